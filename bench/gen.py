@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+
+# Generates a synthetic autopiper design of a given size, for compile-time
+# benchmarks. Each of the design's pipes is an independent entry function:
+#
+# - a chain of |stages| stages of arithmetic on a value read from an input
+#   port,
+# - an if/else tree |if_depth| levels deep in the middle stage,
+# - |arrays| storage arrays, each written and read back once, and
+# - a bypass network with |bypass_writers| writers in successive stages.
+#
+# The design is not meant to compute anything useful, only to exercise each
+# part of the compiler at a size that can be dialed up.
+
+import argparse
+import sys
+
+def gen_ifs(out, depth, var, indent):
+    pad = '    ' * indent
+    if depth == 0:
+        out.append('%s%s = %s + (%s << 1) + %d;' % (pad, var, var, var, indent))
+        return
+    # Only the then-branch nests further, so that the design grows linearly
+    # with depth.
+    out.append('%sif ((%s & %d) != 0) {' % (pad, var, 1 << (depth % 31)))
+    gen_ifs(out, depth - 1, var, indent + 1)
+    out.append('%s} else {' % pad)
+    gen_ifs(out, 0, var, indent + 1)
+    out.append('%s}' % pad)
+
+def gen_pipe(out, index, stages, if_depth, arrays, bypass_writers):
+    # The bypass network needs a stage per writer, plus its start stage.
+    stages = max(stages, bypass_writers + 2, 1)
+    out.append('func entry pipe%d() : void {' % index)
+    out.append('    let in_port : port int32 = port "in%d";' % index)
+    out.append('    let idx_port : port int_4 = port "idx%d";' % index)
+    out.append('    let out_port : port int32 = port "out%d";' % index)
+    for a in range(arrays):
+        out.append('    let arr%d : int32[16] = array;' % a)
+    if bypass_writers > 0:
+        out.append('    let byp : bypass int32 = bypass;')
+    out.append('')
+    out.append('    timing {')
+    out.append('        stage 0;')
+    out.append('        let x = read in_port;')
+    out.append('        let idx = read idx_port;')
+    for a in range(arrays):
+        out.append('        arr%d[idx] = x + %d;' % (a, a))
+    for s in range(1, stages):
+        out.append('')
+        out.append('        stage %d;' % s)
+        out.append('        x = (x + %d) ^ (x >> %d);' % (s, s % 7 + 1))
+        if s == 1:
+            for a in range(arrays):
+                out.append('        x = x + arr%d[idx];' % a)
+            if bypass_writers > 0:
+                out.append('        bypassstart byp, idx;')
+        if s == stages // 2:
+            gen_ifs(out, if_depth, 'x', 2)
+        if bypass_writers > 0 and 2 <= s < 2 + bypass_writers:
+            out.append('        if ((x & %d) == 0)' % (1 << (s % 31)))
+            out.append('            bypasswrite byp, x;')
+    if bypass_writers > 0:
+        out.append('        bypassend byp;')
+    out.append('        write out_port, x;')
+    out.append('    }')
+    out.append('}')
+    out.append('')
+
+def gen_design(pipes, stages, if_depth, arrays, bypass_writers):
+    out = []
+    out.append('# Generated by bench/gen.py: pipes=%d stages=%d if_depth=%d '
+               'arrays=%d bypass_writers=%d' %
+               (pipes, stages, if_depth, arrays, bypass_writers))
+    out.append('')
+    for i in range(pipes):
+        gen_pipe(out, i, stages, if_depth, arrays, bypass_writers)
+    return '\n'.join(out)
+
+def main():
+    parser = argparse.ArgumentParser(
+            description='Generate a synthetic autopiper design.')
+    parser.add_argument('--pipes', type=int, default=1)
+    parser.add_argument('--stages', type=int, default=4)
+    parser.add_argument('--if-depth', type=int, default=0)
+    parser.add_argument('--arrays', type=int, default=0)
+    parser.add_argument('--bypass-writers', type=int, default=0)
+    parser.add_argument('-o', '--output', default='-')
+    args = parser.parse_args()
+
+    text = gen_design(args.pipes, args.stages, args.if_depth, args.arrays,
+                      args.bypass_writers)
+    if args.output == '-':
+        sys.stdout.write(text)
+    else:
+        with open(args.output, 'w') as f:
+            f.write(text)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+
+# Compile-time benchmark harness. Compiles a set of synthetic designs (see
+# gen.py) of increasing size, and reports each pass's time, as measured by
+# `autopiper --time-passes-json`.
+#
+# Each series grows one dimension of the design. For each pass, the harness
+# fits the growth of its time over the series to an exponent (1.0 = linear)
+# and reports a regression if the exponent exceeds --max-exponent, or, given
+# --baseline, if the pass has become more than --max-slowdown times slower
+# than in the recorded baseline. A pass already superlinear in the baseline
+# is only reported if its exponent grows by more than --exponent-slack.
+# Passes faster than --min-ms at the largest size are not judged, as their
+# times are mostly noise.
+#
+# Usage:
+#     run.py --autopiper <binary> [--baseline baseline.json]
+#     run.py --autopiper <binary> --record baseline.json
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+import gen
+
+# The size of a design, before one dimension of it is grown.
+BASE = {
+    'pipes': 1,
+    'stages': 8,
+    'if_depth': 2,
+    'arrays': 1,
+    'bypass_writers': 1,
+}
+
+SERIES = [
+    ('pipes', [8, 16, 32]),
+    ('stages', [16, 32, 64]),
+    ('if_depth', [8, 16, 32]),
+    ('arrays', [4, 8, 16]),
+    ('bypass_writers', [4, 8, 16]),
+]
+
+# Times that pass statistics report as counters rather than as passes.
+COUNTER_TIMES = {
+    'TimePipe': [('timing_dag_solve_us', 'TimingDAGSolve')],
+}
+
+def compile_design(autopiper, params, workdir, repeats):
+    src = os.path.join(workdir, 'design.ap')
+    with open(src, 'w') as f:
+        f.write(gen.gen_design(params['pipes'], params['stages'],
+                               params['if_depth'], params['arrays'],
+                               params['bypass_writers']))
+    times = {}
+    for _ in range(repeats):
+        stats = os.path.join(workdir, 'stats.json')
+        ret = subprocess.call([autopiper, '-o',
+                               os.path.join(workdir, 'design.v'),
+                               '--time-passes-json', stats, src])
+        if ret != 0:
+            raise Exception('Compilation failed for %s' % params)
+        with open(stats) as f:
+            passes = json.load(f)['passes']
+        run = {}
+        for p in passes:
+            run[p['name']] = p['wall_ms']
+            for key, name in COUNTER_TIMES.get(p['name'], []):
+                if key in p['ir']:
+                    run[name] = p['ir'][key] / 1000.0
+        # Keep the fastest of the repeats, the least disturbed by noise.
+        for name, ms in run.items():
+            times[name] = min(times.get(name, ms), ms)
+    return times
+
+def run_series(autopiper, repeats, workdir):
+    results = {}
+    for dim, sizes in SERIES:
+        points = []
+        for size in sizes:
+            params = dict(BASE)
+            params[dim] = size
+            sys.stderr.write('%s = %d\n' % (dim, size))
+            points.append({ 'size': size,
+                            'times': compile_design(autopiper, params,
+                                                    workdir, repeats) })
+        results[dim] = points
+    return results
+
+def growth_exponent(points, name):
+    first, last = points[0], points[-1]
+    t0 = first['times'].get(name, 0.0)
+    t1 = last['times'].get(name, 0.0)
+    if t0 <= 0.0 or t1 <= 0.0:
+        return None
+    return math.log(t1 / t0) / math.log(float(last['size']) / first['size'])
+
+def check(results, baseline, args):
+    failures = []
+    for dim, points in sorted(results.items()):
+        last = points[-1]['times']
+        print('%s (%s):' % (dim, ', '.join(str(p['size']) for p in points)))
+        for name in sorted(last.keys()):
+            ms = last[name]
+            exponent = growth_exponent(points, name)
+            line = '    %-28s %10.3f ms' % (name, ms)
+            if exponent is not None:
+                line += '   n^%.2f' % exponent
+            judged = ms >= args.min_ms
+            max_exponent = args.max_exponent
+            if baseline and dim in baseline:
+                base_exponent = growth_exponent(baseline[dim], name)
+                if base_exponent is not None:
+                    max_exponent = max(max_exponent,
+                                       base_exponent + args.exponent_slack)
+            if judged and exponent is not None and exponent > max_exponent:
+                line += '   SUPERLINEAR'
+                failures.append('%s: %s grows as n^%.2f' %
+                                (dim, name, exponent))
+            if judged and baseline and dim in baseline:
+                base_ms = baseline[dim][-1]['times'].get(name)
+                if base_ms:
+                    line += '   (baseline %.3f ms)' % base_ms
+                    if ms > base_ms * args.max_slowdown:
+                        line += '   SLOWER'
+                        failures.append('%s: %s took %.3f ms, baseline %.3f ms'
+                                        % (dim, name, ms, base_ms))
+            print(line)
+    return failures
+
+def main():
+    parser = argparse.ArgumentParser(description='Compile-time benchmarks.')
+    parser.add_argument('--autopiper', required=True,
+                        help='the autopiper binary to benchmark')
+    parser.add_argument('--baseline',
+                        help='results to compare against')
+    parser.add_argument('--record',
+                        help='write results to this file as a new baseline')
+    parser.add_argument('--repeats', type=int, default=3)
+    parser.add_argument('--max-exponent', type=float, default=1.5)
+    parser.add_argument('--exponent-slack', type=float, default=0.3)
+    parser.add_argument('--max-slowdown', type=float, default=2.0)
+    parser.add_argument('--min-ms', type=float, default=1.0)
+    args = parser.parse_args()
+
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    workdir = tempfile.mkdtemp(prefix='autopiper-bench-')
+    try:
+        results = run_series(args.autopiper, args.repeats, workdir)
+    finally:
+        for name in os.listdir(workdir):
+            os.unlink(os.path.join(workdir, name))
+        os.rmdir(workdir)
+
+    if args.record:
+        with open(args.record, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write('\n')
+
+    failures = check(results, baseline, args)
+    if failures:
+        print('')
+        print('Regressions:')
+        for f in failures:
+            print('    ' + f)
+        return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
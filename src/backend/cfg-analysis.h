@@ -0,0 +1,90 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_CFG_ANALYSIS_H_
+#define _AUTOPIPER_CFG_ANALYSIS_H_
+
+#include "backend/ir.h"
+#include "backend/rpo.h"
+#include "backend/domtree.h"
+
+#include <memory>
+#include <vector>
+
+namespace autopiper {
+
+// Caches the CFG analyses that several passes share -- reverse postorder and
+// the dominator tree from a given set of roots -- so that each is computed
+// once per CFG rather than once per pass. One instance covers the whole
+// program (IRProgram::Analyses()) and one each pipe (Pipe::analyses).
+//
+// The analyses stay valid as long as the CFG does: passes that only add,
+// remove or rewrite non-terminator statements may keep using them. A pass
+// that changes the CFG (retargets a terminator, or adds or removes BBs that
+// are reachable) must call Invalidate() once it is done with any analysis
+// obtained before the change, since invalidation frees them.
+class CFGAnalyses {
+ public:
+  CFGAnalyses() {}
+
+  const BBReversePostorder& RPO(const std::vector<const IRBB*>& roots) {
+      Entry* e = Find(roots);
+      if (!e->rpo) {
+          e->rpo.reset(new BBReversePostorder());
+          e->rpo->Compute(roots);
+      }
+      return *e->rpo;
+  }
+
+  const BBDomTree& DomTree(const std::vector<const IRBB*>& roots) {
+      Entry* e = Find(roots);
+      if (!e->domtree) {
+          const BBReversePostorder& rpo = RPO(roots);
+          e->domtree.reset(new BBDomTree());
+          e->domtree->Compute(rpo);
+      }
+      return *e->domtree;
+  }
+
+  void Invalidate() {
+      entries_.clear();
+  }
+
+ private:
+  // Analyses from one set of roots. Few distinct sets are ever used on one
+  // CFG (e.g. a pipe's entry alone, or all of its roots), so these are kept
+  // in a short list.
+  struct Entry {
+      std::vector<const IRBB*> roots;
+      std::unique_ptr<BBReversePostorder> rpo;
+      std::unique_ptr<BBDomTree> domtree;
+  };
+  std::vector<std::unique_ptr<Entry>> entries_;
+
+  Entry* Find(const std::vector<const IRBB*>& roots) {
+      for (auto& e : entries_) {
+          if (e->roots == roots) return e.get();
+      }
+      std::unique_ptr<Entry> e(new Entry());
+      e->roots = roots;
+      entries_.push_back(std::move(e));
+      return entries_.back().get();
+  }
+};
+
+}  // namespace autopiper
+
+#endif
@@ -15,6 +15,7 @@
  */
 
 #include "backend/cmdline-driver.h"
+#include "backend/pipe.h"
 #include "common/util.h"
 #include "common/error-collector.h"
 #include "common/parse-args.h"
@@ -23,6 +24,10 @@
 
 #include <string>
 #include <iostream>
+#include <thread>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -32,9 +37,110 @@ static const char* kUsage =
     "Usage: autopiper-backend [flags] <input>\n"
     "    Flags:\n"
     "        -o <filename>:   specify the Verilog output filename (<input>.v by default).\n"
+    "        --cmodel <filename>:\n"
+    "                         also write a cycle-based C++ model to the given file.\n"
+    "        --bitsliced-cmodel <filename>:\n"
+    "                         also write a bit-sliced C++ model, which simulates\n"
+    "                         64 (or, with AVX2, 256) copies of the design at\n"
+    "                         once, to the given file.\n"
+    "        --bundle-piperegs:\n"
+    "                         emit one wide pipereg per stage boundary and set of\n"
+    "                         controls instead of one per signal.\n"
+    "        --specialize-piperegs:\n"
+    "                         reset only the piperegs of valid and control\n"
+    "                         bits; data piperegs load only when valid.\n"
+    "        --retime-piperegs:\n"
+    "                         as --specialize-piperegs, with the data\n"
+    "                         piperegs marked for retiming by synthesis.\n"
+    "        --verilator:     write Verilog that lints clean under Verilator.\n"
+    "        --hierarchical:  write each pipe as its own module, under a top\n"
+    "                         module that connects them.\n"
+    "        --timing-model <model>:\n"
+    "                         override the program's timing model: 'null',\n"
+    "                         'standard', or 'library:<file>' for a delay table.\n"
+    "        --minimize-registers:\n"
+    "                         move computations within their timing slack to\n"
+    "                         minimize pipeline register bits.\n"
+    "        --balance-stages:\n"
+    "                         spread computations over the stages to shorten\n"
+    "                         the fullest stage, keeping the stage count.\n"
+    "        --max-stages <N>:\n"
+    "                         time each pipe with the smallest delay per stage\n"
+    "                         that fits it in N stages, and report that delay.\n"
+    "        --minimize-predicates:\n"
+    "                         minimize valid-signal logic, sharing one signal\n"
+    "                         between equivalent predicates.\n"
+    "        --share-kill-if-slices:\n"
+    "                         evaluate each kill_if condition once per cycle\n"
+    "                         for all downstream stages.\n"
+    "        --propagate-predicates:\n"
+    "                         simplify logic under the facts its valid\n"
+    "                         predicate implies, and remove never-valid logic.\n"
+    "        --register-inputs, --register-outputs:\n"
+    "                         register each exported input (output) port at\n"
+    "                         the module boundary, unless it has a latency.\n"
+    "        --bank-arrays:   split arrays into banks by low index bits where\n"
+    "                         that gives each bank fewer ports.\n"
+    "        --elastic <N>:   stall elastically, with an N-entry skid buffer at\n"
+    "                         the input of each elastic stage.\n"
+    "        --elastic-stages <list>:\n"
+    "                         with --elastic, make only the given stages (e.g.\n"
+    "                         '2,4') elastic rather than all that can be.\n"
+    "        --perf-counters <file>:\n"
+    "                         count each stage's valid, stall, kill, bypass-wait\n"
+    "                         and spawn-stall cycles in a counter bank, and\n"
+    "                         write its layout to the given file as JSON.\n"
+    "        --profile <file>:\n"
+    "                         have the Verilog and C++ models trace each\n"
+    "                         cycle's stage and transaction events, for\n"
+    "                         tools/txn_profile.py, and write the trace's\n"
+    "                         layout to the given file as JSON.\n"
+    "        --no-fold:       do not fold constants or remove dead code.\n"
+    "        --no-cse:        do not eliminate common subexpressions.\n"
+    "        --no-narrow:     do not narrow arithmetic to its operands' known\n"
+    "                         significant bits.\n"
+    "        --narrow-report <file>:\n"
+    "                         write each value narrowed, and by how much, to\n"
+    "                         the given file.\n"
+    "        --timing-report <file>:\n"
+    "                         write each stage's critical path and slack to the\n"
+    "                         given file.\n"
+    "        --timing-report-paths <N>:\n"
+    "                         list the N worst paths in the timing report (10).\n"
+    "        --throughput-report <file>:\n"
+    "                         write each pipe's depth and each loop's latency\n"
+    "                         and stalls, with the throughput they allow, to\n"
+    "                         the given file.\n"
     "        --print-ir:      print IR as parsed, before transforms or lowering.\n"
+    "        --ir-binary-output <file>:\n"
+    "                         write the IR as parsed to the given file in binary\n"
+    "                         form, which loads faster than text IR.\n"
     "        --print-lowered: print program as lowered to pipeline form,\n"
     "                         before code generation occurs.\n"
+    "        --lowered-output <file>:\n"
+    "                         write the lowered pipeline form to the given file.\n"
+    "        --print-pipe <label>:\n"
+    "                         print only the lowered pipes entered at the given\n"
+    "                         BB (may be given more than once).\n"
+    "        --print-stages <N>[-<M>]:\n"
+    "                         print only the lowered stages N through M.\n"
+    "        -j <N>:          lower up to N independent pipelines concurrently\n"
+    "                         (and with --hierarchical, generate up to N\n"
+    "                         modules concurrently).\n"
+    "        --cache-dir <dir>:\n"
+    "                         reuse outputs cached in the given directory when\n"
+    "                         the IR and options are unchanged.\n"
+    "        --server <socket>:\n"
+    "                         stay resident, serving compile requests on the\n"
+    "                         given Unix socket.\n"
+    "        --connect <socket>:\n"
+    "                         send this compile to the server on the given\n"
+    "                         socket.\n"
+    "        --shutdown-server:\n"
+    "                         with --connect, ask the server to exit instead.\n"
+    "        --time-passes:   print per-pass time, memory and IR size to stderr.\n"
+    "        --time-passes-json <file>:\n"
+    "                         write per-pass statistics to the given file as JSON.\n"
     "        -h, --help:      print this help message.\n"
     "        -v, --version:   print version and license information.\n";
 
@@ -74,12 +180,155 @@ class BackendFlags : public CmdlineParser {
             if (flag == "--print-ir") {
                 driver_->options_.print_ir = true;
                 return FLAG_CONSUMED_KEY;
+            } else if (flag == "--ir-binary-output") {
+                driver_->options_.ir_binary_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
             } else if (flag == "--print-lowered") {
                 driver_->options_.print_lowered = true;
                 return FLAG_CONSUMED_KEY;
+            } else if (flag == "--lowered-output") {
+                driver_->options_.lowered_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--print-pipe") {
+                driver_->options_.print_pipes.push_back(value);
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--print-stages") {
+                if (!PipeDumpFilter::ParseStageRange(
+                            value, &driver_->options_.print_first_stage,
+                            &driver_->options_.print_last_stage)) {
+                    throw autopiper::Exception(
+                            "--print-stages requires a stage number or "
+                            "range (e.g. '2-4').");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--time-passes") {
+                driver_->time_passes_ = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--time-passes-json") {
+                driver_->time_passes_json_ = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "-j") {
+                driver_->options_.jobs = atoi(value.c_str());
+                if (driver_->options_.jobs < 1) {
+                    throw autopiper::Exception("-j requires a positive job count.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--cache-dir") {
+                driver_->options_.cache_dir = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--server") {
+                driver_->server_socket_ = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--connect") {
+                driver_->connect_socket_ = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--shutdown-server") {
+                driver_->shutdown_server_ = true;
+                return FLAG_CONSUMED_KEY;
             } else if (flag == "-o") {
                 driver_->options_.output = value;
                 return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--cmodel") {
+                driver_->options_.cmodel_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--bitsliced-cmodel") {
+                driver_->options_.bitsliced_cmodel_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--bundle-piperegs") {
+                driver_->options_.bundle_piperegs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--specialize-piperegs") {
+                driver_->options_.specialize_piperegs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--retime-piperegs") {
+                driver_->options_.retime_piperegs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--verilator") {
+                driver_->options_.verilator = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--hierarchical") {
+                driver_->options_.hierarchical = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--timing-model") {
+                driver_->options_.timing_model = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--minimize-registers") {
+                driver_->options_.minimize_registers = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--balance-stages") {
+                driver_->options_.balance_stages = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--max-stages") {
+                driver_->options_.max_stages = atoi(value.c_str());
+                if (driver_->options_.max_stages < 1) {
+                    throw autopiper::Exception(
+                            "--max-stages requires a positive stage count.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--minimize-predicates") {
+                driver_->options_.minimize_predicates = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--share-kill-if-slices") {
+                driver_->options_.share_kill_if_slices = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--propagate-predicates") {
+                driver_->options_.propagate_predicates = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--register-inputs") {
+                driver_->options_.register_inputs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--register-outputs") {
+                driver_->options_.register_outputs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--bank-arrays") {
+                driver_->options_.bank_arrays = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--elastic") {
+                driver_->options_.skid_depth = atoi(value.c_str());
+                if (driver_->options_.skid_depth < 1) {
+                    throw autopiper::Exception(
+                            "--elastic requires a positive skid-buffer depth.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--elastic-stages") {
+                if (!IRProgram::ParseStageList(
+                            value, &driver_->options_.elastic_stages)) {
+                    throw autopiper::Exception(
+                            "--elastic-stages requires a comma-separated list "
+                            "of stage numbers.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--perf-counters") {
+                driver_->options_.perf_counters = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--profile") {
+                driver_->options_.profile = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--no-fold") {
+                driver_->options_.fold_constants = false;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--no-cse") {
+                driver_->options_.cse = false;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--no-narrow") {
+                driver_->options_.narrow_widths = false;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--narrow-report") {
+                driver_->options_.narrow_report = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--timing-report") {
+                driver_->options_.timing_report = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--timing-report-paths") {
+                driver_->options_.timing_report_paths = atoi(value.c_str());
+                if (driver_->options_.timing_report_paths < 0) {
+                    throw autopiper::Exception(
+                            "--timing-report-paths requires a non-negative count.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--throughput-report") {
+                driver_->options_.throughput_report = value;
+                return FLAG_CONSUMED_KEY_VALUE;
             } else if (flag == "-h" || flag == "--help") {
                 cerr << kUsage;
                 throw autopiper::Exception("No compilation performed.");
@@ -108,16 +357,116 @@ class BackendFlags : public CmdlineParser {
 };
 
 void BackendCmdlineDriver::ParseArgs(int argc, const char* const* argv) {
+    args_.assign(argv, argv + argc);
     BackendFlags parser(this, argc, argv);
     parser.Parse();
+    if (shutdown_server_ && connect_socket_.empty()) {
+        throw autopiper::Exception("--shutdown-server requires --connect.");
+    }
+}
+
+int BackendCmdlineDriver::Execute() {
+    if (!server_socket_.empty()) {
+        return Serve();
+    } else if (!connect_socket_.empty()) {
+        return Connect();
+    }
+    Compile(&cerr);
+    return 0;
 }
 
-void BackendCmdlineDriver::Execute() {
+void BackendCmdlineDriver::Compile(ostream* diagnostics) {
     BackendCompiler compiler_;
-    CmdlineErrorCollector collector(&std::cerr);
-    if (!compiler_.CompileFile(options_, &collector)) {
+    CmdlineErrorCollector collector(diagnostics);
+    PassStats stats;
+    if (time_passes_ || !time_passes_json_.empty()) {
+        options_.pass_stats = &stats;
+    }
+    bool ok = compiler_.CompileFile(options_, &collector);
+    if (options_.pass_stats) {
+        stats.Report(time_passes_ ? diagnostics : nullptr, time_passes_json_);
+    }
+    if (!ok) {
         throw autopiper::Exception("Compilation failed.");
     }
 }
 
+int BackendCmdlineDriver::Serve() {
+    int max_concurrent = std::thread::hardware_concurrency();
+    CompileServer server(
+            server_socket_, max_concurrent > 0 ? max_concurrent : 1,
+            [this](const CompileServer::Request& request, ostream* out) {
+                return ServeRequest(request, out);
+            });
+    server.Serve();
+    return 0;
+}
+
+int BackendCmdlineDriver::ServeRequest(
+        const CompileServer::Request& request, ostream* out) {
+    BackendCmdlineDriver driver;
+    try {
+        vector<const char*> argv;
+        for (auto& arg : request.args) {
+            argv.push_back(arg.c_str());
+        }
+        driver.ParseArgs(argv.size(), argv.data());
+        if (!driver.server_socket_.empty() ||
+            !driver.connect_socket_.empty()) {
+            throw autopiper::Exception(
+                    "A compile request cannot start or contact a server.");
+        }
+        // The server's standard output is not the client's.
+        if (driver.options_.print_ir || driver.options_.print_lowered) {
+            throw autopiper::Exception(
+                    "Printing flags are not supported by the compile server.");
+        }
+        driver.ResolvePaths(request.cwd);
+        driver.Compile(out);
+    } catch (autopiper::Exception& e) {
+        (*out) << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int BackendCmdlineDriver::Connect() {
+    if (shutdown_server_) {
+        CompileServer::Shutdown(connect_socket_);
+        return 0;
+    }
+    CompileServer::Request request;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd))) {
+        request.cwd = cwd;
+    }
+    for (size_t i = 0; i < args_.size(); i++) {
+        if (args_[i] == "--connect") {
+            i++;
+            continue;
+        }
+        request.args.push_back(args_[i]);
+    }
+    return CompileServer::Send(connect_socket_, request, &cerr);
+}
+
+void BackendCmdlineDriver::ResolvePaths(const string& dir) {
+    static const string kLibraryPrefix = "library:";
+    BackendCompiler::Options& o = options_;
+    for (string* path : { &o.filename, &o.ir_binary_output,
+                          &o.lowered_output, &o.output,
+                          &o.cmodel_output, &o.bitsliced_cmodel_output,
+                          &o.perf_counters, &o.profile,
+                          &o.narrow_report, &o.timing_report,
+                          &o.throughput_report, &o.cache_dir,
+                          &time_passes_json_ }) {
+        *path = CompileServer::ResolvePath(dir, *path);
+    }
+    if (o.timing_model.compare(0, kLibraryPrefix.size(),
+                               kLibraryPrefix) == 0) {
+        o.timing_model = kLibraryPrefix + CompileServer::ResolvePath(
+                dir, o.timing_model.substr(kLibraryPrefix.size()));
+    }
+}
+
 }  // namespace autopiper
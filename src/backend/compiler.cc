@@ -18,14 +18,111 @@
 #include "backend/ir.h"
 #include "backend/pipe.h"
 #include "backend/gen-verilog.h"
+#include "backend/pipe-timing.h"
 
 #include <fstream>
+#include <iostream>
 #include <memory>
+#include <sstream>
 
 using namespace std;
 
 namespace autopiper {
 
+// Writes the C++ model of |systems| (see CppModelGenerator) to |path|.
+static bool WriteCppModel(const string& path,
+                          const vector<PipeSys*>& systems, bool bit_sliced,
+                          PassStats* pass_stats, ErrorCollector* collector) {
+    ofstream model_out(path);
+    if (!model_out.good()) {
+        Location loc;
+        loc.filename = path;
+        loc.line = loc.column = 0;
+        collector->ReportError(loc, ErrorCollector::ERROR,
+                               string("Could not open file '") + path +
+                               string("'"));
+        return false;
+    }
+    Printer model_printer(&model_out);
+
+    PassStats::Scope scope(pass_stats, bit_sliced ?
+                           "BitSlicedModelGenerator" : "CppModelGenerator");
+    CppModelGenerator gen(&model_printer, systems, "main", bit_sliced);
+    gen.Generate();
+    model_printer.Flush();
+    model_out.close();
+    return true;
+}
+
+static long CountStmts(const IRProgram* prog) {
+    long count = 0;
+    for (auto& bb : prog->bbs) {
+        count += bb->stmts.size();
+    }
+    return count;
+}
+
+// A library timing model is only named by the program or options, so its
+// table file's contents are hashed too.
+static void HashTimingModel(const string& name, ContentHash* hash) {
+    static const string kLibraryPrefix = "library:";
+    hash->Add(name);
+    if (name.compare(0, kLibraryPrefix.size(), kLibraryPrefix) == 0) {
+        hash->AddFile(name.substr(kLibraryPrefix.size()));
+    }
+}
+
+bool BackendCompiler::CanUseCache(const Options& options) {
+    return !options.cache_dir.empty() &&
+           options.narrow_report.empty() &&
+           options.timing_report.empty() &&
+           options.throughput_report.empty() &&
+           options.perf_counters.empty() &&
+           options.profile.empty() &&
+           !options.print_lowered &&
+           options.lowered_output.empty();
+}
+
+void BackendCompiler::HashOptions(const Options& options, ContentHash* hash) {
+    hash->Add(options.bundle_piperegs);
+    hash->Add(options.specialize_piperegs);
+    hash->Add(options.retime_piperegs);
+    hash->Add(options.verilator);
+    hash->Add(options.hierarchical);
+    HashTimingModel(options.timing_model, hash);
+    hash->Add(options.minimize_registers);
+    hash->Add(options.balance_stages);
+    hash->Add(options.max_stages);
+    hash->Add(options.minimize_predicates);
+    hash->Add(options.share_kill_if_slices);
+    hash->Add(options.propagate_predicates);
+    hash->Add(options.register_inputs);
+    hash->Add(options.register_outputs);
+    hash->Add(options.bank_arrays);
+    hash->Add(options.skid_depth);
+    hash->Add(static_cast<int>(options.elastic_stages.size()));
+    for (int stage : options.elastic_stages) {
+        hash->Add(stage);
+    }
+    hash->Add(options.fold_constants);
+    hash->Add(options.cse);
+    hash->Add(options.narrow_widths);
+}
+
+vector<BuildCache::Artifact> BackendCompiler::CacheArtifacts(
+        const Options& options) {
+    vector<BuildCache::Artifact> artifacts;
+    artifacts.push_back({ "v", options.output });
+    if (!options.cmodel_output.empty()) {
+        artifacts.push_back({ "cc", options.cmodel_output });
+    }
+    if (!options.bitsliced_cmodel_output.empty()) {
+        artifacts.push_back({ "bitsliced.cc",
+                              options.bitsliced_cmodel_output });
+    }
+    return artifacts;
+}
+
 bool BackendCompiler::CompileFile(
         const Options& options,
         ErrorCollector* collector) {
@@ -35,43 +132,243 @@ bool BackendCompiler::CompileFile(
     if (options.input_ir) {
         prog = options.input_ir;
     } else {
-        ifstream in(options.filename);
-        if (!in.good()) {
+        // Text or binary IR, detected by the file's contents.
+        PassStats::Scope scope(options.pass_stats, "IRParse");
+        parsed_prog = IRProgram::Load(options.filename, collector);
+        prog = parsed_prog.get();
+        if (!prog) return false;
+        scope.SetSize("stmts", prog->NumStmts());
+        scope.SetSize("bbs", prog->bbs.size());
+    }
+
+    {
+        PassStats::Scope scope(options.pass_stats, "Crosslink");
+        if (!prog->Crosslink(collector)) return false;
+    }
+    {
+        PassStats::Scope scope(options.pass_stats, "Typecheck");
+        if (!prog->Typecheck(collector)) return false;
+    }
+
+    if (!options.ir_binary_output.empty()) {
+        ofstream ir_out(options.ir_binary_output, ios::binary);
+        if (!ir_out.good()) {
             Location loc;
-            loc.filename = options.filename;
+            loc.filename = options.ir_binary_output;
             loc.line = loc.column = 0;
             collector->ReportError(loc, ErrorCollector::ERROR,
                                    string("Could not open file '") +
-                                   options.filename +
+                                   options.ir_binary_output +
                                    string("'"));
             return false;
         }
+        PassStats::Scope scope(options.pass_stats, "IRWriteBinary");
+        prog->WriteBinary(&ir_out);
+    }
 
-        parsed_prog = IRProgram::Parse(options.filename, &in, collector);
-        prog = parsed_prog.get();
-        in.close();
-        if (!prog) return false;
+    if (options.print_ir) {
+        cout << "# IR:" << endl;
+        prog->Print(&cout);
+        cout << endl;
     }
 
-    if (!prog->Crosslink(collector)) return false;
-    if (!prog->Typecheck(collector)) return false;
+    // Outputs depend only on the checked program and the options, so a
+    // hash of the two keys the cache.
+    bool use_cache = CanUseCache(options);
+    BuildCache cache(options.cache_dir);
+    string cache_key;
+    if (use_cache) {
+        PassStats::Scope scope(options.pass_stats, "IRCacheLookup");
+        ostringstream ir_bin;
+        prog->WriteBinary(&ir_bin);
+        ContentHash hash;
+        hash.Add("ir");
+        hash.AddCompilerIdentity();
+        HashOptions(options, &hash);
+        HashTimingModel(prog->timing_model, &hash);
+        hash.Add(ir_bin.str());
+        cache_key = hash.Hex();
+        if (cache.Fetch(cache_key, CacheArtifacts(options))) {
+            scope.AddCount("hits", 1);
+            return true;
+        }
+    }
 
-    if (options.print_ir) {
-        printf("IR:\n%s\n", prog->ToString().c_str());
+    if (options.fold_constants) {
+        PassStats::Scope scope(options.pass_stats, "FoldConstants");
+        scope.SetSize("stmts_before", CountStmts(prog));
+        scope.SetSize("bbs_before", prog->bbs.size());
+        prog->FoldConstants();
+        scope.SetSize("stmts_after", CountStmts(prog));
+        scope.SetSize("bbs_after", prog->bbs.size());
+    }
+    if (options.cse) {
+        PassStats::Scope scope(options.pass_stats, "CSE");
+        long stmts_before = CountStmts(prog);
+        int removed = prog->EliminateCommonSubexprs();
+        scope.SetSize("stmts_before", stmts_before);
+        scope.SetSize("stmts_after", stmts_before - removed);
+    }
+    if (options.narrow_widths) {
+        unique_ptr<ofstream> report_out;
+        if (!options.narrow_report.empty()) {
+            report_out.reset(new ofstream(options.narrow_report));
+            if (!report_out->good()) {
+                Location loc;
+                loc.filename = options.narrow_report;
+                loc.line = loc.column = 0;
+                collector->ReportError(loc, ErrorCollector::ERROR,
+                                       string("Could not open file '") +
+                                       options.narrow_report +
+                                       string("'"));
+                return false;
+            }
+        }
+        PassStats::Scope scope(options.pass_stats, "NarrowWidths");
+        scope.AddCount("narrowed", prog->NarrowWidths(report_out.get()));
     }
 
-    vector<unique_ptr<PipeSys>> pipesystems = prog->Lower(collector);
+    if (!options.timing_model.empty()) {
+        prog->timing_model = options.timing_model;
+    }
+    if (options.minimize_registers) {
+        prog->minimize_registers = true;
+    }
+    if (options.balance_stages) {
+        prog->balance_stages = true;
+    }
+    if (options.max_stages > 0) {
+        prog->max_stages = options.max_stages;
+    }
+    if (options.minimize_predicates) {
+        prog->minimize_predicates = true;
+    }
+    if (options.share_kill_if_slices) {
+        prog->share_kill_if_slices = true;
+    }
+    if (options.propagate_predicates) {
+        prog->propagate_predicates = true;
+    }
+    if (options.register_inputs) {
+        prog->register_inputs = true;
+    }
+    if (options.register_outputs) {
+        prog->register_outputs = true;
+    }
+    if (options.bank_arrays) {
+        prog->bank_arrays = true;
+    }
+    if (options.skid_depth > 0) {
+        prog->skid_depth = options.skid_depth;
+    }
+    if (!options.elastic_stages.empty()) {
+        prog->elastic_stages = options.elastic_stages;
+    }
+    if (!options.perf_counters.empty()) {
+        prog->perf_counters = true;
+    }
+    if (!options.profile.empty()) {
+        prog->profile = true;
+    }
+
+    vector<unique_ptr<PipeSys>> pipesystems =
+        prog->Lower(collector, options.jobs, options.pass_stats);
     if (pipesystems.empty()) return false;
     vector<PipeSys*> systems;
     for (auto& sys : pipesystems) {
         systems.push_back(sys.get());
     }
 
-    if (options.print_lowered) {
-        printf("Lowered pipeline form:\n");
-        for (auto& pipesys : pipesystems) {
-            printf("%s\n", pipesys->ToString().c_str());
+    if (options.print_lowered || !options.lowered_output.empty()) {
+        PipeDumpFilter filter;
+        filter.pipes.insert(options.print_pipes.begin(),
+                            options.print_pipes.end());
+        filter.first_stage = options.print_first_stage;
+        filter.last_stage = options.print_last_stage;
+        if (options.print_lowered) {
+            cout << "# Lowered pipeline form:" << endl;
+            for (auto& pipesys : pipesystems) {
+                pipesys->Print(&cout, filter);
+                cout << endl;
+            }
+        }
+        if (!options.lowered_output.empty()) {
+            ofstream lowered_out(options.lowered_output);
+            if (!lowered_out.good()) {
+                Location loc;
+                loc.filename = options.lowered_output;
+                loc.line = loc.column = 0;
+                collector->ReportError(loc, ErrorCollector::ERROR,
+                                       string("Could not open file '") +
+                                       options.lowered_output +
+                                       string("'"));
+                return false;
+            }
+            for (auto& pipesys : pipesystems) {
+                pipesys->Print(&lowered_out, filter);
+            }
+        }
+    }
+
+    if (!options.timing_report.empty()) {
+        ofstream report_out(options.timing_report);
+        if (!report_out.good()) {
+            Location loc;
+            loc.filename = options.timing_report;
+            loc.line = loc.column = 0;
+            collector->ReportError(loc, ErrorCollector::ERROR,
+                                   string("Could not open file '") +
+                                   options.timing_report +
+                                   string("'"));
+            return false;
+        }
+        PipeTimer::WriteReport(&report_out, systems,
+                               options.timing_report_paths);
+    }
+
+    if (!options.throughput_report.empty()) {
+        ofstream report_out(options.throughput_report);
+        if (!report_out.good()) {
+            Location loc;
+            loc.filename = options.throughput_report;
+            loc.line = loc.column = 0;
+            collector->ReportError(loc, ErrorCollector::ERROR,
+                                   string("Could not open file '") +
+                                   options.throughput_report +
+                                   string("'"));
+            return false;
+        }
+        WriteThroughputReport(&report_out, systems);
+    }
+
+    if (!options.perf_counters.empty()) {
+        ofstream layout_out(options.perf_counters);
+        if (!layout_out.good()) {
+            Location loc;
+            loc.filename = options.perf_counters;
+            loc.line = loc.column = 0;
+            collector->ReportError(loc, ErrorCollector::ERROR,
+                                   string("Could not open file '") +
+                                   options.perf_counters +
+                                   string("'"));
+            return false;
         }
+        PipeGenerator::WritePerfCounterLayout(&layout_out, systems, "main");
+    }
+
+    if (!options.profile.empty()) {
+        ofstream layout_out(options.profile);
+        if (!layout_out.good()) {
+            Location loc;
+            loc.filename = options.profile;
+            loc.line = loc.column = 0;
+            collector->ReportError(loc, ErrorCollector::ERROR,
+                                   string("Could not open file '") +
+                                   options.profile +
+                                   string("'"));
+            return false;
+        }
+        PipeGenerator::WriteProfileLayout(&layout_out, systems, "main");
     }
 
     ofstream out(options.output);
@@ -86,9 +383,32 @@ bool BackendCompiler::CompileFile(
     }
     Printer out_printer(&out);
 
-    VerilogGenerator gen(&out_printer, systems, "main");
-    gen.Generate();
-    out.close();
+    {
+        PassStats::Scope scope(options.pass_stats, "VerilogGenerator");
+        VerilogGenerator gen(&out_printer, systems, "main",
+                             options.bundle_piperegs, options.verilator,
+                             options.hierarchical,
+                             options.specialize_piperegs,
+                             options.retime_piperegs, options.jobs);
+        gen.Generate();
+        out_printer.Flush();
+        out.close();
+    }
+
+    if (!options.cmodel_output.empty() &&
+        !WriteCppModel(options.cmodel_output, systems, false,
+                       options.pass_stats, collector)) {
+        return false;
+    }
+    if (!options.bitsliced_cmodel_output.empty() &&
+        !WriteCppModel(options.bitsliced_cmodel_output, systems, true,
+                       options.pass_stats, collector)) {
+        return false;
+    }
+
+    if (use_cache && !collector->HasErrors()) {
+        cache.Store(cache_key, CacheArtifacts(options));
+    }
 
     return true;
 }
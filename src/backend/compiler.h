@@ -18,11 +18,15 @@
 #define _AUTOPIPER_COMPILER_H_
 
 #include "backend/ir.h"
+#include "common/build-cache.h"
 #include "common/parser-utils.h"
+#include "common/pass-stats.h"
 
 #include <boost/noncopyable.hpp>
 #include <string>
+#include <vector>
 #include <memory>
+#include <vector>
 
 namespace autopiper {
 
@@ -32,28 +36,195 @@ class BackendCompiler : public boost::noncopyable {
         ~BackendCompiler() { }
 
         struct Options {
-            // Specify exactly one of input_ir or filename (a text IR file).
+            // Specify exactly one of input_ir or filename (a text or binary
+            // IR file).
             IRProgram* input_ir;
             std::string filename;
 
+            // Binary IR output, if non-empty: the program as checked, before
+            // any transforms.
+            std::string ir_binary_output;
+
             // Verilog output.
             std::string output;
 
+            // C++ model output, if non-empty.
+            std::string cmodel_output;
+            // Bit-sliced C++ model output, if non-empty: see
+            // CppModelGenerator.
+            std::string bitsliced_cmodel_output;
+
+            // Pack the piperegs at each stage boundary into shared wide
+            // instances in the Verilog output.
+            bool bundle_piperegs;
+
+            // Reset only the piperegs of control values, and carry data in
+            // enable-gated piperegs without reset; with retime_piperegs,
+            // in ones that synthesis may retime. See VerilogGenerator.
+            bool specialize_piperegs;
+            bool retime_piperegs;
+
+            // Write Verilog that lints clean under Verilator, for two-state
+            // cycle-based simulation: see VerilogGenerator.
+            bool verilator;
+
+            // Write each pipe as its own Verilog module, under a top module
+            // that connects them: see VerilogGenerator.
+            bool hierarchical;
+
+            // Timing model to use in place of the program's own, if
+            // non-empty; see TimingModel::New().
+            std::string timing_model;
+
+            // Place computations to minimize pipeline register bits (also
+            // enabled by pragma minimize_registers = "true").
+            bool minimize_registers;
+
+            // Spread computations over the stages to shorten the fullest
+            // stage, at the same stage count (also enabled by pragma
+            // balance_stages = "true").
+            bool balance_stages;
+
+            // If nonzero, time each pipe with the smallest delay per stage
+            // that fits it in this many stages (also set by pragma
+            // max_stages).
+            int max_stages;
+
+            // Minimize valid-signal predicates with their truth tables, and
+            // share one signal between equivalent ones (also enabled by
+            // pragma minimize_predicates = "true").
+            bool minimize_predicates;
+
+            // Evaluate each kill_if condition once per cycle and share it
+            // between the downstream stages, rather than cloning it into each
+            // (also enabled by pragma share_kill_if_slices = "true").
+            bool share_kill_if_slices;
+
+            // Simplify logic using the facts that each statement's valid
+            // predicate implies, and remove statements that can never be
+            // valid (also enabled by pragma propagate_predicates = "true").
+            bool propagate_predicates;
+
+            // Register each exported input and output that declares no
+            // latency of its own at the module boundary (also enabled by
+            // pragmas register_inputs and register_outputs = "true").
+            bool register_inputs;
+            bool register_outputs;
+
+            // Split arrays into banks where that gives each bank fewer ports
+            // (also enabled by pragma bank_arrays = "true").
+            bool bank_arrays;
+
+            // Elastic stalls: skid-buffer entries at the input of each
+            // elastic stage, if nonzero, and the elastic stages, if not all
+            // that can be (also set by pragmas elastic and elastic_stages).
+            int skid_depth;
+            std::vector<int> elastic_stages;
+
+            // Performance-counter layout output, if non-empty: instantiate
+            // a counter for each stage's performance events (also enabled
+            // by pragma perf_counters = "true") and describe the counter
+            // bank here as JSON.
+            std::string perf_counters;
+
+            // Profile layout output, if non-empty: have the Verilog and the
+            // C++ models write a trace of each cycle's performance events
+            // and of the statements that spawn, end, kill and stall
+            // transactions, once a trace file is given to them, and
+            // describe the trace here as JSON (see tools/txn_profile.py).
+            std::string profile;
+
+            // Fold constants and remove dead code before lowering.
+            bool fold_constants;
+
+            // Eliminate common subexpressions before lowering.
+            bool cse;
+
+            // Narrow arithmetic to its operands' significant bits before
+            // lowering, writing what was narrowed to |narrow_report| if
+            // non-empty.
+            bool narrow_widths;
+            std::string narrow_report;
+
+            // Per-stage critical path report output, if non-empty, listing
+            // |timing_report_paths| worst paths overall.
+            std::string timing_report;
+            int timing_report_paths;
+
+            // Throughput report output, if non-empty: each pipe's depth and
+            // each backedge's loop-carried latency, the stalls it causes and
+            // the resulting bound on transactions per cycle.
+            std::string throughput_report;
+
             // Print IR before transforming in the backend.
             bool print_ir;
 
-            // Print lowered pipeline form before generating Verilog.
+            // Print lowered pipeline form before generating Verilog, and
+            // write it to |lowered_output| if non-empty: of the pipes entered
+            // at the BBs labeled in |print_pipes| (all, if empty), the
+            // stages |print_first_stage| through |print_last_stage| (-1 for
+            // no bound). See PipeDumpFilter.
             bool print_lowered;
+            std::string lowered_output;
+            std::vector<std::string> print_pipes;
+            int print_first_stage;
+            int print_last_stage;
+
+            // Number of threads to use for lowering, and with |hierarchical|,
+            // for generating the modules.
+            int jobs;
+
+            // If set, per-pass statistics are recorded here.
+            PassStats* pass_stats;
+
+            // Directory of cached outputs, if non-empty. A program that was
+            // compiled before with the same options has its outputs copied
+            // from the cache instead of being compiled again.
+            std::string cache_dir;
 
             Options()
                 : input_ir(nullptr)
+                , bundle_piperegs(false)
+                , specialize_piperegs(false)
+                , retime_piperegs(false)
+                , verilator(false)
+                , hierarchical(false)
+                , minimize_registers(false)
+                , balance_stages(false)
+                , max_stages(0)
+                , minimize_predicates(false)
+                , share_kill_if_slices(false)
+                , propagate_predicates(false)
+                , register_inputs(false)
+                , register_outputs(false)
+                , bank_arrays(false)
+                , skid_depth(0)
+                , fold_constants(true)
+                , cse(true)
+                , narrow_widths(true)
+                , timing_report_paths(10)
                 , print_ir(false)
                 , print_lowered(false)
+                , print_first_stage(-1)
+                , print_last_stage(-1)
+                , jobs(1)
+                , pass_stats(nullptr)
             {}
         };
 
         bool CompileFile(const Options& options,
                          ErrorCollector* collector);
+
+        // Whether |options| allow outputs to come from the cache: no output
+        // other than the Verilog and C++ model may be requested.
+        static bool CanUseCache(const Options& options);
+        // Adds everything in |options| that affects the outputs to |hash|.
+        // The program's own settings (e.g. its timing model) are part of the
+        // IR, and so are hashed with it.
+        static void HashOptions(const Options& options, ContentHash* hash);
+        // The cached artifacts that |options| ask for.
+        static std::vector<BuildCache::Artifact> CacheArtifacts(
+                const Options& options);
 };
 
 }  // namespace autopiper
@@ -20,10 +20,7 @@
 #include "backend/ir.h"
 #include "backend/rpo.h"
 
-#include <map>
 #include <vector>
-#include <set>
-#include <memory>
 #include <string>
 #include <sstream>
 
@@ -31,59 +28,43 @@ namespace autopiper {
 
 // See KD Cooper et al., "A Simple, Fast Dominance Algorithm", Rice CS
 // TR-06-33870, available at: http://www.cs.rice.edu/~keith/EMBED/dom.pdf
+//
+// As with ReversePostorder, nodes are indexed by their dense |id|.
 template<typename T, typename SuccFunc>
 class DomTree {
- private:
-  struct DomNode {
-      const T* bb;
-      DomNode* parent;
-
-      DomNode(const T* bb_) : bb(bb_), parent(nullptr) {}
-  };
-
-  std::map<const T*, std::unique_ptr<DomNode>> t_to_node_map_;
-  std::map<const DomNode*, const T*> node_to_t_map_;
-
  public:
+  typedef ReversePostorder<T, SuccFunc> RPOType;
+
   DomTree() {}
 
   bool Dom(const T* parent, const T* child) const {
-      DomNode* parent_node = nullptr;
-      DomNode* child_node = nullptr;
-      if ((parent_node = Node(parent)) == nullptr ||
-          (child_node = Node(child)) == nullptr) {
-          return false;
-      }
-      while (child_node != nullptr) {
-          if (child_node == parent_node) return true;
-          child_node = child_node->parent;
+      if (!Contains(parent) || !Contains(child)) return false;
+      int p = parent->id;
+      for (int c = child->id; c != -1; c = idom_[c]) {
+          if (c == p) return true;
       }
       return false;
   }
 
   bool IDom(const T* parent, const T* child) const {
-      DomNode* parent_node = nullptr;
-      DomNode* child_node = nullptr;
-      return ((parent_node = Node(parent)) &&
-              (child_node = Node(child)) &&
-              child_node->parent == parent_node);
+      return Contains(parent) && Contains(child) &&
+             idom_[child->id] == parent->id;
   }
 
   const T* IDomParent(const T* node) const {
-      DomNode* child_node = Node(node);
-      if (!child_node) return nullptr;
-      if (!child_node->parent) return nullptr;
-      return FromNode(child_node->parent);
+      if (!Contains(node)) return nullptr;
+      int parent = idom_[node->id];
+      return parent == -1 ? nullptr : nodes_[parent];
   }
 
   std::string ToString() const {
       std::ostringstream os;
-      for (const auto& i : t_to_node_map_) {
-          const T* node = i.first;
-          const DomNode* domnode = i.second.get();
+      for (const T* node : nodes_) {
+          if (!node) continue;
           os << "BB '" << node->label.c_str() << "': parent '";
-          if (domnode->parent) {
-              os << domnode->parent->bb->label.c_str();
+          const T* parent = IDomParent(node);
+          if (parent) {
+              os << parent->label.c_str();
           } else {
               os << "(root)";
           }
@@ -94,35 +75,50 @@ class DomTree {
 
   void Compute(const std::vector<const T*>& roots) {
       // Compute a DFS reverse postorder starting from the roots.
-      BBReversePostorder rpo;
+      RPOType rpo;
       rpo.Compute(roots);
+      Compute(rpo);
+  }
 
-      // Create DomNodes for each node.
-      for (auto* node : rpo.RPO())
-          Create(node);
+  // Computes the tree over the nodes of an already-computed reverse
+  // postorder.
+  void Compute(const RPOType& rpo) {
+      nodes_.clear();
+      idom_.clear();
+      rponums_.clear();
+
+      // Create entries for each node.
+      for (auto* node : rpo.RPO()) {
+          if (node->id >= static_cast<int>(nodes_.size())) {
+              nodes_.resize(node->id + 1, nullptr);
+              idom_.resize(node->id + 1, -1);
+              rponums_.resize(node->id + 1, -1);
+          }
+          nodes_[node->id] = node;
+          rponums_[node->id] = rpo.RPONum(node);
+      }
 
       // Perform refinement iterations as long as something keeps changing.
       bool changed = true;
       while (changed) {
           changed = false;
           for (auto* T_node : rpo.RPO()) {
-              DomNode* node = Node(T_node);
+              int node = T_node->id;
               const auto& node_preds = rpo.Preds(T_node);
-              int rponum = rpo.RPONum(T_node);
+              int rponum = rponums_[node];
 
               // We compute an immediate dominator (domtree parent) for |node|.
               // If this is different than what we had before, the domtree has
               // changed and we must perform at least one more iteration.
-              DomNode* parent = nullptr;
+              int parent = -1;
               if (node_preds.size() == 0) {
                   // Zero predecessors -- is a root, parent remains null.
               } else {
                   // One or more preds: pick an already-visited (earlier in
                   // rpo) pred as initial parent, then merge the other preds.
                   for (auto* pred : node_preds) {
-                      int pred_rpo = rpo.RPONum(pred);
-                      if (pred_rpo < rponum) {
-                          parent = Node(pred);
+                      if (rponums_[pred->id] < rponum) {
+                          parent = pred->id;
                           break;
                       }
                   }
@@ -132,63 +128,46 @@ class DomTree {
                   // this below.
               }
 
-              if (parent != nullptr) {
+              if (parent != -1) {
                   // Now for the rest of the preds, perform a merge.
                   for (auto* pred : node_preds) {
-                      DomNode* pred_node = Node(pred);
-                      if (pred_node == parent) continue;
-                      parent = Merge(parent, pred_node, &rpo);
+                      if (pred->id == parent) continue;
+                      parent = Merge(parent, pred->id);
                   }
               }
 
               // If this is a new parent, the domtree has changed.
-              if (parent != node->parent)
+              if (parent != idom_[node])
                   changed = true;
-              node->parent = parent;
+              idom_[node] = parent;
           }
       }
   }
 
  private:
-  DomNode* Merge(DomNode* node1, DomNode* node2,
-                 const BBReversePostorder* rpo) {
+  // Indexed by node ID: the node (null if not reached), its immediate
+  // dominator's ID (-1 for roots), and its RPO number.
+  std::vector<const T*> nodes_;
+  std::vector<int> idom_;
+  std::vector<int> rponums_;
+
+  bool Contains(const T* t) const {
+      return t && t->id >= 0 &&
+             t->id < static_cast<int>(nodes_.size()) && nodes_[t->id] == t;
+  }
+
+  int Merge(int node1, int node2) const {
       while (node1 != node2) {
-          if (!node1 || !node2) return nullptr;
+          if (node1 == -1 || node2 == -1) return -1;
 
-          int rpo1 = rpo->RPONum(node1->bb), rpo2 = rpo->RPONum(node2->bb);
-          if (rpo1 > rpo2) {
-              node1 = node1->parent;
+          if (rponums_[node1] > rponums_[node2]) {
+              node1 = idom_[node1];
           } else {
-              node2 = node2->parent;
+              node2 = idom_[node2];
           }
       }
       return node1;
   }
-
-  DomNode* Node(const T* t) const {
-      auto i = t_to_node_map_.find(t);
-      if (i != t_to_node_map_.end()) {
-          return i->second.get();
-      } else {
-          return nullptr;
-      }
-  }
-  const T* FromNode(const DomNode* node) const {
-      auto i = node_to_t_map_.find(node);
-      if (i != node_to_t_map_.end()) {
-          return i->second;
-      } else {
-          return nullptr;
-      }
-  }
-  DomNode* Create(const T* t) {
-      std::unique_ptr<DomNode> node(new DomNode(t));
-      DomNode* ret = node.get();
-      node_to_t_map_.insert(std::make_pair(ret, t));
-      t_to_node_map_.insert(std::make_pair(t, std::move(node)));
-      return ret;
-  }
-
 };
 
 // IRBB-specialized convenience typedef.
@@ -17,35 +17,52 @@
 #include "backend/gen-printer.h"
 
 #include <assert.h>
+#include <stdio.h>
 
 using namespace autopiper;
 using namespace std;
 
+Printer::Piece::Piece(int value) : data_(nullptr) {
+    size_ = snprintf(buf_, sizeof(buf_), "%d", value);
+}
+
 Printer::Printer(ostream* out)
     : out_(out), tab_width_(4), indent_(0) {
-    // create global contex
-    Context global_ctx;
-    vars_.push_back(global_ctx);
+    buffer_.reserve(kFlushSize + kFlushSize / 4);
+    // create global context
+    frames_.push_back(0);
 }
 
 Printer::~Printer() {
+    Flush();
     out_->flush();
 }
 
+void Printer::Flush() {
+    out_->write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
 void Printer::PushContext() {
-    Context new_ctx;
-    vars_.push_back(new_ctx);
+    frames_.push_back(vars_.size());
 }
 
 void Printer::PopContext() {
-    assert(vars_.size() > 1);  // cannot pop global context
-    vars_.pop_back();
+    assert(frames_.size() > 1);  // cannot pop global context
+    vars_.erase(vars_.begin() + frames_.back(), vars_.end());
+    frames_.pop_back();
 }
 
 void Printer::SetVar(const string& name,
                      const string& value) {
-    assert(vars_.size() > 1);
-    vars_.back().vars[name] = value;
+    assert(frames_.size() > 1);
+    for (size_t i = frames_.back(); i < vars_.size(); i++) {
+        if (vars_[i].name == name) {
+            vars_[i].value = value;
+            return;
+        }
+    }
+    vars_.push_back({ name, value });
 }
 
 void Printer::SetVars(const vector<PrintArg>& args) {
@@ -54,69 +71,98 @@ void Printer::SetVars(const vector<PrintArg>& args) {
     }
 }
 
-string Printer::Lookup(const string& name) const {
+const string* Printer::Find(const char* name, size_t size) const {
+    // Inner contexts are at the end, and names are unique within a context.
     for (auto i = vars_.rbegin(), e = vars_.rend(); i != e; ++i) {
-        auto it = i->vars.find(name);
-        if (it != i->vars.end()) {
-            return it->second;
+        if (i->name.size() == size && memcmp(i->name.data(), name, size) == 0) {
+            return &i->value;
         }
     }
-    return string();
+    return nullptr;
 }
 
-string Printer::Format(const string& fmt) const {
-    string out;
-    bool in_varname = false;
+string Printer::Lookup(const string& name) const {
+    const string* value = Find(name.data(), name.size());
+    return value ? *value : string();
+}
+
+// Appends literal |text|, indenting at the start of each line.
+void Printer::Append(string* out, const char* text, size_t size,
+                     bool* start_line) const {
+    const char* end = text + size;
+    while (text < end) {
+        if (*start_line) {
+            out->append(tab_width_ * indent_, ' ');
+            *start_line = false;
+        }
+        const char* newline =
+            static_cast<const char*>(memchr(text, '\n', end - text));
+        const char* stop = newline ? newline + 1 : end;
+        out->append(text, stop - text);
+        if (newline) *start_line = true;
+        text = stop;
+    }
+}
+
+void Printer::FormatTo(string* out, const char* fmt, size_t size) const {
+    const char* end = fmt + size;
     bool start_line = true;
-    string varname;
-    for (auto c : fmt) {
+    while (fmt < end) {
+        const char* dollar =
+            static_cast<const char*>(memchr(fmt, '$', end - fmt));
+        Append(out, fmt, (dollar ? dollar : end) - fmt, &start_line);
+        if (!dollar) break;
+
         if (start_line) {
-            for (int i = 0; i < tab_width_ * indent_; i++) {
-                out += ' ';
-            }
+            out->append(tab_width_ * indent_, ' ');
             start_line = false;
         }
-        if (in_varname) {
-            if (c == '$') {
-                if (varname.empty()) {
-                    out += '$';
-                } else {
-                    string value = Lookup(varname);
-                    varname.clear();
-                    out += value;
-                    if (!value.empty() && value[value.size() - 1] == '\n') {
-                        start_line = true;
-                    }
-                }
-                in_varname = false;
-            } else {
-                varname += c;
-            }
+        const char* name = dollar + 1;
+        const char* close =
+            static_cast<const char*>(memchr(name, '$', end - name));
+        if (!close) break;  // unterminated variable name: dropped
+        if (close == name) {
+            out->push_back('$');
         } else {
-            if (c == '$') {
-                in_varname = true;
-            } else {
-                out += c;
-                if (c == '\n') {
+            const string* value = Find(name, close - name);
+            if (value && !value->empty()) {
+                out->append(*value);
+                if ((*value)[value->size() - 1] == '\n') {
                     start_line = true;
                 }
             }
         }
+        fmt = close + 1;
     }
+}
+
+string Printer::Format(const string& fmt) const {
+    string out;
+    FormatTo(&out, fmt.data(), fmt.size());
     return out;
 }
 
+void Printer::Print(const char* fmt) {
+    FormatTo(&buffer_, fmt, strlen(fmt));
+    MaybeFlush();
+}
+
 void Printer::Print(const string& fmt) {
-    Output(Format(fmt));
+    FormatTo(&buffer_, fmt.data(), fmt.size());
+    MaybeFlush();
 }
 
 void Printer::Print(const string& fmt,
                     const vector<PrintArg>& args) {
-    PrinterScope(this);
+    PrinterScope scope(this);
     SetVars(args);
     Print(fmt);
 }
 
-void Printer::Output(const string& output) {
-    (*out_) << output;
+void Printer::Emit(initializer_list<Piece> pieces) {
+    bool start_line = true;
+    for (const auto& piece : pieces) {
+        Append(&buffer_, piece.data(), piece.size(), &start_line);
+    }
+    MaybeFlush();
 }
@@ -18,19 +18,30 @@
 #define _AUTOPIPER_GEN_PRINTER_H_
 
 #include <vector>
-#include <map>
 #include <string>
 #include <iostream>
+#include <initializer_list>
+#include <string.h>
 
 namespace autopiper {
 
+// Template-based text output. Print() substitutes $name$ with the value of
+// the innermost variable |name| set with SetVar(). Each call's output is
+// indented at its start and after each newline in the template.
+//
+// Output is accumulated in a buffer and written to the stream in large
+// blocks; call Flush() before closing the stream if the Printer outlives it.
 class Printer {
  public:
   struct PrintArg;
+  class Piece;
 
   Printer(std::ostream* out);
   ~Printer();
 
+  // Writes any buffered output to the stream.
+  void Flush();
+
   void PushContext();
   void PopContext();
   void SetVar(const std::string& name,
@@ -44,28 +55,59 @@ class Printer {
 
   std::string Format(const std::string& fmt) const;
 
+  void Print(const char* fmt);
   void Print(const std::string& fmt);
   void Print(const std::string& fmt,
              const std::vector<PrintArg>& args);
 
+  // Fast path: emits the concatenation of |pieces| with no variable
+  // substitution, indented as Print() would indent the same text. This
+  // avoids the variable lookups and string copies of Print() for generators'
+  // per-statement output.
+  void Emit(std::initializer_list<Piece> pieces);
+
   struct PrintArg {
       std::string name;
       std::string value;
   };
 
+  // A borrowed string or a formatted integer, for Emit().
+  class Piece {
+   public:
+    Piece(const char* s) : data_(s), size_(strlen(s)) {}
+    Piece(const std::string& s) : data_(s.data()), size_(s.size()) {}
+    Piece(int value);
+
+    const char* data() const { return data_ ? data_ : buf_; }
+    size_t size() const { return size_; }
+
+   private:
+    // Null if the text is in |buf_|, so that copies stay valid.
+    const char* data_;
+    size_t size_;
+    char buf_[16];
+  };
+
  private:
-  struct Context;
+  // Buffered output is written to the stream once it reaches this size.
+  static const size_t kFlushSize = 1 << 20;
 
   std::ostream* out_;
   int tab_width_;
   int indent_;
-  std::vector<Context> vars_;
-
-  struct Context {
-      std::map<std::string, std::string> vars;
-  };
-
-  void Output(const std::string& value);
+  std::string buffer_;
+  // All variables of all contexts, innermost last; |frames_| holds the index
+  // of each context's first variable.
+  std::vector<PrintArg> vars_;
+  std::vector<size_t> frames_;
+
+  const std::string* Find(const char* name, size_t size) const;
+  void FormatTo(std::string* out, const char* fmt, size_t size) const;
+  void Append(std::string* out, const char* text, size_t size,
+              bool* start_line) const;
+  void MaybeFlush() {
+      if (buffer_.size() >= kFlushSize) Flush();
+  }
 };
 
 // RAII class for a variable scope.
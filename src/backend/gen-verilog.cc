@@ -17,11 +17,21 @@
 #include "backend/gen-verilog.h"
 #include "backend/ir.h"
 #include "backend/pipe.h"
+#include "common/parallel.h"
 #include "common/util.h"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <queue>
+#include <set>
 #include <sstream>
 #include <string>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tuple>
 #include <vector>
 
 using namespace autopiper;
@@ -38,6 +48,96 @@ string HexStrAllOnes(int width) {
     }
     return os.str();
 }
+
+// Suffix of the pipereg outputs that feed a skid buffer.
+const char kArrivingSuffix[] = "_arriving";
+
+// Performance counters wrap at this width.
+const int kPerfCounterWidth = 32;
+
+// Returns a balanced OR of hits[lo..hi), as an expression of depth
+// log2(hi - lo).
+string AnyHitExpr(const vector<string>& hits, unsigned lo, unsigned hi) {
+    if (hi - lo == 1) {
+        return hits[lo];
+    }
+    unsigned mid = (lo + hi) / 2;
+    return "(" + AnyHitExpr(hits, lo, mid) + " | " +
+           AnyHitExpr(hits, mid, hi) + ")";
+}
+
+// Returns values[i] for the first i in [lo, hi) whose hits[i] is set, or
+// values[hi - 1] if none is. Each level of the tree selects between its
+// halves on whether the first half hits, so the result is log2(hi - lo)
+// muxes deep rather than a chain of hi - lo.
+string PriorityMuxExpr(const vector<string>& hits,
+                       const vector<string>& values,
+                       unsigned lo, unsigned hi) {
+    if (hi - lo == 1) {
+        return values[lo];
+    }
+    unsigned mid = (lo + hi) / 2;
+    return "(" + AnyHitExpr(hits, lo, mid) + " ? " +
+           PriorityMuxExpr(hits, values, lo, mid) + " : " +
+           PriorityMuxExpr(hits, values, mid, hi) + ")";
+}
+
+// The name of bank |bank| of a banked array.
+string ArrayBankName(const IRStorage* storage, int bank) {
+    return strprintf("array_%s_bank%d", storage->name.c_str(), bank);
+}
+
+// The row of |storage|'s banks addressed by |index|: its bits above the ones
+// selecting a bank.
+string ArrayRowExpr(const IRStorage* storage, const string& index) {
+    if (storage->index_width == storage->BankBits()) {
+        return "0";
+    }
+    return strprintf("%s[%d:%d]", index.c_str(), storage->index_width - 1,
+                     storage->BankBits());
+}
+
+// Returns values[i] for i in [lo, hi) given by the low bits of |index|, as a
+// balanced tree of muxes on those bits.
+string BankMuxExpr(const string& index, const vector<string>& values,
+                   unsigned lo, unsigned hi) {
+    if (hi - lo == 1) {
+        return values[lo];
+    }
+    unsigned mid = (lo + hi) / 2;
+    int bit = 0;
+    while ((2u << bit) < hi - lo) bit++;
+    return strprintf("(%s[%d] ? ", index.c_str(), bit) +
+           BankMuxExpr(index, values, mid, hi) + " : " +
+           BankMuxExpr(index, values, lo, mid) + ")";
+}
+
+// The word an array read at |index| reads: from the one bank it addresses,
+// if banking fixes it, or else from every bank's row, selected on the bank
+// bits.
+string ArrayWordExpr(const IRStmt* stmt, const string& index) {
+    const IRStorage* storage = stmt->storage;
+    if (storage->banks == 1) {
+        return strprintf("array_%s[%s]", storage->name.c_str(), index.c_str());
+    }
+    string row = ArrayRowExpr(storage, index);
+    if (stmt->array_bank != -1) {
+        return ArrayBankName(storage, stmt->array_bank) + "[" + row + "]";
+    }
+    vector<string> values;
+    for (int b = 0; b < storage->banks; b++) {
+        values.push_back(ArrayBankName(storage, b) + "[" + row + "]");
+    }
+    return BankMuxExpr(index, values, 0, values.size());
+}
+
+// Is |stmt| a read of an array with registered reads? Its value then passes
+// through the read register into the stage after its own (see
+// VerilogGenerator::GenerateReadRegister()); the timing DAG keeps its users
+// |read_latency| stages later.
+bool IsRegisteredRead(const IRStmt* stmt) {
+    return stmt->type == IRStmtArrayRead && stmt->storage->read_latency > 0;
+}
 }  // anonymous namespace
 
 // Strategy:
@@ -53,33 +153,389 @@ string HexStrAllOnes(int width) {
 //
 // By the time we reach this point, each pipestage should have 'stall' and
 // 'kill' signals.
+//
+// Elastic stages have an instance of a 'skidbuf' module at their input
+// instead: the piperegs into the stage feed the buffer, which drives the
+// stage's signals.
+//
+// In Verilator mode, the body of the module is generated into a buffer
+// first, collecting the wire declarations, which are then printed ahead of
+// it: Verilator, unlike event-driven simulators, wants each net declared
+// before its first use.
+//
+// In hierarchical mode, each pipe is its own module instead, under a top
+// module that connects them (see GenerateHierarchy()).
 
 void VerilogGenerator::Generate() {
     PrinterScope global_scope(out_);
     out_->SetVar("module_name", name_);
+    perf_counters_ = PerfCounters(systems_);
+    if (program_ && program_->profile) {
+        profile_events_ = PerfCounters(systems_, true);
+    }
 
-    GenerateModuleStart();
+    if (hierarchical_) {
+        GenerateHierarchy();
+    } else if (verilator_) {
+        string body = GenerateBuffered([this]() { GenerateBody(); });
+        GenerateModuleStart();
+        out_->Emit({ body });
+        GenerateModuleEnd();
+    } else {
+        GenerateModuleStart();
+        GenerateBody();
+        GenerateModuleEnd();
+    }
+
+    GeneratePipeRegModule();
+    if (!Skids().empty()) {
+        GenerateSkidBufModule();
+    }
+}
+
+string VerilogGenerator::GenerateBuffered(const function<void()>& generate) {
+    ostringstream body;
+    Printer* module_out = out_;
+    declarations_.clear();
+    {
+        Printer body_out(&body);
+        out_ = &body_out;
+        generate();
+        body_out.Flush();
+    }
+    out_ = module_out;
+    string text;
+    for (const auto& declaration : declarations_) {
+        text += declaration;
+    }
+    return text + body.str();
+}
+
+void VerilogGenerator::GenerateBody() {
     // Generate storage elements: registers and arrays.
     for (auto& s : program_->storage) {
-        GenerateStorage(s.get());
+        auto home = storage_homes_.find(s.get());
+        if (!module_ || (home != storage_homes_.end() &&
+                         home->second == module_)) {
+            GenerateStorage(s.get());
+        }
     }
     // Generate node implementations. In the process, we learn which signals
     // need to be staged to which pipestages.
     for (auto* sys : systems_) {
         for (auto& pipe : sys->pipes) {
             for (auto& stmt : pipe->stmts) {
-                GenerateNode(stmt);
+                if (InModule(stmt)) {
+                    GenerateNode(stmt);
+                }
             }
         }
     }
+    for (auto& s : program_->storage) {
+        GenerateStorageWrites(s.get());
+    }
+    if (!module_) {
+        GenerateIORegisters();
+        GeneratePerfCounters();
+        GenerateProfileTrace();
+    }
+    StageSkids();
     // Generate flops between each pipestage for each signal.
-    for (auto& p : signal_stages_) {
-        const auto* signal = p.first;
-        GenerateStaging(signal);
+    if (bundle_piperegs_) {
+        GenerateBundledStaging();
+    } else {
+        for (const auto* signal : StagedSignals()) {
+            if (InModule(signal)) {
+                GenerateStaging(signal);
+            }
+        }
+    }
+    for (const auto& skid : Skids()) {
+        if (!module_ || skid.pipe == module_) {
+            GenerateSkid(skid);
+        }
+    }
+}
+
+namespace {
+bool IsIdentifierChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
+
+// Calls |f| with the offset and length of each identifier in the Verilog
+// |text|, other than the port names of instance connections (".src(") and
+// the digits of based constants ("8'hff").
+void ForEachIdentifier(const string& text,
+                       const function<void(size_t, size_t)>& f) {
+    size_t i = 0;
+    while (i < text.size()) {
+        char c = text[i];
+        if (!IsIdentifierChar(c)) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < text.size() && IsIdentifierChar(text[i])) i++;
+        if (isdigit(static_cast<unsigned char>(c)) ||
+            (start > 0 && (text[start - 1] == '.' ||
+                           text[start - 1] == '\''))) {
+            continue;
+        }
+        f(start, i - start);
+    }
+}
+
+// The distinct identifiers in |text|, in order of first appearance.
+vector<string> Identifiers(const string& text) {
+    vector<string> names;
+    set<string> seen;
+    ForEachIdentifier(text, [&](size_t start, size_t len) {
+        string name = text.substr(start, len);
+        if (seen.insert(name).second) names.push_back(name);
+    });
+    return names;
+}
+
+// Renumbers a value's name (val<N>_<stage>..., or skid<N>... for its skid
+// buffer) by |numbers|, which numbers values in order of first use.
+string LocalName(const string& name, map<int, int>* numbers) {
+    size_t prefix = name.compare(0, 3, "val") == 0 ? 3 :
+                    name.compare(0, 4, "skid") == 0 ? 4 : 0;
+    size_t end = prefix;
+    while (end < name.size() &&
+           isdigit(static_cast<unsigned char>(name[end]))) {
+        end++;
+    }
+    if (prefix == 0 || end == prefix ||
+        (prefix == 3 ? end == name.size() || name[end] != '_'
+                     : end != name.size() && name[end] != '_')) {
+        return name;
+    }
+    int valnum = atoi(name.substr(prefix, end - prefix).c_str());
+    auto it = numbers->insert(
+            make_pair(valnum, static_cast<int>(numbers->size()))).first;
+    return strprintf("%s%d", name.substr(0, prefix).c_str(), it->second) +
+           name.substr(end);
+}
+
+string Localize(const string& text, map<int, int>* numbers) {
+    string out;
+    size_t copied = 0;
+    ForEachIdentifier(text, [&](size_t start, size_t len) {
+        out.append(text, copied, start - copied);
+        out += LocalName(text.substr(start, len), numbers);
+        copied = start + len;
+    });
+    out.append(text, copied, string::npos);
+    return out;
+}
+
+string PortRange(int width) {
+    return width == 1 ? "" : strprintf("[%d:0] ", width - 1);
+}
+}  // anonymous namespace
+
+const Pipe* VerilogGenerator::ModuleOf(const IRStmt* stmt) const {
+    if (stmt->storage) {
+        auto it = storage_homes_.find(stmt->storage);
+        if (it != storage_homes_.end()) return it->second;
+    }
+    return stmt->pipe;
+}
+
+// The design is generated once whole, into a discarded buffer, to record the
+// stages each signal is used in: a pipe's staging of its values depends on
+// their uses in the other pipes. Each pipe's module is then generated alone,
+// and its ports are the nets that it uses and another module declares, and
+// the nets that it declares and another module (or the top module) uses.
+// Storage arrays cannot be ports, so each storage element lives with all of
+// its accesses, and exported ports are driven straight from the module that
+// writes them, or with a latency, from their registers in the top module.
+//
+// Once the first pass has recorded the staging, the modules' bodies are
+// independent, so up to |jobs_| of them are generated at once, each by its own
+// copy of the generator into its own buffer. They are then gathered in pipe
+// order, so the output does not depend on the job count.
+void VerilogGenerator::GenerateHierarchy() {
+    for (auto* sys : systems_) {
+        for (auto& pipe : sys->pipes) {
+            for (auto* stmt : pipe->stmts) {
+                if (stmt->storage && !storage_homes_.count(stmt->storage)) {
+                    storage_homes_[stmt->storage] = pipe.get();
+                }
+            }
+        }
+    }
+    GenerateBuffered([this]() { GenerateBody(); });
+
+    struct Module {
+        string name;
+        string body;
+        vector<string> uses;
+        map<string, int> declared;
+    };
+    vector<const Pipe*> pipes;
+    for (auto* sys : systems_) {
+        for (auto& pipe : sys->pipes) {
+            pipes.push_back(pipe.get());
+        }
+    }
+    vector<Module> pipe_modules(pipes.size());
+    vector<set<string>> pipe_pipereg_modules(pipes.size());
+    ParallelFor(jobs_, pipes.size(), [&](int i) {
+        VerilogGenerator gen(*this);
+        gen.module_ = pipes[i];
+        gen.declared_.clear();
+        gen.storage_writes_.clear();
+        gen.registered_reads_.clear();
+        Module& m = pipe_modules[i];
+        m.body = gen.GenerateBuffered([&gen]() { gen.GenerateBody(); });
+        m.uses = Identifiers(m.body);
+        m.declared = gen.declared_;
+        pipe_pipereg_modules[i] = gen.pipereg_modules_;
+    });
+
+    vector<Module> modules;
+    // The module (or -1, the top) that declares each net, and its width.
+    map<string, pair<int, int>> nets;
+    set<string> module_names;
+    for (unsigned i = 0; i < pipes.size(); i++) {
+        pipereg_modules_.insert(pipe_pipereg_modules[i].begin(),
+                                pipe_pipereg_modules[i].end());
+        Module& m = pipe_modules[i];
+        if (m.body.empty()) continue;
+        const string& label = pipes[i]->entry->label;
+        m.name = name_ + "_" + label;
+        for (int j = 1; module_names.count(m.name); j++) {
+            m.name = strprintf("%s_%s_%d", name_.c_str(), label.c_str(), j);
+        }
+        module_names.insert(m.name);
+        for (const auto& net : m.declared) {
+            nets[net.first] = make_pair(static_cast<int>(modules.size()),
+                                        net.second);
+        }
+        modules.push_back(move(m));
+    }
+
+    // The top module holds the performance counters and any storage that no
+    // pipe accesses; its ports are those of the flat module.
+    module_ = nullptr;
+    string top_body = GenerateBuffered([this]() {
+        for (auto& s : program_->storage) {
+            if (!storage_homes_.count(s.get())) GenerateStorage(s.get());
+        }
+        GenerateIORegisters();
+        GeneratePerfCounters();
+        GenerateProfileTrace();
+    });
+    vector<string> top_uses = Identifiers(top_body);
+    nets["clock"] = nets["reset"] = make_pair(-1, 1);
+    for (auto& port : program_->ports) {
+        if (!port->exported) continue;
+        if (port->defs.empty()) {
+            nets[port->name] = make_pair(-1, port->width);
+        } else if (port->latency == 0) {
+            top_uses.push_back(port->name);
+        }
+        // The top module holds the IO registers, which the pipes read.
+        for (const auto& reg : PortStaging(port.get(), port->width)) {
+            nets[reg.dst] = make_pair(-1, port->width);
+        }
+    }
+
+    // The modules using each net declared in another. Some names (e.g. of
+    // bundled piperegs) are local to each module that declares them.
+    map<string, set<int>> users;
+    for (unsigned i = 0; i < modules.size(); i++) {
+        for (const auto& name : modules[i].uses) {
+            if (nets.count(name) && !modules[i].declared.count(name)) {
+                users[name].insert(i);
+            }
+        }
+    }
+    for (const auto& name : top_uses) {
+        if (nets.count(name) && nets[name].first != -1) {
+            users[name].insert(-1);
+        }
+    }
+
+    set<string> top_ports = { "clock", "reset" };
+    for (auto& port : program_->ports) {
+        if (port->exported) top_ports.insert(port->name);
+    }
+    GenerateModuleStart();
+    for (unsigned i = 0; i < modules.size(); i++) {
+        for (const auto& name : modules[i].uses) {
+            if (modules[i].declared.count(name) && users.count(name) &&
+                !top_ports.count(name)) {
+                out_->Emit({ "wire [", nets[name].second, "-1:0] ", name,
+                             ";\n" });
+            }
+        }
+    }
+    out_->Emit({ top_body });
+    // The ports of each module, as (local name, net, direction).
+    typedef std::tuple<string, string, const char*> Port;
+    vector<vector<Port>> ports(modules.size());
+    vector<map<int, int>> module_numbers(modules.size());
+    ParallelFor(jobs_, modules.size(), [&](int i) {
+        modules[i].body = Localize(modules[i].body, &module_numbers[i]);
+    });
+    for (unsigned i = 0; i < modules.size(); i++) {
+        Module& m = modules[i];
+        map<int, int>& numbers = module_numbers[i];
+        for (const auto& name : m.uses) {
+            if (!nets.count(name)) continue;
+            bool output = m.declared.count(name);
+            if (output && !users.count(name)) continue;
+            ports[i].push_back(std::make_tuple(LocalName(name, &numbers), name,
+                                               output ? "output" : "input"));
+        }
+        stable_partition(ports[i].begin(), ports[i].end(),
+                         [](const Port& port) {
+                             return std::get<1>(port) == "clock" ||
+                                    std::get<1>(port) == "reset";
+                         });
+        string instance = m.name + " " + m.name + "_inst(";
+        for (unsigned j = 0; j < ports[i].size(); j++) {
+            instance += (j ? ",\n  ." : "\n  .") + std::get<0>(ports[i][j]) +
+                        "(" + std::get<1>(ports[i][j]) + ")";
+        }
+        out_->Emit({ instance, ");\n" });
     }
     GenerateModuleEnd();
 
-    GeneratePipeRegModule();
+    // The modules' ports are declared in the body, not the port list, as a
+    // net declared in the logic may be an output.
+    for (unsigned i = 0; i < modules.size(); i++) {
+        string header = "\nmodule " + modules[i].name + "(";
+        for (unsigned j = 0; j < ports[i].size(); j++) {
+            header += (j ? ",\n    " : "\n    ") + std::get<0>(ports[i][j]);
+        }
+        out_->Emit({ header, ");\n" });
+        out_->Indent();
+        for (const auto& port : ports[i]) {
+            out_->Emit({ std::get<2>(port), " ",
+                         PortRange(nets[std::get<1>(port)].second),
+                         std::get<0>(port), ";\n" });
+        }
+        out_->Emit({ modules[i].body });
+        GenerateModuleEnd();
+    }
+}
+
+void VerilogGenerator::DeclareWire(int width, const string& name) {
+    declared_[name] = width;
+    if (verilator_) {
+        declarations_.push_back(strprintf("wire [%d-1:0] %s;\n", width,
+                                          name.c_str()));
+    } else {
+        out_->Emit({ "wire [", width, "-1:0] ", name, ";\n" });
+    }
+}
+
+string VerilogGenerator::Zero(int width) const {
+    return verilator_ ? strprintf("%d'd0", width) : "0";
 }
 
 void VerilogGenerator::GenerateModuleStart() {
@@ -92,6 +548,13 @@ void VerilogGenerator::GenerateModuleStart() {
                 GenerateModulePortDef(port.get());
             }
         }
+        if (!perf_counters_.empty()) {
+            out_->Print(",\ninput [$msb$:0] perf_counter_select"
+                        ",\noutput [$width$-1:0] perf_counter_value",
+                        { { "msb", strprintf("%d", PerfSelectWidth(
+                                  perf_counters_.size()) - 1) },
+                          { "width", strprintf("%d", kPerfCounterWidth) } });
+        }
         out_->Print("\n");
     }
     out_->Print(");\n");
@@ -114,15 +577,67 @@ void VerilogGenerator::GenerateModuleEnd() {
     out_->Print("endmodule\n");
 }
 
-void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
-    PrinterScope scope(out_);
+bool PipeGenerator::IsElided(const IRStmt* stmt) {
     // Special case: eliminate zero-width data ops, as they're the result of
     // 'void' functions and need not be materialized.
     if (stmt->type == IRStmtExpr && stmt->width == 0) {
-        return;
+        return true;
     }
     // Eliminate deleted ops.
-    if (stmt->deleted) {
+    return stmt->deleted;
+}
+
+const IRStmt* PipeGenerator::BypassLastWriter(const IRBypass* bypass,
+                                              int stage) {
+    // Find the "last writer", i.e., the producer of the value of the bypass
+    // bus valid at this stage. The last writer will be either the entry in
+    // writes_by_stage with the largest key (stage) <= |stage|, or if all keys
+    // are > |stage|, then bypass->start.
+    auto it = bypass->writes_by_stage.upper_bound(stage);
+    // upper_bound() returns the first elem whose key is > stage, so backing
+    // up by one will give the last elem whose key is <= stage, unless there
+    // is none.
+    if (it == bypass->writes_by_stage.begin()) {
+        return bypass->start;
+    }
+    --it;
+    return it->second;
+}
+
+vector<pair<const IRStmt*, int>> PipeGenerator::BypassBuses(
+        const IRStmt* read) {
+    vector<const IRBypass*> lanes(read->bypass->lanes.begin(),
+                                  read->bypass->lanes.end());
+    if (lanes.empty()) {
+        lanes.push_back(read->bypass);
+    }
+    vector<pair<const IRStmt*, int>> buses;
+    // A network carries no bus outside its start and end stages.
+    auto add = [&buses](const IRBypass* bypass, int stage) {
+        if (stage >= bypass->start->stage->stage &&
+            stage <= bypass->end->stage->stage) {
+            buses.push_back(make_pair(BypassLastWriter(bypass, stage), stage));
+        }
+    };
+    int read_stage = read->stage->stage;
+    int last_stage = read_stage;
+    for (auto* bypass : lanes) {
+        last_stage = max(last_stage, bypass->end->stage->stage);
+    }
+    for (int lane = read->bypass->lane - 1; lane >= 0; lane--) {
+        add(lanes[lane], read_stage);
+    }
+    for (int stage = read_stage + 1; stage <= last_stage; stage++) {
+        for (int lane = lanes.size() - 1; lane >= 0; lane--) {
+            add(lanes[lane], stage);
+        }
+    }
+    return buses;
+}
+
+void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
+    PrinterScope scope(out_);
+    if (IsElided(stmt)) {
         return;
     }
     // Materialize all inputs.
@@ -136,15 +651,16 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
         valid_signal = GetSignalInStage(stmt->valid_in, stmt->stage->stage);
     }
     out_->SetVar("predicate", valid_signal);
-    // If this statement generates an output value, declare a wire for it.
+    // If this statement generates an output value, declare a wire for it. A
+    // registered read's value exists only from its output register on.
     string signal_name;
-    if (stmt->width > 0) {
+    if (stmt->width > 0 && !IsRegisteredRead(stmt)) {
         signal_name = SignalName(stmt, stmt->stage->stage);
         out_->SetVars({
             { "signal", signal_name },
             { "width", strprintf("%d", stmt->width) },
         });
-        out_->Print("wire [$width$-1:0] $signal$;\n");
+        DeclareWire(stmt->width, signal_name);
     }
     out_->SetVar("signal", signal_name);
 
@@ -170,26 +686,39 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
             break;
 
         case IRStmtPortRead:
-            out_->SetVar("portname", stmt->port->name);
+            out_->SetVar("portname", PortReadSignal(stmt->port));
             out_->Print("assign $signal$ = $portname$;\n");
             break;
 
         case IRStmtPortWrite:
-            out_->SetVar("portname", stmt->port->name);
+            out_->SetVar("portname", PortWriteSignal(stmt->port));
             out_->SetVar("arg", arg_signals[0]);
-            if (!stmt->port->exported) {
-                out_->SetVar("width", strprintf("%d", stmt->args[0]->width));
-                out_->Print("wire [$width$-1:0] $portname$;\n");
+            if (!stmt->port->exported || stmt->port->latency > 0) {
+                DeclareWire(stmt->args[0]->width, PortWriteSignal(stmt->port));
+            } else {
+                declared_[stmt->port->name] = stmt->args[0]->width;
             }
             if (stmt->port_has_default) {
-                out_->SetVar("default", string(stmt->port_default)); 
+                out_->SetVar("default", verilator_ ?
+                        strprintf("%d'd%s", stmt->args[0]->width,
+                                  string(stmt->port_default).c_str()) :
+                        string(stmt->port_default));
                 out_->Print("assign $portname$ = $predicate$ ? $arg$ : $default$;\n");
             } else {
                 out_->Print("assign $portname$ = $arg$;\n");
             }
+            // An exported port's registers are at the module boundary (see
+            // GenerateIORegisters()).
+            if (!stmt->port->exported) {
+                for (const auto& reg : PortStaging(stmt->port,
+                                                   stmt->args[0]->width)) {
+                    GeneratePipeReg(reg, reg.dst + "_pipereg");
+                }
+            }
             break;
 
         case IRStmtPortExport:
+        case IRStmtPortLatency:
             // Nothing.
             break;
 
@@ -199,6 +728,10 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
             break;
 
         case IRStmtRegWrite:
+            if (verilator_) {
+                storage_writes_[stmt->storage].push_back(stmt);
+                break;
+            }
             out_->SetVar("regname", stmt->storage->name);
             out_->SetVar("arg", arg_signals[0]);
             out_->Print(
@@ -211,23 +744,31 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
             break;
 
         case IRStmtArrayRead:
-            out_->SetVar("arrayname", stmt->storage->name);
-            out_->SetVar("index", arg_signals[0]);
-            out_->Print(
-                "assign $signal$ = array_$arrayname$[$index$];\n");
+            if (IsRegisteredRead(stmt)) {
+                // The word is read into the first pipereg of our value when
+                // staging; nothing is read combinationally.
+                registered_reads_[SignalName(stmt, stmt->stage->stage)] =
+                    ArrayWordExpr(stmt, arg_signals[0]);
+            } else {
+                out_->SetVar("value", ArrayWordExpr(stmt, arg_signals[0]));
+                out_->Print("assign $signal$ = $value$;\n");
+            }
             break;
 
         case IRStmtArrayWrite:
-            out_->SetVar("arrayname", stmt->storage->name);
-            out_->SetVar("index", arg_signals[0]);
-            out_->SetVar("data", arg_signals[1]);
-            out_->Print(
-                "always @(negedge clock)\n"
-                "    if ($predicate$)\n"
-                "        array_$arrayname$[$index$] <= $data$;\n");
+            if (verilator_) {
+                storage_writes_[stmt->storage].push_back(stmt);
+                break;
+            }
+            out_->Print("always @(negedge clock)\n");
+            out_->Indent();
+            GenerateArrayWrite(stmt);
+            out_->Outdent();
             break;
 
         case IRStmtArraySize:
+        case IRStmtArrayBanks:
+        case IRStmtArrayLatency:
             break;
 
         case IRStmtRestartValue:
@@ -253,6 +794,12 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
             out_->Print("assign $signal$ = $arg$;\n");
             break;
 
+        case IRStmtSkidFull:
+            out_->SetVar("skid", SkidName(stmt->pipe->stages[
+                        stmt->constant.convert_to<int>()].get()));
+            out_->Print("assign $signal$ = $skid$_full;\n");
+            break;
+
         case IRStmtSpawn:
         case IRStmtKill:
         case IRStmtKillIf:
@@ -296,59 +843,54 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
 
         case IRStmtBypassWrite:
             // Create a new bypass-bus signal with data, and and data valid
-            // set. Carry index and index valid from BypassStart.
+            // set. Carry index and index valid from BypassStart. If the write
+            // is not taken, carry the bus as it arrived instead, so that an
+            // earlier write by the same transaction stays visible.
             out_->SetVar("index_valid",
                     GetSignalInStage(stmt->bypass->start->valid_in,
                         stmt->stage->stage));
             out_->SetVar("index",
                     GetSignalInStage(stmt->bypass->start->args[0],
                         stmt->stage->stage));
-            out_->SetVar("data_valid", valid_signal);
             out_->SetVar("data", arg_signals[0]);
-            out_->Print("assign $signal$ = { $index_valid$, "
-                        "$index$, $data_valid$, $data$ };\n");
+            out_->SetVar("data_width", strprintf("%d", stmt->bypass->width));
+            if (stmt->stage->stage == stmt->bypass->start->stage->stage) {
+                out_->SetVar("prev_bus", out_->Format(
+                            "{ $index_valid$, $index$, 1'b0, "
+                            "$data_width$'d0 }"));
+            } else {
+                const IRStmt* prev_writer = BypassLastWriter(stmt->bypass,
+                        stmt->stage->stage - 1);
+                out_->SetVar("prev_bus",
+                        GetSignalInStage(prev_writer, stmt->stage->stage));
+            }
+            if (valid_signal.empty()) {
+                out_->Print("assign $signal$ = { $index_valid$, "
+                            "$index$, 1'b1, $data$ };\n");
+            } else {
+                out_->Print("assign $signal$ = $predicate$ ? { $index_valid$, "
+                            "$index$, 1'b1, $data$ } : $prev_bus$;\n");
+            }
             break;
 
         case IRStmtBypassPresent:
         case IRStmtBypassReady:
         case IRStmtBypassRead: {
-            out_->Print("assign $signal$ =\n    ");
-            bool first = true;
-            for (int stage = stmt->stage->stage + 1; stage <= stmt->bypass->end->stage->stage;
-                 stage++) {
-
-                // If this stage is prior to the bypass network's start, we
-                // have nothing to generate for it, so skip it.
-                if (stage < stmt->bypass->start->stage->stage) {
-                    continue;
-                }
-
-                // Find the "last writer", i.e., the producer of the value of
-                // the bypass bus valid at this stage. The last writer will be
-                // either the entry in writes_by_stage with the largest key
-                // (stage) <= |stage|, or if all keys are > |stage|, then
-                // stmt->bypass->start.
-                IRStmt* last_writer = nullptr;
-                auto it = stmt->bypass->writes_by_stage.upper_bound(stage);
-                // upper_bound() returns the first elem whose key is >
-                // stage, so backing up by one will give the last elem
-                // whose key is <= stage. upper_bound() may return end(), in
-                // which case this will yield begin().
-                if (it != stmt->bypass->writes_by_stage.begin()) {
-                    --it;
-                }
-                if (it == stmt->bypass->writes_by_stage.begin()) {
-                    last_writer = stmt->bypass->start;
-                } else {
-                    last_writer = it->second;
-                }
-
-
-                out_->SetVar("bypass_idx", strprintf("%d", stage));
-                // N.B.: we take the bypass write's value in *its own* stage,
-                // since we are looking across pipeline invocations here.
-                out_->SetVar("bypass_bus",
-                        GetSignalInStage(last_writer, last_writer->stage->stage));
+            // Each bus that carries the value of an older transaction (see
+            // BypassBuses()) is matched against the index in its own hit
+            // wire. The nearest one, i.e. the youngest older transaction,
+            // takes priority.
+            vector<string> hits;
+            vector<string> values;
+            for (auto& p : BypassBuses(stmt)) {
+                // The transaction in the bus's stage made its last write in
+                // an earlier (or that) stage; take that write's bus as
+                // carried down to the stage.
+                string bus = GetSignalInStage(p.first, p.second);
+                string hit = strprintf("%s_hit%d", signal_name.c_str(),
+                                       static_cast<int>(hits.size()));
+                out_->SetVar("hit", hit);
+                out_->SetVar("bypass_bus", bus);
                 int data_width = stmt->bypass->width;
                 int index_width = stmt->bypass->start->args[0]->width;
                 out_->SetVar("data_valid_idx", strprintf("%d", data_width));
@@ -356,37 +898,38 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
                         strprintf("%d", data_width + index_width + 1));
                 out_->SetVar("index", arg_signals[0]);
 
+                DeclareWire(1, hit);
                 if (stmt->type == IRStmtBypassPresent) {
-                    if (!first) out_->Print(" | ");
-                    out_->Print(" ($bypass_bus$[$index_valid_idx$] && "
-                                "  ($bypass_bus$[$index_valid_idx$-1:$data_valid_idx$+1] == "
-                                "   $index$))");
-                } else if (stmt->type == IRStmtBypassReady) {
-                    if (!first) out_->Print(" | ");
-                    out_->Print(" ($bypass_bus$[$index_valid_idx$] && "
+                    out_->Print("assign $hit$ ="
+                                " ($bypass_bus$[$index_valid_idx$] && "
                                 "  ($bypass_bus$[$index_valid_idx$-1:$data_valid_idx$+1] == "
-                                "   $index$) && "
-                                "  $bypass_bus$[$data_valid_idx$])");
-                } else if (stmt->type == IRStmtBypassRead) {
-                    out_->Print("    "
+                                "   $index$));\n");
+                } else {
+                    out_->Print("assign $hit$ ="
                                 " ($bypass_bus$[$index_valid_idx$] && "
                                 "  ($bypass_bus$[$index_valid_idx$-1:$data_valid_idx$+1] == "
                                 "   $index$) && "
-                                "  $bypass_bus$[$data_valid_idx$]) ? "
-                                "  $bypass_bus$[$data_valid_idx$-1:0] :\n");
-                } else {
-                    assert(false);
+                                "  $bypass_bus$[$data_valid_idx$]);\n");
                 }
-                first = false;
+                hits.push_back(hit);
+                values.push_back(bus + strprintf("[%d-1:0]", data_width));
             }
 
-            if (first || stmt->type == IRStmtBypassRead) {
+            if (hits.empty()) {
                 // If no bypass writes after this stage, bypass is never
-                // present. Also, always end the ?: (ternary-op) chain of a
-                // bypass read with a 0.
-                out_->Print("0;\n");
+                // present.
+                out_->SetVar("zero", Zero(stmt->width));
+                out_->Print("assign $signal$ = $zero$;\n");
+            } else if (stmt->type == IRStmtBypassRead) {
+                // The value of the nearest hit, or 0 if there is none.
+                out_->SetVar("any", AnyHitExpr(hits, 0, hits.size()));
+                out_->SetVar("mux", PriorityMuxExpr(hits, values,
+                                                    0, hits.size()));
+                out_->SetVar("zero", Zero(stmt->width));
+                out_->Print("assign $signal$ = $any$ ? $mux$ : $zero$;\n");
             } else {
-                out_->Print(";\n");
+                out_->SetVar("any", AnyHitExpr(hits, 0, hits.size()));
+                out_->Print("assign $signal$ = $any$;\n");
             }
 
             break;
@@ -399,6 +942,51 @@ void VerilogGenerator::GenerateNode(const IRStmt* stmt) {
     }
 }
 
+// The write reads its predicate and arguments in its own stage, as
+// GenerateNode() materialized them, so that it can be generated apart from
+// its node.
+void VerilogGenerator::GenerateArrayWrite(const IRStmt* stmt) {
+    PrinterScope scope(out_);
+    int stage = stmt->stage->stage;
+    string index = SignalName(stmt->args[0], stage);
+    out_->SetVars({
+        { "predicate", stmt->valid_in ? SignalName(stmt->valid_in, stage)
+                                      : "1'b1" },
+        { "arrayname", stmt->storage->name },
+        { "index", index },
+        { "data", SignalName(stmt->args[1], stage) },
+    });
+    if (stmt->storage->banks == 1) {
+        out_->Print(
+            "if ($predicate$)\n"
+            "    array_$arrayname$[$index$] <= $data$;\n");
+    } else if (stmt->array_bank != -1) {
+        out_->SetVar("bank", ArrayBankName(stmt->storage, stmt->array_bank));
+        out_->SetVar("row", ArrayRowExpr(stmt->storage, index));
+        out_->Print(
+            "if ($predicate$)\n"
+            "    $bank$[$row$] <= $data$;\n");
+    } else {
+        // Write the bank given by the bank bits.
+        out_->SetVar("row", ArrayRowExpr(stmt->storage, index));
+        out_->SetVar("bankbits", strprintf("%s[%d:0]", index.c_str(),
+                                           stmt->storage->BankBits() - 1));
+        out_->Print(
+            "if ($predicate$)\n"
+            "    case ($bankbits$)\n");
+        for (int b = 0; b < stmt->storage->banks; b++) {
+            out_->SetVar("bankindex", verilator_ ?
+                    strprintf("%d'd%d", stmt->storage->BankBits(), b) :
+                    strprintf("%d", b));
+            out_->SetVar("bank", ArrayBankName(stmt->storage, b));
+            out_->Print(
+                "        $bankindex$: $bank$[$row$] <= $data$;\n");
+        }
+        out_->Print(
+            "    endcase\n");
+    }
+}
+
 namespace {
 string GetExprOp(IRStmtOp op) {
     switch (op) {
@@ -417,26 +1005,51 @@ string GetExprOp(IRStmtOp op) {
         case IRStmtOpCmpLE: return "<=";
         case IRStmtOpCmpEQ: return "==";
         case IRStmtOpCmpNE: return "!=";
-        case IRStmtOpCmpGT: return "<";
-        case IRStmtOpCmpGE: return "<=";
+        case IRStmtOpCmpGT: return ">";
+        case IRStmtOpCmpGE: return ">=";
         default: assert(false); return "";
     }
 }
 }  // anonymous namespace
 
+// Expressions are the bulk of the output, so these are emitted directly
+// rather than through variable substitution.
 void VerilogGenerator::GenerateNodeExpr(const IRStmt* stmt,
                                         const vector<string>& args) {
-    // Have vars: $signal$, $width$
+    const string signal = SignalName(stmt, stmt->stage->stage);
+    // A product is wider than its operands and a quotient or remainder
+    // narrower than its dividend; Verilator wants the operands widened to
+    // the width the operator computes in, and the result sliced from it.
+    if (verilator_ && (stmt->op == IRStmtOpMul || stmt->op == IRStmtOpDiv ||
+                       stmt->op == IRStmtOpRem)) {
+        int width = max(stmt->width, stmt->args[0]->width);
+        vector<string> operands;
+        for (unsigned i = 0; i < 2; i++) {
+            int pad = width - stmt->args[i]->width;
+            operands.push_back(pad == 0 ? args[i] :
+                    strprintf("{ %d'd0, %s }", pad, args[i].c_str()));
+        }
+        string expr = operands[0] + " " + GetExprOp(stmt->op) + " " +
+                      operands[1];
+        if (width == stmt->width) {
+            out_->Emit({ "assign ", signal, " = ", expr, ";\n" });
+        } else {
+            string full = signal + "_full";
+            DeclareWire(width, full);
+            out_->Emit({ "assign ", full, " = ", expr, ";\n",
+                         "assign ", signal, " = ", full, "[",
+                         stmt->width - 1, ":0];\n" });
+        }
+        return;
+    }
     switch (stmt->op) {
         case IRStmtOpConst:
-            out_->SetVar("const", string(stmt->constant));
-            out_->Print("assign $signal$ = $width$'d$const$;\n");
+            out_->Emit({ "assign ", signal, " = ", stmt->width, "'d",
+                         string(stmt->constant), ";\n" });
             break;
         case IRStmtOpAdd:
         case IRStmtOpSub:
         case IRStmtOpMul:
-        case IRStmtOpDiv:
-        case IRStmtOpRem:
         case IRStmtOpAnd:
         case IRStmtOpOr:
         case IRStmtOpXor:
@@ -448,51 +1061,46 @@ void VerilogGenerator::GenerateNodeExpr(const IRStmt* stmt,
         case IRStmtOpCmpNE:
         case IRStmtOpCmpGT:
         case IRStmtOpCmpGE:
-            out_->SetVars({
-                { "arg1", args[0] },
-                { "arg2", args[1] },
-                { "op", GetExprOp(stmt->op) },
-            });
-            out_->Print("assign $signal$ = $arg1$ $op$ $arg2$;\n");
+            out_->Emit({ "assign ", signal, " = ", args[0], " ",
+                         GetExprOp(stmt->op), " ", args[1], ";\n" });
+            break;
+
+        case IRStmtOpDiv:
+        case IRStmtOpRem:
+            // Verilog divides by zero to X; the models and the expanded
+            // divider (see ExpandDivRem() in lower.cc) yield 0.
+            out_->Emit({ "assign ", signal, " = (", args[1], " == 0) ? ",
+                         stmt->width, "'d0 : ", args[0], " ",
+                         GetExprOp(stmt->op), " ", args[1], ";\n" });
             break;
 
         case IRStmtOpNot:
-            out_->SetVars({
-                { "arg1", args[0] },
-            });
-            out_->Print("assign $signal$ = ~ $arg1$;\n");
+            out_->Emit({ "assign ", signal, " = ~ ", args[0], ";\n" });
             break;
 
         case IRStmtOpBitslice:
-            out_->SetVars({
-                { "arg", args[0] },
-                { "top", string(stmt->args[1]->constant) },
-                { "bot", string(stmt->args[2]->constant) },
-            });
-            out_->Print("assign $signal$ = $arg$[$top$:$bot$];\n");
+            out_->Emit({ "assign ", signal, " = ", args[0], "[",
+                         string(stmt->args[1]->constant), ":",
+                         string(stmt->args[2]->constant), "];\n" });
             break;
 
         case IRStmtOpConcat: {
-            out_->Print("assign $signal$ = { ");
+            // Each piece is indented separately, as a Print() of each would
+            // be.
+            out_->Emit({ "assign ", signal, " = { " });
             bool first = true;
             for (const auto& arg : args) {
-                PrinterScope subscope(out_);
-                out_->SetVar("arg", arg);
-                if (!first) out_->Print(", ");
+                if (!first) out_->Emit({ ", " });
                 first = false;
-                out_->Print("$arg$");
+                out_->Emit({ arg });
             }
-            out_->Print("};\n");
+            out_->Emit({ "};\n" });
             break;
         }
 
         case IRStmtOpSelect:
-            out_->SetVars({
-                { "sel", args[0] },
-                { "arg1", args[1] },
-                { "arg2", args[2] },
-            });
-            out_->Print("assign $signal$ = $sel$ ? $arg1$ : $arg2$;\n");
+            out_->Emit({ "assign ", signal, " = ", args[0], " ? ", args[1],
+                         " : ", args[2], ";\n" });
             break;
 
         default:
@@ -500,94 +1108,2294 @@ void VerilogGenerator::GenerateNodeExpr(const IRStmt* stmt,
     }
 }
 
-std::string VerilogGenerator::GetSignalInStage(const IRStmt* stmt, int stage) {
-    auto it = signal_stages_.find(stmt);
-    if (it == signal_stages_.end()) {
-        it = signal_stages_.insert(
-            make_pair(stmt,
-                      make_pair(stmt->stage->stage,
-                                stmt->stage->stage))).first;
+std::string PipeGenerator::GetSignalInStage(const IRStmt* stmt, int stage) {
+    if (stmt->unstaged) {
+        stage = stmt->stage->stage;
+    }
+    if (stmt->id >= static_cast<int>(signal_stages_.size())) {
+        signal_stages_.resize(stmt->id + 1, { nullptr, 0, 0 });
+    }
+    auto& entry = signal_stages_[stmt->id];
+    if (!entry.stmt) {
+        entry.stmt = stmt;
+        entry.min_stage = entry.max_stage = stmt->stage->stage;
+    }
+    if (stage < entry.min_stage) entry.min_stage = stage;
+    if (stage > entry.max_stage) {
+        entry.max_stage = stage;
+        // The piperegs carrying the value load under its valid, which must
+        // therefore reach the stage before this one.
+        if (stmt->valid_in && stmt->type != IRStmtBypassStart &&
+            stmt->type != IRStmtBypassWrite) {
+            GetSignalInStage(stmt->valid_in, stage - 1);
+        }
     }
-    auto& min_max = it->second;
-    if (stage < min_max.first) min_max.first = stage;
-    if (stage > min_max.second) min_max.second = stage;
     return SignalName(stmt, stage);
 }
 
-std::string VerilogGenerator::SignalName(const IRStmt* stmt, int stage) const {
+vector<const IRStmt*> PipeGenerator::StagedSignals() const {
+    vector<const IRStmt*> signals;
+    for (const auto& entry : signal_stages_) {
+        if (entry.stmt) signals.push_back(entry.stmt);
+    }
+    return signals;
+}
+
+std::string PipeGenerator::SignalName(const IRStmt* stmt, int stage) const {
     return strprintf("val%d_%d", stmt->valnum, stage);
 }
 
-void VerilogGenerator::GenerateStaging(const IRStmt* stmt) {
-    auto it = signal_stages_.find(stmt);
-    if (it == signal_stages_.end()) return;
-    auto min_max = it->second;
-    for (int i = min_max.first; i < min_max.second; i++) {
+vector<PipeGenerator::PipeReg> PipeGenerator::StagingFor(
+        const IRStmt* stmt) const {
+    vector<PipeReg> regs;
+    if (stmt->id >= static_cast<int>(signal_stages_.size()) ||
+        !signal_stages_[stmt->id].stmt) {
+        return regs;
+    }
+    const auto& entry = signal_stages_[stmt->id];
+    for (int i = entry.min_stage; i < entry.max_stage; i++) {
         // We need to stage the value from pipestage i to pipestage i+1.
-        PrinterScope scope(out_);
-        out_->SetVars({
-            { "src", SignalName(stmt, i) },
-            { "dst", SignalName(stmt, i+1) },
-            // Valid signal is staged because it logically travels with the txn.
-            { "valid", stmt->valid_in ? SignalName(stmt->valid_in, i) : "1'b1" },
-            // Stall signal is not staged -- comes directly from combinational
-            // logic that generates it.
-            { "hold",  stmt->pipe->stages[i]->stall ?
-                       SignalName(stmt->pipe->stages[i]->stall,
-                                  stmt->pipe->stages[i]->stall->stage->stage) : "1'b0" },
-            { "width", strprintf("%d", stmt->width) },
-            { "instance_name", SignalName(stmt, i+1) + "_pipereg" },
-        });
+        PipeReg reg;
+        reg.src = SignalName(stmt, i);
+        reg.dst = SignalName(stmt, i+1);
+        // Valid signal is staged because it logically travels with the txn.
+        // A bypass lane is latched every cycle instead: it carries its own
+        // index-valid bit, so a bubble must replace the lane before it.
+        if (stmt->valid_in && stmt->type != IRStmtBypassStart &&
+            stmt->type != IRStmtBypassWrite) {
+            reg.valid = SignalName(stmt->valid_in, i);
+        }
+        // Stall signal is not staged -- comes directly from combinational
+        // logic that generates it.
+        if (stmt->pipe->stages[i]->stall) {
+            reg.hold = SignalName(stmt->pipe->stages[i]->stall,
+                                  stmt->pipe->stages[i]->stall->stage->stage);
+        }
+        reg.width = stmt->width;
+        reg.pipe = stmt->pipe;
+        reg.stage = i;
+        // Restart values are latched, not carried with the transaction, so
+        // they skip skid buffers.
+        reg.skid = i + 1 < static_cast<int>(stmt->pipe->stages.size()) &&
+                   stmt->pipe->stages[i+1]->skid &&
+                   stmt->type != IRStmtRestartValueSrc;
+        if (reg.skid) {
+            reg.dst += kArrivingSuffix;
+        }
+        reg.data = stmt->width > 1 && stmt->type != IRStmtBypassStart &&
+                   stmt->type != IRStmtBypassWrite;
+        regs.push_back(reg);
+    }
+    return regs;
+}
 
-        out_->Print("pipereg #($width$) $instance_name$(\n"
-                    "  .src($src$),\n"
-                    "  .dst($dst$),\n"
-                    "  .valid($valid$),\n"
-                    "  .hold($hold$),\n"
-                    "  .clock(clock),\n"
-                    "  .reset(reset));\n");
-        out_->Print("wire [$width$-1:0] $dst$;\n");
+vector<PipeGenerator::PipeReg> PipeGenerator::PortStaging(
+        const IRPort* port, int width) {
+    vector<PipeReg> regs;
+    for (int i = 0; i < port->latency; i++) {
+        PipeReg reg;
+        reg.src = i == 0 ? PortWriteSignal(port) : strprintf("%s_q%d",
+                port->name.c_str(), i);
+        reg.dst = strprintf("%s_q%d", port->name.c_str(), i + 1);
+        reg.width = width;
+        reg.pipe = nullptr;
+        reg.stage = 0;
+        reg.skid = false;
+        reg.data = false;
+        regs.push_back(reg);
     }
+    return regs;
 }
 
-void VerilogGenerator::GenerateStorage(const IRStorage* storage) {
-    PrinterScope scope(out_);
-    out_->SetVar("name", storage->name);
-    out_->SetVar("width", strprintf("%d", storage->data_width));
-    assert(storage->index_width < 64);  // checked during typecheck
-    out_->SetVar("entries", strprintf("%d", storage->elements));
+string PipeGenerator::PortWriteSignal(const IRPort* port) {
+    if (port->latency == 0 || !port->exported || port->defs.empty()) {
+        return port->name;
+    }
+    return port->name + "_q0";
+}
 
-    if (storage->index_width == 0) {  // individual register
-        out_->Print("reg [$width$-1:0] reg_$name$;\n");
-    } else {  // array
-        out_->Print("reg [$width$-1:0] array_$name$[$entries$-1:0];\n");
+string PipeGenerator::PortReadSignal(const IRPort* port) {
+    if (port->latency == 0 || (port->defs.empty() && !port->exported)) {
+        return port->name;
     }
+    return strprintf("%s_q%d", port->name.c_str(), port->latency);
 }
 
-void VerilogGenerator::GeneratePipeRegModule() {
-    out_->Print(
-        "\n"
-        "module pipereg(\n"
-        "    input [width-1:0] src,\n"
-        "    output [width-1:0] dst,\n"
-        "    input valid,\n"
-        "    input hold,\n"
-        "    input clock,\n"
-        "    input reset);\n"
-        "\n"
-        "    parameter width = 1;\n"
-        "\n"
-        "    reg [width-1:0] dst;\n"
-        "    initial dst <= 0;\n"
-        "\n"
-        "    always @(posedge clock) begin\n"
-        "        if (reset)\n"
-        "            dst <= 0;\n"
-        "        else begin\n"
-        "            if (valid)\n"
-        "                dst <= src;\n"
-        "        end\n"
-        "    end\n"
+string PipeGenerator::SkidOutput(const PipeReg& reg) {
+    return reg.dst.substr(0, reg.dst.size() - strlen(kArrivingSuffix));
+}
+
+string PipeGenerator::SkidName(const PipeStage* stage) const {
+    return strprintf("skid%d", stage->skid->present->valnum);
+}
+
+void PipeGenerator::StageSkids() {
+    for (auto* sys : systems_) {
+        for (auto& pipe : sys->pipes) {
+            for (auto& stage : pipe->stages) {
+                if (stage->skid) {
+                    GetSignalInStage(stage->skid->present, stage->stage);
+                }
+            }
+        }
+    }
+}
+
+vector<PipeGenerator::Skid> PipeGenerator::Skids() const {
+    vector<Skid> skids;
+    map<pair<const Pipe*, int>, int> index;
+    for (auto* sys : systems_) {
+        for (auto& pipe : sys->pipes) {
+            for (auto& stage : pipe->stages) {
+                if (!stage->skid) continue;
+                Skid skid;
+                skid.pipe = pipe.get();
+                skid.stage = stage.get();
+                skid.name = SkidName(stage.get());
+                skid.present = SignalName(stage->skid->present, stage->stage) +
+                               kArrivingSuffix;
+                skid.hold = SignalName(stage->stall, stage->stage);
+                index[make_pair(pipe.get(), stage->stage)] = skids.size();
+                skids.push_back(skid);
+            }
+        }
+    }
+    for (const auto* signal : StagedSignals()) {
+        for (const auto& reg : StagingFor(signal)) {
+            if (!reg.skid) continue;
+            skids[index[make_pair(reg.pipe, reg.stage + 1)]].regs.push_back(reg);
+        }
+    }
+    return skids;
+}
+
+void VerilogGenerator::GenerateStaging(const IRStmt* stmt) {
+    for (const auto& reg : StagingFor(stmt)) {
+        auto it = registered_reads_.find(reg.src);
+        if (it != registered_reads_.end()) {
+            GenerateReadRegister(reg, it->second);
+        } else {
+            GeneratePipeReg(reg, reg.dst + "_pipereg");
+        }
+    }
+}
+
+string VerilogGenerator::PipeRegModule(const PipeReg& reg) const {
+    if (!specialize_piperegs_ || !reg.data) {
+        return "pipereg";
+    }
+    return retime_piperegs_ ? "pipereg_retime" : "pipereg_data";
+}
+
+void VerilogGenerator::GeneratePipeReg(const PipeReg& reg,
+                                       const string& instance_name) {
+    string module = PipeRegModule(reg);
+    pipereg_modules_.insert(module);
+    // The data variants have no reset.
+    bool reset = module == "pipereg";
+    out_->Emit({ module, " #(", reg.width, ") ", instance_name, "(\n",
+                 "  .src(", reg.src, "),\n",
+                 "  .dst(", reg.dst, "),\n",
+                 "  .valid(", reg.valid.empty() ? "1'b1" : reg.valid, "),\n",
+                 "  .hold(", reg.hold.empty() ? "1'b0" : reg.hold, "),\n",
+                 reset ? "  .clock(clock),\n" : "  .clock(clock));\n",
+                 reset ? "  .reset(reset));\n" : "" });
+    DeclareWire(reg.width, reg.dst);
+}
+
+void VerilogGenerator::GenerateReadRegister(const PipeReg& reg,
+                                            const string& word) {
+    // As a pipereg, but reading the array word directly, so that the array
+    // and its read register form a synchronous RAM.
+    declared_[reg.dst] = reg.width;
+    string valid = reg.valid.empty() ? "1'b1" : reg.valid;
+    if (specialize_piperegs_ && reg.data) {
+        if (verilator_) {
+            declarations_.push_back(strprintf("reg [%d-1:0] %s;\n", reg.width,
+                                              reg.dst.c_str()));
+        } else {
+            out_->Emit({ "reg [", reg.width, "-1:0] ", reg.dst, ";\n" });
+        }
+        out_->Emit({ "initial ", reg.dst, verilator_ ? " = " : " <= ",
+                     Zero(reg.width), ";\n",
+                     "always @(posedge clock)\n",
+                     "    if (", valid, ")\n",
+                     "        ", reg.dst, " <= ", word, ";\n" });
+        return;
+    }
+    if (verilator_) {
+        declarations_.push_back(strprintf("reg [%d-1:0] %s;\n", reg.width,
+                                          reg.dst.c_str()));
+        string zero = Zero(reg.width);
+        out_->Emit({ "initial ", reg.dst, " = ", zero, ";\n",
+                     "always @(posedge clock) begin\n",
+                     "    if (reset)\n",
+                     "        ", reg.dst, " <= ", zero, ";\n",
+                     "    else if (", reg.valid.empty() ? "1'b1" : reg.valid, ")\n",
+                     "        ", reg.dst, " <= ", word, ";\n",
+                     "end\n" });
+        return;
+    }
+    out_->Emit({ "reg [", reg.width, "-1:0] ", reg.dst, ";\n",
+                 "initial ", reg.dst, " <= 0;\n",
+                 "always @(posedge clock) begin\n",
+                 "    if (reset)\n",
+                 "        ", reg.dst, " <= 0;\n",
+                 "    else if (", reg.valid.empty() ? "1'b1" : reg.valid, ")\n",
+                 "        ", reg.dst, " <= ", word, ";\n",
+                 "end\n" });
+}
+
+void VerilogGenerator::GenerateSkid(const Skid& skid) {
+    // The buffer holds the concatenation of its values, the first most
+    // significant.
+    int width = 0;
+    string in = "{ ";
+    for (unsigned i = 0; i < skid.regs.size(); i++) {
+        if (i > 0) in += ", ";
+        in += skid.regs[i].dst;
+        width += skid.regs[i].width;
+    }
+    in += " }";
+    if (skid.regs.empty()) {
+        width = 1;
+        in = "1'b0";
+    }
+    if (verilator_) {
+        DeclareWire(width, skid.name + "_out");
+        DeclareWire(1, skid.name + "_full");
+    } else {
+        out_->Emit({ "wire [", width, "-1:0] ", skid.name, "_out;\n",
+                     "wire ", skid.name, "_full;\n" });
+        declared_[skid.name + "_out"] = width;
+        declared_[skid.name + "_full"] = 1;
+    }
+    out_->Emit({ "skidbuf #(", width, ", ", skid.stage->skid->depth, ") ",
+                 skid.name, "(\n",
+                 "  .in(", in, "),\n",
+                 "  .in_valid(", skid.present, "),\n",
+                 "  .out(", skid.name, "_out),\n",
+                 "  .hold(", skid.hold, "),\n",
+                 "  .full(", skid.name, "_full),\n",
+                 "  .clock(clock),\n",
+                 "  .reset(reset));\n" });
+    int top = width;
+    for (const auto& reg : skid.regs) {
+        string signal = SkidOutput(reg);
+        DeclareWire(reg.width, signal);
+        out_->Emit({ "assign ", signal, " = ", skid.name, "_out",
+                     "[", top - 1, ":", top - reg.width, "];\n" });
+        top -= reg.width;
+    }
+}
+
+void VerilogGenerator::GenerateBundledStaging() {
+    // Group piperegs by (pipe, boundary, valid, hold, pipereg module), in
+    // order of first appearance so that output is deterministic.
+    typedef std::tuple<const Pipe*, int, string, string, string> BundleKey;
+    map<BundleKey, int> bundle_index;
+    vector<vector<PipeReg>> bundles;
+    for (const auto* signal : StagedSignals()) {
+        if (!InModule(signal)) continue;
+        for (const auto& reg : StagingFor(signal)) {
+            // A read register stays next to its array.
+            auto read = registered_reads_.find(reg.src);
+            if (read != registered_reads_.end()) {
+                GenerateReadRegister(reg, read->second);
+                continue;
+            }
+            BundleKey key(reg.pipe, reg.stage, reg.valid, reg.hold,
+                          PipeRegModule(reg));
+            auto it = bundle_index.find(key);
+            if (it == bundle_index.end()) {
+                it = bundle_index.insert(
+                        make_pair(key, static_cast<int>(bundles.size()))).first;
+                bundles.push_back({});
+            }
+            bundles[it->second].push_back(reg);
+        }
+    }
+
+    for (unsigned i = 0; i < bundles.size(); i++) {
+        const auto& regs = bundles[i];
+        if (regs.size() == 1) {
+            GeneratePipeReg(regs[0], regs[0].dst + "_pipereg");
+            continue;
+        }
+
+        // The bundle is the concatenation of its members, the first member
+        // most significant.
+        string name = strprintf("pipebundle%d", i);
+        PipeReg bundle = regs[0];
+        bundle.src = "{ ";
+        bundle.dst = name + "_dst";
+        bundle.width = 0;
+        for (unsigned j = 0; j < regs.size(); j++) {
+            if (j > 0) bundle.src += ", ";
+            bundle.src += regs[j].src;
+            bundle.width += regs[j].width;
+        }
+        bundle.src += " }";
+        GeneratePipeReg(bundle, name + "_pipereg");
+
+        int top = bundle.width;
+        for (const auto& reg : regs) {
+            DeclareWire(reg.width, reg.dst);
+            out_->Emit({ "assign ", reg.dst, " = ", bundle.dst,
+                         "[", top - 1, ":", top - reg.width, "];\n" });
+            top -= reg.width;
+        }
+    }
+}
+
+void VerilogGenerator::GenerateStorage(const IRStorage* storage) {
+    PrinterScope scope(out_);
+    out_->SetVar("name", storage->name);
+    out_->SetVar("width", strprintf("%d", storage->data_width));
+    assert(storage->index_width < 64);  // checked during typecheck
+    out_->SetVar("entries", strprintf("%d", storage->elements));
+
+    if (storage->index_width == 0) {  // individual register
+        out_->Print("reg [$width$-1:0] reg_$name$;\n");
+    } else if (storage->banks == 1) {  // array
+        out_->Print("reg [$width$-1:0] array_$name$[$entries$-1:0];\n");
+    } else {  // banked array: element i is in bank i % banks
+        out_->SetVar("rows", strprintf("%d",
+                    (storage->elements + storage->banks - 1) /
+                    storage->banks));
+        for (int b = 0; b < storage->banks; b++) {
+            out_->SetVar("bank", ArrayBankName(storage, b));
+            out_->Print("reg [$width$-1:0] $bank$[$rows$-1:0];\n");
+        }
+    }
+}
+
+void VerilogGenerator::GenerateStorageWrites(const IRStorage* storage) {
+    auto it = storage_writes_.find(storage);
+    if (it == storage_writes_.end()) return;
+    PrinterScope scope(out_);
+    out_->Print("always @(negedge clock) begin\n");
+    out_->Indent();
+    if (storage->index_width == 0) {
+        out_->SetVars({
+            { "regname", storage->name },
+            { "zero", Zero(storage->data_width) },
+        });
+        out_->Print("if (reset)\n"
+                    "    reg_$regname$ <= $zero$;\n"
+                    "else begin\n");
+        out_->Indent();
+        for (const auto* stmt : it->second) {
+            int stage = stmt->stage->stage;
+            out_->SetVars({
+                { "predicate", stmt->valid_in ?
+                        SignalName(stmt->valid_in, stage) : "1'b1" },
+                { "arg", SignalName(stmt->args[0], stage) },
+            });
+            out_->Print("if ($predicate$)\n"
+                        "    reg_$regname$ <= $arg$;\n");
+        }
+        out_->Outdent();
+        out_->Print("end\n");
+    } else {
+        for (const auto* stmt : it->second) {
+            GenerateArrayWrite(stmt);
+        }
+    }
+    out_->Outdent();
+    out_->Print("end\n");
+}
+
+vector<PipeGenerator::PerfCounter> PipeGenerator::PerfCounters(
+        const vector<PipeSys*>& systems, bool profile) {
+    vector<PerfCounter> counters;
+    for (unsigned s = 0; s < systems.size(); s++) {
+        for (unsigned p = 0; p < systems[s]->pipes.size(); p++) {
+            const Pipe* pipe = systems[s]->pipes[p].get();
+            for (auto& stage : pipe->stages) {
+                for (auto& event : stage->perf_events) {
+                    if (event.site && !profile) continue;
+                    counters.push_back({ static_cast<int>(s),
+                                         static_cast<int>(p), pipe,
+                                         stage->stage, event.name,
+                                         event.signal, event.site });
+                }
+            }
+        }
+    }
+    return counters;
+}
+
+int PipeGenerator::PerfSelectWidth(int counters) {
+    int bits = 1;
+    while ((1 << bits) < counters) bits++;
+    return bits;
+}
+
+void PipeGenerator::WritePerfCounterLayout(ostream* out,
+                                           const vector<PipeSys*>& systems,
+                                           const string& name) {
+    vector<PerfCounter> counters = PerfCounters(systems);
+    *out << strprintf("{\n  \"module\": \"%s\",\n", name.c_str());
+    *out << strprintf("  \"select_port\": \"perf_counter_select\", "
+                      "\"select_width\": %d,\n",
+                      counters.empty() ? 0 : PerfSelectWidth(counters.size()));
+    *out << strprintf("  \"value_port\": \"perf_counter_value\", "
+                      "\"counter_width\": %d,\n", kPerfCounterWidth);
+    *out << "  \"counters\": [";
+    for (unsigned i = 0; i < counters.size(); i++) {
+        const PerfCounter& c = counters[i];
+        *out << (i ? ",\n" : "\n");
+        *out << strprintf("    {\"index\": %d, \"process\": %d, "
+                          "\"pipe\": %d, \"entry\": \"%s\", "
+                          "\"lane\": %d, \"stage\": %d, "
+                          "\"event\": \"%s\"}",
+                          i, c.sys, c.pipe_index,
+                          c.pipe->entry->label.c_str(), c.pipe->lane,
+                          c.stage, c.event);
+    }
+    *out << (counters.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
+
+void PipeGenerator::WriteProfileLayout(ostream* out,
+                                       const vector<PipeSys*>& systems,
+                                       const string& name) {
+    vector<PerfCounter> events = PerfCounters(systems, true);
+    *out << strprintf("{\n  \"module\": \"%s\",\n", name.c_str());
+    *out << "  \"events\": [";
+    for (unsigned i = 0; i < events.size(); i++) {
+        const PerfCounter& e = events[i];
+        *out << (i ? ",\n" : "\n");
+        *out << strprintf("    {\"index\": %d, \"process\": %d, "
+                          "\"pipe\": %d, \"entry\": \"%s\", "
+                          "\"lane\": %d, \"stage\": %d, "
+                          "\"event\": \"%s\"",
+                          i, e.sys, e.pipe_index,
+                          e.pipe->entry->label.c_str(), e.pipe->lane,
+                          e.stage, e.event);
+        if (e.site) {
+            // A restart's transaction comes from its backedge's stage, and
+            // a spawn's starts in the pipe that it spawns.
+            if (e.site->type == IRStmtBackedge) {
+                *out << strprintf(", \"from_stage\": %d",
+                                  e.site->stage->stage);
+            }
+            const auto& pipes = systems[e.sys]->pipes;
+            for (unsigned p = 0; p < pipes.size(); p++) {
+                if (e.site->type == IRStmtSpawn &&
+                    pipes[p]->spawn == e.site) {
+                    *out << strprintf(", \"target_pipe\": %d", p);
+                }
+            }
+            *out << strprintf(", \"location\": \"%s\"",
+                              e.site->location.line > 0 ?
+                              e.site->location.ToString().c_str() :
+                              "(generated)");
+        }
+        *out << "}";
+    }
+    *out << (events.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
+
+// An exported port with a latency is registered where it crosses the module
+// boundary: an input passes through its registers before any reader sees it,
+// and an output is driven by the last register after its writer.
+void VerilogGenerator::GenerateIORegisters() {
+    for (auto& port : program_->ports) {
+        if (!port->exported || port->latency == 0) continue;
+        for (const auto& reg : PortStaging(port.get(), port->width)) {
+            GeneratePipeReg(reg, reg.dst + "_pipereg");
+        }
+        if (!port->defs.empty()) {
+            out_->Emit({ "assign ", port->name, " = ", PortReadSignal(port.get()),
+                         ";\n" });
+        }
+    }
+}
+
+// The counters are one array of registers, counting on the falling edge as
+// the storage elements are written; their read port is combinational. In
+// Verilator mode each counter has its own always block, with sized
+// constants.
+void VerilogGenerator::GeneratePerfCounters() {
+    if (perf_counters_.empty()) return;
+    PrinterScope scope(out_);
+    int select_width = PerfSelectWidth(perf_counters_.size());
+    out_->SetVars({
+        { "width", strprintf("%d", kPerfCounterWidth) },
+        { "count", strprintf("%d", (int)perf_counters_.size()) },
+    });
+    out_->Print("reg [$width$-1:0] perf_counters[$count$-1:0];\n");
+    if (verilator_) {
+        out_->SetVars({
+            { "zero", Zero(kPerfCounterWidth) },
+            { "select_count", strprintf("%d'd%d", select_width,
+                                        (int)perf_counters_.size()) },
+        });
+        for (unsigned i = 0; i < perf_counters_.size(); i++) {
+            const PerfCounter& c = perf_counters_[i];
+            out_->Print("always @(negedge clock)\n"
+                        "    if (reset)\n"
+                        "        perf_counters[$i$] <= $zero$;\n"
+                        "    else if ($event$)\n"
+                        "        perf_counters[$i$] <= perf_counters[$i$] + "
+                        "$width$'d1;\n",
+                        { { "i", strprintf("%d", i) },
+                          { "event", GetSignalInStage(c.signal, c.stage) } });
+        }
+        // A select of 2^n counters is always in range.
+        if ((1 << select_width) == static_cast<int>(perf_counters_.size())) {
+            out_->Print("assign perf_counter_value = "
+                        "perf_counters[perf_counter_select];\n");
+        } else {
+            out_->Print("assign perf_counter_value = "
+                        "perf_counter_select < $select_count$ ?\n"
+                        "    perf_counters[perf_counter_select] : $zero$;\n");
+        }
+        return;
+    }
+    out_->Print("always @(negedge clock) begin\n");
+    out_->Indent();
+    out_->Print("if (reset) begin\n");
+    for (unsigned i = 0; i < perf_counters_.size(); i++) {
+        out_->Print("    perf_counters[$i$] <= 0;\n",
+                    { { "i", strprintf("%d", i) } });
+    }
+    out_->Print("end else begin\n");
+    for (unsigned i = 0; i < perf_counters_.size(); i++) {
+        const PerfCounter& c = perf_counters_[i];
+        out_->Print("    if ($event$)\n"
+                    "        perf_counters[$i$] <= perf_counters[$i$] + 1;\n",
+                    { { "i", strprintf("%d", i) },
+                      { "event", GetSignalInStage(c.signal, c.stage) } });
+    }
+    out_->Print("end\n");
+    out_->Outdent();
+    out_->Print("end\n"
+                "assign perf_counter_value = perf_counter_select < $count$ ?\n"
+                "    perf_counters[perf_counter_select] : 0;\n");
+}
+
+// The profile trace is for simulation only: given +profile_trace=<file>, it
+// writes a line to the file on each falling edge out of reset, listing the
+// indices of the events that occurred in the cycle (see
+// WriteProfileLayout()).
+void VerilogGenerator::GenerateProfileTrace() {
+    if (profile_events_.empty()) return;
+    out_->Emit({ "// synthesis translate_off\n"
+                 "integer profile_trace;\n"
+                 "reg [8*1024-1:0] profile_trace_file;\n"
+                 "initial begin\n"
+                 "    profile_trace = 0;\n"
+                 "    if ($value$plusargs(\"profile_trace=%s\", "
+                 "profile_trace_file))\n"
+                 "        profile_trace = $fopen(profile_trace_file, \"w\");\n"
+                 "end\n"
+                 "always @(negedge clock) begin\n"
+                 "    if (!reset && profile_trace != 0) begin\n" });
+    for (unsigned i = 0; i < profile_events_.size(); i++) {
+        const PerfCounter& e = profile_events_[i];
+        out_->Emit({ "        if (", GetSignalInStage(e.signal, e.stage),
+                     ") $fwrite(profile_trace, \" ", static_cast<int>(i),
+                     "\");\n" });
+    }
+    out_->Emit({ "        $fwrite(profile_trace, \"\\n\");\n"
+                 "    end\n"
+                 "end\n"
+                 "// synthesis translate_on\n" });
+}
+
+void VerilogGenerator::GeneratePipeRegModule() {
+    GenerateGenericPipeRegModule();
+    // The data variants neither reset nor load without a valid transaction;
+    // the retimable one asks synthesis to move its register across the
+    // logic around it.
+    for (const char* module : { "pipereg_data", "pipereg_retime" }) {
+        if (!pipereg_modules_.count(module)) continue;
+        PrinterScope scope(out_);
+        out_->SetVars({
+            { "module", module },
+            { "attributes", string(module) == "pipereg_retime" ?
+                    "(* retiming_forward = 1, retiming_backward = 1 *) " : "" },
+        });
+        if (verilator_) {
+            out_->Print(
+                "\n"
+                "module $module$ #(\n"
+                "    parameter width = 1\n"
+                ") (\n"
+                "    input [width-1:0] src,\n"
+                "    $attributes$output reg [width-1:0] dst,\n"
+                "    input valid,\n"
+                "    /* verilator lint_off UNUSED */\n"
+                "    input hold,\n"
+                "    /* verilator lint_on UNUSED */\n"
+                "    input clock);\n"
+                "\n"
+                "    initial dst = {width{1'b0}};\n"
+                "\n"
+                "    always @(posedge clock)\n"
+                "        if (valid)\n"
+                "            dst <= src;\n"
+                "\n"
+                "endmodule\n");
+        } else {
+            out_->Print(
+                "\n"
+                "module $module$(\n"
+                "    input [width-1:0] src,\n"
+                "    output [width-1:0] dst,\n"
+                "    input valid,\n"
+                "    input hold,\n"
+                "    input clock);\n"
+                "\n"
+                "    parameter width = 1;\n"
+                "\n"
+                "    $attributes$reg [width-1:0] dst;\n"
+                "    initial dst <= 0;\n"
+                "\n"
+                "    always @(posedge clock)\n"
+                "        if (valid)\n"
+                "            dst <= src;\n"
+                "\n"
+                "endmodule\n");
+        }
+    }
+}
+
+void VerilogGenerator::GenerateGenericPipeRegModule() {
+    if (verilator_) {
+        out_->Print(
+            "\n"
+            "module pipereg #(\n"
+            "    parameter width = 1\n"
+            ") (\n"
+            "    input [width-1:0] src,\n"
+            "    output reg [width-1:0] dst,\n"
+            "    input valid,\n"
+            "    /* verilator lint_off UNUSED */\n"
+            "    input hold,\n"
+            "    /* verilator lint_on UNUSED */\n"
+            "    input clock,\n"
+            "    input reset);\n"
+            "\n"
+            "    initial dst = {width{1'b0}};\n"
+            "\n"
+            "    always @(posedge clock)\n"
+            "        if (reset)\n"
+            "            dst <= {width{1'b0}};\n"
+            "        else if (valid)\n"
+            "            dst <= src;\n"
+            "\n"
+            "endmodule\n");
+        return;
+    }
+    out_->Print(
+        "\n"
+        "module pipereg(\n"
+        "    input [width-1:0] src,\n"
+        "    output [width-1:0] dst,\n"
+        "    input valid,\n"
+        "    input hold,\n"
+        "    input clock,\n"
+        "    input reset);\n"
+        "\n"
+        "    parameter width = 1;\n"
+        "\n"
+        "    reg [width-1:0] dst;\n"
+        "    initial dst <= 0;\n"
+        "\n"
+        "    always @(posedge clock) begin\n"
+        "        if (reset)\n"
+        "            dst <= 0;\n"
+        "        else begin\n"
+        "            if (valid)\n"
+        "                dst <= src;\n"
+        "        end\n"
+        "    end\n"
+        "\n"
+        "endmodule\n");
+}
+
+void VerilogGenerator::GenerateSkidBufModule() {
+    // The buffer passes its input straight through while empty and not held.
+    // Otherwise it presents its oldest entry, and queues each arriving
+    // transaction. |full| depends only on registers: it is set when the
+    // buffer could not take one more transaction after the one arriving.
+    //
+    // In Verilator mode, the count and the entries are updated in separate
+    // always blocks, and the entries are indexed only by constants and the loop
+    // variable.
+    if (verilator_) {
+        out_->Print(
+            "\n"
+            "module skidbuf #(\n"
+            "    parameter width = 1,\n"
+            "    parameter depth = 2\n"
+            ") (\n"
+            "    input [width-1:0] in,\n"
+            "    input in_valid,\n"
+            "    output [width-1:0] out,\n"
+            "    input hold,\n"
+            "    output full,\n"
+            "    input clock,\n"
+            "    input reset);\n"
+            "\n"
+            "    reg [width-1:0] entries[depth-1:0];\n"
+            "    reg [31:0] count;\n"
+            "    initial count = 32'd0;\n"
+            "    integer i;\n"
+            "\n"
+            "    wire pop = !hold && count != 32'd0;\n"
+            "    wire push = in_valid && (hold || count != 32'd0);\n"
+            "    wire [31:0] tail = count - {31'd0, pop};\n"
+            "\n"
+            "    assign out = count != 32'd0 ? entries[0] : in;\n"
+            "    assign full = count + {31'd0, in_valid} >= depth;\n"
+            "\n"
+            "    always @(posedge clock)\n"
+            "        if (reset)\n"
+            "            count <= 32'd0;\n"
+            "        else\n"
+            "            count <= count + {31'd0, push} - {31'd0, pop};\n"
+            "\n"
+            "    always @(posedge clock)\n"
+            "        if (!reset) begin\n"
+            "            for (i = 0; i < depth - 1; i = i + 1)\n"
+            "                if (push && tail == i)\n"
+            "                    entries[i] <= in;\n"
+            "                else if (pop)\n"
+            "                    entries[i] <= entries[i + 1];\n"
+            "            if (push && tail == depth - 1)\n"
+            "                entries[depth - 1] <= in;\n"
+            "        end\n"
+            "\n"
+            "endmodule\n");
+        return;
+    }
+    out_->Print(
+        "\n"
+        "module skidbuf(\n"
+        "    input [width-1:0] in,\n"
+        "    input in_valid,\n"
+        "    output [width-1:0] out,\n"
+        "    input hold,\n"
+        "    output full,\n"
+        "    input clock,\n"
+        "    input reset);\n"
+        "\n"
+        "    parameter width = 1;\n"
+        "    parameter depth = 2;\n"
+        "\n"
+        "    reg [width-1:0] entries[depth-1:0];\n"
+        "    reg [31:0] count;\n"
+        "    initial count <= 0;\n"
+        "    integer i;\n"
+        "\n"
+        "    wire pop = !hold && count != 0;\n"
+        "    wire push = in_valid && (hold || count != 0);\n"
+        "\n"
+        "    assign out = count != 0 ? entries[0] : in;\n"
+        "    assign full = count + in_valid >= depth;\n"
+        "\n"
+        "    always @(posedge clock) begin\n"
+        "        if (reset)\n"
+        "            count <= 0;\n"
+        "        else begin\n"
+        "            if (pop)\n"
+        "                for (i = 0; i < depth - 1; i = i + 1)\n"
+        "                    entries[i] <= entries[i + 1];\n"
+        "            if (push)\n"
+        "                entries[count - pop] <= in;\n"
+        "            count <= count + push - pop;\n"
+        "        end\n"
+        "    end\n"
         "\n"
         "endmodule\n");
 }
+
+// C++ model generation.
+//
+// The model mirrors the Verilog above one-for-one. Each wire becomes a field
+// computed in eval(); each pipereg becomes a field updated in rising_edge();
+// each register or array write is performed in falling_edge(). Signals are
+// held in uint64_t, unsigned __int128 or, above 128 bits, the multi-word
+// ap_wide<> type from the model's prelude, and are masked to their width
+// after every assignment so that arithmetic wraps as in Verilog.
+//
+// The bit-sliced model is generated from the same code: each value is an
+// ap_slice<> of exactly its width, whose operators in the bit-sliced prelude
+// compute in every lane what the scalar operators would. Only the constructs
+// C++ cannot overload differ: a ?: is an ap_select(), a conditional write
+// assigns through ap_select(), and arrays are read and written with
+// ap_read() and ap_write(), as each lane may access a different entry.
+
+namespace {
+string CppType(int width) {
+    if (width <= 64) return "uint64_t";
+    if (width <= 128) return "ap_u128";
+    return strprintf("ap_wide<%d>", (width + 63) / 64);
+}
+
+// A constant of |width| bits, as a value of |type|.
+string CppConstant(const bignum& value, int width, const string& type) {
+    bignum masked = value & ((bignum(1) << width) - 1);
+    string hex = masked.str(0, std::ios_base::hex);
+    if (hex.size() <= 16) {
+        return "0x" + hex + "ull";
+    }
+    // Assemble wider constants 64 bits at a time, most significant first.
+    int first = hex.size() - ((hex.size() - 1) / 16) * 16;
+    string code = "(" + type + ")0x" + hex.substr(0, first) + "ull";
+    for (int i = first; i < hex.size(); i += 16) {
+        code = "(" + code + " << 64 | (" + type + ")0x" +
+               hex.substr(i, 16) + "ull)";
+    }
+    return code;
+}
+
+// Builds the concatenation of (expr, width) parts, most significant first,
+// in a value of type |type|.
+string CppConcat(const vector<pair<string, int>>& parts, const string& type) {
+    string code;
+    int shift = 0;
+    for (int i = parts.size() - 1; i >= 0; i--) {
+        string part = "(" + type + ")" + parts[i].first;
+        if (shift > 0) {
+            part = "(" + part + strprintf(" << %d)", shift);
+        }
+        code = code.empty() ? part : part + " | " + code;
+        shift += parts[i].second;
+    }
+    return code.empty() ? "0" : code;
+}
+
+// The element of the array accessed by |stmt| at |index|, as an lvalue. In a
+// banked array whose bank the index does not fix, this selects among the
+// banks' rows on the bank bits.
+string ArrayElement(const IRStmt* stmt, const string& index) {
+    const IRStorage* storage = stmt->storage;
+    if (storage->banks == 1) {
+        return strprintf("array_%s[(size_t)%s]", storage->name.c_str(),
+                         index.c_str());
+    }
+    string row = strprintf("[(size_t)(%s >> %d)]", index.c_str(),
+                           storage->BankBits());
+    if (stmt->array_bank != -1) {
+        return ArrayBankName(storage, stmt->array_bank) + row;
+    }
+    vector<string> values;
+    for (int b = 0; b < storage->banks; b++) {
+        values.push_back(ArrayBankName(storage, b) + row);
+    }
+    string code = values.back();
+    for (int b = storage->banks - 2; b >= 0; b--) {
+        code = strprintf("(%s & %d) == %d ? %s : (%s)", index.c_str(),
+                         storage->banks - 1, b, values[b].c_str(),
+                         code.c_str());
+    }
+    return "(" + code + ")";
+}
+
+// In the bit-sliced model: a cast to a width that holds both the index of
+// |stmt| and |value|, for comparing the two.
+string SlicedIndexCast(const IRStmt* stmt, int value) {
+    int width = stmt->args[0]->width;
+    while (width < 31 && (1 << width) <= value) width++;
+    return strprintf("(ap_slice<%d>)", width);
+}
+
+// In the bit-sliced model: whether the index of |stmt| is in bounds, and
+// whether it falls in |bank|.
+string SlicedInBounds(const IRStmt* stmt, const string& index) {
+    string cast = SlicedIndexCast(stmt, stmt->storage->elements);
+    return strprintf("(%s%s < %s%d)", cast.c_str(), index.c_str(),
+                     cast.c_str(), stmt->storage->elements);
+}
+string SlicedInBank(const IRStmt* stmt, const string& index, int bank) {
+    int mask = stmt->storage->banks - 1;
+    string cast = SlicedIndexCast(stmt, mask);
+    return strprintf("((%s%s & %s%d) == %s%d)", cast.c_str(), index.c_str(),
+                     cast.c_str(), mask, cast.c_str(), bank);
+}
+
+// The bit-sliced counterparts of an ArrayElement() read and write. A banked
+// array is accessed in each bank that the index may select, by row.
+string SlicedArrayRead(const IRStmt* stmt, const string& index) {
+    const IRStorage* storage = stmt->storage;
+    if (storage->banks == 1) {
+        return strprintf("ap_read(array_%s, %d, %s)", storage->name.c_str(),
+                         storage->elements, index.c_str());
+    }
+    int rows = (storage->elements + storage->banks - 1) / storage->banks;
+    string row = strprintf("%s >> %d", index.c_str(), storage->BankBits());
+    auto read = [&](int bank) {
+        return strprintf("ap_read(%s, %d, %s)",
+                         ArrayBankName(storage, bank).c_str(), rows,
+                         row.c_str());
+    };
+    string code;
+    if (stmt->array_bank != -1) {
+        code = read(stmt->array_bank);
+    } else {
+        code = read(storage->banks - 1);
+        for (int b = storage->banks - 2; b >= 0; b--) {
+            code = "ap_select(" + SlicedInBank(stmt, index, b) + ", " +
+                   read(b) + ",\n    " + code + ")";
+        }
+    }
+    return "ap_select(" + SlicedInBounds(stmt, index) + ", " + code +
+           strprintf(", (ap_slice<%d>)0)", storage->data_width);
+}
+
+vector<string> SlicedArrayWrites(const IRStmt* stmt, const string& index,
+                                 const string& data, const string& enable) {
+    const IRStorage* storage = stmt->storage;
+    if (storage->banks == 1) {
+        return { strprintf("ap_write(array_%s, %d, %s, %s, %s);",
+                           storage->name.c_str(), storage->elements,
+                           index.c_str(), data.c_str(), enable.c_str()) };
+    }
+    int rows = (storage->elements + storage->banks - 1) / storage->banks;
+    string row = strprintf("%s >> %d", index.c_str(), storage->BankBits());
+    string in_bounds = enable + " & " + SlicedInBounds(stmt, index);
+    vector<string> writes;
+    for (int b = 0; b < storage->banks; b++) {
+        if (stmt->array_bank != -1 && b != stmt->array_bank) continue;
+        string bank_enable = in_bounds;
+        if (stmt->array_bank == -1) {
+            bank_enable += " & " + SlicedInBank(stmt, index, b);
+        }
+        writes.push_back(strprintf("ap_write(%s, %d, %s, %s, %s);",
+                                   ArrayBankName(storage, b).c_str(), rows,
+                                   row.c_str(), data.c_str(),
+                                   bank_enable.c_str()));
+    }
+    return writes;
+}
+}  // anonymous namespace
+
+void CppModelGenerator::Generate() {
+    for (auto& port : program_->ports) {
+        if (port->exported) {
+            Declare(&ports_, port->name, port->width, 0,
+                    port->defs.size() > 0 ? "output" : "input");
+        }
+    }
+    // As in the Verilog, an exported port with a latency passes through its
+    // registers between the module's IO and the logic.
+    for (auto& port : program_->ports) {
+        if (!port->exported || port->latency == 0) continue;
+        if (!port->defs.empty()) {
+            Declare(&signals_, PortWriteSignal(port.get()), port->width, 0,
+                    "output before its IO registers");
+            AddComb(port->name, port->width, PortReadSignal(port.get()),
+                    { PortReadSignal(port.get()) });
+        }
+        for (const auto& reg : PortStaging(port.get(), port->width)) {
+            Declare(&signals_, reg.dst, reg.width, 0, "IO register");
+            port_regs_.push_back(reg);
+        }
+    }
+    for (auto& s : program_->storage) {
+        const IRStorage* storage = s.get();
+        if (storage->index_width == 0) {
+            Declare(&storage_, "reg_" + storage->name, storage->data_width, 0,
+                    "register");
+        } else {
+            // Keep at least one entry so that the C++ array is well-formed;
+            // accesses are bounds-checked against the real size.
+            if (storage->banks == 1) {
+                Declare(&storage_, "array_" + storage->name,
+                        storage->data_width, max(storage->elements, 1),
+                        "array");
+            } else {
+                int rows = (storage->elements + storage->banks - 1) /
+                           storage->banks;
+                for (int b = 0; b < storage->banks; b++) {
+                    Declare(&storage_, ArrayBankName(storage, b),
+                            storage->data_width, max(rows, 1), "array bank");
+                }
+            }
+        }
+    }
+    for (auto* sys : systems_) {
+        for (auto& pipe : sys->pipes) {
+            for (auto& stmt : pipe->stmts) {
+                GenerateNode(stmt);
+            }
+        }
+    }
+    GeneratePerfCounters();
+    GenerateProfileTrace();
+    StageSkids();
+    for (const auto* signal : StagedSignals()) {
+        for (const auto& reg : StagingFor(signal)) {
+            Declare(&signals_, reg.dst, reg.width, 0, "pipereg");
+            // A valid signal that was never carried to this stage is an
+            // implicit, undriven net in the Verilog; here it reads as zero.
+            if (!reg.valid.empty()) {
+                Declare(&signals_, reg.valid, 1, 0, "undriven");
+            }
+        }
+    }
+    for (const auto& skid : Skids()) {
+        GenerateSkid(skid);
+    }
+
+    bool cyclic = !SortComb();
+    PrintModel(cyclic);
+}
+
+void CppModelGenerator::GenerateSkid(const Skid& skid) {
+    // As the Verilog skidbuf module, with one array of entries per value.
+    string count = skid.name + "_count";
+    string full = skid.name + "_full";
+    int depth = skid.stage->skid->depth;
+    Declare(&signals_, count, 32, 0, "skid buffer");
+    Declare(&signals_, full, 1, 0, "skid buffer");
+    reset_.push_back(count + " = 0;");
+
+    // The count differs between lanes in the bit-sliced model, so there each
+    // entry shifts and takes the arriving value under a lane mask.
+    string count_type = Type(32);
+    string nonempty = bit_sliced_ ?
+        strprintf("(%s != (%s)0)", count.c_str(), count_type.c_str()) :
+        count + " != 0";
+    if (bit_sliced_) {
+        AddComb(full, 1, strprintf("%s + (%s)%s >= (%s)%d", count.c_str(),
+                                   count_type.c_str(), skid.present.c_str(),
+                                   count_type.c_str(), depth),
+                { skid.present });
+    } else {
+        AddComb(full, 1, strprintf("%s + %s >= %d", count.c_str(),
+                                   skid.present.c_str(), depth),
+                { skid.present });
+    }
+
+    rising_edge_.push_back("{");
+    if (bit_sliced_) {
+        rising_edge_.push_back(strprintf(
+                    "    ap_slice<1> pop = ~%s & %s;",
+                    skid.hold.c_str(), nonempty.c_str()));
+        rising_edge_.push_back(strprintf(
+                    "    ap_slice<1> push = %s & (%s | %s);",
+                    skid.present.c_str(), skid.hold.c_str(),
+                    nonempty.c_str()));
+        rising_edge_.push_back(strprintf(
+                    "    %s slot = %s - (%s)pop;", count_type.c_str(),
+                    count.c_str(), count_type.c_str()));
+    } else {
+        rising_edge_.push_back(strprintf(
+                    "    bool pop = !%s && %s != 0;",
+                    skid.hold.c_str(), count.c_str()));
+        rising_edge_.push_back(strprintf(
+                    "    bool push = %s && (%s || %s != 0);",
+                    skid.present.c_str(), skid.hold.c_str(), count.c_str()));
+    }
+    vector<string> shifts, pushes;
+    for (const auto& reg : skid.regs) {
+        string signal = SkidOutput(reg);
+        string entries = skid.name + "_" + signal;
+        Declare(&signals_, signal, reg.width, 0, "skid buffer");
+        Declare(&signals_, entries, reg.width, depth, "skid buffer");
+        AddComb(signal, reg.width,
+                Select(nonempty, entries + "[0]", reg.dst, reg.width),
+                { reg.dst });
+        if (bit_sliced_) {
+            shifts.push_back(strprintf(
+                        "        %s[i] = ap_select(pop, %s[i + 1], %s[i]);",
+                        entries.c_str(), entries.c_str(), entries.c_str()));
+            pushes.push_back(strprintf(
+                        "    ap_write(%s, %d, slot, %s, push);",
+                        entries.c_str(), depth, reg.dst.c_str()));
+        } else {
+            shifts.push_back(strprintf("            %s[i] = %s[i + 1];",
+                                       entries.c_str(), entries.c_str()));
+            pushes.push_back(strprintf("        %s[%s - pop] = %s;",
+                                       entries.c_str(), count.c_str(),
+                                       reg.dst.c_str()));
+        }
+    }
+    if (bit_sliced_) {
+        rising_edge_.push_back(strprintf(
+                    "    for (int i = 0; i + 1 < %d; i++) {", depth));
+        rising_edge_.insert(rising_edge_.end(), shifts.begin(), shifts.end());
+        rising_edge_.push_back("    }");
+        rising_edge_.insert(rising_edge_.end(), pushes.begin(), pushes.end());
+        rising_edge_.push_back(strprintf(
+                    "    %s = %s + (%s)push - (%s)pop;", count.c_str(),
+                    count.c_str(), count_type.c_str(), count_type.c_str()));
+        rising_edge_.push_back("}");
+        return;
+    }
+    rising_edge_.push_back("    if (pop) {");
+    rising_edge_.push_back(strprintf(
+                "        for (int i = 0; i + 1 < %d; i++) {", depth));
+    rising_edge_.insert(rising_edge_.end(), shifts.begin(), shifts.end());
+    rising_edge_.push_back("        }");
+    rising_edge_.push_back("    }");
+    rising_edge_.push_back("    if (push) {");
+    rising_edge_.insert(rising_edge_.end(), pushes.begin(), pushes.end());
+    rising_edge_.push_back("    }");
+    rising_edge_.push_back(strprintf("    %s = %s + push - pop;",
+                                     count.c_str(), count.c_str()));
+    rising_edge_.push_back("}");
+}
+
+// As in the Verilog, the counters count on the falling edge and are read
+// through a combinational port.
+void CppModelGenerator::GeneratePerfCounters() {
+    vector<PerfCounter> counters = PerfCounters(systems_);
+    if (counters.empty()) return;
+    int count = counters.size();
+    Declare(&ports_, "perf_counter_select", PerfSelectWidth(count), 0,
+            "input");
+    Declare(&ports_, "perf_counter_value", kPerfCounterWidth, 0, "output");
+    Declare(&storage_, "perf_counters", kPerfCounterWidth, count,
+            "performance counters");
+    reset_.push_back(strprintf(
+                "for (int i = 0; i < %d; i++) perf_counters[i] = 0;", count));
+    string type = Type(kPerfCounterWidth);
+    for (int i = 0; i < count; i++) {
+        string event = SignalInStage(counters[i].signal, counters[i].stage);
+        if (bit_sliced_) {
+            falling_edge_.push_back(strprintf(
+                        "perf_counters[%d] = ap_select(%s, "
+                        "perf_counters[%d] + (%s)1, perf_counters[%d]);",
+                        i, event.c_str(), i, type.c_str(), i));
+            continue;
+        }
+        falling_edge_.push_back(strprintf(
+                    "if (%s) perf_counters[%d] = "
+                    "ap_mask<%s>(perf_counters[%d] + 1, %d);",
+                    event.c_str(), i, type.c_str(), i,
+                    kPerfCounterWidth));
+    }
+    AddComb("perf_counter_value", kPerfCounterWidth,
+            bit_sliced_ ?
+            strprintf("ap_read(perf_counters, %d, perf_counter_select)",
+                      count) :
+            strprintf("perf_counter_select < %d ? "
+                      "perf_counters[perf_counter_select] : 0", count),
+            { "perf_counter_select" });
+}
+
+// As in the Verilog, the trace line is written on the falling edge, once
+// |profile_trace| is set. The bit-sliced model traces lane 0.
+void CppModelGenerator::GenerateProfileTrace() {
+    if (!program_ || !program_->profile) return;
+    vector<PerfCounter> events = PerfCounters(systems_, true);
+    if (events.empty()) return;
+    profile_trace_ = true;
+    falling_edge_.push_back("if (profile_trace) {");
+    for (unsigned i = 0; i < events.size(); i++) {
+        string event = SignalInStage(events[i].signal, events[i].stage);
+        falling_edge_.push_back(strprintf(
+                    "    if (%s%s) fputs(\" %d\", profile_trace);",
+                    event.c_str(), bit_sliced_ ? ".get(0)" : "", i));
+    }
+    falling_edge_.push_back("    fputc('\\n', profile_trace);");
+    falling_edge_.push_back("}");
+}
+
+void CppModelGenerator::Declare(vector<Field>* fields, const string& name,
+                                int width, int elements,
+                                const string& comment) {
+    if (widths_.find(name) != widths_.end()) return;
+    widths_[name] = width;
+    Field field;
+    field.name = name;
+    field.width = width;
+    field.elements = elements;
+    field.comment = comment;
+    fields->push_back(field);
+}
+
+string CppModelGenerator::Type(int width) const {
+    return bit_sliced_ ? strprintf("ap_slice<%d>", width) : CppType(width);
+}
+
+string CppModelGenerator::Select(const string& cond, const string& a,
+                                 const string& b, int width) const {
+    if (bit_sliced_) {
+        string type = Type(width);
+        return "ap_select(" + cond + ", (" + type + ")" + a + ", (" + type +
+               ")" + b + ")";
+    }
+    return cond + " ? " + a + " : " + b;
+}
+
+string CppModelGenerator::Signal(const IRStmt* stmt, int stage) {
+    string name = SignalName(stmt, stage);
+    Declare(&signals_, name, stmt->width, 0, "");
+    return name;
+}
+
+string CppModelGenerator::SignalInStage(const IRStmt* stmt, int stage) {
+    GetSignalInStage(stmt, stage);
+    return Signal(stmt, stmt->unstaged ? stmt->stage->stage : stage);
+}
+
+void CppModelGenerator::AddComb(const string& target, int width,
+                                const string& expr,
+                                const vector<string>& deps) {
+    CombAssign assign;
+    assign.target = target;
+    assign.deps = deps;
+    assign.code = strprintf("%s = ap_mask<%s>(", target.c_str(),
+                            Type(width).c_str()) +
+                  expr + strprintf(", %d);", width);
+    comb_.push_back(assign);
+}
+
+void CppModelGenerator::GenerateNode(const IRStmt* stmt) {
+    if (IsElided(stmt)) {
+        return;
+    }
+    // Signals are requested in the same order as in
+    // VerilogGenerator::GenerateNode() so that staging is identical.
+    int stage = stmt->stage->stage;
+    vector<string> args;
+    for (auto* arg : stmt->args) {
+        args.push_back(SignalInStage(arg, stage));
+    }
+    string predicate;
+    if (stmt->valid_in) {
+        predicate = SignalInStage(stmt->valid_in, stage);
+    }
+    string signal;
+    if (stmt->width > 0) {
+        signal = Signal(stmt, stage);
+    }
+
+    switch (stmt->type) {
+        case IRStmtExpr:
+            AddComb(signal, stmt->width, GenerateNodeExpr(stmt, args), args);
+            break;
+        case IRStmtPhi:
+        case IRStmtIf:
+        case IRStmtJmp:
+            assert(false);  // removed during if-conversion
+            break;
+
+        case IRStmtChanRead: {
+            string arg = SignalInStage(stmt->port->defs[0]->args[0], stage);
+            AddComb(signal, stmt->width, arg, { arg });
+            break;
+        }
+
+        case IRStmtChanWrite:
+            // Nothing -- the ChanRead takes the writer's arg.
+            break;
+
+        case IRStmtPortRead:
+            if (!stmt->port->exported) {
+                Declare(&signals_, stmt->port->name, stmt->port->width, 0,
+                        "internal port");
+            }
+            AddComb(signal, stmt->width, PortReadSignal(stmt->port),
+                    { PortReadSignal(stmt->port) });
+            break;
+
+        case IRStmtPortWrite: {
+            int width = stmt->port->width;
+            if (!stmt->port->exported) {
+                width = stmt->args[0]->width;
+                Declare(&signals_, stmt->port->name, width, 0,
+                        "internal port");
+            }
+            string target = PortWriteSignal(stmt->port);
+            if (stmt->port_has_default) {
+                AddComb(target, width,
+                        Select(predicate.empty() ? "1" : predicate, args[0],
+                               CppConstant(stmt->port_default, width,
+                                           Type(width)),
+                               width),
+                        { predicate, args[0] });
+            } else {
+                AddComb(target, width, args[0], { args[0] });
+            }
+            if (!stmt->port->exported) {
+                for (const auto& reg : PortStaging(stmt->port, width)) {
+                    Declare(&signals_, reg.dst, reg.width, 0, "port delay");
+                    port_regs_.push_back(reg);
+                }
+            }
+            break;
+        }
+
+        case IRStmtRegRead:
+            AddComb(signal, stmt->width, "reg_" + stmt->storage->name, {});
+            break;
+
+        case IRStmtRegWrite: {
+            string reg = "reg_" + stmt->storage->name;
+            string value = strprintf("ap_mask<%s>(%s, %d)",
+                    Type(stmt->storage->data_width).c_str(),
+                    args[0].c_str(), stmt->storage->data_width);
+            if (predicate.empty()) {
+                falling_edge_.push_back(reg + " = " + value + ";");
+            } else if (bit_sliced_) {
+                falling_edge_.push_back(reg + " = ap_select(" + predicate +
+                                        ", " + value + ", " + reg + ");");
+            } else {
+                falling_edge_.push_back("if (" + predicate + ") " + reg +
+                                        " = " + value + ";");
+            }
+            break;
+        }
+
+        case IRStmtArrayRead:
+            if (bit_sliced_) {
+                AddComb(signal, stmt->width, SlicedArrayRead(stmt, args[0]),
+                        { args[0] });
+                break;
+            }
+            AddComb(signal, stmt->width,
+                    strprintf("%s < %d ? %s : 0",
+                              args[0].c_str(), stmt->storage->elements,
+                              ArrayElement(stmt, args[0]).c_str()),
+                    { args[0] });
+            break;
+
+        case IRStmtArrayWrite:
+            if (bit_sliced_) {
+                string data = strprintf("ap_mask<%s>(%s, %d)",
+                        Type(stmt->storage->data_width).c_str(),
+                        args[1].c_str(), stmt->storage->data_width);
+                for (const auto& write : SlicedArrayWrites(
+                            stmt, args[0], data,
+                            predicate.empty() ? "(ap_slice<1>)1" :
+                            predicate)) {
+                    falling_edge_.push_back(write);
+                }
+                break;
+            }
+            falling_edge_.push_back(
+                strprintf("if (%s%s < %d) %s = ap_mask<%s>(%s, %d);",
+                          predicate.empty() ? "" : (predicate + " && ").c_str(),
+                          args[0].c_str(), stmt->storage->elements,
+                          ArrayElement(stmt, args[0]).c_str(),
+                          CppType(stmt->storage->data_width).c_str(),
+                          args[1].c_str(), stmt->storage->data_width));
+            break;
+
+        case IRStmtArraySize:
+        case IRStmtArrayBanks:
+        case IRStmtArrayLatency:
+            break;
+
+        case IRStmtRestartValue:
+            // Get the RestartValueSrc buffered by one latch stage. This
+            // aligns with our stage on the restart.
+            if (stmt->restart_arg) {
+                string arg = SignalInStage(stmt->restart_arg,
+                                           stmt->restart_arg->stage->stage + 1);
+                AddComb(signal, stmt->width, arg, { arg });
+            } else {
+                // No arg -- set to all ones.
+                AddComb(signal, stmt->width,
+                        "~(" + Type(stmt->width) + ")0", {});
+            }
+            break;
+
+        case IRStmtRestartValueSrc: {
+            string arg = SignalInStage(stmt->args[0], stage);
+            AddComb(signal, stmt->width, arg, { arg });
+            break;
+        }
+
+        case IRStmtSkidFull: {
+            string full = SkidName(stmt->pipe->stages[
+                    stmt->constant.convert_to<int>()].get()) + "_full";
+            AddComb(signal, stmt->width, full, { full });
+            break;
+        }
+
+        case IRStmtPortExport:
+        case IRStmtPortLatency:
+        case IRStmtSpawn:
+        case IRStmtKill:
+        case IRStmtKillIf:
+        case IRStmtKillYounger:
+        case IRStmtTimingBarrier:
+        case IRStmtBackedge:
+        case IRStmtDone:
+        case IRStmtBypassEnd:
+            // Nothing -- see VerilogGenerator::GenerateNode().
+            break;
+
+        case IRStmtBypassStart:
+            // If there's no bypass write in this cycle, write the combined
+            // index + data + valid. Otherwise, do nothing.
+            if (stmt->bypass->writes_by_stage.find(stage) ==
+                stmt->bypass->writes_by_stage.end()) {
+                AddComb(signal, stmt->width,
+                        CppConcat({
+                            { predicate.empty() ? "1" : predicate, 1 },
+                            { args[0], stmt->args[0]->width },
+                            { "0", 1 },
+                            { "0", stmt->bypass->width },
+                        }, Type(stmt->width)),
+                        { predicate, args[0] });
+            }
+            break;
+
+        case IRStmtBypassWrite: {
+            // As in VerilogGenerator::GenerateNode(), a write not taken
+            // carries the arriving bus.
+            const IRStmt* start = stmt->bypass->start;
+            string index_valid = SignalInStage(start->valid_in, stage);
+            string index = SignalInStage(start->args[0], stage);
+            string written = CppConcat({
+                        { index_valid, 1 },
+                        { index, start->args[0]->width },
+                        { "1", 1 },
+                        { args[0], stmt->args[0]->width },
+                    }, Type(stmt->width));
+            vector<string> deps = { index_valid, index, predicate, args[0] };
+            string prev_bus;
+            if (stage == start->stage->stage) {
+                prev_bus = CppConcat({
+                            { index_valid, 1 },
+                            { index, start->args[0]->width },
+                            { "0", 1 },
+                            { "0", stmt->bypass->width },
+                        }, Type(stmt->width));
+            } else {
+                prev_bus = SignalInStage(
+                        BypassLastWriter(stmt->bypass, stage - 1), stage);
+                deps.push_back(prev_bus);
+            }
+            if (predicate.empty()) {
+                AddComb(signal, stmt->width, written,
+                        { index_valid, index, args[0] });
+            } else {
+                AddComb(signal, stmt->width,
+                        Select(predicate, written, prev_bus, stmt->width),
+                        deps);
+            }
+            break;
+        }
+
+        case IRStmtBypassPresent:
+        case IRStmtBypassReady:
+        case IRStmtBypassRead: {
+            vector<string> deps = { args[0] };
+            string code;
+            vector<pair<string, string>> reads;  // (match, data)
+            for (auto& p : BypassBuses(stmt)) {
+                string bus = SignalInStage(p.first, p.second);
+                deps.push_back(bus);
+                int data_width = stmt->bypass->width;
+                int index_width = stmt->bypass->start->args[0]->width;
+                int data_valid_idx = data_width;
+                int index_valid_idx = data_width + index_width + 1;
+                if (bit_sliced_) {
+                    // The bus's index and the read's, compared at a width
+                    // that holds both.
+                    string index_type = Type(max(index_width,
+                                                 stmt->args[0]->width));
+                    string match = strprintf(
+                        "(ap_field<ap_slice<1>>(%s, %d, %d) & "
+                        "(ap_field<%s>(%s, %d, %d) == (%s)%s)",
+                        bus.c_str(), index_valid_idx, index_valid_idx,
+                        index_type.c_str(), bus.c_str(), index_valid_idx - 1,
+                        data_valid_idx + 1, index_type.c_str(),
+                        args[0].c_str());
+                    if (stmt->type != IRStmtBypassPresent) {
+                        match += strprintf(
+                            " & ap_field<ap_slice<1>>(%s, %d, %d)",
+                            bus.c_str(), data_valid_idx, data_valid_idx);
+                    }
+                    match += ")";
+                    reads.push_back(make_pair(match, strprintf(
+                        "ap_field<%s>(%s, %d, 0)", Type(data_width).c_str(),
+                        bus.c_str(), data_valid_idx - 1)));
+                    continue;
+                }
+                string match = strprintf(
+                    "(ap_field<uint64_t>(%s, %d, %d) && "
+                    "ap_field<uint64_t>(%s, %d, %d) == %s",
+                    bus.c_str(), index_valid_idx, index_valid_idx,
+                    bus.c_str(), index_valid_idx - 1, data_valid_idx + 1,
+                    args[0].c_str());
+                if (stmt->type != IRStmtBypassPresent) {
+                    match += strprintf(" && ap_field<uint64_t>(%s, %d, %d)",
+                                       bus.c_str(), data_valid_idx,
+                                       data_valid_idx);
+                }
+                match += ")";
+                if (stmt->type == IRStmtBypassRead) {
+                    code += match + strprintf(" ? ap_field<%s>(%s, %d, 0) :\n    ",
+                                              CppType(data_width).c_str(),
+                                              bus.c_str(), data_valid_idx - 1);
+                } else {
+                    code += (code.empty() ? "" : " ||\n    ") + match;
+                }
+            }
+            if (bit_sliced_) {
+                // The nearest match's data, or 0; or whether any matches.
+                if (stmt->type == IRStmtBypassRead) {
+                    code = "(" + Type(stmt->bypass->width) + ")0";
+                    for (int i = reads.size() - 1; i >= 0; i--) {
+                        code = "ap_select(" + reads[i].first + ", " +
+                               reads[i].second + ",\n    " + code + ")";
+                    }
+                } else {
+                    for (const auto& read : reads) {
+                        code += (code.empty() ? "" : " |\n    ") + read.first;
+                    }
+                    if (code.empty()) code = "0";
+                }
+            } else if (code.empty() || stmt->type == IRStmtBypassRead) {
+                // Never present, or the end of a ?: chain.
+                code += "0";
+            }
+            AddComb(signal, stmt->width, code, deps);
+            break;
+        }
+
+        default:
+            printf("Unknown statement in C++ model generator: %s\n",
+                   stmt->ToString().c_str());
+            assert(false);
+            break;
+    }
+}
+
+string CppModelGenerator::GenerateNodeExpr(const IRStmt* stmt,
+                                           const vector<string>& args) {
+    int width = stmt->width;
+    for (auto* arg : stmt->args) {
+        if (arg->width > width) width = arg->width;
+    }
+    // Operations are performed at the width of the widest operand or of the
+    // result, whichever is larger, as Verilog does.
+    string type = Type(width);
+    vector<string> cast;
+    for (int i = 0; i < args.size(); i++) {
+        cast.push_back(Type(stmt->args[i]->width) == type ?
+                       args[i] : "(" + type + ")" + args[i]);
+    }
+    switch (stmt->op) {
+        case IRStmtOpConst:
+            return CppConstant(stmt->constant, stmt->width,
+                               Type(stmt->width));
+        case IRStmtOpAdd:
+        case IRStmtOpSub:
+        case IRStmtOpMul:
+        case IRStmtOpAnd:
+        case IRStmtOpOr:
+        case IRStmtOpXor:
+        case IRStmtOpCmpLT:
+        case IRStmtOpCmpLE:
+        case IRStmtOpCmpEQ:
+        case IRStmtOpCmpNE:
+        case IRStmtOpCmpGT:
+        case IRStmtOpCmpGE:
+            return cast[0] + " " + GetExprOp(stmt->op) + " " + cast[1];
+        case IRStmtOpDiv:
+            return "ap_div<" + type + ">(" + cast[0] + ", " + cast[1] + ")";
+        case IRStmtOpRem:
+            return "ap_rem<" + type + ">(" + cast[0] + ", " + cast[1] + ")";
+        case IRStmtOpLsh:
+            return "ap_shl<" + type + ">(" + cast[0] + ", " + args[1] + ")";
+        case IRStmtOpRsh:
+            return "ap_shr<" + type + ">(" + cast[0] + ", " + args[1] + ")";
+        case IRStmtOpNot:
+            return "~" + cast[0];
+        case IRStmtOpBitslice:
+            return "ap_shr<" + type + ">(" + cast[0] + ", " +
+                   string(stmt->args[2]->constant) + ")";
+        case IRStmtOpConcat: {
+            vector<pair<string, int>> parts;
+            for (int i = 0; i < args.size(); i++) {
+                parts.push_back(make_pair(args[i], stmt->args[i]->width));
+            }
+            return CppConcat(parts, Type(stmt->width));
+        }
+        case IRStmtOpSelect:
+            return Select(args[0], cast[1], cast[2], width);
+        default:
+            assert(false);
+            return "";
+    }
+}
+
+bool CppModelGenerator::SortComb() {
+    // Kahn's algorithm, always taking the earliest ready assignment so that
+    // the output order is stable and follows program order where possible.
+    map<string, vector<int>> producers;
+    for (int i = 0; i < comb_.size(); i++) {
+        producers[comb_[i].target].push_back(i);
+    }
+    bool cyclic = false;
+    vector<vector<int>> succs(comb_.size());
+    vector<int> indegree(comb_.size(), 0);
+    for (int i = 0; i < comb_.size(); i++) {
+        for (const auto& dep : comb_[i].deps) {
+            auto it = producers.find(dep);
+            if (it == producers.end()) continue;
+            for (int j : it->second) {
+                if (j == i) {
+                    cyclic = true;
+                    continue;
+                }
+                succs[j].push_back(i);
+                indegree[i]++;
+            }
+        }
+    }
+    priority_queue<int, vector<int>, greater<int>> ready;
+    for (int i = 0; i < comb_.size(); i++) {
+        if (indegree[i] == 0) ready.push(i);
+    }
+    vector<int> order;
+    vector<bool> placed(comb_.size(), false);
+    while (!ready.empty()) {
+        int i = ready.top();
+        ready.pop();
+        order.push_back(i);
+        placed[i] = true;
+        for (int j : succs[i]) {
+            if (--indegree[j] == 0) ready.push(j);
+        }
+    }
+    for (int i = 0; i < comb_.size(); i++) {
+        if (!placed[i]) {
+            order.push_back(i);
+            cyclic = true;
+        }
+    }
+    vector<CombAssign> sorted;
+    for (int i : order) {
+        sorted.push_back(comb_[i]);
+    }
+    comb_.swap(sorted);
+    return !cyclic;
+}
+
+void CppModelGenerator::PrintPrelude() {
+    out_->Print(
+        "#ifndef AUTOPIPER_MODEL_PRELUDE_\n"
+        "#define AUTOPIPER_MODEL_PRELUDE_\n"
+        "\n"
+        "typedef unsigned __int128 ap_u128;\n"
+        "\n"
+        "// Unsigned values of more than 128 bits, as N 64-bit words.\n"
+        "template<int N> struct ap_wide {\n"
+        "    uint64_t w[N];\n"
+        "\n"
+        "    ap_wide(ap_u128 v = 0) {\n"
+        "        w[0] = (uint64_t)v;\n"
+        "        w[1] = (uint64_t)(v >> 64);\n"
+        "        for (int i = 2; i < N; i++) w[i] = 0;\n"
+        "    }\n"
+        "    template<int M> explicit ap_wide(const ap_wide<M>& o) {\n"
+        "        for (int i = 0; i < N; i++) w[i] = i < M ? o.w[i] : 0;\n"
+        "    }\n"
+        "    explicit operator uint64_t() const { return w[0]; }\n"
+        "    explicit operator ap_u128() const {\n"
+        "        return (ap_u128)w[1] << 64 | w[0];\n"
+        "    }\n"
+        "    explicit operator bool() const {\n"
+        "        for (int i = 0; i < N; i++) if (w[i]) return true;\n"
+        "        return false;\n"
+        "    }\n"
+        "};\n"
+        "\n"
+        "template<int N> ap_wide<N> operator~(const ap_wide<N>& a) {\n"
+        "    ap_wide<N> r;\n"
+        "    for (int i = 0; i < N; i++) r.w[i] = ~a.w[i];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator&(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    ap_wide<N> r;\n"
+        "    for (int i = 0; i < N; i++) r.w[i] = a.w[i] & b.w[i];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator|(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    ap_wide<N> r;\n"
+        "    for (int i = 0; i < N; i++) r.w[i] = a.w[i] | b.w[i];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator^(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    ap_wide<N> r;\n"
+        "    for (int i = 0; i < N; i++) r.w[i] = a.w[i] ^ b.w[i];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator+(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    ap_wide<N> r;\n"
+        "    uint64_t carry = 0;\n"
+        "    for (int i = 0; i < N; i++) {\n"
+        "        ap_u128 t = (ap_u128)a.w[i] + b.w[i] + carry;\n"
+        "        r.w[i] = (uint64_t)t;\n"
+        "        carry = (uint64_t)(t >> 64);\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator-(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    return a + ~b + ap_wide<N>(1);\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator*(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    ap_wide<N> r;\n"
+        "    for (int i = 0; i < N; i++) {\n"
+        "        uint64_t carry = 0;\n"
+        "        for (int j = 0; i + j < N; j++) {\n"
+        "            ap_u128 t = (ap_u128)a.w[i] * b.w[j] + r.w[i + j] + carry;\n"
+        "            r.w[i + j] = (uint64_t)t;\n"
+        "            carry = (uint64_t)(t >> 64);\n"
+        "        }\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator<<(const ap_wide<N>& a, int s) {\n"
+        "    ap_wide<N> r;\n"
+        "    int ws = s / 64, bs = s % 64;\n"
+        "    for (int i = N - 1; i >= ws; i--) {\n"
+        "        r.w[i] = a.w[i - ws] << bs;\n"
+        "        if (bs && i - ws > 0) r.w[i] |= a.w[i - ws - 1] >> (64 - bs);\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator>>(const ap_wide<N>& a, int s) {\n"
+        "    ap_wide<N> r;\n"
+        "    int ws = s / 64, bs = s % 64;\n"
+        "    for (int i = 0; i + ws < N; i++) {\n"
+        "        r.w[i] = a.w[i + ws] >> bs;\n"
+        "        if (bs && i + ws + 1 < N) r.w[i] |= a.w[i + ws + 1] << (64 - bs);\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int N> bool operator==(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    for (int i = 0; i < N; i++) if (a.w[i] != b.w[i]) return false;\n"
+        "    return true;\n"
+        "}\n"
+        "template<int N> bool operator!=(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    return !(a == b);\n"
+        "}\n"
+        "template<int N> bool operator<(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    for (int i = N - 1; i >= 0; i--) {\n"
+        "        if (a.w[i] != b.w[i]) return a.w[i] < b.w[i];\n"
+        "    }\n"
+        "    return false;\n"
+        "}\n"
+        "template<int N> bool operator<=(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    return !(b < a);\n"
+        "}\n"
+        "// Restoring division, one quotient bit at a time.\n"
+        "template<int N> ap_wide<N> ap_divmod(const ap_wide<N>& a, const ap_wide<N>& b,\n"
+        "                                     ap_wide<N>* rem) {\n"
+        "    ap_wide<N> q, r;\n"
+        "    for (int i = N * 64 - 1; i >= 0; i--) {\n"
+        "        r = r << 1;\n"
+        "        r.w[0] |= (a.w[i / 64] >> (i % 64)) & 1;\n"
+        "        if (b <= r) {\n"
+        "            r = r - b;\n"
+        "            q.w[i / 64] |= 1ull << (i % 64);\n"
+        "        }\n"
+        "    }\n"
+        "    *rem = r;\n"
+        "    return q;\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator/(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    ap_wide<N> r;\n"
+        "    return ap_divmod(a, b, &r);\n"
+        "}\n"
+        "template<int N> ap_wide<N> operator%(const ap_wide<N>& a, const ap_wide<N>& b) {\n"
+        "    ap_wide<N> r;\n"
+        "    ap_divmod(a, b, &r);\n"
+        "    return r;\n"
+        "}\n"
+        "\n"
+        "// Two-state helpers. Shifts by at least the value's width yield 0, as\n"
+        "// does division or remainder by 0.\n"
+        "template<typename T, typename U> inline T ap_mask(const U& u, int width) {\n"
+        "    T v = (T)u;\n"
+        "    return width >= (int)(sizeof(T) * 8) ? v : (v & ((T(1) << width) - T(1)));\n"
+        "}\n"
+        "template<typename R, typename T> inline R ap_field(const T& v, int hi, int lo) {\n"
+        "    return ap_mask<R>(v >> lo, hi - lo + 1);\n"
+        "}\n"
+        "template<typename T, typename U> inline T ap_shl(T v, U amt) {\n"
+        "    return amt >= sizeof(T) * 8 ? T(0) : T(v << (int)amt);\n"
+        "}\n"
+        "template<typename T, typename U> inline T ap_shr(T v, U amt) {\n"
+        "    return amt >= sizeof(T) * 8 ? T(0) : T(v >> (int)amt);\n"
+        "}\n"
+        "template<typename T> inline T ap_div(T a, T b) {\n"
+        "    return b == T(0) ? T(0) : T(a / b);\n"
+        "}\n"
+        "template<typename T> inline T ap_rem(T a, T b) {\n"
+        "    return b == T(0) ? T(0) : T(a % b);\n"
+        "}\n"
+        "\n"
+        "#endif  // AUTOPIPER_MODEL_PRELUDE_\n"
+        "\n");
+}
+
+// The bit-sliced model's counterpart of the prelude above, in namespace
+// ap_bitsliced so that both models may be included in one program.
+void CppModelGenerator::PrintBitSlicedPrelude() {
+    out_->Print(
+        "#ifndef AUTOPIPER_BITSLICED_MODEL_PRELUDE_\n"
+        "#define AUTOPIPER_BITSLICED_MODEL_PRELUDE_\n"
+        "\n"
+        "namespace ap_bitsliced {\n"
+        "\n"
+        "// One bit of every lane: 256 lanes in a vector where AVX2 is available\n"
+        "// (unless AP_LANES_64 is defined), else 64 in a word.\n"
+        "#if defined(__AVX2__) && !defined(AP_LANES_64)\n"
+        "typedef uint64_t ap_lanes __attribute__((vector_size(32)));\n"
+        "#else\n"
+        "typedef uint64_t ap_lanes;\n"
+        "#endif\n"
+        "enum { ap_lane_count = (int)sizeof(ap_lanes) * 8 };\n"
+        "enum { ap_lane_words = (int)sizeof(ap_lanes) / 8 };\n"
+        "\n"
+        "inline ap_lanes ap_all(bool bit) { return bit ? ~ap_lanes() : ap_lanes(); }\n"
+        "inline bool ap_lane_bit(const ap_lanes& w, int lane) {\n"
+        "    uint64_t words[ap_lane_words];\n"
+        "    memcpy(words, &w, sizeof(w));\n"
+        "    return words[lane / 64] >> (lane % 64) & 1;\n"
+        "}\n"
+        "inline void ap_set_lane_bit(ap_lanes* w, int lane, bool bit) {\n"
+        "    uint64_t words[ap_lane_words];\n"
+        "    memcpy(words, w, sizeof(*w));\n"
+        "    words[lane / 64] &= ~(1ull << (lane % 64));\n"
+        "    words[lane / 64] |= (uint64_t)bit << (lane % 64);\n"
+        "    memcpy(w, words, sizeof(*w));\n"
+        "}\n"
+        "inline bool ap_any_lane(const ap_lanes& w) {\n"
+        "    uint64_t words[ap_lane_words];\n"
+        "    memcpy(words, &w, sizeof(w));\n"
+        "    for (int i = 0; i < ap_lane_words; i++) if (words[i]) return true;\n"
+        "    return false;\n"
+        "}\n"
+        "\n"
+        "// A W-bit value in every lane, as W bit-planes: p[i] holds bit i of every\n"
+        "// lane.\n"
+        "template<int W> struct ap_slice {\n"
+        "    enum { width = W };\n"
+        "    ap_lanes p[W];\n"
+        "\n"
+        "    // The same value in every lane.\n"
+        "    ap_slice(uint64_t v = 0) {\n"
+        "        for (int i = 0; i < W; i++) p[i] = ap_all(i < 64 && (v >> i & 1));\n"
+        "    }\n"
+        "    // Zero-extended or truncated.\n"
+        "    template<int M> explicit ap_slice(const ap_slice<M>& o) {\n"
+        "        for (int i = 0; i < W; i++) p[i] = i < M ? o.p[i] : ap_lanes();\n"
+        "    }\n"
+        "\n"
+        "    // Bits [lo, lo + 64) of one lane.\n"
+        "    uint64_t get(int lane, int lo = 0) const {\n"
+        "        uint64_t v = 0;\n"
+        "        for (int i = lo; i < W && i < lo + 64; i++) {\n"
+        "            v |= (uint64_t)ap_lane_bit(p[i], lane) << (i - lo);\n"
+        "        }\n"
+        "        return v;\n"
+        "    }\n"
+        "    void set(int lane, uint64_t v, int lo = 0) {\n"
+        "        for (int i = lo; i < W && i < lo + 64; i++) {\n"
+        "            ap_set_lane_bit(&p[i], lane, v >> (i - lo) & 1);\n"
+        "        }\n"
+        "    }\n"
+        "    // Whether any bit of any lane is set.\n"
+        "    bool any() const {\n"
+        "        ap_lanes r = ap_lanes();\n"
+        "        for (int i = 0; i < W; i++) r |= p[i];\n"
+        "        return ap_any_lane(r);\n"
+        "    }\n"
+        "};\n"
+        "\n"
+        "// Each lane of |a| where its lane of |m| is set, else of |b|.\n"
+        "template<int W> ap_slice<W> ap_mux(const ap_lanes& m, const ap_slice<W>& a,\n"
+        "                                   const ap_slice<W>& b) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i < W; i++) r.p[i] = (a.p[i] & m) | (b.p[i] & ~m);\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<W> ap_select(const ap_slice<1>& c,\n"
+        "                                      const ap_slice<W>& a,\n"
+        "                                      const ap_slice<W>& b) {\n"
+        "    return ap_mux(c.p[0], a, b);\n"
+        "}\n"
+        "\n"
+        "template<int W> ap_slice<W> operator~(const ap_slice<W>& a) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i < W; i++) r.p[i] = ~a.p[i];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<W> operator&(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i < W; i++) r.p[i] = a.p[i] & b.p[i];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<W> operator|(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i < W; i++) r.p[i] = a.p[i] | b.p[i];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<W> operator^(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i < W; i++) r.p[i] = a.p[i] ^ b.p[i];\n"
+        "    return r;\n"
+        "}\n"
+        "// Ripple-carry addition, with a carry in of all ones for subtraction.\n"
+        "template<int W> ap_slice<W> ap_add(const ap_slice<W>& a, const ap_slice<W>& b,\n"
+        "                                   ap_lanes carry) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i < W; i++) {\n"
+        "        ap_lanes x = a.p[i] ^ b.p[i];\n"
+        "        r.p[i] = x ^ carry;\n"
+        "        carry = (a.p[i] & b.p[i]) | (carry & x);\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<W> operator+(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    return ap_add(a, b, ap_lanes());\n"
+        "}\n"
+        "template<int W> ap_slice<W> operator-(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    return ap_add(a, ~b, ~ap_lanes());\n"
+        "}\n"
+        "// Shift-and-add, keeping the low W bits.\n"
+        "template<int W> ap_slice<W> operator*(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i < W; i++) {\n"
+        "        ap_lanes carry = ap_lanes();\n"
+        "        for (int j = i; j < W; j++) {\n"
+        "            ap_lanes x = a.p[j - i] & b.p[i];\n"
+        "            ap_lanes t = r.p[j];\n"
+        "            ap_lanes s = t ^ x;\n"
+        "            r.p[j] = s ^ carry;\n"
+        "            carry = (t & x) | (carry & s);\n"
+        "        }\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<W> operator<<(const ap_slice<W>& a, int s) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = s; i < W; i++) r.p[i] = a.p[i - s];\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<W> operator>>(const ap_slice<W>& a, int s) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int i = 0; i + s < W; i++) r.p[i] = a.p[i + s];\n"
+        "    return r;\n"
+        "}\n"
+        "\n"
+        "template<int W> ap_slice<1> operator==(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    ap_slice<1> r(1);\n"
+        "    for (int i = 0; i < W; i++) r.p[0] &= ~(a.p[i] ^ b.p[i]);\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<1> operator!=(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    return ~(a == b);\n"
+        "}\n"
+        "template<int W> ap_slice<1> operator<(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    ap_slice<1> r;\n"
+        "    for (int i = 0; i < W; i++) {\n"
+        "        r.p[0] = (~a.p[i] & b.p[i]) | (~(a.p[i] ^ b.p[i]) & r.p[0]);\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W> ap_slice<1> operator>(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    return b < a;\n"
+        "}\n"
+        "template<int W> ap_slice<1> operator<=(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    return ~(b < a);\n"
+        "}\n"
+        "template<int W> ap_slice<1> operator>=(const ap_slice<W>& a, const ap_slice<W>& b) {\n"
+        "    return ~(a < b);\n"
+        "}\n"
+        "\n"
+        "// Restoring division, one quotient bit at a time, in every lane at once.\n"
+        "template<int W> ap_slice<W> ap_divmod(const ap_slice<W>& a, const ap_slice<W>& b,\n"
+        "                                      ap_slice<W>* rem) {\n"
+        "    ap_slice<W> q;\n"
+        "    ap_slice<W + 1> r, d(b);\n"
+        "    for (int i = W - 1; i >= 0; i--) {\n"
+        "        r = r << 1;\n"
+        "        r.p[0] = a.p[i];\n"
+        "        ap_lanes ge = ~(r < d).p[0];\n"
+        "        r = ap_mux(ge, r - d, r);\n"
+        "        q.p[i] = ge;\n"
+        "    }\n"
+        "    ap_lanes nonzero = (b != ap_slice<W>()).p[0];\n"
+        "    *rem = ap_mux(nonzero, ap_slice<W>(r), ap_slice<W>());\n"
+        "    return ap_mux(nonzero, q, ap_slice<W>());\n"
+        "}\n"
+        "\n"
+        "// The same two-state helpers as the scalar model's. Shifts by at least the\n"
+        "// value's width yield 0, as does division or remainder by 0.\n"
+        "template<typename T, int M> T ap_mask(const ap_slice<M>& u, int width) {\n"
+        "    return T(u);\n"
+        "}\n"
+        "template<typename T> T ap_mask(uint64_t u, int width) {\n"
+        "    return T(u);\n"
+        "}\n"
+        "template<typename R, int M> R ap_field(const ap_slice<M>& v, int hi, int lo) {\n"
+        "    R r(v >> lo);\n"
+        "    for (int i = hi - lo + 1; i < R::width; i++) r.p[i] = ap_lanes();\n"
+        "    return r;\n"
+        "}\n"
+        "template<typename T> T ap_shl(const T& v, int amt) {\n"
+        "    return v << amt;\n"
+        "}\n"
+        "template<typename T> T ap_shr(const T& v, int amt) {\n"
+        "    return v >> amt;\n"
+        "}\n"
+        "// A barrel shifter, one stage per bit of the amount.\n"
+        "template<typename T, int M> T ap_shl(const T& v, const ap_slice<M>& amt) {\n"
+        "    T r = v;\n"
+        "    ap_lanes over = ap_lanes();\n"
+        "    for (int k = 0; k < M; k++) {\n"
+        "        if (k < 30 && (1 << k) < T::width) {\n"
+        "            r = ap_mux(amt.p[k], r << (1 << k), r);\n"
+        "        } else {\n"
+        "            over |= amt.p[k];\n"
+        "        }\n"
+        "    }\n"
+        "    return ap_mux(over, T(), r);\n"
+        "}\n"
+        "template<typename T, int M> T ap_shr(const T& v, const ap_slice<M>& amt) {\n"
+        "    T r = v;\n"
+        "    ap_lanes over = ap_lanes();\n"
+        "    for (int k = 0; k < M; k++) {\n"
+        "        if (k < 30 && (1 << k) < T::width) {\n"
+        "            r = ap_mux(amt.p[k], r >> (1 << k), r);\n"
+        "        } else {\n"
+        "            over |= amt.p[k];\n"
+        "        }\n"
+        "    }\n"
+        "    return ap_mux(over, T(), r);\n"
+        "}\n"
+        "template<typename T> T ap_div(const T& a, const T& b) {\n"
+        "    T rem;\n"
+        "    return ap_divmod(a, b, &rem);\n"
+        "}\n"
+        "template<typename T> T ap_rem(const T& a, const T& b) {\n"
+        "    T rem;\n"
+        "    ap_divmod(a, b, &rem);\n"
+        "    return rem;\n"
+        "}\n"
+        "\n"
+        "// Array accesses, whose index may differ between lanes: a read ORs together\n"
+        "// the entries each lane's index selects, and a write updates each entry in\n"
+        "// the lanes that select it. Indices of |n| or more read as 0 and write\n"
+        "// nothing.\n"
+        "template<int W, int I> ap_slice<W> ap_read(const ap_slice<W>* entries, int n,\n"
+        "                                           const ap_slice<I>& index) {\n"
+        "    ap_slice<W> r;\n"
+        "    for (int e = 0; e < n && (I >= 30 || e < (1 << (I % 30))); e++) {\n"
+        "        ap_lanes m = (index == ap_slice<I>(e)).p[0];\n"
+        "        for (int i = 0; i < W; i++) r.p[i] |= entries[e].p[i] & m;\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "template<int W, int I> void ap_write(ap_slice<W>* entries, int n,\n"
+        "                                     const ap_slice<I>& index,\n"
+        "                                     const ap_slice<W>& data,\n"
+        "                                     const ap_slice<1>& enable) {\n"
+        "    for (int e = 0; e < n && (I >= 30 || e < (1 << (I % 30))); e++) {\n"
+        "        ap_lanes m = enable.p[0] & (index == ap_slice<I>(e)).p[0];\n"
+        "        entries[e] = ap_mux(m, data, entries[e]);\n"
+        "    }\n"
+        "}\n"
+        "\n"
+        "}  // namespace ap_bitsliced\n"
+        "\n"
+        "#endif  // AUTOPIPER_BITSLICED_MODEL_PRELUDE_\n"
+        "\n");
+}
+
+void CppModelGenerator::PrintFields(const char* title,
+                                    const vector<Field>& fields) {
+    if (fields.empty()) return;
+    out_->Print(string("    // ") + title + "\n");
+    for (const auto& field : fields) {
+        PrinterScope scope(out_);
+        out_->SetVars({
+            { "type", Type(field.width) },
+            { "name", field.name },
+            { "entries", strprintf("%d", field.elements) },
+            { "comment", field.comment.empty() ? "" : field.comment + " " },
+            { "msb", strprintf("%d", field.width - 1) },
+        });
+        if (field.elements > 0) {
+            out_->Print("    $type$ $name$[$entries$] = {};  // $comment$[$msb$:0]\n");
+        } else {
+            out_->Print("    $type$ $name$ = 0;  // $comment$[$msb$:0]\n");
+        }
+    }
+    out_->Print("\n");
+}
+
+void CppModelGenerator::PrintModel(bool cyclic) {
+    PrinterScope global_scope(out_);
+    out_->SetVar("model", name_ + "_model");
+    out_->SetVar("guard", string(bit_sliced_ ? "AUTOPIPER_BITSLICED_MODEL_" :
+                                              "AUTOPIPER_MODEL_") +
+                          name_ + "_H_");
+
+    // N.B.: Printer indents every line it starts, including blank ones, so
+    // the model is printed at indent level zero with explicit indentation.
+    if (bit_sliced_) {
+        out_->Print(
+            "// Bit-sliced C++ model of module '$name$', generated by autopiper.\n"
+            "//\n"
+            "// As the cycle-based model, but simulating ap_lane_count independent\n"
+            "// copies of the module (lanes) at once. Each field is an ap_slice<>\n"
+            "// holding its value in every lane: set or read one lane's value with\n"
+            "// set() and get(), or assign a constant to set it in every lane.\n"
+            "\n"
+            "#ifndef $guard$\n"
+            "#define $guard$\n"
+            "\n"
+            "#include <stddef.h>\n"
+            "#include <stdint.h>\n"
+            "#include <string.h>\n"
+            "$stdio$"
+            "\n", { { "name", name_ },
+                    { "stdio", profile_trace_ ? "#include <stdio.h>\n" : "" } });
+        PrintBitSlicedPrelude();
+        out_->Print("namespace ap_bitsliced {\n\n");
+    } else {
+        out_->Print(
+            "// Cycle-based C++ model of module '$name$', generated by autopiper.\n"
+            "//\n"
+            "// Set input port fields, then call step() to advance one clock cycle:\n"
+            "// registers and arrays are written on the falling edge, then piperegs\n"
+            "// advance on the rising edge. eval() recomputes combinational logic\n"
+            "// without advancing the clock.\n"
+            "\n"
+            "#ifndef $guard$\n"
+            "#define $guard$\n"
+            "\n"
+            "#include <stddef.h>\n"
+            "#include <stdint.h>\n"
+            "$stdio$"
+            "\n", { { "name", name_ },
+                    { "stdio", profile_trace_ ? "#include <stdio.h>\n" : "" } });
+        PrintPrelude();
+    }
+
+    out_->Print(
+        "class $model$ {\n"
+        " public:\n"
+        "    $model$()$init$ { reset(); }\n"
+        "\n", { { "init", profile_trace_ ? " : profile_trace(NULL)" : "" } });
+    if (profile_trace_) {
+        out_->Print(
+            "    // Profile trace output, if set: a line per cycle listing the\n"
+            "    // events that occurred, as the layout written by --profile\n"
+            "    // numbers them.\n"
+            "    FILE* profile_trace;\n"
+            "\n");
+    }
+
+    PrintFields("Ports.", ports_);
+    PrintFields("Storage.", storage_);
+    PrintFields("Signals.", signals_);
+
+    vector<PipeReg> regs;
+    for (const auto* signal : StagedSignals()) {
+        for (const auto& reg : StagingFor(signal)) {
+            regs.push_back(reg);
+        }
+    }
+    regs.insert(regs.end(), port_regs_.begin(), port_regs_.end());
+
+    // Piperegs and registers return to zero on reset; arrays do not.
+    out_->Print("    void reset() {\n");
+    for (const auto& field : storage_) {
+        if (field.elements == 0) {
+            out_->Print("        " + field.name + " = 0;\n");
+        }
+    }
+    for (const auto& reg : regs) {
+        out_->Print("        " + reg.dst + " = 0;\n");
+    }
+    for (const auto& line : reset_) {
+        out_->Print("        " + line + "\n");
+    }
+    out_->Print(
+        "        eval();\n"
+        "    }\n"
+        "\n"
+        "    void eval() {\n");
+    string indent = "        ";
+    if (cyclic) {
+        // Combinational loops settle after at most one pass per assignment.
+        out_->Print("        for (int pass = 0; pass < $passes$; pass++) {\n",
+                    { { "passes", strprintf("%d", (int)comb_.size() + 1) } });
+        indent += "    ";
+    }
+    for (const auto& assign : comb_) {
+        string code = indent;
+        for (char c : assign.code) {
+            code += c;
+            if (c == '\n') code += indent;
+        }
+        out_->Print(code + "\n");
+    }
+    if (cyclic) {
+        out_->Print("        }\n");
+    }
+    out_->Print(
+        "    }\n"
+        "\n"
+        "    void falling_edge() {\n");
+    for (const auto& write : falling_edge_) {
+        out_->Print("        " + write + "\n");
+    }
+    out_->Print(
+        "    }\n"
+        "\n"
+        "    void rising_edge() {\n");
+    // Skid buffers take the arriving values before the piperegs advance.
+    for (const auto& line : rising_edge_) {
+        out_->Print("        " + line + "\n");
+    }
+    // As in the Verilog pipereg module, a pipereg loads whenever its valid
+    // input is set; the hold input is not consulted.
+    for (const auto& reg : regs) {
+        PrinterScope scope(out_);
+        out_->SetVars({
+            { "type", Type(reg.width) },
+            { "dst", reg.dst },
+        });
+        if (reg.valid.empty()) {
+            out_->Print("        $type$ next_$dst$ = $src$;\n",
+                        { { "src", bit_sliced_ ?
+                            "(" + Type(reg.width) + ")" + reg.src :
+                            reg.src } });
+        } else {
+            out_->Print("        $type$ next_$dst$ = $next$;\n",
+                        { { "next", Select(reg.valid, reg.src, reg.dst,
+                                           reg.width) } });
+        }
+    }
+    for (const auto& reg : regs) {
+        out_->Print("        " + reg.dst + " = next_" + reg.dst + ";\n");
+    }
+    out_->Print(
+        "    }\n"
+        "\n"
+        "    void step() {\n"
+        "        eval();\n"
+        "        falling_edge();\n"
+        "        eval();\n"
+        "        rising_edge();\n"
+        "        eval();\n"
+        "    }\n"
+        "};\n"
+        "\n");
+    if (bit_sliced_) {
+        out_->Print("}  // namespace ap_bitsliced\n\n");
+    }
+    out_->Print("#endif  // $guard$\n");
+}
@@ -17,6 +17,7 @@
 #ifndef _AUTOPIPER_GEN_VERILOG_H_
 #define _AUTOPIPER_GEN_VERILOG_H_
 
+#include <functional>
 #include <vector>
 #include <map>
 #include <set>
@@ -30,37 +31,265 @@
 
 namespace autopiper {
 
-class VerilogGenerator {
+// State and helpers shared by the generators below. Values are carried from
+// their defining stage to each stage that uses them through piperegs; both
+// generators derive the set of piperegs and the bypass-network structure from
+// the same bookkeeping here so that their outputs stay cycle-equivalent.
+class PipeGenerator {
  public:
-  VerilogGenerator(Printer* out,
-                   const std::vector<PipeSys*>& systems,
-                   const std::string& name)
+  // Writes the layout of the performance-counter bank that the generators
+  // emit for |systems| (see AssignPerfEvents() in lower.cc) to |out| as JSON,
+  // for host tools that read the counters back.
+  static void WritePerfCounterLayout(std::ostream* out,
+                                     const std::vector<PipeSys*>& systems,
+                                     const std::string& name);
+  // Writes the layout of the profile trace that the generators emit for
+  // |systems| (with IRProgram::profile) to |out| as JSON: each event's index
+  // in the trace, its stage, and for a statement's event, the statement's
+  // location. The trace has a line per cycle listing the events that
+  // occurred in it.
+  static void WriteProfileLayout(std::ostream* out,
+                                 const std::vector<PipeSys*>& systems,
+                                 const std::string& name);
+
+ protected:
+  PipeGenerator(Printer* out,
+                const std::vector<PipeSys*>& systems,
+                const std::string& name)
       : out_(out), program_(nullptr), systems_(systems), name_(name) {
       if (systems.size() > 0) {
           program_ = systems[0]->program;
       }
   }
 
-  void Generate();
-
- private:
   Printer* out_;
   IRProgram* program_;
   std::vector<PipeSys*> systems_;
   std::string name_;
 
-  // Map from generating node to (min_stage, max_stage) pairs
-  std::map<const IRStmt*, std::pair<int, int>> signal_stages_;
+  // Range of stages each signal is used in, indexed by IRStmt::id; |stmt| is
+  // null for signals not (yet) used.
+  struct SignalStages {
+      const IRStmt* stmt;
+      int min_stage;
+      int max_stage;
+  };
+  std::vector<SignalStages> signal_stages_;
+
+  // Returns all signals recorded by GetSignalInStage(), in statement-ID
+  // order.
+  std::vector<const IRStmt*> StagedSignals() const;
 
   // Returns a signal name for an IRStmt's value in a given stage. Creates
   // entries in the staged-values map but does not emit the pipereg instances.
   std::string GetSignalInStage(const IRStmt* stmt, int stage);
 
+  // Helper: deterministic name given a stmt and a stage
+  std::string SignalName(const IRStmt* stmt, int stage) const;
+
+  // Returns true if the statement produces no logic at all.
+  static bool IsElided(const IRStmt* stmt);
+
+  // One pipereg carrying a signal from stage i to stage i+1.
+  struct PipeReg {
+      std::string src;
+      std::string dst;
+      std::string valid;  // empty if always valid
+      std::string hold;   // empty if never held
+      int width;
+      const Pipe* pipe;
+      int stage;  // i
+      // Set if stage i+1 is elastic and the value passes through its skid
+      // buffer: |dst| is then the arriving value, and the buffer drives the
+      // signal's name in stage i+1.
+      bool skid;
+      // Set if the value is data, read only by the transaction it travels
+      // with, rather than control (a valid, kill or stall bit, or a bypass
+      // bus, which carries its own valid bits), so the register need not be
+      // reset.
+      bool data;
+  };
+  // Returns the piperegs needed for a signal, given the stages it is used in
+  // (as recorded by GetSignalInStage()).
+  std::vector<PipeReg> StagingFor(const IRStmt* stmt) const;
+  // Returns the registers that delay the value written to |port| (of
+  // |width| bits) by its latency (see IRPort::latency), one per cycle. They
+  // load every cycle, as the port itself is not tied to any transaction. For
+  // an exported input, they delay the module's input instead.
+  static std::vector<PipeReg> PortStaging(const IRPort* port, int width);
+  // The signal that a port's writer drives: the port itself, or for an
+  // exported output with a latency, the input of its first register.
+  static std::string PortWriteSignal(const IRPort* port);
+  // The signal that a port's readers see: the written value, or with a
+  // latency, the last of its delay registers.
+  static std::string PortReadSignal(const IRPort* port);
+
+  // The skid buffer at the input of an elastic stage (see SkidBuffer), with
+  // the piperegs of the values that pass through it.
+  struct Skid {
+      const Pipe* pipe;
+      const PipeStage* stage;
+      std::string name;  // prefix of the buffer's signals
+      std::string present;  // arriving transaction's presence
+      std::string hold;
+      std::vector<PipeReg> regs;
+  };
+  // Requests the staging that the skid buffers need. Call after all nodes are
+  // generated, before the piperegs are.
+  void StageSkids();
+  std::vector<Skid> Skids() const;
+  // Name prefix of the skid buffer at the input of |stage|.
+  std::string SkidName(const PipeStage* stage) const;
+  // The signal that a skid buffer drives for the value of |reg|.
+  static std::string SkidOutput(const PipeReg& reg);
+
+  // Returns the bypass-bus writer whose value is visible at |stage|: the
+  // write with the largest stage <= |stage|, or the bypass start if none.
+  static const IRStmt* BypassLastWriter(const IRBypass* bypass, int stage);
+  // The bypass buses that |read| (a bypass present, ready or read) matches
+  // its index against, as (last writer, stage) pairs, nearest-older
+  // transaction first: the bus in each later stage, and with several lanes,
+  // the older lanes' buses in the read's own stage and each lane's bus in
+  // each later stage, younger lanes first.
+  static std::vector<std::pair<const IRStmt*, int>> BypassBuses(
+          const IRStmt* read);
+
+  // One performance counter: the number of cycles in which |event| occurred
+  // in |stage| of |pipe|, the |pipe_index|'th pipe of the |sys|'th system.
+  // |signal| is set in those cycles and is read in |stage|. |site| is the
+  // statement of a statement's event (see PerfEvent).
+  struct PerfCounter {
+      int sys;
+      int pipe_index;
+      const Pipe* pipe;
+      int stage;
+      const char* event;
+      const IRStmt* signal;
+      const IRStmt* site;
+  };
+  // Returns the performance counters of |systems|, by system, pipe and stage,
+  // in the order of their indices in the counter bank. With |profile|, the
+  // statements' events are included, in the order of the profile trace.
+  static std::vector<PerfCounter> PerfCounters(
+          const std::vector<PipeSys*>& systems, bool profile = false);
+  // Width of the counter-bank select port for |counters| counters.
+  static int PerfSelectWidth(int counters);
+};
+
+class VerilogGenerator : public PipeGenerator {
+ public:
+  // If |bundle_piperegs| is set, all signals crossing a given stage boundary
+  // of a pipe with the same valid and hold controls share one wide pipereg
+  // instance rather than each having their own.
+  //
+  // If |verilator| is set, the output is written to lint clean under
+  // Verilator: every wire is declared ahead of the logic, constants and
+  // operands carry explicit widths, all writes to one storage element share
+  // one always block (in statement order, so the last write wins, as in the
+  // C++ model) and the library modules are in ANSI style.
+  //
+  // If |specialize_piperegs| is set, only the piperegs of control values
+  // are reset: data values are carried by a 'pipereg_data' instance, which
+  // only loads when its valid input is set, so that synthesis can gate its
+  // clock, and keeps its value through reset (the C++ model clears it). If
+  // |retime_piperegs| is also set, they are 'pipereg_retime' instances
+  // instead, whose register synthesis may retime.
+  //
+  // If |hierarchical| is set, each pipe is generated as its own module,
+  // |name|_<entry label>, whose ports are the signals it shares with the
+  // others, and module |name| only instantiates and connects them. Storage
+  // is in the module of the first pipe that accesses it, with all of its
+  // reads and writes. Values are numbered within each module, so a module's
+  // text does not change unless its pipe (or the storage it holds) does. The
+  // modules are generated by up to |jobs| threads; the output is the same for
+  // any number.
+  VerilogGenerator(Printer* out,
+                   const std::vector<PipeSys*>& systems,
+                   const std::string& name,
+                   bool bundle_piperegs = false,
+                   bool verilator = false,
+                   bool hierarchical = false,
+                   bool specialize_piperegs = false,
+                   bool retime_piperegs = false,
+                   int jobs = 1)
+      : PipeGenerator(out, systems, name),
+        bundle_piperegs_(bundle_piperegs),
+        verilator_(verilator),
+        hierarchical_(hierarchical),
+        specialize_piperegs_(specialize_piperegs || retime_piperegs),
+        retime_piperegs_(retime_piperegs),
+        jobs_(jobs),
+        module_(nullptr) {}
+
+  void Generate();
+
+ private:
+  bool bundle_piperegs_;
+  bool verilator_;
+  bool hierarchical_;
+  bool specialize_piperegs_;
+  bool retime_piperegs_;
+  int jobs_;
+  // The pipereg modules instantiated so far.
+  std::set<std::string> pipereg_modules_;
+  // With |hierarchical_|, the pipe whose module is being generated (null for
+  // the top module), the pipe whose module holds each storage element, and
+  // the width of each net declared so far in the module.
+  const Pipe* module_;
+  std::map<const IRStorage*, const Pipe*> storage_homes_;
+  std::map<std::string, int> declared_;
+  // With |verilator_|, the wire and read-register declarations, printed
+  // ahead of the logic.
+  std::vector<std::string> declarations_;
+  // With |verilator_|, the register and array writes of each storage
+  // element, in statement order.
+  std::map<const IRStorage*, std::vector<const IRStmt*>> storage_writes_;
+  // The array word read by each registered array read, by the name of its
+  // value in the stage that presents the index: this value's first pipereg
+  // is the read's output register (see GenerateReadRegister()).
+  std::map<std::string, std::string> registered_reads_;
+  // The performance counters, if any; their ports are module ports.
+  std::vector<PerfCounter> perf_counters_;
+  // The events that the profile trace records, if IRProgram::profile.
+  std::vector<PerfCounter> profile_events_;
+
+  // Generate the storage elements, the logic and the piperegs: everything
+  // in the module after its ports. With |hierarchical_|, only those of
+  // |module_|.
+  void GenerateBody();
+  // Runs |generate| with the output going to a buffer, and returns what it
+  // printed, preceded with |verilator_| by the declarations it made.
+  std::string GenerateBuffered(const std::function<void()>& generate);
+
+  // With |hierarchical_|: generate the top module and one module per pipe.
+  void GenerateHierarchy();
+  // The pipe whose module generates |stmt|: its own, or for a storage
+  // access, that which holds the storage.
+  const Pipe* ModuleOf(const IRStmt* stmt) const;
+  bool InModule(const IRStmt* stmt) const {
+      return !module_ || ModuleOf(stmt) == module_;
+  }
+
+  // Declare a wire: in place, or with |verilator_|, ahead of the logic.
+  void DeclareWire(int width, const std::string& name);
+  // A constant of |width| bits, sized with |verilator_|.
+  std::string Zero(int width) const;
+
   // Generate initial node computation for a given node.
   void GenerateNode(const IRStmt* stmt);
 
   // Generate pipereg instances for a signal.
   void GenerateStaging(const IRStmt* stmt);
+  // Generate one pipereg instance for each group of same-boundary,
+  // same-control piperegs across all signals.
+  void GenerateBundledStaging();
+  void GeneratePipeReg(const PipeReg& reg, const std::string& instance_name);
+  // The pipereg module that carries |reg|.
+  std::string PipeRegModule(const PipeReg& reg) const;
+  // Generate the output register of a registered array read, in the form
+  // synthesis tools infer as a synchronous RAM read port.
+  void GenerateReadRegister(const PipeReg& reg, const std::string& word);
+  void GenerateSkid(const Skid& skid);
 
   // Helpers: Generate()
   void GenerateModuleStart();
@@ -69,16 +298,124 @@ class VerilogGenerator {
 
   // Generate a storage element.
   void GenerateStorage(const IRStorage* storage);
+  // With |verilator_|, generate one always block for each storage element's
+  // writes.
+  void GenerateStorageWrites(const IRStorage* storage);
+  // The write of |stmt| to its array, as statements in an always block.
+  void GenerateArrayWrite(const IRStmt* stmt);
+
+  // Generate the performance-counter bank and its read port. Call after all
+  // nodes are generated.
+  void GeneratePerfCounters();
+  // Generate the profile trace, if IRProgram::profile. Call after all nodes
+  // are generated.
+  void GenerateProfileTrace();
+  // Generate the registers of exported ports with a latency, at the top
+  // module's boundary.
+  void GenerateIORegisters();
 
   // Helper: GenerateNode()
   void GenerateNodeExpr(const IRStmt* stmt,
                         const std::vector<std::string>& args);
 
-  // Helper: deterministic name given a stmt and a stage
-  std::string SignalName(const IRStmt* stmt, int stage) const;
-
-  // Generate the pipereg module.
+  // Generate the pipereg modules: the generic one, and the data variants
+  // that were used.
   void GeneratePipeRegModule();
+  void GenerateGenericPipeRegModule();
+  // Generate the skid buffer module.
+  void GenerateSkidBufModule();
+};
+
+// Generates a self-contained C++ header holding a two-state, cycle-based
+// model of the same pipeline systems that VerilogGenerator emits. The model is
+// a class named |name|_model with one public field per port, storage element
+// and signal, and reset(), eval() and step() methods. step() advances one
+// clock cycle: storage is written on the falling edge and piperegs advance on
+// the rising edge, as in the Verilog.
+//
+// With |bit_sliced|, the model instead simulates many independent copies of
+// the design (lanes) at once, for randomized testing: each field is an
+// ap_slice<width>, that holds the field of every lane as one bit-plane per
+// bit, and all logic is evaluated with bitwise operations over the planes.
+// The class is the same, in namespace ap_bitsliced.
+class CppModelGenerator : public PipeGenerator {
+ public:
+  CppModelGenerator(Printer* out,
+                    const std::vector<PipeSys*>& systems,
+                    const std::string& name,
+                    bool bit_sliced = false)
+      : PipeGenerator(out, systems, name), bit_sliced_(bit_sliced),
+        profile_trace_(false) {}
+
+  void Generate();
+
+ private:
+  bool bit_sliced_;
+  // Whether the model writes a profile trace (see GenerateProfileTrace()).
+  bool profile_trace_;
+
+  // The C++ type of a value of |width| bits.
+  std::string Type(int width) const;
+  // |cond| ? |a| : |b|, as a value of |width| bits.
+  std::string Select(const std::string& cond, const std::string& a,
+                     const std::string& b, int width) const;
+
+  // A field of the model class.
+  struct Field {
+      std::string name;
+      int width;
+      int elements;  // 0 for scalars
+      std::string comment;
+  };
+  std::vector<Field> ports_;
+  std::vector<Field> storage_;
+  std::vector<Field> signals_;
+  std::map<std::string, int> widths_;
+
+  // One combinational assignment: |code| sets |target| and reads |deps|.
+  struct CombAssign {
+      std::string target;
+      std::vector<std::string> deps;
+      std::string code;
+  };
+  std::vector<CombAssign> comb_;
+  // Register and array writes, performed on the falling clock edge.
+  std::vector<std::string> falling_edge_;
+  // Skid buffer updates, performed on the rising clock edge before the
+  // piperegs advance, and resets.
+  std::vector<std::string> rising_edge_;
+  std::vector<std::string> reset_;
+  // The delay registers of ports with a latency, including exported ones
+  // (see PortStaging()).
+  std::vector<PipeReg> port_regs_;
+
+  void GenerateSkid(const Skid& skid);
+  void GeneratePerfCounters();
+  void GenerateProfileTrace();
+
+  // Declare a field if not already declared.
+  void Declare(std::vector<Field>* fields, const std::string& name, int width,
+               int elements, const std::string& comment);
+  // Helper: deterministic signal name that also declares the signal.
+  std::string Signal(const IRStmt* stmt, int stage);
+  std::string SignalInStage(const IRStmt* stmt, int stage);
+
+  void GenerateNode(const IRStmt* stmt);
+  std::string GenerateNodeExpr(const IRStmt* stmt,
+                               const std::vector<std::string>& args);
+  void AddComb(const std::string& target, int width,
+               const std::string& expr,
+               const std::vector<std::string>& deps);
+
+  // Orders |comb_| so that each assignment follows the assignments it reads.
+  // Returns false if the logic has a combinational cycle, in which case the
+  // cyclic assignments are left at the end in their original order.
+  bool SortComb();
+
+  void PrintModel(bool cyclic);
+  void PrintFields(const char* title, const std::vector<Field>& fields);
+  void PrintPrelude();
+  void PrintBitSlicedPrelude();
 };
 
 }  // namespace autopiper
@@ -0,0 +1,440 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend/ir.h"
+#include "common/binary-format.h"
+#include "common/util.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace autopiper;
+using namespace std;
+
+// Binary IR format.
+//
+// A binary IR file holds one IRProgram, as the frontend hands it to the
+// backend: BBs, their statements, timing variables and program-level
+// settings. Ports, storage and bypass networks are not stored, since
+// crosslinking recreates them from statements' names.
+//
+// Integers, strings, locations and bignums are encoded as in
+// common/binary-format.h. The file is:
+//
+//     magic "APIRBIN\0", version
+//     string table: count, then (length, bytes) per string
+//     timing_model (string), minimize_registers, balance_stages,
+//         max_stages, minimize_predicates, share_kill_if_slices,
+//         propagate_predicates, register_inputs, register_outputs,
+//         bank_arrays, skid_depth,
+//         elastic_stages: count, then stage per entry, perf_counters,
+//         next_valnum, next_anon_timevar
+//     timevars: count, then name (string) per timevar
+//     BBs: count, then (label (string), is_entry, lanes, lane, pipelined,
+//         location) per BB
+//     entries: count, then per entry, BB index and lane_entries (count,
+//         then BB index per lane entry)
+//     stmts: count, then per stmt, in creation (id) order:
+//         valnum, type, op, width (signed), flags, location,
+//         constant, port_name (string), [port_default],
+//         timevar (index + 1, or 0), time_offset (signed),
+//         args: count, then stmt index per arg,
+//         targets: count, then BB index per target
+//     BB contents: per BB, count, then stmt index per stmt
+//
+// Statements keep their creation order, since later passes (e.g. CSE's
+// choice of leaders) depend on statement IDs. The constant is always stored:
+// some statements (arraysize) carry one without setting has_constant.
+//
+// Args and targets are stored as indices rather than valnums and labels, so
+// a loaded program is already crosslinked in that respect: Crosslink() only
+// has to create ports, storage and bypass networks.
+
+namespace {
+
+const char kBinaryMagic[8] = { 'A', 'P', 'I', 'R', 'B', 'I', 'N', '\0' };
+const int kBinaryVersion = 14;
+
+enum StmtFlags {
+    kFlagHasConstant = 1,
+    kFlagPortHasDefault = 2,
+};
+
+class BinaryWriter : public BinaryEncoder {
+    public:
+        BinaryWriter(const IRProgram* program) : program_(program) {}
+
+        void Write(ostream* out) {
+            // Number everything first, so that the string table is complete
+            // before it is written.
+            for (unsigned i = 0; i < program_->bbs.size(); i++) {
+                const IRBB* bb = program_->bbs[i].get();
+                bb_index_[bb] = i;
+                stmts_.insert(stmts_.end(), bb->stmts.begin(), bb->stmts.end());
+            }
+            sort(stmts_.begin(), stmts_.end(),
+                 [](const IRStmt* a, const IRStmt* b) {
+                     return a->id < b->id;
+                 });
+            for (unsigned i = 0; i < stmts_.size(); i++) {
+                stmt_index_[stmts_[i]] = i;
+            }
+            for (unsigned i = 0; i < program_->timevars.size(); i++) {
+                timevar_index_[program_->timevars[i].get()] = i;
+            }
+
+            string body;
+            WriteProgram(&body);
+
+            string header(kBinaryMagic, sizeof(kBinaryMagic));
+            PutVarint(&header, kBinaryVersion);
+            PutStringTable(&header);
+            out->write(header.data(), header.size());
+            out->write(body.data(), body.size());
+        }
+
+    private:
+        const IRProgram* program_;
+        map<const IRBB*, int> bb_index_;
+        vector<const IRStmt*> stmts_;
+        map<const IRStmt*, int> stmt_index_;
+        map<const IRTimeVar*, int> timevar_index_;
+
+        void WriteProgram(string* out) {
+            PutString(out, program_->timing_model);
+            PutVarint(out, program_->minimize_registers ? 1 : 0);
+            PutVarint(out, program_->balance_stages ? 1 : 0);
+            PutVarint(out, program_->max_stages);
+            PutVarint(out, program_->minimize_predicates ? 1 : 0);
+            PutVarint(out, program_->share_kill_if_slices ? 1 : 0);
+            PutVarint(out, program_->propagate_predicates ? 1 : 0);
+            PutVarint(out, program_->register_inputs ? 1 : 0);
+            PutVarint(out, program_->register_outputs ? 1 : 0);
+            PutVarint(out, program_->bank_arrays ? 1 : 0);
+            PutVarint(out, program_->skid_depth);
+            PutVarint(out, program_->elastic_stages.size());
+            for (int stage : program_->elastic_stages) {
+                PutVarint(out, stage);
+            }
+            PutVarint(out, program_->perf_counters ? 1 : 0);
+            PutVarint(out, program_->next_valnum.load());
+            PutVarint(out, program_->next_anon_timevar);
+
+            PutVarint(out, program_->timevars.size());
+            for (auto& timevar : program_->timevars) {
+                PutString(out, timevar->name);
+            }
+
+            PutVarint(out, program_->bbs.size());
+            for (auto& bb : program_->bbs) {
+                PutString(out, bb->label);
+                PutVarint(out, bb->is_entry ? 1 : 0);
+                PutVarint(out, bb->lanes);
+                PutVarint(out, bb->lane);
+                PutVarint(out, bb->pipelined ? 1 : 0);
+                PutLocation(out, bb->location);
+            }
+            PutVarint(out, program_->entries.size());
+            for (auto* entry : program_->entries) {
+                PutVarint(out, bb_index_[entry]);
+                PutVarint(out, entry->lane_entries.size());
+                for (auto* lane_entry : entry->lane_entries) {
+                    PutVarint(out, bb_index_[lane_entry]);
+                }
+            }
+
+            PutVarint(out, stmts_.size());
+            for (auto* stmt : stmts_) {
+                WriteStmt(out, stmt);
+            }
+            for (auto& bb : program_->bbs) {
+                PutVarint(out, bb->stmts.size());
+                for (auto* stmt : bb->stmts) {
+                    PutVarint(out, stmt_index_[stmt]);
+                }
+            }
+        }
+
+        void WriteStmt(string* out, const IRStmt* stmt) {
+            PutVarint(out, stmt->valnum);
+            PutVarint(out, stmt->type);
+            PutVarint(out, stmt->op);
+            PutSigned(out, stmt->width);
+            int flags = (stmt->has_constant ? kFlagHasConstant : 0) |
+                        (stmt->port_has_default ? kFlagPortHasDefault : 0);
+            PutVarint(out, flags);
+            PutLocation(out, stmt->location);
+            PutBignum(out, stmt->constant);
+            PutString(out, stmt->port_name);
+            if (stmt->port_has_default) {
+                PutBignum(out, stmt->port_default);
+            }
+            PutVarint(out, stmt->timevar ?
+                           timevar_index_[stmt->timevar] + 1 : 0);
+            PutSigned(out, stmt->time_offset);
+
+            PutVarint(out, stmt->args.size());
+            for (auto* arg : stmt->args) {
+                auto it = stmt_index_.find(arg);
+                assert(it != stmt_index_.end());
+                PutVarint(out, it->second);
+            }
+            PutVarint(out, stmt->targets.size());
+            for (auto* target : stmt->targets) {
+                auto it = bb_index_.find(target);
+                assert(it != bb_index_.end());
+                PutVarint(out, it->second);
+            }
+        }
+};
+
+class BinaryReader : public BinaryDecoder {
+    public:
+        BinaryReader(const string& filename, const char* data, size_t size,
+                     ErrorCollector* collector)
+            : BinaryDecoder(filename, data, size, collector,
+                            "binary IR file") {}
+
+        unique_ptr<IRProgram> Read() {
+            unique_ptr<IRProgram> program(new IRProgram());
+            if (!GetHeader(kBinaryMagic, sizeof(kBinaryMagic),
+                           kBinaryVersion, "binary IR")) {
+                return nullptr;
+            }
+            GetStringTable();
+
+            if (ok()) ReadProgram(program.get());
+            if (ok() && !AtEnd()) {
+                Error("Trailing data after binary IR program");
+            }
+            if (!ok()) return nullptr;
+            return program;
+        }
+
+    private:
+        void ReadProgram(IRProgram* program) {
+            program->timing_model = GetString();
+            program->minimize_registers = GetVarint() != 0;
+            program->balance_stages = GetVarint() != 0;
+            program->max_stages = GetInt();
+            program->minimize_predicates = GetVarint() != 0;
+            program->share_kill_if_slices = GetVarint() != 0;
+            program->propagate_predicates = GetVarint() != 0;
+            program->register_inputs = GetVarint() != 0;
+            program->register_outputs = GetVarint() != 0;
+            program->bank_arrays = GetVarint() != 0;
+            program->skid_depth = GetInt();
+            unsigned long long stage_count = GetCount();
+            for (unsigned long long i = 0; ok() && i < stage_count; i++) {
+                program->elastic_stages.push_back(GetInt());
+            }
+            program->perf_counters = GetVarint() != 0;
+            program->next_valnum = GetInt();
+            program->next_anon_timevar = GetInt();
+
+            unsigned long long timevar_count = GetCount();
+            for (unsigned long long i = 0; ok() && i < timevar_count; i++) {
+                unique_ptr<IRTimeVar> timevar(new IRTimeVar());
+                timevar->name = GetString();
+                program->timevar_map[timevar->name] = timevar.get();
+                program->timevars.push_back(move(timevar));
+            }
+
+            unsigned long long bb_count = GetCount();
+            for (unsigned long long i = 0; ok() && i < bb_count; i++) {
+                unique_ptr<IRBB> bb(new IRBB());
+                bb->label = GetString();
+                bb->is_entry = GetVarint() != 0;
+                bb->lanes = GetInt();
+                bb->lane = GetInt();
+                bb->pipelined = GetVarint() != 0;
+                GetLocation(&bb->location);
+                program->AddBB(move(bb));
+            }
+            unsigned long long entry_count = GetCount();
+            for (unsigned long long i = 0; ok() && i < entry_count; i++) {
+                int index = GetIndex(program->bbs.size());
+                if (!ok()) break;
+                IRBB* entry = program->bbs[index].get();
+                program->entries.push_back(entry);
+                unsigned long long lane_count = GetCount();
+                for (unsigned long long j = 0; ok() && j < lane_count; j++) {
+                    int lane_index = GetIndex(program->bbs.size());
+                    if (ok()) {
+                        entry->lane_entries.push_back(
+                                program->bbs[lane_index].get());
+                    }
+                }
+            }
+
+            // Statements are created up front so that args may refer
+            // forward (e.g., phi inputs along backedges).
+            unsigned long long stmt_count = GetCount();
+            vector<IRStmt*> stmts;
+            for (unsigned long long i = 0; ok() && i < stmt_count; i++) {
+                stmts.push_back(program->NewStmt());
+            }
+            for (unsigned long long i = 0; ok() && i < stmt_count; i++) {
+                ReadStmt(program, stmts, stmts[i]);
+            }
+            for (unsigned i = 0; ok() && i < program->bbs.size(); i++) {
+                IRBB* bb = program->bbs[i].get();
+                unsigned long long count = GetCount();
+                for (unsigned long long j = 0; ok() && j < count; j++) {
+                    int index = GetIndex(stmts.size());
+                    if (!ok()) break;
+                    IRStmt* stmt = stmts[index];
+                    if (stmt->bb) {
+                        Error("Statement in more than one BB in binary IR file");
+                        break;
+                    }
+                    stmt->bb = bb;
+                    bb->stmts.push_back(stmt);
+                }
+            }
+            program->crosslinked_args_bbs = true;
+        }
+
+        void ReadStmt(IRProgram* program, const vector<IRStmt*>& stmts,
+                      IRStmt* stmt) {
+            stmt->valnum = GetInt();
+            int type = GetIndex(IRStmtNone + 1);
+            int op = GetIndex(IRStmtOpCmpGE + 1);
+            stmt->width = static_cast<int>(GetSigned());
+            int flags = GetInt();
+            GetLocation(&stmt->location);
+            if (!ok()) return;
+            stmt->type = static_cast<IRStmtType>(type);
+            stmt->op = static_cast<IRStmtOp>(op);
+
+            stmt->has_constant = (flags & kFlagHasConstant) != 0;
+            stmt->constant = GetBignum<bignum>();
+            stmt->port_name = GetString();
+            if (flags & kFlagPortHasDefault) {
+                stmt->port_has_default = true;
+                stmt->port_default = GetBignum<bignum>();
+            }
+            int timevar = GetIndex(program->timevars.size() + 1);
+            stmt->time_offset = static_cast<int>(GetSigned());
+            if (ok() && timevar > 0) {
+                stmt->timevar = program->timevars[timevar - 1].get();
+                stmt->timevar->uses.push_back(stmt);
+            }
+
+            unsigned long long arg_count = GetCount();
+            for (unsigned long long i = 0; ok() && i < arg_count; i++) {
+                int index = GetIndex(stmts.size());
+                if (ok()) stmt->args.push_back(stmts[index]);
+            }
+            unsigned long long target_count = GetCount();
+            for (unsigned long long i = 0; ok() && i < target_count; i++) {
+                int index = GetIndex(program->bbs.size());
+                if (ok()) stmt->targets.push_back(program->bbs[index].get());
+            }
+
+            // Later passes index args and targets by position, as the text
+            // parser's grammar guarantees them; hold this file to the same.
+            string error;
+            if (ok() && !stmt->CheckArity(&error)) {
+                Error(error + " in binary IR file");
+            }
+        }
+};
+
+// A read-only mapping of a whole file, unmapped on destruction.
+class MappedFile {
+    public:
+        MappedFile() : data_(nullptr), size_(0) {}
+        ~MappedFile() {
+            if (data_ && size_ > 0) {
+                munmap(const_cast<char*>(data_), size_);
+            }
+        }
+
+        bool Open(const string& filename) {
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                return false;
+            }
+            size_ = st.st_size;
+            if (size_ > 0) {
+                void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr == MAP_FAILED) {
+                    close(fd);
+                    return false;
+                }
+                data_ = static_cast<const char*>(addr);
+            }
+            close(fd);
+            return true;
+        }
+
+        const char* data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        const char* data_;
+        size_t size_;
+};
+
+}  // anonymous namespace
+
+void IRProgram::WriteBinary(std::ostream* out) const {
+    BinaryWriter writer(this);
+    writer.Write(out);
+}
+
+bool IRProgram::IsBinary(const char* data, size_t size) {
+    return size >= sizeof(kBinaryMagic) &&
+           memcmp(data, kBinaryMagic, sizeof(kBinaryMagic)) == 0;
+}
+
+unique_ptr<IRProgram> IRProgram::ParseBinary(const std::string& filename,
+                                             const char* data, size_t size,
+                                             ErrorCollector* collector) {
+    BinaryReader reader(filename, data, size, collector);
+    return reader.Read();
+}
+
+unique_ptr<IRProgram> IRProgram::Load(const std::string& filename,
+                                      ErrorCollector* collector) {
+    MappedFile file;
+    if (!file.Open(filename)) {
+        Location loc;
+        loc.filename = filename;
+        collector->ReportError(loc, ErrorCollector::ERROR,
+                               string("Could not open file '") + filename +
+                               string("'"));
+        return nullptr;
+    }
+    if (IsBinary(file.data(), file.size())) {
+        return ParseBinary(filename, file.data(), file.size(), collector);
+    }
+    ifstream in(filename);
+    return Parse(filename, &in, collector);
+}
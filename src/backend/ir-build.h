@@ -26,31 +26,41 @@ class IRBBBuilder {
   IRBBBuilder(IRProgram* prog, IRBB* bb) : prog_(prog), bb_(bb) {}
 
   IRStmt* Add(IRStmt* new_stmt) {
-      std::unique_ptr<IRStmt> p(new_stmt);
-      stmts_.push_back(std::move(p));
+      stmts_.push_back(new_stmt);
       return new_stmt;
   }
 
+  // Allocates a new, blank statement in the program's arena and appends it.
+  IRStmt* AddStmt() {
+      return Add(prog_->NewStmt());
+  }
+
   IRStmt* AddExpr(IRStmtOp op, std::vector<IRStmt*> args) {
-      std::unique_ptr<IRStmt> new_stmt(new IRStmt());
+      IRStmt* new_stmt = prog_->NewStmt();
       new_stmt->valnum = prog_->GetValnum();
       new_stmt->bb = bb_;
       new_stmt->type = IRStmtExpr;
       new_stmt->op = op;
       for (auto* arg : args) {
-          new_stmt->arg_nums.push_back(arg->valnum);
           new_stmt->args.push_back(arg);
           new_stmt->width = arg->width;
       }
-      IRStmt* ret = new_stmt.get();
-      stmts_.push_back(std::move(new_stmt));
-      return ret;
+      stmts_.push_back(new_stmt);
+      return new_stmt;
   }
 
-  IRStmt* AddStmt(std::unique_ptr<IRStmt> stmt) {
-      IRStmt* ret = stmt.get();
-      stmts_.push_back(move(stmt));
-      return ret;
+  // As above, but with an explicit result width.
+  IRStmt* AddExpr(IRStmtOp op, int width, std::vector<IRStmt*> args) {
+      IRStmt* new_stmt = AddExpr(op, args);
+      new_stmt->width = width;
+      return new_stmt;
+  }
+
+  IRStmt* AddConst(int width, const bignum& value) {
+      IRStmt* new_stmt = AddExpr(IRStmtOpConst, width, {});
+      new_stmt->constant = value;
+      new_stmt->has_constant = true;
+      return new_stmt;
   }
 
   // Requires |op| to be associative, i.e. (((v1 op v2) op v3) op v4) can be
@@ -74,8 +84,8 @@ class IRBBBuilder {
   // Prepend accumulated ops to the BB's stmt list. User should batch additions
   // and do this only once, since it needs to copy the stmt list.
   void PrependToBB() {
-      for (auto& s : bb_->stmts) {
-          stmts_.push_back(std::move(s));
+      for (auto* s : bb_->stmts) {
+          stmts_.push_back(s);
       }
       std::swap(bb_->stmts, stmts_);
       stmts_.clear();
@@ -90,7 +100,7 @@ class IRBBBuilder {
   IRProgram* prog_;
   IRBB* bb_;
   // statements to append at flush.
-  std::vector<std::unique_ptr<IRStmt>> stmts_;
+  std::vector<IRStmt*> stmts_;
 };
 
 }  // namespace autopiper
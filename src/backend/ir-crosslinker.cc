@@ -18,7 +18,9 @@
 #include "backend/compiler.h"
 #include "common/util.h"
 
+#include <algorithm>
 #include <map>
+#include <set>
 #include <vector>
 #include <string>
 
@@ -27,6 +29,13 @@ using namespace autopiper;
 
 namespace {
 
+// The longest registered-read pipeline an array may declare.
+const int kMaxReadLatency = 16;
+// The longest latency a port or chan may declare.
+const int kMaxPortLatency = 16;
+// The most lanes an entry may issue into.
+const int kMaxLanes = 64;
+
 void SetBBBackpointers(IRProgram* program) {
     for (auto& bb : program->bbs) {
         for (auto& stmt : bb->stmts) {
@@ -35,112 +44,263 @@ void SetBBBackpointers(IRProgram* program) {
     }
 }
 
-typedef map<string, IRBB*> BBMap;
+// BBs by the interned ID of their labels.
+typedef vector<IRBB*> BBMap;
 
 bool GetBBMap(IRProgram* program,
               BBMap* m,
               ErrorCollector* collector) {
     for (auto& bb : program->bbs) {
-        if (m->find(bb->label) != m->end()) {
+        int id = Symbol(bb->label).id();
+        if (id >= static_cast<int>(m->size())) m->resize(id + 1, nullptr);
+        if ((*m)[id]) {
             collector->ReportError(bb->location, ErrorCollector::ERROR,
                     string("Duplicate basic-block label '") + bb->label +
                     string("': previous was at ") +
-                    (*m)[bb->label]->location.ToString());
+                    (*m)[id]->location.ToString());
             return false;
         }
-        m->insert(make_pair(bb->label, bb.get()));
+        (*m)[id] = bb.get();
     }
     return true;
 }
 
-typedef map<int, IRStmt*> ValnumMap;
+// Statements by valnum. Valnums are dense (the parser keeps next_valnum
+// above every valnum it reads), so they index the table directly.
+typedef vector<IRStmt*> ValnumMap;
 
 bool GetValnumMap(IRProgram* program,
                   ValnumMap* m,
                   ErrorCollector* collector) {
+    m->assign(program->next_valnum, nullptr);
     for (auto& bb : program->bbs) {
         for (auto& stmt : bb->stmts) {
-            if (m->find(stmt->valnum) != m->end()) {
+            if (stmt->valnum < 0 || stmt->valnum >= program->next_valnum) {
+                collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                        "Invalid value number");
+                return false;
+            }
+            if ((*m)[stmt->valnum]) {
                 collector->ReportError(stmt->location, ErrorCollector::ERROR,
                         string("Value number duplicated: original use at ") +
                         (*m)[stmt->valnum]->location.ToString());
                 return false;
             }
-            m->insert(make_pair(stmt->valnum, stmt.get()));
+            (*m)[stmt->valnum] = stmt;
         }
     }
     return true;
 }
 
-typedef map<string, vector<IRStmt*>> PortMap;
+// Statements grouped by the name of the port, storage or bypass network they
+// refer to, in name order. Names are interned, and each group found through
+// a table indexed by the name's ID, so grouping is one linear pass; only the
+// distinct names are sorted, so that ports, storage and bypasses are created
+// in the same order as ever.
+class NameGroups {
+ public:
+  void Add(const string& name, IRStmt* stmt) {
+      Symbol sym(name);
+      int id = sym.id();
+      if (id >= static_cast<int>(index_.size())) index_.resize(id + 1, -1);
+      if (index_[id] == -1) {
+          index_[id] = groups_.size();
+          groups_.push_back(make_pair(sym, vector<IRStmt*>()));
+      }
+      groups_[index_[id]].second.push_back(stmt);
+  }
 
-bool GetPortMap(IRProgram* program,
-                PortMap* m,
-                ErrorCollector* collector) {
-    for (auto& bb : program->bbs) {
-        for (auto& stmt : bb->stmts) {
-            if (!IRReadsPort(stmt->type) &&
-                !IRWritesPort(stmt->type) &&
-                stmt->type != IRStmtPortExport) continue;
-            if (stmt->port_name == "") {
-                collector->ReportError(stmt->location, ErrorCollector::ERROR,
-                        "Empty port name");
-                return false;
-            }
-            (*m)[stmt->port_name].push_back(stmt.get());
-        }
+  const vector<pair<Symbol, vector<IRStmt*>>>& Sorted() {
+      sort(groups_.begin(), groups_.end(),
+           [](const pair<Symbol, vector<IRStmt*>>& a,
+              const pair<Symbol, vector<IRStmt*>>& b) {
+               return a.first < b.first;
+           });
+      return groups_;
+  }
+
+ private:
+  vector<int> index_;
+  vector<pair<Symbol, vector<IRStmt*>>> groups_;
+};
+
+typedef NameGroups PortMap;
+typedef NameGroups StorageMap;
+typedef NameGroups BypassMap;
+
+bool IsBypassStmt(const IRStmt* stmt) {
+    switch (stmt->type) {
+        case IRStmtBypassStart:
+        case IRStmtBypassEnd:
+        case IRStmtBypassPresent:
+        case IRStmtBypassReady:
+        case IRStmtBypassRead:
+        case IRStmtBypassWrite:
+            return true;
+        default:
+            return false;
     }
-    return true;
 }
 
-typedef map<string, vector<IRStmt*>> StorageMap;
+// The name of lane |lane|'s copy of a BB, chan or bypass network. Lane 0
+// keeps the original.
+string LaneName(const string& name, int lane) {
+    return lane == 0 ? name : strprintf("%s_lane%d", name.c_str(), lane);
+}
 
-bool GetStorageMap(IRProgram* program,
-                   StorageMap* m,
-                   ErrorCollector* collector) {
+// Chans and bypass networks carry per-transaction state, so each lane has its
+// own; ports and storage are shared by all lanes.
+bool IsLanePrivate(const IRStmt* stmt) {
+    return stmt->type == IRStmtChanRead ||
+           stmt->type == IRStmtChanWrite ||
+           IsBypassStmt(stmt);
+}
+
+// Turns a 'lane' statement into the constant index of its lane.
+void SetLaneIndex(IRStmt* stmt, int lane) {
+    stmt->type = IRStmtExpr;
+    stmt->op = IRStmtOpConst;
+    stmt->constant = lane;
+    stmt->has_constant = true;
+}
+
+// Copies the BBs reachable from each multi-lane entry, following spawns,
+// once per lane after the first (see IRBB::lanes). The copies share timevars
+// with the originals, so that all lanes of the group are timed alike. A
+// program read back from binary IR already has its copies.
+bool ExpandLanes(IRProgram* program, ErrorCollector* collector) {
+    for (auto* entry : program->entries) {
+        if (entry->lanes < 1 || entry->lanes > kMaxLanes) {
+            collector->ReportError(entry->location, ErrorCollector::ERROR,
+                    strprintf("Lane count for entry '%s' must be between 1 "
+                              "and %d", entry->label.c_str(), kMaxLanes));
+            return false;
+        }
+        if (entry->lanes == 1 || !entry->lane_entries.empty()) continue;
+
+        // The group's BBs, in program order.
+        set<IRBB*> reached;
+        vector<IRBB*> work = { entry };
+        while (!work.empty()) {
+            IRBB* bb = work.back();
+            work.pop_back();
+            if (!reached.insert(bb).second) continue;
+            for (auto* stmt : bb->stmts) {
+                if (stmt->type == IRStmtJmp || stmt->type == IRStmtIf ||
+                    stmt->type == IRStmtSpawn) {
+                    work.insert(work.end(),
+                                stmt->targets.begin(), stmt->targets.end());
+                }
+            }
+        }
+        vector<IRBB*> group;
+        for (auto& bb : program->bbs) {
+            if (reached.count(bb.get())) group.push_back(bb.get());
+        }
+
+        for (int lane = 1; lane < entry->lanes; lane++) {
+            map<const IRBB*, IRBB*> bb_copies;
+            map<const IRStmt*, IRStmt*> stmt_copies;
+            vector<IRBB*> copies;
+            for (auto* bb : group) {
+                unique_ptr<IRBB> copy(new IRBB());
+                copy->label = LaneName(bb->label, lane);
+                copy->location = bb->location;
+                copy->lanes = entry->lanes;
+                copy->lane = lane;
+                copy->pipelined = bb->pipelined;
+                for (auto* stmt : bb->stmts) {
+                    IRStmt* stmt_copy = program->NewStmt(*stmt);
+                    stmt_copy->valnum = program->GetValnum();
+                    stmt_copy->bb = copy.get();
+                    if (stmt_copy->timevar) {
+                        stmt_copy->timevar->uses.push_back(stmt_copy);
+                    }
+                    if (IsLanePrivate(stmt) && !stmt->port_name.empty()) {
+                        stmt_copy->port_name = LaneName(stmt->port_name, lane);
+                    }
+                    if (stmt->type == IRStmtLane) {
+                        SetLaneIndex(stmt_copy, lane);
+                    }
+                    copy->stmts.push_back(stmt_copy);
+                    stmt_copies[stmt] = stmt_copy;
+                }
+                bb_copies[bb] = copy.get();
+                copies.push_back(copy.get());
+                program->AddBB(move(copy));
+            }
+            for (auto* copy : copies) {
+                for (auto* stmt : copy->stmts) {
+                    for (auto& arg : stmt->args) {
+                        auto it = stmt_copies.find(arg);
+                        if (it != stmt_copies.end()) arg = it->second;
+                    }
+                    for (auto& target : stmt->targets) {
+                        auto it = bb_copies.find(target);
+                        if (it != bb_copies.end()) target = it->second;
+                    }
+                }
+            }
+            entry->lane_entries.push_back(bb_copies[entry]);
+        }
+
+        for (auto* bb : group) {
+            bb->lanes = entry->lanes;
+        }
+    }
+
+    // The originals, and BBs outside any multi-lane group, are lane 0.
     for (auto& bb : program->bbs) {
-        for (auto& stmt : bb->stmts) {
-            if (!IRReadsStorage(stmt->type) &&
-                !IRWritesStorage(stmt->type) &&
-                stmt->type != IRStmtArraySize) continue;
-            if (stmt->port_name == "") {
-                collector->ReportError(stmt->location, ErrorCollector::ERROR,
-                        "Empty storage name");
-                return false;
+        for (auto* stmt : bb->stmts) {
+            if (stmt->type == IRStmtLane) {
+                SetLaneIndex(stmt, 0);
             }
-            (*m)[stmt->port_name].push_back(stmt.get());
         }
     }
     return true;
 }
 
-typedef map<string, vector<IRStmt*>> BypassMap;
-
-bool GetBypassMap(IRProgram* program,
-                  BypassMap* m,
-                  ErrorCollector* collector) {
+// Groups the port, storage and bypass statements in a single pass. A
+// statement with an empty name is not grouped; the first of each kind is
+// returned in |empty_*| so that the caller can report it at the point where
+// that kind's objects would be created.
+void GetNameMaps(IRProgram* program,
+                 PortMap* ports,
+                 StorageMap* storage,
+                 BypassMap* bypasses,
+                 const IRStmt** empty_port,
+                 const IRStmt** empty_storage,
+                 const IRStmt** empty_bypass) {
+    *empty_port = *empty_storage = *empty_bypass = nullptr;
     for (auto& bb : program->bbs) {
-        for (auto& stmt : bb->stmts) {
-            switch (stmt->type) {
-                case IRStmtBypassStart:
-                case IRStmtBypassEnd:
-                case IRStmtBypassPresent:
-                case IRStmtBypassReady:
-                case IRStmtBypassRead:
-                case IRStmtBypassWrite:
-                    if (stmt->port_name == "") {
-                        collector->ReportError(stmt->location, ErrorCollector::ERROR,
-                                "Empty bypass-network name");
-                        return false;
-                    }
-                    (*m)[stmt->port_name].push_back(stmt.get());
-                    break;
-                default:
-                    break;
+        for (auto* stmt : bb->stmts) {
+            NameGroups* groups = nullptr;
+            const IRStmt** empty = nullptr;
+            if (IRReadsPort(stmt->type) || IRWritesPort(stmt->type) ||
+                stmt->type == IRStmtPortExport ||
+                stmt->type == IRStmtPortLatency) {
+                groups = ports;
+                empty = empty_port;
+            } else if (IRReadsStorage(stmt->type) ||
+                       IRWritesStorage(stmt->type) ||
+                       stmt->type == IRStmtArraySize ||
+                       stmt->type == IRStmtArrayBanks ||
+                       stmt->type == IRStmtArrayLatency) {
+                groups = storage;
+                empty = empty_storage;
+            } else if (IsBypassStmt(stmt)) {
+                groups = bypasses;
+                empty = empty_bypass;
+            } else {
+                continue;
+            }
+            if (stmt->port_name.empty()) {
+                if (!*empty) *empty = stmt;
+                continue;
             }
+            groups->Add(stmt->port_name, stmt);
         }
     }
-    return true;
 }
 
 bool LinkStmts(IRProgram* program,
@@ -148,18 +308,24 @@ bool LinkStmts(IRProgram* program,
                ValnumMap& valnums,
                ErrorCollector* collector) {
     for (auto& bb : program->bbs) {
-        for (auto& stmt : bb->stmts) {
-            for (auto& targ : stmt->target_names) {
-                if (targets.find(targ) == targets.end()) {
+        for (auto* stmt : bb->stmts) {
+            if (stmt->id >= static_cast<int>(program->parse_refs.size())) {
+                continue;
+            }
+            const IRStmtParseRefs& refs = program->parse_refs[stmt->id];
+            for (auto& targ : refs.target_names) {
+                if (targ.id() >= static_cast<int>(targets.size()) ||
+                    !targets[targ.id()]) {
                     collector->ReportError(stmt->location, ErrorCollector::ERROR,
                             string("Unknown target label '") + targ + string("'"));
                     return false;
                 }
-                stmt->targets.push_back(targets[targ]);
+                stmt->targets.push_back(targets[targ.id()]);
             }
 
-            for (auto valnum : stmt->arg_nums) {
-                if (valnums.find(valnum) == valnums.end()) {
+            for (auto valnum : refs.arg_nums) {
+                if (valnum < 0 || valnum >= static_cast<int>(valnums.size()) ||
+                    !valnums[valnum]) {
                     collector->ReportError(stmt->location, ErrorCollector::ERROR,
                             "Unknown argument value number");
                     return false;
@@ -172,11 +338,11 @@ bool LinkStmts(IRProgram* program,
 }
 
 bool CreatePorts(IRProgram* program,
-                 const PortMap& m,
+                 PortMap& m,
                  ErrorCollector* collector) {
-    for (auto& pair : m) {
-        auto portname = pair.first;
-        auto stmts = pair.second;
+    for (auto& pair : m.Sorted()) {
+        const string& portname = pair.first;
+        const auto& stmts = pair.second;
         unique_ptr<IRPort> port(new IRPort());
         port->name = portname;
         for (auto* stmt : stmts) {
@@ -202,6 +368,22 @@ bool CreatePorts(IRProgram* program,
             } else if (stmt->type == IRStmtPortExport) {
                 port->exported = true;
                 port->exports.push_back(stmt);
+            } else if (stmt->type == IRStmtPortLatency) {
+                if (port->latency != 0 && port->latency != stmt->constant) {
+                    collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                            strprintf(
+                                "Conflicting latencies declared for port '%s'",
+                                portname.c_str()));
+                    return false;
+                }
+                if (stmt->constant < 0 || stmt->constant > kMaxPortLatency) {
+                    collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                            strprintf(
+                                "Latency for port '%s' must be between 0 and %d",
+                                portname.c_str(), kMaxPortLatency));
+                    return false;
+                }
+                port->latency = static_cast<int>(stmt->constant);
             }
         }
         program->ports.push_back(move(port));
@@ -210,11 +392,11 @@ bool CreatePorts(IRProgram* program,
 }
 
 bool CreateStorage(IRProgram* program,
-                   const StorageMap& m,
+                   StorageMap& m,
                    ErrorCollector* collector) {
-    for (auto& pair : m) {
-        auto storagename = pair.first;
-        auto stmts = pair.second;
+    for (auto& pair : m.Sorted()) {
+        const string& storagename = pair.first;
+        const auto& stmts = pair.second;
         unique_ptr<IRStorage> storage(new IRStorage());
         storage->name = storagename;
         for (auto* stmt : stmts) {
@@ -228,6 +410,43 @@ bool CreateStorage(IRProgram* program,
             if (stmt->type == IRStmtArraySize) {
                 storage->elements = static_cast<int>(stmt->constant);
             }
+            if (stmt->type == IRStmtArrayBanks) {
+                if (storage->declared_banks != 0 &&
+                    storage->declared_banks != stmt->constant) {
+                    collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                            strprintf(
+                                "Conflicting bank counts declared for array '%s'",
+                                storagename.c_str()));
+                    return false;
+                }
+                if (stmt->constant < 1 || stmt->constant > (1 << 16) ||
+                    (stmt->constant & (stmt->constant - 1)) != 0) {
+                    collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                            strprintf(
+                                "Bank count for array '%s' must be a power of two",
+                                storagename.c_str()));
+                    return false;
+                }
+                storage->declared_banks = static_cast<int>(stmt->constant);
+            }
+            if (stmt->type == IRStmtArrayLatency) {
+                if (storage->read_latency != 0 &&
+                    storage->read_latency != stmt->constant) {
+                    collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                            strprintf(
+                                "Conflicting read latencies declared for array '%s'",
+                                storagename.c_str()));
+                    return false;
+                }
+                if (stmt->constant < 0 || stmt->constant > kMaxReadLatency) {
+                    collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                            strprintf(
+                                "Read latency for array '%s' must be between 0 and %d",
+                                storagename.c_str(), kMaxReadLatency));
+                    return false;
+                }
+                storage->read_latency = static_cast<int>(stmt->constant);
+            }
         }
         program->storage.push_back(move(storage));
     }
@@ -235,11 +454,11 @@ bool CreateStorage(IRProgram* program,
 }
 
 bool CreateBypass(IRProgram* program,
-                  const BypassMap& m,
+                  BypassMap& m,
                   ErrorCollector* collector) {
-    for (auto& pair : m ) {
-        auto bypassname = pair.first;
-        auto stmts = pair.second;
+    for (auto& pair : m.Sorted()) {
+        const string& bypassname = pair.first;
+        const auto& stmts = pair.second;
         unique_ptr<IRBypass> bypass(new IRBypass());
         bypass->name = bypassname;
         for (auto* stmt : stmts) {
@@ -285,6 +504,29 @@ bool CreateBypass(IRProgram* program,
     return true;
 }
 
+// Links the lanes' copies of each bypass network (see IRBypass::lanes).
+void LinkLaneBypasses(IRProgram* program) {
+    map<string, IRBypass*> by_name;
+    for (auto& bypass : program->bypasses) {
+        by_name[bypass->name] = bypass.get();
+    }
+    for (auto& bypass : program->bypasses) {
+        const IRStmt* start = bypass->start;
+        if (!start || start->bb->lanes == 1 || start->bb->lane != 0) continue;
+        vector<IRBypass*> lanes;
+        for (int lane = 0; lane < start->bb->lanes; lane++) {
+            auto it = by_name.find(LaneName(bypass->name, lane));
+            if (it == by_name.end()) break;
+            lanes.push_back(it->second);
+        }
+        if (lanes.size() != static_cast<size_t>(start->bb->lanes)) continue;
+        for (unsigned lane = 0; lane < lanes.size(); lane++) {
+            lanes[lane]->lanes = lanes;
+            lanes[lane]->lane = lane;
+        }
+    }
+}
+
 }  // anonymous namespace
 
 bool IRProgram::Crosslink(ErrorCollector* collector) {
@@ -297,18 +539,39 @@ bool IRProgram::Crosslink(ErrorCollector* collector) {
         if (!LinkStmts(this, bbmap, valnummap, collector)) return false;
         crosslinked_args_bbs = true;
     }
+    // Symbolic references are no longer needed once resolved.
+    vector<IRStmtParseRefs>().swap(parse_refs);
+
+    if (!ExpandLanes(this, collector)) return false;
 
     PortMap portmap;
-    if (!GetPortMap(this, &portmap, collector)) return false;
+    StorageMap storagemap;
+    BypassMap bypassmap;
+    const IRStmt *empty_port, *empty_storage, *empty_bypass;
+    GetNameMaps(this, &portmap, &storagemap, &bypassmap,
+                &empty_port, &empty_storage, &empty_bypass);
+
+    if (empty_port) {
+        collector->ReportError(empty_port->location, ErrorCollector::ERROR,
+                "Empty port name");
+        return false;
+    }
     if (!CreatePorts(this, portmap, collector)) return false;
 
-    StorageMap storagemap;
-    if (!GetStorageMap(this, &storagemap, collector)) return false;
+    if (empty_storage) {
+        collector->ReportError(empty_storage->location, ErrorCollector::ERROR,
+                "Empty storage name");
+        return false;
+    }
     if (!CreateStorage(this, storagemap, collector)) return false;
 
-    BypassMap bypassmap;
-    if (!GetBypassMap(this, &bypassmap, collector)) return false;
+    if (empty_bypass) {
+        collector->ReportError(empty_bypass->location, ErrorCollector::ERROR,
+                "Empty bypass-network name");
+        return false;
+    }
     if (!CreateBypass(this, bypassmap, collector)) return false;
+    LinkLaneBypasses(this);
 
     return true;
 }
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend/ir.h"
+#include "backend/cfg-analysis.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace autopiper;
+using namespace std;
+
+namespace {
+
+bool IsCommutative(IRStmtOp op) {
+    switch (op) {
+        case IRStmtOpAdd:
+        case IRStmtOpMul:
+        case IRStmtOpAnd:
+        case IRStmtOpOr:
+        case IRStmtOpXor:
+        case IRStmtOpCmpEQ:
+        case IRStmtOpCmpNE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Dominator-scoped value numbering. A pure expression is redundant if an
+// expression with the same op, width and operand values is available in a
+// dominating position (earlier in the same BB or in a dominating BB).
+class ValueNumbering {
+ public:
+  ValueNumbering(IRProgram* program) : program_(program) {}
+
+  // Returns the number of statements removed.
+  int Run() {
+      const BBDomTree& domtree =
+          program_->Analyses().DomTree(program_->Roots());
+
+      // Build domtree children lists; roots are the BBs reachable from a
+      // program root that have no immediate dominator. Unreachable BBs are
+      // not in the domtree and are left untouched.
+      map<const IRBB*, vector<IRBB*>> children;
+      vector<IRBB*> roots;
+      for (auto& bb : program_->bbs) {
+          if (!domtree.Dom(bb.get(), bb.get())) continue;
+          const IRBB* parent = domtree.IDomParent(bb.get());
+          if (parent) {
+              children[parent].push_back(bb.get());
+          } else {
+              roots.push_back(bb.get());
+          }
+      }
+
+      // Walk the domtree in preorder, entering each subtree with the table as
+      // it stood at its root and unwinding it afterward.
+      struct WorkItem {
+          IRBB* bb;
+          size_t undo_mark;
+          bool entered;
+      };
+      vector<WorkItem> work;
+      for (auto i = roots.rbegin(); i != roots.rend(); ++i) {
+          work.push_back({ *i, 0, false });
+      }
+      while (!work.empty()) {
+          WorkItem& item = work.back();
+          if (item.entered) {
+              while (undo_.size() > item.undo_mark) {
+                  table_.erase(undo_.back());
+                  undo_.pop_back();
+              }
+              work.pop_back();
+              continue;
+          }
+          item.entered = true;
+          item.undo_mark = undo_.size();
+          IRBB* bb = item.bb;
+          NumberBB(bb);
+          const auto& kids = children[bb];
+          for (auto i = kids.rbegin(); i != kids.rend(); ++i) {
+              work.push_back({ *i, 0, false });
+          }
+      }
+
+      // Rewrite all remaining uses, including phi inputs along backedges,
+      // which may be visited before the values they refer to.
+      for (auto& bb : program_->bbs) {
+          for (auto* stmt : bb->stmts) {
+              for (auto*& arg : stmt->args) {
+                  arg = Leader(arg);
+              }
+          }
+      }
+
+      return static_cast<int>(replacements_.size());
+  }
+
+ private:
+  typedef vector<long> Key;
+
+  IRProgram* program_;
+  // Available expressions, keyed by op, width and operand value numbers.
+  map<Key, IRStmt*> table_;
+  vector<map<Key, IRStmt*>::iterator> undo_;
+  // Redundant statement -> the available statement that replaces it.
+  map<IRStmt*, IRStmt*> replacements_;
+  // Constants are numbered by value so that distinct constant statements
+  // with the same value compare equal as operands. The statements themselves
+  // are kept, so that each use still gets its own constant in its own stage.
+  map<pair<int, bignum>, long> constant_numbers_;
+
+  IRStmt* Leader(IRStmt* stmt) const {
+      auto i = replacements_.find(stmt);
+      return (i != replacements_.end()) ? i->second : stmt;
+  }
+
+  // Value numbers are statement IDs, or negative numbers for constants.
+  long Number(IRStmt* stmt) {
+      if (stmt->type == IRStmtExpr && stmt->op == IRStmtOpConst) {
+          auto key = make_pair(stmt->width, stmt->constant);
+          auto i = constant_numbers_.find(key);
+          if (i == constant_numbers_.end()) {
+              long number = -1 - static_cast<long>(constant_numbers_.size());
+              i = constant_numbers_.insert(make_pair(key, number)).first;
+          }
+          return i->second;
+      }
+      return Leader(stmt)->id;
+  }
+
+  static bool IsCandidate(const IRStmt* stmt) {
+      // Timing-constrained expressions stay where the user put them.
+      return stmt->type == IRStmtExpr &&
+             stmt->op != IRStmtOpConst &&
+             stmt->op != IRStmtOpNone &&
+             stmt->width > 0 &&
+             stmt->timevar == NULL;
+  }
+
+  void NumberBB(IRBB* bb) {
+      vector<IRStmt*> kept;
+      kept.reserve(bb->stmts.size());
+      for (auto* stmt : bb->stmts) {
+          if (!IsCandidate(stmt)) {
+              kept.push_back(stmt);
+              continue;
+          }
+          for (auto*& arg : stmt->args) {
+              arg = Leader(arg);
+          }
+
+          Key key;
+          key.reserve(stmt->args.size() + 2);
+          key.push_back(stmt->op);
+          key.push_back(stmt->width);
+          for (auto* arg : stmt->args) {
+              key.push_back(Number(arg));
+          }
+          if (IsCommutative(stmt->op)) {
+              sort(key.begin() + 2, key.end());
+          }
+
+          auto i = table_.find(key);
+          if (i != table_.end()) {
+              replacements_[stmt] = i->second;
+          } else {
+              undo_.push_back(table_.insert(make_pair(key, stmt)).first);
+              kept.push_back(stmt);
+          }
+      }
+      bb->stmts.swap(kept);
+  }
+};
+
+}  // anonymous namespace
+
+int IRProgram::EliminateCommonSubexprs() {
+    ValueNumbering vn(this);
+    return vn.Run();
+}
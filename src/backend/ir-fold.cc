@@ -0,0 +1,397 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend/ir.h"
+#include "backend/cfg-analysis.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace autopiper;
+using namespace std;
+
+namespace {
+
+bool IsConst(const IRStmt* stmt) {
+    return stmt->type == IRStmtExpr && stmt->op == IRStmtOpConst;
+}
+
+bignum Mask(int width) {
+    return (bignum(1) << width) - 1;
+}
+
+// Folds expressions over constants at full width, turns branches on constant
+// conditions into jumps and removes the BBs this leaves unreachable, and
+// removes pure statements whose values are never used.
+class ConstantFolder {
+ public:
+  ConstantFolder(IRProgram* program) : program_(program) {}
+
+  void Run() {
+      bool changed = true;
+      while (changed) {
+          changed = false;
+          for (auto& bb : program_->bbs) {
+              for (auto* stmt : bb->stmts) {
+                  for (auto*& arg : stmt->args) {
+                      arg = Leader(arg);
+                  }
+                  if (stmt->type == IRStmtExpr && FoldExpr(stmt)) {
+                      changed = true;
+                  }
+              }
+          }
+      }
+      // Rewrite any remaining uses of replaced statements (e.g. phi inputs
+      // visited before the value's replacement was found).
+      for (auto& bb : program_->bbs) {
+          for (auto* stmt : bb->stmts) {
+              for (auto*& arg : stmt->args) {
+                  arg = Leader(arg);
+              }
+          }
+      }
+
+      PruneBranches();
+      RemoveDeadStmts();
+  }
+
+ private:
+  IRProgram* program_;
+  // Folded selects -> the arm they evaluate to. Selects are otherwise left in
+  // place so that the final use rewrite sees them.
+  map<IRStmt*, IRStmt*> replacements_;
+
+  IRStmt* Leader(IRStmt* stmt) const {
+      while (true) {
+          auto i = replacements_.find(stmt);
+          if (i == replacements_.end()) return stmt;
+          stmt = i->second;
+      }
+  }
+
+  static void MakeConst(IRStmt* stmt, bignum value) {
+      stmt->op = IRStmtOpConst;
+      stmt->args.clear();
+      stmt->constant = value & Mask(stmt->width);
+      stmt->has_constant = true;
+  }
+
+  // Returns true if |stmt| was folded.
+  bool FoldExpr(IRStmt* stmt) {
+      if (stmt->op == IRStmtOpConst || stmt->op == IRStmtOpNone ||
+          stmt->width <= 0 || replacements_.count(stmt)) {
+          return false;
+      }
+
+      if (stmt->op == IRStmtOpSelect) {
+          IRStmt* chosen = nullptr;
+          if (IsConst(stmt->args[0])) {
+              chosen = stmt->args[0]->constant != 0 ?
+                  stmt->args[1] : stmt->args[2];
+          } else if (stmt->args[1] == stmt->args[2]) {
+              chosen = stmt->args[1];
+          }
+          if (!chosen) return false;
+          if (IsConst(chosen)) {
+              MakeConst(stmt, chosen->constant);
+          } else {
+              replacements_[stmt] = chosen;
+          }
+          return true;
+      }
+
+      vector<bignum> args;
+      for (auto* arg : stmt->args) {
+          if (!IsConst(arg)) return false;
+          args.push_back(arg->constant);
+      }
+      bignum result;
+      if (!IRFoldExpr(stmt, args, &result)) return false;
+      MakeConst(stmt, result);
+      return true;
+  }
+
+  // Finds BBs reachable from the entry points, following spawns from
+  // reachable BBs only.
+  set<IRBB*> Reachable() const {
+      set<IRBB*> reachable;
+      vector<IRBB*> work(program_->entries.begin(), program_->entries.end());
+      for (auto* entry : program_->entries) {
+          work.insert(work.end(), entry->lane_entries.begin(),
+                      entry->lane_entries.end());
+      }
+      while (!work.empty()) {
+          IRBB* bb = work.back();
+          work.pop_back();
+          if (!reachable.insert(bb).second) continue;
+          for (auto* stmt : bb->stmts) {
+              if (stmt->type == IRStmtJmp || stmt->type == IRStmtIf ||
+                  stmt->type == IRStmtSpawn) {
+                  work.insert(work.end(),
+                              stmt->targets.begin(), stmt->targets.end());
+              }
+          }
+      }
+      return reachable;
+  }
+
+  // Turns ifs on constant conditions into jumps and removes BBs that are no
+  // longer reachable. Pruning is skipped entirely if it would remove the only
+  // writers of an exported port (changing the module's interface) or either
+  // end of a bypass network.
+  void PruneBranches() {
+      vector<pair<IRStmt*, IRStmt>> folded_ifs;
+      for (auto& bb : program_->bbs) {
+          for (auto* stmt : bb->stmts) {
+              if (stmt->type != IRStmtIf || !IsConst(stmt->args[0])) {
+                  continue;
+              }
+              folded_ifs.push_back(make_pair(stmt, *stmt));
+              IRBB* target = stmt->args[0]->constant != 0 ?
+                  stmt->targets[0] : stmt->targets[1];
+              stmt->type = IRStmtJmp;
+              stmt->args.clear();
+              stmt->targets = { target };
+          }
+      }
+      if (folded_ifs.empty()) return;
+
+      set<IRBB*> reachable = Reachable();
+      set<const IRStmt*> removed;
+      for (auto& bb : program_->bbs) {
+          if (reachable.count(bb.get())) continue;
+          for (auto* stmt : bb->stmts) {
+              removed.insert(stmt);
+          }
+      }
+
+      if (!CanRemove(removed)) {
+          for (auto& p : folded_ifs) {
+              *p.first = p.second;
+          }
+          return;
+      }
+
+      // Drop phi inputs along edges that no longer exist.
+      map<IRBB*, set<IRBB*>> preds;
+      for (auto* bb : reachable) {
+          for (auto* succ : bb->Succs()) {
+              preds[succ].insert(bb);
+          }
+      }
+      for (auto* bb : reachable) {
+          for (auto* stmt : bb->stmts) {
+              if (stmt->type != IRStmtPhi) continue;
+              vector<IRStmt*> args;
+              vector<IRBB*> targets;
+              for (unsigned i = 0; i < stmt->args.size(); i++) {
+                  if (preds[bb].count(stmt->targets[i])) {
+                      args.push_back(stmt->args[i]);
+                      targets.push_back(stmt->targets[i]);
+                  }
+              }
+              stmt->args.swap(args);
+              stmt->targets.swap(targets);
+          }
+      }
+
+      RemoveReferences(removed);
+      vector<unique_ptr<IRBB>> kept;
+      for (auto& bb : program_->bbs) {
+          if (reachable.count(bb.get())) {
+              kept.push_back(move(bb));
+          }
+      }
+      program_->bbs.swap(kept);
+      program_->Analyses().Invalidate();
+  }
+
+  bool CanRemove(const set<const IRStmt*>& removed) const {
+      for (auto& port : program_->ports) {
+          if (!port->exported || port->defs.empty()) continue;
+          bool all_removed = true;
+          for (auto* def : port->defs) {
+              if (!removed.count(def)) all_removed = false;
+          }
+          if (all_removed) return false;
+      }
+      for (auto& bypass : program_->bypasses) {
+          if (removed.count(bypass->start) || removed.count(bypass->end)) {
+              return false;
+          }
+      }
+      return true;
+  }
+
+  template<typename T>
+  static void Filter(vector<T*>* stmts, const set<const IRStmt*>& removed) {
+      stmts->erase(remove_if(stmts->begin(), stmts->end(),
+                             [&removed](const IRStmt* stmt) {
+                                 return removed.count(stmt) > 0;
+                             }),
+                   stmts->end());
+  }
+
+  // Removes |removed| from the side tables built by crosslinking.
+  void RemoveReferences(const set<const IRStmt*>& removed) {
+      if (removed.empty()) return;
+      for (auto& port : program_->ports) {
+          Filter(&port->defs, removed);
+          Filter(&port->uses, removed);
+          Filter(&port->exports, removed);
+      }
+      for (auto& storage : program_->storage) {
+          Filter(&storage->writers, removed);
+          Filter(&storage->readers, removed);
+      }
+      for (auto& bypass : program_->bypasses) {
+          Filter(&bypass->reads, removed);
+          Filter(&bypass->writes, removed);
+      }
+      for (auto& timevar : program_->timevars) {
+          Filter(&timevar->uses, removed);
+      }
+  }
+
+  // Removes pure statements with no uses, transitively. Statements tied to a
+  // timing variable are kept, since they anchor the user's constraints.
+  void RemoveDeadStmts() {
+      map<const IRStmt*, int> use_count;
+      for (auto& bb : program_->bbs) {
+          for (auto* stmt : bb->stmts) {
+              for (auto* arg : stmt->args) {
+                  use_count[arg]++;
+              }
+          }
+      }
+
+      auto is_dead = [&use_count](const IRStmt* stmt) {
+          return !IRHasSideEffects(stmt->type) &&
+                 stmt->timevar == NULL &&
+                 use_count[stmt] == 0;
+      };
+
+      set<const IRStmt*> dead;
+      vector<IRStmt*> work;
+      for (auto& bb : program_->bbs) {
+          for (auto* stmt : bb->stmts) {
+              if (is_dead(stmt)) work.push_back(stmt);
+          }
+      }
+      while (!work.empty()) {
+          IRStmt* stmt = work.back();
+          work.pop_back();
+          if (!dead.insert(stmt).second) continue;
+          for (auto* arg : stmt->args) {
+              if (--use_count[arg] == 0 && is_dead(arg)) {
+                  work.push_back(arg);
+              }
+          }
+      }
+
+      if (dead.empty()) return;
+      for (auto& bb : program_->bbs) {
+          Filter(&bb->stmts, dead);
+      }
+  }
+};
+
+}  // anonymous namespace
+
+namespace autopiper {
+
+bool IRFoldExpr(const IRStmt* stmt, const vector<bignum>& args,
+                bignum* value) {
+    auto arg = [&args](int i) -> const bignum& { return args[i]; };
+    bignum& result = *value;
+    switch (stmt->op) {
+        case IRStmtOpAdd:
+            result = 0;
+            for (auto& a : args) result += a;
+            break;
+        case IRStmtOpSub:
+            // Wrap at the statement's width, as the hardware does.
+            result = (arg(0) + (bignum(1) << stmt->width)) - arg(1);
+            break;
+        case IRStmtOpMul:
+            result = arg(0) * arg(1);
+            break;
+        case IRStmtOpDiv:
+        case IRStmtOpRem:
+            // Division by zero yields 0, as in the models and the Verilog.
+            if (arg(1) == 0) {
+                result = 0;
+            } else {
+                result = stmt->op == IRStmtOpDiv ?
+                    bignum(arg(0) / arg(1)) : bignum(arg(0) % arg(1));
+            }
+            break;
+        case IRStmtOpAnd:
+            result = Mask(stmt->width);
+            for (auto& a : args) result &= a;
+            break;
+        case IRStmtOpOr:
+            result = 0;
+            for (auto& a : args) result |= a;
+            break;
+        case IRStmtOpXor:
+            result = 0;
+            for (auto& a : args) result ^= a;
+            break;
+        case IRStmtOpNot:
+            result = arg(0) ^ Mask(stmt->width);
+            break;
+        case IRStmtOpLsh:
+        case IRStmtOpRsh:
+            if (arg(1) >= stmt->width) {
+                result = 0;
+            } else {
+                int shift = static_cast<int>(arg(1));
+                result = stmt->op == IRStmtOpLsh ?
+                    bignum(arg(0) << shift) : bignum(arg(0) >> shift);
+            }
+            break;
+        case IRStmtOpBitslice:
+            result = arg(0) >> static_cast<int>(arg(2));
+            break;
+        case IRStmtOpConcat:
+            result = 0;
+            for (unsigned i = 0; i < args.size(); i++) {
+                result = (result << stmt->args[i]->width) | args[i];
+            }
+            break;
+        case IRStmtOpCmpLT: result = arg(0) < arg(1) ? 1 : 0; break;
+        case IRStmtOpCmpLE: result = arg(0) <= arg(1) ? 1 : 0; break;
+        case IRStmtOpCmpEQ: result = arg(0) == arg(1) ? 1 : 0; break;
+        case IRStmtOpCmpNE: result = arg(0) != arg(1) ? 1 : 0; break;
+        case IRStmtOpCmpGT: result = arg(0) > arg(1) ? 1 : 0; break;
+        case IRStmtOpCmpGE: result = arg(0) >= arg(1) ? 1 : 0; break;
+        default:
+            return false;
+    }
+    result &= Mask(stmt->width);
+    return true;
+}
+
+}  // namespace autopiper
+
+void IRProgram::FoldConstants() {
+    ConstantFolder folder(this);
+    folder.Run();
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend/ir.h"
+#include "backend/ir-build.h"
+#include "backend/cfg-analysis.h"
+#include "common/util.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace autopiper;
+using namespace std;
+
+namespace {
+
+int BitLength(bignum value) {
+    int bits = 0;
+    while (value > 0) {
+        value >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+// Narrows arithmetic to the bits its operands can actually occupy.
+//
+// The analysis finds, for every value, how many low-order bits may be nonzero
+// (its "significant" width); all bits above are known zero. Adds, multiplies,
+// divides, remainders, comparisons and bitwise ops whose operands are known
+// to be narrower than their declared widths are then recomputed at the
+// narrow width, and their original statements become zero-extensions of the
+// narrow results. A narrowed operation whose operand is itself narrowed uses
+// the narrow value directly, so chains of such arithmetic carry only the
+// significant bits, and the extension is left only for users that need the
+// full width.
+class WidthNarrower {
+ public:
+  WidthNarrower(IRProgram* program)
+      : program_(program), builder_(nullptr) {}
+
+  int Run(std::ostream* report) {
+      ComputeSignificantBits();
+
+      const BBReversePostorder& rpo =
+          program_->Analyses().RPO(program_->Roots());
+      for (auto* const_bb : rpo.RPO()) {
+          IRBB* bb = const_cast<IRBB*>(const_bb);
+          bool changed = false;
+          IRBBBuilder builder(program_, bb);
+          builder_ = &builder;
+          for (auto* stmt : bb->stmts) {
+              if (stmt->type == IRStmtExpr && stmt->timevar == NULL &&
+                  Narrow(stmt)) {
+                  changed = true;
+              }
+              builder.Add(stmt);
+          }
+          builder_ = nullptr;
+          if (changed) {
+              builder.ReplaceBB();
+          }
+      }
+
+      if (report) {
+          WriteReport(report);
+      }
+      return static_cast<int>(narrowed_.size());
+  }
+
+ private:
+  struct Narrowing {
+      const IRStmt* stmt;
+      // "result" if the value itself was narrowed, or "operands" if only the
+      // operation's inputs were.
+      const char* what;
+      int old_width;
+      int new_width;
+  };
+
+  IRProgram* program_;
+  IRBBBuilder* builder_;
+  Location location_;
+  // Number of low-order bits of each value that may be nonzero.
+  map<const IRStmt*, int> sig_;
+  // Narrowed value -> a statement of fewer bits whose zero-extension equals
+  // it.
+  map<const IRStmt*, IRStmt*> narrow_;
+  vector<Narrowing> narrowed_;
+
+  int Sig(const IRStmt* stmt) const {
+      auto i = sig_.find(stmt);
+      if (i != sig_.end()) return i->second;
+      return stmt->width > 0 ? stmt->width : 0;
+  }
+
+  int ComputeSig(const IRStmt* stmt) const {
+      int width = stmt->width;
+      if (width <= 0) return 0;
+      const auto& args = stmt->args;
+      if (stmt->type == IRStmtPhi) {
+          int sig = 0;
+          for (auto* arg : args) sig = max(sig, Sig(arg));
+          return min(sig, width);
+      }
+      if (stmt->type != IRStmtExpr) return width;
+
+      auto is_const = [](const IRStmt* s) {
+          return s->type == IRStmtExpr && s->op == IRStmtOpConst;
+      };
+
+      int sig = width;
+      switch (stmt->op) {
+          case IRStmtOpConst:
+              sig = BitLength(stmt->constant);
+              break;
+          case IRStmtOpAdd: {
+              int most = 0;
+              for (auto* arg : args) most = max(most, Sig(arg));
+              sig = most + BitLength(args.size() - 1);
+              break;
+          }
+          case IRStmtOpMul:
+              sig = Sig(args[0]) + Sig(args[1]);
+              break;
+          case IRStmtOpDiv:
+              sig = Sig(args[0]);
+              break;
+          case IRStmtOpRem:
+              sig = min(Sig(args[0]), Sig(args[1]));
+              break;
+          case IRStmtOpAnd:
+              for (auto* arg : args) sig = min(sig, Sig(arg));
+              break;
+          case IRStmtOpOr:
+          case IRStmtOpXor:
+              sig = 0;
+              for (auto* arg : args) sig = max(sig, Sig(arg));
+              break;
+          case IRStmtOpSelect:
+              sig = max(Sig(args[1]), Sig(args[2]));
+              break;
+          case IRStmtOpLsh:
+              if (is_const(args[1]) && args[1]->constant < width) {
+                  sig = Sig(args[0]) + static_cast<int>(args[1]->constant);
+              }
+              break;
+          case IRStmtOpRsh:
+              sig = Sig(args[0]);
+              if (is_const(args[1])) {
+                  sig = args[1]->constant < sig ?
+                      sig - static_cast<int>(args[1]->constant) : 0;
+              }
+              break;
+          case IRStmtOpBitslice: {
+              int lo = static_cast<int>(args[2]->constant);
+              sig = max(0, Sig(args[0]) - lo);
+              break;
+          }
+          case IRStmtOpConcat: {
+              // The last arg is least significant.
+              int offset = 0;
+              sig = 0;
+              for (auto i = args.rbegin(); i != args.rend(); ++i) {
+                  int arg_sig = Sig(*i);
+                  if (arg_sig > 0) sig = offset + arg_sig;
+                  offset += (*i)->width;
+              }
+              break;
+          }
+          case IRStmtOpCmpLT:
+          case IRStmtOpCmpLE:
+          case IRStmtOpCmpEQ:
+          case IRStmtOpCmpNE:
+          case IRStmtOpCmpGT:
+          case IRStmtOpCmpGE:
+              sig = 1;
+              break;
+          default:
+              break;
+      }
+      return min(sig, width);
+  }
+
+  // Significant widths only grow from their optimistic starting point of
+  // zero, and are bounded by the declared widths, so this terminates; the
+  // iteration is needed only for values carried around loops by phis.
+  void ComputeSignificantBits() {
+      for (auto& bb : program_->bbs) {
+          for (auto* stmt : bb->stmts) {
+              if (stmt->type == IRStmtExpr || stmt->type == IRStmtPhi) {
+                  sig_[stmt] = 0;
+              }
+          }
+      }
+      bool changed = true;
+      while (changed) {
+          changed = false;
+          for (auto& bb : program_->bbs) {
+              for (auto* stmt : bb->stmts) {
+                  auto i = sig_.find(stmt);
+                  if (i == sig_.end()) continue;
+                  int sig = ComputeSig(stmt);
+                  if (sig > i->second) {
+                      i->second = sig;
+                      changed = true;
+                  }
+              }
+          }
+      }
+  }
+
+  IRStmt* Expr(IRStmtOp op, int width, vector<IRStmt*> args) {
+      IRStmt* stmt = builder_->AddExpr(op, width, args);
+      stmt->location = location_;
+      return stmt;
+  }
+
+  IRStmt* Const(int width, const bignum& value) {
+      IRStmt* stmt = builder_->AddConst(width, value);
+      stmt->location = location_;
+      return stmt;
+  }
+
+  // Returns |value| as a |width|-bit value. Requires that |value| has no
+  // significant bits at or above |width|.
+  IRStmt* Resize(IRStmt* value, int width) {
+      auto i = narrow_.find(value);
+      if (i != narrow_.end()) value = i->second;
+      if (value->width == width) return value;
+      if (value->type == IRStmtExpr && value->op == IRStmtOpConst) {
+          return Const(width, value->constant);
+      }
+      if (value->width > width) {
+          return Expr(IRStmtOpBitslice, width,
+                      { value, Const(32, width - 1), Const(32, 0) });
+      }
+      return Expr(IRStmtOpConcat, width,
+                  { Const(width - value->width, 0), value });
+  }
+
+  // Rewrites |stmt| in place to be the zero-extension of the narrow |value|.
+  void Extend(IRStmt* stmt, IRStmt* value) {
+      narrowed_.push_back({ stmt, "result", stmt->width, value->width });
+      narrow_[stmt] = value;
+      stmt->op = IRStmtOpConcat;
+      stmt->args = { Const(stmt->width - value->width, 0), value };
+  }
+
+  // Narrows |stmt| if its operands allow, adding the narrow computation to
+  // the current BB ahead of it. Returns true if |stmt| was rewritten.
+  bool Narrow(IRStmt* stmt) {
+      if (stmt->width <= 0 || stmt->args.empty()) return false;
+      location_ = stmt->location;
+      const auto& args = stmt->args;
+      int width = stmt->width;
+      int sig = max(1, Sig(stmt));
+
+      switch (stmt->op) {
+          case IRStmtOpAdd:
+          case IRStmtOpAnd:
+          case IRStmtOpOr:
+          case IRStmtOpXor: {
+              if (sig >= width) return false;
+              vector<IRStmt*> narrow_args;
+              for (auto* arg : args) {
+                  narrow_args.push_back(Resize(arg, sig));
+              }
+              Extend(stmt, Expr(stmt->op, sig, narrow_args));
+              return true;
+          }
+          case IRStmtOpSelect: {
+              if (sig >= width) return false;
+              Extend(stmt, Expr(IRStmtOpSelect, sig,
+                                { args[0], Resize(args[1], sig),
+                                  Resize(args[2], sig) }));
+              return true;
+          }
+          case IRStmtOpMul: {
+              int a = max(1, Sig(args[0]));
+              int b = max(1, Sig(args[1]));
+              if (a >= args[0]->width && b >= args[1]->width) return false;
+              // The product is always narrower than the full-width one.
+              Extend(stmt, Expr(IRStmtOpMul, a + b,
+                                { Resize(args[0], a), Resize(args[1], b) }));
+              return true;
+          }
+          case IRStmtOpDiv:
+          case IRStmtOpRem: {
+              // The result width is the dividend's width less the divisor's,
+              // so the dividend keeps enough bits above the divisor's for the
+              // full quotient (or remainder).
+              int b = max(1, Sig(args[1]));
+              int a = (stmt->op == IRStmtOpDiv) ?
+                  max(1, Sig(args[0])) + b :
+                  max(Sig(args[0]), b + min(Sig(args[0]), b));
+              a = max(a, b + 1);
+              if (a > args[0]->width) return false;
+              if (a == args[0]->width && b == args[1]->width) return false;
+              IRStmt* result = Expr(stmt->op, a - b,
+                                    { Resize(args[0], a),
+                                      Resize(args[1], b) });
+              if (result->width < width) {
+                  Extend(stmt, result);
+                  return true;
+              }
+              narrowed_.push_back({ stmt, "operands", args[0]->width, a });
+              if (result->width == width) {
+                  stmt->op = IRStmtOpConcat;
+                  stmt->args = { result };
+              } else {
+                  stmt->op = IRStmtOpBitslice;
+                  stmt->args = { result, Const(32, width - 1), Const(32, 0) };
+              }
+              return true;
+          }
+          case IRStmtOpCmpLT:
+          case IRStmtOpCmpLE:
+          case IRStmtOpCmpEQ:
+          case IRStmtOpCmpNE:
+          case IRStmtOpCmpGT:
+          case IRStmtOpCmpGE: {
+              int operand = max(1, max(Sig(args[0]), Sig(args[1])));
+              int old_width = args[0]->width;
+              if (operand >= old_width) return false;
+              stmt->args = { Resize(args[0], operand),
+                             Resize(args[1], operand) };
+              narrowed_.push_back({ stmt, "operands", old_width, operand });
+              return true;
+          }
+          default:
+              return false;
+      }
+  }
+
+  void WriteReport(std::ostream* out) const {
+      long bits = 0;
+      for (auto& n : narrowed_) {
+          const IRStmt* stmt = n.stmt;
+          std::string where = stmt->location.line > 0 ?
+              stmt->location.ToString() : "(generated)";
+          *out << strprintf("%%%-6d %-8s %4d -> %-4d %s\n",
+                            stmt->valnum, n.what, n.old_width, n.new_width,
+                            where.c_str());
+          bits += n.old_width - n.new_width;
+      }
+      *out << strprintf("%d values narrowed, %ld bits removed\n",
+                        static_cast<int>(narrowed_.size()), bits);
+  }
+};
+
+}  // anonymous namespace
+
+int IRProgram::NarrowWidths(std::ostream* report) {
+    WidthNarrower narrower(this);
+    return narrower.Run(report);
+}
@@ -18,11 +18,13 @@
 #include "backend/compiler.h"
 
 #include "common/parser-utils.h"
+#include "common/util.h"
 
 #include <map>
 #include <iostream>
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
 
 using namespace std;
 using namespace autopiper;
@@ -39,7 +41,9 @@ class Parser : public ParserBase {
     protected:
         bool ParseBB(IRProgram* program);
         bool ParseBBLabel(IRProgram* program, string* label,
-                          bool* is_entry, Location* loc);
+                          bool* is_entry, int* lanes, bool* pipelined,
+                          Location* loc);
+        bool ParsePragma(IRProgram* program);
 
         bool ParseIRStmt(IRProgram* program, IRBB* bb);
         bool ParseIRStmtTimingAnchor(IRProgram* program, IRStmt* stmt);
@@ -58,29 +62,74 @@ bool Parser::ParseProgram(IRProgram* program) {
 bool Parser::ParseBB(IRProgram* program) {
     string label;
     bool is_entry = false;
+    int lanes = 1;
+    bool pipelined = false;
     unique_ptr<IRBB> bb(new IRBB);
-    if (!ParseBBLabel(program, &label, &is_entry, &bb->location)) return false;
+    if (!ParseBBLabel(program, &label, &is_entry, &lanes, &pipelined,
+                      &bb->location)) {
+        return false;
+    }
 
     bb->label = label;
     bb->is_entry = is_entry;
+    bb->lanes = lanes;
+    bb->pipelined = pipelined;
     while (ParseIRStmt(program, bb.get())) /* nothing */ ;
 
     bb_map_[label] = bb.get();
     if (bb->is_entry) {
         program->entries.push_back(bb.get());
     }
-    program->bbs.push_back(move(bb));
+    program->AddBB(move(bb));
     return true;
 }
 bool Parser::ParseBBLabel(IRProgram* program, string* label,
-        bool* is_entry, Location* loc) {
+        bool* is_entry, int* lanes, bool* pipelined, Location* loc) {
     while (TryConsume(Token::NEWLINE)) /* nothing */ ;
     *loc = CurLocation();
     if (!TryExpect(Token::IDENT)) return false;
+    // 'pragma key = "value"' lines, which may come between BBs, set the
+    // program's settings, unless the label itself is 'pragma'.
+    while (CurToken().s == "pragma") {
+        Consume();
+        if (!TryExpect(Token::IDENT)) {
+            *label = "pragma";
+            return Consume(Token::COLON) && Consume(Token::NEWLINE);
+        }
+        if (!ParsePragma(program)) return false;
+        while (TryConsume(Token::NEWLINE)) /* nothing */ ;
+        *loc = CurLocation();
+        if (!TryExpect(Token::IDENT)) return false;
+    }
     if (CurToken().s == "entry") {
         *is_entry = true;
         Consume();
         if (!Expect(Token::IDENT)) return false;
+        // 'entry lanes N label:', unless the label itself is 'lanes'. The
+        // count is range-checked by the crosslinker.
+        if (CurToken().s == "lanes") {
+            Consume();
+            if (TryExpect(Token::INT_LITERAL)) {
+                const bignum& count = CurToken().int_literal;
+                *lanes = count > INT_MAX ? INT_MAX : count.convert_to<int>();
+                Consume();
+                if (!Expect(Token::IDENT)) return false;
+            } else {
+                *label = "lanes";
+                return Consume(Token::COLON) && Consume(Token::NEWLINE);
+            }
+        }
+    }
+    // 'pipeline label:' marks a pipelined loop header, unless the label
+    // itself is 'pipeline'.
+    if (CurToken().s == "pipeline") {
+        Consume();
+        if (TryExpect(Token::IDENT)) {
+            *pipelined = true;
+        } else {
+            *label = "pipeline";
+            return Consume(Token::COLON) && Consume(Token::NEWLINE);
+        }
     }
     *label = CurToken().s;
     Consume();
@@ -89,6 +138,22 @@ bool Parser::ParseBBLabel(IRProgram* program, string* label,
     return true;
 }
 
+bool Parser::ParsePragma(IRProgram* program) {
+    string key = CurToken().s;
+    Consume();
+    if (!Consume(Token::EQUALS)) return false;
+    if (!Expect(Token::QUOTED_STRING)) return false;
+    string value = CurToken().s;
+    Consume();
+    if (!Consume(Token::NEWLINE)) return false;
+    string error;
+    if (!program->SetPragma(key, value, &error)) {
+        Error(error);
+        return false;
+    }
+    return true;
+}
+
 enum StmtArg {
     StmtArgConst,
     StmtArgValnum,
@@ -146,11 +211,15 @@ bool IdentToStatementType(string ident,
     S("chanread", IRStmtChanRead, StmtArgPortname);
     S("chanwrite", IRStmtChanWrite, StmtArgPortname, StmtArgValnum);
     S("portexport", IRStmtPortExport, StmtArgPortname);
+    S("portlatency", IRStmtPortLatency, StmtArgPortname, StmtArgConst);
 
     S("regread", IRStmtRegRead, StmtArgPortname);
     S("regwrite", IRStmtRegWrite, StmtArgPortname, StmtArgValnum);
     S("arrayread", IRStmtArrayRead,  StmtArgPortname, StmtArgValnum);
     S("arraywrite", IRStmtArrayWrite,  StmtArgPortname, StmtArgValnum, StmtArgValnum);
+    S("arraysize", IRStmtArraySize,  StmtArgPortname, StmtArgConst);
+    S("arraybanks", IRStmtArrayBanks,  StmtArgPortname, StmtArgConst);
+    S("arraylatency", IRStmtArrayLatency,  StmtArgPortname, StmtArgConst);
 
     S("bypassstart", IRStmtBypassStart, StmtArgPortname, StmtArgValnum);
     S("bypassend", IRStmtBypassEnd, StmtArgPortname);
@@ -164,15 +233,90 @@ bool IdentToStatementType(string ident,
     S("killyounger", IRStmtKillYounger, StmtArgNone);
     S("done", IRStmtDone, StmtArgNone);
     S("killif", IRStmtKillIf, StmtArgValnum);
+    S("lane", IRStmtLane, StmtArgNone);
 
     S("timing_barrier", IRStmtTimingBarrier, StmtArgNone);
 
+    // Only in the lowered pipeline form (see Pipe::Print()), which parses
+    // but does not typecheck.
+    S("backedge", IRStmtBackedge, StmtArgBBname);
+    S("restart_value", IRStmtRestartValue, StmtArgNone);
+    S("restart_value_src", IRStmtRestartValueSrc, StmtArgValnums);
+    S("skid_full", IRStmtSkidFull, StmtArgConst);
+
     return false;
 
 #undef S
 #undef SO
 }
 
+}  // anonymous namespace
+
+// Checks |this| against the form its keyword takes in text IR, using the
+// table above, so that readers other than the parser (the binary IR loader)
+// accept exactly the statements that the parser could have produced.
+bool IRStmt::CheckArity(string* error) const {
+    IRStmtType keyword_type;
+    IRStmtOp keyword_op;
+    vector<StmtArg> keyword_args;
+    if ((type != IRStmtExpr && op != IRStmtOpNone) ||
+        !IdentToStatementType(Keyword(), &keyword_type, &keyword_op,
+                              &keyword_args) ||
+        keyword_type != type) {
+        *error = strprintf("Statement %%%d has invalid type %d and op %d",
+                           valnum, type, op);
+        return false;
+    }
+
+    // Fixed counts, or -1 where a list takes any number.
+    int nargs = 0, ntargets = 0;
+    for (auto arg : keyword_args) {
+        switch (arg) {
+            case StmtArgConst:
+                if (!has_constant) {
+                    *error = strprintf("Statement %%%d ('%s') has no constant",
+                                       valnum, Keyword());
+                    return false;
+                }
+                break;
+            case StmtArgValnum:
+                if (nargs >= 0) nargs++;
+                break;
+            case StmtArgValnums:
+                nargs = -1;
+                break;
+            case StmtArgBBname:
+                if (ntargets >= 0) ntargets++;
+                break;
+            case StmtArgBBnameValnumPairs:
+                if (args.size() != targets.size()) {
+                    *error = strprintf("Statement %%%d ('%s') has %d args "
+                                       "but %d targets", valnum, Keyword(),
+                                       (int)args.size(), (int)targets.size());
+                    return false;
+                }
+                nargs = ntargets = -1;
+                break;
+            case StmtArgPortname:
+            case StmtArgNone:
+                break;
+        }
+    }
+    if (nargs >= 0 && args.size() != nargs) {
+        *error = strprintf("Statement %%%d ('%s') has %d args; expected %d",
+                           valnum, Keyword(), (int)args.size(), nargs);
+        return false;
+    }
+    if (ntargets >= 0 && targets.size() != ntargets) {
+        *error = strprintf("Statement %%%d ('%s') has %d targets; expected %d",
+                           valnum, Keyword(), (int)targets.size(), ntargets);
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
 bool Parser::ParseIRStmt(IRProgram* program, IRBB* bb) {
     while (TryConsume(Token::NEWLINE)) /* nothing */ ;
     if (!TryExpect(Token::PERCENT)) return false;
@@ -211,7 +355,8 @@ bool Parser::ParseIRStmt(IRProgram* program, IRBB* bb) {
     Location loc = CurLocation();
     if (!Consume(Token::IDENT)) return false;
 
-    unique_ptr<IRStmt> stmt(new IRStmt);
+    IRStmt* stmt = program->NewStmt();
+    IRStmtParseRefs& refs = program->ParseRefs(stmt);
     stmt->valnum = value_number;
     if (value_number >= program->next_valnum) {
         program->next_valnum = value_number + 1;
@@ -240,7 +385,7 @@ bool Parser::ParseIRStmt(IRProgram* program, IRBB* bb) {
             case StmtArgValnum:
                 if (!Consume(Token::PERCENT)) return false;
                 if (!Expect(Token::INT_LITERAL)) return false;
-                stmt->arg_nums.push_back(static_cast<int>(CurToken().int_literal));
+                refs.arg_nums.push_back(static_cast<int>(CurToken().int_literal));
                 Consume();
                 break;
 
@@ -248,7 +393,7 @@ bool Parser::ParseIRStmt(IRProgram* program, IRBB* bb) {
                 while (true) {
                     if (!TryConsume(Token::PERCENT)) break;
                     if (!Expect(Token::INT_LITERAL)) return false;
-                    stmt->arg_nums.push_back(static_cast<int>(CurToken().int_literal));
+                    refs.arg_nums.push_back(static_cast<int>(CurToken().int_literal));
                     Consume();
                     if (!TryConsume(Token::COMMA)) break;
                 }
@@ -262,22 +407,22 @@ bool Parser::ParseIRStmt(IRProgram* program, IRBB* bb) {
 
             case StmtArgBBname:
                 if (!Expect(Token::IDENT)) return false;
-                stmt->target_names.push_back(CurToken().s);
+                refs.target_names.push_back(CurToken().s);
                 Consume();
                 break;
 
             case StmtArgBBnameValnumPairs:
                 while (true) {
                     if (!TryExpect(Token::IDENT)) break;
-                    string bbname = CurToken().s;
+                    Symbol bbname = CurToken().s;
                     Consume();
                     if (!Consume(Token::COMMA)) return false;
                     if (!Consume(Token::PERCENT)) return false;
                     if (!Expect(Token::INT_LITERAL)) return false;
                     int valnum = static_cast<int>(CurToken().int_literal);
                     Consume();
-                    stmt->target_names.push_back(bbname);
-                    stmt->arg_nums.push_back(valnum);
+                    refs.target_names.push_back(bbname);
+                    refs.arg_nums.push_back(valnum);
                     if (!TryConsume(Token::COMMA)) break;
                 }
                 break;
@@ -287,14 +432,24 @@ bool Parser::ParseIRStmt(IRProgram* program, IRBB* bb) {
         }
     }
 
+    // A port write may give the value the port takes in cycles without a
+    // write.
+    if (TryExpect(Token::IDENT) && CurToken().s == "default") {
+        Consume();
+        if (!Expect(Token::INT_LITERAL)) return false;
+        stmt->port_default = CurToken().int_literal;
+        stmt->port_has_default = true;
+        Consume();
+    }
+
     if (TryExpect(Token::AT)) {
-        if (!ParseIRStmtTimingAnchor(program, stmt.get())) return false;
+        if (!ParseIRStmtTimingAnchor(program, stmt)) return false;
     }
 
     if (!Consume(Token::NEWLINE)) return false;
 
-    ir_map_[value_number] = stmt.get();
-    bb->stmts.push_back(move(stmt));
+    ir_map_[value_number] = stmt;
+    bb->stmts.push_back(stmt);
     return true;
 }
 
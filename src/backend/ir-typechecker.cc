@@ -17,7 +17,7 @@
 #include "backend/ir.h"
 #include "backend/compiler.h"
 #include "common/util.h"
-#include "backend/domtree.h"
+#include "backend/cfg-analysis.h"
 
 #include <map>
 #include <vector>
@@ -209,6 +209,29 @@ bool DeriveStorageSize(IRStorage* storage, ErrorCollector* collector) {
         }
     }
 
+    // A declared bank count must split the array's index space.
+    if (storage->declared_banks > 1 &&
+        (storage->index_width == 0 ||
+         storage->declared_banks > (1LL << storage->index_width) ||
+         (storage->elements > 0 &&
+          storage->declared_banks > storage->elements))) {
+        collector->ReportError(storage->writers[0]->location,
+                ErrorCollector::ERROR,
+                strprintf("Storage '%s' cannot be split into %d banks: it "
+                          "has fewer elements than banks.",
+                          storage->name.c_str(), storage->declared_banks));
+        return false;
+    }
+
+    // Only an array's reads may be registered; a reg is read combinationally.
+    if (storage->read_latency > 0 && storage->index_width == 0) {
+        collector->ReportError(storage->writers[0]->location,
+                ErrorCollector::ERROR,
+                strprintf("Storage '%s' is a register and cannot have a read "
+                          "latency.", storage->name.c_str()));
+        return false;
+    }
+
     return true;
 }
 
@@ -456,6 +479,18 @@ bool CheckStmtWidth(IRStmt* stmt, ErrorCollector* collector) {
 }
 
 bool CheckStmt(IRStmt* stmt, ErrorCollector* collector) {
+    switch (stmt->type) {
+        case IRStmtBackedge:
+        case IRStmtRestartValue:
+        case IRStmtRestartValueSrc:
+        case IRStmtSkidFull:
+            collector->ReportError(stmt->location, ErrorCollector::ERROR,
+                    strprintf("'%s' appears only in the lowered pipeline form",
+                              stmt->Keyword()));
+            return false;
+        default:
+            break;
+    }
     // All statements must have width matches. The precise width match
     // requirements depend on the operation.
     if (!CheckStmtWidth(stmt, collector)) return false;
@@ -469,7 +504,7 @@ bool CheckBB(IRBB* bb, ErrorCollector* collector) {
                 "BB has no statements");
         return false;
     }
-    IRStmt* last = bb->stmts.back().get();
+    IRStmt* last = bb->stmts.back();
     if (last->type != IRStmtIf && last->type != IRStmtJmp &&
         last->type != IRStmtKill && last->type != IRStmtDone) {
         collector->ReportError(bb->location, ErrorCollector::ERROR,
@@ -505,16 +540,15 @@ string JoinSet(I begin, I end, function<string(T)> f, const char* joiner) {
 // that each phi node has an in-edge from every BB that precedes it.
 // Also validates that every value use is dominated by its def.
 bool CheckPhis(IRProgram* program, ErrorCollector* collector) {
-    // Find all predecessors for each BB.
-    map<IRBB*, set<IRBB*>> preds;
+    // Find all predecessors for each BB, reachable or not, indexed by BB ID.
+    vector<set<IRBB*>> preds(program->NumBBIds());
     for (auto& bb : program->bbs) {
         for (auto* succ : bb->Succs()) {
-            preds[succ].insert(bb.get());
+            preds[succ->id].insert(bb.get());
         }
     }
-    // Compute the domtree.
-    BBDomTree domtree;
-    domtree.Compute(program->Roots());
+    // Compute the domtree (kept for later passes until the CFG changes).
+    const BBDomTree& domtree = program->Analyses().DomTree(program->Roots());
 
     // Check that each phi-node has the required inputs.
     for (auto& bb : program->bbs) {
@@ -522,8 +556,7 @@ bool CheckPhis(IRProgram* program, ErrorCollector* collector) {
             if (stmt->type != IRStmtPhi) continue;
             assert(stmt->targets.size() == stmt->args.size());
 
-            set<IRBB*> expected_inputs(preds[bb.get()].begin(),
-                                       preds[bb.get()].end());
+            const set<IRBB*>& expected_inputs = preds[bb->id];
             if (expected_inputs.size() != stmt->args.size()) {
                 collector->ReportError(
                     stmt->location,
@@ -633,7 +666,7 @@ bool IRProgram::Typecheck(ErrorCollector* collector) {
     for (auto& bb : bbs) {
         if (!CheckBB(bb.get(), collector)) return false;
         for (auto& stmt : bb->stmts) {
-            if (!CheckStmt(stmt.get(), collector)) return false;
+            if (!CheckStmt(stmt, collector)) return false;
         }
     }
     if (!CheckPhis(this, collector)) return false;
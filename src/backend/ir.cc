@@ -15,9 +15,12 @@
  */
 
 #include "backend/ir.h"
+#include "backend/cfg-analysis.h"
+#include "common/util.h"
 
 #include <set>
 #include <sstream>
+#include <stdlib.h>
 
 using namespace autopiper;
 using namespace std;
@@ -25,7 +28,7 @@ using namespace std;
 const IRStmt* IRBB::SuccStmt() const {
     for (auto& stmt : stmts) {
         if (stmt->type == IRStmtJmp || stmt->type == IRStmtIf)
-            return stmt.get();
+            return stmt;
     }
     return NULL;
 }
@@ -53,6 +56,9 @@ vector<const IRBB*> IRProgram::Roots() const {
     // Include all top-level entry points.
     for (auto* entry : entries) {
         ret.push_back(entry);
+        for (auto* lane_entry : entry->lane_entries) {
+            ret.push_back(lane_entry);
+        }
     }
     // Find spawn-points.
     set<const IRBB*> already_found;
@@ -70,7 +76,108 @@ vector<const IRBB*> IRProgram::Roots() const {
     return ret;
 }
 
+bool IRProgram::ParseStageList(const string& text, vector<int>* stages) {
+    stages->clear();
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == string::npos) end = text.size();
+        string item = text.substr(pos, end - pos);
+        size_t first = item.find_first_not_of(' ');
+        size_t last = item.find_last_not_of(' ');
+        if (first == string::npos) return false;
+        item = item.substr(first, last - first + 1);
+        if (item.find_first_not_of("0123456789") != string::npos) {
+            return false;
+        }
+        stages->push_back(atoi(item.c_str()));
+        pos = end + 1;
+    }
+    return !stages->empty();
+}
+
+bool IRProgram::SetPragma(const string& key, const string& value,
+                          string* error) {
+    if (key == "timing_model") {
+        timing_model = value;
+    } else if (key == "minimize_registers") {
+        minimize_registers = (value == "true");
+    } else if (key == "balance_stages") {
+        balance_stages = (value == "true");
+    } else if (key == "max_stages") {
+        max_stages = atoi(value.c_str());
+        if (max_stages < 1) {
+            *error = "Max_stages pragma requires a positive stage count.";
+            return false;
+        }
+    } else if (key == "minimize_predicates") {
+        minimize_predicates = (value == "true");
+    } else if (key == "share_kill_if_slices") {
+        share_kill_if_slices = (value == "true");
+    } else if (key == "propagate_predicates") {
+        propagate_predicates = (value == "true");
+    } else if (key == "register_inputs") {
+        register_inputs = (value == "true");
+    } else if (key == "register_outputs") {
+        register_outputs = (value == "true");
+    } else if (key == "bank_arrays") {
+        bank_arrays = (value == "true");
+    } else if (key == "perf_counters") {
+        perf_counters = (value == "true");
+    } else if (key == "elastic") {
+        skid_depth = atoi(value.c_str());
+        if (skid_depth < 1) {
+            *error = "Elastic pragma requires a positive skid-buffer depth.";
+            return false;
+        }
+    } else if (key == "elastic_stages") {
+        if (!ParseStageList(value, &elastic_stages)) {
+            *error = "Elastic_stages pragma requires a comma-separated list "
+                     "of stage numbers.";
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<pair<string, string>> IRProgram::Pragmas() const {
+    vector<pair<string, string>> ret;
+    if (timing_model != "null") {
+        ret.push_back(make_pair("timing_model", timing_model));
+    }
+    const pair<const char*, bool> flags[] = {
+        { "minimize_registers", minimize_registers },
+        { "balance_stages", balance_stages },
+        { "minimize_predicates", minimize_predicates },
+        { "share_kill_if_slices", share_kill_if_slices },
+        { "propagate_predicates", propagate_predicates },
+        { "register_inputs", register_inputs },
+        { "register_outputs", register_outputs },
+        { "bank_arrays", bank_arrays },
+        { "perf_counters", perf_counters },
+    };
+    for (auto& flag : flags) {
+        if (flag.second) ret.push_back(make_pair(flag.first, "true"));
+    }
+    if (max_stages > 0) {
+        ret.push_back(make_pair("max_stages", strprintf("%d", max_stages)));
+    }
+    if (skid_depth > 0) {
+        ret.push_back(make_pair("elastic", strprintf("%d", skid_depth)));
+    }
+    if (!elastic_stages.empty()) {
+        string list;
+        for (int stage : elastic_stages) {
+            if (!list.empty()) list += ",";
+            list += strprintf("%d", stage);
+        }
+        ret.push_back(make_pair("elastic_stages", list));
+    }
+    return ret;
+}
+
 IRTimeVar* IRProgram::GetTimeVar() {
+    std::lock_guard<std::mutex> l(mutex);
     std::unique_ptr<IRTimeVar> new_var(new IRTimeVar());
     IRTimeVar* ret = new_var.get();
     ostringstream os;
@@ -81,161 +188,322 @@ IRTimeVar* IRProgram::GetTimeVar() {
     return ret;
 }
 
-string IRProgram::ToString() const {
-    string s;
+namespace {
+thread_local IRStmtArenaScope* current_stmt_scope = nullptr;
+
+// Gives |stmt|, just allocated in |arena|, the arena's next ID, reserving a
+// new block once the last is used up.
+IRStmt* NumberThreadStmt(IRProgram* program, IRStmtThreadArena* arena,
+                         IRStmt* stmt) {
+    if (arena->next_id == arena->end_id) {
+        arena->next_id = program->next_stmt_id.fetch_add(
+                IRProgram::kStmtIdBlock);
+        arena->end_id = arena->next_id + IRProgram::kStmtIdBlock;
+    }
+    stmt->id = arena->next_id++;
+    arena->size.store(arena->stmts.size(), std::memory_order_relaxed);
+    return stmt;
+}
+}  // anonymous namespace
+
+IRStmtArenaScope::IRStmtArenaScope(IRProgram* program)
+    : program_(program), saved_(current_stmt_scope) {
+    {
+        std::lock_guard<std::mutex> l(program->mutex);
+        if (program->free_thread_arenas.empty()) {
+            program->thread_arenas.emplace_back(new IRStmtThreadArena());
+            arena_ = program->thread_arenas.back().get();
+        } else {
+            arena_ = program->free_thread_arenas.back();
+            program->free_thread_arenas.pop_back();
+        }
+    }
+    IRStmtThreadArena* outer = Current(program);
+    if (outer) outer->next_id = outer->end_id;
+    current_stmt_scope = this;
+}
+
+IRStmtArenaScope::~IRStmtArenaScope() {
+    current_stmt_scope = saved_;
+    // The rest of the block goes unused: it was reserved before statements
+    // that other scopes have allocated since.
+    arena_->next_id = arena_->end_id;
+    std::lock_guard<std::mutex> l(program_->mutex);
+    program_->free_thread_arenas.push_back(arena_);
+}
+
+IRStmtThreadArena* IRStmtArenaScope::Current(const IRProgram* program) {
+    for (auto* scope = current_stmt_scope; scope; scope = scope->saved_) {
+        if (scope->program_ == program) return scope->arena_;
+    }
+    return nullptr;
+}
+
+IRStmt* IRProgram::NewStmt() {
+    IRStmtThreadArena* arena = IRStmtArenaScope::Current(this);
+    if (arena) {
+        return NumberThreadStmt(this, arena, arena->stmts.New());
+    }
+    std::lock_guard<std::mutex> l(mutex);
+    IRStmt* stmt = stmts.New();
+    stmt->id = next_stmt_id++;
+    return stmt;
+}
+
+IRStmt* IRProgram::NewStmt(const IRStmt& proto) {
+    IRStmtThreadArena* arena = IRStmtArenaScope::Current(this);
+    if (arena) {
+        return NumberThreadStmt(this, arena, arena->stmts.New(proto));
+    }
+    std::lock_guard<std::mutex> l(mutex);
+    IRStmt* stmt = stmts.New(proto);
+    stmt->id = next_stmt_id++;
+    return stmt;
+}
+
+int IRProgram::NumStmts() {
+    std::lock_guard<std::mutex> l(mutex);
+    int count = stmts.size();
+    for (auto& arena : thread_arenas) {
+        count += arena->size.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+IRProgram::IRProgram() {
+    next_valnum = 1;
+    next_stmt_id = 0;
+    next_anon_timevar = 1;
+    crosslinked_args_bbs = false;
+    timing_model = "null";
+    minimize_registers = false;
+    balance_stages = false;
+    max_stages = 0;
+    minimize_predicates = false;
+    share_kill_if_slices = false;
+    propagate_predicates = false;
+    register_inputs = false;
+    register_outputs = false;
+    bank_arrays = false;
+    skid_depth = 0;
+    perf_counters = false;
+    profile = false;
+    next_bb_id = 0;
+}
+
+IRProgram::~IRProgram() {}
+
+CFGAnalyses& IRProgram::Analyses() {
+    if (!analyses) analyses.reset(new CFGAnalyses());
+    return *analyses;
+}
+
+IRBB* IRProgram::AddBB(std::unique_ptr<IRBB> bb) {
+    std::lock_guard<std::mutex> l(mutex);
+    IRBB* ret = bb.get();
+    ret->id = next_bb_id++;
+    bbs.push_back(std::move(bb));
+    return ret;
+}
+
+IRStmtParseRefs& IRProgram::ParseRefs(const IRStmt* stmt) {
+    if (stmt->id >= static_cast<int>(parse_refs.size())) {
+        parse_refs.resize(stmt->id + 1);
+    }
+    return parse_refs[stmt->id];
+}
+
+void IRProgram::Print(ostream* out) const {
+    auto pragmas = Pragmas();
+    for (auto& pragma : pragmas) {
+        *out << "pragma " << pragma.first << " = \"" << pragma.second
+             << "\"\n";
+    }
+    if (!pragmas.empty()) *out << "\n";
     bool first = true;
     for (auto& bb : bbs) {
-        if (!first) s += "\n";
+        if (!first) *out << "\n";
         first = false;
-        s += bb->ToString();
+        bb->Print(out);
     }
-    return s;
 }
 
-string IRBB::ToString() const {
-    string s;
+string IRProgram::ToString() const {
+    ostringstream os;
+    Print(&os);
+    return os.str();
+}
+
+void IRBB::Print(ostream* out) const {
     if (is_entry) {
-        s += "entry ";
+        *out << "entry ";
+        if (lanes > 1) {
+            *out << "lanes " << lanes << " ";
+        }
+    }
+    if (pipelined) {
+        *out << "pipeline ";
     }
-    s += label + ":\n";
+    *out << label << ":\n";
     for (auto& stmt : stmts) {
         if (stmt->deleted) continue;
-        s += stmt->ToString() + "\n";
+        stmt->Print(out);
+        *out << "\n";
     }
-    return s;
 }
 
-string IRStmt::ToString() const {
+string IRBB::ToString() const {
     ostringstream os;
+    Print(&os);
+    return os.str();
+}
 
-    os << '%' << valnum;
-    if (width > 0) {
-        os << '[' << width << ']';
-    } else if (width == kIRStmtWidthTxnID) {
-        os << "[txn]";
-    }
-    os << " = ";
+// The textual name of the op, as used by the IR parser and printer.
+const char* IRStmt::Keyword() const {
     switch (type) {
         case IRStmtExpr:
             switch (op) {
                 case IRStmtOpNone:
-                    os << "none"; break;
+                    return "none";
                 case IRStmtOpConst:
-                    os << "const"; break;
+                    return "const";
                 case IRStmtOpAdd:
-                    os << "add"; break;
+                    return "add";
                 case IRStmtOpSub:
-                    os << "sub"; break;
+                    return "sub";
                 case IRStmtOpMul:
-                    os << "mul"; break;
+                    return "mul";
                 case IRStmtOpDiv:
-                    os << "div"; break;
+                    return "div";
                 case IRStmtOpRem:
-                    os << "rem"; break;
+                    return "rem";
                 case IRStmtOpAnd:
-                    os << "and"; break;
+                    return "and";
                 case IRStmtOpOr:
-                    os << "or"; break;
+                    return "or";
                 case IRStmtOpXor:
-                    os << "xor"; break;
+                    return "xor";
                 case IRStmtOpNot:
-                    os << "not"; break;
+                    return "not";
                 case IRStmtOpLsh:
-                    os << "lsh"; break;
+                    return "lsh";
                 case IRStmtOpRsh:
-                    os << "rsh"; break;
+                    return "rsh";
                 case IRStmtOpBitslice:
-                    os << "bsl"; break;
+                    return "bsl";
                 case IRStmtOpConcat:
-                    os << "cat"; break;
+                    return "cat";
                 case IRStmtOpSelect:
-                    os << "sel"; break;
+                    return "sel";
                 case IRStmtOpCmpLT:
-                    os << "cmplt"; break;
+                    return "cmplt";
                 case IRStmtOpCmpLE:
-                    os << "cmple"; break;
+                    return "cmple";
                 case IRStmtOpCmpEQ:
-                    os << "cmpeq"; break;
+                    return "cmpeq";
                 case IRStmtOpCmpNE:
-                    os << "cmpne"; break;
+                    return "cmpne";
                 case IRStmtOpCmpGT:
-                    os << "cmpgt"; break;
+                    return "cmpgt";
                 case IRStmtOpCmpGE:
-                    os << "cmpge"; break;
+                    return "cmpge";
             }
             break;
         case IRStmtPhi:
-            os << "phi"; break;
+            return "phi";
         case IRStmtIf:
-            os << "if"; break;
+            return "if";
         case IRStmtJmp:
-            os << "jmp"; break;
+            return "jmp";
         case IRStmtPortRead:
-            os << "portread"; break;
+            return "portread";
         case IRStmtPortWrite:
-            os << "portwrite"; break;
+            return "portwrite";
         case IRStmtChanRead:
-            os << "chanread"; break;
+            return "chanread";
         case IRStmtChanWrite:
-            os << "chanwrite"; break;
+            return "chanwrite";
         case IRStmtPortExport:
-            os << "portexport"; break;
+            return "portexport";
+        case IRStmtPortLatency:
+            return "portlatency";
         case IRStmtRegRead:
-            os << "regread"; break;
+            return "regread";
         case IRStmtRegWrite:
-            os << "regwrite"; break;
+            return "regwrite";
         case IRStmtArrayRead:
-            os << "arrayread"; break;
+            return "arrayread";
         case IRStmtArrayWrite:
-            os << "arraywrite"; break;
+            return "arraywrite";
         case IRStmtArraySize:
-            os << "arraysize"; break;
+            return "arraysize";
+        case IRStmtArrayBanks:
+            return "arraybanks";
+        case IRStmtArrayLatency:
+            return "arraylatency";
         case IRStmtSpawn:
-            os << "spawn"; break;
+            return "spawn";
         case IRStmtKill:
-            os << "kill"; break;
+            return "kill";
         case IRStmtKillYounger:
-            os << "killyounger"; break;
+            return "killyounger";
         case IRStmtDone:
-            os << "done"; break;
+            return "done";
         case IRStmtKillIf:
-            os << "killif"; break;
+            return "killif";
+        case IRStmtLane:
+            return "lane";
         case IRStmtBypassStart:
-            os << "bypassstart"; break;
+            return "bypassstart";
         case IRStmtBypassEnd:
-            os << "bypassend"; break;
+            return "bypassend";
         case IRStmtBypassWrite:
-            os << "bypasswrite"; break;
+            return "bypasswrite";
         case IRStmtBypassPresent:
-            os << "bypasspresent"; break;
+            return "bypasspresent";
         case IRStmtBypassReady:
-            os << "bypassready"; break;
+            return "bypassready";
         case IRStmtBypassRead:
-            os << "bypassread"; break;
+            return "bypassread";
         case IRStmtTimingBarrier:
-            os << "timing_barrier"; break;
+            return "timing_barrier";
         case IRStmtBackedge:
-            os << "backedge"; break;
+            return "backedge";
         case IRStmtRestartValue:
-            os << "restart_value"; break;
+            return "restart_value";
         case IRStmtRestartValueSrc:
-            os << "restart_value_src"; break;
+            return "restart_value_src";
+        case IRStmtSkidFull:
+            return "skid_full";
         case IRStmtNone:
             break;
     }
-    os << ' ';
+    return "";
+}
+
+// Requires a crosslinked IRProgram.
+void IRStmt::Print(ostream* out) const {
+    ostream& os = *out;
+
+    os << '%' << valnum;
+    if (width > 0) {
+        os << '[' << width << ']';
+    } else if (width == kIRStmtWidthTxnID) {
+        os << "[txn]";
+    }
+    os << " = " << Keyword() << ' ';
 
     bool first = true;
 
     // Special-case 'phi' to get interleaved BBname/valnum list.
     if (type == IRStmtPhi) {
-        assert(arg_nums.size() == target_names.size());
-        for (unsigned i = 0; i < arg_nums.size(); i++) {
+        assert(args.size() == targets.size());
+        for (unsigned i = 0; i < args.size(); i++) {
             if (!first) os << ", ";
             first = false;
-            os << target_names[i] << ", " << arg_nums[i];
+            os << targets[i]->label << ", %" << args[i]->valnum;
         }
-        return os.str();
+        return;
     }
 
     if (port_name != "") {
@@ -243,16 +511,16 @@ string IRStmt::ToString() const {
         os << '"' << port_name << '"';
     }
 
-    for (auto arg : arg_nums) {
+    for (auto* arg : args) {
         if (!first) os << ", ";
         first = false;
-        os << '%' << arg;
+        os << '%' << arg->valnum;
     }
 
-    for (auto t : target_names) {
+    for (auto* t : targets) {
         if (!first) os << ", ";
         first = false;
-        os << t;
+        os << t->label;
     }
 
     if (has_constant) {
@@ -261,27 +529,34 @@ string IRStmt::ToString() const {
         os << constant;
     }
 
+    if (port_has_default) {
+        os << " default " << port_default;
+    }
+
+    if (timevar) {
+        os << " @[" << timevar->name << " + " << time_offset << "]";
+    }
+
+    // Lowering's annotations, which the parser skips as a comment.
+    const char* sep = " # ";
     if (valid_in) {
-        os << " [valid_in = %" << valid_in->valnum << "]";
+        os << sep << "valid_in = %" << valid_in->valnum;
+        sep = ", ";
     }
     if (valid_out) {
-        os << " [valid_out = %" << valid_out->valnum << "]";
+        os << sep << "valid_out = %" << valid_out->valnum;
+        sep = ", ";
     }
-
     if (restart_arg) {
-        os << " [restart = %" << restart_arg->valnum << "]";
+        os << sep << "restart = %" << restart_arg->valnum;
+        sep = ", ";
     }
-
     if (restart_target) {
-        os << " [restart_target = " << restart_target->label << "]";
-    }
-
-    if (timevar) {
-        os << " @[" << timevar->name << " + " << time_offset << "]";
+        os << sep << "restart_target = " << restart_target->label;
+        sep = ", ";
     }
-
     if (pipedag_deps.size() > 0) {
-        os << " pipedag:[";
+        os << sep << "pipedag:[";
         bool first = true;
         for (auto* dep : pipedag_deps) {
             if (!first) os << ",";
@@ -290,6 +565,10 @@ string IRStmt::ToString() const {
         }
         os << "]";
     }
+}
 
+string IRStmt::ToString() const {
+    ostringstream os;
+    Print(&os);
     return os.str();
 }
@@ -21,14 +21,19 @@
 #include <map>
 #include <memory>
 #include <sstream>
-#include <boost/multiprecision/gmp.hpp>
+#include <atomic>
+#include <mutex>
 
 #include "backend/predicate.h"
+#include "common/arena.h"
 #include "common/parser-utils.h"  // Location, ErrorCollector
+#include "common/small-int.h"
 
 namespace autopiper {
 
-typedef boost::multiprecision::mpz_int bignum;
+// Constants are arbitrary-precision, but almost all fit in 64 bits: SmallInt
+// keeps those inline and falls back to GMP only for the rest.
+typedef SmallInt bignum;
 
 struct IRProgram;
 struct IRBB;
@@ -40,16 +45,71 @@ struct IRBypass;
 struct PipeSys;
 struct Pipe;
 struct PipeStage;
+class PassStats;
+class CFGAnalyses;
+
+// Predicate factors are statements, ordered by ID (see IRStmt::id): statement
+// addresses depend on which thread allocated them when pipes are lowered
+// concurrently, and the order of factors is visible in the generated logic.
+template<>
+struct FactorLess<IRStmt*> {
+  bool operator()(const IRStmt* a, const IRStmt* b) const;
+};
+
+// Symbolic references on a statement as written in textual IR, before
+// crosslinking resolves them to |args| and |targets|. Kept in a side table on
+// the IRProgram (see IRProgram::ParseRefs()) and dropped once the program is
+// crosslinked.
+struct IRStmtParseRefs {
+    std::vector<int> arg_nums;
+    std::vector<Symbol> target_names;
+};
+
+// Statements allocated by the threads that hold an IRStmtArenaScope, and the
+// block of IDs reserved for them. Owned by the program and pooled: a scope
+// takes a free one when it opens and returns it when it closes.
+struct IRStmtThreadArena {
+    IRStmtThreadArena() : size(0), next_id(0), end_id(0) {}
+
+    Arena<IRStmt> stmts;
+    // stmts.size(), for readers on other threads (see NumStmts()).
+    std::atomic<int> size;
+    // Unused IDs [next_id, end_id) of the current block.
+    int next_id;
+    int end_id;
+};
+
+// While an IRStmtArenaScope is open on a thread, IRProgram::NewStmt() on that
+// thread allocates from an arena of the program's that no other thread uses,
+// and assigns IDs from blocks reserved with one atomic add, so that pipes
+// lowered concurrently allocate statements without locking. IDs increase
+// along any one thread's allocations, as they would from a single counter:
+// opening a nested scope gives up the rest of the enclosing one's block.
+class IRStmtArenaScope {
+ public:
+  explicit IRStmtArenaScope(IRProgram* program);
+  ~IRStmtArenaScope();
+
+  // The arena new statements of |program| on this thread come from, or null
+  // for the program's own arena.
+  static IRStmtThreadArena* Current(const IRProgram* program);
+
+ private:
+  IRProgram* program_;
+  IRStmtThreadArena* arena_;
+  IRStmtArenaScope* saved_;
+};
 
 struct IRProgram {
-    IRProgram() {
-        next_valnum = 1;
-        next_anon_timevar = 1;
-        crosslinked_args_bbs = false;
-        timing_model = "null";
-    }
+    // Out of line, where CFGAnalyses is complete.
+    IRProgram();
+    ~IRProgram();
 
     std::vector<std::unique_ptr<IRBB>> bbs;
+    // All statements are owned by the program's arena, whether created by the
+    // parser, the frontend, or during lowering; BBs and pipes refer to them by
+    // pointer only.
+    Arena<IRStmt> stmts;
     std::vector<std::unique_ptr<IRPort>> ports;
     std::vector<std::unique_ptr<IRStorage>> storage;
     std::vector<std::unique_ptr<IRTimeVar>> timevars;
@@ -58,6 +118,44 @@ struct IRProgram {
 
     // timing model -- "null" by default.
     std::string timing_model;
+    // place computations to minimize pipeline register bits? (see
+    // TimingDAG::MinimizeRegisterCost())
+    bool minimize_registers;
+    // spread computations evenly over the stages? (see
+    // TimingDAG::BalanceStages())
+    bool balance_stages;
+    // if nonzero, time each PipeSys with the smallest delay per stage that
+    // fits it in this many stages (see TimingDAG::FitStages())
+    int max_stages;
+    // minimize valid-signal predicates before building them? (see
+    // PredicateTable in predicate-min.h)
+    bool minimize_predicates;
+    // evaluate each kill_if condition once per cycle for all downstream
+    // stages? (see PropagateKillIfDownstream() in lower.cc)
+    bool share_kill_if_slices;
+    // simplify logic under the facts implied by valid predicates, and remove
+    // never-valid statements? (see PropagatePredicates() in lower.cc)
+    bool propagate_predicates;
+    // register exported inputs and outputs that declare no latency of their
+    // own, with one register each? (see IRPort::latency)
+    bool register_inputs;
+    bool register_outputs;
+    // split arrays into banks where that gives each bank fewer ports? (see
+    // AssignArrayBanks() in lower.cc)
+    bool bank_arrays;
+    // elastic stalls: if nonzero, the number of skid-buffer entries at the
+    // input of each elastic stage (see AssignElasticStalls() in lower.cc).
+    // The elastic stages are those listed in |elastic_stages|, or every
+    // eligible stage if it is empty.
+    int skid_depth;
+    std::vector<int> elastic_stages;
+    // instantiate performance counters for each stage's events? (see
+    // AssignPerfEvents() in lower.cc)
+    bool perf_counters;
+    // trace each stage's events and those of the statements that spawn,
+    // end, kill and stall transactions, for the profiler? (see
+    // AssignPerfEvents() in lower.cc; set only by BackendCompiler::Options)
+    bool profile;
 
     // top-level entry points -- set during parsing.
     std::vector<IRBB*> entries;
@@ -70,9 +168,55 @@ struct IRProgram {
                                             std::istream* in,
                                             ErrorCollector* collector);
 
+    // Binary IR (see ir-binary.cc). WriteBinary() requires resolved args and
+    // targets (i.e., a crosslinked or frontend-generated program); a program
+    // read back by ParseBinary() has them resolved already.
+    void WriteBinary(std::ostream* out) const;
+    static bool IsBinary(const char* data, size_t size);
+    static std::unique_ptr<IRProgram> ParseBinary(const std::string& filename,
+                                                  const char* data,
+                                                  size_t size,
+                                                  ErrorCollector* collector);
+    // Map |filename| and parse it as binary or text IR, as appropriate.
+    static std::unique_ptr<IRProgram> Load(const std::string& filename,
+                                           ErrorCollector* collector);
+
+    // Parse a comma-separated list of stage numbers, as given to the
+    // elastic_stages pragma or the --elastic-stages flag. Returns false if
+    // |text| is malformed.
+    static bool ParseStageList(const std::string& text,
+                               std::vector<int>* stages);
+
+    // Apply pragma |key| = |value| to the settings above, as the frontend's
+    // 'pragma' statements and text IR's 'pragma' lines do. Unknown keys are
+    // ignored. Returns false, with |error| set, if |value| is malformed.
+    bool SetPragma(const std::string& key, const std::string& value,
+                   std::string* error);
+    // The pragmas that reproduce the settings that differ from the defaults,
+    // in the order Print() writes them.
+    std::vector<std::pair<std::string, std::string>> Pragmas() const;
+
     bool Crosslink(ErrorCollector* collector);
     bool Typecheck(ErrorCollector* collector);
-    std::vector<std::unique_ptr<PipeSys>> Lower(ErrorCollector* collector);
+    // Fold expressions over constants, turn branches on constant conditions
+    // into jumps and remove the BBs left unreachable, and remove pure
+    // statements whose values are never used. Requires a typechecked
+    // IRProgram.
+    void FoldConstants();
+    // Remove pure expressions that recompute a value already available at a
+    // dominating point, rewriting their uses. Requires a typechecked
+    // IRProgram. Returns the number of statements removed.
+    int EliminateCommonSubexprs();
+    // Recompute arithmetic whose operands are known to have fewer significant
+    // bits than their declared widths at the narrower width. Writes a line per
+    // narrowed value to |report| if non-null. Returns the number narrowed.
+    int NarrowWidths(std::ostream* report = nullptr);
+    // Lower each entry's spawn tree to a PipeSys, using up to |jobs| threads
+    // across PipeSys instances and the pipes within them.
+    // Per-pass statistics are recorded to |stats| if non-null.
+    std::vector<std::unique_ptr<PipeSys>> Lower(ErrorCollector* collector,
+                                                int jobs = 1,
+                                                PassStats* stats = nullptr);
 
     // top-level entry and any spawn points
     std::vector<const IRBB*> Roots() const;
@@ -83,29 +227,90 @@ struct IRProgram {
 
     IRTimeVar* GetTimeVar();
 
+    // Allocate a new statement (or a copy of |proto|) in the program's arena,
+    // or in the thread's under an IRStmtArenaScope, and assign it a new
+    // statement ID. IDs are dense except for those allocated under a scope;
+    // Lower() makes those of the statements it allocated dense again, and
+    // independent of the number of jobs.
+    IRStmt* NewStmt();
+    IRStmt* NewStmt(const IRStmt& proto);
+    // Statements allocated so far, in any arena.
+    int NumStmts();
+
+    // Take ownership of a new BB (from the parser, the frontend, or
+    // lowering) and assign it the next dense BB ID.
+    IRBB* AddBB(std::unique_ptr<IRBB> bb);
+    // One more than the largest BB ID assigned so far. IDs of removed BBs
+    // are not reused, so this may exceed bbs.size().
+    int NumBBIds() const { return next_bb_id; }
+
+    // CFG analyses over the whole program, from Roots(). Cached until a pass
+    // that changes the CFG invalidates them (see cfg-analysis.h).
+    CFGAnalyses& Analyses();
+
+    // Parse-time symbolic references for |stmt|. Valid only until Crosslink()
+    // completes.
+    IRStmtParseRefs& ParseRefs(const IRStmt* stmt);
+
+    // Writes the program as text IR, its settings as pragmas and then one BB
+    // at a time, in the form that Parse() reads.
+    void Print(std::ostream* out) const;
     std::string ToString() const;
 
-    // Internal: for valnum allocation.
-    int next_valnum;
+    // Internal: for valnum allocation. GetValnum(), GetTimeVar(), NewStmt()
+    // and AddBB() may be called concurrently while lowering PipeSys
+    // instances or pipes in parallel; |mutex| guards the latter two, and
+    // NewStmt() outside an IRStmtArenaScope.
+    std::atomic<int> next_valnum;
+    std::atomic<int> next_stmt_id;
+    // IDs are reserved for an IRStmtThreadArena this many at a time.
+    static const int kStmtIdBlock = 256;
+    std::vector<std::unique_ptr<IRStmtThreadArena>> thread_arenas;
+    std::vector<IRStmtThreadArena*> free_thread_arenas;  // guarded by |mutex|
     int next_anon_timevar;
+    int next_bb_id;
+    std::unique_ptr<CFGAnalyses> analyses;
+    std::mutex mutex;
+    // Indexed by IRStmt::id; emptied by Crosslink().
+    std::vector<IRStmtParseRefs> parse_refs;
 };
 
 struct IRBB {
     IRBB() {
+        id = -1;
         pipe = NULL;
         is_entry = false;
+        lanes = 1;
+        lane = 0;
         is_restart = false;
         restart_cond = NULL;
         in_valid = NULL;
         restart_pred_src = NULL;
+        pipelined = false;
     }
 
+    int id;  // dense index assigned by IRProgram::AddBB()
     std::string label;
-    std::vector<std::unique_ptr<IRStmt>> stmts;
+    std::vector<IRStmt*> stmts;  // owned by IRProgram::stmts
 
     bool is_entry;  // top-level entry point
     Pipe* pipe;  // filled in during lowering
 
+    // An entry may issue into |lanes| copies of its pipes, each cycle's
+    // transactions ordered from lane 0 (oldest) up. Crosslinking copies every
+    // BB reachable from the entry once per further lane; the copies of the
+    // entry are listed in |lane_entries|, and every BB in the group records
+    // the group's |lanes| and its own |lane|.
+    int lanes;
+    int lane;
+    std::vector<IRBB*> lane_entries;
+
+    // Is this the header of a pipelined loop? Its backedges then restart
+    // iterations at the stage the header falls in, rather than holding the
+    // header in the backedge's stage, so that younger transactions may enter
+    // the loop while older iterations finish.
+    bool pipelined;
+
     Location location;
 
     std::vector<IRBB*> Succs() const;
@@ -126,6 +331,7 @@ struct IRBB {
     // pointer to restart value src for 'valid' value in backedge BB.
     IRStmt* restart_pred_src;
 
+    void Print(std::ostream* out) const;
     std::string ToString() const;
 };
 
@@ -151,6 +357,7 @@ enum IRStmtType {
     // idiomatic form is to place it at the place where the channel is
     // read or written).
     IRStmtPortExport,
+    IRStmtPortLatency,  // declare a port's or chan's latency (constant field)
 
     // state element reads and writes
     IRStmtRegRead,
@@ -158,6 +365,8 @@ enum IRStmtType {
     IRStmtArrayRead,
     IRStmtArrayWrite,
     IRStmtArraySize,  // declare an array's size (constant field)
+    IRStmtArrayBanks,  // declare an array's bank count (constant field)
+    IRStmtArrayLatency,  // declare an array's read latency (constant field)
 
     // transaction-related: spawn (returning ID), kill own txn, kill younger
     // txns in this pipe.
@@ -167,6 +376,7 @@ enum IRStmtType {
     IRStmtDone,  // txn completes
 
     IRStmtKillIf,  // kill self if a condition (first arg) is met at any downstream point.
+    IRStmtLane,  // index of the lane this txn issued into; a constant after crosslinking
 
     // bypass-network operations:
     IRStmtBypassStart,  // start a bypass-providing region (first arg is index, portname is bypass network name)
@@ -189,6 +399,9 @@ enum IRStmtType {
     IRStmtRestartValue,
     // Represent a backedge restart value source.
     IRStmtRestartValueSrc,
+    // Whether the skid buffer at the input of an elastic stage (whose number
+    // is the constant) is full. Cannot be parsed in; generated in lowering.
+    IRStmtSkidFull,
 
     IRStmtNone,
 };
@@ -222,25 +435,35 @@ static const int kIRStmtWidthTxnID = -2;
 
 struct IRStmt {
     IRStmt() {
+        id = -1;
         valnum = -1;
         type = IRStmtNone;
+        op = IRStmtOpNone;
         bb = NULL;
         port = NULL;
+        storage = NULL;
+        bypass = NULL;
         port_has_default = false;
         dom_killyounger = NULL;
         timevar = NULL;
         restart_arg = NULL;
         restart_target = NULL;
+        pipe = NULL;
+        stage = NULL;
         time_offset = 0;
         width = 0;
+        array_bank = -1;
+        valid_preds_slot = -1;
         has_constant = false;
         is_valid_start = false;
         valid_in = NULL;
         valid_out = NULL;
         valid_spine = false;
+        unstaged = false;
         deleted = false;
     }
     
+    int id;  // unique; see IRProgram::NewStmt() and Lower()
     int valnum;
     IRStmtType type;
     IRStmtOp op;
@@ -256,21 +479,23 @@ struct IRStmt {
     int time_offset;
     int width;
 
-    // used only prior to crosslinking:
-    std::vector<int> arg_nums;
-    std::vector<std::string> target_names;
+    // Textual name of the port, storage element, or bypass network; resolved
+    // by crosslinking. (Arg valnums and target labels live in
+    // IRProgram::parse_refs until then.)
     std::string port_name;
     bignum port_default;
     bool port_has_default;
 
     // Filled in during lowering/timing:
     IRStmt* dom_killyounger;  // dominated by a killyounger?
+    int array_bank;  // bank always addressed by an array read/write, or -1.
+    int valid_preds_slot;  // in PipeSys::valid_preds while lowering, or -1.
     IRStmt* restart_arg;  // backward arg to IRStmtRestartValueSrc on an IRStmtRestartValue op.
     IRBB* restart_target;  // backward target to restart header on an IRStmtBackedge op.
     Pipe* pipe;
     bool is_valid_start;
-    Predicate<IRStmt*> valid_in_pred;
-    Predicate<IRStmt*> valid_out_pred;
+    // (valid_in/valid_out predicates are kept per-PipeSys during lowering; see
+    // PipeSys::valid_preds.)
     IRStmt* valid_in;
     IRStmt* valid_out;
     // the result of this stmt is a 'valid' signal. Note that this *cannot* be used
@@ -280,14 +505,31 @@ struct IRStmt {
     bool valid_spine;
     std::vector<IRStmt*> pipedag_deps; // DAG of side-effecting ops
     PipeStage* stage;  // stage into which this op is placed
+    // the value is read combinationally by later stages rather than staged
+    // through piperegs: it depends only on the current cycle's port values,
+    // not on the transaction (set for shared kill_if conditions).
+    bool unstaged;
 
     bool deleted;
 
     // Auxiliary info
+    const char* Keyword() const;
+    // Whether the type, op, args and targets are those the statement's
+    // keyword takes in text IR; sets |error| if not (see ir-parser.cc).
+    bool CheckArity(std::string* error) const;
+    // Writes the statement as one line of text IR (without the newline).
+    // Annotations added by lowering (valid signals, restarts and pipedag
+    // edges) follow as a comment.
+    void Print(std::ostream* out) const;
     std::string ToString() const;
     Location location;
 };
 
+inline bool FactorLess<IRStmt*>::operator()(const IRStmt* a,
+                                            const IRStmt* b) const {
+    return a->id < b->id;
+}
+
 // IRPort represents either a port or a chan.
 struct IRPort {
     enum Type {
@@ -299,12 +541,22 @@ struct IRPort {
         width = 0;
         type = PORT;
         exported = false;
+        latency = 0;
     }
 
     std::string name;
     int width;
     Type type;
     bool exported;
+    // Cycles between a write and the readers seeing it, set by a
+    // 'portlatency' statement. A port's written value passes through this
+    // many registers on its way to the readers; a chan's readers are placed
+    // at least this many stages after its writer, so the value reaches them
+    // through piperegs. Either way, no combinational path runs from the
+    // writer's logic to the readers'. An exported port's registers sit at the
+    // module boundary instead: between its writer and the module's output, or
+    // between the module's input and its readers.
+    int latency;
 
     std::vector<IRStmt*> defs;
     std::vector<IRStmt*> uses;
@@ -326,6 +578,9 @@ struct IRStorage {
         data_width = 0;
         index_width = 0;
         elements = 0;
+        declared_banks = 0;
+        banks = 1;
+        read_latency = 0;
     }
 
     std::string name;
@@ -333,6 +588,26 @@ struct IRStorage {
     int index_width;
     int elements;
 
+    // An array may be split into |banks| banks (a power of two), each
+    // holding the elements whose low index bits are its bank number, and
+    // each with its own ports. |declared_banks| is the count given by an
+    // 'arraybanks' statement, or 0 if none; |banks| is chosen in lowering
+    // (see AssignArrayBanks()).
+    int declared_banks;
+    int banks;
+
+    // A read of an array with a nonzero |read_latency| is registered, as in a
+    // synchronous RAM: its data is available that many stages after the
+    // stage that presents its index. Set by an 'arraylatency' statement.
+    int read_latency;
+
+    // The number of low index bits that select a bank.
+    int BankBits() const {
+        int bits = 0;
+        while ((1 << bits) < banks) bits++;
+        return bits;
+    }
+
     std::vector<IRStmt*> writers;
     std::vector<IRStmt*> readers;
 };
@@ -342,6 +617,7 @@ struct IRBypass {
         start = NULL;
         end = NULL;
         width = 0;
+        lane = 0;
     }
 
     std::string name;
@@ -351,6 +627,12 @@ struct IRBypass {
     std::vector<IRStmt*> writes;
     std::map<int, IRStmt*> writes_by_stage;
     int width;
+
+    // A network used in a multi-lane pipe has one copy per lane, all listed
+    // in |lanes| (empty otherwise) by lane index; |lane| is this copy's. A
+    // read sees the writes of older transactions in every lane.
+    std::vector<IRBypass*> lanes;
+    int lane;
 };
 
 // Helpers
@@ -381,6 +663,12 @@ inline bool IRHasSideEffects(IRStmtType type) {
     }
 }
 
+// Evaluates the expression |stmt| with each arg taking the value in |args|,
+// wrapping at the statement's width as the hardware does. Returns false if the
+// op cannot be evaluated (e.g. a select). Defined in ir-fold.cc.
+bool IRFoldExpr(const IRStmt* stmt, const std::vector<bignum>& args,
+                bignum* result);
+
 // Used by both BBReversePostorder and BBDomTree
 struct BBSuccFunc {
     std::vector<const IRBB*> operator()(const IRBB* bb) {
@@ -20,14 +20,20 @@
 #include "common/util.h"
 #include "backend/rpo.h"
 #include "backend/predicate.h"
+#include "backend/predicate-min.h"
 #include "backend/ir-build.h"
 #include "backend/pipe-timing.h"
+#include "common/error-collector.h"
+#include "common/parallel.h"
+#include "common/pass-stats.h"
 
 #include <algorithm>
 #include <map>
 #include <vector>
 #include <queue>
 #include <deque>
+#include <functional>
+#include <mutex>
 #include <set>
 
 using namespace autopiper;
@@ -43,13 +49,20 @@ bool FindPipes(IRProgram* program,
     // point (this is initially the program entry point), and all reachable
     // BBs are merged into the pipe. Spawned BBs are added to the entrypoint
     // set for later processing. We enforce that each pipeline can have only
-    // one spawn-point.
+    // one spawn-point. The copies of a multi-lane entry start their lanes'
+    // pipes in the same PipeSys.
     queue<unique_ptr<Pipe>> to_process;
 
-    unique_ptr<Pipe> entry_pipe(new Pipe());
-    entry_pipe->entry = entry;
-    entry_pipe->sys = sys;
-    to_process.push(move(entry_pipe));
+    vector<IRBB*> lane_entries = { entry };
+    lane_entries.insert(lane_entries.end(), entry->lane_entries.begin(),
+                        entry->lane_entries.end());
+    for (unsigned lane = 0; lane < lane_entries.size(); lane++) {
+        unique_ptr<Pipe> entry_pipe(new Pipe());
+        entry_pipe->entry = lane_entries[lane];
+        entry_pipe->sys = sys;
+        entry_pipe->lane = lane;
+        to_process.push(move(entry_pipe));
+    }
 
     while (!to_process.empty()) {
         unique_ptr<Pipe> pipe = move(to_process.front());
@@ -92,7 +105,8 @@ bool FindPipes(IRProgram* program,
                     spawned->parent = pipe.get();
                     spawned->parent->children.push_back(spawned.get());
                     spawned->sys = sys;
-                    spawned->spawn = stmt.get();
+                    spawned->spawn = stmt;
+                    spawned->lane = pipe->lane;
                     to_process.push(move(spawned));
                 }
             }
@@ -101,6 +115,13 @@ bool FindPipes(IRProgram* program,
         sys->pipes.push_back(move(pipe));
     }
 
+    // Keep each lane's pipes together, in lane order, so that passes run
+    // pipe by pipe see an older lane's pipes before a younger one's.
+    stable_sort(sys->pipes.begin(), sys->pipes.end(),
+                [](const unique_ptr<Pipe>& a, const unique_ptr<Pipe>& b) {
+                    return a->lane < b->lane;
+                });
+
     return true;
 }
 
@@ -139,8 +160,7 @@ bool ComputeKillyoungerDom(IRProgram* program,
                            PipeSys* sys,
                            Pipe* pipe,
                            ErrorCollector* coll) {
-    BBReversePostorder rpo;
-    rpo.Compute( { pipe->entry } );
+    const BBReversePostorder& rpo = pipe->analyses.RPO({ pipe->entry });
 
     // is a BB's out-edge dominated by a killyounger (where dominance counts
     // only forward edges)?
@@ -167,7 +187,7 @@ bool ComputeKillyoungerDom(IRProgram* program,
         IRStmt* dom = join;
         for (auto& stmt : bb->stmts) {
             stmt->dom_killyounger = dom;
-            if (stmt->type == IRStmtKillYounger) dom = stmt.get();
+            if (stmt->type == IRStmtKillYounger) dom = stmt;
         }
 
         out_killyounger[bb] = dom;
@@ -176,6 +196,18 @@ bool ComputeKillyoungerDom(IRProgram* program,
     return true;
 }
 
+// Names the backedge BB, its restart header and its timevar after the
+// backedge op's valnum.
+void NameBackedge(IRStmt* backedge_op) {
+    backedge_op->bb->label = strprintf("__backedge_bb_%d",
+                                       backedge_op->valnum);
+    backedge_op->restart_target->label = backedge_op->bb->label + "_restart_";
+    if (backedge_op->timevar) {
+        backedge_op->timevar->name = strprintf("__backedge_timevar_%d",
+                                               backedge_op->valnum);
+    }
+}
+
 void ConvertBackedgePhis(
         IRProgram* program,
         Pipe* pipe,
@@ -185,12 +217,11 @@ void ConvertBackedgePhis(
     // Backedge is retargeted to restart header, which contains the necessary
     // restart value sources.
     unique_ptr<IRBB> restart_header(new IRBB());
-    restart_header->label = backedge_op->bb->label + "_restart_";
 
     // Generate the backedge valid restart signal. This is linked up to the
     // backedge predicate during codegen.
     restart_header->restart_cond =
-        AppendOwnedToVector(restart_header->stmts, new IRStmt());
+        AppendToVector(restart_header->stmts, program->NewStmt());
     restart_header->restart_cond->valnum = program->GetValnum();
     restart_header->restart_cond->bb = restart_header.get();
     restart_header->restart_cond->type = IRStmtRestartValue;
@@ -201,7 +232,7 @@ void ConvertBackedgePhis(
 
     // Generate the source for the restart header's condition/valid signal.
     IRStmt* restart_valid_src =
-        PrependOwnedToVector(backedge_op->bb->stmts, new IRStmt());
+        PrependToVector(backedge_op->bb->stmts, program->NewStmt());
     restart_valid_src->valnum = program->GetValnum();
     restart_valid_src->bb = backedge_op->bb;
     restart_valid_src->type = IRStmtRestartValueSrc;
@@ -213,7 +244,7 @@ void ConvertBackedgePhis(
 
     backedge_op->restart_target = restart_header.get();
 
-    vector<unique_ptr<IRStmt>> restart_value_srcs;
+    vector<IRStmt*> restart_value_srcs;
 
     // Find phis in backedge dest with input from the source BB.
     for (auto& phi_stmt : dest_bb->stmts) {
@@ -222,40 +253,36 @@ void ConvertBackedgePhis(
             if (phi_stmt->targets[i] != source_bb) continue;
 
             IRStmt* restart_value =
-                AppendOwnedToVector(restart_header->stmts, new IRStmt());
+                AppendToVector(restart_header->stmts, program->NewStmt());
             restart_value->valnum = program->GetValnum();
             restart_value->type = IRStmtRestartValue;
             restart_value->width = phi_stmt->width;
             restart_value->bb = restart_header.get();
 
             IRStmt* restart_value_src =
-                AppendOwnedToVector(restart_value_srcs, new IRStmt());
+                AppendToVector(restart_value_srcs, program->NewStmt());
             restart_value_src->valnum = program->GetValnum();
             restart_value_src->type = IRStmtRestartValueSrc;
             restart_value_src->width = phi_stmt->width;
             restart_value_src->args.push_back(phi_stmt->args[i]);
-            restart_value_src->arg_nums.push_back(phi_stmt->arg_nums[i]);
             restart_value_src->bb = backedge_op->bb;
             restart_value->restart_arg = restart_value_src;
 
             phi_stmt->args[i] = restart_value;
-            phi_stmt->arg_nums[i] = restart_value->valnum;
             phi_stmt->targets[i] = restart_value->bb;
-            phi_stmt->target_names[i] = restart_value->bb->label;
         }
     }
 
     // Generate a jump to restart point.
     IRStmt* jmp =
-        AppendOwnedToVector(restart_header->stmts, new IRStmt());
+        AppendToVector(restart_header->stmts, program->NewStmt());
     jmp->valnum = program->GetValnum();
     jmp->type = IRStmtJmp;
-    jmp->target_names.push_back(dest_bb->label);
     jmp->targets.push_back(dest_bb);
 
     // Prepend the restart value src ops to the backedge BB.
-    for (auto& stmt : backedge_op->bb->stmts) {
-        restart_value_srcs.push_back(move(stmt));
+    for (auto* stmt : backedge_op->bb->stmts) {
+        restart_value_srcs.push_back(stmt);
     }
     swap(backedge_op->bb->stmts, restart_value_srcs);
     restart_value_srcs.clear();
@@ -267,22 +294,26 @@ void ConvertBackedgePhis(
 
     pipe->bbs.push_back(restart_header.get());
     pipe->roots.push_back(restart_header.get());
-    program->bbs.push_back(move(restart_header));
+    program->AddBB(move(restart_header));
 }
 
 bool ConvertBackedges(IRProgram* program,
                       PipeSys* sys,
                       Pipe* pipe,
                       ErrorCollector* coll) {
-    BBReversePostorder rpo;
-    rpo.Compute( { pipe->entry } );
+    const BBReversePostorder& rpo = pipe->analyses.RPO({ pipe->entry });
 
     // For each backedge, insert the appropriate barriers. We determine whether
     // the jump is dominated by a killyounger; if so, the killyounger and jump
     // are constrained to the same stage (new timing var); if not, the jump and
-    // its backward target are constrained to the same stage.
+    // its backward target are constrained to the same stage, unless the target
+    // is a pipelined loop header. A pipelined loop's header falls where its
+    // own dependences place it and each iteration restarts there, stalling the
+    // stages above it, so that a new transaction may enter the loop while
+    // older iterations are still in flight.
     
     set<const IRBB*> seen;
+    bool changed_cfg = false;
     for (auto* bb : rpo.RPO()) {
         seen.insert(bb);
 
@@ -290,7 +321,7 @@ bool ConvertBackedges(IRProgram* program,
         IRStmt* term = nullptr;
         for (auto& stmt : bb->stmts) {
             if (stmt->type == IRStmtJmp || stmt->type == IRStmtIf) {
-                term = stmt.get();
+                term = stmt;
                 break;
             }
         }
@@ -304,54 +335,64 @@ bool ConvertBackedges(IRProgram* program,
             if (seen.find(term->targets[i]) != seen.end()) {
                 // Convert to a target to a new BB with a single 'backedge' op.
                 unique_ptr<IRBB> backedge_bb(new IRBB());
-                backedge_bb->stmts.emplace_back(new IRStmt());
-                IRStmt* backedge_op = backedge_bb->stmts.back().get();
+                IRStmt* backedge_op =
+                    AppendToVector(backedge_bb->stmts, program->NewStmt());
                 backedge_op->bb = backedge_bb.get();
                 pipe->bbs.push_back(backedge_bb.get());
-                program->bbs.push_back(move(backedge_bb));
+                program->AddBB(move(backedge_bb));
 
                 backedge_op->valnum = program->GetValnum();
-                backedge_op->bb->label = strprintf("__backedge_bb_%d",
-                                                   backedge_op->valnum);
                 backedge_op->type = IRStmtBackedge;
                 backedge_op->dom_killyounger = term->dom_killyounger;
+                // Attribute the backedge to the loop it closes, e.g. to a
+                // while loop's condition, for the throughput report.
+                for (auto* target_stmt : term->targets[i]->stmts) {
+                    if (target_stmt->location.line > 0) {
+                        backedge_op->location = target_stmt->location;
+                        break;
+                    }
+                }
 
                 // Insert a barrier either at the start of the backedge target
                 // BB, if no dominating killyounger, or right before the most
                 // recent killyounger, if so.
                 IRStmt* backedge_barrier = NULL;
-                if (backedge_op->dom_killyounger) {
+                if (!backedge_op->dom_killyounger &&
+                    term->targets[i]->pipelined) {
+                    // No barrier: see above.
+                } else if (backedge_op->dom_killyounger) {
                     backedge_barrier =
-                        InsertOwnedBefore(
+                        InsertBefore(
                                 backedge_op->dom_killyounger->bb->stmts,
                                 backedge_op->dom_killyounger,
-                                new IRStmt());
+                                program->NewStmt());
                     backedge_barrier->bb = backedge_op->dom_killyounger->bb;
                 } else {
                     backedge_barrier =
-                        PrependOwnedToVector(term->targets[i]->stmts, new IRStmt());
+                        PrependToVector(term->targets[i]->stmts, program->NewStmt());
                     backedge_barrier->bb = term->targets[i];
                 }
-                backedge_barrier->valnum = program->GetValnum();
-                backedge_barrier->type = IRStmtTimingBarrier;
-
-                // Create a timevar that ensures the backedge source and dest
-                // are in the same stage.
-                auto* timevar = program->GetTimeVar();
-                timevar->name = strprintf("__backedge_timevar_%d",
-                                          backedge_op->valnum);
-                backedge_op->timevar = timevar;
-                backedge_op->time_offset = 0;
-                backedge_barrier->timevar = timevar;
-                backedge_barrier->time_offset = 0;
+                if (backedge_barrier) {
+                    backedge_barrier->valnum = program->GetValnum();
+                    backedge_barrier->type = IRStmtTimingBarrier;
+
+                    // Create a timevar that ensures the backedge source and
+                    // dest are in the same stage.
+                    auto* timevar = program->GetTimeVar();
+                    backedge_op->timevar = timevar;
+                    backedge_op->time_offset = 0;
+                    backedge_barrier->timevar = timevar;
+                    backedge_barrier->time_offset = 0;
+                }
 
                 // This creates the backedge restart block and sets
                 // backedge_op's restart_target appropriately.
                 ConvertBackedgePhis(
                         program, pipe, term->bb, backedge_op, term->targets[i]);
+                NameBackedge(backedge_op);
 
                 term->targets[i] = backedge_op->bb;
-                term->target_names[i] = backedge_op->bb->label.c_str();
+                changed_cfg = true;
             }
         }
     }
@@ -360,21 +401,205 @@ bool ConvertBackedges(IRProgram* program,
     // valids work.
     pipe->roots.push_back(pipe->entry);
 
+    // Backedges now lead to new backedge BBs rather than their targets. (After
+    // the loop above, which walks the RPO that this frees.)
+    if (changed_cfg) pipe->analyses.Invalidate();
+
+    return true;
+}
+
+// Builds the sub-operations of an expanded multi-cycle op, placing them ahead
+// of it in its BB and tagging each with its source location.
+class MultiCycleBuilder {
+ public:
+  MultiCycleBuilder(IRBBBuilder* builder, const IRStmt* op)
+      : builder_(builder), location_(op->location) {}
+
+  IRStmt* Expr(IRStmtOp op, int width, vector<IRStmt*> args) {
+      IRStmt* stmt = builder_->AddExpr(op, width, args);
+      stmt->location = location_;
+      return stmt;
+  }
+
+  // Constants are not shared between uses, so that each one is placed in its
+  // user's stage rather than staged down the pipe.
+  IRStmt* Const(int width, int value) {
+      IRStmt* stmt = builder_->AddConst(width, value);
+      stmt->location = location_;
+      return stmt;
+  }
+
+  IRStmt* Slice(IRStmt* value, int hi, int lo) {
+      return Expr(IRStmtOpBitslice, hi - lo + 1,
+                  { value, Const(32, hi), Const(32, lo) });
+  }
+
+ private:
+  IRBBBuilder* builder_;
+  Location location_;
+};
+
+// Rewrites |stmt|, a multiply, as a carry-save tree over its partial
+// products followed by a single final add (which |stmt| becomes).
+void ExpandMul(IRStmt* stmt, MultiCycleBuilder* b) {
+    IRStmt* x = stmt->args[0];
+    IRStmt* y = stmt->args[1];
+    int width = stmt->width;
+
+    // Partial products: x, zero-extended to the full product width and
+    // shifted left by i, for each set bit i of y.
+    IRStmt* x_ext = b->Expr(IRStmtOpConcat, width,
+                            { b->Const(width - x->width, 0), x });
+    vector<IRStmt*> terms;
+    for (int i = 0; i < y->width; i++) {
+        IRStmt* shifted = i == 0 ? x_ext :
+            b->Expr(IRStmtOpLsh, width, { x_ext, b->Const(32, i) });
+        terms.push_back(b->Expr(IRStmtOpSelect, width,
+                                { b->Slice(y, i, i), shifted,
+                                  b->Const(width, 0) }));
+    }
+
+    // Reduce three terms to two with full adders until two remain.
+    while (terms.size() > 2) {
+        vector<IRStmt*> next;
+        unsigned i = 0;
+        for (; i + 2 < terms.size(); i += 3) {
+            IRStmt* p = terms[i];
+            IRStmt* q = terms[i + 1];
+            IRStmt* r = terms[i + 2];
+            IRStmt* sum = b->Expr(IRStmtOpXor, width,
+                    { b->Expr(IRStmtOpXor, width, { p, q }), r });
+            IRStmt* majority = b->Expr(IRStmtOpOr, width,
+                    { b->Expr(IRStmtOpOr, width,
+                              { b->Expr(IRStmtOpAnd, width, { p, q }),
+                                b->Expr(IRStmtOpAnd, width, { p, r }) }),
+                      b->Expr(IRStmtOpAnd, width, { q, r }) });
+            next.push_back(sum);
+            next.push_back(b->Expr(IRStmtOpLsh, width,
+                                   { majority, b->Const(32, 1) }));
+        }
+        for (; i < terms.size(); i++) {
+            next.push_back(terms[i]);
+        }
+        terms.swap(next);
+    }
+    if (terms.size() == 1) {
+        terms.push_back(b->Const(width, 0));
+    }
+
+    stmt->op = IRStmtOpAdd;
+    stmt->args = terms;
+}
+
+// Rewrites |stmt|, a divide or remainder, as a chain of restoring radix-2
+// steps, one per dividend bit, each a subtract and a MUX. |stmt| becomes a
+// select of the concatenation of quotient bits, or a resize of the final
+// remainder, or 0 if the divisor is 0 (as ap_div() and ap_rem() in the models
+// yield).
+void ExpandDivRem(IRStmt* stmt, MultiCycleBuilder* b) {
+    IRStmt* x = stmt->args[0];
+    IRStmt* y = stmt->args[1];
+    int width = stmt->width;
+    int y_width = y->width;
+
+    // The partial remainder is always less than |y|, so one extra bit holds
+    // it shifted left; the trial subtraction's top bit is then its borrow.
+    IRStmt* rem = b->Const(y_width, 0);
+    vector<IRStmt*> quotient_bits(x->width);
+    for (int i = x->width - 1; i >= 0; i--) {
+        IRStmt* shifted = b->Expr(IRStmtOpConcat, y_width + 1,
+                                  { rem, b->Slice(x, i, i) });
+        IRStmt* y_ext = b->Expr(IRStmtOpConcat, y_width + 1,
+                                { b->Const(1, 0), y });
+        IRStmt* trial = b->Expr(IRStmtOpSub, y_width + 1, { shifted, y_ext });
+        IRStmt* fits = b->Expr(IRStmtOpNot, 1,
+                               { b->Slice(trial, y_width, y_width) });
+        rem = b->Expr(IRStmtOpSelect, y_width,
+                      { fits, b->Slice(trial, y_width - 1, 0),
+                        b->Slice(shifted, y_width - 1, 0) });
+        quotient_bits[i] = fits;
+    }
+
+    IRStmt* result;
+    if (stmt->op == IRStmtOpDiv) {
+        // Concat takes its most significant part first; the quotient is
+        // truncated to the statement's width.
+        result = b->Expr(IRStmtOpConcat, width,
+                         vector<IRStmt*>(quotient_bits.rend() - width,
+                                         quotient_bits.rend()));
+    } else if (width <= y_width) {
+        result = b->Slice(rem, width - 1, 0);
+    } else {
+        result = b->Expr(IRStmtOpConcat, width,
+                         { b->Const(width - y_width, 0), rem });
+    }
+
+    // Every trial subtraction of a zero divisor fits, which would give an
+    // all-ones quotient and the dividend's low bits as the remainder.
+    IRStmt* nonzero = b->Expr(IRStmtOpCmpNE, 1,
+                              { y, b->Const(y_width, 0) });
+    stmt->op = IRStmtOpSelect;
+    stmt->args = { nonzero, result, b->Const(width, 0) };
+}
+
+// Expands multiplies, divides and remainders whose delay exceeds a single
+// pipestage under the timing model into trees and chains of simpler
+// operations. The timing DAG can then spread these across as many stages as
+// needed, so that a pipeline containing them still meets the target clock with
+// full throughput. Ops that fit in one stage are left alone.
+bool ExpandMultiCycleOps(IRProgram* program,
+                         PipeSys* sys,
+                         const TimingModel* model,
+                         ErrorCollector* coll) {
+    for (auto& pipe : sys->pipes) {
+        for (auto* bb : pipe->bbs) {
+            bool expanded = false;
+            IRBBBuilder builder(program, bb);
+            for (auto* stmt : bb->stmts) {
+                if (stmt->type == IRStmtExpr &&
+                    (stmt->op == IRStmtOpMul || stmt->op == IRStmtOpDiv ||
+                     stmt->op == IRStmtOpRem) &&
+                    stmt->width > 0 &&
+                    model->Delay(stmt) > model->DelayPerStage()) {
+                    MultiCycleBuilder b(&builder, stmt);
+                    if (stmt->op == IRStmtOpMul) {
+                        ExpandMul(stmt, &b);
+                    } else {
+                        ExpandDivRem(stmt, &b);
+                    }
+                    expanded = true;
+                }
+                builder.Add(stmt);
+            }
+            if (expanded) {
+                builder.ReplaceBB();
+            }
+        }
+    }
     return true;
 }
 
-// Helper for if-conversion.
+// Helper for if-conversion. If |negations| is given, the inverted factors
+// are shared through it rather than built once per use.
 IRStmt* BuildPredicateExpr(const Predicate<IRStmt*>& pred,
                            IRBB* bb,
-                           IRBBBuilder* builder) {
+                           IRBBBuilder* builder,
+                           map<IRStmt*, IRStmt*>* negations = nullptr) {
     vector<IRStmt*> term_values;
     for (auto& term : pred.Terms()) {
         vector<IRStmt*> factor_values;
         for (auto& factor : term.Factors()) {
             IRStmt* value = factor.first;
             bool polarity = factor.second;
-            if (!polarity)
+            if (!polarity && negations) {
+                IRStmt*& inverted = (*negations)[value];
+                if (!inverted) {
+                    inverted = builder->AddExpr(IRStmtOpNot, { value });
+                }
+                value = inverted;
+            } else if (!polarity) {
                 value = builder->AddExpr(IRStmtOpNot, { value });
+            }
             factor_values.push_back(value);
         }
         term_values.push_back(builder->BuildTree(IRStmtOpAnd, factor_values));
@@ -384,29 +609,52 @@ IRStmt* BuildPredicateExpr(const Predicate<IRStmt*>& pred,
     return value;
 }
 
+// Builds each distinct predicate once. With |minimize| set, predicates over
+// few enough factors are also minimized (see PredicateTable) and keyed by
+// their truth tables, so that predicates that reach the same function by
+// different paths through the CFG share one signal.
 class PredicateMemoizer {
  public:
-  PredicateMemoizer() {}
+  explicit PredicateMemoizer(bool minimize = false) : minimize_(minimize) {}
 
   IRStmt* GetPredStmt(IRBBBuilder* builder,
                       IRBB* bb,
                       const Predicate<IRStmt*>& pred) {
       auto i = stmts_.find(pred);
-      if (i == stmts_.end()) {
-          IRStmt* stmt = BuildPredicateExpr(pred, bb, builder);
-          stmts_.insert(make_pair(pred, stmt));
-          return stmt;
+      if (i != stmts_.end()) return i->second;
+
+      IRStmt* stmt = nullptr;
+      PredicateTable<IRStmt*> table;
+      if (minimize_ && PredicateTable<IRStmt*>::Build(pred, &table)) {
+          auto j = tables_.find(table);
+          if (j != tables_.end()) {
+              stmt = j->second;
+          } else {
+              Predicate<IRStmt*> minimized = table.Minimize();
+              stmt = BuildPredicateExpr(
+                      PredicateTable<IRStmt*>::Cost(minimized) <
+                      PredicateTable<IRStmt*>::Cost(pred) ? minimized : pred,
+                      bb, builder, &negations_);
+              tables_.insert(make_pair(table, stmt));
+          }
       } else {
-          return i->second;
+          stmt = BuildPredicateExpr(pred, bb, builder,
+                                    minimize_ ? &negations_ : nullptr);
       }
+      stmts_.insert(make_pair(pred, stmt));
+      return stmt;
   }
 
  private:
   typedef Predicate<IRStmt*> KeyType;
+  bool minimize_;
   map<KeyType, IRStmt*> stmts_;
+  map<PredicateTable<IRStmt*>, IRStmt*> tables_;
+  map<IRStmt*, IRStmt*> negations_;
 };
 
-IRStmt* BuildMuxTree(IRBBBuilder* builder,
+IRStmt* BuildMuxTree(PipeSys* sys,
+                     IRBBBuilder* builder,
                      const IRStmt* stmt,
                      PredicateMemoizer* memo) {
     assert(stmt->type == IRStmtPhi);
@@ -418,13 +666,31 @@ IRStmt* BuildMuxTree(IRBBBuilder* builder,
     // Compute pairs of (predicate, value) MUX inputs.
     vector<pair<Predicate<IRStmt*>, IRStmt*>> inputs;
     for (unsigned i = 0; i < stmt->args.size(); i++) {
-        Predicate<IRStmt*> pred_val = stmt->args[i]->valid_out_pred;
+        // Select on the predicate of the edge the value arrives along, not
+        // that of the value's definition: a value defined in a dominating BB
+        // (e.g. a variable left unchanged on one side of an if) is valid on
+        // every path, and would otherwise always win the select.
+        Predicate<IRStmt*> pred_val =
+            sys->LookupValidPreds(stmt->args[i]).out;
+        const IRBB* from = stmt->targets[i];
+        int which_succ = from->WhichSucc(stmt->bb);
+        if (which_succ >= 0 && which_succ < from->out_preds.size()) {
+            pred_val = from->out_preds[which_succ];
+        }
         // Sometimes predicate joins are smart enough to figure out that a
         // certain BB is unreachable...
         if (pred_val.IsFalse()) continue;
         inputs.push_back(make_pair(pred_val, stmt->args[i]));
     }
 
+    // ...and if every input arrives along such an edge, the phi's own BB is
+    // unreachable (e.g. the else-arm of a condition CSE has merged with an
+    // enclosing, identical one). Its value is never observed, so any value
+    // of the right width will do.
+    if (inputs.empty()) {
+        return builder->AddConst(stmt->width, 0);
+    }
+
     // Build layers of the tree.
     while (inputs.size() > 1) {
         vector<pair<Predicate<IRStmt*>, IRStmt*>> next;
@@ -440,22 +706,29 @@ IRStmt* BuildMuxTree(IRBBBuilder* builder,
                 // at the same place, the one from a later pipestage must also
                 // be 'killyounger', which will qualify/gate out the earlier
                 // backedge predicate).
-                Predicate<IRStmt*> sel_pred;
+                // The input whose predicate is chosen is the mux's 'true'
+                // arm.
+                int sel = i;
                 if (inputs[i].first.IsBackedge())
-                    sel_pred = inputs[i].first;
+                    sel = i;
                 else if (inputs[i+1].first.IsBackedge())
-                    sel_pred = inputs[i+1].first;
+                    sel = i + 1;
                 else if (inputs[i].first.IsTrue())
-                    sel_pred = inputs[i+1].first;
-                else
-                    sel_pred = inputs[i].first;
+                    sel = i + 1;
+                int other = (sel == i) ? i + 1 : i;
                 Predicate<IRStmt*> joined_pred = inputs[i].first.OrWith(inputs[i+1].first); // predicate on output
-                IRStmt* sel_input = memo->GetPredStmt(builder, stmt->bb, sel_pred);
+                IRStmt* sel_input = memo->GetPredStmt(builder, stmt->bb,
+                                                      inputs[sel].first);
                 assert(sel_input != nullptr);
                 IRStmt* mux = builder->AddExpr(IRStmtOpSelect,
                                                { sel_input,
-                                                 inputs[i].second,
-                                                 inputs[i+1].second });
+                                                 inputs[sel].second,
+                                                 inputs[other].second });
+                // The mux's value is used only where the phi's is, so it
+                // takes the phi's predicate (see PropagatePredicates()).
+                if (sys->program->propagate_predicates) {
+                    mux->valid_preds_slot = stmt->valid_preds_slot;
+                }
                 next.push_back(make_pair(joined_pred, mux));
             }
         }
@@ -476,10 +749,49 @@ IRStmt* FindReplacement(
     return FindReplacement(replacements, i->second);
 }
 
+// Begin a valid signal at each root of |pipe| that is not a restart: a
+// 'RestartValue' that codegen ties to constant 'true'.
+bool InsertEntryValids(IRProgram* program,
+                       PipeSys* sys,
+                       Pipe* pipe,
+                       ErrorCollector* coll) {
+    for (const auto* const_bb : pipe->roots) {
+        IRBB* bb = const_cast<IRBB*>(const_bb);
+        if (bb->restart_cond) continue;
+        IRStmt* entry_valid = PrependToVector(bb->stmts, program->NewStmt());
+        entry_valid->valnum = program->GetValnum();
+        entry_valid->bb = bb;
+        entry_valid->type = IRStmtRestartValue;
+        entry_valid->width = 1;
+        entry_valid->is_valid_start = true;
+        entry_valid->valid_spine = true;
+    }
+    return true;
+}
+
+// Give every statement of |sys| a slot in its valid-predicate table, in pipe
+// and statement order. Runs once all pipes' backedges are converted and
+// before any is if-converted; see PipeSys::valid_preds.
+bool AssignValidPredSlots(IRProgram* program,
+                          PipeSys* sys,
+                          ErrorCollector* coll) {
+    int slots = 0;
+    for (auto& pipe : sys->pipes) {
+        for (auto* bb : pipe->bbs) {
+            for (auto* stmt : bb->stmts) {
+                stmt->valid_preds_slot = slots++;
+            }
+        }
+    }
+    sys->valid_preds.assign(slots, StmtValidPreds());
+    return true;
+}
+
 // Perform if-conversion on statements, and place them in the statement list.
 bool IfConvert(IRProgram* program,
                PipeSys* sys,
                Pipe* pipe,
+               PredicateMemoizer* memo,
                ErrorCollector* coll) {
 
     // We perform "valid signal insertion" along all control-flow paths. A
@@ -498,19 +810,6 @@ bool IfConvert(IRProgram* program,
         bb->in_pred = Predicate<IRStmt*>::True();
     }
 
-    // For all existing roots that are not restarts, initialize predicate.
-    for (const auto* const_bb : pipe->roots) {
-        IRBB* bb = const_cast<IRBB*>(const_bb);
-        if (bb->restart_cond) continue;
-        IRStmt* entry_valid = PrependOwnedToVector(bb->stmts, new IRStmt());
-        entry_valid->valnum = program->GetValnum();
-        entry_valid->bb = bb;
-        entry_valid->type = IRStmtRestartValue;
-        entry_valid->width = 1;
-        entry_valid->is_valid_start = true;
-        entry_valid->valid_spine = true;
-    }
-    
     // For all 'valid start' entries, initialize predicate.
     for (auto* bb : pipe->bbs) {
         for (auto& stmt : bb->stmts) {
@@ -520,18 +819,18 @@ bool IfConvert(IRProgram* program,
                 // practice, this is a 'RestartValue' stmt that gets linked to
                 // a RestartValueSrc for restart headers or constant 'true' for
                 // entry points.
-                stmt->valid_out_pred = Predicate<IRStmt*>::True().AndWith(stmt.get(), true);
+                auto& preds = sys->ValidPreds(stmt);
+                preds.out = Predicate<IRStmt*>::True().AndWith(stmt, true);
                 // Backedge flag on predicate prioritizes it in MUX-tree select
                 // generation.
-                if (bb->restart_cond) stmt->valid_out_pred.SetBackedge();
+                if (bb->restart_cond) preds.out.SetBackedge();
             }
         }
     }
 
     // Do a forward pass, propagating predicate across statements and
     // performing joins at each bb-in.
-    BBReversePostorder rpo;
-    rpo.Compute(pipe->roots);
+    const BBReversePostorder& rpo = pipe->analyses.RPO(pipe->roots);
     for (auto* _bb : rpo.RPO()) {
         IRBB* bb = const_cast<IRBB*>(_bb);
 
@@ -551,38 +850,39 @@ bool IfConvert(IRProgram* program,
         }
 
         // Propagate valid signal across statements.
-        for (auto& stmt : bb->stmts) {
+        for (auto* stmt : bb->stmts) {
+            auto& preds = sys->ValidPreds(stmt);
             // Propagate last stmt's out to this stmt's in.
-            stmt->valid_in_pred = in_pred;
+            preds.in = in_pred;
             // Transfer func: branches, kills, and 'starts' are special.
             if (stmt->is_valid_start) {
                 // Already set above.
             } else if (stmt->type == IRStmtKill) {
-                stmt->valid_out_pred = Predicate<IRStmt*>::False();
+                preds.out = Predicate<IRStmt*>::False();
             } else if (stmt->type == IRStmtKillIf) {
                 // KillIf kills immediately (in this stage) and is also
                 // replicated downstream at each successive pipestage, after
                 // pipe timing occurs, to create the "continuous monitoring"
                 // semantics. Here we just need to create a predicate that is
                 // gated by the inverse of its arg.
-                stmt->valid_out_pred =
-                    stmt->valid_in_pred.AndWith(stmt->args[0], false);
+                preds.out = preds.in.AndWith(stmt->args[0], false);
             } else {
-                stmt->valid_out_pred = stmt->valid_in_pred;
+                preds.out = preds.in;
             }
-            in_pred = stmt->valid_out_pred;
+            in_pred = preds.out;
         }
 
         // Compute out-valids to all targets.
         const IRStmt* succ = bb->SuccStmt();
         if (succ != NULL) {
+            const auto& succ_out = sys->ValidPreds(succ).out;
             if (succ->type == IRStmtJmp) {
-                bb->out_preds.push_back(succ->valid_out_pred);
+                bb->out_preds.push_back(succ_out);
             } else if (succ->type == IRStmtIf) {
                 bb->out_preds.push_back(
-                        succ->valid_out_pred.AndWith(succ->args[0], true));
+                        succ_out.AndWith(succ->args[0], true));
                 bb->out_preds.push_back(
-                        succ->valid_out_pred.AndWith(succ->args[0], false));
+                        succ_out.AndWith(succ->args[0], false));
             }
         }
     }
@@ -590,19 +890,18 @@ bool IfConvert(IRProgram* program,
 
     // Now do a pass over all preds and convert to concrete valid signals,
     // inserting valid-signal computation logic where necessary.
-    PredicateMemoizer memo;
     for (auto* _bb : rpo.RPO()) {
         IRBB* bb = const_cast<IRBB*>(_bb);
         unique_ptr<IRBBBuilder> builder(new IRBBBuilder(program, bb));
-        bb->in_valid = memo.GetPredStmt(builder.get(), bb, bb->in_pred);
-        for (auto& stmt : bb->stmts) {
-            IRStmt* s = stmt.get();
-            s->valid_in = memo.GetPredStmt(builder.get(), bb, s->valid_in_pred);
-            builder->AddStmt(move(stmt));
-            s->valid_out = memo.GetPredStmt(builder.get(), bb, s->valid_out_pred);
+        bb->in_valid = memo->GetPredStmt(builder.get(), bb, bb->in_pred);
+        for (auto* s : bb->stmts) {
+            const auto& preds = sys->ValidPreds(s);
+            s->valid_in = memo->GetPredStmt(builder.get(), bb, preds.in);
+            builder->Add(s);
+            s->valid_out = memo->GetPredStmt(builder.get(), bb, preds.out);
         }
         for (auto& out_pred : bb->out_preds) {
-            bb->out_valids.push_back(memo.GetPredStmt(builder.get(), bb, out_pred));
+            bb->out_valids.push_back(memo->GetPredStmt(builder.get(), bb, out_pred));
         }
         builder->ReplaceBB();
     }
@@ -612,11 +911,23 @@ bool IfConvert(IRProgram* program,
     for (auto* bb : pipe->bbs) {
         if (bb->restart_pred_src) {
             bb->restart_pred_src->args.push_back(bb->restart_pred_src->valid_in);
-            bb->restart_pred_src->arg_nums.push_back(bb->restart_pred_src->valid_in->valnum);
+            // The source *is* the backedge's valid, so it is latched every
+            // cycle rather than only when valid; otherwise the restart valid
+            // would stay set after the loop exits.
+            bb->restart_pred_src->valid_in = nullptr;
         }
     }
 
-    // Make a pass to propagate valid_spine bits.
+    return true;
+}
+
+// Propagate valid_spine bits from the valid-signal roots to everything
+// computed from them. Args may be defined in ancestor pipes, so this must run
+// after those pipes have been if-converted.
+bool PropagateValidSpine(IRProgram* program,
+                         PipeSys* sys,
+                         Pipe* pipe,
+                         ErrorCollector* coll) {
     bool changed_valid_spine = true;
     while (changed_valid_spine) {
         changed_valid_spine = false;
@@ -638,14 +949,22 @@ bool IfConvert(IRProgram* program,
         }
     }
 
-    // Now convert all phi-nodes to MUXes.
+    return true;
+}
+
+// Convert all phi-nodes to MUXes selected by the valid predicates computed in
+// IfConvert(), sharing its predicate memo.
+bool ConvertPhis(IRProgram* program,
+                 PipeSys* sys,
+                 Pipe* pipe,
+                 PredicateMemoizer* memo,
+                 ErrorCollector* coll) {
     map<const IRStmt*, IRStmt*> replacements;
     for (auto* bb : pipe->bbs) {
         unique_ptr<IRBBBuilder> builder(new IRBBBuilder(program, bb));
         for (auto& stmt : bb->stmts) {
             if (stmt->type != IRStmtPhi) continue;
-            replacements[stmt.get()] = BuildMuxTree(builder.get(), stmt.get(),
-                                                    &memo);
+            replacements[stmt] = BuildMuxTree(sys, builder.get(), stmt, memo);
         }
         builder->PrependToBB();
     }
@@ -654,17 +973,16 @@ bool IfConvert(IRProgram* program,
         for (auto& stmt : bb->stmts) {
             for (unsigned i = 0; i < stmt->args.size(); i++) {
                 stmt->args[i] = FindReplacement(replacements, stmt->args[i]);
-                stmt->arg_nums[i] = stmt->args[i]->valnum;
             }
         }
     }
 
     // Remove phi nodes.
     for (auto* bb : pipe->bbs) {
-        vector<unique_ptr<IRStmt>> stmts;
-        for (auto& stmt : bb->stmts) {
+        vector<IRStmt*> stmts;
+        for (auto* stmt : bb->stmts) {
             if (stmt->type == IRStmtPhi) continue;
-            stmts.push_back(move(stmt));
+            stmts.push_back(stmt);
         }
         bb->stmts.swap(stmts);
         stmts.clear();
@@ -682,8 +1000,7 @@ bool BuildPipeDAG(IRProgram* program,
                   PipeSys* sys,
                   Pipe* pipe,
                   ErrorCollector* coll) {
-    BBReversePostorder rpo;
-    rpo.Compute( { pipe->entry } );
+    const BBReversePostorder& rpo = pipe->analyses.RPO({ pipe->entry });
 
     // Map per block of outgoing side-effect spine. This is set of last
     // side-effecting ops that were seen on this block's postdom frontier,
@@ -733,7 +1050,7 @@ bool BuildPipeDAG(IRProgram* program,
                 } else {
                     stmt->pipedag_deps = timing_barriers;
                 }
-                pure_ops.push_back(stmt.get());
+                pure_ops.push_back(stmt);
                 continue;
             }
             if (stmt->type == IRStmtIf || stmt->type == IRStmtJmp) continue;
@@ -742,9 +1059,9 @@ bool BuildPipeDAG(IRProgram* program,
             } else {
                 stmt->pipedag_deps.push_back(last);
             }
-            last = stmt.get();
+            last = stmt;
             if (stmt->type == IRStmtTimingBarrier) {
-                last_timing_barrier = stmt.get();
+                last_timing_barrier = stmt;
                 for (auto* op : pure_ops) {
                     stmt->pipedag_deps.push_back(op);
                 }
@@ -789,8 +1106,6 @@ bool FlattenPipe(IRProgram* program,
                  ErrorCollector* coll) {
     // Remove all terminators and phi-nodes from BBs, and flatten stmts into
     // one list for the pipe.
-    BBReversePostorder rpo;
-    rpo.Compute(pipe->roots);
     for (auto* bb : pipe->bbs) {
         for (auto& stmt : bb->stmts) {
             switch (stmt->type) {
@@ -798,7 +1113,7 @@ bool FlattenPipe(IRProgram* program,
                 case IRStmtJmp:
                     break;
                 default:
-                    pipe->stmts.push_back(stmt.get());
+                    pipe->stmts.push_back(stmt);
                     stmt->pipe = pipe;
             }
         }
@@ -807,6 +1122,9 @@ bool FlattenPipe(IRProgram* program,
     return true;
 }
 
+// Label prefix of BBs holding cloned kill_if slices.
+const char* kClonedKillIfSlicePrefix = "__cloned_kill_if_slice_";
+
 // DFS usd to extract slice.
 void DoExtractSlice(IRStmt* stmt,
                     set<IRStmt*>* seen,
@@ -860,8 +1178,8 @@ IRStmt* CloneKillIfSlice(IRProgram* program,
     map<IRStmt*, IRStmt*> replace_map;
     unique_ptr<IRBB> _cloned_bb(new IRBB());
     IRBB* cloned_bb = _cloned_bb.get();
-    program->bbs.push_back(move(_cloned_bb));
-    cloned_bb->label = strprintf("__cloned_kill_if_slice_%d",
+    program->AddBB(move(_cloned_bb));
+    cloned_bb->label = strprintf("%s%d", kClonedKillIfSlicePrefix,
                                  program->GetValnum());
     IRStmt* cloned_condition = nullptr;
     for (auto* stmt : stmts) {
@@ -871,12 +1189,12 @@ IRStmt* CloneKillIfSlice(IRProgram* program,
             cloned_condition = stmt->args[0];
             continue;
         }
-        unique_ptr<IRStmt> cloned_stmt(new IRStmt(*stmt));
+        IRStmt* cloned_stmt = program->NewStmt(*stmt);
         cloned_stmt->valnum = program->GetValnum();
         cloned_stmt->bb = cloned_bb;
         cloned_stmt->stage = nullptr;  // filled in by caller later.
-        replace_map[stmt] = cloned_stmt.get();
-        cloned_bb->stmts.push_back(move(cloned_stmt));
+        replace_map[stmt] = cloned_stmt;
+        cloned_bb->stmts.push_back(cloned_stmt);
     }
 
     // Make a pass to replace args.
@@ -887,7 +1205,6 @@ IRStmt* CloneKillIfSlice(IRProgram* program,
             // the cloned statement set. Thus this lookup should never fail.
             assert(it != replace_map.end());
             stmt->args[i] = it->second;
-            stmt->arg_nums[i] = it->second->valnum;
         }
     }
     assert(replace_map.find(cloned_condition) != replace_map.end());
@@ -917,6 +1234,18 @@ vector<PipeStage*> KillIfDownstreamStages(IRStmt* kill_if_stmt) {
     return ret;
 }
 
+// Places a slice cloned by CloneKillIfSlice() in the given stage.
+void PlaceKillIfSlice(IRStmt* kill_if_stmt, IRBB* cloned_bb,
+                      PipeStage* stage) {
+    for (auto* stmt : cloned_bb->stmts) {
+        stmt->stage = stage;
+        stmt->pipe = stage->pipe;
+        stmt->valid_in = kill_if_stmt->valid_in;
+        stage->pipe->stmts.push_back(stmt);
+        stage->stmts.push_back(stmt);
+    }
+}
+
 bool PropagateKillIfDownstream(IRProgram* program,
                                PipeSys* sys,
                                IRStmt* kill_if_stmt,
@@ -952,37 +1281,57 @@ bool PropagateKillIfDownstream(IRProgram* program,
 
     // Determine the set of pipes we propagate across: this pipe and any children.
     
+    //
+    // With share_kill_if_slices, the condition is instead cloned once, into
+    // the kill_if's own stage, and each downstream stage's kill reads that
+    // clone's result directly. The slice depends only on the current port
+    // values, so every per-stage clone would compute the same value in a
+    // given cycle anyway; the shared value is marked unstaged so that it
+    // fans out combinationally rather than through (stale) piperegs.
+
     auto downstream_stages = KillIfDownstreamStages(kill_if_stmt);
+    IRBB* shared_bb = nullptr;
+    IRStmt* shared_arg = nullptr;
+    if (program->share_kill_if_slices && !downstream_stages.empty()) {
+        shared_arg = CloneKillIfSlice(program, sys, kill_if_stmt, &shared_bb,
+                                      coll);
+        if (!shared_arg) {
+            return false;
+        }
+        PlaceKillIfSlice(kill_if_stmt, shared_bb, kill_if_stmt->stage);
+        shared_arg->unstaged = true;
+    }
     for (auto* stage : downstream_stages) {
-        IRBB* cloned_bb;
-        IRStmt* arg = CloneKillIfSlice(program, sys, kill_if_stmt, &cloned_bb, coll);
-        for (auto& stmt : cloned_bb->stmts) {
-            stmt->stage = stage;
-            stmt->pipe = stage->pipe;
-            stmt->valid_in = kill_if_stmt->valid_in;
-            stage->pipe->stmts.push_back(stmt.get());
-            stage->stmts.push_back(stmt.get());
+        IRBB* cloned_bb = shared_bb;
+        IRStmt* arg = shared_arg;
+        if (!arg) {
+            arg = CloneKillIfSlice(program, sys, kill_if_stmt, &cloned_bb,
+                                   coll);
+            if (!arg) {
+                return false;
+            }
+            PlaceKillIfSlice(kill_if_stmt, cloned_bb, stage);
         }
 
         // Add an AND: kill_if's valid_in & cloned kill_if arg.
-        unique_ptr<IRStmt> kill_cond(new IRStmt());
+        IRStmt* kill_cond = program->NewStmt();
         kill_cond->type = IRStmtExpr;
         kill_cond->op = IRStmtOpAnd;
         kill_cond->valnum = program->GetValnum();
+        kill_cond->width = 1;
         kill_cond->bb = cloned_bb;
         kill_cond->stage = stage;
         kill_cond->pipe = stage->pipe;
 
         kill_cond->args.push_back(arg);
-        kill_cond->arg_nums.push_back(arg->valnum);
         kill_cond->args.push_back(kill_if_stmt->valid_in);
-        kill_cond->arg_nums.push_back(kill_if_stmt->valid_in->valnum);
+        kill_cond->location = kill_if_stmt->location;
 
-        stage->kills.push_back(kill_cond.get());
+        stage->kills.push_back(kill_cond);
 
-        stage->pipe->stmts.push_back(kill_cond.get());
-        stage->stmts.push_back(kill_cond.get());
-        cloned_bb->stmts.push_back(move(kill_cond));
+        stage->pipe->stmts.push_back(kill_cond);
+        stage->stmts.push_back(kill_cond);
+        cloned_bb->stmts.push_back(kill_cond);
     }
 
     return true;
@@ -1021,43 +1370,430 @@ bool InsertKillIfKills(IRProgram* program,
     return true;
 }
 
-// Creates a RestartValue / RestartValueSrc pair to port a signal across
-// stages.
-IRStmt* CreateNonStagedLink(IRProgram* prog, PipeStage* src_stage,
-                            IRStmt* src_value, PipeStage* consumer_stage) {
-    if (src_stage->stage == consumer_stage->stage) {
-        return src_value;
+bool IsConstExpr(const IRStmt* stmt) {
+    return stmt->type == IRStmtExpr && stmt->op == IRStmtOpConst;
+}
+
+void MakeConstExpr(IRStmt* stmt, const bignum& value) {
+    stmt->op = IRStmtOpConst;
+    stmt->args.clear();
+    stmt->constant = value & ((bignum(1) << stmt->width) - 1);
+    stmt->has_constant = true;
+}
+
+// Collects the values known wherever |pred| holds: those of the factors
+// common to all of its terms, and what they imply in turn (the args of a true
+// AND or a false OR, the arg of a NOT, and the value that a decided equality
+// compares against a constant).
+void CollectPredicateFacts(const Predicate<IRStmt*>& pred,
+                           map<const IRStmt*, bignum>* facts) {
+    map<IRStmt*, bool, FactorLess<IRStmt*>> common;
+    bool first = true;
+    for (auto& term : pred.Terms()) {
+        map<IRStmt*, bool, FactorLess<IRStmt*>> factors(
+                term.Factors().begin(), term.Factors().end());
+        if (first) {
+            common.swap(factors);
+            first = false;
+            continue;
+        }
+        for (auto it = common.begin(); it != common.end();) {
+            auto f = factors.find(it->first);
+            if (f == factors.end() || f->second != it->second) {
+                it = common.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    vector<pair<IRStmt*, bignum>> work;
+    for (auto& p : common) {
+        work.push_back(make_pair(p.first, bignum(p.second ? 1 : 0)));
+    }
+    while (!work.empty()) {
+        IRStmt* stmt = work.back().first;
+        bignum value = work.back().second;
+        work.pop_back();
+        if (facts->count(stmt)) continue;
+        (*facts)[stmt] = value;
+        if (stmt->type != IRStmtExpr || stmt->width != 1) continue;
+        bool truth = value != 0;
+        switch (stmt->op) {
+            case IRStmtOpNot:
+                work.push_back(make_pair(stmt->args[0],
+                                         bignum(truth ? 0 : 1)));
+                break;
+            case IRStmtOpAnd:
+            case IRStmtOpOr:
+                if (truth == (stmt->op == IRStmtOpAnd)) {
+                    for (auto* arg : stmt->args) {
+                        work.push_back(make_pair(arg, value));
+                    }
+                }
+                break;
+            case IRStmtOpCmpEQ:
+            case IRStmtOpCmpNE:
+                if (truth == (stmt->op == IRStmtOpCmpEQ) &&
+                    stmt->args[0]->width == stmt->args[1]->width) {
+                    for (int i = 0; i < 2; i++) {
+                        if (IsConstExpr(stmt->args[1 - i])) {
+                            work.push_back(make_pair(
+                                        stmt->args[i],
+                                        stmt->args[1 - i]->constant));
+                        }
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Simplifies the expression |stmt| given the values in |facts|: folds it to a
+// constant, or records in |replacements| the arg that it reduces to. Returns
+// true if it was simplified.
+bool SimplifyUnderFacts(IRStmt* stmt,
+                        const map<const IRStmt*, bignum>& facts,
+                        map<IRStmt*, IRStmt*>* replacements) {
+    vector<const bignum*> known;
+    bool all_known = true;
+    for (auto* arg : stmt->args) {
+        const bignum* value = nullptr;
+        if (IsConstExpr(arg)) {
+            value = &arg->constant;
+        } else {
+            auto it = facts.find(arg);
+            if (it != facts.end()) value = &it->second;
+        }
+        known.push_back(value);
+        if (!value) all_known = false;
+    }
+
+    if (stmt->op == IRStmtOpSelect) {
+        if (!known[0]) return false;
+        int chosen = *known[0] != 0 ? 1 : 2;
+        if (known[chosen]) {
+            MakeConstExpr(stmt, *known[chosen]);
+        } else {
+            (*replacements)[stmt] = stmt->args[chosen];
+        }
+        return true;
+    }
+
+    if (all_known && !stmt->args.empty()) {
+        vector<bignum> values;
+        for (auto* value : known) values.push_back(*value);
+        bignum result;
+        if (!IRFoldExpr(stmt, values, &result)) return false;
+        MakeConstExpr(stmt, result);
+        return true;
+    }
+
+    // An AND with a zero arg or an OR with an all-ones arg is decided; args
+    // that are otherwise all-ones (AND) or zero (OR) drop out.
+    if (stmt->op == IRStmtOpAnd || stmt->op == IRStmtOpOr) {
+        bignum mask = (bignum(1) << stmt->width) - 1;
+        bignum decides = stmt->op == IRStmtOpAnd ? bignum(0) : mask;
+        bignum neutral = stmt->op == IRStmtOpAnd ? mask : bignum(0);
+        IRStmt* rest = nullptr;
+        int unknown = 0;
+        for (unsigned i = 0; i < stmt->args.size(); i++) {
+            if (!known[i]) {
+                rest = stmt->args[i];
+                unknown++;
+                continue;
+            }
+            bignum value = *known[i] & mask;
+            if (value == decides) {
+                MakeConstExpr(stmt, decides);
+                return true;
+            }
+            if (value != neutral) return false;
+        }
+        if (unknown == 1 && rest->width == stmt->width) {
+            (*replacements)[stmt] = rest;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Simplifies logic using what each statement's valid predicate implies, and
+// removes logic that can never be valid. This runs over the flattened
+// statements of all pipes of the PipeSys, after if-conversion and before
+// timing, so that the removed logic is neither timed nor staged.
+//
+// A value matters only while its statement's predicate holds: its uses are
+// dominated by it (or, across a spawn, run only if it did), so their
+// predicates imply its one. Within a statement, then, each factor common to
+// all terms of its predicate is known, as are the values that factor implies
+// (see CollectPredicateFacts()), and the statement may be evaluated with those
+// in place of its args. A valid signal that uses the simplified value is still
+// correct, since the predicate under which the value was simplified qualifies
+// every term that uses it. The exception is a kill_if condition, which is
+// evaluated anew in every later stage (see PropagateKillIfDownstream()), so
+// kill_if slices are left alone.
+//
+// Register and array writes whose predicate is false are removed (unless they
+// are the storage's only writers), as are expressions left with no uses.
+bool PropagatePredicates(IRProgram* program,
+                         PipeSys* sys,
+                         ErrorCollector* coll) {
+    set<IRStmt*> kill_if_slices;
+    for (auto& pipe : sys->pipes) {
+        for (auto* stmt : pipe->stmts) {
+            if (stmt->type == IRStmtKillIf) {
+                vector<IRStmt*> slice;
+                DoExtractSlice(stmt, &kill_if_slices, &slice);
+            }
+        }
+    }
+
+    map<IRStmt*, IRStmt*> replacements;
+    auto leader = [&replacements](IRStmt* stmt) {
+        while (true) {
+            auto it = replacements.find(stmt);
+            if (it == replacements.end()) return stmt;
+            stmt = it->second;
+        }
+    };
+    map<const IRStmt*, map<const IRStmt*, bignum>> facts;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& pipe : sys->pipes) {
+            for (auto* stmt : pipe->stmts) {
+                for (auto*& arg : stmt->args) {
+                    arg = leader(arg);
+                }
+                if (stmt->type != IRStmtExpr || stmt->valid_spine ||
+                    stmt->op == IRStmtOpConst || stmt->op == IRStmtOpNone ||
+                    stmt->width <= 0 || stmt->timevar ||
+                    kill_if_slices.count(stmt) || replacements.count(stmt)) {
+                    continue;
+                }
+                // Statements built during lowering have no predicate (and
+                // an empty, i.e. false, entry), other than phi muxes.
+                const auto& pred = sys->LookupValidPreds(stmt).in;
+                if (pred.IsFalse()) continue;
+                auto it = facts.find(stmt);
+                if (it == facts.end()) {
+                    it = facts.insert(make_pair(
+                                stmt, map<const IRStmt*, bignum>())).first;
+                    CollectPredicateFacts(pred, &it->second);
+                }
+                if (SimplifyUnderFacts(stmt, it->second, &replacements)) {
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    set<const IRStmt*> removed;
+    for (auto& pipe : sys->pipes) {
+        for (auto* stmt : pipe->stmts) {
+            if (IRWritesStorage(stmt->type) && stmt->valid_in &&
+                stmt->storage->writers.size() > 1 &&
+                sys->LookupValidPreds(stmt).in.IsFalse()) {
+                removed.insert(stmt);
+            }
+        }
+    }
+
+    // Remove expressions with no uses (other than by the writes removed
+    // above), transitively.
+    map<const IRStmt*, int> use_count;
+    auto use = [&use_count](const IRStmt* stmt) {
+        if (stmt) use_count[stmt]++;
+    };
+    for (auto& pipe : sys->pipes) {
+        for (auto* bb : pipe->bbs) {
+            use(bb->in_valid);
+            for (auto* valid : bb->out_valids) use(valid);
+        }
+        for (auto* stmt : pipe->stmts) {
+            if (removed.count(stmt)) continue;
+            for (auto* arg : stmt->args) use(arg);
+            use(stmt->valid_in);
+            use(stmt->valid_out);
+            use(stmt->restart_arg);
+        }
+    }
+    auto is_dead = [&use_count](const IRStmt* stmt) {
+        return stmt->type == IRStmtExpr && !stmt->timevar &&
+               use_count[stmt] == 0;
+    };
+    vector<const IRStmt*> work;
+    for (auto& pipe : sys->pipes) {
+        for (auto* stmt : pipe->stmts) {
+            if (is_dead(stmt)) work.push_back(stmt);
+        }
+    }
+    while (!work.empty()) {
+        const IRStmt* stmt = work.back();
+        work.pop_back();
+        if (!removed.insert(stmt).second) continue;
+        for (auto* arg : stmt->args) {
+            if (--use_count[arg] == 0 && is_dead(arg)) {
+                work.push_back(arg);
+            }
+        }
+        for (auto* valid : { stmt->valid_in, stmt->valid_out }) {
+            if (valid && --use_count[valid] == 0 && is_dead(valid)) {
+                work.push_back(valid);
+            }
+        }
+    }
+    if (removed.empty()) return true;
+
+    // Drop the removed statements, passing their dependences on to the
+    // statements that depended on them.
+    function<void(IRStmt*, set<IRStmt*>*, vector<IRStmt*>*)> add_deps =
+        [&](IRStmt* dep, set<IRStmt*>* seen, vector<IRStmt*>* deps) {
+            if (!seen->insert(dep).second) return;
+            if (!removed.count(dep)) {
+                deps->push_back(dep);
+                return;
+            }
+            for (auto* d : dep->pipedag_deps) add_deps(d, seen, deps);
+        };
+    for (auto& pipe : sys->pipes) {
+        vector<IRStmt*> kept;
+        for (auto* stmt : pipe->stmts) {
+            if (removed.count(stmt)) {
+                stmt->deleted = true;
+                continue;
+            }
+            kept.push_back(stmt);
+            set<IRStmt*> seen;
+            vector<IRStmt*> deps;
+            for (auto* dep : stmt->pipedag_deps) add_deps(dep, &seen, &deps);
+            stmt->pipedag_deps.swap(deps);
+        }
+        pipe->stmts.swap(kept);
+        for (auto* bb : pipe->bbs) {
+            bb->stmts.erase(remove_if(bb->stmts.begin(), bb->stmts.end(),
+                                      [&removed](const IRStmt* stmt) {
+                                          return removed.count(stmt) > 0;
+                                      }),
+                            bb->stmts.end());
+        }
     }
 
+    return true;
+}
+
+// Creates a RestartValue / RestartValueSrc pair to port a signal to another
+// stage through one latch: the consumer sees the value the source had in the
+// prior cycle, even if both are in the same stage.
+IRStmt* CreateLatchedLink(IRProgram* prog, PipeStage* src_stage,
+                          IRStmt* src_value, PipeStage* consumer_stage) {
     IRStmt* ret;
-    unique_ptr<IRStmt> restart_value(new IRStmt());
+    IRStmt* restart_value = prog->NewStmt();
     restart_value->valnum = prog->GetValnum();
     restart_value->type = IRStmtRestartValue;
     restart_value->width = src_value->width;
-    ret = restart_value.get();
+    ret = restart_value;
     restart_value->pipe = consumer_stage->pipe;
     restart_value->stage = consumer_stage;
-    restart_value->pipe->stmts.push_back(restart_value.get());
-    restart_value->stage->stmts.push_back(restart_value.get());
-    restart_value->stage->owned_stmts.push_back(move(restart_value));
+    restart_value->pipe->stmts.push_back(restart_value);
+    restart_value->stage->stmts.push_back(restart_value);
 
-    unique_ptr<IRStmt> restart_value_src(new IRStmt());
-    ret->restart_arg = restart_value_src.get();
+    IRStmt* restart_value_src = prog->NewStmt();
+    ret->restart_arg = restart_value_src;
     restart_value_src->valnum = prog->GetValnum();
     restart_value_src->type = IRStmtRestartValueSrc;
     restart_value_src->width = src_value->width;
     restart_value_src->args.push_back(src_value);
-    restart_value_src->arg_nums.push_back(src_value->valnum);
     restart_value_src->pipe = src_stage->pipe;
     restart_value_src->stage = src_stage;
-    restart_value_src->pipe->stmts.push_back(restart_value_src.get());
-    restart_value_src->stage->stmts.push_back(restart_value_src.get());
-    restart_value_src->stage->owned_stmts.push_back(move(restart_value_src));
+    restart_value_src->pipe->stmts.push_back(restart_value_src);
+    restart_value_src->stage->stmts.push_back(restart_value_src);
 
 
     return ret;
 }
 
+// Creates a RestartValue / RestartValueSrc pair to port a signal across
+// stages.
+IRStmt* CreateNonStagedLink(IRProgram* prog, PipeStage* src_stage,
+                            IRStmt* src_value, PipeStage* consumer_stage) {
+    if (src_stage->stage == consumer_stage->stage) {
+        return src_value;
+    }
+    return CreateLatchedLink(prog, src_stage, src_value, consumer_stage);
+}
+
+// Creates an expression in |stage| with no BB, as the lowering passes from
+// here on do, and adds it to the stage's and pipe's statements.
+IRStmt* AddStageExpr(IRProgram* program, PipeStage* stage, IRStmtOp op,
+                     int width, const vector<IRStmt*>& args) {
+    IRStmt* stmt = program->NewStmt();
+    stmt->valnum = program->GetValnum();
+    stmt->type = IRStmtExpr;
+    stmt->op = op;
+    stmt->width = width;
+    stmt->args = args;
+    stmt->pipe = stage->pipe;
+    stmt->stage = stage;
+    stmt->pipe->stmts.push_back(stmt);
+    stmt->stage->stmts.push_back(stmt);
+    return stmt;
+}
+
+IRStmt* AddStageConst(IRProgram* program, PipeStage* stage, int width) {
+    IRStmt* stmt = AddStageExpr(program, stage, IRStmtOpConst, width, {});
+    stmt->constant = 0;
+    stmt->has_constant = true;
+    return stmt;
+}
+
+// As IRBBBuilder::BuildTree(), but with AddStageExpr().
+IRStmt* BuildStageTree(IRProgram* program, PipeStage* stage, IRStmtOp op,
+                       const vector<IRStmt*>& args) {
+    if (args.size() == 0) return nullptr;
+    if (args.size() == 1) return args[0];
+    vector<IRStmt*> layer;
+    for (unsigned i = 0; i < args.size(); i += 2) {
+        if (i == args.size() - 1) {
+            layer.push_back(args[i]);
+        } else {
+            layer.push_back(AddStageExpr(program, stage, op,
+                        args[i]->width, { args[i], args[i+1] }));
+        }
+    }
+    return BuildStageTree(program, stage, op, layer);
+}
+
+// Merges (valid, value) pairs of writes whose predicates do not overlap into
+// the value written, in |stage|. At most one of them is valid: with three or
+// more, each value is ANDed with its valid and the results are ORed together
+// in a balanced tree, log2(N) deep rather than a chain of N selects.
+IRStmt* MergeDisjointWrites(IRProgram* program, PipeStage* stage,
+                            const vector<pair<IRStmt*, IRStmt*>>& writes) {
+    if (writes.size() == 1) {
+        // Nothing to OR with, so the value need not be gated.
+        return writes[0].second;
+    }
+    if (writes.size() == 2) {
+        // One select is as shallow as an AND-OR pair, and smaller.
+        return AddStageExpr(program, stage, IRStmtOpSelect,
+                writes[1].second->width,
+                { writes[1].first, writes[1].second, writes[0].second });
+    }
+    vector<IRStmt*> gated_values;
+    for (auto& write : writes) {
+        int width = write.second->width;
+        gated_values.push_back(AddStageExpr(program, stage,
+                    IRStmtOpSelect, width,
+                    { write.first, write.second,
+                      AddStageConst(program, stage, width) }));
+    }
+    return BuildStageTree(program, stage, IRStmtOpOr, gated_values);
+}
+
 bool ConvertSingleWrites(IRProgram* program,
                          PipeSys* sys,
                          ErrorCollector* coll) {
@@ -1079,7 +1815,10 @@ bool ConvertSingleWrites(IRProgram* program,
         {}
     };
 
-    map<void*, WrittenObj> written_objs;
+    // Kept in first-write (pipe/statement) order so that the generated logic
+    // does not depend on where the ports and storage landed in memory.
+    vector<pair<void*, WrittenObj>> written_objs;
+    map<void*, size_t> written_obj_index;
 
     for (auto& pipe : sys->pipes) {
         for (auto* stmt : pipe->stmts) {
@@ -1106,7 +1845,9 @@ bool ConvertSingleWrites(IRProgram* program,
             }
 
             if (written_obj) {
-                auto it = written_objs.find(written_obj);
+                auto idx = written_obj_index.find(written_obj);
+                auto it = (idx != written_obj_index.end()) ?
+                    written_objs.begin() + idx->second : written_objs.end();
                 // Do we already have a record of this written object? If so,
                 // compare stage number (verify it's the same as other writers)
                 // and add ourselves to the list of writers.
@@ -1156,7 +1897,8 @@ bool ConvertSingleWrites(IRProgram* program,
                     record.port = port;
                     record.storage = storage;
                     record.stmts.push_back(stmt);
-                    written_objs.insert(make_pair(written_obj, record));
+                    written_obj_index[written_obj] = written_objs.size();
+                    written_objs.push_back(make_pair(written_obj, record));
                 }
             }
         }
@@ -1227,13 +1969,16 @@ bool ConvertSingleWrites(IRProgram* program,
         for (auto* stmt : p.second.stmts) {
             for (auto* other : p.second.stmts) {
                 if (stmt == other) continue;
+                // Lanes issue separate transactions; their writes are
+                // ordered below rather than exclusive.
+                if (stmt->pipe->lane != other->pipe->lane) continue;
                 if ((stmt->dom_killyounger &&
                      stmt->dom_killyounger->stage->stage == stmt->stage->stage) ||
                     (other->dom_killyounger &&
                      other->dom_killyounger->stage->stage == other->stage->stage))
                     continue;
-                if (!stmt->valid_in_pred.AndWith(
-                            other->valid_in_pred).IsFalse()) {
+                if (!sys->LookupValidPreds(stmt).in.AndWith(
+                            sys->LookupValidPreds(other).in).IsFalse()) {
                     coll->ReportError(other->location, ErrorCollector::ERROR,
                             "Two writes to one port/chan/reg have overlapping "
                             "predicates. Only one write may occur on a given "
@@ -1244,73 +1989,84 @@ bool ConvertSingleWrites(IRProgram* program,
         }
     }
 
-    // Now, for each written object with more than one writer, generate a
-    // sequence of select operations and rewrite the source of the write.
+    // Now, for each written object with more than one writer, merge the
+    // written values and rewrite the source of the write (see
+    // MergeDisjointWrites() for the ordinary writes of one lane). Writes by
+    // the lanes of a multi-lane pipe in the same cycle take effect in lane
+    // order, so each lane's value takes priority over the older lanes' with a
+    // select. Killing writes may overlap the others, so each one takes
+    // priority over those before it with a select, as before.
     for (auto& p : written_objs) {
         if (p.second.stmts.size() < 2) continue;
         PipeStage* write_stage = p.second.write_stage;
-        // Wire up the sels and valid-signal combining ORs.
-        IRStmt* last_sel = nullptr;
-        IRStmt* last_or = nullptr;
-        for (unsigned i = 0; i < p.second.stmts.size() - 1; i++) {
-            unique_ptr<IRStmt> sel(new IRStmt());
-            sel->valnum = program->GetValnum();
-            sel->type = IRStmtExpr;
-            sel->op = IRStmtOpSelect;
-            sel->pipe = write_stage->pipe;
-            sel->stage = write_stage;
-
-            sel->args.push_back(CreateNonStagedLink(program,
-                        p.second.stmts[i+1]->stage,
-                        p.second.stmts[i+1]->valid_in, sel->stage));
-            sel->arg_nums.push_back(sel->args.back()->valnum);
-
-            sel->args.push_back(CreateNonStagedLink(program,
-                        p.second.stmts[i+1]->stage,
-                        p.second.stmts[i+1]->args[0], sel->stage));
-            sel->arg_nums.push_back(sel->args.back()->valnum);
-            sel->args.push_back(last_sel ? last_sel :
-                    CreateNonStagedLink(program,
-                        p.second.stmts[i]->stage,
-                        p.second.stmts[i]->args[0], sel->stage));
-            sel->arg_nums.push_back(sel->args.back()->valnum);
-            sel->width = sel->args[1]->width;
-            last_sel = sel.get();
-
-            sel->pipe->stmts.push_back(sel.get());
-            sel->stage->stmts.push_back(sel.get());
-            sel->stage->owned_stmts.push_back(move(sel));
-
-            unique_ptr<IRStmt> valid_or(new IRStmt());
-            valid_or->valnum = program->GetValnum();
-            valid_or->type = IRStmtExpr;
-            valid_or->op = IRStmtOpOr;
-            valid_or->pipe = write_stage->pipe;
-            valid_or->stage = write_stage;
-            valid_or->args.push_back(last_or ? last_or :
-                    CreateNonStagedLink(program,
-                        p.second.stmts[i]->stage,
-                        p.second.stmts[i]->valid_in, valid_or->stage));
-            valid_or->arg_nums.push_back(valid_or->args.back()->valnum);
-            valid_or->args.push_back(
-                    CreateNonStagedLink(program,
-                        p.second.stmts[i+1]->stage,
-                        p.second.stmts[i+1]->valid_in, valid_or->stage));
-            valid_or->arg_nums.push_back(valid_or->args.back()->valnum);
-            valid_or->width = 1;
-            last_or = valid_or.get();
-
-            valid_or->pipe->stmts.push_back(valid_or.get());
-            valid_or->stage->stmts.push_back(valid_or.get());
-            valid_or->stage->owned_stmts.push_back(move(valid_or));
+        vector<IRStmt*> valids;
+        map<int, vector<pair<IRStmt*, IRStmt*>>> ordinary_writes;
+        vector<pair<IRStmt*, IRStmt*>> killing_writes;
+        for (auto* stmt : p.second.stmts) {
+            IRStmt* valid = CreateNonStagedLink(program,
+                    stmt->stage, stmt->valid_in, write_stage);
+            IRStmt* value = CreateNonStagedLink(program,
+                    stmt->stage, stmt->args[0], write_stage);
+            valids.push_back(valid);
+            if (stmt->dom_killyounger &&
+                stmt->dom_killyounger->stage->stage == stmt->stage->stage) {
+                killing_writes.push_back(make_pair(valid, value));
+            } else {
+                ordinary_writes[stmt->pipe->lane].push_back(
+                        make_pair(valid, value));
+            }
         }
 
-        // Rewrite the first write's arg, and replace its 'valid_in' with the
-        // OR of all.
-        IRStmt* one_write = p.second.one_write;
-        one_write->valid_in = last_or;
+        // In a multi-lane pipe, an older lane's killyounger may kill a
+        // younger lane's write within its stage (see AssignKills()), which
+        // gates the valids used here; the trees built from them must then
+        // carry valid_spine so that the kill reaches them.
+        bool multi_lane = ordinary_writes.size() > 1;
+
+        IRStmt* last_sel = nullptr;
+        for (auto& lane : ordinary_writes) {
+            IRStmt* lane_sel = MergeDisjointWrites(program, write_stage,
+                                                   lane.second);
+            if (!last_sel) {
+                last_sel = lane_sel;
+                continue;
+            }
+            vector<IRStmt*> lane_valids;
+            for (auto& write : lane.second) {
+                lane_valids.push_back(write.first);
+            }
+            unsigned first_tree_stmt = write_stage->stmts.size();
+            IRStmt* lane_valid = BuildStageTree(program, write_stage,
+                                                IRStmtOpOr, lane_valids);
+            for (unsigned i = first_tree_stmt;
+                 i < write_stage->stmts.size(); i++) {
+                write_stage->stmts[i]->valid_spine = true;
+            }
+            last_sel = AddStageExpr(program, write_stage, IRStmtOpSelect,
+                    lane_sel->width, { lane_valid, lane_sel, last_sel });
+        }
+        for (auto& write : killing_writes) {
+            last_sel = last_sel ?
+                AddStageExpr(program, write_stage, IRStmtOpSelect,
+                             write.second->width,
+                             { write.first, write.second, last_sel }) :
+                write.second;
+        }
+        unsigned first_or_stmt = write_stage->stmts.size();
+        IRStmt* last_or = BuildStageTree(program, write_stage, IRStmtOpOr,
+                                         valids);
+        if (multi_lane) {
+            for (unsigned i = first_or_stmt;
+                 i < write_stage->stmts.size(); i++) {
+                write_stage->stmts[i]->valid_spine = true;
+            }
+        }
+
+        // Rewrite the first write's arg, and replace its 'valid_in' with the
+        // OR of all.
+        IRStmt* one_write = p.second.one_write;
+        one_write->valid_in = last_or;
         one_write->args[0] = last_sel;
-        one_write->arg_nums[0] = last_sel->valnum;
 
         // Delete all of the other writes.
         for (auto* stmt : p.second.stmts) {
@@ -1331,6 +2087,50 @@ bool ConvertSingleWrites(IRProgram* program,
     return true;
 }
 
+// Orders the array writes made by the lanes of a multi-lane pipe in the same
+// stage: each array write has its own write port, so an older lane's write is
+// dropped when a younger lane writes the same element in the same cycle. This
+// runs after kills are assigned, so that a killed younger write drops nothing.
+bool OrderLaneArrayWrites(IRProgram* program,
+                          PipeSys* sys,
+                          ErrorCollector* coll) {
+    // Array writes by array name and stage.
+    map<pair<string, int>, vector<IRStmt*>> writes;
+    for (auto& pipe : sys->pipes) {
+        for (auto* stmt : pipe->stmts) {
+            if (stmt->type != IRStmtArrayWrite || stmt->deleted) continue;
+            writes[make_pair(stmt->storage->name, stmt->stage->stage)]
+                .push_back(stmt);
+        }
+    }
+
+    for (auto& p : writes) {
+        for (auto* older : p.second) {
+            PipeStage* stage = older->stage;
+            vector<IRStmt*> overwrites;
+            for (auto* younger : p.second) {
+                if (younger->pipe->lane <= older->pipe->lane) continue;
+                IRStmt* same_index = AddStageExpr(program, stage,
+                        IRStmtOpCmpEQ, 1,
+                        { older->args[0], younger->args[0] });
+                overwrites.push_back(younger->valid_in ?
+                        AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                     { younger->valid_in, same_index }) :
+                        same_index);
+            }
+            if (overwrites.empty()) continue;
+            IRStmt* kept = AddStageExpr(program, stage, IRStmtOpNot, 1,
+                    { BuildStageTree(program, stage, IRStmtOpOr,
+                                     overwrites) });
+            older->valid_in = older->valid_in ?
+                AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                             { older->valid_in, kept }) :
+                kept;
+        }
+    }
+    return true;
+}
+
 // Assigns 'stall' signals to pipestages: each stage stalls if any later
 // 'backedge' evaluates. We simply take the OR of all backedge predicates.
 // Note that the predicates from later stage backedges must be marked such that
@@ -1395,13 +2195,203 @@ bool AssignStalls(IRProgram* program,
         // there.
         auto* prior_stage = pipe->stages[i-1].get();
         for (auto& stmt : stallgen_bb->stmts) {
-            prior_stage->stmts.push_back(stmt.get());
+            prior_stage->stmts.push_back(stmt);
             stmt->stage = prior_stage;
-            stmt->stage->pipe->stmts.push_back(stmt.get());
+            stmt->stage->pipe->stmts.push_back(stmt);
             stmt->pipe = stmt->stage->pipe;
         }
         pipe->bbs.push_back(stallgen_bb.get());
-        program->bbs.push_back(move(stallgen_bb));
+        program->AddBB(move(stallgen_bb));
+    }
+
+    return true;
+}
+
+// Returns the valid signals that carry transactions into stage |i| from
+// earlier stages: the valid_ins, and the valid args of valid-spine ops, of
+// statements in that stage or any later one that are produced before it.
+vector<IRStmt*> ValidsCrossingInto(Pipe* pipe, int i) {
+    vector<IRStmt*> valids;
+    set<IRStmt*> seen;
+    for (unsigned j = i; j < pipe->stages.size(); j++) {
+        for (auto* stmt : pipe->stages[j]->stmts) {
+            if (stmt->deleted) continue;
+            if (stmt->valid_in && stmt->valid_in->stage->stage < i &&
+                seen.insert(stmt->valid_in).second) {
+                valids.push_back(stmt->valid_in);
+            }
+            if (stmt->valid_spine) {
+                for (auto* arg : stmt->args) {
+                    if (arg->valid_spine && arg->stage->stage < i &&
+                        seen.insert(arg).second) {
+                        valids.push_back(arg);
+                    }
+                }
+            }
+        }
+    }
+    return valids;
+}
+
+// Assigns stall signals as AssignStalls() does, but elastically (if
+// IRProgram::skid_depth is nonzero): each elastic stage gets a skid buffer at
+// its input (see SkidBuffer). A stall of an elastic stage holds the arriving
+// transactions in its buffer, and the stages upstream stall only on whether
+// the buffer is full, which depends on registers alone. No stall signal thus
+// crosses more than one elastic stage per cycle.
+//
+// Each stage's stall is the OR of (i) the latched valid of each backedge that
+// restarts at this stage, if it is elastic, or at a later stage otherwise,
+// and (ii) the full signal of the skid buffer at the next elastic stage.
+// Each of these is carried to earlier stages only down to the nearest
+// elastic stage; the stages in between stall together, as before.
+//
+// A stage can be elastic only if no transaction can be restarted or killed
+// across its input, since its buffer would keep the transactions a restart
+// or kill must see: no loop may span the stage boundary, and no killyounger
+// or kill_if may kill the stage. Stalls of pipes that spawn (or are spawned
+// by) other pipes cross pipes, so they stay global. Stages listed in
+// IRProgram::elastic_stages that cannot be elastic are errors; with no list,
+// every stage that can be elastic is.
+bool AssignElasticStalls(IRProgram* program,
+                         PipeSys* sys,
+                         Pipe* pipe,
+                         ErrorCollector* coll) {
+    int num_stages = pipe->stages.size();
+
+    vector<IRStmt*> backedges;
+    vector<IRStmt*> killyoungers;
+    for (auto& other_pipe : sys->pipes) {
+        for (auto& stage : other_pipe->stages) {
+            for (auto* stmt : stage->stmts) {
+                if (stmt->type == IRStmtBackedge) {
+                    backedges.push_back(stmt);
+                } else if (stmt->type == IRStmtKillYounger) {
+                    killyoungers.push_back(stmt);
+                }
+            }
+        }
+    }
+    // No backedges: nothing stalls.
+    if (backedges.empty()) {
+        return AssignStalls(program, sys, pipe, coll);
+    }
+
+    // Pick the elastic stages. Stage 1 is never elastic: nothing enters it
+    // from stage 0.
+    bool all = program->elastic_stages.empty();
+    set<int> listed(program->elastic_stages.begin(),
+                    program->elastic_stages.end());
+    vector<bool> elastic(num_stages, false);
+    bool any_elastic = false;
+    for (int i = 2; i < num_stages; i++) {
+        if (!all && listed.find(i) == listed.end()) continue;
+        const IRStmt* culprit = nullptr;
+        string reason;
+        if (sys->pipes.size() > 1) {
+            culprit = backedges[0];
+            reason = "its stalls are shared with spawned pipes";
+        }
+        for (auto* backedge : backedges) {
+            if (culprit) break;
+            int restart = backedge->restart_target->restart_cond->stage->stage;
+            if (restart < i && backedge->stage->stage >= i) {
+                culprit = backedge;
+                reason = strprintf("a loop in stage %d restarts at stage %d",
+                                   backedge->stage->stage, restart);
+            }
+        }
+        for (auto* killyounger : killyoungers) {
+            if (culprit) break;
+            if (killyounger->stage->stage > i) {
+                culprit = killyounger;
+                reason = "a later killyounger kills it";
+            }
+        }
+        if (!culprit && !pipe->stages[i]->kills.empty()) {
+            culprit = pipe->stages[i]->kills[0];
+            reason = "a kill_if kills it";
+        }
+        if (culprit) {
+            if (!all) {
+                coll->ReportError(culprit->location, ErrorCollector::ERROR,
+                        strprintf("Stage %d cannot be elastic: %s.", i,
+                                  reason.c_str()));
+                return false;
+            }
+            continue;
+        }
+        // Nothing to buffer if no transaction crosses into the stage.
+        if (ValidsCrossingInto(pipe, i).empty()) continue;
+        elastic[i] = true;
+        any_elastic = true;
+    }
+    if (!any_elastic) {
+        return AssignStalls(program, sys, pipe, coll);
+    }
+
+    // A stall source: a backedge, or the skid buffer of an elastic stage.
+    struct StallSource {
+        IRStmt* backedge;
+        int skid_stage;
+    };
+    // Sources by the latest stage they stall.
+    vector<vector<StallSource>> sources(num_stages);
+    for (auto* backedge : backedges) {
+        int restart = backedge->restart_target->restart_cond->stage->stage;
+        int latest = elastic[restart] ? restart : restart - 1;
+        if (latest >= 1) {
+            sources[latest].push_back({ backedge, 0 });
+        }
+    }
+
+    // Walk from the last stage back, carrying each source down to the
+    // nearest elastic stage.
+    vector<StallSource> active;
+    for (int i = num_stages - 1; i >= 1; i--) {
+        auto* stage = pipe->stages[i].get();
+        active.insert(active.end(), sources[i].begin(), sources[i].end());
+        if (active.empty()) continue;
+
+        unique_ptr<IRBB> stallgen_bb(new IRBB());
+        stallgen_bb->label = strprintf("__stallgen_stage_%d", i);
+        IRBBBuilder builder(program, stallgen_bb.get());
+        vector<IRStmt*> stall_inputs;
+        for (auto& source : active) {
+            if (source.backedge) {
+                // Latched: the restart occupies its stage in the cycle after
+                // the backedge is taken.
+                stall_inputs.push_back(
+                        CreateLatchedLink(program, source.backedge->stage,
+                                          source.backedge->valid_in, stage));
+            } else {
+                IRStmt* full = builder.AddStmt();
+                full->valnum = program->GetValnum();
+                full->bb = stallgen_bb.get();
+                full->type = IRStmtSkidFull;
+                full->width = 1;
+                full->constant = source.skid_stage;
+                full->has_constant = true;
+                stall_inputs.push_back(full);
+            }
+        }
+        stage->stall = builder.BuildTree(IRStmtOpOr, stall_inputs);
+        builder.PrependToBB();
+        for (auto& stmt : stallgen_bb->stmts) {
+            stage->stmts.push_back(stmt);
+            stmt->stage = stage;
+            stmt->pipe = pipe;
+            pipe->stmts.push_back(stmt);
+        }
+        pipe->bbs.push_back(stallgen_bb.get());
+        program->AddBB(move(stallgen_bb));
+
+        if (elastic[i]) {
+            stage->skid.reset(new SkidBuffer());
+            stage->skid->depth = program->skid_depth;
+            active.clear();
+            active.push_back({ nullptr, i });
+        }
     }
 
     return true;
@@ -1422,6 +2412,11 @@ bool AssignKills(IRProgram* program,
     //   - For each such signal, insert an AND gate to qualify (gate) the
     //     incoming valid with its other input the inverse of the kill.
     
+    bool elastic = false;
+    for (auto& stage : pipe->stages) {
+        if (stage->skid) elastic = true;
+    }
+
     // Start at stage 1; stage 0 is empty and has no kills.
     for (unsigned i = 1; i < pipe->stages.size(); i++) {
         auto* stage = pipe->stages[i].get();
@@ -1457,15 +2452,52 @@ bool AssignKills(IRProgram* program,
             // there.
             auto* prior_stage = pipe->stages[i-1].get();
             for (auto& stmt : killgen_bb->stmts) {
-                prior_stage->stmts.push_back(stmt.get());
+                prior_stage->stmts.push_back(stmt);
                 stmt->stage = prior_stage;
             }
             pipe->bbs.push_back(killgen_bb.get());
-            program->bbs.push_back(move(killgen_bb));
+            program->AddBB(move(killgen_bb));
         }
 
+        // A killyounger also kills the younger lanes' transactions in its own
+        // stage. Pipes are processed in lane order, so the older lanes'
+        // killyoungers are already qualified by their own kills.
+        vector<IRStmt*> lane_kills;
+        for (auto& other_pipe : sys->pipes) {
+            if (other_pipe->lane >= pipe->lane ||
+                i >= other_pipe->stages.size()) {
+                continue;
+            }
+            for (auto* stmt : other_pipe->stages[i]->stmts) {
+                if (stmt->type == IRStmtKillYounger) {
+                    lane_kills.push_back(stmt->valid_in);
+                }
+            }
+        }
+        if (!lane_kills.empty()) {
+            if (kill_signal != nullptr) {
+                lane_kills.push_back(kill_signal);
+            }
+            unique_ptr<IRBB> lane_kill_bb(new IRBB());
+            lane_kill_bb->label = strprintf("__lane_kill_stage_%d", i);
+            IRBBBuilder builder(program, lane_kill_bb.get());
+            kill_signal = builder.BuildTree(IRStmtOpOr, lane_kills);
+
+            for (auto& stmt : lane_kill_bb->stmts) {
+                stmt->stage = stage;
+                stmt->pipe = stage->pipe;
+                stage->stmts.push_back(stmt);
+                stage->pipe->stmts.push_back(stmt);
+            }
+
+            pipe->bbs.push_back(lane_kill_bb.get());
+            program->AddBB(move(lane_kill_bb));
+        }
+
+        stage->kill = kill_signal;
+
         // The kill signal for this stage is the OR of its killyounger-derived
-        // kill (above), any downstream kill_if clones, and its stall signal.
+        // kills (above), any downstream kill_if clones, and its stall signal.
         // The reason for the latter is that if the stage is stalled, its
         // internal logic must be prevented from invoking its side-effects; in
         // such a case, the stage's output latches will hold the prior output.
@@ -1480,12 +2512,12 @@ bool AssignKills(IRProgram* program,
 
                 for (auto& stmt : kill_or_bb->stmts) {
                     stmt->stage = stage;
-                    stage->stmts.push_back(stmt.get());
-                    stage->pipe->stmts.push_back(stmt.get());
+                    stage->stmts.push_back(stmt);
+                    stage->pipe->stmts.push_back(stmt);
                 }
 
                 pipe->bbs.push_back(kill_or_bb.get());
-                program->bbs.push_back(move(kill_or_bb));
+                program->AddBB(move(kill_or_bb));
             } else {
                 kill_signal = stage->stall;
             }
@@ -1498,18 +2530,62 @@ bool AssignKills(IRProgram* program,
             // substitute all uses of the 'valid' signals when they are either
             // valid_ins on any stmt, or when they are ordinary args on
             // valid_spine stmts.
+            //
+            // In a pipe with elastic stages, a stall holds the transaction
+            // entering a stage rather than dropping it, so the transaction
+            // must not slip past the stage on valids used only downstream:
+            // the cut then includes the valids used in all later stages too.
+            //
+            // A younger lane's transaction killed within its own stage has
+            // not yet been cut off from its later stages by any kill there,
+            // so the cut extends to all later stages in that case as well.
+            unsigned last_stage = (elastic || !lane_kills.empty()) ?
+                pipe->stages.size() : i + 1;
             set<IRStmt*> valid_cut;
-            for (auto* stmt : stage->stmts) {
-                if (stmt->valid_in && stmt->valid_in->stage->stage < i) {
-                    valid_cut.insert(stmt->valid_in);
-                } else if (stmt->is_valid_start) {
-                    valid_cut.insert(stmt);
+            for (unsigned j = i; j < last_stage; j++) {
+                for (auto* stmt : pipe->stages[j]->stmts) {
+                    if (stmt->valid_in && stmt->valid_in->stage->stage < i) {
+                        valid_cut.insert(stmt->valid_in);
+                    } else if (stmt->is_valid_start && j == i) {
+                        // A restart re-enters an elastic stage from within;
+                        // the stall holds only the transaction arriving from
+                        // the skid buffer.
+                        if (!stage->skid || !stmt->restart_arg) {
+                            valid_cut.insert(stmt);
+                        }
+                    }
+                    if (stmt->valid_spine) {
+                        for (auto* arg : stmt->args) {
+                            if (arg->stage->stage < i) {
+                                valid_cut.insert(arg);
+                            }
+                        }
+                    }
                 }
-                if (stmt->valid_spine) {
-                    for (auto* arg : stmt->args) {
-                        if (arg->stage->stage < i) {
-                            valid_cut.insert(arg);
+            }
+            // The older lanes' pipes may combine this lane's valids with
+            // their own, e.g. to order the lanes' writes in
+            // ConvertSingleWrites(); those uses are gated as well, and may
+            // take them as ordinary args too.
+            vector<PipeStage*> gated_stages;
+            for (unsigned j = i; j < last_stage; j++) {
+                gated_stages.push_back(pipe->stages[j].get());
+            }
+            if (!lane_kills.empty()) {
+                for (auto& other_pipe : sys->pipes) {
+                    if (other_pipe.get() == pipe) continue;
+                    for (unsigned j = i; j < other_pipe->stages.size(); j++) {
+                        auto* other_stage = other_pipe->stages[j].get();
+                        for (auto* stmt : other_stage->stmts) {
+                            if (!stmt->valid_spine) continue;
+                            for (auto* arg : stmt->args) {
+                                if (arg->pipe == pipe &&
+                                    arg->stage->stage < i) {
+                                    valid_cut.insert(arg);
+                                }
+                            }
                         }
+                        gated_stages.push_back(other_stage);
                     }
                 }
             }
@@ -1518,33 +2594,36 @@ bool AssignKills(IRProgram* program,
             unique_ptr<IRBB> valid_cut_gating_bb(new IRBB());
             valid_cut_gating_bb->label = strprintf("__valid_cut_gating_stage_%d", i);
             IRBBBuilder builder(program, valid_cut_gating_bb.get());
-            IRStmt* not_kill = builder.AddStmt(unique_ptr<IRStmt>(new IRStmt()));
+            IRStmt* not_kill = builder.AddStmt();
             not_kill->type = IRStmtExpr;
             not_kill->op = IRStmtOpNot;
             not_kill->width = 1;
             not_kill->valnum = program->GetValnum();
             not_kill->bb = valid_cut_gating_bb.get();
             not_kill->args.push_back(kill_signal);
-            not_kill->arg_nums.push_back(kill_signal->valnum);
 
             for (auto* stmt : valid_cut) {
                 vector<IRStmt*> and_args = { not_kill, stmt };
                 IRStmt* gated = builder.AddExpr(IRStmtOpAnd, and_args);
+                gated->valid_spine = true;
                 valid_replacements[stmt] = gated;
+                stage->ungated_valids[gated] = stmt;
             }
 
-            for (auto* stmt : stage->stmts) {
-                if (stmt->valid_in) {
-                    auto it = valid_replacements.find(stmt->valid_in);
-                    if (it != valid_replacements.end()) {
-                        stmt->valid_in = it->second;
-                    }
-                }
-                if (stmt->valid_spine) {
-                    for (int i = 0; i < stmt->args.size(); i++) {
-                        auto it = valid_replacements.find(stmt->args[i]);
+            for (auto* gated_stage : gated_stages) {
+                for (auto* stmt : gated_stage->stmts) {
+                    if (stmt->valid_in) {
+                        auto it = valid_replacements.find(stmt->valid_in);
                         if (it != valid_replacements.end()) {
-                            stmt->args[i] = it->second;
+                            stmt->valid_in = it->second;
+                        }
+                    }
+                    if (stmt->valid_spine || !lane_kills.empty()) {
+                        for (int i = 0; i < stmt->args.size(); i++) {
+                            auto it = valid_replacements.find(stmt->args[i]);
+                            if (it != valid_replacements.end()) {
+                                stmt->args[i] = it->second;
+                            }
                         }
                     }
                 }
@@ -1554,16 +2633,285 @@ bool AssignKills(IRProgram* program,
             for (auto& stmt : valid_cut_gating_bb->stmts) {
                 stmt->stage = stage;
                 stmt->pipe = stage->pipe;
-                stage->stmts.push_back(stmt.get());
-                stage->pipe->stmts.push_back(stmt.get());
+                stage->stmts.push_back(stmt);
+                stage->pipe->stmts.push_back(stmt);
             }
-            program->bbs.push_back(move(valid_cut_gating_bb));
+            program->AddBB(move(valid_cut_gating_bb));
+        }
+    }
+
+    return true;
+}
+
+// Builds the |present| signal of each skid buffer (see SkidBuffer) in the
+// stage before it. This runs after AssignKills(), so that transactions killed
+// or held in that stage are not counted.
+bool AssignSkidPresence(IRProgram* program,
+                        PipeSys* sys,
+                        Pipe* pipe,
+                        ErrorCollector* coll) {
+    for (unsigned i = 1; i < pipe->stages.size(); i++) {
+        auto* stage = pipe->stages[i].get();
+        if (!stage->skid) continue;
+
+        unique_ptr<IRBB> present_bb(new IRBB());
+        present_bb->label = strprintf("__skid_present_stage_%d", i);
+        IRBBBuilder builder(program, present_bb.get());
+        stage->skid->present =
+            builder.BuildTree(IRStmtOpOr, ValidsCrossingInto(pipe, i));
+        assert(stage->skid->present != nullptr);
+        builder.PrependToBB();
+
+        auto* prior_stage = pipe->stages[i-1].get();
+        for (auto& stmt : present_bb->stmts) {
+            prior_stage->stmts.push_back(stmt);
+            stmt->stage = prior_stage;
+            stmt->pipe = pipe;
+            pipe->stmts.push_back(stmt);
         }
+        pipe->bbs.push_back(present_bb.get());
+        program->AddBB(move(present_bb));
     }
 
     return true;
 }
 
+// Builds the events that the performance counters count in each stage of
+// |pipe| (see PerfEvent), if IRProgram::perf_counters is set. Each event is
+// a signal in its stage:
+//   - valid: a transaction is in the stage, i.e., one of the stage's
+//     statements runs under a valid from an earlier stage, or a restart
+//     re-enters it.
+//   - stall: the stage's stall signal.
+//   - kill: the transaction in the stage is killed by a later killyounger,
+//     a kill_if or an older lane's killyounger (see PipeStage::kill).
+//   - bypass_wait: a bypass-ready query finds its producer present in the
+//     bypass network but with no value yet.
+//   - spawn_stall: a transaction that spawns is held by the stall.
+// With IRProgram::profile, each stage also has the events of its statements
+// that start, end or hold up a transaction, which the profile traces so that
+// it can follow each transaction and report per-statement counts:
+//   - spawn, done, kill, killyounger: the statement runs.
+//   - kill_if: the kill_if runs and its condition holds, or a transaction in
+//     a later stage that passed through it is killed by its condition.
+//   - bypass_wait: as above, for a single bypass-ready query.
+//   - restart: a backedge restarts its loop in this stage.
+// This runs after kills are assigned, so that the signals it uses are the
+// final ones; none of the events feeds back into the pipe's own logic.
+bool AssignPerfEvents(IRProgram* program,
+                      PipeSys* sys,
+                      Pipe* pipe,
+                      ErrorCollector* coll) {
+    map<const IRStmt*, const IRStmt*> restart_backedges;
+    for (auto* stmt : pipe->stmts) {
+        if (stmt->type == IRStmtBackedge && stmt->restart_target) {
+            restart_backedges[stmt->restart_target->restart_cond] = stmt;
+        }
+    }
+
+    for (unsigned i = 1; i < pipe->stages.size(); i++) {
+        auto* stage = pipe->stages[i].get();
+
+        // The transaction is present if any statement in the stage runs
+        // under a valid from an earlier stage (or a restart into this one).
+        // Valids gated by this stage's own kill are taken before the gating,
+        // so that the stall and kill events count against a present
+        // transaction; predicate terms computed in the stage are skipped.
+        vector<IRStmt*> valids;
+        set<IRStmt*> seen;
+        vector<IRStmt*> readies;
+        vector<IRStmt*> spawns;
+        vector<IRStmt*> sites;
+        for (auto* stmt : stage->stmts) {
+            if (stmt->deleted) continue;
+            IRStmt* valid = stmt->is_valid_start ? stmt : stmt->valid_in;
+            if (valid) {
+                auto it = stage->ungated_valids.find(valid);
+                if (it != stage->ungated_valids.end()) {
+                    valid = it->second;
+                }
+                if ((valid->is_valid_start ||
+                     (valid->stage && valid->stage->stage < stage->stage)) &&
+                    !seen.count(valid)) {
+                    seen.insert(valid);
+                    valids.push_back(valid);
+                }
+            }
+            if (stmt->type == IRStmtBypassReady) {
+                readies.push_back(stmt);
+            } else if (stmt->type == IRStmtSpawn) {
+                spawns.push_back(stmt);
+                sites.push_back(stmt);
+            } else if (stmt->type == IRStmtDone ||
+                       stmt->type == IRStmtKill ||
+                       stmt->type == IRStmtKillYounger ||
+                       stmt->type == IRStmtKillIf ||
+                       restart_backedges.count(stmt)) {
+                sites.push_back(stmt);
+            }
+        }
+        if (valids.empty()) continue;
+
+        IRStmt* present = BuildStageTree(program, stage, IRStmtOpOr, valids);
+        stage->perf_events.push_back({ "valid", present });
+
+        if (stage->stall) {
+            stage->perf_events.push_back({ "stall", stage->stall });
+        }
+
+        if (stage->kill) {
+            stage->perf_events.push_back({ "kill",
+                    AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                 { present, stage->kill }) });
+        }
+
+        vector<IRStmt*> waits;
+        if (!readies.empty()) {
+            for (auto* ready : readies) {
+                // The same query without the value's ready bit.
+                IRStmt* query = program->NewStmt();
+                query->valnum = program->GetValnum();
+                query->type = IRStmtBypassPresent;
+                query->width = 1;
+                query->port_name = ready->port_name;
+                query->bypass = ready->bypass;
+                query->args = ready->args;
+                query->valid_in = ready->valid_in;
+                query->pipe = pipe;
+                query->stage = stage;
+                pipe->stmts.push_back(query);
+                stage->stmts.push_back(query);
+                ready->bypass->reads.push_back(query);
+
+                IRStmt* not_ready = AddStageExpr(program, stage,
+                        IRStmtOpNot, 1, { ready });
+                IRStmt* wait = AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                            { query, not_ready });
+                if (ready->valid_in) {
+                    wait = AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                        { ready->valid_in, wait });
+                }
+                waits.push_back(wait);
+            }
+            stage->perf_events.push_back({ "bypass_wait",
+                    AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                 { present,
+                                   BuildStageTree(program, stage, IRStmtOpOr,
+                                                  waits) }) });
+        }
+
+        if (!spawns.empty() && stage->stall) {
+            vector<IRStmt*> spawning;
+            for (auto* spawn : spawns) {
+                spawning.push_back(spawn->valid_in ? spawn->valid_in : present);
+            }
+            stage->perf_events.push_back({ "spawn_stall",
+                    AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                 { stage->stall,
+                                   BuildStageTree(program, stage, IRStmtOpOr,
+                                                  spawning) }) });
+        }
+
+        if (!program->profile) continue;
+        for (auto* stmt : sites) {
+            IRStmt* runs = stmt->valid_in ? stmt->valid_in : present;
+            switch (stmt->type) {
+                case IRStmtSpawn:
+                    stage->perf_events.push_back({ "spawn", runs, stmt });
+                    break;
+                case IRStmtDone:
+                    stage->perf_events.push_back({ "done", runs, stmt });
+                    break;
+                case IRStmtKill:
+                    stage->perf_events.push_back({ "kill", runs, stmt });
+                    break;
+                case IRStmtKillYounger:
+                    stage->perf_events.push_back({ "killyounger", runs,
+                                                   stmt });
+                    break;
+                case IRStmtKillIf:
+                    stage->perf_events.push_back({ "kill_if",
+                            AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                         { runs, stmt->args[0] }),
+                            stmt });
+                    break;
+                default:
+                    // The restart's valid, with its backedge as the site.
+                    stage->perf_events.push_back({ "restart", stmt,
+                                                   restart_backedges[stmt] });
+                    break;
+            }
+        }
+        // The kill_if clones that kill this stage keep their kill_if's
+        // location.
+        for (auto* kill : stage->kills) {
+            stage->perf_events.push_back({ "kill_if",
+                    AddStageExpr(program, stage, IRStmtOpAnd, 1,
+                                 { present, kill }),
+                    kill });
+        }
+        for (unsigned j = 0; j < waits.size(); j++) {
+            stage->perf_events.push_back({ "bypass_wait", waits[j],
+                                           readies[j] });
+        }
+    }
+
+    return true;
+}
+
+// Joins writes[lo..hi), all in one stage, into a single write's |valid| and
+// |data|. A later write takes priority over an earlier one, as it would
+// overwrite it. The writes are split in half recursively, so the result is
+// a tree of ORs and selects of depth log2(hi - lo) rather than a chain.
+void JoinBypassWrites(IRProgram* program, const vector<IRStmt*>& writes,
+                      unsigned lo, unsigned hi,
+                      IRStmt** valid, IRStmt** data) {
+    auto* stage = writes[lo]->stage;
+    if (hi - lo == 1) {
+        *valid = CreateNonStagedLink(program, writes[lo]->stage,
+                                     writes[lo]->valid_in, stage);
+        *data = CreateNonStagedLink(program, writes[lo]->stage,
+                                    writes[lo]->args[0], stage);
+        return;
+    }
+
+    unsigned mid = (lo + hi) / 2;
+    IRStmt* older_valid;
+    IRStmt* older_data;
+    IRStmt* newer_valid;
+    IRStmt* newer_data;
+    JoinBypassWrites(program, writes, lo, mid, &older_valid, &older_data);
+    JoinBypassWrites(program, writes, mid, hi, &newer_valid, &newer_data);
+
+    IRStmt* sel = program->NewStmt();
+    sel->valnum = program->GetValnum();
+    sel->type = IRStmtExpr;
+    sel->op = IRStmtOpSelect;
+    sel->pipe = stage->pipe;
+    sel->stage = stage;
+    sel->args.push_back(newer_valid);
+    sel->args.push_back(newer_data);
+    sel->args.push_back(older_data);
+    sel->width = newer_data->width;
+    sel->pipe->stmts.push_back(sel);
+    sel->stage->stmts.push_back(sel);
+
+    IRStmt* valid_or = program->NewStmt();
+    valid_or->valnum = program->GetValnum();
+    valid_or->type = IRStmtExpr;
+    valid_or->op = IRStmtOpOr;
+    valid_or->pipe = stage->pipe;
+    valid_or->stage = stage;
+    valid_or->args.push_back(older_valid);
+    valid_or->args.push_back(newer_valid);
+    valid_or->width = 1;
+    valid_or->pipe->stmts.push_back(valid_or);
+    valid_or->stage->stmts.push_back(valid_or);
+
+    *valid = valid_or;
+    *data = sel;
+}
+
 bool ConvertBypasses(IRProgram* program,
                      PipeSys* sys,
                      ErrorCollector* coll) {
@@ -1614,11 +2962,15 @@ bool ConvertBypasses(IRProgram* program,
         // plus the bypassed value's index, plus a 'valid' bit for the index
         // and a 'valid' bit for the data. Verilog generation handles these
         // details manually, but setting the correct width here ensures that
-        // the staging latches are created correctly.
-        bypass->start->width = (bypass->start->width /* data */ +
+        // the staging latches are created correctly. Each bypass write
+        // replaces the lane with its own value, so it gets the same width.
+        bypass->start->width = (bypass->width /* data */ +
                                 1 /* data valid bit */ +
                                 bypass->start->args[0]->width /* index */ +
                                 1 /* index valid bit */);
+        for (auto* write : bypass->writes) {
+            write->width = bypass->start->width;
+        }
 
         // Group bypass writes by stage.
         map<int, vector<IRStmt*>> writes_by_stage;
@@ -1633,61 +2985,13 @@ bool ConvertBypasses(IRProgram* program,
             if (writes.size() > 1) {
                 auto* master_write = writes[0];
 
-                IRStmt* last_sel = nullptr;
-                IRStmt* last_or = nullptr;
-                for (unsigned i = 0; i < writes.size() - 1; i++) {
-                    auto* write1 = writes[i];
-                    auto* write2 = writes[i+1];
-
-                    unique_ptr<IRStmt> sel(new IRStmt());
-                    sel->valnum = program->GetValnum();
-                    sel->type = IRStmtExpr;
-                    sel->op = IRStmtOpSelect;
-                    sel->pipe = write1->pipe;
-                    sel->stage = write1->stage;
-
-                    sel->args.push_back(CreateNonStagedLink(program,
-                                write2->stage, write2->valid_in, sel->stage));
-                    sel->arg_nums.push_back(sel->args.back()->valnum);
-
-                    sel->args.push_back(CreateNonStagedLink(program,
-                                write2->stage, write2->args[0], sel->stage));
-                    sel->arg_nums.push_back(sel->args.back()->valnum);
-                    sel->args.push_back(last_sel ? last_sel :
-                            CreateNonStagedLink(program,
-                                write1->stage, write1->args[0], sel->stage));
-                    sel->arg_nums.push_back(sel->args.back()->valnum);
-                    sel->width = sel->args[1]->width;
-                    last_sel = sel.get();
-
-                    sel->pipe->stmts.push_back(sel.get());
-                    sel->stage->stmts.push_back(sel.get());
-                    sel->stage->owned_stmts.push_back(move(sel));
-
-                    unique_ptr<IRStmt> valid_or(new IRStmt());
-                    valid_or->valnum = program->GetValnum();
-                    valid_or->type = IRStmtExpr;
-                    valid_or->op = IRStmtOpOr;
-                    valid_or->pipe = write1->pipe;
-                    valid_or->stage = write1->stage;
-                    valid_or->args.push_back(last_or ? last_or :
-                            CreateNonStagedLink(program,
-                                write1->stage, write1->valid_in, valid_or->stage));
-                    valid_or->arg_nums.push_back(valid_or->args.back()->valnum);
-                    valid_or->args.push_back(
-                            CreateNonStagedLink(program,
-                                write2->stage, write2->valid_in, valid_or->stage));
-                    valid_or->arg_nums.push_back(valid_or->args.back()->valnum);
-                    valid_or->width = 1;
-                    last_or = valid_or.get();
-
-                    valid_or->pipe->stmts.push_back(valid_or.get());
-                    valid_or->stage->stmts.push_back(valid_or.get());
-                    valid_or->stage->owned_stmts.push_back(move(valid_or));
-                }
+                IRStmt* valid = nullptr;
+                IRStmt* data = nullptr;
+                JoinBypassWrites(program, writes, 0, writes.size(),
+                                 &valid, &data);
 
-                master_write->args[0] = last_sel;
-                master_write->valid_in = last_sel;
+                master_write->args[0] = data;
+                master_write->valid_in = valid;
 
                 for (unsigned i = 1; i < writes.size(); i++) {
                     writes[i]->deleted = true;
@@ -1704,23 +3008,596 @@ bool ConvertBypasses(IRProgram* program,
     return true;
 }
 
+// Records program-wide IR size after a pass.
+void RecordIRSize(PassStats::Scope* scope, IRProgram* program) {
+    if (!scope->enabled()) return;
+    scope->SetSize("stmts", program->NumStmts());
+    lock_guard<mutex> l(program->mutex);
+    scope->SetSize("bbs", program->bbs.size());
+}
+
+// Runs a lowering pass, returning false from the caller if it fails. Expects
+// |program| and |stats| in scope.
+#define RUN_PASS(pass, ...)                                                    \
+    {                                                                          \
+        PassStats::Scope scope(stats, #pass);                                  \
+        if (!pass(__VA_ARGS__)) return false;                                  \
+        RecordIRSize(&scope, program);                                         \
+    }
+
+// The per-pipe passes before valid-predicate slots are assigned, and those
+// before and after valid-spine propagation. These touch only the given
+// pipe's BBs and statements, so distinct pipes of one PipeSys may run them
+// concurrently.
+bool LowerPipeBeforeSlots(IRProgram* program,
+                          PipeSys* sys,
+                          Pipe* pipe,
+                          PassStats* stats,
+                          ErrorCollector* coll) {
+    // Compute killyounger dominance over all points in the CFG. This is
+    // used during backedge conversion to decide how to constrain stages.
+    RUN_PASS(ComputeKillyoungerDom, program, sys, pipe, coll);
+    // Break backedges into backedge BB / restart BB pairs with no CFG
+    // linkage, so that the CFG becomes a DAG with restart points.
+    RUN_PASS(ConvertBackedges, program, sys, pipe, coll);
+    // Begin a valid signal at each entry point.
+    RUN_PASS(InsertEntryValids, program, sys, pipe, coll);
+    return true;
+}
+
+bool LowerPipeBeforeSpine(IRProgram* program,
+                          PipeSys* sys,
+                          Pipe* pipe,
+                          PredicateMemoizer* memo,
+                          PassStats* stats,
+                          ErrorCollector* coll) {
+    // Build a 'valid'-signal spine along each path in the CFG, and assign
+    // valid predicates to all statements.
+    RUN_PASS(IfConvert, program, sys, pipe, memo, coll);
+    return true;
+}
+
+bool LowerPipeAfterSpine(IRProgram* program,
+                         PipeSys* sys,
+                         Pipe* pipe,
+                         PredicateMemoizer* memo,
+                         PassStats* stats,
+                         ErrorCollector* coll) {
+    // Replace phis with MUXes on the valid predicates.
+    RUN_PASS(ConvertPhis, program, sys, pipe, memo, coll);
+    // Build the dependence DAG according to side effects, used as a part
+    // of the partial order that constrains pipe staging.
+    RUN_PASS(BuildPipeDAG, program, sys, pipe, coll);
+    // Flatten the BBs into a list of statements.
+    RUN_PASS(FlattenPipe, program, sys, pipe, coll);
+    return true;
+}
+
+// Runs |pass(i, coll)| for the i'th pipe of |sys|, over all pipes, on up to
+// |jobs| threads, each allocating statements from an arena of its own. Errors
+// are buffered per pipe and replayed in pipe order, stopping after the first
+// pipe that failed.
+template<typename F>
+bool ParallelPipePass(PipeSys* sys, int jobs, ErrorCollector* coll, F pass) {
+    vector<BufferedErrorCollector> colls(sys->pipes.size());
+    vector<char> ok(sys->pipes.size(), 0);
+    ParallelFor(jobs, sys->pipes.size(), [&](int i) {
+        IRStmtArenaScope arena_scope(sys->program);
+        ok[i] = pass(i, &colls[i]);
+    });
+    for (unsigned i = 0; i < sys->pipes.size(); i++) {
+        colls[i].ReplayTo(coll);
+        if (!ok[i]) return false;
+    }
+    return true;
+}
+
+// Runs all lowering passes on a single PipeSys.
+bool LowerPipeSys(IRProgram* program,
+                  PipeSys* sys,
+                  const PipeTimer& timer,
+                  int jobs,
+                  PassStats* stats,
+                  ErrorCollector* coll) {
+    IRStmtArenaScope arena_scope(program);
+
+    // Check that chans are only used within their own extracted pipes. This is
+    // really a typecheck-like pass, but cannot be run until the spawn-tree
+    // pipe extraction runs.
+    RUN_PASS(CheckChanUses, program, sys, coll);
+
+    // Split arithmetic too slow for one stage into pipelinable steps.
+    RUN_PASS(ExpandMultiCycleOps, program, sys, timer.model(), coll);
+
+    vector<PredicateMemoizer> memos(sys->pipes.size(),
+                                    PredicateMemoizer(
+                                        program->minimize_predicates));
+    if (jobs <= 1) {
+        for (auto& pipe : sys->pipes) {
+            if (!LowerPipeBeforeSlots(program, sys, pipe.get(), stats, coll)) {
+                return false;
+            }
+        }
+        RUN_PASS(AssignValidPredSlots, program, sys, coll);
+        for (unsigned i = 0; i < sys->pipes.size(); i++) {
+            Pipe* pipe = sys->pipes[i].get();
+            if (!LowerPipeBeforeSpine(program, sys, pipe, &memos[i], stats,
+                                      coll)) {
+                return false;
+            }
+            RUN_PASS(PropagateValidSpine, program, sys, pipe, coll);
+            if (!LowerPipeAfterSpine(program, sys, pipe, &memos[i], stats,
+                                     coll)) {
+                return false;
+            }
+        }
+    } else {
+        // Valid-predicate slots are assigned once, serially, so that pipes
+        // can then be if-converted without locking. Valid-spine propagation
+        // reads bits computed in ancestor pipes, so it too runs serially, in
+        // spawn order, between the parallel phases.
+        if (!ParallelPipePass(sys, jobs, coll,
+                    [&](int i, ErrorCollector* c) {
+                        return LowerPipeBeforeSlots(program, sys,
+                                sys->pipes[i].get(), stats, c);
+                    })) {
+            return false;
+        }
+        RUN_PASS(AssignValidPredSlots, program, sys, coll);
+        if (!ParallelPipePass(sys, jobs, coll,
+                    [&](int i, ErrorCollector* c) {
+                        return LowerPipeBeforeSpine(program, sys,
+                                sys->pipes[i].get(), &memos[i], stats, c);
+                    })) {
+            return false;
+        }
+        for (auto& pipe : sys->pipes) {
+            RUN_PASS(PropagateValidSpine, program, sys, pipe.get(), coll);
+        }
+        if (!ParallelPipePass(sys, jobs, coll,
+                    [&](int i, ErrorCollector* c) {
+                        return LowerPipeAfterSpine(program, sys,
+                                sys->pipes[i].get(), &memos[i], stats, c);
+                    })) {
+            return false;
+        }
+    }
+    memos.clear();
+
+    if (program->propagate_predicates) {
+        RUN_PASS(PropagatePredicates, program, sys, coll);
+    }
+
+    // Once all pipes have been flattened to lists of statements with
+    // partial-order DAGs, we can segment statements into pipe stages according
+    // to a model of node delays.
+    {
+        PassStats::Scope scope(stats, "TimePipe");
+        PipeTimingStats timing_stats;
+        if (!timer.TimePipe(sys, coll,
+                            scope.enabled() ? &timing_stats : nullptr)) {
+            return false;
+        }
+        scope.AddCount("timing_dag_nodes", timing_stats.nodes);
+        scope.AddCount("timing_dag_edges", timing_stats.edges);
+        scope.AddCount("timing_nodes_visited", timing_stats.nodes_visited);
+        scope.AddCount("timing_var_updates", timing_stats.var_updates);
+        scope.AddCount("timing_dag_solve_us", timing_stats.solve_us);
+        scope.AddCount("pipereg_bits", timing_stats.pipereg_bits);
+        scope.AddCount("pipereg_bits_saved", timing_stats.pipereg_bits_saved);
+    }
+
+    // We clone 'kill_if' backward slices downstream to each stage.
+    RUN_PASS(InsertKillIfKills, program, sys, coll);
+
+    // We check that ports, chans, and regs have all write-points in only
+    // one stage. Then we convert the multiple writes to a single write
+    // with a muxed input. (We check that valids do not overlap.)
+    RUN_PASS(ConvertSingleWrites, program, sys, coll);
+
+    // Check bypasses and convert writes to a single write per stage.
+    RUN_PASS(ConvertBypasses, program, sys, coll);
+
+    for (auto& pipe : sys->pipes) {
+
+        // TODO: check here for 'can only be killed if killyounger' markers
+        // and error out if so.
+
+        // We assign stall signals *after* pipelining because the
+        // signals depend on the pipestage assignments.
+        if (program->skid_depth > 0) {
+            RUN_PASS(AssignElasticStalls, program, sys, pipe.get(), coll);
+        } else {
+            RUN_PASS(AssignStalls, program, sys, pipe.get(), coll);
+        }
+
+        // Likewise, we assign kill signals *after* pipelining because their inputs
+        // depend on the pipestage assignments. We shoehorn in ANDs on valids that
+        // occur at the start of pipestages (i.e., valid_ins on stmts whose
+        // producer statements occur in previous pipestages, or which are NULL).
+        // TODO: implement this. Need to add RestartValueSrc / RestartValue pair
+        // for each killyounger, and then ensure that codegen uses the result of
+        // RestartValue *directly*, with no staging aside from the latch between
+        // RestartValueSrc and RestartValue.
+        RUN_PASS(AssignKills, program, sys, pipe.get(), coll);
+
+        if (program->skid_depth > 0) {
+            RUN_PASS(AssignSkidPresence, program, sys, pipe.get(), coll);
+        }
+    }
+
+    // Same-cycle array writes by the lanes of a multi-lane pipe take effect
+    // in lane order.
+    RUN_PASS(OrderLaneArrayWrites, program, sys, coll);
+
+    if (program->perf_counters || program->profile) {
+        for (auto& pipe : sys->pipes) {
+            RUN_PASS(AssignPerfEvents, program, sys, pipe.get(), coll);
+        }
+    }
+
+    // Predicates are not needed past this point; drop the side table.
+    vector<StmtValidPreds>().swap(sys->valid_preds);
+    return true;
+}
+
+#undef RUN_PASS
+
+// The bits of a value that are known statically: those set in |mask|, with
+// the values in |value|. Only the low 64 bits are tracked, which covers any
+// array index (see DeriveStorageSize() in ir-typechecker.cc).
+struct KnownBits {
+    uint64_t mask;
+    uint64_t value;
+
+    KnownBits() : mask(0), value(0) {}
+    KnownBits(uint64_t mask_, uint64_t value_)
+        : mask(mask_), value(value_ & mask_) {}
+
+    uint64_t Ones() const { return value; }
+    uint64_t Zeros() const { return mask & ~value; }
+    // The number of low bits, from bit 0 up, that are all known.
+    int LowKnown() const {
+        int n = 0;
+        while (n < 64 && (mask >> n) & 1) n++;
+        return n;
+    }
+    // The number of low bits, from bit 0 up, that are all known zero.
+    int LowZeros() const {
+        int n = 0;
+        while (n < 64 && (Zeros() >> n) & 1) n++;
+        return n;
+    }
+};
+
+uint64_t LowMask(int bits) {
+    return bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+}
+
+// Computes the bits of statement values that hold whatever the inputs,
+// from constants and the bit-level structure of the expressions over them.
+class KnownBitsAnalysis {
+ public:
+  KnownBits Get(const IRStmt* stmt) {
+      auto it = memo_.find(stmt);
+      if (it != memo_.end()) return it->second;
+      // Nothing is known about a value on a cycle back to itself.
+      memo_[stmt] = KnownBits();
+      KnownBits result = Compute(stmt);
+      if (stmt->width >= 0) {
+          // Bits above the width are zero.
+          uint64_t width_mask = LowMask(stmt->width);
+          result = KnownBits(result.mask | ~width_mask,
+                             result.value & width_mask);
+      } else {
+          result = KnownBits();
+      }
+      memo_[stmt] = result;
+      return result;
+  }
+
+ private:
+  std::map<const IRStmt*, KnownBits> memo_;
+
+  bool ConstArg(const IRStmt* stmt, int i, int* value) {
+      const IRStmt* arg = stmt->args[i];
+      if (arg->type != IRStmtExpr || arg->op != IRStmtOpConst ||
+          arg->constant < 0 || arg->constant > 64) {
+          return false;
+      }
+      *value = arg->constant.convert_to<int>();
+      return true;
+  }
+
+  KnownBits Compute(const IRStmt* stmt) {
+      if (stmt->type != IRStmtExpr) return KnownBits();
+      switch (stmt->op) {
+          case IRStmtOpConst: {
+              bignum low = stmt->constant & bignum(~uint64_t(0));
+              return KnownBits(~uint64_t(0), low.convert_to<uint64_t>());
+          }
+          case IRStmtOpNot: {
+              KnownBits a = Get(stmt->args[0]);
+              return KnownBits(a.mask, ~a.value);
+          }
+          case IRStmtOpAnd: {
+              KnownBits a = Get(stmt->args[0]), b = Get(stmt->args[1]);
+              uint64_t ones = a.Ones() & b.Ones();
+              uint64_t zeros = a.Zeros() | b.Zeros();
+              return KnownBits(ones | zeros, ones);
+          }
+          case IRStmtOpOr: {
+              KnownBits a = Get(stmt->args[0]), b = Get(stmt->args[1]);
+              uint64_t ones = a.Ones() | b.Ones();
+              uint64_t zeros = a.Zeros() & b.Zeros();
+              return KnownBits(ones | zeros, ones);
+          }
+          case IRStmtOpXor: {
+              KnownBits a = Get(stmt->args[0]), b = Get(stmt->args[1]);
+              return KnownBits(a.mask & b.mask, a.value ^ b.value);
+          }
+          case IRStmtOpAdd:
+          case IRStmtOpSub:
+          case IRStmtOpMul: {
+              // The low bits of a sum, difference or product depend only on
+              // the low bits of the operands.
+              KnownBits a = Get(stmt->args[0]), b = Get(stmt->args[1]);
+              uint64_t low = LowMask(min(a.LowKnown(), b.LowKnown()));
+              uint64_t value =
+                  stmt->op == IRStmtOpAdd ? a.value + b.value :
+                  stmt->op == IRStmtOpSub ? a.value - b.value :
+                                            a.value * b.value;
+              if (stmt->op == IRStmtOpMul) {
+                  // A product also has at least as many low zeros as its
+                  // operands have together.
+                  int zeros = min(64, a.LowZeros() + b.LowZeros());
+                  if (LowMask(zeros) > low) {
+                      return KnownBits(LowMask(zeros), 0);
+                  }
+              }
+              return KnownBits(low, value);
+          }
+          case IRStmtOpLsh: {
+              int shift;
+              if (!ConstArg(stmt, 1, &shift)) return KnownBits();
+              if (shift >= 64) return KnownBits(~uint64_t(0), 0);
+              KnownBits a = Get(stmt->args[0]);
+              return KnownBits((a.mask << shift) | LowMask(shift),
+                               a.value << shift);
+          }
+          case IRStmtOpRsh:
+          case IRStmtOpBitslice: {
+              // A bitslice's third arg is its low bit.
+              int shift;
+              if (!ConstArg(stmt, stmt->op == IRStmtOpRsh ? 1 : 2, &shift)) {
+                  return KnownBits();
+              }
+              if (shift >= 64) return KnownBits();
+              KnownBits a = Get(stmt->args[0]);
+              return KnownBits(a.mask >> shift, a.value >> shift);
+          }
+          case IRStmtOpConcat: {
+              // Args are most significant first.
+              uint64_t mask = 0, value = 0;
+              int shift = 0;
+              for (int i = stmt->args.size() - 1; i >= 0 && shift < 64; i--) {
+                  KnownBits a = Get(stmt->args[i]);
+                  uint64_t part = LowMask(stmt->args[i]->width);
+                  mask |= (a.mask & part) << shift;
+                  value |= (a.value & part) << shift;
+                  shift += stmt->args[i]->width;
+              }
+              return KnownBits(mask, value);
+          }
+          case IRStmtOpSelect: {
+              KnownBits sel = Get(stmt->args[0]);
+              if (sel.mask & 1) return Get(stmt->args[(sel.value & 1) ? 1 : 2]);
+              KnownBits a = Get(stmt->args[1]), b = Get(stmt->args[2]);
+              return KnownBits(a.mask & b.mask & ~(a.value ^ b.value),
+                               a.value);
+          }
+          default:
+              return KnownBits();
+      }
+  }
+};
+
+// The most index bits on which an array is banked without a declared bank
+// count.
+const int kMaxInferredBankBits = 3;
+
+// Returns the bank addressed by |index| when an array is split into
+// 2^|bits| banks, or -1 if the index does not fix the bank.
+int AccessBank(KnownBitsAnalysis* known, const IRStmt* index, int bits) {
+    KnownBits k = known->Get(index);
+    uint64_t low = LowMask(bits);
+    if ((k.mask & low) != low) return -1;
+    return static_cast<int>(k.value & low);
+}
+
+// Splits arrays into banks by their low index bits. Each bank has its own
+// read and write ports in the generated design, and an access whose index
+// fixes its bank (e.g. a[{i, 1'd0}] and a[{i, 1'd1}]) uses a port on that
+// bank alone, while any other access uses one on every bank. A declared bank
+// count is always used, and a warning is given for each bank still needing
+// more than one read or write port; otherwise, if the program asks for it
+// with |bank_arrays|, the fewest banks (up to 2^kMaxInferredBankBits) are
+// chosen that most reduce the ports on any one bank, if that is fewer than
+// the array needs unbanked.
+bool AssignArrayBanks(IRProgram* program,
+                      const vector<unique_ptr<PipeSys>>& pipesystems,
+                      ErrorCollector* coll) {
+    map<IRStorage*, vector<IRStmt*>> accesses;
+    for (auto& sys : pipesystems) {
+        for (auto& pipe : sys->pipes) {
+            for (auto* stmt : pipe->stmts) {
+                if (stmt->deleted) continue;
+                if (stmt->type == IRStmtArrayRead ||
+                    stmt->type == IRStmtArrayWrite) {
+                    accesses[stmt->storage].push_back(stmt);
+                }
+            }
+        }
+    }
+
+    KnownBitsAnalysis known;
+    // Returns the most read or write ports on any one bank with 2^|bits|
+    // banks, and the accesses that need them.
+    auto max_ports = [&](const vector<IRStmt*>& stmts, int bits,
+                         int* worst_bank, vector<IRStmt*>* worst) {
+        int banks = 1 << bits;
+        vector<vector<IRStmt*>> reads(banks), writes(banks);
+        for (auto* stmt : stmts) {
+            int bank = AccessBank(&known, stmt->args[0], bits);
+            auto& ports = stmt->type == IRStmtArrayRead ? reads : writes;
+            for (int b = 0; b < banks; b++) {
+                if (bank == -1 || bank == b) ports[b].push_back(stmt);
+            }
+        }
+        int most = 0;
+        for (int b = 0; b < banks; b++) {
+            for (auto* ports : { &reads[b], &writes[b] }) {
+                if (ports->size() > most) {
+                    most = ports->size();
+                    if (worst_bank) *worst_bank = b;
+                    if (worst) *worst = *ports;
+                }
+            }
+        }
+        return most;
+    };
+
+    for (auto& s : program->storage) {
+        IRStorage* storage = s.get();
+        storage->banks = 1;
+        auto it = accesses.find(storage);
+        if (storage->index_width == 0 || it == accesses.end()) continue;
+        const vector<IRStmt*>& stmts = it->second;
+
+        int bits = 0;
+        if (storage->declared_banks > 0) {
+            while ((1 << bits) < storage->declared_banks) bits++;
+            int bank = 0;
+            vector<IRStmt*> worst;
+            if (max_ports(stmts, bits, &bank, &worst) > 1) {
+                coll->ReportError(worst[1]->location, ErrorCollector::WARNING,
+                        strprintf("Bank %d of array '%s' needs %d ports for "
+                                  "simultaneous accesses. Accesses whose "
+                                  "index does not fix their bank use a port "
+                                  "on every bank.",
+                                  bank, storage->name.c_str(),
+                                  static_cast<int>(worst.size())));
+            }
+        } else if (program->bank_arrays) {
+            int best = max_ports(stmts, 0, nullptr, nullptr);
+            for (int b = 1; b <= kMaxInferredBankBits &&
+                            b <= storage->index_width &&
+                            (1 << b) <= storage->elements; b++) {
+                int ports = max_ports(stmts, b, nullptr, nullptr);
+                if (ports < best) {
+                    best = ports;
+                    bits = b;
+                }
+            }
+        }
+
+        storage->banks = 1 << bits;
+        for (auto* stmt : stmts) {
+            stmt->array_bank = bits > 0 ?
+                AccessBank(&known, stmt->args[0], bits) : -1;
+        }
+    }
+    return true;
+}
+
+// Gives fresh valnums, in pipe and statement order, to all statements created
+// while lowering (those with valnums at or above |first_lowered|), and
+// regenerates the BB and timevar names derived from them. Likewise gives
+// fresh, dense IDs to the statements allocated while lowering (those with IDs
+// at or above |first_lowered_id|): reached ones in pipe and statement order,
+// then any others. Statements created by concurrently-lowered pipes draw both
+// from shared counters in nondeterministic order, and the generators key side
+// tables and emission order on them; this makes the output the same for any
+// number of jobs.
+void RenumberLoweredStmts(IRProgram* program,
+                          const vector<unique_ptr<PipeSys>>& pipesystems,
+                          int first_lowered, int first_lowered_id) {
+    set<IRStmt*> seen;
+    set<IRBB*> renamed_slices;
+    vector<IRStmt*> lowered;
+    const string slice_prefix = kClonedKillIfSlicePrefix;
+    for (auto& sys : pipesystems) {
+        for (auto& pipe : sys->pipes) {
+            for (auto* stmt : pipe->stmts) {
+                if (!seen.insert(stmt).second) continue;
+                if (stmt->id >= first_lowered_id) lowered.push_back(stmt);
+                if (stmt->valnum < first_lowered) continue;
+                if (stmt->bb &&
+                    stmt->bb->label.compare(0, slice_prefix.size(),
+                                            slice_prefix) == 0 &&
+                    renamed_slices.insert(stmt->bb).second) {
+                    stmt->bb->label = strprintf("%s%d", kClonedKillIfSlicePrefix,
+                                                program->GetValnum());
+                }
+                stmt->valnum = program->GetValnum();
+                if (stmt->type == IRStmtBackedge) {
+                    NameBackedge(stmt);
+                }
+            }
+        }
+    }
+    // Until now, IDs were also indices into the program's own arena.
+    for (int i = first_lowered_id; i < program->stmts.size(); i++) {
+        IRStmt* stmt = program->stmts.At(i);
+        if (!seen.count(stmt)) lowered.push_back(stmt);
+    }
+    for (auto& arena : program->thread_arenas) {
+        for (int i = 0; i < arena->stmts.size(); i++) {
+            IRStmt* stmt = arena->stmts.At(i);
+            if (stmt->id >= first_lowered_id && !seen.count(stmt)) {
+                lowered.push_back(stmt);
+            }
+        }
+    }
+    for (unsigned i = 0; i < lowered.size(); i++) {
+        lowered[i]->id = first_lowered_id + i;
+    }
+    program->next_stmt_id = first_lowered_id + lowered.size();
+}
+
 }  // anonymous namespace
 
-vector<unique_ptr<PipeSys>> IRProgram::Lower(ErrorCollector* coll) {
+vector<unique_ptr<PipeSys>> IRProgram::Lower(ErrorCollector* coll, int jobs,
+                                             PassStats* stats) {
+    // Lowering rewrites the CFG, so the program-wide analyses go stale; the
+    // passes below use per-pipe ones (Pipe::analyses) instead.
+    Analyses().Invalidate();
+
+    // Registered IO gives each exported port without a latency of its own one
+    // register at the module boundary.
+    for (auto& port : ports) {
+        if (!port->exported || port->latency > 0) continue;
+        if (port->defs.empty() ? register_inputs : register_outputs) {
+            port->latency = 1;
+        }
+    }
 
     // Extract pipelines from the spawn forest (set of spawn trees). Each BB is
     // extracted to at most one pipe, because each pipeline can only be spawned
     // from one point.
     vector<unique_ptr<PipeSys>> pipesystems;
     bool had_error = false;
-    for (auto* entry : entries) {
-        unique_ptr<PipeSys> sys(new PipeSys());
-        sys->program = this;
-        if (!FindPipes(this, sys.get(), entry, coll)) {
-            had_error = true;
-            break;
+    {
+        PassStats::Scope scope(stats, "FindPipes");
+        for (auto* entry : entries) {
+            unique_ptr<PipeSys> sys(new PipeSys());
+            sys->program = this;
+            if (!FindPipes(this, sys.get(), entry, coll)) {
+                had_error = true;
+                break;
+            }
+            pipesystems.push_back(move(sys));
         }
-        pipesystems.push_back(move(sys));
     }
     if (had_error) {
         pipesystems.clear();
@@ -1730,74 +3607,63 @@ vector<unique_ptr<PipeSys>> IRProgram::Lower(ErrorCollector* coll) {
     // For each PipeSys, perform pipe conversion and predication.
 
     unique_ptr<TimingModel> timing_model =
-        TimingModel::New(this->timing_model);
-
-    PipeTimer timer(timing_model.get());
-
-    for (auto& sys : pipesystems) {
-        // Check that chans are only used within their own extracted pipes. This is
-        // really a typecheck-like pass, but cannot be run until the spawn-tree
-        // pipe extraction runs.
-        if (!CheckChanUses(this, sys.get(), coll)) goto err;
-
-        for (auto& pipe : sys->pipes) {
-            // Compute killyounger dominance over all points in the CFG. This is
-            // used during backedge conversion to decide how to constrain stages.
-            if (!ComputeKillyoungerDom(this, sys.get(), pipe.get(), coll)) goto err;
-            // Break backedges into backedge BB / restart BB pairs with no CFG
-            // linkage, so that the CFG becomes a DAG with restart points.
-            if (!ConvertBackedges(this, sys.get(), pipe.get(), coll)) goto err;
-            // Build a 'valid'-signal spine along each path in the CFG, and assign
-            // valid predicates to all statements.
-            if (!IfConvert(this, sys.get(), pipe.get(), coll)) goto err;
-            // Build the dependence DAG according to side effects, used as a part
-            // of the partial order that constrains pipe staging.
-            if (!BuildPipeDAG(this, sys.get(), pipe.get(), coll)) goto err;
-            // Flatten the BBs into a list of statements.
-            if (!FlattenPipe(this, sys.get(), pipe.get(), coll)) goto err;
-        }
-
-        // Once all pipes have been flattened to lists of statements with
-        // partial-order DAGs, we can segment statements into pipe stages according
-        // to a model of node delays.
-        if (!timer.TimePipe(sys.get(), coll)) goto err;
-
-        // We clone 'kill_if' backward slices downstream to each stage.
-        if (!InsertKillIfKills(this, sys.get(), coll)) goto err;
-
-        // We check that ports, chans, and regs have all write-points in only
-        // one stage. Then we convert the multiple writes to a single write
-        // with a muxed input. (We check that valids do not overlap.)
-        if (!ConvertSingleWrites(this, sys.get(), coll)) goto err;
-
-        // Check bypasses and convert writes to a single write per stage.
-        if (!ConvertBypasses(this, sys.get(), coll)) goto err;
-
-        for (auto& pipe : sys->pipes) {
-
-            // TODO: check here for 'can only be killed if killyounger' markers
-            // and error out if so.
+        TimingModel::New(this->timing_model, coll);
+    if (!timing_model) {
+        pipesystems.clear();
+        return pipesystems;
+    }
 
-            // We assign stall signals *after* pipelining because the
-            // signals depend on the pipestage assignments.
-            if (!AssignStalls(this, sys.get(), pipe.get(), coll)) goto err;
+    PipeTimer timer(timing_model.get(), minimize_registers, balance_stages,
+                    max_stages);
 
-            // Likewise, we assign kill signals *after* pipelining because their inputs
-            // depend on the pipestage assignments. We shoehorn in ANDs on valids that
-            // occur at the start of pipestages (i.e., valid_ins on stmts whose
-            // producer statements occur in previous pipestages, or which are NULL).
-            // TODO: implement this. Need to add RestartValueSrc / RestartValue pair
-            // for each killyounger, and then ensure that codegen uses the result of
-            // RestartValue *directly*, with no staging aside from the latch between
-            // RestartValueSrc and RestartValue.
-            if (!AssignKills(this, sys.get(), pipe.get(), coll)) goto err;
+    int first_lowered = next_valnum;
+    int first_lowered_id = stmts.size();
+    if (jobs <= 1) {
+        for (auto& sys : pipesystems) {
+            if (!LowerPipeSys(this, sys.get(), timer, 1, stats, coll)) {
+                had_error = true;
+                break;
+            }
+        }
+    } else {
+        // Separate spawn trees share no chans, so each PipeSys can be lowered
+        // independently. Errors are buffered per PipeSys and replayed in
+        // order, stopping after the first PipeSys that failed, so that they
+        // appear as they would in a serial run. Threads left over once every
+        // PipeSys has one are spread across the pipes within each PipeSys.
+        int sys_jobs = min<int>(jobs, pipesystems.size());
+        int pipe_jobs = max(1, jobs / max(1, sys_jobs));
+        vector<BufferedErrorCollector> colls(pipesystems.size());
+        vector<char> ok(pipesystems.size(), 0);
+        ParallelFor(sys_jobs, pipesystems.size(), [&](int i) {
+            ok[i] = LowerPipeSys(this, pipesystems[i].get(), timer, pipe_jobs,
+                                 stats, &colls[i]);
+        });
+        for (unsigned i = 0; i < pipesystems.size(); i++) {
+            colls[i].ReplayTo(coll);
+            if (!ok[i]) {
+                had_error = true;
+                break;
+            }
         }
+    }
 
+    // Serial lowering numbers statements deterministically already, but not
+    // in the order that the renumbering does; renumber in both cases so that
+    // the output does not depend on |jobs|.
+    if (!had_error) {
+        PassStats::Scope scope(stats, "RenumberLoweredStmts");
+        RenumberLoweredStmts(this, pipesystems, first_lowered,
+                             first_lowered_id);
+    }
 
-        continue;
-err:
-        had_error = true;
-        break;
+    // Arrays may be accessed from any PipeSys, so their banks are chosen
+    // once all are lowered.
+    if (!had_error) {
+        PassStats::Scope scope(stats, "AssignArrayBanks");
+        if (!AssignArrayBanks(this, pipesystems, coll)) {
+            had_error = true;
+        }
     }
 
     if (had_error) {
@@ -20,6 +20,11 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cmath>
 
 using namespace autopiper;
 using namespace std;
@@ -47,14 +52,37 @@ int MulStages(int n) {
 }
 
 int DivStages(int n, int dividend, int divisor) {
-    // If the user doesn't design a state machine-based divider manually,
-    // we're not going to do it for them; assume a fully-combinational design
-    // with radix 2. There's a comparator and subtractor at each stage (for
-    // each output bit).
+    // A fully-combinational design with radix 2: there's a comparator and
+    // subtractor at each stage (for each output bit). Dividers too slow for
+    // one pipestage are expanded into their radix steps before timing (see
+    // ExpandMultiCycleOps() in lower.cc).
     (void)divisor;
     return n * 2*AddStages(dividend);
 }
 
+int CeilLog2(int n) {
+    int ret = 0;
+    while ((1 << ret) < n) {
+        ret++;
+    }
+    return ret;
+}
+
+// Matching one bypass bus: an index comparator (as for CmpEQ), then an AND
+// with the bus's valid bits.
+int BypassHitStages(int index_width) {
+    return 2 + Log2(index_width) + 1;
+}
+
+// The stages between an op and the first use of its value: nonzero only for
+// registered array reads.
+int ReadLatency(const IRStmt* stmt) {
+    if (stmt->type == IRStmtArrayRead && stmt->storage) {
+        return stmt->storage->read_latency;
+    }
+    return 0;
+}
+
 int BarrelShifter(int input_width, int shiftamt_width) {
     (void)input_width;
     // Tree of MUXes, |shiftamt_width| 2-input MUXes deep; each 2-input MUX
@@ -62,6 +90,21 @@ int BarrelShifter(int input_width, int shiftamt_width) {
     return 2 * shiftamt_width;
 }
 
+// Whether |keyword| names a statement as IRStmt::Keyword() prints it.
+bool IsStmtKeyword(const string& keyword) {
+    IRStmt stmt;
+    stmt.type = IRStmtExpr;
+    for (int op = IRStmtOpNone; op <= IRStmtOpCmpGE; op++) {
+        stmt.op = static_cast<IRStmtOp>(op);
+        if (keyword == stmt.Keyword()) return true;
+    }
+    for (int type = IRStmtExpr + 1; type < IRStmtNone; type++) {
+        stmt.type = static_cast<IRStmtType>(type);
+        if (keyword == stmt.Keyword()) return true;
+    }
+    return false;
+}
+
 }  // anonymous namespace
 
 int StandardTimingModel::Delay(const IRStmt* stmt) const {
@@ -125,6 +168,43 @@ int StandardTimingModel::Delay(const IRStmt* stmt) const {
                     return 0;
             }
             break;
+        case IRStmtPortWrite:
+        case IRStmtChanWrite:
+        case IRStmtRegWrite: {
+            // Several writers to one port, chan or reg are merged into one
+            // write during lowering (see ConvertSingleWrites()): two through
+            // one select, and more by gating each value with its valid (an
+            // AND layer) and ORing the gated values in a balanced tree.
+            int writers = 1;
+            if (stmt->type == IRStmtRegWrite) {
+                if (stmt->storage) writers = stmt->storage->writers.size();
+            } else {
+                if (stmt->port) writers = stmt->port->defs.size();
+            }
+            if (writers < 2) {
+                return 0;
+            } else if (writers == 2) {
+                return 2;
+            }
+            return 1 + CeilLog2(writers);
+        }
+        case IRStmtBypassPresent:
+        case IRStmtBypassReady:
+        case IRStmtBypassRead: {
+            // A reader matches the bus of each later stage of the bypass
+            // region in parallel (see the generators), then combines the
+            // hits with a balanced tree: ORs for present/ready, and
+            // two-layer muxes selecting the nearest hit for a read. Stages
+            // are not assigned yet, so the region is taken to span one stage
+            // per write, plus the start.
+            int buses = stmt->bypass ? stmt->bypass->writes.size() + 1 : 1;
+            int hit = BypassHitStages(stmt->args[0]->width);
+            if (stmt->type == IRStmtBypassRead) {
+                // The final AND gates the result to 0 when nothing hits.
+                return hit + 2 * CeilLog2(buses) + 1;
+            }
+            return hit + CeilLog2(buses);
+        }
         default:
             // TODO: other primitives: array reads/writes, ...
             return 0;
@@ -135,6 +215,151 @@ int StandardTimingModel::DelayPerStage() const {
     return kGatesPerStage;
 }
 
+int StandardTimingModel::FanoutDelay(const IRStmt* stmt, int fanout) const {
+    int layers = 0;
+    for (int loads = kMaxFanout; loads < fanout; loads *= kMaxFanout) {
+        layers++;
+    }
+    return layers;
+}
+
+bool TableTimingModel::Load(const string& filename, istream* in,
+                            ErrorCollector* coll) {
+    Location loc;
+    loc.filename = filename;
+    loc.line = 0;
+    loc.column = 0;
+    auto error = [&](const string& msg) {
+        coll->ReportError(loc, ErrorCollector::ERROR, msg);
+        return false;
+    };
+
+    string line;
+    while (getline(*in, line)) {
+        loc.line++;
+        size_t comment = line.find('#');
+        if (comment != string::npos) line.resize(comment);
+
+        istringstream is(line);
+        string keyword;
+        if (!(is >> keyword)) continue;  // blank line
+
+        if (keyword == "clock_period") {
+            string extra;
+            if (!(is >> clock_period_) || clock_period_ <= 0 || (is >> extra)) {
+                return error("clock_period requires one positive integer.");
+            }
+            continue;
+        }
+        if (keyword == "input_delay" || keyword == "output_delay") {
+            int* delay = keyword == "input_delay" ? &input_delay_ :
+                                                    &output_delay_;
+            string extra;
+            if (!(is >> *delay) || *delay < 0 || (is >> extra)) {
+                return error(keyword +
+                             " requires one non-negative integer.");
+            }
+            continue;
+        }
+
+        if (keyword != "fanout" && !IsStmtKeyword(keyword)) {
+            return error("Unknown op '" + keyword + "' in timing library.");
+        }
+        auto& table = tables_[keyword];
+        string point;
+        while (is >> point) {
+            istringstream ps(point);
+            int width = 0, delay = 0;
+            char colon = 0;
+            string extra;
+            if (!(ps >> width >> colon >> delay) || colon != ':' ||
+                (ps >> extra)) {
+                return error("Expected width:delay, got '" + point + "'.");
+            }
+            if (width <= 0 || delay < 0) {
+                return error("Width must be positive and delay non-negative "
+                             "in '" + point + "'.");
+            }
+            table[width] = delay;
+        }
+        if (table.empty()) {
+            return error("No width:delay entries for '" + keyword + "'.");
+        }
+    }
+
+    if (clock_period_ <= 0) {
+        loc.line = 0;
+        return error("Timing library does not specify clock_period.");
+    }
+    if (input_delay_ >= clock_period_ || output_delay_ >= clock_period_) {
+        loc.line = 0;
+        return error("input_delay and output_delay must be less than "
+                     "clock_period.");
+    }
+    return true;
+}
+
+int TableTimingModel::Lookup(const map<int, int>& table, int width) {
+    if (table.size() == 1) return table.begin()->second;
+
+    // Find the two points bracketing |width|, or the nearest two if |width|
+    // lies outside the table.
+    auto hi = table.lower_bound(width);
+    if (hi != table.end() && hi->first == width) return hi->second;
+    if (hi == table.begin()) ++hi;
+    if (hi == table.end()) --hi;
+    auto lo = hi;
+    --lo;
+
+    double slope = double(hi->second - lo->second) / (hi->first - lo->first);
+    double delay = lo->second + slope * (width - lo->first);
+    if (delay < 0) return 0;
+    return int(floor(delay + 0.5));
+}
+
+int TableTimingModel::IODelay(const IRStmt* stmt) const {
+    const IRPort* port = stmt->port;
+    if (!port || !port->exported || port->latency > 0) return 0;
+    if (stmt->type == IRStmtPortRead && port->defs.empty()) {
+        return input_delay_;
+    }
+    if (stmt->type == IRStmtPortWrite) {
+        return output_delay_;
+    }
+    return 0;
+}
+
+int TableTimingModel::Delay(const IRStmt* stmt) const {
+    if (stmt->type == IRStmtExpr &&
+        (stmt->op == IRStmtOpLsh || stmt->op == IRStmtOpRsh) &&
+        stmt->args[1]->type == IRStmtExpr &&
+        stmt->args[1]->op == IRStmtOpConst) {
+        // Constant shifts are just wires.
+        return 0;
+    }
+
+    int io_delay = IODelay(stmt);
+    auto it = tables_.find(stmt->Keyword());
+    if (it == tables_.end()) return io_delay;
+
+    int width = stmt->width;
+    for (auto* arg : stmt->args) {
+        if (arg->width > width) width = arg->width;
+    }
+    if (width < 1) width = 1;
+    return io_delay + Lookup(it->second, width);
+}
+
+int TableTimingModel::DelayPerStage() const {
+    return clock_period_;
+}
+
+int TableTimingModel::FanoutDelay(const IRStmt* stmt, int fanout) const {
+    auto it = tables_.find("fanout");
+    if (it == tables_.end() || fanout < 1) return 0;
+    return Lookup(it->second, fanout);
+}
+
 namespace {
 // Fits interface required by TimingDAG and reports errors to given
 // ErrorCollector.
@@ -161,27 +386,64 @@ struct TimingErrorCollector {
 };
 }
 
-bool PipeTimer::TimePipe(PipeSys* sys, ErrorCollector* coll) const {
+bool PipeTimer::TimePipe(PipeSys* sys, ErrorCollector* coll,
+                         PipeTimingStats* stats) const {
+    // Count the loads on each value: its uses as an operand or valid, in any
+    // pipe of the system. Constants are tie-offs and drive nothing.
+    map<const IRStmt*, int> fanout;
+    for (auto& pipe : sys->pipes) {
+        for (auto* stmt : pipe->stmts) {
+            for (auto* arg : stmt->args) {
+                fanout[arg]++;
+            }
+            if (stmt->valid_in) {
+                fanout[stmt->valid_in]++;
+            }
+        }
+    }
+
     // Build timing DAG nodes
     TimingDAG<IRStmt, IRTimeVar> dag;
     for (auto& pipe : sys->pipes) {
         for (auto* stmt : pipe->stmts) {
-            dag.AddNode(stmt, model_->Delay(stmt));
+            int delay = model_->Delay(stmt);
+            auto loads = fanout.find(stmt);
+            if (loads != fanout.end() &&
+                !(stmt->type == IRStmtExpr && stmt->op == IRStmtOpConst)) {
+                delay += model_->FanoutDelay(stmt, loads->second);
+            }
+            dag.AddNode(stmt, delay, stmt->width > 0 ? stmt->width : 0);
+            // Only pure computations may be moved to save registers; side
+            // effects stay where the solver's ordering puts them.
+            if (stmt->type != IRStmtExpr) {
+                dag.PinNode(stmt);
+            }
         }
     }
     // Add edges between nodes for dataflow dependences and pipedag edges, and
     // attach timing vars.
     for (auto& pipe : sys->pipes) {
         for (auto* stmt : pipe->stmts) {
-            // Add edges for dataflow dependences
+            // Add edges for dataflow dependences. The data of a registered
+            // array read is only available |read_latency| stages after the
+            // read presents its index.
             for (auto* arg : stmt->args) {
-                dag.AddEdge(arg, stmt);
+                dag.AddEdge(arg, stmt, /* uses_value = */ true,
+                            ReadLatency(arg));
+            }
+            // A chan read follows its writers by at least the chan's
+            // latency, so that its value arrives through piperegs.
+            int chan_latency = 0;
+            if (stmt->type == IRStmtChanRead && stmt->port) {
+                chan_latency = stmt->port->latency;
             }
             for (auto* arg : stmt->pipedag_deps) {
-                dag.AddEdge(arg, stmt);
+                dag.AddEdge(arg, stmt, /* uses_value = */ false,
+                            arg->type == IRStmtChanWrite ? chan_latency : 0);
             }
             if (stmt->valid_in) {
-                dag.AddEdge(stmt->valid_in, stmt);
+                dag.AddEdge(stmt->valid_in, stmt, /* uses_value = */ true,
+                            ReadLatency(stmt->valid_in));
             }
             // Add timing var, if any
             if (stmt->timevar) {
@@ -191,51 +453,295 @@ bool PipeTimer::TimePipe(PipeSys* sys, ErrorCollector* coll) const {
         }
     }
 
-    // Solve!
+    // Solve! Given a stage limit, the budget is instead the smallest one that
+    // fits the PipeSys in that many stages, found by solving repeatedly; a
+    // budget large enough for any chain to fit in one stage bounds the search.
     TimingErrorCollector err(coll);
-    if (!dag.Solve(model_->DelayPerStage(), &err)) {
+    auto solve_start = chrono::steady_clock::now();
+    int budget = model_->DelayPerStage();
+    bool solved;
+    if (max_stages_ > 0) {
+        int most = max(max(budget, dag.TotalDelay()), 1);
+        budget = dag.FitStages(max_stages_, 1, most);
+        solved = budget != -1;
+        // If even the largest budget does not fit, solve at it once more to
+        // report any error that made the trials fail.
+        if (!solved && dag.Solve(most, &err)) {
+            coll->ReportError(sys->pipes[0]->entry->location,
+                    ErrorCollector::ERROR,
+                    strprintf("Pipe '%s' needs %d stages at any delay per "
+                              "stage, more than the maximum of %d. Its timing "
+                              "constraints set its length.",
+                              sys->pipes[0]->entry->label.c_str(),
+                              dag.StageCount(), max_stages_));
+        }
+    } else {
+        solved = dag.Solve(budget, &err);
+    }
+    if (stats) {
+        stats->solve_us = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - solve_start).count();
+        stats->nodes = dag.NodeCount();
+        stats->edges = dag.EdgeCount();
+        stats->nodes_visited = dag.Stats().nodes_visited;
+        stats->var_updates = dag.Stats().var_updates;
+    }
+    if (!solved) {
         // The error collector adapter should already have reported the errors
         // to `coll`.
         return false;
     }
 
+    // Spread computations over the stages found above, if requested. Later
+    // placement then works within the balanced budget.
+    int delay_per_stage = budget;
+    sys->balanced_delay = 0;
+    if (balance_stages_) {
+        delay_per_stage = dag.BalanceStages(delay_per_stage);
+        sys->balanced_delay = delay_per_stage;
+    }
+
+    // Tally each pipe's pipeline register bits, before and after the
+    // register-minimizing placement if requested.
+    auto pipereg_bits = [&dag](const Pipe* pipe) {
+        int bits = 0;
+        for (auto* stmt : pipe->stmts) {
+            bits += dag.RegisterCost(stmt);
+        }
+        return bits;
+    };
+    for (auto& pipe : sys->pipes) {
+        pipe->pipereg_bits = pipereg_bits(pipe.get());
+        pipe->pipereg_bits_saved = 0;
+    }
+    if (minimize_registers_) {
+        dag.MinimizeRegisterCost(delay_per_stage);
+        for (auto& pipe : sys->pipes) {
+            int bits = pipereg_bits(pipe.get());
+            pipe->pipereg_bits_saved = pipe->pipereg_bits - bits;
+            pipe->pipereg_bits = bits;
+        }
+    }
+    if (stats) {
+        for (auto& pipe : sys->pipes) {
+            stats->pipereg_bits += pipe->pipereg_bits;
+            stats->pipereg_bits_saved += pipe->pipereg_bits_saved;
+        }
+    }
+
     // Retrieve stage information from timing DAG and create PipeStages as
     // appropriate.
     //
     // Note that we start at stage 1 here, leaving stage 0 free for "insert X
     // into prior stage"-type transforms (e.g., stall logic generation) without
     // descending into negative-numbered stages.
+    //
+    // Find last stage in pipe; while < current stage, add a stage. In this
+    // way, each Pipe ends up with a contiguous sequence of PipeStages for the
+    // range of global pipestages over which it has nodes (statements).
+    auto extend_pipe = [](Pipe* pipe, int stage_number) {
+        while (pipe->stages.empty() ||
+               pipe->stages.back()->stage < stage_number) {
+            std::unique_ptr<PipeStage> new_stage(new PipeStage());
+            new_stage->stage = pipe->stages.size();
+            new_stage->pipe = pipe;
+            pipe->stages.push_back(move(new_stage));
+        }
+    };
     for (int stage = 0; stage < dag.StageCount(); stage++) {
         int stage_number = stage + 1;
         for (const auto* c_node : dag.NodesInStage(stage)) {
             IRStmt* node = const_cast<IRStmt*>(c_node);
             Pipe* pipe = node->pipe;
-            // Find last stage in pipe; while < current stage, add a stage.
-            // In this way, each Pipe ends up with a contiguous sequence of
-            // PipeStages for the range of global pipestages over which it has
-            // nodes (statements).
-            while (pipe->stages.empty() ||
-                   pipe->stages.back()->stage < stage_number) {
-                std::unique_ptr<PipeStage> new_stage(new PipeStage());
-                new_stage->stage = pipe->stages.size();
-                new_stage->pipe = pipe;
-                pipe->stages.push_back(move(new_stage));
-            }
+            extend_pipe(pipe, stage_number);
             PipeStage* pipestage = pipe->stages.back().get();
             pipestage->stmts.push_back(node);
             node->stage = pipestage;
         }
     }
+    // A chan's value is carried down its writer's pipe to the stage of each
+    // reader, which a chan latency places after the writer's last node.
+    for (auto& pipe : sys->pipes) {
+        for (auto* stmt : pipe->stmts) {
+            if (stmt->type != IRStmtChanRead || !stmt->port) continue;
+            for (auto* def : stmt->port->defs) {
+                extend_pipe(def->pipe, stmt->stage->stage);
+            }
+        }
+    }
+
+    // Report the budget found above along with the pipe's depth as staged,
+    // which, as in the timing report, counts the reserved stage 0 that the
+    // stage limit does not.
+    if (max_stages_ > 0) {
+        const Pipe* pipe = sys->pipes[0].get();
+        int depth = pipe->stages.size();
+        coll->ReportError(pipe->entry->location,
+                ErrorCollector::INFO,
+                strprintf("Pipe '%s' has %d stage%s with a delay per stage of "
+                          "%d (the timing model's is %d), the smallest that "
+                          "fits it in at most %d stage%s after stage 0.",
+                          pipe->entry->label.c_str(), depth,
+                          depth == 1 ? "" : "s", budget,
+                          model_->DelayPerStage(), max_stages_,
+                          max_stages_ == 1 ? "" : "s"));
+    }
+
+    // Record each stage's critical path for timing reports.
+    sys->delay_per_stage = budget;
+    sys->max_stages = max_stages_;
+    for (auto& pipe : sys->pipes) {
+        for (auto& stage : pipe->stages) {
+            const IRStmt* end = nullptr;
+            int end_time = 0;
+            for (auto* stmt : stage->stmts) {
+                int t = dag.GetArrival(stmt) + dag.GetDelay(stmt);
+                if (!end || t > end_time) {
+                    end = stmt;
+                    end_time = t;
+                }
+            }
+            for (const IRStmt* s = end; s; s = dag.GetCriticalPred(s)) {
+                TimingPathEntry entry;
+                entry.stmt = const_cast<IRStmt*>(s);
+                entry.delay = dag.GetDelay(s);
+                entry.start = dag.GetArrival(s);
+                stage->critical_path.push_back(entry);
+            }
+            std::reverse(stage->critical_path.begin(),
+                         stage->critical_path.end());
+        }
+    }
 
     return true;
 }
 
-unique_ptr<TimingModel> TimingModel::New(string name) {
+void PipeTimer::WriteReport(std::ostream* out,
+                            const std::vector<PipeSys*>& systems,
+                            int worst_paths) {
+    struct PathRef {
+        const Pipe* pipe;
+        const PipeStage* stage;
+        int delay;
+        int budget;
+    };
+    std::vector<PathRef> paths;
+
+    auto print_path = [out](const PipeStage* stage) {
+        for (auto& entry : stage->critical_path) {
+            const IRStmt* stmt = entry.stmt;
+            std::string name = strprintf("%%%d", stmt->valnum);
+            if (stmt->width > 0) name += strprintf("[%d]", stmt->width);
+            std::string where = stmt->location.line > 0 ?
+                stmt->location.ToString() : "(generated)";
+            *out << strprintf("    %-14s %-14s %6d +%-5d %s",
+                             name.c_str(), stmt->Keyword(),
+                             entry.start, entry.delay, where.c_str());
+            if (stmt->pipe != stage->pipe) {
+                *out << " (pipe '" << stmt->pipe->entry->label << "')";
+            }
+            *out << std::endl;
+        }
+    };
+
+    for (auto* sys : systems) {
+        for (auto& pipe : sys->pipes) {
+            *out << "Pipe '" << pipe->entry->label << "': "
+                << pipe->stages.size() << " stages, "
+                << sys->delay_per_stage << " delay per stage";
+            if (sys->max_stages > 0) {
+                *out << strprintf(" (fit to at most %d stage%s after "
+                                  "stage 0)",
+                                  sys->max_stages,
+                                  sys->max_stages == 1 ? "" : "s");
+            }
+            *out << ", "
+                << pipe->pipereg_bits << " pipeline register bits";
+            if (pipe->pipereg_bits_saved) {
+                *out << " (" << pipe->pipereg_bits_saved << " saved)";
+            }
+            *out << std::endl;
+            for (auto& stage : pipe->stages) {
+                if (stage->critical_path.empty()) continue;
+                const TimingPathEntry& last = stage->critical_path.back();
+                int delay = last.start + last.delay;
+                *out << strprintf("  Stage %d: critical path %d, slack %d",
+                                 stage->stage, delay,
+                                 sys->delay_per_stage - delay)
+                    << std::endl;
+                print_path(stage.get());
+                PathRef ref = { pipe.get(), stage.get(), delay,
+                                sys->delay_per_stage };
+                paths.push_back(ref);
+            }
+            if (sys->balanced_delay) {
+                std::string profile;
+                int max_delay = 0;
+                for (auto& stage : pipe->stages) {
+                    if (stage->critical_path.empty()) continue;
+                    const TimingPathEntry& last = stage->critical_path.back();
+                    int delay = last.start + last.delay;
+                    max_delay = std::max(max_delay, delay);
+                    if (!profile.empty()) profile += " ";
+                    profile += strprintf("%d", delay);
+                }
+                *out << strprintf("  Balanced stage delays: %s (max %d, "
+                                  "balanced to %d)", profile.c_str(),
+                                  max_delay, sys->balanced_delay)
+                    << std::endl;
+            }
+            *out << std::endl;
+        }
+    }
+
+    // Rank by slack; ties keep program order.
+    std::stable_sort(paths.begin(), paths.end(),
+                     [](const PathRef& a, const PathRef& b) {
+                         return (a.budget - a.delay) < (b.budget - b.delay);
+                     });
+    if (static_cast<int>(paths.size()) > worst_paths) {
+        paths.resize(worst_paths);
+    }
+    *out << "Worst " << paths.size() << " paths:" << std::endl;
+    for (auto& ref : paths) {
+        const IRStmt* end = ref.stage->critical_path.back().stmt;
+        *out << strprintf("  Pipe '%s' stage %d: critical path %d, slack %d, "
+                          "ending at %%%d %s",
+                          ref.pipe->entry->label.c_str(), ref.stage->stage,
+                          ref.delay, ref.budget - ref.delay,
+                          end->valnum, end->Keyword());
+        if (end->location.line > 0) {
+            *out << " (" << end->location.ToString() << ")";
+        }
+        *out << std::endl;
+    }
+}
+unique_ptr<TimingModel> TimingModel::New(const string& name,
+                                         ErrorCollector* coll) {
+    static const string kLibraryPrefix = "library:";
     unique_ptr<TimingModel> ret;
     if (name == "standard") {
         ret.reset(new StandardTimingModel());
     } else if (name == "null") {
         ret.reset(new NullTimingModel());
+    } else if (name.compare(0, kLibraryPrefix.size(), kLibraryPrefix) == 0) {
+        string filename = name.substr(kLibraryPrefix.size());
+        ifstream in(filename);
+        if (!in.good()) {
+            Location loc;
+            loc.filename = filename;
+            coll->ReportError(loc, ErrorCollector::ERROR,
+                              "Could not open timing library '" +
+                              filename + "'");
+            return ret;
+        }
+        unique_ptr<TableTimingModel> table(new TableTimingModel());
+        if (table->Load(filename, &in, coll)) {
+            ret = move(table);
+        }
+    } else {
+        coll->ReportError(Location(), ErrorCollector::ERROR,
+                          "Unknown timing model '" + name + "'");
     }
     return ret;
 }
@@ -19,10 +19,14 @@
 
 #include "backend/ir.h"
 #include "backend/pipe.h"
+#include "common/error-collector.h"
 
 #include <vector>
+#include <map>
 #include <memory>
 #include <string>
+#include <istream>
+#include <ostream>
 
 namespace autopiper {
 
@@ -30,8 +34,17 @@ class TimingModel {
     public:
         virtual int Delay(const IRStmt* stmt) const = 0;
         virtual int DelayPerStage() const = 0;
+        // The delay added to |stmt|'s for driving |fanout| loads (the uses
+        // of its value as an operand or valid) rather than one.
+        virtual int FanoutDelay(const IRStmt* stmt, int fanout) const {
+            return 0;
+        }
 
-        static std::unique_ptr<TimingModel> New(std::string name);
+        // Returns the model named |name|: "standard", "null", or
+        // "library:<filename>" to load a TableTimingModel. Reports an error
+        // and returns null if the name is unknown or the library is invalid.
+        static std::unique_ptr<TimingModel> New(const std::string& name,
+                                                ErrorCollector* coll);
 };
 
 class StandardTimingModel : public TimingModel {
@@ -40,9 +53,69 @@ class StandardTimingModel : public TimingModel {
 
         virtual int Delay(const IRStmt* stmt) const;
         virtual int DelayPerStage() const;
+        // A gate drives kMaxFanout loads in its own delay; more are driven
+        // through a tree of buffers, each a logic layer, kMaxFanout wide.
+        virtual int FanoutDelay(const IRStmt* stmt, int fanout) const;
 
     private:
         static const int kGatesPerStage = 32;  // TODO: parameterize this (knobs on cmdline)
+        static const int kMaxFanout = 4;
+};
+
+// A timing model driven by a technology library: per-op delay tables indexed
+// by bit width, plus a target clock period, in whatever delay unit the
+// library chooses. The library is a line-oriented text file:
+//
+//   # comment
+//   clock_period 500
+//   add 1:40 8:110 32:180 64:220
+//   mul 8:300 32:900
+//
+// Each op line gives an IR statement keyword (as printed by --print-ir; any
+// other keyword is an error) and a list of width:delay points. An op's width is the widest of its result and
+// operands. Delays between listed widths are linearly interpolated; outside the
+// listed range they are extrapolated from the nearest two points (clamped at
+// zero). Unlisted ops, and shifts by a constant amount, have zero delay.
+//
+// An optional 'fanout' line gives the same kind of table indexed by fanout
+// (the number of loads a value drives) instead of width, for the delay added
+// to every value that drives that many, e.g.:
+//
+//   fanout 1:0 4:0 16:45 64:90
+//
+// Without one, fanout adds no delay.
+//
+// Optional 'input_delay' and 'output_delay' lines give the part of the clock
+// period spent outside the module on each exported input and output, e.g.:
+//
+//   input_delay 150
+//   output_delay 100
+//
+// An unregistered exported port's read or write takes that delay; one with a
+// latency (see IRPort::latency) meets its register at the boundary instead.
+class TableTimingModel : public TimingModel {
+    public:
+        TableTimingModel()
+            : clock_period_(0), input_delay_(0), output_delay_(0) {}
+
+        // Parses a library from |in|; |filename| is used for error locations.
+        bool Load(const std::string& filename, std::istream* in,
+                  ErrorCollector* coll);
+
+        virtual int Delay(const IRStmt* stmt) const;
+        virtual int DelayPerStage() const;
+        virtual int FanoutDelay(const IRStmt* stmt, int fanout) const;
+
+    private:
+        int clock_period_;
+        int input_delay_;
+        int output_delay_;
+        // keyword -> (width -> delay)
+        std::map<std::string, std::map<int, int>> tables_;
+
+        static int Lookup(const std::map<int, int>& table, int width);
+        // The delay outside the module on |stmt|'s exported port, if any.
+        int IODelay(const IRStmt* stmt) const;
 };
 
 class NullTimingModel : public TimingModel {
@@ -53,13 +126,54 @@ class NullTimingModel : public TimingModel {
         virtual int DelayPerStage() const { return 1; }
 };
 
+// Size of and work done on the timing DAG built by PipeTimer::TimePipe().
+struct PipeTimingStats {
+    PipeTimingStats()
+        : nodes(0), edges(0), nodes_visited(0), var_updates(0),
+          solve_us(0), pipereg_bits(0), pipereg_bits_saved(0) {}
+    int nodes;
+    int edges;
+    int nodes_visited;
+    int var_updates;
+    // Wall time spent in TimingDAG::Solve(), in microseconds.
+    long solve_us;
+    int pipereg_bits;
+    int pipereg_bits_saved;
+};
+
 class PipeTimer {
     public:
-        PipeTimer(TimingModel* model) : model_(model) {}
-        bool TimePipe(PipeSys* sys, ErrorCollector* coll) const;
+        // If |minimize_registers| is set, computations are moved within
+        // their slack to minimize pipeline register bits after the usual
+        // placement. If |balance_stages| is set, computations are first
+        // spread across the same number of stages to shorten the fullest
+        // stage. If |max_stages| is nonzero, the delay budget per stage is
+        // the smallest that fits each PipeSys in that many stages, rather
+        // than the timing model's.
+        PipeTimer(TimingModel* model, bool minimize_registers = false,
+                  bool balance_stages = false, int max_stages = 0)
+            : model_(model), minimize_registers_(minimize_registers),
+              balance_stages_(balance_stages), max_stages_(max_stages) {}
+        // Fills in |stats| if non-null.
+        bool TimePipe(PipeSys* sys, ErrorCollector* coll,
+                      PipeTimingStats* stats = nullptr) const;
+
+        // Writes, for each pipe of each timed PipeSys, every stage's
+        // critical path (statements, delays and start times within the
+        // stage) and its slack against the delay budget, followed by a
+        // summary of the |worst_paths| paths with the least slack overall.
+        // Balanced pipes also get their per-stage delay profile.
+        const TimingModel* model() const { return model_; }
+
+        static void WriteReport(std::ostream* out,
+                                const std::vector<PipeSys*>& systems,
+                                int worst_paths);
 
     private:
         TimingModel* model_;
+        bool minimize_registers_;
+        bool balance_stages_;
+        int max_stages_;
 };
 
 }
@@ -16,60 +16,237 @@
 
 #include "backend/pipe.h"
 #include "backend/ir.h"
+#include "common/util.h"
 
 #include <sstream>
 #include <iostream>
+#include <stdlib.h>
 
 using namespace autopiper;
 using namespace std;
 
 namespace autopiper {
 
-string Pipe::ToString() const {
-    ostringstream os;
+bool PipeDumpFilter::SelectsPipe(const Pipe* pipe) const {
+    return pipes.empty() || pipes.count(pipe->entry->label);
+}
+
+bool PipeDumpFilter::SelectsStage(const PipeStage* stage) const {
+    return (first_stage == -1 || stage->stage >= first_stage) &&
+           (last_stage == -1 || stage->stage <= last_stage);
+}
+
+bool PipeDumpFilter::ParseStageRange(const string& text, int* first,
+                                     int* last) {
+    size_t dash = text.find('-');
+    string lo = text.substr(0, dash);
+    string hi = dash == string::npos ? lo : text.substr(dash + 1);
+    for (const string* item : { &lo, &hi }) {
+        if (item->empty() ||
+            item->find_first_not_of("0123456789") != string::npos) {
+            return false;
+        }
+    }
+    *first = atoi(lo.c_str());
+    *last = atoi(hi.c_str());
+    return *first <= *last;
+}
+
+void Pipe::Print(ostream* out, const PipeDumpFilter& filter) const {
+    ostream& os = *out;
 
-    os << "Pipe: entry at '" << entry->label << "'" << endl;
-    os << "Spawned by: ";
+    os << "# Pipe: entry at '" << entry->label << "'\n";
+    os << "# Spawned by: ";
     if (spawn) {
-        os << " stmt %" << spawn->valnum << " in BB '" << spawn->bb->label << "'" << endl;
+        os << " stmt %" << spawn->valnum << " in BB '" << spawn->bb->label << "'\n";
     } else {
-        os << " (entry point)" << endl;
+        os << " (entry point)\n";
     }
+    os << entry->label << ":\n";
 
     if (!stages.empty()) {
         for (auto& stage : stages) {
-            os << "Pipestage " << stage->stage << endl;
+            if (!filter.SelectsStage(stage.get())) continue;
+            os << "# Pipestage " << stage->stage << "\n";
             if (stage->stall) {
-                os << "Stall = %" << stage->stall->valnum << endl;
+                os << "# Stall = %" << stage->stall->valnum << "\n";
             }
-            os << "Kills = { ";
+            if (stage->skid) {
+                os << "# Skid = " << stage->skid->depth << " entries, present = %"
+                   << stage->skid->present->valnum << "\n";
+            }
+            os << "# Kills = { ";
             for (auto* kill : stage->kills) {
                 os << "%" << kill->valnum << ", ";
             }
-            os << " }" << endl;
+            os << " }\n";
             for (auto* stmt : stage->stmts) {
                 if (stmt->deleted) continue;
-                os << stmt->ToString() << endl;
+                stmt->Print(out);
+                os << "\n";
             }
-            os << endl;
+            os << "\n";
         }
     } else {
         for (auto* stmt : stmts) {
-            os << stmt->ToString() << endl;
+            stmt->Print(out);
+            os << "\n";
         }
     }
-    os << endl;
+    os << "\n";
+}
 
+string Pipe::ToString() const {
+    ostringstream os;
+    Print(&os);
     return os.str();
 }
 
-string PipeSys::ToString() const {
-    string s;
+void PipeSys::Print(ostream* out, const PipeDumpFilter& filter) const {
     for (auto& pipe : pipes) {
-        s += pipe->ToString();
-        s += "\n";
+        if (!filter.SelectsPipe(pipe.get())) continue;
+        pipe->Print(out, filter);
+        *out << "\n";
+    }
+}
+
+string PipeSys::ToString() const {
+    ostringstream os;
+    Print(&os);
+    return os.str();
+}
+
+namespace {
+
+// The first and last stages holding any of |pipe|'s statements, or (-1, -1)
+// if none. Stage 0 holds only stage 1's stall logic.
+pair<int, int> OccupiedStages(const Pipe* pipe) {
+    int first = -1, last = -1;
+    for (auto& stage : pipe->stages) {
+        if (stage->stage == 0) continue;
+        for (auto* stmt : stage->stmts) {
+            if (stmt->deleted) continue;
+            if (first == -1) first = stage->stage;
+            last = stage->stage;
+            break;
+        }
+    }
+    return make_pair(first, last);
+}
+
+}  // anonymous namespace
+
+void WriteThroughputReport(ostream* out, const vector<PipeSys*>& systems) {
+    for (auto* sys : systems) {
+        if (sys->pipes.empty()) continue;
+        const IRBB* entry = sys->pipes[0]->entry;
+        *out << "Process '" << entry->label << "': issues up to "
+             << entry->lanes << " transaction"
+             << (entry->lanes == 1 ? "" : "s") << " per cycle" << endl;
+
+        // A backedge in any pipe of the process stalls every stage before
+        // its restart, in all of the process's pipes (see AssignStalls() in
+        // lower.cc), for one cycle per iteration; the process issues nothing
+        // new in those cycles.
+        int loops = 0;
+        for (auto& pipe : sys->pipes) {
+            pair<int, int> occupied = OccupiedStages(pipe.get());
+            if (occupied.first == -1) continue;
+            int depth = occupied.second - occupied.first + 1;
+            *out << "  Pipe '" << pipe->entry->label << "'";
+            if (entry->lanes > 1) {
+                *out << " (lane " << pipe->lane << ")";
+            }
+            if (depth == 1) {
+                *out << strprintf(": stage %d, depth 1 cycle",
+                                  occupied.first) << endl;
+            } else {
+                *out << strprintf(": stages %d-%d, depth %d cycles",
+                                  occupied.first, occupied.second, depth)
+                     << endl;
+            }
+
+            for (auto& stage : pipe->stages) {
+                if (stage->skid) {
+                    *out << strprintf("    Stage %d: elastic, with %d skid "
+                                      "buffer entries", stage->stage,
+                                      stage->skid->depth) << endl;
+                }
+            }
+
+            for (auto& stage : pipe->stages) {
+                for (auto* stmt : stage->stmts) {
+                    if (stmt->deleted || stmt->type != IRStmtBackedge) continue;
+                    int backedge_stage = stage->stage;
+                    int restart_stage =
+                        stmt->restart_target->restart_cond->stage->stage;
+                    int latency = backedge_stage - restart_stage + 1;
+
+                    *out << "    Loop %" << stmt->valnum;
+                    if (stmt->location.line > 0) {
+                        *out << " (" << stmt->location.ToString() << ")";
+                    }
+                    *out << strprintf(": backedge in stage %d, restart in "
+                                      "stage %d", backedge_stage,
+                                      restart_stage) << endl;
+                    // Without a killyounger, the backedge and its restart
+                    // share a stage, so an iteration occupies the restart
+                    // stage for one cycle while the stages before it stall.
+                    // With one, the iteration kills the younger transactions
+                    // behind it, so the loop holds the pipe to itself for
+                    // its whole latency. A pipelined loop restarts iterations
+                    // above its backedge, so each costs one issue cycle and
+                    // the loop's own iterations start every |latency| cycles.
+                    bool pipelined = !stmt->dom_killyounger &&
+                                     latency > 1;
+                    int cost = pipelined ? 1 : latency;
+                    *out << strprintf("      loop-carried latency %d cycle%s",
+                                      latency, latency == 1 ? "" : "s");
+                    if (!stmt->dom_killyounger && restart_stage <= 1) {
+                        *out << "; it restarts into the first stage, which "
+                                "does not stall to make room for it";
+                    } else {
+                        loops++;
+                        *out << strprintf("; each iteration costs %d issue "
+                                          "cycle%s: ", cost,
+                                          cost == 1 ? "" : "s");
+                        if (stmt->dom_killyounger) {
+                            *out << strprintf("it kills the younger "
+                                              "transactions before stage %d",
+                                              backedge_stage);
+                        } else if (restart_stage == 2) {
+                            *out << "it stalls stage 1";
+                        } else {
+                            *out << strprintf("it stalls stages 1-%d",
+                                              restart_stage - 1);
+                        }
+                    }
+                    *out << endl;
+                    if (pipelined) {
+                        *out << strprintf("      pipelined: iteration "
+                                          "interval %d, and younger "
+                                          "transactions in stages %d-%d may "
+                                          "overtake its iterations",
+                                          latency, restart_stage,
+                                          backedge_stage) << endl;
+                    }
+                }
+            }
+        }
+
+        if (loops == 0) {
+            *out << strprintf("  Throughput: initiation interval 1; %d "
+                              "transaction%s per cycle", entry->lanes,
+                              entry->lanes == 1 ? "" : "s") << endl;
+        } else {
+            *out << strprintf("  Throughput: initiation interval 1 + c cycles "
+                              "for c issue cycles of loop iterations per "
+                              "issue, i.e. at most %d/(1+c) transactions per "
+                              "cycle (%d with no iterations)",
+                              entry->lanes, entry->lanes) << endl;
+        }
+        *out << endl;
     }
-    return s;
 }
 
 }  // namespace autopiper
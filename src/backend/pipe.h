@@ -18,12 +18,38 @@
 #define _AUTOPIPER_PIPE_H_
 
 #include "backend/ir.h"
+#include "backend/cfg-analysis.h"
 
+#include <map>
 #include <vector>
 #include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <assert.h>
 
 namespace autopiper {
 
+// Selects the parts of the lowered form that Pipe::Print() and
+// PipeSys::Print() write: the pipes whose entry BBs are labeled in |pipes|
+// (all, if empty), and of those, the stages from |first_stage| through
+// |last_stage| (-1 for no bound).
+struct PipeDumpFilter {
+    PipeDumpFilter() : first_stage(-1), last_stage(-1) {}
+
+    std::set<std::string> pipes;
+    int first_stage;
+    int last_stage;
+
+    bool SelectsPipe(const Pipe* pipe) const;
+    bool SelectsStage(const PipeStage* stage) const;
+
+    // Parses a stage range, 'N' or 'N-M', into |first| and |last|. Returns
+    // false if malformed.
+    static bool ParseStageRange(const std::string& text, int* first,
+                                int* last);
+};
+
 // A Pipe is a single pipeline containing lowered IRStmts. It refers to the
 // original Program's IRStmts; no copies are made.
 struct Pipe {
@@ -31,6 +57,9 @@ struct Pipe {
         parent = NULL;
         spawn = NULL;
         entry = NULL;
+        lane = 0;
+        pipereg_bits = 0;
+        pipereg_bits_saved = 0;
     }
 
     // BBs are used during lowering but are not valid/used once statements are
@@ -38,6 +67,8 @@ struct Pipe {
     IRBB* entry;  // target of spawn
     std::vector<const IRBB*> roots;  // BBs without predecessors
     std::vector<IRBB*> bbs;
+    // Cached RPO/domtree over |bbs|, shared by the lowering passes.
+    CFGAnalyses analyses;
 
     // Statements are placed in |stmts| in a valid dataflow order, but are
     // unconstrained except for pipedag edges.
@@ -48,12 +79,58 @@ struct Pipe {
     std::vector<Pipe*> children;  // spawned (direct) children
     PipeSys* sys;     // pipesys: whole tree of pipes
     IRStmt* spawn;    // spawning statement
+    // Lane of a multi-lane entry this pipe belongs to (see IRBB::lanes).
+    // Transactions in the same stage are ordered by lane, lane 0 oldest.
+    int lane;
 
     std::vector<std::unique_ptr<PipeStage>> stages;
 
+    // Pipeline register bits needed to carry this pipe's values to their
+    // latest uses, as placed by PipeTimer, and how many of those the
+    // register-minimizing placement saved (if enabled).
+    int pipereg_bits;
+    int pipereg_bits_saved;
+
+    // Writes the pipe's stages, or before staging its statements, as a BB of
+    // text IR labeled with the entry's label, with the stages' stall, skid
+    // and kill signals as comments.
+    void Print(std::ostream* out,
+               const PipeDumpFilter& filter = PipeDumpFilter()) const;
     std::string ToString() const;
 };
 
+// One statement on a stage's critical path: its delay, and the time within
+// the stage at which it starts (per the timing model's delay units).
+struct TimingPathEntry {
+    IRStmt* stmt;
+    int delay;
+    int start;
+};
+
+// A skid buffer at the input of an elastic pipestage. When the stage is
+// stalled, the transactions arriving from the prior stage are queued here, up
+// to |depth| of them, instead of being lost; the stages upstream stall only
+// once the buffer fills. See AssignElasticStalls() in lower.cc.
+struct SkidBuffer {
+    SkidBuffer() : depth(0), present(nullptr) {}
+
+    int depth;
+    // In the prior stage: set if a transaction leaves it toward this stage,
+    // i.e., the OR of all valid signals crossing the boundary.
+    IRStmt* present;
+};
+
+// One performance-counter event of a pipestage: |name| is one of "valid",
+// "stall", "kill", "bypass_wait" and "spawn_stall" (see AssignPerfEvents()
+// in lower.cc). With IRProgram::profile, a stage also has events of single
+// statements, which only the profile trace records: |site| is then the
+// statement, whose location the profile reports.
+struct PerfEvent {
+    const char* name;
+    IRStmt* signal;
+    const IRStmt* site;
+};
+
 // A PipeStage collects all nodes together that are logically in the same stage
 // of a single Pipe. (Note that this is slightly different from what ends up in
 // the timing DAG: the timing DAG computes timing across *all* pipes, since
@@ -61,7 +138,7 @@ struct Pipe {
 // other operations we care only about what's in a single pipe.)
 struct PipeStage {
     PipeStage()
-        : stage(0), stall(nullptr) {}
+        : stage(0), stall(nullptr), kill(nullptr) {}
 
     int stage;  // global stage number, starting from 0.
     std::vector<IRStmt*> stmts;
@@ -70,25 +147,95 @@ struct PipeStage {
     // downstream)
     IRStmt* stall;
 
+    // skid buffer at this stage's input, if this stage is elastic. The stall
+    // signal (always present in that case) then holds the buffer's contents.
+    std::unique_ptr<SkidBuffer> skid;
+
     // Kills that kill the whole stage, across the input valid-cut. This does
     // not include any killyoungers -- those are accounted for directly in
     // AssignKills() -- but can include inputs from other transforms, e.g.
     // kill_if condition clone insertion.
     std::vector<IRStmt*> kills;
 
-    // Extra statements added after lowering, owned directly by the stage.
-    std::vector<std::unique_ptr<IRStmt>> owned_stmts;
+    // kill signal, if any, as AssignKills() built it from the killyoungers and
+    // |kills| above: set when the transaction in this stage is killed. Unlike
+    // the signal that gates the stage's valids, it does not include |stall|.
+    IRStmt* kill;
+
+    // The valid signals entering this stage that AssignKills() gated with
+    // the stage's kill (and stall), each mapped from its gated form, which
+    // the statements use in its place.
+    std::map<IRStmt*, IRStmt*> ungated_valids;
+
+    // Events counted by the performance counters in this stage, if enabled
+    // (see AssignPerfEvents() in lower.cc), each a 1-bit signal set in the
+    // cycles in which the event occurs.
+    std::vector<PerfEvent> perf_events;
+
+    // Longest dependence chain ending at one of this stage's statements, in
+    // dataflow order, as found by PipeTimer. Earlier entries may belong to
+    // other pipes in the same global stage.
+    std::vector<TimingPathEntry> critical_path;
 
     Pipe* pipe;
 };
 
+// Predicates on a statement's input and output valid signals, computed during
+// if-conversion.
+struct StmtValidPreds {
+    Predicate<IRStmt*> in;
+    Predicate<IRStmt*> out;
+};
+
 struct PipeSys {
+    PipeSys()
+        : program(nullptr), delay_per_stage(0), max_stages(0),
+          balanced_delay(0) {}
+
     IRProgram* program;
     std::vector<std::unique_ptr<Pipe>> pipes;
 
+    // The delay budget per stage, recorded by PipeTimer: the timing model's,
+    // or if the PipeSys was fit to at most |max_stages| (nonzero) stages, the
+    // smallest budget that fits (see TimingDAG::FitStages()).
+    int delay_per_stage;
+    int max_stages;
+    // If stages were balanced, the smaller budget they were balanced to
+    // (see TimingDAG::BalanceStages()); else 0.
+    int balanced_delay;
+
+    // Lowering-only side table, indexed by IRStmt::valid_preds_slot.
+    // AssignValidPredSlots() numbers the statements of all pipes densely,
+    // once, before they are if-converted, so that pipes converted
+    // concurrently read and fill in their own entries without locking.
+    // Statements created after that have no entry, and read as having
+    // empty (false) predicates, except that a phi's muxes share its entry.
+    // Discarded once lowering of this PipeSys completes.
+    std::vector<StmtValidPreds> valid_preds;
+    StmtValidPreds& ValidPreds(const IRStmt* stmt) {
+        assert(stmt->valid_preds_slot >= 0);
+        return valid_preds[stmt->valid_preds_slot];
+    }
+    const StmtValidPreds& LookupValidPreds(const IRStmt* stmt) const {
+        static const StmtValidPreds kNone;
+        return stmt->valid_preds_slot >= 0 ?
+            valid_preds[stmt->valid_preds_slot] : kNone;
+    }
+
+    void Print(std::ostream* out,
+               const PipeDumpFilter& filter = PipeDumpFilter()) const;
     std::string ToString() const;
 };
 
+// Writes, for each PipeSys, the steady-state throughput that its backedges
+// allow: each pipe's depth after staging, and for each backedge the stages
+// of the backedge and its restart, the loop-carried latency of an iteration
+// and the issue cycles that each iteration costs the process, through stalls
+// or kills. Backedges are the only source of stalls, so the report ends with
+// the resulting bound on transactions per cycle.
+void WriteThroughputReport(std::ostream* out,
+                           const std::vector<PipeSys*>& systems);
+
 }  // namespace autopiper
 
 #endif
@@ -0,0 +1,304 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_PREDICATE_MIN_H_
+#define _AUTOPIPER_PREDICATE_MIN_H_
+
+#include <stdint.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "backend/predicate.h"
+
+namespace autopiper {
+
+// The truth table of a predicate over its factors, and two-level
+// minimization of the predicate from it.
+//
+// Predicate's own simplifications (S1-S4 in predicate.h) are local: they
+// apply only between pairs of terms as they are ORed together, so the DNF
+// that if-conversion produces for a complex CFG may have many more terms and
+// factors than needed (e.g. A&B | ~A&C | B&C, whose B&C is redundant).
+// Minimize() rebuilds a predicate as a minimal-cost cover of prime
+// implicants (Quine-McCluskey, with a greedy cover after the essential
+// primes), which is cheaper to build as an AND/OR tree.
+//
+// The table is canonical -- it is over only the factors the function depends
+// on, so predicates with equal tables are the same function, however their
+// terms were built -- and so it also serves as a key for sharing one signal
+// between equivalent predicates.
+//
+// Only predicates over at most kMaxFactors factors are tabulated; Build()
+// returns false for larger ones.
+template<typename T>
+class PredicateTable {
+ public:
+  static const int kMaxFactors = 10;
+
+  template<typename FactorSet>
+  static bool Build(const Predicate<T, FactorSet>& pred,
+                    PredicateTable* table) {
+      std::vector<T>& factors = table->factors_;
+      factors.clear();
+      for (auto& term : pred.Terms()) {
+          for (auto& factor : term.Factors()) {
+              factors.push_back(factor.first);
+          }
+      }
+      std::sort(factors.begin(), factors.end(), FactorLess<T>());
+      factors.erase(std::unique(factors.begin(), factors.end()),
+                    factors.end());
+      if (factors.size() > kMaxFactors) return false;
+
+      unsigned minterms = 1u << factors.size();
+      table->bits_.assign((minterms + 63) / 64, 0);
+      for (auto& term : pred.Terms()) {
+          Cube cube = table->TermCube(term.Factors());
+          for (unsigned m = 0; m < minterms; m++) {
+              if (cube.Covers(m)) table->Set(m);
+          }
+      }
+      // Drop factors the function does not depend on (e.g. B in A&B | A&~B),
+      // so that equivalent predicates have equal tables.
+      for (int i = factors.size() - 1; i >= 0; i--) {
+          if (table->Independent(i)) table->DropFactor(i);
+      }
+      return true;
+  }
+
+  bool operator==(const PredicateTable& other) const {
+      return factors_ == other.factors_ && bits_ == other.bits_;
+  }
+  bool operator<(const PredicateTable& other) const {
+      if (factors_ != other.factors_) {
+          return std::lexicographical_compare(
+                  factors_.begin(), factors_.end(),
+                  other.factors_.begin(), other.factors_.end(),
+                  FactorLess<T>());
+      }
+      return bits_ < other.bits_;
+  }
+
+  // Returns a minimal sum-of-products predicate with this truth table.
+  Predicate<T> Minimize() const {
+      std::vector<unsigned> on_set;
+      for (unsigned m = 0; m < (1u << factors_.size()); m++) {
+          if (Get(m)) on_set.push_back(m);
+      }
+      std::vector<Cube> cover = Cover(Primes(on_set), on_set);
+
+      Predicate<T> result = Predicate<T>::False();
+      for (auto& cube : cover) {
+          Predicate<T> term = Predicate<T>::True();
+          for (unsigned i = 0; i < factors_.size(); i++) {
+              if (cube.mask & (1u << i)) {
+                  term = term.AndWith(factors_[i], (cube.value >> i) & 1);
+              }
+          }
+          result = result.OrWith(term);
+      }
+      return result;
+  }
+
+  // The cost of building |pred| as an AND/OR tree: one gate input per
+  // factor, plus one per term.
+  template<typename FactorSet>
+  static int Cost(const Predicate<T, FactorSet>& pred) {
+      int cost = 0;
+      for (auto& term : pred.Terms()) {
+          cost += term.Factors().size() + 1;
+      }
+      return cost;
+  }
+
+ private:
+  // Factors, sorted by FactorLess; bit i of a minterm is the value of factors_[i].
+  std::vector<T> factors_;
+  std::vector<uint64_t> bits_;
+
+  // A product term over the factors: those in |mask| must equal their bits
+  // in |value| (which is zero outside |mask|).
+  struct Cube {
+      unsigned mask;
+      unsigned value;
+
+      Cube(unsigned mask_, unsigned value_) : mask(mask_), value(value_) {}
+
+      bool Covers(unsigned minterm) const {
+          return (minterm & mask) == value;
+      }
+      int Literals() const {
+          int n = 0;
+          for (unsigned m = mask; m; m &= m - 1) n++;
+          return n;
+      }
+      bool operator==(const Cube& other) const {
+          return mask == other.mask && value == other.value;
+      }
+      bool operator<(const Cube& other) const {
+          if (mask != other.mask) return mask < other.mask;
+          return value < other.value;
+      }
+  };
+
+  bool Get(unsigned m) const { return (bits_[m / 64] >> (m % 64)) & 1; }
+  void Set(unsigned m) { bits_[m / 64] |= uint64_t(1) << (m % 64); }
+
+  bool Independent(int i) const {
+      unsigned bit = 1u << i;
+      for (unsigned m = 0; m < (1u << factors_.size()); m++) {
+          if (!(m & bit) && Get(m) != Get(m | bit)) return false;
+      }
+      return true;
+  }
+  // Removes factors_[i], on which the function must not depend.
+  void DropFactor(int i) {
+      unsigned low = (1u << i) - 1;
+      unsigned minterms = 1u << (factors_.size() - 1);
+      std::vector<uint64_t> bits((minterms + 63) / 64, 0);
+      bits_.swap(bits);
+      for (unsigned m = 0; m < minterms; m++) {
+          unsigned old = (m & low) | ((m & ~low) << 1);
+          if ((bits[old / 64] >> (old % 64)) & 1) Set(m);
+      }
+      factors_.erase(factors_.begin() + i);
+  }
+
+  template<typename FactorSet>
+  Cube TermCube(const FactorSet& term_factors) const {
+      Cube cube(0, 0);
+      for (auto& factor : term_factors) {
+          unsigned bit = 1u << (std::lower_bound(factors_.begin(),
+                                                 factors_.end(),
+                                                 factor.first,
+                                                 FactorLess<T>()) -
+                                factors_.begin());
+          cube.mask |= bit;
+          if (factor.second) cube.value |= bit;
+      }
+      return cube;
+  }
+
+  // Returns the prime implicants of the function whose on-set is |on_set|.
+  // Starting from the minterms, each round merges every pair of implicants
+  // that differ in exactly one factor; an implicant that merges with none is
+  // prime.
+  std::vector<Cube> Primes(const std::vector<unsigned>& on_set) const {
+      unsigned all = (1u << factors_.size()) - 1;
+      std::vector<Cube> level;
+      for (unsigned m : on_set) level.push_back(Cube(all, m));
+
+      std::vector<Cube> primes;
+      while (!level.empty()) {
+          std::vector<Cube> next;
+          for (auto& cube : level) {
+              bool merged = false;
+              for (unsigned bit = 1; bit <= all; bit <<= 1) {
+                  if (!(cube.mask & bit)) continue;
+                  if (std::binary_search(level.begin(), level.end(),
+                                         Cube(cube.mask, cube.value ^ bit))) {
+                      merged = true;
+                      next.push_back(Cube(cube.mask & ~bit,
+                                          cube.value & ~bit));
+                  }
+              }
+              if (!merged) primes.push_back(cube);
+          }
+          std::sort(next.begin(), next.end());
+          next.erase(std::unique(next.begin(), next.end()), next.end());
+          level.swap(next);
+      }
+      return primes;
+  }
+
+  // Chooses primes covering |on_set|: first the essential ones (the only
+  // cover of some minterm), then greedily the one covering the most minterms
+  // not yet covered, preferring fewer factors. Primes left redundant by
+  // later choices are then dropped.
+  static std::vector<Cube> Cover(const std::vector<Cube>& primes,
+                                 const std::vector<unsigned>& on_set) {
+      std::vector<bool> chosen(primes.size(), false);
+      for (unsigned m : on_set) {
+          int only = -1, count = 0;
+          for (unsigned i = 0; i < primes.size() && count < 2; i++) {
+              if (primes[i].Covers(m)) {
+                  only = i;
+                  count++;
+              }
+          }
+          if (count == 1) chosen[only] = true;
+      }
+
+      std::vector<unsigned> uncovered;
+      for (unsigned m : on_set) {
+          bool covered = false;
+          for (unsigned i = 0; i < primes.size() && !covered; i++) {
+              covered = chosen[i] && primes[i].Covers(m);
+          }
+          if (!covered) uncovered.push_back(m);
+      }
+      while (!uncovered.empty()) {
+          int best = -1, best_count = 0;
+          for (unsigned i = 0; i < primes.size(); i++) {
+              if (chosen[i]) continue;
+              int count = 0;
+              for (unsigned m : uncovered) {
+                  if (primes[i].Covers(m)) count++;
+              }
+              if (count > best_count ||
+                  (count == best_count && count > 0 &&
+                   primes[i].Literals() < primes[best].Literals())) {
+                  best = i;
+                  best_count = count;
+              }
+          }
+          chosen[best] = true;
+          std::vector<unsigned> rest;
+          for (unsigned m : uncovered) {
+              if (!primes[best].Covers(m)) rest.push_back(m);
+          }
+          uncovered.swap(rest);
+      }
+
+      for (unsigned i = 0; i < primes.size(); i++) {
+          if (!chosen[i]) continue;
+          bool redundant = true;
+          for (unsigned m : on_set) {
+              if (!primes[i].Covers(m)) continue;
+              bool other = false;
+              for (unsigned j = 0; j < primes.size() && !other; j++) {
+                  other = j != i && chosen[j] && primes[j].Covers(m);
+              }
+              if (!other) {
+                  redundant = false;
+                  break;
+              }
+          }
+          if (redundant) chosen[i] = false;
+      }
+
+      std::vector<Cube> cover;
+      for (unsigned i = 0; i < primes.size(); i++) {
+          if (chosen[i]) cover.push_back(primes[i]);
+      }
+      return cover;
+  }
+};
+
+}  // namespace autopiper
+
+#endif
@@ -22,13 +22,141 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <utility>
+
+#include "common/small-vector.h"
 
 namespace autopiper {
 
+// The order of predicate factors: operator< unless specialized (ir.h orders
+// IRStmt* factors by statement ID, not by address, so that predicates built
+// on different threads are ordered alike).
+template<typename T>
+struct FactorLess {
+  bool operator()(const T& a, const T& b) const { return a < b; }
+};
+
+// Orders (factor, polarity) pairs by factor, then polarity.
+template<typename T>
+struct FactorPairLess {
+  template<typename Pair>
+  bool operator()(const Pair& a, const Pair& b) const {
+      FactorLess<T> less;
+      if (less(a.first, b.first)) return true;
+      if (less(b.first, a.first)) return false;
+      return a.second < b.second;
+  }
+};
+
+// Storage for the factors of one predicate term: (factor, polarity) pairs,
+// kept sorted by factor (see FactorLess) so that terms can be compared and merged in linear
+// time. PackedFactorSet keeps the pairs in a sorted inline small-vector, so
+// building, copying and simplifying the short terms produced by
+// if-conversion does not touch the heap. MapFactorSet is the original
+// std::map representation; it orders and compares identically and is kept as
+// a reference for the benchmark at the end of this file.
+template<typename T>
+class PackedFactorSet {
+ public:
+  typedef std::pair<T, bool> value_type;
+  typedef const value_type* const_iterator;
+
+  const_iterator begin() const { return factors_.begin(); }
+  const_iterator end() const { return factors_.end(); }
+  bool empty() const { return factors_.empty(); }
+  int size() const { return factors_.size(); }
+  void clear() { factors_.clear(); }
+
+  // Returns a pointer to the polarity of |t|, or NULL if |t| is absent.
+  const bool* Find(const T& t) const {
+      auto i = LowerBound(t);
+      if (i != factors_.end() && !FactorLess<T>()(t, i->first)) {
+          return &i->second;
+      }
+      return NULL;
+  }
+  void Set(const T& t, bool polarity) {
+      auto i = LowerBound(t);
+      if (i != factors_.end() && !FactorLess<T>()(t, i->first)) {
+          i->second = polarity;
+      } else {
+          factors_.insert(i, value_type(t, polarity));
+      }
+  }
+  void Erase(const T& t) {
+      auto i = LowerBound(t);
+      if (i != factors_.end() && !FactorLess<T>()(t, i->first)) {
+          factors_.erase(i);
+      }
+  }
+
+  bool operator==(const PackedFactorSet& other) const {
+      return factors_ == other.factors_;
+  }
+  bool operator<(const PackedFactorSet& other) const {
+      return std::lexicographical_compare(
+              factors_.begin(), factors_.end(),
+              other.factors_.begin(), other.factors_.end(),
+              FactorPairLess<T>());
+  }
+
+ private:
+  // Most terms have only a handful of factors (one per enclosing branch).
+  static const int kInlineFactors = 4;
+  typedef SmallVector<value_type, kInlineFactors> Storage;
+  Storage factors_;
+
+  typename Storage::iterator LowerBound(const T& t) {
+      return std::lower_bound(factors_.begin(), factors_.end(), t,
+              [](const value_type& p, const T& key) {
+                  return FactorLess<T>()(p.first, key);
+              });
+  }
+  typename Storage::const_iterator LowerBound(const T& t) const {
+      return std::lower_bound(factors_.begin(), factors_.end(), t,
+              [](const value_type& p, const T& key) {
+                  return FactorLess<T>()(p.first, key);
+              });
+  }
+};
+
+template<typename T>
+class MapFactorSet {
+ public:
+  typedef std::map<T, bool, FactorLess<T>> Storage;
+  typedef typename Storage::const_iterator const_iterator;
+
+  const_iterator begin() const { return factors_.begin(); }
+  const_iterator end() const { return factors_.end(); }
+  bool empty() const { return factors_.empty(); }
+  int size() const { return factors_.size(); }
+  void clear() { factors_.clear(); }
+
+  const bool* Find(const T& t) const {
+      auto i = factors_.find(t);
+      return (i != factors_.end()) ? &i->second : NULL;
+  }
+  void Set(const T& t, bool polarity) { factors_[t] = polarity; }
+  void Erase(const T& t) { factors_.erase(t); }
+
+  bool operator==(const MapFactorSet& other) const {
+      return factors_ == other.factors_;
+  }
+  bool operator<(const MapFactorSet& other) const {
+      return std::lexicographical_compare(
+              factors_.begin(), factors_.end(),
+              other.factors_.begin(), other.factors_.end(),
+              FactorPairLess<T>());
+  }
+
+ private:
+  Storage factors_;
+};
+
 // Represents a logical expression in disjunctive normal form (DNF), i.e., an
 // OR of terms, each of which is an AND of factors. Each factor is a thing of
-// type |T| (must support equality and ordering) with a polarity (true or
-// inverted).
+// type |T| (must support equality and ordering; see FactorLess) with a
+// polarity (true or inverted).
 //
 // Predicates support two operations: AndWith(T, polarity) and
 // OrWith(Predicate). Each returns a new predicate, leaving the original(s)
@@ -41,13 +169,16 @@ namespace autopiper {
 // S2. A1 & A2 | A1 = A1
 // S3. A1 & A1 = A1  (implicitly, by construction of the data structures)
 // S4. A1 | A1 = A1
-template<typename T>
+//
+// |FactorSet| selects the storage used for each term's factors (see above).
+template<typename T, typename FactorSet = PackedFactorSet<T>>
 class Predicate {
  public:
   // Represents an AND of positive and negative factors, e.g. A & ~B & C & ~D.
   struct Term {
    public:
-    const std::map<T, bool> Factors() const { return factors; }
+    // Iterates over (factor, polarity) pairs in factor order.
+    const FactorSet& Factors() const { return factors; }
 
     bool operator==(const Term& other) const {
         // N.B.: don't worry about |falsified| here -- will be removed during
@@ -60,7 +191,7 @@ class Predicate {
 
    protected:
     friend class Predicate;
-    std::map<T, bool> factors;
+    FactorSet factors;
     bool falsified;  // If factors.empty(), is this term true or false?
 
     Term() : falsified(false) {}
@@ -88,14 +219,14 @@ class Predicate {
     // ANDs this term with a factor, updating this term.
     void AndWith(T t, bool polarity) {
         if (falsified) return; // false & A == false -- short-circuit this.
-        if (factors.find(t) != factors.end() &&
-            factors[t] == !polarity) {
+        const bool* existing = factors.Find(t);
+        if (existing && *existing == !polarity) {
             // Note: we don't need to clear factors here because
             // Predicate::Simplify() will remove this term once |falisified| is
             // set.
             falsified = true;
         } else {
-            factors[t] = polarity;
+            factors.Set(t, polarity);
         }
     }
 
@@ -120,23 +251,32 @@ class Predicate {
 
         // factors are stored in T-order, so we can iterate through to find
         // differences in linear time. We implement S1 (AB | A~B = A) and S2
-        // (AB | A = A) here by dumping factors that appear on only one side
-        // into 'this' and 'other' lists (i.e. factoring out common factors)
-        // then handling these cases.
+        // (AB | A = A) here by counting the factors that appear on only one
+        // side (i.e. factoring out common factors) then handling these cases.
+        // Only the first such factor on each side is needed, so nothing is
+        // copied out of either term.
         auto i_this = factors.begin(), e_this = factors.end();
         auto i_other = other->factors.begin(), e_other = other->factors.end();
-        std::vector<std::pair<T, bool>> this_factors, other_factors;
+        int this_only = 0, other_only = 0;
+        std::pair<T, bool> this_first, other_first;
+        auto note_this = [&](const std::pair<T, bool>& p) {
+            if (this_only++ == 0) this_first = p;
+        };
+        auto note_other = [&](const std::pair<T, bool>& p) {
+            if (other_only++ == 0) other_first = p;
+        };
+        FactorLess<T> less;
         while (i_this != e_this && i_other != e_other) {
-            if (i_this->first < i_other->first) {
-                this_factors.push_back(*i_this);
+            if (less(i_this->first, i_other->first)) {
+                note_this(*i_this);
                 i_this++;
-            } else if (i_this->first > i_other->first) {
-                other_factors.push_back(*i_other);
+            } else if (less(i_other->first, i_this->first)) {
+                note_other(*i_other);
                 i_other++;
             } else {
                 if (i_this->second != i_other->second) {
-                    this_factors.push_back(*i_this);
-                    other_factors.push_back(*i_other);
+                    note_this(*i_this);
+                    note_other(*i_other);
                 } else {
                     // match.
                 }
@@ -145,22 +285,22 @@ class Predicate {
             }
         }
         for (; i_this != e_this; ++i_this) {
-            this_factors.push_back(*i_this);
+            note_this(*i_this);
         }
         for (; i_other != e_other; ++i_other) {
-            other_factors.push_back(*i_other);
+            note_other(*i_other);
         }
 
         // Now, if one side strictly covers the other (manifests as either
-        // this_factors.empty() or other_factors.empty(), but not both), we
-        // can eliminate the more specific term.
-        if (this_factors.empty()) {
+        // this_only == 0 or other_only == 0, but not both), we can eliminate
+        // the more specific term.
+        if (this_only == 0) {
             // |other| is more specific -- covered by |this|. Clear |other|.
             other->factors.clear();
             other->falsified = true;
             return true;
         }
-        else if (other_factors.empty()) {
+        else if (other_only == 0) {
             this->factors.clear();
             this->falsified = true;
             return true;
@@ -168,11 +308,11 @@ class Predicate {
         // Otherwise, if each side has exactly one factor not in the other,
         // and they are opposites, then we can cancel them both out (A | ~A
         // reduces to |true|).
-        else if (this_factors.size() == 1 && other_factors.size() == 1 &&
-                 this_factors[0].first == other_factors[0].first &&
-                 this_factors[0].second == ! other_factors[0].second) {
-            this->factors.erase(this_factors[0].first);
-            other->factors.erase(this_factors[0].first);
+        else if (this_only == 1 && other_only == 1 &&
+                 this_first.first == other_first.first &&
+                 this_first.second == ! other_first.second) {
+            this->factors.Erase(this_first.first);
+            other->factors.Erase(this_first.first);
             return true;
         }
         return false;
@@ -211,12 +351,12 @@ class Predicate {
 
   // Predicates can be used as keys so must support == and < operators.
   // These work because we keep terms in canonical order, i.e., sorted, and
-  // factors are sorted (implicitly by std::map) within terms, so we can use
+  // factors are sorted (by FactorLess) within terms, so we can use
   // the builtin == and < on the vector of terms.
-  bool operator==(const Predicate<T>& other) const {
+  bool operator==(const Predicate& other) const {
       return terms == other.terms;
   }
-  bool operator<(const Predicate<T>& other) const {
+  bool operator<(const Predicate& other) const {
       return terms < other.terms;
   }
 
@@ -301,7 +441,7 @@ class Predicate {
       return terms.empty();
   }
 
-  const std::vector<Term> Terms() const { return terms; }
+  const std::vector<Term>& Terms() const { return terms; }
 
   bool IsBackedge() const {
       return backedge;
@@ -317,26 +457,28 @@ class Predicate {
   // Simplification pass: (i) remove falsified terms; (ii) if any tautological
   // terms are present, remove all terms except this one.
   void Simplify() {
-      // is_tautological indicates, if |new_terms| is empty, whether the
-      // predicate is constant true or constant false.
+      // is_tautological indicates, if no terms are kept, whether the
+      // predicate is constant true or constant false. Surviving terms are
+      // compacted in place.
       bool is_tautological = false;
-      std::vector<Term> new_terms;
-      for (auto& term : terms) {
-          if (term.falsified) continue;
-          if (term.factors.empty()) {
+      unsigned kept = 0;
+      for (unsigned i = 0; i < terms.size(); i++) {
+          if (terms[i].falsified) continue;
+          if (terms[i].factors.empty()) {
               // Once we OR in a constant-true term, the predicate must be
               // constant true.
               is_tautological = true;
               break;
           }
-          new_terms.push_back(term);
+          if (kept != i) terms[kept] = terms[i];
+          kept++;
       }
       if (is_tautological) {
           // Constant true is represented by a single empty term.
           terms.clear();
           terms.push_back(Term());
       } else {
-          terms = new_terms;
+          terms.erase(terms.begin() + kept, terms.end());
       }
       // Now sort the terms to obtain canonical form.
       sort(terms.begin(), terms.end());
@@ -390,4 +532,90 @@ int main() {
 }
 #endif
 
+#ifdef PREDICATE_BENCH
+// Micro-benchmark comparing packed and map-based factor storage on the
+// predicate shapes that if-conversion produces: every branch ANDs its
+// condition into the incoming predicate, and every join ORs the arms back
+// together. Build with e.g.:
+//
+//   g++ -std=c++11 -O2 -I.. -DPREDICATE_BENCH -x c++ predicate.h -o pred-bench
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+using namespace autopiper;
+
+struct IntStringFunc {
+    string operator()(int i) { return to_string(i); }
+};
+
+// Keeps the benchmark's results observable so the work is not optimized away.
+volatile long bench_sink;
+
+// Recursively if-converts a complete binary tree of branches of the given
+// depth under |pred|, returning the predicate at the final join. |sink|
+// accumulates term counts.
+template<typename P>
+P NestedIfs(const P& pred, int depth, int* next_cond, long* sink) {
+    if (depth == 0) return pred;
+    int cond = (*next_cond)++;
+    P taken = NestedIfs(pred.AndWith(cond, true), depth - 1, next_cond, sink);
+    P not_taken = NestedIfs(pred.AndWith(cond, false), depth - 1, next_cond, sink);
+    P joined = taken.OrWith(not_taken);
+    *sink += joined.Terms().size();
+    return joined;
+}
+
+// ORs together early-exit paths out of a chain of branches, as produced by
+// a sequence of conditional kills or breaks; these do not simplify away.
+template<typename P>
+P EarlyExits(int length, int base, long* sink) {
+    P path = P::True();
+    P exits = P::False();
+    for (int i = 0; i < length; i++) {
+        exits = exits.OrWith(path.AndWith(base + i, true));
+        path = path.AndWith(base + i, false);
+        *sink += exits.Terms().size();
+    }
+    return exits;
+}
+
+template<typename P>
+double RunBench(int iters, string* result) {
+    long sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iters; i++) {
+        int next_cond = 0;
+        P p = NestedIfs(P::True(), 8, &next_cond, &sink);
+        P q = EarlyExits<P>(12, next_cond, &sink);
+        if (i == 0) {
+            *result = p.template ToString<IntStringFunc>() + " / " +
+                      q.template ToString<IntStringFunc>();
+        }
+    }
+    auto end = chrono::steady_clock::now();
+    bench_sink = sink;
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+    int iters = argc > 1 ? atoi(argv[1]) : 200;
+    string map_result, packed_result;
+    double map_ms = RunBench<Predicate<int, MapFactorSet<int>>>(
+            iters, &map_result);
+    double packed_ms = RunBench<Predicate<int, PackedFactorSet<int>>>(
+            iters, &packed_result);
+    if (map_result != packed_result) {
+        cout << "MISMATCH:" << endl
+             << "  map:    " << map_result << endl
+             << "  packed: " << packed_result << endl;
+        return 1;
+    }
+    cout << "map-based terms: " << map_ms << " ms" << endl
+         << "packed terms:    " << packed_ms << " ms" << endl
+         << "speedup:         " << (map_ms / packed_ms) << "x" << endl;
+    return 0;
+}
+#endif
+
 #endif
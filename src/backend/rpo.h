@@ -19,31 +19,41 @@
 
 #include "backend/ir.h"
 
+#include <assert.h>
 #include <vector>
 #include <set>
-#include <map>
 
 namespace autopiper {
 
+// Reverse postorder over the nodes reachable from a set of roots, with each
+// node's predecessors along the edges traversed. Nodes must carry a dense,
+// non-negative |id| (e.g. IRBB::id), by which the per-node data is indexed.
 template<typename T, typename SuccFunc>
 class ReversePostorder {
  public:
   ReversePostorder() {}
 
   void Compute(const std::vector<const T*>& roots) {
-      DFS(roots, &rpo_, &rponums_, &preds_);
+      rpo_.clear();
+      rponums_.clear();
+      preds_.clear();
+      DFS(roots);
   }
 
+  bool Contains(const T* node) const {
+      return node->id < static_cast<int>(rponums_.size()) &&
+             rponums_[node->id] >= 0;
+  }
   int RPONum(const T* node) const {
-      return rponums_.at(node);
+      assert(Contains(node));
+      return rponums_[node->id];
   }
   const std::vector<const T*>& RPO() const {
       return rpo_;
   }
   const std::vector<const T*>& Preds(const T* node) const {
-      auto it = preds_.find(node);
-      if (it != preds_.end()) {
-          return it->second;
+      if (node->id < static_cast<int>(preds_.size())) {
+          return preds_[node->id];
       } else {
           return empty_pred_vec_;
       }
@@ -65,44 +75,63 @@ class ReversePostorder {
 
  private:
   std::vector<const T*> rpo_;
-  std::map<const T*, int> rponums_;
-  std::map<const T*, std::vector<const T*>> preds_;
+  // Indexed by node ID; -1 for nodes not reached.
+  std::vector<int> rponums_;
+  std::vector<std::vector<const T*>> preds_;
   std::vector<const T*> empty_pred_vec_;
 
-  // Compute reverse-postorder, and also collect a map of predecessors.
-  void DFS(const std::vector<const T*>& roots,
-           std::vector<const T*>* rpo,
-           std::map<const T*, int>* rponums,
-           std::map<const T*, std::vector<const T*>>* preds) {
-      std::set<const T*> visited;
+  void Grow(const T* node) {
+      if (node->id >= static_cast<int>(rponums_.size())) {
+          rponums_.resize(node->id + 1, -1);
+          preds_.resize(node->id + 1);
+      }
+  }
+
+  // Compute reverse-postorder, and also collect the predecessors. The DFS
+  // keeps an explicit stack, so that long chains of BBs do not overflow the
+  // native one; it visits nodes and records predecessors in the same order
+  // as the obvious recursive walk.
+  void DFS(const std::vector<const T*>& roots) {
+      SuccFunc sf;
       std::vector<const T*> postorder;
+      struct Frame {
+          const T* node;
+          std::vector<const T*> succs;
+          unsigned next;
+      };
+      std::vector<Frame> stack;
+      // Visited nodes are marked with rponum -2 until they are numbered.
+      auto visit = [&](const T* node) {
+          Grow(node);
+          if (rponums_[node->id] != -1) return;
+          rponums_[node->id] = -2;
+          stack.push_back(Frame { node, sf(node), 0 });
+      };
       // Go over roots in reverse order because we reverse the final result --
       // want DFS trees of first roots to come first (user may have good
       // reasons for this).
-      std::vector<const T*> reverse_roots(roots);
-      std::reverse(reverse_roots.begin(), reverse_roots.end());
-      for (auto* root : reverse_roots) {
-          DoDFS(root, &visited, &postorder, preds);
+      for (auto i = roots.rbegin(), e = roots.rend(); i != e; ++i) {
+          visit(*i);
+          while (!stack.empty()) {
+              Frame& top = stack.back();
+              if (top.next == top.succs.size()) {
+                  postorder.push_back(top.node);
+                  stack.pop_back();
+                  continue;
+              }
+              const T* node = top.node;
+              const T* succ = top.succs[top.next++];
+              Grow(succ);
+              preds_[succ->id].push_back(node);
+              visit(succ);
+          }
       }
       int rpo_num = 0;
       for (auto i = postorder.rbegin(), e = postorder.rend();
            i != e; ++i) {
-          rpo->push_back(*i);
-          (*rponums)[*i] = rpo_num++;
-      }
-  }
-  void DoDFS(const T* node,
-             std::set<const T*>* visited,
-             std::vector<const T*>* postorder,
-             std::map<const T*, std::vector<const T*>>* preds) {
-      SuccFunc sf;
-      if (visited->find(node) != visited->end()) return;
-      visited->insert(node);
-      for (auto* succ : sf(node)) {
-          (*preds)[succ].push_back(node);
-          DoDFS(succ, visited, postorder, preds);
+          rpo_.push_back(*i);
+          rponums_[(*i)->id] = rpo_num++;
       }
-      postorder->push_back(node);
   }
 };
 
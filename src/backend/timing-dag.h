@@ -17,15 +17,15 @@
 #ifndef _AUTOPIPER_TIMING_DAG_H_
 #define _AUTOPIPER_TIMING_DAG_H_
 
+#include <algorithm>
 #include <vector>
-#include <map>
-#include <set>
-#include <memory>
+#include <unordered_map>
 #include <string>
-#include <stack>
+#include <queue>
+#include <functional>
+#include <utility>
+#include <assert.h>
 
-#include "backend/ir.h"
-#include "backend/rpo.h"
 #include "common/util.h"
 
 namespace autopiper {
@@ -38,21 +38,37 @@ namespace autopiper {
 //
 // Nodes are of type T and timing variables are of type U. Both T and U are
 // opaque and are used as pointers.
+//
+// Internally, nodes and vars are numbered densely in the order they are
+// added and live in contiguous arrays. Edges and var attachments are only
+// recorded while the DAG is being built; Solve() compiles them into
+// compressed-sparse-row (CSR) adjacency arrays once, so the solver never
+// does a map lookup or allocates while walking the graph.
 template<typename T, typename U>
 class TimingDAG {
     public:
-        TimingDAG() {}
+        TimingDAG() : compiled_(false) {}
 
-        // Add a node to the graph.
-        inline void AddNode(const T* node, int delay);
+        // Add a node to the graph. |weight| is the cost of carrying the node's
+        // value across one stage boundary (e.g., its bit width); it is used
+        // only by MinimizeRegisterCost().
+        inline void AddNode(const T* node, int delay, int weight = 0);
         // Add a constraint from a node to a timing variable, offset by a
         // certain number of stages from that variable's origin.
         inline void AddVar(const T* node, const U* var, int offset);
-        // Add a dependence edge.
-        inline void AddEdge(const T* from, const T* to);
+        // Add a dependence edge. |uses_value| indicates that |to| consumes the
+        // value produced by |from|, rather than only being ordered after it.
+        // A nonzero |latency| requires |to| to be at least that many stages
+        // after |from| (e.g., the data of a registered array read), rather
+        // than only no earlier and later in the same stage's delay.
+        inline void AddEdge(const T* from, const T* to, bool uses_value = true,
+                            int latency = 0);
         // Note a node as 'lifted'. A lifted node cannot sink past its
         // earliest-possible time during the sink phase.
         inline void LiftNode(const T* node);
+        // Note a node as 'pinned'. A pinned node keeps its solved placement
+        // in MinimizeRegisterCost().
+        inline void PinNode(const T* node);
 
         // Solves the DAG. Requires ErrorReporter with the method:
         //   ReportError(const T* node, const U* var,
@@ -68,77 +84,164 @@ class TimingDAG {
         // Reports all nodes in a given stage.
         std::vector<const T*> NodesInStage(int stage) const;
 
+        // After solving, moves nodes within their slack windows to minimize
+        // the total RegisterCost() over all nodes, without changing the number
+        // of stages. Anchored and pinned nodes, and nodes constrained by
+        // timing vars, keep their placement.
+        void MinimizeRegisterCost(int delay_per_stage);
+
+        // After solving, finds the smallest per-stage delay at which the DAG
+        // still solves into the same number of stages, and leaves it solved
+        // at that delay: nodes spread across the stages so that the fullest
+        // stage is as short as the constraints allow. Returns the delay used,
+        // which is at most |delay_per_stage|.
+        int BalanceStages(int delay_per_stage);
+        // Finds the smallest per-stage delay in [lo, hi] at which the DAG
+        // solves into at most |max_stages| stages, and leaves the DAG solved
+        // at that delay. Returns the delay, or -1 if none in the range fits.
+        // Need not follow a Solve().
+        int FitStages(int max_stages, int lo, int hi);
+        // Reports the summed delay of all nodes, a per-stage delay at which
+        // any dependence chain fits in one stage.
+        int TotalDelay() const;
+        // Reports the longest delay through any stage (after solving).
+        int MaxStageDelay() const;
+        // Reports the cost of carrying a node's value from its own stage to
+        // the latest stage that uses it: its weight times the number of stage
+        // boundaries crossed (after solving).
+        int RegisterCost(const T* t) const;
+
+        // Reports a node's delay, and (after solving) the time within its
+        // stage at which its inputs from the same stage are all ready: the
+        // summed delay of the longest chain of same-stage predecessors.
+        // GetCriticalPred() returns the last node on that chain, or NULL if
+        // the node depends on nothing else in its stage.
+        int GetDelay(const T* t) const;
+        int GetArrival(const T* t) const;
+        const T* GetCriticalPred(const T* t) const;
+
+        // Reports the number of nodes and dependence edges added.
+        int NodeCount() const { return nodes_.size(); }
+        int EdgeCount() const { return edge_list_.size(); }
+
+        // Solver work counters, accumulated over both phases of Solve().
+        struct SolveStats {
+            SolveStats() : nodes_visited(0), var_updates(0) {}
+            int nodes_visited;  // node placements computed
+            int var_updates;    // var stage changes
+        };
+        // Reports solver statistics (after solving).
+        const SolveStats& Stats() const { return stats_; }
+
     private:
         // Forward decls.
         struct Node;
-        struct Edge;
         struct Var;
-        struct Stage;
-        struct NodeSucc;
 
-        // A specialization of the generic reverse-postorder computation for
-        // timing-DAG nodes.
-        typedef ReversePostorder<Node, NodeSucc> NodeReversePostorder;
+        // A half-open range [begin, end) of a CSR value array.
+        template<typename V>
+        struct Range {
+            const V* b;
+            const V* e;
+            const V* begin() const { return b; }
+            const V* end() const { return e; }
+        };
 
         // Helpers.
+        void BuildAdjacency();
         template<typename ErrorReporter>
-        bool CheckForCycles(ErrorReporter* err);
+        bool CheckForCyclesAndComputeRPO(ErrorReporter* err);
         template<typename ErrorReporter>
-        bool DoPhase(const NodeReversePostorder& rpo,
-                int delay_per_stage, ErrorReporter* err,
+        bool DoPhase(int delay_per_stage, ErrorReporter* err,
                 bool forward, bool respectLifted);
-        void SetAnchors(const NodeReversePostorder& rpo);
+        void PlaceNode(int node, int delay_per_stage,
+                bool forward, bool respectAnchors,
+                int* node_stage, int* node_offset) const;
+        void SetAnchors();
+        // Discards errors from trial solves in FitStages().
+        struct QuietReporter {
+            void ReportError(const T* node, const U* var,
+                             const std::string& message) {}
+        };
         void FindStageSets();
-        
-        // DAG data strctures.
+        void ComputeArrivals();
+        int RegisterCostAt(int node, int stage) const;
+        bool MoveToCheapestStage(int node, int delay_per_stage);
 
-        static const int kUnknown = -1;
+        Range<int> Succs(int n) const {
+            return Range<int> { out_edges_.data() + out_begin_[n],
+                                out_edges_.data() + out_begin_[n + 1] };
+        }
+        Range<int> Preds(int n) const {
+            return Range<int> { in_edges_.data() + in_begin_[n],
+                                in_edges_.data() + in_begin_[n + 1] };
+        }
+        // Value-carrying edges only.
+        Range<int> ValueSuccs(int n) const {
+            return Range<int> { value_out_edges_.data() + value_out_begin_[n],
+                                value_out_edges_.data() + value_out_begin_[n + 1] };
+        }
+        Range<int> ValuePreds(int n) const {
+            return Range<int> { value_in_edges_.data() + value_in_begin_[n],
+                                value_in_edges_.data() + value_in_begin_[n + 1] };
+        }
+        // (var, offset) pairs attached to a node.
+        Range<std::pair<int, int>> NodeVars(int n) const {
+            return Range<std::pair<int, int>> {
+                node_vars_.data() + node_var_begin_[n],
+                node_vars_.data() + node_var_begin_[n + 1] };
+        }
+        // (node, offset) pairs attached to a var.
+        Range<std::pair<int, int>> VarNodes(int v) const {
+            return Range<std::pair<int, int>> {
+                var_nodes_.data() + var_node_begin_[v],
+                var_nodes_.data() + var_node_begin_[v + 1] };
+        }
 
-        struct Edge {
-            Node* from;
-            Node* to;
+        // Builds a CSR array from (row, value) entries, keeping the order in
+        // which entries were added within each row.
+        template<typename V>
+        static void BuildCSR(int rows,
+                const std::vector<std::pair<int, V>>& entries,
+                std::vector<int>* begin, std::vector<V>* values);
 
-            Edge(Node* from_, Node* to_)
-                : from(from_), to(to_) {}
-        };
+        // DAG data strctures.
+
+        static const int kUnknown = -1;
 
         struct Node {
-            Node(const T* t_, int delay_)
+            Node(const T* t_, int delay_, int weight_)
                 : t(t_),
                   lifted(false),
+                  pinned(false),
                   delay(delay_),
+                  weight(weight_),
                   stage(kUnknown),
                   stage_offset(kUnknown),
                   anchored(false),
                   anchored_stage(kUnknown),
-                  cycle_check_visiting(false),
-                  cycle_check_visited(false)
+                  arrival(0),
+                  critical_pred(kUnknown),
+                  rpo_index(kUnknown),
+                  on_worklist(false)
             {}
 
             const T* t;
             bool lifted;
+            bool pinned;
             int delay;
+            int weight;
             int stage;
             int stage_offset;  // gate delays from start of stage
             bool anchored;  // anchored to this stage
             int anchored_stage;
 
-            bool cycle_check_visiting;
-            bool cycle_check_visited;
-
-            std::vector<Edge*> in, out;
-            std::vector<std::pair<Var*, int>> vars;  // (var, stage_offset) pairs
-        };
+            // Computed after solving; see GetArrival().
+            int arrival;
+            int critical_pred;
 
-        // Successor functor for Node, and convenience RPO typedef.
-        struct NodeSucc {
-            std::vector<const Node*> operator()(const Node* node) {
-                std::vector<const Node*> ret;
-                for (auto* edge : node->out) {
-                    ret.push_back(edge->to);
-                }
-                return ret;
-            }
+            int rpo_index;  // position in RPO, used to order the worklist
+            bool on_worklist;
         };
 
         // Limit to iterations for unsolvable systems: each var may be updated
@@ -149,129 +252,234 @@ class TimingDAG {
         // the reverse order).
         static const int kMaxVarUpdates = 100;
 
+        // Limit to sweeps over all nodes in MinimizeRegisterCost(). Each sweep
+        // that moves anything strictly lowers the total cost, so this only
+        // bounds compile time on large pipes.
+        static const int kMaxRegisterSweeps = 8;
+
         struct Var {
             Var(const U* u_)
                 : u(u_),
-                  stage(kUnknown),
+                  known(false),
+                  stage(0),
                   updates(0)
             {}
 
             const U* u;
+            // A var's stage may legitimately be negative (e.g. only attached
+            // to a stage-0 node at offset 1), so track knownness separately
+            // rather than overloading kUnknown.
+            bool known;
             int stage;
             int updates;  // tracked during solving
-            std::vector<std::pair<Node*, int>> nodes;  // (node, stage_offset) pairs
         };
 
-        struct Stage {
-            std::vector<Node*> nodes;
-        };
+        std::vector<Node> nodes_;
+        std::vector<Var> vars_;
+        std::unordered_map<const T*, int> node_map_;
+        std::unordered_map<const U*, int> var_map_;
+
+        // As added: (from, to) edges, each with its latency, and (node, (var,
+        // offset)) attachments.
+        std::vector<std::pair<int, int>> edge_list_;
+        std::vector<int> edge_latency_;
+        std::vector<std::pair<int, int>> value_edge_list_;
+        std::vector<std::pair<int, std::pair<int, int>>> var_list_;
 
-        std::vector<std::unique_ptr<Node>> nodes_;
-        std::vector<std::unique_ptr<Edge>> edges_;
-        std::vector<std::unique_ptr<Var>> vars_;
-        std::vector<std::unique_ptr<Stage>> stages_;
-        std::map<const T*, Node*> node_map_;
-        std::map<const U*, Var*> var_map_;
+        // CSR adjacency, built by BuildAdjacency(). The successors of node n
+        // are out_edges_[out_begin_[n] .. out_begin_[n+1]), and likewise for
+        // the other arrays.
+        // out_latency_ and in_latency_ hold each edge's latency, parallel to
+        // out_edges_ and in_edges_.
+        std::vector<int> out_begin_, out_edges_, out_latency_;
+        std::vector<int> in_begin_, in_edges_, in_latency_;
+        std::vector<int> value_out_begin_, value_out_edges_;
+        std::vector<int> value_in_begin_, value_in_edges_;
+        std::vector<int> node_var_begin_;
+        std::vector<std::pair<int, int>> node_vars_;
+        std::vector<int> var_node_begin_;
+        std::vector<std::pair<int, int>> var_nodes_;
+
+        // Node indices in reverse postorder.
+        std::vector<int> rpo_;
+        // Node indices grouped by stage, in CSR form.
+        std::vector<int> stage_begin_, stage_nodes_;
+
+        SolveStats stats_;
+
+        // Set once the adjacency arrays and RPO are built, so that repeated
+        // solves (see FitStages()) build them only once. Adding to the DAG
+        // clears it.
+        bool compiled_;
 };
 
 template<typename T, typename U>
-void TimingDAG<T, U>::AddNode(const T* t, int delay) {
-    std::unique_ptr<Node> node(new Node(t, delay));
-    node_map_.insert(std::make_pair(t, node.get()));
-    nodes_.push_back(std::move(node));
+void TimingDAG<T, U>::AddNode(const T* t, int delay, int weight) {
+    node_map_.insert(std::make_pair(t, static_cast<int>(nodes_.size())));
+    nodes_.push_back(Node(t, delay, weight));
+    compiled_ = false;
 }
 
 template<typename T, typename U>
 void TimingDAG<T, U>::AddVar(const T* node, const U* var, int offset) {
-    Var* v = nullptr;
-    if (var_map_.find(var) != var_map_.end()) {
-        v = var_map_[var];
-    } else {
-        std::unique_ptr<Var> new_v(new Var(var));
-        v = new_v.get();
-        var_map_.insert(std::make_pair(var, new_v.get()));
-        vars_.push_back(std::move(new_v));
-    }
-    assert(node_map_.find(node) != node_map_.end());
-    Node* n = node_map_[node];
-    v->nodes.push_back(std::make_pair(n, offset));
-    n->vars.push_back(std::make_pair(v, offset));
+    auto v = var_map_.insert(
+            std::make_pair(var, static_cast<int>(vars_.size())));
+    if (v.second) {
+        vars_.push_back(Var(var));
+    }
+    auto n = node_map_.find(node);
+    assert(n != node_map_.end());
+    var_list_.push_back(std::make_pair(n->second,
+                std::make_pair(v.first->second, offset)));
+    compiled_ = false;
 }
 
 template<typename T, typename U>
-void TimingDAG<T, U>::AddEdge(const T* from, const T* to) {
-    assert(node_map_.find(from) != node_map_.end());
-    assert(node_map_.find(to) != node_map_.end());
-    Node* f = node_map_[from];
-    Node* t = node_map_[to];
-
-    std::unique_ptr<Edge> edge(new Edge(f, t));
-    f->out.push_back(edge.get());
-    t->in.push_back(edge.get());
-    edges_.push_back(std::move(edge));
+void TimingDAG<T, U>::AddEdge(const T* from, const T* to, bool uses_value,
+                              int latency) {
+    auto f = node_map_.find(from);
+    auto t = node_map_.find(to);
+    assert(f != node_map_.end());
+    assert(t != node_map_.end());
+    assert(latency >= 0);
+    edge_list_.push_back(std::make_pair(f->second, t->second));
+    edge_latency_.push_back(latency);
+    if (uses_value) {
+        value_edge_list_.push_back(std::make_pair(f->second, t->second));
+    }
+    compiled_ = false;
 }
 
 template<typename T, typename U>
 void TimingDAG<T, U>::LiftNode(const T* node) {
-    assert(node_map_.find(node) != node_map_.end());
-    Node* n = node_map_[node];
-    n->lifted = true;
+    auto n = node_map_.find(node);
+    assert(n != node_map_.end());
+    nodes_[n->second].lifted = true;
+}
+
+template<typename T, typename U>
+void TimingDAG<T, U>::PinNode(const T* node) {
+    auto n = node_map_.find(node);
+    assert(n != node_map_.end());
+    nodes_[n->second].pinned = true;
+}
+
+template<typename T, typename U>
+template<typename V>
+void TimingDAG<T, U>::BuildCSR(
+        int rows,
+        const std::vector<std::pair<int, V>>& entries,
+        std::vector<int>* begin,
+        std::vector<V>* values) {
+    // Counting sort by row: count, prefix-sum, then scatter.
+    begin->assign(rows + 1, 0);
+    for (auto& e : entries) {
+        (*begin)[e.first + 1]++;
+    }
+    for (int i = 0; i < rows; i++) {
+        (*begin)[i + 1] += (*begin)[i];
+    }
+    std::vector<int> fill(begin->begin(), begin->end() - 1);
+    values->resize(entries.size());
+    for (auto& e : entries) {
+        (*values)[fill[e.first]++] = e.second;
+    }
+}
+
+template<typename T, typename U>
+void TimingDAG<T, U>::BuildAdjacency() {
+    int n = nodes_.size();
+    std::vector<std::pair<int, int>> reversed;
+    reversed.reserve(edge_list_.size());
+    for (auto& e : edge_list_) {
+        reversed.push_back(std::make_pair(e.second, e.first));
+    }
+    BuildCSR(n, edge_list_, &out_begin_, &out_edges_);
+    BuildCSR(n, reversed, &in_begin_, &in_edges_);
+
+    // BuildCSR() keeps insertion order within each row, so latencies built
+    // from the same rows line up with the edges.
+    std::vector<std::pair<int, int>> latencies;
+    latencies.reserve(edge_list_.size());
+    for (unsigned i = 0; i < edge_list_.size(); i++) {
+        latencies.push_back(std::make_pair(edge_list_[i].first,
+                                           edge_latency_[i]));
+    }
+    std::vector<int> unused_begin;
+    BuildCSR(n, latencies, &unused_begin, &out_latency_);
+    for (unsigned i = 0; i < edge_list_.size(); i++) {
+        latencies[i].first = edge_list_[i].second;
+    }
+    BuildCSR(n, latencies, &unused_begin, &in_latency_);
+
+    reversed.clear();
+    for (auto& e : value_edge_list_) {
+        reversed.push_back(std::make_pair(e.second, e.first));
+    }
+    BuildCSR(n, value_edge_list_, &value_out_begin_, &value_out_edges_);
+    BuildCSR(n, reversed, &value_in_begin_, &value_in_edges_);
+
+    std::vector<std::pair<int, std::pair<int, int>>> by_var;
+    by_var.reserve(var_list_.size());
+    for (auto& a : var_list_) {
+        by_var.push_back(std::make_pair(a.second.first,
+                    std::make_pair(a.first, a.second.second)));
+    }
+    BuildCSR(n, var_list_, &node_var_begin_, &node_vars_);
+    BuildCSR(static_cast<int>(vars_.size()), by_var,
+             &var_node_begin_, &var_nodes_);
 }
 
 template<typename T, typename U>
 template<typename ErrorReporter>
-bool TimingDAG<T, U>::CheckForCycles(ErrorReporter* err) {
-    // Do a simple non-recursive DFS to check for cycles.
+bool TimingDAG<T, U>::CheckForCyclesAndComputeRPO(ErrorReporter* err) {
+    // Do a simple non-recursive DFS to check for cycles. The postorder of
+    // the same DFS, reversed, is a topological order of the DAG.
+    enum { kUnvisited, kVisiting, kVisited };
     struct StackEntry {
-        Node* node;
+        int node;
         int idx;
     };
-    std::stack<StackEntry> dfs_stack;
-    for (auto& node : nodes_) {
-        node->cycle_check_visiting = false;
-        node->cycle_check_visited = false;
-    }
-    for (auto& node : nodes_) {
-        if (node->cycle_check_visited) continue;
-        dfs_stack.push(StackEntry { node.get(), 0 });
+    int n = nodes_.size();
+    std::vector<char> state(n, kUnvisited);
+    std::vector<StackEntry> dfs_stack;
+    std::vector<int> postorder;
+    postorder.reserve(n);
+    for (int root = 0; root < n; root++) {
+        if (state[root] != kUnvisited) continue;
+        dfs_stack.push_back(StackEntry { root, out_begin_[root] });
+        state[root] = kVisiting;
         while (!dfs_stack.empty()) {
-            Node* n = dfs_stack.top().node;
-            int idx = dfs_stack.top().idx;
-            if (idx == n->out.size()) {
-                n->cycle_check_visiting = false;
-                n->cycle_check_visited = true;
-                dfs_stack.pop();
+            StackEntry& top = dfs_stack.back();
+            if (top.idx == out_begin_[top.node + 1]) {
+                state[top.node] = kVisited;
+                postorder.push_back(top.node);
+                dfs_stack.pop_back();
                 continue;
             }
-            n->cycle_check_visiting = true;
-            Edge* e = n->out[idx];
-            dfs_stack.top().idx++;
-            if (e->to->cycle_check_visiting) {
-                // Back-edge: cycle. Extract the cycle from the stack.
-                std::vector<Node*> cycle;
-                while (!dfs_stack.empty()) {
-                    cycle.push_back(dfs_stack.top().node);
-                    if (dfs_stack.top().node == e->to) break;
-                    dfs_stack.pop();
-                }
-                for (auto* node : cycle) {
-                    err->ReportError(node->t, NULL,
-                            std::string("Node is involved in timing-DAG cycle."));
-                    return false;
-                }
-            } else if (e->to->cycle_check_visited) {
-                // Cross-edge: ignore.
-            } else {
+            int to = out_edges_[top.idx++];
+            if (state[to] == kVisiting) {
+                // Back-edge: cycle. Report the node that closes it.
+                err->ReportError(nodes_[top.node].t, NULL,
+                        std::string("Node is involved in timing-DAG cycle."));
+                return false;
+            } else if (state[to] == kUnvisited) {
                 // Forward edge.
-                dfs_stack.push(StackEntry { e->to, 0 });
-                continue;
+                state[to] = kVisiting;
+                dfs_stack.push_back(StackEntry { to, out_begin_[to] });
             }
+            // Else cross-edge: ignore.
         }
     }
+
+    rpo_.assign(postorder.rbegin(), postorder.rend());
+    for (int i = 0; i < n; i++) {
+        nodes_[rpo_[i]].rpo_index = i;
+    }
     return true;
 }
 
-// Algorithm: over a maximum of N iterations:
+// Algorithm:
 //
 // 1. Do a forward pass over the dependence graph (in RPO), computing
 //    the latest input ready time and determining whether this node fits in
@@ -287,23 +495,27 @@ bool TimingDAG<T, U>::CheckForCycles(ErrorReporter* err) {
 //       ii. If none do, pick the node's natural stage as its stage.
 //    b. For all attached vars, set the var's stage if previously unknown,
 //       or set if known, based on this node's chosen stage. Only push vars
-//       later. If any vars' stages were updated, queue another iteration
-//       of this algorithm.
+//       later.
 //
-// 3. After all nodes are assigned to stages, if any vars' stages were
-//    updated, perform another pass, up to a maximum of N passes. To bail out
-//    if no convergence occurs, allow each var a certain number of updates,
-//    and fail if a particular var reaches this limit. (This scheme, rather
-//    than a global maximum iteration count, is used to allow cases where a
-//    number of iterations linear in the number of variables is required. We
-//    still converge because the number of vars is finite.)
+// 3. Rather than re-sweeping the whole RPO whenever a var moves, keep a
+//    worklist ordered by RPO index. Initially every node is on it. When a
+//    node moves, its successors are queued; when a var moves, every node
+//    attached to the var is queued. Both node placements and var stages only
+//    move later, so this converges to the same fixpoint as repeated full
+//    sweeps while touching only the nodes downstream of each change. To bail
+//    out if no convergence occurs, allow each var a certain number of
+//    updates, and fail if a particular var reaches this limit. (This scheme,
+//    rather than a global maximum iteration count, is used to allow cases
+//    where a number of iterations linear in the number of variables is
+//    required. We still converge because the number of vars is finite.)
 //
 // 4. Sink: First, set all nodes with no successors as anchored, so the
 //    overall DAG length (i.e., pipeline length) does not become longer than
 //    necessary. Also anchor user-specified nodes so that they remain at
 //    earliest-possible positions ("lifted" nodes). Then, working backward
-//    (so, in forward postorder) and with reversed edges, run the above
-//    algorithm again to sink non-anchored nodes as late as possible.
+//    (so, in forward postorder, with the worklist ordered accordingly) and
+//    with reversed edges, run the above algorithm again to sink non-anchored
+//    nodes as late as possible.
 //
 // TODO: notion of live-set? Costs of edges; minimize the edge-cost cut
 // at each pipeline boundary.
@@ -315,213 +527,275 @@ bool TimingDAG<T, U>::CheckForCycles(ErrorReporter* err) {
 template<typename T, typename U>
 template<typename ErrorReporter>
 bool TimingDAG<T, U>::Solve(int delay_per_stage, ErrorReporter* err) {
-    // Check for cycles.
-    if (!CheckForCycles(err)) return false;
+    if (!compiled_) {
+        // Compile the edge lists into CSR form.
+        BuildAdjacency();
+
+        // Check for cycles, and compute reverse postorder over nodes with
+        // respect to dependence edges.
+        if (!CheckForCyclesAndComputeRPO(err)) return false;
+        compiled_ = true;
+    }
 
-    // Compute reverse postorder over nodes with respect to dependence edges.
-    NodeReversePostorder rpo;
-    std::vector<const Node*> nodes;
-    for (auto& n : nodes_) { nodes.push_back(n.get()); }
-    rpo.Compute(rpo.FindRoots(nodes.begin(), nodes.end()));
+    // Reset any state left from a previous solve.
+    for (auto& node : nodes_) {
+        node.stage = kUnknown;
+        node.stage_offset = kUnknown;
+        node.anchored = false;
+        node.anchored_stage = kUnknown;
+        // A failed solve may leave nodes queued.
+        node.on_worklist = false;
+    }
+    for (auto& var : vars_) {
+        var.known = false;
+        var.stage = 0;
+        var.updates = 0;
+    }
+    stats_ = SolveStats();
 
     // Perform initial forward pass to find earliest point for each node.
     // These earliest points will be the anchors for port writes and 'final'
     // nodes (nodes with no successors).
-    if (!DoPhase(rpo, delay_per_stage, err,
+    if (!DoPhase(delay_per_stage, err,
                 /* forward = */ true,
                 /* anchors = */ false)) return false;
     // Set anchors. This anchors both lifted nodes and nodes with no
     // successors.
-    SetAnchors(rpo);
+    SetAnchors();
     // Perform final backward pass to sink each node to its latest possible
     // point, subject to anchors. This heuristic minimizes live-set sizes by
     // computing results only when necessary.
-    if (!DoPhase(rpo, delay_per_stage, err,
+    if (!DoPhase(delay_per_stage, err,
                 /* forward = */ false,
                 /* anchors = */ true)) return false;
 
-    // Post-process to extract nodes into stage sets.
+    // Post-process to extract nodes into stage sets and find the critical
+    // path through each stage.
     FindStageSets();
+    ComputeArrivals();
 
     return true;
 }
 
 template<typename T, typename U>
-template<typename ErrorReporter>
-bool TimingDAG<T, U>::DoPhase(
-        const NodeReversePostorder& rpo,
+void TimingDAG<T, U>::PlaceNode(
+        int n,
         int delay_per_stage,
-        ErrorReporter* err,
         bool forward,
-        bool respectAnchors) {
-
-    // Repeat until convergence.
-    bool changed = true;
-    while (changed) {
-        changed = false;
-
-        // In either reverse postorder (forward) or forward postorder
-        // (!forward) over nodes...
-        auto& rpo_seq = rpo.RPO();
-        for (int i = forward ? 0 : static_cast<int>(rpo_seq.size() - 1);
-             forward ? (i < static_cast<int>(rpo_seq.size())) : (i >= 0);
-             forward ? ++i : --i) {
-            auto* node = const_cast<Node*>(rpo_seq[i]);
-
-            // First, ensure node's delay is not greater than delay_per_stage,
-            // or else no solution will exist (the op must be able to fit in a
-            // single stage).
-            if (node->delay > delay_per_stage) {
-                err->ReportError(node->t, NULL,
-                                 strprintf("Node delay %d greater than delay-per-stage %d",
-                                           node->delay, delay_per_stage));
-                return false;
-            }
+        bool respectAnchors,
+        int* out_stage,
+        int* out_offset) const {
+    const Node* node = &nodes_[n];
+    int node_stage = kUnknown;
+    int node_offset = kUnknown;
 
-            int node_stage = kUnknown;
-            int node_offset = kUnknown;
+    // If we respect anchors, snap the node to the appropriate stage.
+    if (respectAnchors && node->anchored) {
+        if (forward) {
+            node_offset = 0;
+        } else {
+            node_offset = delay_per_stage - node->delay;
+        }
+        node_stage = node->anchored_stage;
+    }
 
-            // If we respect anchors, snap the node to the appropriate stage.
-            if (respectAnchors && node->anchored) {
-                if (forward) {
-                    node_offset = 0;
+    // Compute natural stage based on in-edges.
+    const std::vector<int>& begin = forward ? in_begin_ : out_begin_;
+    const std::vector<int>& edges = forward ? in_edges_ : out_edges_;
+    const std::vector<int>& latencies = forward ? in_latency_ : out_latency_;
+    for (int e = begin[n]; e < begin[n + 1]; e++) {
+        const Node* in_node = &nodes_[edges[e]];
+        int latency = latencies[e];
+        // Compute natural stage according to only this predecessor node.
+        int start_stage_from_this_input = kUnknown;
+        int stage_offset_from_this_input = 0;
+        if (forward) {
+            // Forward direction: compute natural stage based on
+            // predecessors, and push node to higher stage if
+            // necessary.
+            if (in_node->stage != kUnknown && latency > 0) {
+                // The node may only start |latency| stages later, and then
+                // anywhere in that stage.
+                start_stage_from_this_input = in_node->stage + latency;
+                stage_offset_from_this_input = 0;
+            } else if (in_node->stage != kUnknown) {
+                // Compute timing offset in predecessor node's output from
+                // the beginning of its stage, in gate delays.
+                int start_delay = in_node->stage_offset + in_node->delay;
+                assert(start_delay <= delay_per_stage);
+                // If our output would exceed this pred node's stage output
+                // time, bump this node to next stage; else, stay in same
+                // stage.
+                if ((start_delay + node->delay) > delay_per_stage) {
+                    start_stage_from_this_input = in_node->stage + 1;
+                    stage_offset_from_this_input = 0;
                 } else {
-                    node_offset = delay_per_stage - node->delay;
+                    start_stage_from_this_input = in_node->stage;
+                    stage_offset_from_this_input = start_delay;
                 }
-                node_stage = node->anchored_stage;
             }
-
-            // Compute natural stage based on in-edges.
-            for (auto* in_edge : (forward ? node->in : node->out)) {
-                // Compute natural stage according to only this predecessor node.
-                int start_stage_from_this_input = kUnknown;
-                int stage_offset_from_this_input = 0;
-                if (forward) {
-                    // Forward direction: compute natural stage based on
-                    // predecessors, and push node to higher stage if
-                    // necessary.
-                    if (in_edge->from->stage != kUnknown) {
-                        // Compute timing offset in predecessor node's output from
-                        // the beginning of its stage, in gate delays.
-                        int start_delay = in_edge->from->stage_offset + in_edge->from->delay;
-                        assert(start_delay <= delay_per_stage);
-                        // If our output would exceed this pred node's stage output
-                        // time, bump this node to next stage; else, stay in same
-                        // stage.
-                        if ((start_delay + node->delay) > delay_per_stage) {
-                            start_stage_from_this_input = in_edge->from->stage + 1;
-                            stage_offset_from_this_input = 0;
-                        } else {
-                            start_stage_from_this_input = in_edge->from->stage;
-                            stage_offset_from_this_input = start_delay;
-                        }
-                    }
-                    if (start_stage_from_this_input != kUnknown &&
-                        (node_stage == kUnknown ||
-                         (start_stage_from_this_input > node_stage) ||
-                         ((start_stage_from_this_input == node_stage) &&
-                          (stage_offset_from_this_input > node_offset)))) {
-                        node_stage = start_stage_from_this_input;
-                        node_offset = stage_offset_from_this_input;
-                    }
+            if (start_stage_from_this_input != kUnknown &&
+                (node_stage == kUnknown ||
+                 (start_stage_from_this_input > node_stage) ||
+                 ((start_stage_from_this_input == node_stage) &&
+                  (stage_offset_from_this_input > node_offset)))) {
+                node_stage = start_stage_from_this_input;
+                node_offset = stage_offset_from_this_input;
+            }
+        } else {
+            // Reverse direction: compute natural stage based on
+            // successors, and push node to lower stage if necessary.
+            if (in_node->stage != kUnknown && latency > 0) {
+                start_stage_from_this_input = in_node->stage - latency;
+                stage_offset_from_this_input = delay_per_stage - node->delay;
+            } else if (in_node->stage != kUnknown) {
+                int start_delay = in_node->stage_offset - node->delay;
+                if (start_delay < 0) {
+                    start_stage_from_this_input = in_node->stage - 1;
+                    stage_offset_from_this_input = delay_per_stage - node->delay;
                 } else {
-                    // Reverse direction: compute natural stage based on
-                    // successors, and push node to lower stage if necessary.
-                    if (in_edge->to->stage != kUnknown) {
-                        int start_delay = in_edge->to->stage_offset - node->delay;
-                        if (start_delay < 0) {
-                            start_stage_from_this_input = in_edge->to->stage - 1;
-                            stage_offset_from_this_input = delay_per_stage - node->delay;
-                        } else {
-                            start_stage_from_this_input = in_edge->to->stage;
-                            stage_offset_from_this_input = in_edge->to->stage_offset - node->delay;
-                        }
-                    }
-                    if (start_stage_from_this_input != kUnknown &&
-                        (node_stage == kUnknown ||
-                         (start_stage_from_this_input < node_stage) ||
-                         ((start_stage_from_this_input == node_stage) &&
-                          (stage_offset_from_this_input < node_offset)))) {
-                        node_stage = start_stage_from_this_input;
-                        node_offset = stage_offset_from_this_input;
-                    }
+                    start_stage_from_this_input = in_node->stage;
+                    stage_offset_from_this_input = in_node->stage_offset - node->delay;
                 }
             }
+            if (start_stage_from_this_input != kUnknown &&
+                (node_stage == kUnknown ||
+                 (start_stage_from_this_input < node_stage) ||
+                 ((start_stage_from_this_input == node_stage) &&
+                  (stage_offset_from_this_input < node_offset)))) {
+                node_stage = start_stage_from_this_input;
+                node_offset = stage_offset_from_this_input;
+            }
+        }
+    }
+
+    // If no in-edges, default to stage 0.
+    if (node_stage == kUnknown) {
+        node_stage = 0;
+        node_offset = 0;
+    }
+
+    // Now examine vars: see if any var implies a stage for this node,
+    // and bump our stage later (but not earlier! -- to ensure forward
+    // progress) if required.
+    for (auto& p : NodeVars(n)) {
+        const Var* var = &vars_[p.first];
+        int offset = p.second;
 
-            // If no in-edges, default to stage 0.
-            if (node_stage == kUnknown) {
-                node_stage = 0;
+        if (var->known &&
+            ((forward &&
+              ((var->stage + offset) > node_stage)) ||
+             (!forward &&
+              ((var->stage + offset) < node_stage)))) {
+            node_stage = var->stage + offset;
+            // Start at 'beginning' of offset within stage -- we can
+            // monotonically approach solution but we must ensure we
+            // don't overshoot it.
+            if (forward) {
                 node_offset = 0;
+            } else {
+                node_offset = delay_per_stage;
             }
+        }
+    }
 
-            // Now examine vars: see if any var implies a stage for this node,
-            // and bump our stage later (but not earlier! -- to ensure forward
-            // progress) if required.
-            for (auto& p : node->vars) {
-                auto* var = p.first;
-                int offset = p.second;
-
-                if (var->stage != kUnknown &&
-                    ((forward &&
-                      ((var->stage + offset) > node_stage)) ||
-                     (!forward &&
-                      ((var->stage + offset) < node_stage)))) {
-                    node_stage = var->stage + offset;
-                    // Start at 'beginning' of offset within stage -- we can
-                    // monotonically approach solution but we must ensure we
-                    // don't overshoot it.
-                    if (forward) {
-                        node_offset = 0;
-                    } else {
-                        node_offset = delay_per_stage;
-                    }
-                }
-            }
+    *out_stage = node_stage;
+    *out_offset = node_offset;
+}
 
-            // Compare to current node location, if any, and set 'changed' flag
-            // if node moved.
-            if (node->stage != kUnknown &&
-                    ((node->stage != node_stage) ||
-                     (node->stage_offset != node_offset))) {
-                changed = true;
-            }
+template<typename T, typename U>
+template<typename ErrorReporter>
+bool TimingDAG<T, U>::DoPhase(
+        int delay_per_stage,
+        ErrorReporter* err,
+        bool forward,
+        bool respectAnchors) {
+
+    // The worklist is keyed so that the smallest key is always the next
+    // node in reverse postorder (forward) or forward postorder (!forward).
+    // Visiting in this order means that a node is normally placed only after
+    // all of its inputs have settled.
+    std::priority_queue<int, std::vector<int>, std::greater<int>> worklist;
+    auto enqueue = [this, &worklist, forward](int n) {
+        Node* node = &nodes_[n];
+        if (node->on_worklist) return;
+        node->on_worklist = true;
+        worklist.push(forward ? node->rpo_index : -node->rpo_index);
+    };
+    for (int n : rpo_) {
+        enqueue(n);
+    }
 
-            // Now update vars: if any var attached to this node is unknown, or
-            // is known but this node's placement implies a later stage for the
-            // var, we're allowed to update it.
-            for (auto& p : node->vars) {
-                auto* var = p.first;
-                int offset = p.second;
-
-                if (var->stage == kUnknown ||
-                    ((node_stage - offset) > var->stage)) {
-                    var->stage = node->stage - offset;
-                    var->updates++;
-                    changed = true;
-                    if (var->updates > kMaxVarUpdates) {
-                        err->ReportError(node->t, var->u,
-                                         strprintf("Var experienced more than "
-                                                   "the maximum of %d updates during "
-                                                   "timing-DAG solving. Please "
-                                                   "reconsider timing constraints.",
-                                                   kMaxVarUpdates));
-                        return false;
-                    }
+    while (!worklist.empty()) {
+        int key = worklist.top();
+        worklist.pop();
+        int n = rpo_[forward ? key : -key];
+        Node* node = &nodes_[n];
+        node->on_worklist = false;
+        stats_.nodes_visited++;
+
+        // First, ensure node's delay is not greater than delay_per_stage,
+        // or else no solution will exist (the op must be able to fit in a
+        // single stage).
+        if (node->delay > delay_per_stage) {
+            err->ReportError(node->t, NULL,
+                             strprintf("Node delay %d greater than delay-per-stage %d",
+                                       node->delay, delay_per_stage));
+            return false;
+        }
+
+        int node_stage, node_offset;
+        PlaceNode(n, delay_per_stage, forward, respectAnchors,
+                  &node_stage, &node_offset);
+
+        // Now update vars: if any var attached to this node is unknown, or
+        // is known but this node's placement implies a later stage for the
+        // var, we're allowed to update it. Every other node constrained by
+        // the var must then be revisited.
+        for (auto& p : NodeVars(n)) {
+            Var* var = &vars_[p.first];
+            int offset = p.second;
+
+            if (!var->known ||
+                ((node_stage - offset) > var->stage)) {
+                var->known = true;
+                var->stage = node_stage - offset;
+                var->updates++;
+                stats_.var_updates++;
+                if (var->updates > kMaxVarUpdates) {
+                    err->ReportError(node->t, var->u,
+                                     strprintf("Var experienced more than "
+                                               "the maximum of %d updates during "
+                                               "timing-DAG solving. Please "
+                                               "reconsider timing constraints.",
+                                               kMaxVarUpdates));
+                    return false;
+                }
+                for (auto& q : VarNodes(p.first)) {
+                    enqueue(q.first);
                 }
             }
+        }
 
+        // If the node moved, its dependents (successors going forward,
+        // predecessors going backward) must be revisited.
+        if (node->stage != node_stage || node->stage_offset != node_offset) {
             node->stage = node_stage;
             node->stage_offset = node_offset;
+            for (int other : (forward ? Succs(n) : Preds(n))) {
+                enqueue(other);
+            }
         }
     }
-    
+
     return true;
 }
 
 template<typename T, typename U>
-void TimingDAG<T, U>::SetAnchors(const NodeReversePostorder& rpo) {
-    for (auto& node : nodes_) {
-        if (node->lifted || node->out.empty()) {
+void TimingDAG<T, U>::SetAnchors() {
+    for (int n = 0; n < static_cast<int>(nodes_.size()); n++) {
+        Node* node = &nodes_[n];
+        if (node->lifted || out_begin_[n] == out_begin_[n + 1]) {
             node->anchored = true;
             node->anchored_stage = node->stage;
         }
@@ -533,39 +807,252 @@ void TimingDAG<T, U>::FindStageSets() {
     // Discover the maximum stage number.
     int max_stage = kUnknown;
     for (auto& node : nodes_) {
-        if (node->stage != kUnknown &&
-                (max_stage == kUnknown || node->stage > max_stage)) {
-            max_stage = node->stage;
+        if (node.stage != kUnknown &&
+                (max_stage == kUnknown || node.stage > max_stage)) {
+            max_stage = node.stage;
         }
     }
     // Post-processing: collect nodes into stages.
-    for (int i = 0; i <= max_stage; i++) {
-        std::unique_ptr<Stage> stage(new Stage());
-        stages_.push_back(std::move(stage));
+    std::vector<std::pair<int, int>> entries;
+    entries.reserve(nodes_.size());
+    for (int n = 0; n < static_cast<int>(nodes_.size()); n++) {
+        entries.push_back(std::make_pair(nodes_[n].stage, n));
+    }
+    BuildCSR(max_stage + 1, entries, &stage_begin_, &stage_nodes_);
+}
+
+template<typename T, typename U>
+void TimingDAG<T, U>::ComputeArrivals() {
+    // The solver's final offsets come from the sink phase and so are
+    // latest-possible start times; walk the final placement in RPO to
+    // recompute earliest arrivals along same-stage edges instead.
+    for (int n : rpo_) {
+        Node* node = &nodes_[n];
+        node->arrival = 0;
+        node->critical_pred = kUnknown;
+        for (int other : Preds(n)) {
+            const Node* in_node = &nodes_[other];
+            if (in_node->stage != node->stage) continue;
+            int ready = in_node->arrival + in_node->delay;
+            if (node->critical_pred == kUnknown || ready > node->arrival) {
+                node->arrival = ready;
+                node->critical_pred = other;
+            }
+        }
+    }
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::RegisterCostAt(int n, int stage) const {
+    // The node's own value is carried to its latest user...
+    const Node* node = &nodes_[n];
+    int last_use = stage;
+    for (int succ : ValueSuccs(n)) {
+        last_use = std::max(last_use, nodes_[succ].stage);
+    }
+    int cost = node->weight * (last_use - stage);
+    // ... and each input's value must now reach |stage|.
+    for (int pred : ValuePreds(n)) {
+        const Node* in_node = &nodes_[pred];
+        int in_last_use = stage;
+        for (int succ : ValueSuccs(pred)) {
+            if (succ != n) {
+                in_last_use = std::max(in_last_use, nodes_[succ].stage);
+            }
+        }
+        cost += in_node->weight * (in_last_use - in_node->stage);
+    }
+    return cost;
+}
+
+template<typename T, typename U>
+bool TimingDAG<T, U>::MoveToCheapestStage(int n, int delay_per_stage) {
+    Node* node = &nodes_[n];
+    // The node may go anywhere between its latest predecessor and earliest
+    // successor (each less any latency on the edge), provided it fits between
+    // their delay offsets if it shares a stage with them.
+    int lo = 0, hi = kUnknown;
+    for (int e = in_begin_[n]; e < in_begin_[n + 1]; e++) {
+        lo = std::max(lo, nodes_[in_edges_[e]].stage + in_latency_[e]);
+    }
+    for (int e = out_begin_[n]; e < out_begin_[n + 1]; e++) {
+        int stage = nodes_[out_edges_[e]].stage - out_latency_[e];
+        if (hi == kUnknown || stage < hi) {
+            hi = stage;
+        }
+    }
+    if (hi == kUnknown) return false;
+
+    int best_stage = node->stage;
+    int best_offset = node->stage_offset;
+    int best_cost = RegisterCostAt(n, node->stage);
+    for (int stage = lo; stage <= hi; stage++) {
+        if (stage == node->stage) continue;
+        int earliest = 0;
+        int latest = delay_per_stage - node->delay;
+        for (int pred : Preds(n)) {
+            const Node* in_node = &nodes_[pred];
+            if (in_node->stage == stage) {
+                earliest = std::max(earliest,
+                                    in_node->stage_offset + in_node->delay);
+            }
+        }
+        for (int succ : Succs(n)) {
+            const Node* out_node = &nodes_[succ];
+            if (out_node->stage == stage) {
+                latest = std::min(latest, out_node->stage_offset - node->delay);
+            }
+        }
+        if (earliest > latest) continue;
+        int cost = RegisterCostAt(n, stage);
+        if (cost < best_cost) {
+            best_stage = stage;
+            best_offset = earliest;
+            best_cost = cost;
+        }
+    }
+
+    if (best_stage == node->stage) return false;
+    node->stage = best_stage;
+    node->stage_offset = best_offset;
+    return true;
+}
+
+template<typename T, typename U>
+void TimingDAG<T, U>::MinimizeRegisterCost(int delay_per_stage) {
+    std::vector<int> movable;
+    for (int n : rpo_) {
+        const Node* node = &nodes_[n];
+        if (node->anchored || node->pinned ||
+            node_var_begin_[n] != node_var_begin_[n + 1]) {
+            continue;
+        }
+        movable.push_back(n);
+    }
+
+    // Greedy descent: move each node to its cheapest feasible stage given
+    // its neighbors' current placement, until nothing moves.
+    for (int sweep = 0; sweep < kMaxRegisterSweeps; sweep++) {
+        bool moved = false;
+        for (int n : movable) {
+            if (MoveToCheapestStage(n, delay_per_stage)) {
+                moved = true;
+            }
+        }
+        if (!moved) break;
+    }
+
+    FindStageSets();
+    ComputeArrivals();
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::BalanceStages(int delay_per_stage) {
+    // Solving forward packs each stage as full as the budget allows, so the
+    // last stages are often nearly empty. A smaller budget that still gives
+    // the same stage count spreads the nodes out. The current budget fits,
+    // so the search always succeeds.
+    int delay = FitStages(StageCount(), 1, delay_per_stage);
+    assert(delay != -1);
+    return delay;
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::FitStages(int max_stages, int lo, int hi) {
+    // Binary-search for the smallest budget that fits. A larger budget never
+    // needs more stages unless timing vars interact badly, in which case the
+    // search may settle on a larger budget than necessary. A budget at which
+    // the vars cannot be satisfied is simply a trial that fails.
+    QuietReporter quiet;
+    auto fits = [this, max_stages, &quiet](int delay) {
+        return Solve(delay, &quiet) && StageCount() <= max_stages;
+    };
+    if (lo > hi || !fits(hi)) return -1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (fits(mid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    // Leave the DAG solved at the chosen budget, which fit before.
+    bool solved = fits(hi);
+    assert(solved);
+    (void)solved;
+    return hi;
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::TotalDelay() const {
+    int total = 0;
+    for (auto& node : nodes_) {
+        total += node.delay;
     }
+    return total;
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::MaxStageDelay() const {
+    int max_delay = 0;
     for (auto& node : nodes_) {
-        stages_[node->stage]->nodes.push_back(node.get());
+        max_delay = std::max(max_delay, node.arrival + node.delay);
     }
+    return max_delay;
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::RegisterCost(const T* t) const {
+    auto n = node_map_.find(t);
+    assert(n != node_map_.end());
+    const Node* node = &nodes_[n->second];
+    int last_use = node->stage;
+    for (int succ : ValueSuccs(n->second)) {
+        last_use = std::max(last_use, nodes_[succ].stage);
+    }
+    return node->weight * (last_use - node->stage);
 }
 
 template<typename T, typename U>
 int TimingDAG<T, U>::GetStage(const T* t) const {
-    assert(node_map_.find(t) != node_map_.end());
-    Node* n = node_map_[t];
-    return n->stage;
+    auto n = node_map_.find(t);
+    assert(n != node_map_.end());
+    return nodes_[n->second].stage;
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::GetDelay(const T* t) const {
+    auto n = node_map_.find(t);
+    assert(n != node_map_.end());
+    return nodes_[n->second].delay;
+}
+
+template<typename T, typename U>
+int TimingDAG<T, U>::GetArrival(const T* t) const {
+    auto n = node_map_.find(t);
+    assert(n != node_map_.end());
+    return nodes_[n->second].arrival;
+}
+
+template<typename T, typename U>
+const T* TimingDAG<T, U>::GetCriticalPred(const T* t) const {
+    auto n = node_map_.find(t);
+    assert(n != node_map_.end());
+    int pred = nodes_[n->second].critical_pred;
+    return pred == kUnknown ? NULL : nodes_[pred].t;
 }
 
 template<typename T, typename U>
 int TimingDAG<T, U>::StageCount() const {
-    return stages_.size();
+    return stage_begin_.empty() ? 0 : stage_begin_.size() - 1;
 }
 
 template<typename T, typename U>
 std::vector<const T*> TimingDAG<T,  U>::NodesInStage(int stage) const {
     std::vector<const T*> ret;
-    assert(stage >= 0 && stage < static_cast<int>(stages_.size()));
-    for (auto* node : stages_[stage]->nodes) {
-        ret.push_back(node->t);
+    assert(stage >= 0 && stage < StageCount());
+    for (int i = stage_begin_[stage]; i < stage_begin_[stage + 1]; i++) {
+        ret.push_back(nodes_[stage_nodes_[i]].t);
     }
     return ret;
 }
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_ARENA_H_
+#define _AUTOPIPER_COMMON_ARENA_H_
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <assert.h>
+#include <stdlib.h>
+
+namespace autopiper {
+
+// A typed arena: objects are constructed in large contiguous chunks and are
+// all destroyed together when the arena goes away. Pointers handed out are
+// stable for the arena's lifetime. Objects are never individually freed, so
+// this suits IR that is built up incrementally and discarded as a whole.
+template<typename T, int kChunkSize = 256>
+class Arena {
+ public:
+  Arena() : size_(0) {}
+  ~Arena() { Clear(); }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  template<typename... Args>
+  T* New(Args&&... args) {
+      int offset = size_ % kChunkSize;
+      if (offset == 0) {
+          chunks_.push_back(static_cast<T*>(malloc(sizeof(T) * kChunkSize)));
+          if (!chunks_.back()) throw std::bad_alloc();
+      }
+      T* slot = chunks_.back() + offset;
+      new (slot) T(std::forward<Args>(args)...);
+      size_++;
+      return slot;
+  }
+
+  // Number of objects allocated so far; also the index that the next New()
+  // will be assigned by At().
+  int size() const { return size_; }
+
+  T* At(int i) const {
+      return chunks_[i / kChunkSize] + (i % kChunkSize);
+  }
+
+  void Clear() {
+      for (int i = 0; i < size_; i++) {
+          At(i)->~T();
+      }
+      for (auto* chunk : chunks_) {
+          free(chunk);
+      }
+      chunks_.clear();
+      size_ = 0;
+  }
+
+ private:
+  std::vector<T*> chunks_;
+  int size_;
+};
+
+// An untyped arena for objects of assorted small sizes that are freed one by
+// one: a freed block goes on the free list of its size class and is reused by
+// the next allocation of that class. Memory returns to the system only when
+// the arena goes away, which must be after every block is freed. This suits
+// trees that are rewritten in place and discarded as a whole.
+class PoolArena {
+ public:
+  PoolArena() : next_(nullptr), end_(nullptr), bytes_(0), live_(0) {}
+  ~PoolArena() {
+      assert(live_ == 0);
+      for (auto* chunk : chunks_) {
+          free(chunk);
+      }
+  }
+
+  PoolArena(const PoolArena&) = delete;
+  PoolArena& operator=(const PoolArena&) = delete;
+
+  // Blocks are aligned to, and sized in multiples of, this many bytes.
+  static const size_t kAlign = 16;
+
+  void* Allocate(size_t size) {
+      size_t cls = SizeClass(size);
+      live_++;
+      if (cls < free_lists_.size() && free_lists_[cls]) {
+          FreeBlock* block = free_lists_[cls];
+          free_lists_[cls] = block->next;
+          return block;
+      }
+      size = cls * kAlign;
+      if (size > kChunkSize / 4) {
+          return NewChunk(size);
+      }
+      if (static_cast<size_t>(end_ - next_) < size) {
+          next_ = NewChunk(kChunkSize);
+          end_ = next_ + kChunkSize;
+      }
+      char* block = next_;
+      next_ += size;
+      return block;
+  }
+
+  void Free(void* p, size_t size) {
+      size_t cls = SizeClass(size);
+      if (cls >= free_lists_.size()) {
+          free_lists_.resize(cls + 1, nullptr);
+      }
+      FreeBlock* block = static_cast<FreeBlock*>(p);
+      block->next = free_lists_[cls];
+      free_lists_[cls] = block;
+      live_--;
+  }
+
+  // Bytes taken from the system so far.
+  size_t bytes() const { return bytes_; }
+
+ private:
+  static const size_t kChunkSize = 64 << 10;
+
+  struct FreeBlock {
+      FreeBlock* next;
+  };
+
+  static size_t SizeClass(size_t size) {
+      return (size + kAlign - 1) / kAlign;
+  }
+
+  char* NewChunk(size_t size) {
+      char* chunk = static_cast<char*>(malloc(size));
+      if (!chunk) throw std::bad_alloc();
+      chunks_.push_back(chunk);
+      bytes_ += size;
+      return chunk;
+  }
+
+  std::vector<char*> chunks_;
+  // The unallocated rest of the current chunk.
+  char* next_;
+  char* end_;
+  std::vector<FreeBlock*> free_lists_;
+  size_t bytes_;
+  long live_;
+};
+
+}  // namespace autopiper
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/binary-format.h"
+#include "common/util.h"
+
+#include <string.h>
+
+using namespace autopiper;
+using namespace std;
+
+void BinaryEncoder::PutString(string* out, const string& s) {
+    auto it = string_index_.find(s);
+    if (it == string_index_.end()) {
+        it = string_index_.insert(
+                make_pair(s, static_cast<int>(strings_.size()))).first;
+        strings_.push_back(s);
+    }
+    PutVarint(out, it->second);
+}
+
+void BinaryEncoder::PutStringTable(string* out) const {
+    PutVarint(out, strings_.size());
+    for (auto& s : strings_) {
+        PutVarint(out, s.size());
+        *out += s;
+    }
+}
+
+void BinaryDecoder::Error(const string& message) {
+    if (!ok_) return;
+    ok_ = false;
+    Location loc;
+    loc.filename = filename_;
+    collector_->ReportError(loc, ErrorCollector::ERROR, message);
+}
+
+bool BinaryDecoder::GetHeader(const char* magic, size_t size, int version,
+                              const string& what) {
+    if (end_ - pos_ < static_cast<long>(size) ||
+        memcmp(pos_, magic, size) != 0) {
+        Error("Not a " + kind_);
+        return false;
+    }
+    pos_ += size;
+    unsigned long long file_version = GetVarint();
+    if (ok_ && file_version != static_cast<unsigned long long>(version)) {
+        Error(strprintf("Unsupported %s version %d (expected %d)",
+                        what.c_str(), static_cast<int>(file_version),
+                        version));
+    }
+    return ok_;
+}
+
+bool BinaryDecoder::Need(unsigned long long bytes) {
+    if (ok_ && static_cast<unsigned long long>(end_ - pos_) < bytes) {
+        Error("Truncated " + kind_);
+    }
+    return ok_;
+}
+
+unsigned long long BinaryDecoder::GetVarint() {
+    unsigned long long value = 0;
+    for (int shift = 0; ok_; shift += 7) {
+        if (!Need(1)) break;
+        unsigned char byte = static_cast<unsigned char>(*pos_++);
+        if (shift > 63) {
+            Error("Malformed integer in " + kind_);
+            break;
+        }
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return ok_ ? value : 0;
+}
+
+long long BinaryDecoder::GetSigned() {
+    unsigned long long value = GetVarint();
+    return static_cast<long long>(value >> 1) ^
+           -static_cast<long long>(value & 1);
+}
+
+int BinaryDecoder::GetInt() {
+    unsigned long long value = GetVarint();
+    if (value > 0x7fffffff) {
+        Error("Integer out of range in " + kind_);
+        return 0;
+    }
+    return static_cast<int>(value);
+}
+
+unsigned long long BinaryDecoder::GetCount() {
+    unsigned long long count = GetVarint();
+    Need(count);
+    return ok_ ? count : 0;
+}
+
+int BinaryDecoder::GetIndex(size_t limit) {
+    unsigned long long index = GetVarint();
+    if (ok_ && index >= limit) {
+        Error("Index out of range in " + kind_);
+    }
+    return ok_ ? static_cast<int>(index) : static_cast<int>(limit);
+}
+
+void BinaryDecoder::GetStringTable() {
+    unsigned long long string_count = GetCount();
+    for (unsigned long long i = 0; ok_ && i < string_count; i++) {
+        unsigned long long len = GetCount();
+        if (!Need(len)) break;
+        strings_.push_back(string(pos_, len));
+        pos_ += len;
+    }
+}
+
+const string& BinaryDecoder::GetString() {
+    static const string empty;
+    int index = GetIndex(strings_.size());
+    return ok_ ? strings_[index] : empty;
+}
+
+void BinaryDecoder::GetLocation(Location* loc) {
+    loc->filename = GetString();
+    loc->line = GetInt();
+    loc->column = GetInt();
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_BINARY_FORMAT_H_
+#define _AUTOPIPER_COMMON_BINARY_FORMAT_H_
+
+#include "common/parser-utils.h"  // Location, ErrorCollector
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace autopiper {
+
+// The primitives shared by the compiler's binary formats (binary IR and
+// precompiled libraries). All integers are unsigned LEB128 varints (signed
+// ones are zigzag-encoded first), so small values -- nearly all of them --
+// take one byte. Strings are indices into a table that the file holds ahead
+// of its body, so each distinct string is stored once. A location is
+// (filename (string), line, column), and a bignum is a signed byte count
+// (negative for negative values) followed by the magnitude's bytes, least
+// significant first.
+class BinaryEncoder {
+    public:
+        BinaryEncoder() {}
+
+        static void PutVarint(std::string* out, unsigned long long value) {
+            while (value >= 0x80) {
+                out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out->push_back(static_cast<char>(value));
+        }
+
+        static void PutSigned(std::string* out, long long value) {
+            PutVarint(out, (static_cast<unsigned long long>(value) << 1) ^
+                           static_cast<unsigned long long>(value >> 63));
+        }
+
+        // Appends |s|'s index, adding it to the string table if new.
+        void PutString(std::string* out, const std::string& s);
+
+        void PutLocation(std::string* out, const Location& loc) {
+            PutString(out, loc.filename);
+            PutVarint(out, loc.line);
+            PutVarint(out, loc.column);
+        }
+
+        template<typename Bignum>
+        static void PutBignum(std::string* out, const Bignum& value) {
+            std::vector<unsigned char> bytes;
+            Bignum magnitude = value < 0 ? Bignum(-value) : value;
+            while (magnitude != 0) {
+                bytes.push_back(static_cast<unsigned char>(
+                            Bignum(magnitude & 0xff).template
+                                convert_to<unsigned>()));
+                magnitude >>= 8;
+            }
+            long long count = static_cast<long long>(bytes.size());
+            PutSigned(out, value < 0 ? -count : count);
+            out->append(bytes.begin(), bytes.end());
+        }
+
+        // Appends the string table: the count, then (length, bytes) per
+        // string. Written once the body is complete, ahead of it.
+        void PutStringTable(std::string* out) const;
+
+    private:
+        std::map<std::string, int> string_index_;
+        std::vector<std::string> strings_;
+};
+
+// Reads what BinaryEncoder writes. The first error is reported to the
+// collector, naming the file as |kind| (e.g. "binary IR file"); after it,
+// every read returns a zero value and ok() is false, so callers need only
+// check ok() before using what they read.
+class BinaryDecoder {
+    public:
+        BinaryDecoder(const std::string& filename, const char* data,
+                      size_t size, ErrorCollector* collector,
+                      const std::string& kind)
+            : filename_(filename), pos_(data), end_(data + size),
+              collector_(collector), kind_(kind), ok_(true) {}
+
+        bool ok() const { return ok_; }
+        bool AtEnd() const { return pos_ == end_; }
+        void Error(const std::string& message);
+
+        // Consumes |magic| ([size] bytes) and a version, which must be
+        // |version|; reports |what| as the file's description otherwise.
+        bool GetHeader(const char* magic, size_t size, int version,
+                       const std::string& what);
+
+        bool Need(unsigned long long bytes);
+        unsigned long long GetVarint();
+        long long GetSigned();
+        int GetInt();
+        // A count of items that each take at least one byte, so can be
+        // checked against the remaining size before anything is allocated.
+        unsigned long long GetCount();
+        // Returns an index below |limit|, or |limit| on error.
+        int GetIndex(size_t limit);
+
+        void GetStringTable();
+        const std::string& GetString();
+        void GetLocation(Location* loc);
+
+        template<typename Bignum>
+        Bignum GetBignum() {
+            long long count = GetSigned();
+            unsigned long long len = count < 0 ? -count : count;
+            Bignum value = 0;
+            if (!Need(len)) return value;
+            for (unsigned long long i = len; i > 0; i--) {
+                value <<= 8;
+                value |= static_cast<unsigned char>(pos_[i - 1]);
+            }
+            pos_ += len;
+            return count < 0 ? Bignum(-value) : value;
+        }
+
+    private:
+        std::string filename_;
+        const char* pos_;
+        const char* end_;
+        ErrorCollector* collector_;
+        std::string kind_;
+        bool ok_;
+        std::vector<std::string> strings_;
+};
+
+}  // namespace autopiper
+
+#endif  // _AUTOPIPER_COMMON_BINARY_FORMAT_H_
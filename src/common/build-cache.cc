@@ -0,0 +1,109 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/build-cache.h"
+#include "common/util.h"
+
+#include <fstream>
+#include <memory>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace autopiper;
+using namespace std;
+
+void ContentHash::AddFile(const string& filename) {
+    ifstream in(filename, ios::binary);
+    if (!in.good()) {
+        Add("(unreadable)");
+        return;
+    }
+    char buf[4096];
+    while (in) {
+        in.read(buf, sizeof(buf));
+        Add(buf, in.gcount());
+    }
+}
+
+void ContentHash::AddCompilerIdentity() {
+    char path[4096];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len < 0) {
+        Add("(unknown compiler)");
+        return;
+    }
+    path[len] = '\0';
+    Add(string(path));
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        Add(static_cast<long long>(st.st_size));
+        Add(static_cast<long long>(st.st_mtime));
+    }
+}
+
+string ContentHash::Hex() const {
+    return strprintf("%016llx", static_cast<unsigned long long>(hash_));
+}
+
+string BuildCache::EntryPath(const string& key,
+                             const Artifact& artifact) const {
+    return dir_ + "/" + key + "." + artifact.suffix;
+}
+
+bool BuildCache::Fetch(const string& key,
+                       const vector<Artifact>& artifacts) const {
+    vector<unique_ptr<ifstream>> entries;
+    for (auto& artifact : artifacts) {
+        unique_ptr<ifstream> in(
+                new ifstream(EntryPath(key, artifact), ios::binary));
+        if (!in->good()) return false;
+        entries.push_back(move(in));
+    }
+    for (unsigned i = 0; i < artifacts.size(); i++) {
+        ofstream out(artifacts[i].path, ios::binary);
+        if (!out.good()) return false;
+        out << entries[i]->rdbuf();
+        if (!out.good()) return false;
+    }
+    return true;
+}
+
+void BuildCache::Store(const string& key,
+                       const vector<Artifact>& artifacts) const {
+    mkdir(dir_.c_str(), 0777);
+    for (auto& artifact : artifacts) {
+        ifstream in(artifact.path, ios::binary);
+        if (!in.good()) return;
+        string path = EntryPath(key, artifact);
+        string tmp = strprintf("%s.tmp%d", path.c_str(),
+                               static_cast<int>(getpid()));
+        {
+            ofstream out(tmp, ios::binary);
+            if (!out.good()) return;
+            out << in.rdbuf();
+            if (!out.good()) {
+                out.close();
+                unlink(tmp.c_str());
+                return;
+            }
+        }
+        if (rename(tmp.c_str(), path.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return;
+        }
+    }
+}
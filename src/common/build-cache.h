@@ -0,0 +1,99 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_BUILD_CACHE_H_
+#define _AUTOPIPER_COMMON_BUILD_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace autopiper {
+
+// A 64-bit FNV-1a hash of a stream of values, used to key cached outputs by
+// the content that produced them.
+class ContentHash {
+    public:
+        ContentHash() : hash_(14695981039346656037ULL) {}
+
+        void Add(const void* data, size_t size) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; i++) {
+                hash_ ^= p[i];
+                hash_ *= 1099511628211ULL;
+            }
+        }
+        // Strings are length-prefixed, so that adjacent strings cannot run
+        // together into the same hash.
+        void Add(const std::string& s) {
+            Add(static_cast<long long>(s.size()));
+            Add(s.data(), s.size());
+        }
+        void Add(const char* s) { Add(std::string(s)); }
+        void Add(long long value) { Add(&value, sizeof(value)); }
+        void Add(int value) { Add(static_cast<long long>(value)); }
+        void Add(bool value) { Add(static_cast<long long>(value)); }
+
+        // Adds the contents of the named file, or a marker if it cannot be
+        // read.
+        void AddFile(const std::string& filename);
+
+        // Adds the identity (path, size and modification time) of the running
+        // executable, so that a rebuilt compiler does not reuse outputs cached
+        // by an older one.
+        void AddCompilerIdentity();
+
+        std::string Hex() const;
+
+    private:
+        uint64_t hash_;
+};
+
+// An on-disk cache of compiler outputs. Each entry is a set of artifacts --
+// output files, named by suffix (e.g. "v" for Verilog) -- stored under a
+// content-hash key as <dir>/<key>.<suffix>. The cache is best-effort: a
+// missing or unwritable directory just means every lookup misses.
+class BuildCache {
+    public:
+        explicit BuildCache(const std::string& dir) : dir_(dir) {}
+
+        struct Artifact {
+            std::string suffix;
+            // The compiler's output file for this artifact.
+            std::string path;
+        };
+
+        // Copies the cached artifacts for |key| to their output paths.
+        // Returns false, copying nothing, unless all of them are present.
+        bool Fetch(const std::string& key,
+                   const std::vector<Artifact>& artifacts) const;
+
+        // Copies the output files of |artifacts| into the cache under |key|.
+        // Each file is written under a temporary name and renamed into place,
+        // so concurrent compilers never see a partial entry.
+        void Store(const std::string& key,
+                   const std::vector<Artifact>& artifacts) const;
+
+    private:
+        std::string dir_;
+
+        std::string EntryPath(const std::string& key,
+                              const Artifact& artifact) const;
+};
+
+}  // namespace autopiper
+
+#endif  // _AUTOPIPER_COMMON_BUILD_CACHE_H_
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/compile-server.h"
+#include "common/exception.h"
+#include "common/util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <exception>
+#include <sstream>
+#include <thread>
+
+using namespace autopiper;
+using namespace std;
+
+namespace {
+
+const char kRequestMagic[] = "autopiper-request\n";
+
+bool WriteAll(int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        // MSG_NOSIGNAL: a client that hangs up must not kill the server.
+        ssize_t n = send(fd, data.data() + done, data.size() - done,
+                         MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+bool ReadAll(int fd, string* data) {
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) return true;
+        data->append(buf, n);
+    }
+}
+
+sockaddr_un Address(const string& socket_path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw autopiper::Exception(
+                "Compile server socket path is too long: " + socket_path);
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+    return addr;
+}
+
+// Returns a socket connected to the server at |socket_path|, or -1.
+int Connect(const string& socket_path) {
+    sockaddr_un addr = Address(socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Encodes |strings| (the working directory and arguments; none for a
+// shutdown) as a request.
+string EncodeRequest(const vector<string>& strings) {
+    string data = kRequestMagic;
+    data += strprintf("%d\n", static_cast<int>(strings.size()));
+    for (auto& s : strings) {
+        data += s;
+        data += '\0';
+    }
+    return data;
+}
+
+bool DecodeRequest(const string& data, vector<string>* strings) {
+    size_t magic_len = sizeof(kRequestMagic) - 1;
+    if (data.compare(0, magic_len, kRequestMagic) != 0) return false;
+    size_t eol = data.find('\n', magic_len);
+    if (eol == string::npos) return false;
+    int count = atoi(data.substr(magic_len, eol - magic_len).c_str());
+    size_t pos = eol + 1;
+    for (int i = 0; i < count; i++) {
+        size_t end = data.find('\0', pos);
+        if (end == string::npos) return false;
+        strings->push_back(data.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return pos == data.size();
+}
+
+// Sends a request and returns the response, throwing if the server cannot
+// be reached.
+string Exchange(const string& socket_path, const vector<string>& strings) {
+    int fd = Connect(socket_path);
+    if (fd < 0) {
+        throw autopiper::Exception(strprintf(
+                    "Could not connect to compile server at '%s': %s",
+                    socket_path.c_str(), strerror(errno)));
+    }
+    string response;
+    bool ok = WriteAll(fd, EncodeRequest(strings)) &&
+              shutdown(fd, SHUT_WR) == 0 &&
+              ReadAll(fd, &response);
+    close(fd);
+    if (!ok) {
+        throw autopiper::Exception(
+                "Lost the connection to the compile server.");
+    }
+    return response;
+}
+
+}  // anonymous namespace
+
+void CompileServer::Serve() {
+    // A socket file may be left behind by a server that did not exit
+    // cleanly; but if a server still answers on it, leave it be.
+    int existing = Connect(socket_path_);
+    if (existing >= 0) {
+        close(existing);
+        throw autopiper::Exception(
+                "A compile server is already running at '" +
+                socket_path_ + "'.");
+    }
+    unlink(socket_path_.c_str());
+
+    sockaddr_un addr = Address(socket_path_);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 ||
+        ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr),
+               sizeof(addr)) < 0 ||
+        listen(listen_fd, 64) < 0) {
+        string error = strerror(errno);
+        if (listen_fd >= 0) close(listen_fd);
+        throw autopiper::Exception(strprintf(
+                    "Could not listen on '%s': %s",
+                    socket_path_.c_str(), error.c_str()));
+    }
+
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        // Requests are small and written all at once, so they are read
+        // here; only the compile itself goes to another thread.
+        string data;
+        vector<string> strings;
+        if (!ReadAll(fd, &data) || !DecodeRequest(data, &strings)) {
+            WriteAll(fd, "1\nError: Malformed compile request.\n");
+            close(fd);
+            continue;
+        }
+        if (strings.empty()) {
+            close(fd);
+            break;
+        }
+        Request request;
+        request.cwd = strings[0];
+        request.args.assign(strings.begin() + 1, strings.end());
+
+        {
+            unique_lock<mutex> l(mutex_);
+            done_.wait(l, [this]() { return active_ < max_concurrent_; });
+            active_++;
+        }
+        thread([this, fd, request]() {
+            ServeConnection(fd, request);
+        }).detach();
+    }
+
+    close(listen_fd);
+    unlink(socket_path_.c_str());
+    unique_lock<mutex> l(mutex_);
+    done_.wait(l, [this]() { return active_ == 0; });
+}
+
+void CompileServer::ServeConnection(int fd, const Request& request) {
+    ostringstream out;
+    int status;
+    try {
+        status = handler_(request, &out);
+    } catch (std::exception& e) {
+        out << "Error: " << e.what() << endl;
+        status = 1;
+    }
+    WriteAll(fd, strprintf("%d\n", status) + out.str());
+    close(fd);
+
+    lock_guard<mutex> l(mutex_);
+    active_--;
+    done_.notify_all();
+}
+
+int CompileServer::Send(const string& socket_path, const Request& request,
+                        ostream* out) {
+    vector<string> strings;
+    strings.push_back(request.cwd);
+    strings.insert(strings.end(), request.args.begin(), request.args.end());
+    string response = Exchange(socket_path, strings);
+    size_t eol = response.find('\n');
+    if (eol == string::npos) {
+        throw autopiper::Exception(
+                "The compile server closed the connection without a "
+                "response.");
+    }
+    (*out) << response.substr(eol + 1);
+    return atoi(response.substr(0, eol).c_str());
+}
+
+void CompileServer::Shutdown(const string& socket_path) {
+    Exchange(socket_path, vector<string>());
+}
+
+string CompileServer::ResolvePath(const string& dir, const string& path) {
+    if (path.empty() || path[0] == '/' || dir.empty()) {
+        return path;
+    }
+    return dir + "/" + path;
+}
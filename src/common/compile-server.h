@@ -0,0 +1,95 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_COMPILE_SERVER_H_
+#define _AUTOPIPER_COMMON_COMPILE_SERVER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace autopiper {
+
+// A resident compiler, serving compile requests over a Unix-domain socket so
+// that repeated compiles skip process startup and can share whatever the
+// handler keeps between requests (e.g. parsed libraries).
+//
+// A request is the client's working directory and a command line, as the
+// compiler would take it; the response is the compile's exit status and the
+// diagnostics it wrote. Each connection carries one request. Requests are
+// served on their own threads, up to |max_concurrent| at once.
+//
+// On the wire, a request is the line "autopiper-request", a line holding the
+// number of strings that follow, and then the working directory and each
+// argument, each NUL-terminated; the client then shuts down its side of the
+// connection. A request with no strings at all asks the server to exit once
+// the requests in flight finish. The response is the exit status on a line
+// of its own, followed by the diagnostics up to the end of the stream.
+class CompileServer : public boost::noncopyable {
+    public:
+        struct Request {
+            std::string cwd;
+            std::vector<std::string> args;
+        };
+
+        // Compiles one request, writing diagnostics to |out|, and returns
+        // its exit status. Called from several threads at once.
+        typedef std::function<int(const Request& request, std::ostream* out)>
+            Handler;
+
+        CompileServer(const std::string& socket_path, int max_concurrent,
+                      Handler handler)
+            : socket_path_(socket_path), max_concurrent_(max_concurrent),
+              handler_(handler), active_(0) {}
+
+        // Serves requests until asked to exit. Throws autopiper::Exception
+        // if the socket cannot be created.
+        void Serve();
+
+        // Sends |request| to the server at |socket_path|, copies its
+        // diagnostics to |out| and returns its exit status. Throws
+        // autopiper::Exception if the server cannot be reached.
+        static int Send(const std::string& socket_path,
+                        const Request& request, std::ostream* out);
+
+        // Asks the server at |socket_path| to exit.
+        static void Shutdown(const std::string& socket_path);
+
+        // Returns |path| relative to |dir|, unless it is empty or absolute.
+        // Request handlers use this on every path in a request, since the
+        // server does not share the client's working directory.
+        static std::string ResolvePath(const std::string& dir,
+                                       const std::string& path);
+
+    private:
+        std::string socket_path_;
+        int max_concurrent_;
+        Handler handler_;
+
+        std::mutex mutex_;
+        std::condition_variable done_;
+        int active_;
+
+        void ServeConnection(int fd, const Request& request);
+};
+
+}  // namespace autopiper
+
+#endif  // _AUTOPIPER_COMMON_COMPILE_SERVER_H_
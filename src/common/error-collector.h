@@ -20,6 +20,8 @@
 #include "common/parser-utils.h"
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace autopiper {
 
@@ -53,6 +55,38 @@ class CmdlineErrorCollector : public ErrorCollector {
         bool has_errors_;
 };
 
+// Records errors for later delivery to another collector. Used to keep error
+// output in a deterministic order when work runs concurrently: each task
+// reports into its own buffer, and buffers are replayed in task order.
+class BufferedErrorCollector : public ErrorCollector {
+    public:
+        BufferedErrorCollector() : has_errors_(false) {}
+
+        virtual void ReportError(Location loc,
+                                 Level level,
+                                 const std::string& message) {
+            if (level == ERROR) has_errors_ = true;
+            errors_.push_back({ loc, level, message });
+        }
+
+        virtual bool HasErrors() const { return has_errors_; }
+
+        void ReplayTo(ErrorCollector* other) const {
+            for (const auto& e : errors_) {
+                other->ReportError(e.loc, e.level, e.message);
+            }
+        }
+
+    private:
+        struct Error {
+            Location loc;
+            Level level;
+            std::string message;
+        };
+        std::vector<Error> errors_;
+        bool has_errors_;
+};
+
 }  // namespace autopiper
 
 #endif // _AUTOPIPER_COMMON_ERROR_COLLECTOR_H_
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_PARALLEL_H_
+#define _AUTOPIPER_COMMON_PARALLEL_H_
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace autopiper {
+
+// Runs |fn(i)| for every i in [0, count) using up to |jobs| threads (the
+// calling thread included). Indices are handed out dynamically, so uneven
+// work items balance across threads. Returns once all calls have completed.
+// If any call throws, the first exception is rethrown in the caller after all
+// threads have joined.
+template<typename F>
+void ParallelFor(int jobs, int count, F fn) {
+    if (jobs > count) jobs = count;
+    if (jobs <= 1) {
+        for (int i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next(0);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto worker = [&]() {
+        while (true) {
+            int i = next++;
+            if (i >= count) break;
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> l(error_mutex);
+                if (!error) error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < jobs; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+}  // namespace autopiper
+
+#endif
@@ -20,9 +20,12 @@
 #include <iostream>
 #include <assert.h>
 #include <string>
+#include <vector>
 
 #include <boost/multiprecision/gmp.hpp>
 
+#include "common/symbol.h"
+
 namespace autopiper {
 
 struct Location {
@@ -56,10 +59,15 @@ class ErrorCollector {
         virtual bool HasErrors() const = 0;
 };
 
+// A character stream with one character of lookahead and line/column
+// tracking. Input is read from the underlying stream in large blocks and
+// scanned out of the buffer, so that per-character reads cost no stream
+// calls.
 class PeekableStream {
     public:
         PeekableStream(std::istream* in)
-            : in_(in), peek_char_(0), have_peek_(false), eof_(false),
+            : in_(in), buf_(kBlockSize), pos_(0), end_(0),
+              peek_char_(0), have_peek_(false), eof_(false),
               line_(1), col_(0) {
             ReadNext();
         }
@@ -89,32 +97,67 @@ class PeekableStream {
         bool ReadNext() {
             have_peek_ = false;
             if (eof_) return false;
-            char c;
-            in_->get(c);
-            if (in_->bad() || in_->eof()) {
+            if (pos_ == end_ && !Refill()) {
                 eof_ = true;
-            } else {
-                peek_char_ = c;
-                have_peek_ = true;
-                if (c == '\n') {
-                    line_++;
-                    col_ = 0;
-                } else if (c == '\r') {
-                    col_ = 0;
-                } else {
-                    col_++;
+                return false;
+            }
+            peek_char_ = buf_[pos_++];
+            have_peek_ = true;
+            Advance(peek_char_);
+            return true;
+        }
+
+        // Appends the peeked character and all following characters for
+        // which |pred| holds to |out|, copying runs straight out of the
+        // buffer. Afterward the first character not matching |pred| (if any)
+        // is in the peek-slot, exactly as if ReadNext() had been called for
+        // each character.
+        template<typename Pred>
+        void ReadWhile(Pred pred, std::string* out) {
+            while (have_peek_ && pred(peek_char_)) {
+                // The peeked character is always the last one taken from the
+                // buffer.
+                size_t start = pos_ - 1;
+                size_t stop = pos_;
+                while (stop < end_ && pred(buf_[stop])) {
+                    Advance(buf_[stop]);
+                    stop++;
                 }
+                out->append(&buf_[start], stop - start);
+                pos_ = stop;
+                ReadNext();
             }
-            return !eof_;
         }
 
     private:
+        static const size_t kBlockSize = 64 * 1024;
+
         std::istream* in_;
+        std::vector<char> buf_;
+        size_t pos_, end_;
         char peek_char_;
         bool have_peek_;
         bool eof_;
         int line_;
         int col_;
+
+        bool Refill() {
+            std::streamsize n = in_->rdbuf()->sgetn(&buf_[0], buf_.size());
+            pos_ = 0;
+            end_ = n > 0 ? static_cast<size_t>(n) : 0;
+            return end_ > 0;
+        }
+
+        void Advance(char c) {
+            if (c == '\n') {
+                line_++;
+                col_ = 0;
+            } else if (c == '\r') {
+                col_ = 0;
+            } else {
+                col_++;
+            }
+        }
 };
 
 struct Token {
@@ -171,7 +214,8 @@ struct Token {
     typedef boost::multiprecision::mpz_int bignum;
 
     bignum int_literal;
-    std::string s;
+    // Identifier or string contents, interned so that tokens copy cheaply.
+    Symbol s;
 
     int line, col;
 
@@ -188,7 +232,7 @@ struct Token {
     void Reset(Type type_) {
         type = type_;
         int_literal = 0;
-        s = "";
+        s = Symbol();
     }
 
     // ToString() returns a human-readable representation of the token data
@@ -345,7 +389,7 @@ struct Token {
 
 class Lexer {
     public:
-        virtual Token Peek() const = 0;
+        virtual const Token& Peek() const = 0;
         virtual bool Have() const = 0;
         virtual bool ReadNext() = 0;
         virtual void SetIgnoreNewline(bool ignore_newline) = 0;
@@ -366,7 +410,7 @@ class LexerImpl : public Lexer {
             }
         }
 
-        virtual Token Peek() const {
+        virtual const Token& Peek() const {
             assert(have_peek_);
             return token_;
         }
@@ -535,9 +579,8 @@ class LexerImpl : public Lexer {
                         state = S_INIT;
                         break;
                     case S_IDENT:
-                        if (!eof && (isalnum(c) || c == '_' || c == '!')) {
-                            cur_token += c;
-                            stream_.ReadNext();
+                        if (!eof && IsIdentChar(c)) {
+                            stream_.ReadWhile(IsIdentChar, &cur_token);
                             continue;
                         }
                         Emit(line, col, Token::IDENT, cur_token);
@@ -577,11 +620,13 @@ class LexerImpl : public Lexer {
                             state = S_INIT;
                             continue;
                         }
-                        stream_.ReadNext();
+                        // The newline ending the comment is left to be
+                        // lexed as usual.
                         if (c == '\n') {
                             state = S_INIT;
                             continue;
                         }
+                        stream_.ReadNext();
                         break;
                 }
             }
@@ -619,7 +664,7 @@ class LexerImpl : public Lexer {
             Emit(line, col, type);
             token_.int_literal = literal;
         }
-        void Emit(int line, int col, Token::Type type, std::string s) {
+        void Emit(int line, int col, Token::Type type, const std::string& s) {
             Emit(line, col, type);
             token_.s = s;
         }
@@ -646,6 +691,10 @@ class LexerImpl : public Lexer {
             return false;
         }
 
+        static bool IsIdentChar(char c) {
+            return isalnum(c) || c == '_' || c == '!';
+        }
+
         bool StartsWith(std::string s, std::string prefix) {
             return s.size() >= prefix.size() &&
                    s.substr(0, prefix.size()) == prefix;
@@ -702,7 +751,7 @@ class ParserBase {
             return loc;
         }
 
-        Token CurToken() const {
+        const Token& CurToken() const {
             if (lexer_->Have()) {
                 return lexer_->Peek();
             } else {
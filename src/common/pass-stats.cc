@@ -0,0 +1,165 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/pass-stats.h"
+#include "common/exception.h"
+#include "common/util.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sys/resource.h>
+
+using namespace autopiper;
+using namespace std;
+
+PassStats::Scope::Scope(PassStats* stats, const char* name)
+    : stats_(stats), name_(name), start_rss_kb_(0) {
+    if (stats_) {
+        start_rss_kb_ = PeakRSSKB();
+        start_ = chrono::steady_clock::now();
+    }
+}
+
+PassStats::Scope::~Scope() {
+    if (!stats_) return;
+    stats_->Record(*this, chrono::steady_clock::now(),
+                   PeakRSSKB() - start_rss_kb_);
+}
+
+long PassStats::PeakRSSKB() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    // Linux reports ru_maxrss in KiB.
+    return usage.ru_maxrss;
+}
+
+void PassStats::Record(const Scope& scope, chrono::steady_clock::time_point end,
+                       long rss_delta_kb) {
+    double wall_ms =
+        chrono::duration<double, milli>(end - scope.start_).count();
+    lock_guard<mutex> l(mutex_);
+    if (!has_span_ || scope.start_ < span_start_) span_start_ = scope.start_;
+    if (!has_span_ || end > span_end_) span_end_ = end;
+    has_span_ = true;
+    Entry* entry = nullptr;
+    for (auto& e : entries_) {
+        if (e.name == scope.name_) {
+            entry = &e;
+            break;
+        }
+    }
+    if (!entry) {
+        entries_.push_back({ scope.name_, 0, 0.0, 0, {} });
+        entry = &entries_.back();
+    }
+    entry->runs++;
+    entry->wall_ms += wall_ms;
+    entry->peak_rss_delta_kb += rss_delta_kb;
+
+    auto merge = [entry](const char* key, long value, bool summed) {
+        for (auto& c : entry->counters) {
+            if (c.key == key) {
+                if (summed) {
+                    c.value += value;
+                } else if (value > c.value) {
+                    c.value = value;
+                }
+                return;
+            }
+        }
+        entry->counters.push_back({ key, value, summed });
+    };
+    for (auto& s : scope.sizes_) merge(s.first, s.second, false);
+    for (auto& c : scope.counts_) merge(c.first, c.second, true);
+}
+
+double PassStats::TotalWallMS() const {
+    if (!has_span_) return 0.0;
+    return chrono::duration<double, milli>(span_end_ - span_start_).count();
+}
+
+void PassStats::PrintTable(ostream& os) const {
+    // Percentages are of the total wall time, so those of nested or
+    // concurrent passes may add up to more than 100.
+    double total_ms = TotalWallMS();
+    ios::fmtflags flags = os.flags();
+    streamsize precision = os.precision();
+
+    os << "Pass statistics:" << endl;
+    os << left << setw(28) << "  Pass" << right
+       << setw(6) << "Runs"
+       << setw(12) << "Wall (ms)"
+       << setw(8) << "%"
+       << setw(14) << "Peak RSS +KB"
+       << "  IR size / counters" << endl;
+    for (auto& e : entries_) {
+        os << "  " << left << setw(26) << e.name << right
+           << setw(6) << e.runs
+           << setw(12) << fixed << setprecision(3) << e.wall_ms
+           << setw(8) << setprecision(1)
+           << (total_ms > 0 ? 100.0 * e.wall_ms / total_ms : 0.0)
+           << setw(14) << e.peak_rss_delta_kb;
+        if (!e.counters.empty()) os << " ";
+        for (auto& c : e.counters) {
+            os << " " << c.key << "=" << c.value;
+        }
+        os << endl;
+    }
+    os << "  " << left << setw(26) << "Total (wall)" << right
+       << setw(6) << ""
+       << setw(12) << fixed << setprecision(3) << total_ms
+       << setw(8) << ""
+       << setw(14) << "" << "  peak_rss_kb=" << PeakRSSKB() << endl;
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void PassStats::PrintJSON(ostream& os) const {
+    os << "{\n  \"passes\": [";
+    bool first = true;
+    for (auto& e : entries_) {
+        os << (first ? "\n" : ",\n");
+        first = false;
+        os << strprintf("    {\"name\": \"%s\", \"runs\": %d, "
+                        "\"wall_ms\": %.3f, \"peak_rss_delta_kb\": %ld",
+                        e.name.c_str(), e.runs, e.wall_ms,
+                        e.peak_rss_delta_kb);
+        os << ", \"ir\": {";
+        for (unsigned i = 0; i < e.counters.size(); i++) {
+            os << strprintf("%s\"%s\": %ld", i ? ", " : "",
+                            e.counters[i].key.c_str(), e.counters[i].value);
+        }
+        os << "}}";
+    }
+    os << "\n  ],\n";
+    os << strprintf("  \"total_wall_ms\": %.3f,\n", TotalWallMS());
+    os << strprintf("  \"peak_rss_kb\": %ld\n}\n", PeakRSSKB());
+}
+
+void PassStats::Report(ostream* table, const string& json_filename) const {
+    if (table) {
+        PrintTable(*table);
+    }
+    if (!json_filename.empty()) {
+        ofstream out(json_filename);
+        if (!out.good()) {
+            throw autopiper::Exception(
+                    "Could not open pass statistics file '" + json_filename +
+                    "'.");
+        }
+        PrintJSON(out);
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_PASS_STATS_H_
+#define _AUTOPIPER_COMMON_PASS_STATS_H_
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace autopiper {
+
+// Collects per-pass compile statistics: wall time, growth in the process's
+// peak RSS, and IR size counters reported by the pass. A pass is measured by
+// holding a PassStats::Scope for its duration. Scopes given a null PassStats
+// do nothing, so instrumented code costs only a pointer test when statistics
+// are not requested.
+//
+// Passes with the same name are merged into one entry (e.g. a per-pipe pass
+// run once per pipe). Scopes may be used from several threads at once; the
+// RSS delta is process-wide, so it is only meaningful for passes that run
+// alone. Scopes may also nest, so entries' wall times may overlap; the total
+// is the wall time from the first scope's start to the last one's end.
+class PassStats {
+    public:
+        PassStats() : has_span_(false) {}
+
+        class Scope {
+            public:
+                Scope(PassStats* stats, const char* name);
+                ~Scope();
+
+                bool enabled() const { return stats_ != nullptr; }
+
+                // Records an IR size as of the end of this pass. Across merged
+                // runs, the largest value is kept.
+                void SetSize(const char* key, long value) {
+                    if (stats_) sizes_.push_back({ key, value });
+                }
+                // Records a work counter for this pass. Across merged runs,
+                // values are summed.
+                void AddCount(const char* key, long value) {
+                    if (stats_) counts_.push_back({ key, value });
+                }
+
+            private:
+                friend class PassStats;
+
+                PassStats* stats_;
+                const char* name_;
+                std::chrono::steady_clock::time_point start_;
+                long start_rss_kb_;
+                std::vector<std::pair<const char*, long>> sizes_;
+                std::vector<std::pair<const char*, long>> counts_;
+        };
+
+        // Prints a human-readable table of all passes, in first-run order.
+        void PrintTable(std::ostream& os) const;
+        // Prints all passes as a JSON object.
+        void PrintJSON(std::ostream& os) const;
+        // Prints the table to |table| if non-null, and writes the JSON form
+        // to |json_filename| if non-empty.
+        void Report(std::ostream* table,
+                    const std::string& json_filename) const;
+
+        // Peak resident set size of this process so far, in KiB.
+        static long PeakRSSKB();
+
+    private:
+        struct Counter {
+            std::string key;
+            long value;
+            bool summed;
+        };
+        struct Entry {
+            std::string name;
+            int runs;
+            double wall_ms;
+            long peak_rss_delta_kb;
+            std::vector<Counter> counters;
+        };
+
+        void Record(const Scope& scope,
+                    std::chrono::steady_clock::time_point end,
+                    long rss_delta_kb);
+        // Wall time from the first scope's start to the last scope's end.
+        double TotalWallMS() const;
+
+        std::mutex mutex_;
+        std::vector<Entry> entries_;
+        bool has_span_;
+        std::chrono::steady_clock::time_point span_start_;
+        std::chrono::steady_clock::time_point span_end_;
+};
+
+}  // namespace autopiper
+
+#endif
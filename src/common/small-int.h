@@ -0,0 +1,261 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_SMALL_INT_H_
+#define _AUTOPIPER_COMMON_SMALL_INT_H_
+
+#include <stdint.h>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <boost/multiprecision/gmp.hpp>
+
+namespace autopiper {
+
+// An arbitrary-precision integer that holds values fitting in an int64_t
+// inline and only allocates a GMP integer for the rest. Nearly every constant
+// in a design is a few bits wide, so this makes copying, comparing and folding
+// them plain machine arithmetic; a result that overflows 64 bits is
+// recomputed at full precision and so is exact either way. The interface is
+// the subset of boost::multiprecision::mpz_int that the compiler uses.
+class SmallInt {
+ public:
+  typedef boost::multiprecision::mpz_int Big;
+
+  SmallInt() : small_(0) {}
+  SmallInt(int v) : small_(v) {}
+  SmallInt(long v) : small_(v) {}
+  SmallInt(long long v) : small_(v) {}
+  SmallInt(unsigned v) : small_(v) {}
+  SmallInt(unsigned long v) { SetUnsigned(v); }
+  SmallInt(unsigned long long v) { SetUnsigned(v); }
+  SmallInt(const Big& v) : small_(0) { Set(v); }
+
+  SmallInt(const SmallInt& other)
+      : small_(other.small_),
+        big_(other.big_ ? new Big(*other.big_) : nullptr) {}
+  SmallInt(SmallInt&& other)
+      : small_(other.small_), big_(std::move(other.big_)) {}
+
+  SmallInt& operator=(const SmallInt& other) {
+      if (this == &other) return *this;
+      small_ = other.small_;
+      big_.reset(other.big_ ? new Big(*other.big_) : nullptr);
+      return *this;
+  }
+  SmallInt& operator=(SmallInt&& other) {
+      small_ = other.small_;
+      big_ = std::move(other.big_);
+      return *this;
+  }
+
+  bool is_small() const { return !big_; }
+  Big big() const {
+      return big_ ? *big_ : Big(static_cast<long long>(small_));
+  }
+
+  template<typename T>
+  T convert_to() const {
+      return big_ ? big_->convert_to<T>() : static_cast<T>(small_);
+  }
+  explicit operator int() const { return convert_to<int>(); }
+  explicit operator long() const { return convert_to<long>(); }
+  explicit operator long long() const { return convert_to<long long>(); }
+  explicit operator unsigned() const { return convert_to<unsigned>(); }
+  explicit operator unsigned long() const {
+      return convert_to<unsigned long>();
+  }
+  explicit operator unsigned long long() const {
+      return convert_to<unsigned long long>();
+  }
+  explicit operator std::string() const { return str(); }
+
+  std::string str(std::streamsize digits = 0,
+                  std::ios_base::fmtflags f = std::ios_base::fmtflags(0))
+      const {
+      // Negative values in hex or octal are printed sign-and-magnitude, as
+      // GMP does, not as two's complement.
+      if (big_ || (small_ < 0 && (f & std::ios_base::basefield) != 0 &&
+                   (f & std::ios_base::basefield) != std::ios_base::dec)) {
+          return big().str(digits, f);
+      }
+      std::ostringstream os;
+      os.flags(f);
+      os << small_;
+      return os.str();
+  }
+
+  friend SmallInt operator+(const SmallInt& a, const SmallInt& b) {
+      int64_t r;
+      if (a.is_small() && b.is_small() &&
+          !__builtin_add_overflow(a.small_, b.small_, &r)) {
+          return SmallInt(r);
+      }
+      return SmallInt(Big(a.big() + b.big()));
+  }
+  friend SmallInt operator-(const SmallInt& a, const SmallInt& b) {
+      int64_t r;
+      if (a.is_small() && b.is_small() &&
+          !__builtin_sub_overflow(a.small_, b.small_, &r)) {
+          return SmallInt(r);
+      }
+      return SmallInt(Big(a.big() - b.big()));
+  }
+  friend SmallInt operator*(const SmallInt& a, const SmallInt& b) {
+      int64_t r;
+      if (a.is_small() && b.is_small() &&
+          !__builtin_mul_overflow(a.small_, b.small_, &r)) {
+          return SmallInt(r);
+      }
+      return SmallInt(Big(a.big() * b.big()));
+  }
+  // Division truncates toward zero, as both C++ and GMP's '/' do. Division by
+  // zero and INT64_MIN / -1 take the GMP path, so that they behave exactly as
+  // they did with mpz_int.
+  friend SmallInt operator/(const SmallInt& a, const SmallInt& b) {
+      if (a.is_small() && b.is_small() && DividesSmall(a.small_, b.small_)) {
+          return SmallInt(a.small_ / b.small_);
+      }
+      return SmallInt(Big(a.big() / b.big()));
+  }
+  friend SmallInt operator%(const SmallInt& a, const SmallInt& b) {
+      if (a.is_small() && b.is_small() && DividesSmall(a.small_, b.small_)) {
+          return SmallInt(a.small_ % b.small_);
+      }
+      return SmallInt(Big(a.big() % b.big()));
+  }
+
+  // Bitwise operators act on the infinite two's-complement representation,
+  // which int64_t arithmetic matches for values that fit.
+  friend SmallInt operator&(const SmallInt& a, const SmallInt& b) {
+      if (a.is_small() && b.is_small()) return SmallInt(a.small_ & b.small_);
+      return SmallInt(Big(a.big() & b.big()));
+  }
+  friend SmallInt operator|(const SmallInt& a, const SmallInt& b) {
+      if (a.is_small() && b.is_small()) return SmallInt(a.small_ | b.small_);
+      return SmallInt(Big(a.big() | b.big()));
+  }
+  friend SmallInt operator^(const SmallInt& a, const SmallInt& b) {
+      if (a.is_small() && b.is_small()) return SmallInt(a.small_ ^ b.small_);
+      return SmallInt(Big(a.big() ^ b.big()));
+  }
+  friend SmallInt operator<<(const SmallInt& a, unsigned n) {
+      if (a.is_small() && a.small_ >= 0 && n < 63 &&
+          a.small_ < (INT64_C(1) << (63 - n))) {
+          return SmallInt(a.small_ << n);
+      }
+      return SmallInt(Big(a.big() << n));
+  }
+  // An arithmetic shift, rounding toward negative infinity, as GMP's is.
+  friend SmallInt operator>>(const SmallInt& a, unsigned n) {
+      if (a.is_small()) {
+          return SmallInt(n >= 63 ? (a.small_ < 0 ? -1 : 0) : a.small_ >> n);
+      }
+      return SmallInt(Big(a.big() >> n));
+  }
+
+  SmallInt operator-() const {
+      if (is_small() && small_ != std::numeric_limits<int64_t>::min()) {
+          return SmallInt(-small_);
+      }
+      return SmallInt(Big(-big()));
+  }
+  SmallInt operator~() const {
+      if (is_small()) return SmallInt(~small_);
+      return SmallInt(Big(~big()));
+  }
+
+  SmallInt& operator+=(const SmallInt& b) { return *this = *this + b; }
+  SmallInt& operator-=(const SmallInt& b) { return *this = *this - b; }
+  SmallInt& operator*=(const SmallInt& b) { return *this = *this * b; }
+  SmallInt& operator/=(const SmallInt& b) { return *this = *this / b; }
+  SmallInt& operator%=(const SmallInt& b) { return *this = *this % b; }
+  SmallInt& operator&=(const SmallInt& b) { return *this = *this & b; }
+  SmallInt& operator|=(const SmallInt& b) { return *this = *this | b; }
+  SmallInt& operator^=(const SmallInt& b) { return *this = *this ^ b; }
+  SmallInt& operator<<=(unsigned n) { return *this = *this << n; }
+  SmallInt& operator>>=(unsigned n) { return *this = *this >> n; }
+
+  friend bool operator==(const SmallInt& a, const SmallInt& b) {
+      return Compare(a, b) == 0;
+  }
+  friend bool operator!=(const SmallInt& a, const SmallInt& b) {
+      return Compare(a, b) != 0;
+  }
+  friend bool operator<(const SmallInt& a, const SmallInt& b) {
+      return Compare(a, b) < 0;
+  }
+  friend bool operator<=(const SmallInt& a, const SmallInt& b) {
+      return Compare(a, b) <= 0;
+  }
+  friend bool operator>(const SmallInt& a, const SmallInt& b) {
+      return Compare(a, b) > 0;
+  }
+  friend bool operator>=(const SmallInt& a, const SmallInt& b) {
+      return Compare(a, b) >= 0;
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const SmallInt& v) {
+      std::ios_base::fmtflags base = os.flags() & std::ios_base::basefield;
+      if (v.big_ || (v.small_ < 0 && base != 0 &&
+                     base != std::ios_base::dec)) {
+          return os << v.big();
+      }
+      return os << v.small_;
+  }
+
+ private:
+  // The value, when big_ is null. Values that fit in int64_t are always
+  // stored here, so that is_small() is a canonical test.
+  int64_t small_;
+  std::unique_ptr<Big> big_;
+
+  void Set(const Big& v) {
+      if (v >= std::numeric_limits<int64_t>::min() &&
+          v <= std::numeric_limits<int64_t>::max()) {
+          small_ = v.convert_to<int64_t>();
+          big_.reset();
+      } else {
+          big_.reset(new Big(v));
+      }
+  }
+  void SetUnsigned(unsigned long long v) {
+      small_ = 0;
+      if (v <= static_cast<unsigned long long>(
+                  std::numeric_limits<int64_t>::max())) {
+          small_ = static_cast<int64_t>(v);
+      } else {
+          big_.reset(new Big(v));
+      }
+  }
+
+  static bool DividesSmall(int64_t a, int64_t b) {
+      return b != 0 && !(a == std::numeric_limits<int64_t>::min() && b == -1);
+  }
+
+  static int Compare(const SmallInt& a, const SmallInt& b) {
+      if (a.is_small() && b.is_small()) {
+          return a.small_ < b.small_ ? -1 : a.small_ > b.small_ ? 1 : 0;
+      }
+      return a.big().compare(b.big());
+  }
+};
+
+}  // namespace autopiper
+
+#endif  // _AUTOPIPER_COMMON_SMALL_INT_H_
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_SMALL_VECTOR_H_
+#define _AUTOPIPER_COMMON_SMALL_VECTOR_H_
+
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+
+namespace autopiper {
+
+// A vector that stores up to N elements inline and only moves to the heap
+// when it grows past that. Intended for the many tiny, short-lived sequences
+// built during lowering (e.g. predicate terms), where a heap allocation per
+// container dominates the cost of the actual work. V must be
+// default-constructible and copyable.
+template<typename V, int N>
+class SmallVector {
+ public:
+  typedef V value_type;
+  typedef V* iterator;
+  typedef const V* const_iterator;
+
+  SmallVector() : size_(0) {}
+  SmallVector(const SmallVector& other) : size_(0) { *this = other; }
+
+  SmallVector& operator=(const SmallVector& other) {
+      if (this == &other) return *this;
+      if (other.size_ > N) {
+          heap_.assign(other.begin(), other.end());
+      } else {
+          heap_.clear();
+          std::copy(other.begin(), other.end(), inline_);
+      }
+      size_ = other.size_;
+      return *this;
+  }
+
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  V* data() { return size_ > N ? heap_.data() : inline_; }
+  const V* data() const { return size_ > N ? heap_.data() : inline_; }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+
+  V& operator[](int i) { return data()[i]; }
+  const V& operator[](int i) const { return data()[i]; }
+
+  void clear() {
+      heap_.clear();
+      size_ = 0;
+  }
+
+  void push_back(const V& v) {
+      insert(end(), v);
+  }
+
+  // Inserts |v| before |pos|, returning an iterator to the new element.
+  iterator insert(iterator pos, const V& v) {
+      int idx = pos - begin();
+      assert(idx >= 0 && idx <= size_);
+      if (size_ < N) {
+          std::copy_backward(inline_ + idx, inline_ + size_,
+                             inline_ + size_ + 1);
+          inline_[idx] = v;
+      } else {
+          if (size_ == N) {
+              heap_.assign(inline_, inline_ + N);
+          }
+          heap_.insert(heap_.begin() + idx, v);
+      }
+      size_++;
+      return begin() + idx;
+  }
+
+  // Removes the element at |pos|.
+  void erase(iterator pos) {
+      int idx = pos - begin();
+      assert(idx >= 0 && idx < size_);
+      if (size_ > N) {
+          heap_.erase(heap_.begin() + idx);
+          if (size_ - 1 == N) {
+              std::copy(heap_.begin(), heap_.end(), inline_);
+              heap_.clear();
+          }
+      } else {
+          std::copy(inline_ + idx + 1, inline_ + size_, inline_ + idx);
+      }
+      size_--;
+  }
+
+  bool operator==(const SmallVector& other) const {
+      return size_ == other.size_ &&
+             std::equal(begin(), end(), other.begin());
+  }
+  bool operator!=(const SmallVector& other) const {
+      return !(*this == other);
+  }
+  bool operator<(const SmallVector& other) const {
+      return std::lexicographical_compare(begin(), end(),
+                                          other.begin(), other.end());
+  }
+
+ private:
+  V inline_[N];
+  std::vector<V> heap_;  // holds all elements once size_ > N
+  int size_;
+};
+
+}  // namespace autopiper
+
+#endif
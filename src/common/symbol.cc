@@ -0,0 +1,61 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/symbol.h"
+
+#include <mutex>
+#include <unordered_map>
+
+using namespace autopiper;
+using namespace std;
+
+namespace {
+
+// Entries are never removed, and unordered_map nodes do not move, so entry
+// pointers stay valid for the life of the process.
+struct SymbolTable {
+    mutex lock;
+    unordered_map<string, int> entries;
+};
+
+SymbolTable& Table() {
+    static SymbolTable* table = new SymbolTable();
+    return *table;
+}
+
+}  // anonymous namespace
+
+const Symbol::Entry* Symbol::Intern(const string& s) {
+    SymbolTable& table = Table();
+    lock_guard<mutex> l(table.lock);
+    auto it = table.entries.find(s);
+    if (it == table.entries.end()) {
+        int id = static_cast<int>(table.entries.size());
+        it = table.entries.insert(make_pair(s, id)).first;
+    }
+    return &*it;
+}
+
+const Symbol::Entry* Symbol::Empty() {
+    static const Entry* empty = Intern(string());
+    return empty;
+}
+
+int Symbol::Count() {
+    SymbolTable& table = Table();
+    lock_guard<mutex> l(table.lock);
+    return static_cast<int>(table.entries.size());
+}
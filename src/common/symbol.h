@@ -0,0 +1,117 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_COMMON_SYMBOL_H_
+#define _AUTOPIPER_COMMON_SYMBOL_H_
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+
+namespace autopiper {
+
+// An interned string. Every distinct string is stored once in a global table,
+// and a Symbol is a pointer to its entry, so Symbols are copied, compared for
+// equality and hashed in constant time. Symbols order by their strings, so
+// ordered containers keyed by Symbol iterate as they would with string keys.
+//
+// Symbols convert implicitly to const std::string&, and provide the read-only
+// std::string accessors that token and identifier code uses.
+class Symbol {
+    public:
+        Symbol() : entry_(Empty()) {}
+        Symbol(const std::string& s) : entry_(Intern(s)) {}
+        Symbol(const char* s) : entry_(Intern(s)) {}
+
+        const std::string& str() const { return entry_->first; }
+        operator const std::string&() const { return str(); }
+        // A dense ID, unique to this string.
+        int id() const { return entry_->second; }
+
+        const char* c_str() const { return str().c_str(); }
+        size_t size() const { return str().size(); }
+        bool empty() const { return str().empty(); }
+        char operator[](size_t i) const { return str()[i]; }
+        std::string substr(size_t pos,
+                           size_t n = std::string::npos) const {
+            return str().substr(pos, n);
+        }
+
+        bool operator==(const Symbol& other) const {
+            return entry_ == other.entry_;
+        }
+        bool operator!=(const Symbol& other) const {
+            return entry_ != other.entry_;
+        }
+        bool operator==(const std::string& s) const { return str() == s; }
+        bool operator!=(const std::string& s) const { return str() != s; }
+        bool operator==(const char* s) const { return str() == s; }
+        bool operator!=(const char* s) const { return str() != s; }
+        bool operator<(const Symbol& other) const {
+            return entry_ != other.entry_ && str() < other.str();
+        }
+
+        // Number of distinct strings interned so far.
+        static int Count();
+
+    private:
+        typedef std::pair<const std::string, int> Entry;
+
+        const Entry* entry_;
+
+        static const Entry* Intern(const std::string& s);
+        static const Entry* Empty();
+};
+
+inline bool operator==(const std::string& s, const Symbol& sym) {
+    return sym == s;
+}
+inline bool operator!=(const std::string& s, const Symbol& sym) {
+    return sym != s;
+}
+
+inline std::string operator+(const Symbol& a, const Symbol& b) {
+    return a.str() + b.str();
+}
+inline std::string operator+(const Symbol& a, const std::string& b) {
+    return a.str() + b;
+}
+inline std::string operator+(const std::string& a, const Symbol& b) {
+    return a + b.str();
+}
+inline std::string operator+(const Symbol& a, const char* b) {
+    return a.str() + b;
+}
+inline std::string operator+(const char* a, const Symbol& b) {
+    return a + b.str();
+}
+
+inline std::ostream& operator<<(std::ostream& os, const Symbol& sym) {
+    return os << sym.str();
+}
+
+}  // namespace autopiper
+
+namespace std {
+template<> struct hash<autopiper::Symbol> {
+    size_t operator()(const autopiper::Symbol& sym) const {
+        return std::hash<int>()(sym.id());
+    }
+};
+}  // namespace std
+
+#endif  // _AUTOPIPER_COMMON_SYMBOL_H_
@@ -66,4 +66,35 @@ inline T* InsertOwnedBefore(
     return new_value;
 }
 
+// Non-owning variants of the above, for vectors of pointers to objects owned
+// elsewhere (e.g. by an arena).
+template<typename T>
+inline T* PrependToVector(
+        std::vector<T*>& v,
+        T* new_value) {
+    v.insert(v.begin(), new_value);
+    return new_value;
+}
+
+template<typename T>
+inline T* AppendToVector(
+        std::vector<T*>& v,
+        T* new_value) {
+    v.push_back(new_value);
+    return new_value;
+}
+
+template<typename T>
+inline T* InsertBefore(
+        std::vector<T*>& v,
+        T* before_this,
+        T* new_value) {
+    auto it = v.begin();
+    while (it != v.end() && *it != before_this) ++it;
+    // As above, prepend if |before_this| is not present.
+    if (it == v.end()) it = v.begin();
+    v.insert(it, new_value);
+    return new_value;
+}
+
 #endif
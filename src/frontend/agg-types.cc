@@ -38,8 +38,6 @@ bool AggTypeResolver::Compute(ErrorCollector* coll) {
     map<ASTTypeDef*, InferredType> typedef_types;
     map<ASTTypeField*, InferredType> field_types;
 
-    BuildMap();
-
     // Initially set all field types according to the type map.
     for (auto& type_pair : map_) {
         ASTTypeDef* type = type_pair.second;
@@ -143,6 +141,27 @@ bool AggTypeResolver::Compute(ErrorCollector* coll) {
     return !have_errors;
 }
 
+const AggFieldLayout* AggTypeResolver::FieldLayout(const ASTTypeDef* type,
+                                                   const Symbol& name) {
+    auto it = layouts_.find(type);
+    if (it == layouts_.end()) {
+        FieldLayoutMap& layout = layouts_[type];
+        for (auto& field : type->fields) {
+            AggFieldLayout f;
+            f.field = field.get();
+            f.offset = field->offset;
+            f.width = field->width;
+            f.type = ResolveType(field->type.get());
+            // As a lookup by scanning the fields would, the first of two
+            // fields with one name wins.
+            layout.insert(make_pair(field->ident->name, f));
+        }
+        it = layouts_.find(type);
+    }
+    auto field_it = it->second.find(name);
+    return field_it == it->second.end() ? nullptr : &field_it->second;
+}
+
 InferredType AggTypeResolver::ResolveType(const ASTType* type) {
     InferredType ret;
     if (type) {
@@ -22,17 +22,27 @@
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 
 namespace autopiper {
 namespace frontend {
 
+// The layout of one field of an aggregate type: its bit offset and width
+// within the aggregate, and its resolved type.
+struct AggFieldLayout {
+    const ASTTypeField* field;
+    int offset;
+    int width;
+    InferredType type;
+};
+
 // This resolves aggregate types down to their widths and the bit-offsets of
 // each contained field. It is not actually a visit/modify pass; it iterates
 // over typedefs manually (it does not need to see the main body of the
 // program).
 class AggTypeResolver {
     public:
-        AggTypeResolver(AST* ast) : ast_(ast) {}
+        AggTypeResolver(AST* ast) : ast_(ast) { BuildMap(); }
         ~AggTypeResolver() {}
 
         // Resolve all types' widths. Returns |true| if successful.
@@ -41,6 +51,13 @@ class AggTypeResolver {
         // Resolve a type to an inferred type value (width / agg type).
         InferredType ResolveType(const ASTType* type);
 
+        // Returns the layout of the field named |name| in |type|, or null if
+        // it has no such field. Valid once the types' widths are resolved
+        // (by Compute() on this or an earlier resolver of the same AST). Each
+        // type's layout is built on its first lookup and cached.
+        const AggFieldLayout* FieldLayout(const ASTTypeDef* type,
+                                          const Symbol& name);
+
     private:
         AST* ast_;
 
@@ -48,6 +65,9 @@ class AggTypeResolver {
 
         TypeDefMap map_;
 
+        typedef std::unordered_map<Symbol, AggFieldLayout> FieldLayoutMap;
+        std::map<const ASTTypeDef*, FieldLayoutMap> layouts_;
+
         // Create a map of typedefs by name given an AST.
         void BuildMap();
 };
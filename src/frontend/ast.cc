@@ -25,6 +25,48 @@ using namespace std;
 namespace autopiper {
 namespace frontend {
 
+namespace {
+thread_local ASTArena* current_arena = nullptr;
+
+// Precedes each node: the arena it was carved from, or null for the heap.
+// Padded so that the node keeps the arena's alignment.
+union NodeHeader {
+    ASTArena* arena;
+    char pad[ASTArena::kAlign];
+};
+}  // anonymous namespace
+
+ASTArenaScope::ASTArenaScope(ASTArena* arena) : saved_(current_arena) {
+    current_arena = arena;
+}
+
+ASTArenaScope::~ASTArenaScope() {
+    current_arena = saved_;
+}
+
+ASTArena* ASTArenaScope::Current() {
+    return current_arena;
+}
+
+void* ASTBase::operator new(size_t size) {
+    size += sizeof(NodeHeader);
+    NodeHeader* header = static_cast<NodeHeader*>(
+            current_arena ? current_arena->Allocate(size)
+                          : ::operator new(size));
+    header->arena = current_arena;
+    return header + 1;
+}
+
+void ASTBase::operator delete(void* p, size_t size) {
+    if (!p) return;
+    NodeHeader* header = static_cast<NodeHeader*>(p) - 1;
+    if (header->arena) {
+        header->arena->Free(header, size + sizeof(NodeHeader));
+    } else {
+        ::operator delete(header);
+    }
+}
+
 static string Indent(int indent) {
     string ret;
     for (int i = 0; i < indent; i++) {
@@ -64,6 +106,9 @@ AST_PRINTER(ASTFunctionDef) {
     if (node->is_entry) {
         out << I(1) << "(entry)" << endl;
     }
+    if (node->lanes != 1) {
+        out << I(1) << "(lanes " << node->lanes << ")" << endl;
+    }
 
     out << I(1) << "(return_type ";
     P(node->return_type.get(), 2);
@@ -99,6 +144,7 @@ AST_PRINTER(ASTIdent) {
         case ASTIdent::TYPE: out << "TYPE"; break;
         case ASTIdent::FIELD: out << "FIELD"; break;
         case ASTIdent::PORT: out << "PORT"; break;
+        case ASTIdent::INTERNAL_PORT: out << "INTERNAL_PORT"; break;
     }
     out << ")";
 }
@@ -218,6 +264,9 @@ AST_PRINTER(ASTStmtIf) {
 
 AST_PRINTER(ASTStmtWhile) {
     out << I(0) << "(stmt-while " << node << endl;
+    if (node->pipelined) {
+        out << I(1) << "(pipelined)" << endl;
+    }
     if (node->label) {
         out << I(1) << "(label ";
         P(node->label.get(), 2);
@@ -397,6 +446,7 @@ AST_PRINTER(ASTExpr) {
         T(BYPASSPRESENT);
         T(BYPASSREADY);
         T(BYPASSREAD);
+        T(LANE);
 
         T(STMTBLOCK);
 
@@ -483,6 +533,7 @@ AST_CLONE(AST) {
     SETUP(AST);
     VEC(functions);
     VEC(types);
+    VEC(pragmas);
     PRIM(gencounter);
     return ret;
 }
@@ -493,6 +544,8 @@ AST_CLONE(ASTFunctionDef) {
     SUB(return_type);
     VEC(params);
     SUB(block);
+    PRIM(is_entry);
+    PRIM(lanes);
     return ret;
 }
 
@@ -591,6 +644,7 @@ AST_CLONE(ASTStmtWhile) {
     SUB(condition);
     SUB(body);
     SUB(label);
+    PRIM(pipelined);
     return ret;
 }
 
@@ -698,6 +752,7 @@ AST_CLONE(ASTExpr) {
     SUB(ident);
     PRIM(constant);
     PRIM(has_constant);
+    PRIM(read_latency);
     PRIM(def);
     PRIM(inferred_type);
     SUB(stmt);
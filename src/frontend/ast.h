@@ -22,6 +22,7 @@
 #include <memory>
 #include <string>
 
+#include "common/arena.h"
 #include "common/parser-utils.h"
 #include "frontend/type.h"
 
@@ -45,10 +46,35 @@ ASTRef<T> astnull() { return std::unique_ptr<T>(nullptr); }
 
 typedef Token::bignum ASTBignum;
 
+// Memory for the AST of one compilation. While an ASTArenaScope is open on
+// it, every AST node that its thread creates is carved from the arena rather
+// than the heap, so the whole tree goes back to the system at once when the
+// arena is destroyed; it must outlive the nodes.
+typedef PoolArena ASTArena;
+
+class ASTArenaScope {
+ public:
+  explicit ASTArenaScope(ASTArena* arena);
+  ~ASTArenaScope();
+
+  // The arena new nodes on this thread come from, or null for the heap.
+  static ASTArena* Current();
+
+ private:
+  ASTArena* saved_;
+};
+
 struct ASTBase {
     autopiper::Location loc;
 
     ASTBase() { loc.line = 0; loc.column = 0; loc.filename = "(internal)"; }
+
+    // Nodes live in the current ASTArena, if any. Each block records where
+    // it came from, so a node may be freed from within any scope (or none).
+    // AST nodes are always deleted as their own type, which the sized delete
+    // relies on.
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
 };
 
 struct AST;
@@ -110,8 +136,10 @@ struct ASTFunctionDef : public ASTBase {
     ASTVector<ASTParam> params;
     ASTRef<ASTStmtBlock> block;
     bool is_entry;
+    // Number of lanes (copies of its pipes) an entry issues into per cycle.
+    ASTBignum lanes;
 
-    ASTFunctionDef() : is_entry(false)  {}
+    ASTFunctionDef() : is_entry(false), lanes(1)  {}
 };
 
 struct ASTParam : public ASTBase {
@@ -139,7 +167,7 @@ struct ASTTypeField : public ASTBase {
 };
 
 struct ASTIdent : public ASTBase {
-    std::string name;
+    Symbol name;
 
     enum Type {
         FUNC,
@@ -147,6 +175,9 @@ struct ASTIdent : public ASTBase {
         TYPE,
         FIELD,
         PORT,
+        // A named port that is not exported from the generated module (e.g.,
+        // the interface of a shared function unit).
+        INTERNAL_PORT,
     };
     Type type;
 };
@@ -229,6 +260,11 @@ struct ASTStmtWhile : public ASTBase {
     ASTRef<ASTExpr> condition;
     ASTRef<ASTStmt> body;
     ASTRef<ASTIdent> label;  // optional; can't be specified by user.
+    // Set by a preceding 'pragma pipeline = "true";': iterations may overlap
+    // with younger transactions rather than holding the loop header's stage.
+    bool pipelined;
+
+    ASTStmtWhile() : pipelined(false) {}
 };
 
 struct ASTStmtBreak : public ASTBase {
@@ -343,6 +379,8 @@ struct ASTExpr : public ASTBase {
         BYPASSREADY,
         BYPASSREAD,
 
+        LANE,  // index of the lane the transaction issued into
+
         STMTBLOCK,  // must end in an ASTStmtExpr
 
         CAST,
@@ -357,6 +395,9 @@ struct ASTExpr : public ASTBase {
     ASTRef<ASTIdent> ident;
     ASTBignum constant;
     bool has_constant;
+    // for ARRAY_INIT nodes: registered-read latency ('array latency N'), and
+    // for PORTDEF nodes: the port's or chan's latency ('port latency N'); or 0.
+    ASTBignum read_latency;
 
     ASTStmtLet* def; // for VAR nodes; connected during VarScopePass
 
@@ -366,7 +407,7 @@ struct ASTExpr : public ASTBase {
 
     ASTRef<ASTType> cast_type;
 
-    ASTExpr() : op(CONST), has_constant(false), def(nullptr)  {}
+    ASTExpr() : op(CONST), has_constant(false), read_latency(0), def(nullptr)  {}
     ASTExpr(ASTBignum constant_)
         : ASTExpr()
     { constant = constant_; }
@@ -17,10 +17,18 @@
 #include "frontend/cmdline-driver.h"
 #include "frontend/compiler.h"
 #include "backend/compiler.h"
+#include "backend/ir.h"
+#include "backend/pipe.h"
 #include "common/parse-args.h"
 #include "common/exception.h"
 #include "build-config.h"
 
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <thread>
+
 using namespace std;
 
 namespace autopiper {
@@ -30,6 +38,61 @@ static const char* kUsage =
     "Usage: autopiper [flags] <input>\n"
     "    Flags:\n"
     "        -o <file>:          specify the Verilog output filename (<input>.v by default).\n"
+    "        --cmodel <file>:    also write a cycle-based C++ model to the given file.\n"
+    "        --bitsliced-cmodel <file>: also write a bit-sliced C++ model, which\n"
+    "                            simulates 64 (or, with AVX2, 256) copies of the\n"
+    "                            design at once, to the given file.\n"
+    "        --bundle-piperegs:  emit one wide pipereg per stage boundary and set of\n"
+    "                            controls instead of one per signal.\n"
+    "        --specialize-piperegs: reset only the piperegs of valid and control\n"
+    "                            bits; data piperegs load only when valid.\n"
+    "        --retime-piperegs:  as --specialize-piperegs, with the data piperegs\n"
+    "                            marked for retiming by synthesis.\n"
+    "        --verilator:        write Verilog that lints clean under Verilator.\n"
+    "        --hierarchical:     write each pipe as its own module, under a top\n"
+    "                            module that connects them.\n"
+    "        --timing-model <model>: override the timing model: 'null', 'standard',\n"
+    "                            or 'library:<file>' for a delay table.\n"
+    "        --minimize-registers: move computations within their timing slack to\n"
+    "                            minimize pipeline register bits.\n"
+    "        --balance-stages:   spread computations over the stages to shorten\n"
+    "                            the fullest stage, keeping the stage count.\n"
+    "        --max-stages <N>:   time each pipe with the smallest delay per stage\n"
+    "                            that fits it in N stages, and report that delay.\n"
+    "        --minimize-predicates: minimize valid-signal logic, sharing one signal\n"
+    "                            between equivalent predicates.\n"
+    "        --share-kill-if-slices: evaluate each kill_if condition once per\n"
+    "                            cycle for all downstream stages.\n"
+    "        --propagate-predicates: simplify logic under the facts its valid\n"
+    "                            predicate implies, and remove never-valid logic.\n"
+    "        --register-inputs, --register-outputs: register each exported\n"
+    "                            input (output) port at the module boundary,\n"
+    "                            unless it has a latency.\n"
+    "        --bank-arrays:      split arrays into banks by low index bits where\n"
+    "                            that gives each bank fewer ports.\n"
+    "        --elastic <N>:      stall elastically, with an N-entry skid buffer at the\n"
+    "                            input of each elastic stage.\n"
+    "        --elastic-stages <list>: with --elastic, make only the given stages\n"
+    "                            (e.g. '2,4') elastic rather than all that can be.\n"
+    "        --perf-counters <file>: count each stage's valid, stall, kill, bypass-wait\n"
+    "                            and spawn-stall cycles in a counter bank, and write\n"
+    "                            its layout to the given file as JSON.\n"
+    "        --profile <file>:   have the Verilog and C++ models trace each cycle's\n"
+    "                            stage and transaction events, for\n"
+    "                            tools/txn_profile.py, and write the trace's layout\n"
+    "                            to the given file as JSON.\n"
+    "        --no-fold:          do not fold constants or remove dead code.\n"
+    "        --no-cse:           do not eliminate common subexpressions.\n"
+    "        --no-narrow:        do not narrow arithmetic to its operands' known\n"
+    "                            significant bits.\n"
+    "        --narrow-report <file>: write each value narrowed, and by how much, to\n"
+    "                            the given file.\n"
+    "        --timing-report <file>: write each stage's critical path and slack to the\n"
+    "                            given file.\n"
+    "        --timing-report-paths <N>: list the N worst paths in the timing report (10).\n"
+    "        --throughput-report <file>: write each pipe's depth and each loop's latency\n"
+    "                            and stalls, with the throughput they allow, to the\n"
+    "                            given file.\n"
     "        --expand-macros:    print macro-expanded source and exit.\n"
     "        --print-ast-orig:   print the AST after parsing.\n"
     "        --print-ast:        print the AST before codegen, after transforms.\n"
@@ -38,7 +101,32 @@ static const char* kUsage =
     "        --print-backend-ir: print the IR after backend transforms,\n"
     "                            but before lowering.\n"
     "        --print-lowered:    print the lowered pipeline form before backend codegen.\n"
+    "        --lowered-output <file>: write the lowered pipeline form to the given\n"
+    "                            file (and continue to backend codegen).\n"
+    "        --print-pipe <label>: print only the lowered pipes entered at the given\n"
+    "                            BB (may be given more than once).\n"
+    "        --print-stages <N>[-<M>]: print only the lowered stages N through M.\n"
     "        --ir-output <file>: print the IR to the given file (and continue to backend).\n"
+    "        --ir-binary-output <file>: write the IR to the given file in binary form,\n"
+    "                            loadable by autopiper-backend (and continue).\n"
+    "        -j <N>:             lower up to N independent pipelines concurrently\n"
+    "                            (and with --hierarchical, generate up to N\n"
+    "                            modules concurrently).\n"
+    "        --cache-dir <dir>:  reuse outputs cached in the given directory when the\n"
+    "                            macro-expanded source or the IR, and the options,\n"
+    "                            are unchanged.\n"
+    "        --library <file>:   compile with the macros, functions and types of the\n"
+    "                            given library (in source or precompiled form).\n"
+    "        --precompile-library <file>: parse the input as a library and write it\n"
+    "                            to the given file in precompiled form, loadable\n"
+    "                            with --library without reparsing.\n"
+    "        --server <socket>:  stay resident, serving compile requests on the given\n"
+    "                            Unix socket and keeping parsed libraries between\n"
+    "                            them (libraries named here are parsed up front).\n"
+    "        --connect <socket>: send this compile to the server on the given socket.\n"
+    "        --shutdown-server:  with --connect, ask the server to exit instead.\n"
+    "        --time-passes:      print per-pass time, memory and IR size to stderr.\n"
+    "        --time-passes-json <file>: write per-pass statistics to the given file as JSON.\n"
     "        -h, --help:         print this help message.\n"
     "        -v, --version:      print version and license information.\n";
 
@@ -95,12 +183,161 @@ class FrontendFlags : public CmdlineParser {
             } else if (flag == "--print-lowered") {
                 driver_->options_.print_lowered = true;
                 return FLAG_CONSUMED_KEY;
+            } else if (flag == "--lowered-output") {
+                driver_->options_.lowered_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--print-pipe") {
+                driver_->options_.print_pipes.push_back(value);
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--print-stages") {
+                if (!PipeDumpFilter::ParseStageRange(
+                            value, &driver_->options_.print_first_stage,
+                            &driver_->options_.print_last_stage)) {
+                    throw autopiper::Exception(
+                            "--print-stages requires a stage number or "
+                            "range (e.g. '2-4').");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
             } else if (flag == "--ir-output") {
                 driver_->options_.ir_output = value;
                 return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--ir-binary-output") {
+                driver_->options_.ir_binary_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--cache-dir") {
+                driver_->options_.cache_dir = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--library") {
+                driver_->options_.libraries.push_back(value);
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--precompile-library") {
+                driver_->options_.precompile_library = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--server") {
+                driver_->server_socket_ = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--connect") {
+                driver_->connect_socket_ = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--shutdown-server") {
+                driver_->shutdown_server_ = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--time-passes") {
+                driver_->time_passes_ = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--time-passes-json") {
+                driver_->time_passes_json_ = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "-j") {
+                driver_->options_.jobs = atoi(value.c_str());
+                if (driver_->options_.jobs < 1) {
+                    throw autopiper::Exception("-j requires a positive job count.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
             } else if (flag == "-o") {
                 driver_->options_.output = value;
                 return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--cmodel") {
+                driver_->options_.cmodel_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--bitsliced-cmodel") {
+                driver_->options_.bitsliced_cmodel_output = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--bundle-piperegs") {
+                driver_->options_.bundle_piperegs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--specialize-piperegs") {
+                driver_->options_.specialize_piperegs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--retime-piperegs") {
+                driver_->options_.retime_piperegs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--verilator") {
+                driver_->options_.verilator = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--hierarchical") {
+                driver_->options_.hierarchical = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--timing-model") {
+                driver_->options_.timing_model = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--minimize-registers") {
+                driver_->options_.minimize_registers = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--balance-stages") {
+                driver_->options_.balance_stages = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--max-stages") {
+                driver_->options_.max_stages = atoi(value.c_str());
+                if (driver_->options_.max_stages < 1) {
+                    throw autopiper::Exception(
+                            "--max-stages requires a positive stage count.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--minimize-predicates") {
+                driver_->options_.minimize_predicates = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--share-kill-if-slices") {
+                driver_->options_.share_kill_if_slices = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--propagate-predicates") {
+                driver_->options_.propagate_predicates = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--register-inputs") {
+                driver_->options_.register_inputs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--register-outputs") {
+                driver_->options_.register_outputs = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--bank-arrays") {
+                driver_->options_.bank_arrays = true;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--elastic") {
+                driver_->options_.skid_depth = atoi(value.c_str());
+                if (driver_->options_.skid_depth < 1) {
+                    throw autopiper::Exception(
+                            "--elastic requires a positive skid-buffer depth.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--elastic-stages") {
+                if (!IRProgram::ParseStageList(
+                            value, &driver_->options_.elastic_stages)) {
+                    throw autopiper::Exception(
+                            "--elastic-stages requires a comma-separated list "
+                            "of stage numbers.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--perf-counters") {
+                driver_->options_.perf_counters = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--profile") {
+                driver_->options_.profile = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--no-fold") {
+                driver_->options_.fold_constants = false;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--no-cse") {
+                driver_->options_.cse = false;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--no-narrow") {
+                driver_->options_.narrow_widths = false;
+                return FLAG_CONSUMED_KEY;
+            } else if (flag == "--narrow-report") {
+                driver_->options_.narrow_report = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--timing-report") {
+                driver_->options_.timing_report = value;
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--timing-report-paths") {
+                driver_->options_.timing_report_paths = atoi(value.c_str());
+                if (driver_->options_.timing_report_paths < 0) {
+                    throw autopiper::Exception(
+                            "--timing-report-paths requires a non-negative count.");
+                }
+                return FLAG_CONSUMED_KEY_VALUE;
+            } else if (flag == "--throughput-report") {
+                driver_->options_.throughput_report = value;
+                return FLAG_CONSUMED_KEY_VALUE;
             } else if (flag == "-h" || flag == "--help") {
                 cerr << kUsage;
                 throw autopiper::Exception("No compilation performed.");
@@ -128,17 +365,132 @@ class FrontendFlags : public CmdlineParser {
 };
 
 void FrontendCmdlineDriver::ParseArgs(int argc, const char* const* argv) {
+    args_.assign(argv, argv + argc);
     FrontendFlags parser(this, argc, argv);
     parser.Parse();
+    if (shutdown_server_ && connect_socket_.empty()) {
+        throw autopiper::Exception("--shutdown-server requires --connect.");
+    }
 }
 
-void FrontendCmdlineDriver::Execute() {
+int FrontendCmdlineDriver::Execute() {
+    if (!server_socket_.empty()) {
+        return Serve();
+    } else if (!connect_socket_.empty()) {
+        return Connect();
+    }
+    Compile(&cerr);
+    return 0;
+}
+
+void FrontendCmdlineDriver::Compile(ostream* diagnostics) {
     frontend::Compiler compiler;
-    CmdlineErrorCollector collector(&std::cerr);
-    if (!compiler.CompileFile(options_, &collector)) {
+    CmdlineErrorCollector collector(diagnostics);
+    PassStats stats;
+    if (time_passes_ || !time_passes_json_.empty()) {
+        options_.pass_stats = &stats;
+    }
+    bool ok = compiler.CompileFile(options_, &collector);
+    if (options_.pass_stats) {
+        stats.Report(time_passes_ ? diagnostics : nullptr, time_passes_json_);
+    }
+    if (!ok) {
         throw autopiper::Exception("Compilation failed.");
     }
 }
 
+int FrontendCmdlineDriver::Serve() {
+    // Libraries named on the server's own command line are parsed now, so
+    // that even the first request that uses them finds them cached.
+    CmdlineErrorCollector collector(&cerr);
+    for (auto& filename : options_.libraries) {
+        if (!library_cache_.Get(filename, &collector)) {
+            throw autopiper::Exception("Could not load library.");
+        }
+    }
+    int max_concurrent = std::thread::hardware_concurrency();
+    CompileServer server(
+            server_socket_, max_concurrent > 0 ? max_concurrent : 1,
+            [this](const CompileServer::Request& request, ostream* out) {
+                return ServeRequest(request, out);
+            });
+    server.Serve();
+    return 0;
+}
+
+int FrontendCmdlineDriver::ServeRequest(
+        const CompileServer::Request& request, ostream* out) {
+    FrontendCmdlineDriver driver;
+    try {
+        vector<const char*> argv;
+        for (auto& arg : request.args) {
+            argv.push_back(arg.c_str());
+        }
+        driver.ParseArgs(argv.size(), argv.data());
+        if (!driver.server_socket_.empty() ||
+            !driver.connect_socket_.empty()) {
+            throw autopiper::Exception(
+                    "A compile request cannot start or contact a server.");
+        }
+        // The server's standard output is not the client's.
+        const Compiler::Options& options = driver.options_;
+        if (options.expand_macros || options.print_ast_orig ||
+            options.print_ast || options.print_ir ||
+            options.print_backend_ir || options.print_lowered) {
+            throw autopiper::Exception(
+                    "Printing flags are not supported by the compile server.");
+        }
+        driver.ResolvePaths(request.cwd);
+        driver.options_.library_cache = &library_cache_;
+        driver.Compile(out);
+    } catch (autopiper::Exception& e) {
+        (*out) << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int FrontendCmdlineDriver::Connect() {
+    if (shutdown_server_) {
+        CompileServer::Shutdown(connect_socket_);
+        return 0;
+    }
+    CompileServer::Request request;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd))) {
+        request.cwd = cwd;
+    }
+    for (size_t i = 0; i < args_.size(); i++) {
+        if (args_[i] == "--connect") {
+            i++;
+            continue;
+        }
+        request.args.push_back(args_[i]);
+    }
+    return CompileServer::Send(connect_socket_, request, &cerr);
+}
+
+void FrontendCmdlineDriver::ResolvePaths(const string& dir) {
+    static const string kLibraryPrefix = "library:";
+    Compiler::Options& o = options_;
+    for (string* path : { &o.filename, &o.ir_output, &o.ir_binary_output,
+                          &o.lowered_output, &o.output, &o.cmodel_output,
+                          &o.bitsliced_cmodel_output, &o.perf_counters,
+                          &o.profile,
+                          &o.narrow_report, &o.timing_report,
+                          &o.throughput_report, &o.cache_dir,
+                          &o.precompile_library, &time_passes_json_ }) {
+        *path = CompileServer::ResolvePath(dir, *path);
+    }
+    for (auto& library : o.libraries) {
+        library = CompileServer::ResolvePath(dir, library);
+    }
+    if (o.timing_model.compare(0, kLibraryPrefix.size(),
+                               kLibraryPrefix) == 0) {
+        o.timing_model = kLibraryPrefix + CompileServer::ResolvePath(
+                dir, o.timing_model.substr(kLibraryPrefix.size()));
+    }
+}
+
 }  // namespace frontend
 }  // namespace autopiper
@@ -18,9 +18,13 @@
 #define _AUTOPIPER_FRONTEND_CMDLINE_DRIVER_H_
 
 #include "frontend/compiler.h"
+#include "frontend/library.h"
 #include "backend/compiler.h"
+#include "common/compile-server.h"
 
+#include <ostream>
 #include <string>
+#include <vector>
 #include <boost/noncopyable.hpp>
 
 namespace autopiper {
@@ -30,15 +34,43 @@ class FrontendFlags;
 
 class FrontendCmdlineDriver : public boost::noncopyable {
     public:
-        FrontendCmdlineDriver() { }
+        FrontendCmdlineDriver()
+            : time_passes_(false), shutdown_server_(false) { }
         ~FrontendCmdlineDriver() { }
 
         void ParseArgs(int argc, const char* const* argv);
-        void Execute();
+        // Compiles, serves compile requests or sends one to a server, as the
+        // flags say. Returns the exit status.
+        int Execute();
 
     private:
         friend class FrontendFlags;
         autopiper::frontend::Compiler::Options options_;
+
+        // Pass statistics output: a table on stderr and/or a JSON file.
+        bool time_passes_;
+        std::string time_passes_json_;
+
+        // Compile server: the socket to serve requests on, or to send this
+        // command line (less --connect) to, and whether to ask that server
+        // to exit instead.
+        std::string server_socket_;
+        std::string connect_socket_;
+        bool shutdown_server_;
+        std::vector<std::string> args_;
+
+        // Libraries parsed by a server, kept for its later requests.
+        LibraryCache library_cache_;
+
+        // Compiles with the parsed flags, writing diagnostics to
+        // |diagnostics|. Throws autopiper::Exception on failure.
+        void Compile(std::ostream* diagnostics);
+        int Serve();
+        int ServeRequest(const CompileServer::Request& request,
+                         std::ostream* out);
+        int Connect();
+        // Makes the paths among the flags relative to |dir|.
+        void ResolvePaths(const std::string& dir);
 };
 
 }  // namespace frontend
@@ -18,6 +18,7 @@
 #include "common/util.h"
 
 #include <sstream>
+#include <limits.h>
 
 using namespace std;
 
@@ -49,23 +50,21 @@ std::string CodeGenContext::GenSym(const char* prefix) {
 IRBB* CodeGenContext::AddBB(const char* label_prefix) {
     unique_ptr<IRBB> bb(new IRBB());
     bb->label = GenSym(label_prefix);
-    IRBB* ret = bb.get();
-    prog_->bbs.push_back(move(bb));
-    return ret;
+    return prog_->AddBB(move(bb));
 }
 
 IRStmt* CodeGenContext::AddIRStmt(
-        IRBB* bb, std::unique_ptr<IRStmt> stmt,
+        IRBB* bb, IRStmt* stmt,
         const ASTExpr* expr) {
     if (expr) {
-        expr_to_ir_map_[expr] = stmt.get();
+        expr_to_ir_map_[expr] = stmt;
+        stmt->location = expr->loc;
     }
     if (stmt->valnum >= prog_->next_valnum) {
         prog_->next_valnum = stmt->valnum + 1;
     }
-    IRStmt* ret = stmt.get();
-    bb->stmts.push_back(move(stmt));
-    return ret;
+    bb->stmts.push_back(stmt);
+    return stmt;
 }
 
 // -------------------------- CodeGenPass ----------------------------------
@@ -82,9 +81,16 @@ CodeGenPass::ModifyASTFunctionDefPre(ASTRef<ASTFunctionDef>& node) {
     IRBB* bb = ctx_->AddBB();
     bb->label = node->name->name;
     bb->is_entry = true;
+    bb->location = node->loc;
+    // The backend checks the lane count's range.
+    bb->lanes = node->lanes > INT_MAX ? INT_MAX : node->lanes.convert_to<int>();
     ctx_->AddEntry(bb);
     ctx_->SetCurBB(bb);
 
+    // Each entry function (process) starts with no bindings; otherwise the
+    // lets of earlier functions would flow into this one's phis.
+    c_.back().binding_level = ctx_->Bindings().Push();
+
     return VISIT_CONTINUE;
 }
 
@@ -92,10 +98,12 @@ CodeGenPass::Result
 CodeGenPass::ModifyASTFunctionDefPost(ASTRef<ASTFunctionDef>& node) {
     // Add a 'done' at the end in case the function body did not.
     if (node->is_entry) {
-        unique_ptr<IRStmt> done_stmt(new IRStmt());
+        IRStmt* done_stmt = ctx_->ir()->NewStmt();
         done_stmt->valnum = ctx_->Valnum();
         done_stmt->type = IRStmtDone;
-        ctx_->AddIRStmt(ctx_->CurBB(), move(done_stmt));
+        done_stmt->location = node->loc;
+        ctx_->AddIRStmt(ctx_->CurBB(), done_stmt);
+        ctx_->Bindings().PopTo(c_.back().binding_level);
     }
     return VISIT_CONTINUE;
 }
@@ -134,7 +142,7 @@ CodeGenPass::ModifyASTStmtAssignPost(ASTRef<ASTStmtAssign>& node) {
             return VISIT_END;
         }
 
-        unique_ptr<IRStmt> reg_write(new IRStmt());
+        IRStmt* reg_write = ctx_->ir()->NewStmt();
         reg_write->valnum = ctx_->Valnum();
         reg_write->type = IRStmtRegWrite;
         reg_write->port_name = regdef->ident->name;
@@ -142,9 +150,8 @@ CodeGenPass::ModifyASTStmtAssignPost(ASTRef<ASTStmtAssign>& node) {
 
         IRStmt* value = ctx_->GetIRStmt(node->rhs.get());
         reg_write->args.push_back(value);
-        reg_write->arg_nums.push_back(value->valnum);
 
-        ctx_->AddIRStmt(ctx_->CurBB(), move(reg_write));
+        ctx_->AddIRStmt(ctx_->CurBB(), reg_write);
     } else if (node->lhs->op == ASTExpr::ARRAY_REF) {
         // Generate an array-write IR stmt.
         // The first op must be a direct var reference to an array -- arrays
@@ -157,11 +164,12 @@ CodeGenPass::ModifyASTStmtAssignPost(ASTRef<ASTStmtAssign>& node) {
             return VISIT_END;
         }
 
-        unique_ptr<IRStmt> array_write(new IRStmt());
+        IRStmt* array_write = ctx_->ir()->NewStmt();
         array_write->valnum = ctx_->Valnum();
         array_write->type = IRStmtArrayWrite;
         array_write->width = node->rhs->inferred_type.width;
         array_write->port_name = arraydef->ident->name;
+        array_write->location = node->lhs->loc;
 
         // Manually codegen the index arg, because we disable traversal over
         // the LHS subtree (to avoid turning the whole ARRAY_REF into a read).
@@ -173,11 +181,9 @@ CodeGenPass::ModifyASTStmtAssignPost(ASTRef<ASTStmtAssign>& node) {
         IRStmt* index_arg = ctx_->GetIRStmt(node->lhs->ops[1].get());
         IRStmt* value = ctx_->GetIRStmt(node->rhs.get());
         array_write->args.push_back(index_arg);
-        array_write->arg_nums.push_back(index_arg->valnum);
         array_write->args.push_back(value);
-        array_write->arg_nums.push_back(value->valnum);
 
-        ctx_->AddIRStmt(ctx_->CurBB(), move(array_write));
+        ctx_->AddIRStmt(ctx_->CurBB(), array_write);
     } else if (node->lhs->op == ASTExpr::FIELD_REF) {
         // This should have been desugared by the type-lower pass to (i)
         // constructing the new aggregate value in a temporary and (ii)
@@ -195,7 +201,7 @@ CodeGenPass::ModifyASTStmtAssignPost(ASTRef<ASTStmtAssign>& node) {
 
 CodeGenPass::Result
 CodeGenPass::ModifyASTStmtWritePost(ASTRef<ASTStmtWrite>& node) {
-    unique_ptr<IRStmt> write_stmt(new IRStmt());
+    IRStmt* write_stmt = ctx_->ir()->NewStmt();
     write_stmt->valnum = ctx_->Valnum();
     const ASTExpr* portdef = FindEntityDef(
             node->port.get(), ASTExpr::PORTDEF, node->port.get());
@@ -212,30 +218,31 @@ CodeGenPass::ModifyASTStmtWritePost(ASTRef<ASTStmtWrite>& node) {
     write_stmt->port_name = portdef->ident->name;
     IRStmt* val = ctx_->GetIRStmt(node->rhs.get());
     write_stmt->args.push_back(val);
-    write_stmt->arg_nums.push_back(val->valnum);
     write_stmt->width = node->rhs->inferred_type.width;
     write_stmt->port_default = portdef->constant;
     write_stmt->port_has_default = portdef->has_constant;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(write_stmt));
+    ctx_->AddIRStmt(ctx_->CurBB(), write_stmt);
     return VISIT_CONTINUE;
 }
 
 CodeGenPass::Result
 CodeGenPass::ModifyASTStmtKillPost(ASTRef<ASTStmtKill>& node) {
-    unique_ptr<IRStmt> stmt(new IRStmt());
+    IRStmt* stmt = ctx_->ir()->NewStmt();
     stmt->valnum = ctx_->Valnum();
     stmt->type = IRStmtKill;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(stmt));
+    stmt->location = node->loc;
+    ctx_->AddIRStmt(ctx_->CurBB(), stmt);
     return VISIT_CONTINUE;
 }
 
 CodeGenPass::Result
 CodeGenPass::ModifyASTStmtKillYoungerPost(
                 ASTRef<ASTStmtKillYounger>& node) {
-    unique_ptr<IRStmt> stmt(new IRStmt());
+    IRStmt* stmt = ctx_->ir()->NewStmt();
     stmt->valnum = ctx_->Valnum();
     stmt->type = IRStmtKillYounger;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(stmt));
+    stmt->location = node->loc;
+    ctx_->AddIRStmt(ctx_->CurBB(), stmt);
 
     // Codegen any OnKillYounger blocks.
     ASTVisitor visitor;
@@ -277,13 +284,13 @@ CodeGenPass::ModifyASTStmtKillIfPost(ASTRef<ASTStmtKillIf>& node) {
     if (!VerifyNoSideEffects(node->condition.get(), Errors())) {
         return VISIT_END;
     }
-    unique_ptr<IRStmt> stmt(new IRStmt());
+    IRStmt* stmt = ctx_->ir()->NewStmt();
     stmt->valnum = ctx_->Valnum();
     stmt->type = IRStmtKillIf;
     IRStmt* cond = ctx_->GetIRStmt(node->condition.get());
     stmt->args.push_back(cond);
-    stmt->arg_nums.push_back(cond->valnum);
-    ctx_->AddIRStmt(ctx_->CurBB(), move(stmt));
+    stmt->location = node->loc;
+    ctx_->AddIRStmt(ctx_->CurBB(), stmt);
     return VISIT_CONTINUE;
 }
 
@@ -296,13 +303,13 @@ CodeGenPass::ModifyASTStmtTimingPre(ASTRef<ASTStmtTiming>& node) {
     c_.back().timing_last_stage.push_back(0);
 
     // Create an implicit barrier with offset 0.
-    unique_ptr<IRStmt> timing_barrier(new IRStmt());
+    IRStmt* timing_barrier = ctx_->ir()->NewStmt();
     timing_barrier->valnum = ctx_->Valnum();
     timing_barrier->type = IRStmtTimingBarrier;
     timing_barrier->timevar = timevar.get();
-    timevar->uses.push_back(timing_barrier.get());
+    timevar->uses.push_back(timing_barrier);
     timing_barrier->time_offset = 0;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(timing_barrier));
+    ctx_->AddIRStmt(ctx_->CurBB(), timing_barrier);
 
     ctx_->ir()->timevars.push_back(move(timevar));
     return VISIT_CONTINUE;
@@ -312,13 +319,13 @@ CodeGenPass::Result
 CodeGenPass::ModifyASTStmtTimingPost(ASTRef<ASTStmtTiming>& node) {
     // Create an implicit barrier with offset equal to the last stage statement
     // to ensure the last stage can't leak into later stages.
-    unique_ptr<IRStmt> timing_barrier(new IRStmt());
+    IRStmt* timing_barrier = ctx_->ir()->NewStmt();
     timing_barrier->valnum = ctx_->Valnum();
     timing_barrier->type = IRStmtTimingBarrier;
     timing_barrier->timevar = c_.back().timing_stack.back();
-    c_.back().timing_stack.back()->uses.push_back(timing_barrier.get());
+    c_.back().timing_stack.back()->uses.push_back(timing_barrier);
     timing_barrier->time_offset = c_.back().timing_last_stage.back();
-    ctx_->AddIRStmt(ctx_->CurBB(), move(timing_barrier));
+    ctx_->AddIRStmt(ctx_->CurBB(), timing_barrier);
 
     c_.back().timing_stack.pop_back();
     c_.back().timing_last_stage.pop_back();
@@ -342,24 +349,24 @@ CodeGenPass::ModifyASTStmtStagePost(ASTRef<ASTStmtStage>& node) {
     // barrier anchored to *this* stage statement's offset, to early-constrain
     // all statements in this stage.
 
-    unique_ptr<IRStmt> late_timing_barrier(new IRStmt());
+    IRStmt* late_timing_barrier = ctx_->ir()->NewStmt();
     late_timing_barrier->valnum = ctx_->Valnum();
     late_timing_barrier->type = IRStmtTimingBarrier;
     late_timing_barrier->timevar = timevar;
-    timevar->uses.push_back(late_timing_barrier.get());
+    timevar->uses.push_back(late_timing_barrier);
     late_timing_barrier->time_offset = last_stage;
 
-    ctx_->AddIRStmt(ctx_->CurBB(), move(late_timing_barrier));
+    ctx_->AddIRStmt(ctx_->CurBB(), late_timing_barrier);
 
-    unique_ptr<IRStmt> early_timing_barrier(new IRStmt());
+    IRStmt* early_timing_barrier = ctx_->ir()->NewStmt();
     early_timing_barrier->valnum = ctx_->Valnum();
     early_timing_barrier->type = IRStmtTimingBarrier;
     early_timing_barrier->timevar = timevar;
-    timevar->uses.push_back(early_timing_barrier.get());
+    timevar->uses.push_back(early_timing_barrier);
     early_timing_barrier->time_offset = node->offset;
     last_stage = node->offset;
 
-    ctx_->AddIRStmt(ctx_->CurBB(), move(early_timing_barrier));
+    ctx_->AddIRStmt(ctx_->CurBB(), early_timing_barrier);
 
     return VISIT_CONTINUE;
 }
@@ -416,7 +423,7 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
     IRStmtOp op = ExprTypeToOpType(node->op);
     // Is this a 'normal' case where we have a 1-to-1 mapping with an IR stmt?
     if (op != IRStmtOpNone) {
-        unique_ptr<IRStmt> stmt(new IRStmt());
+        IRStmt* stmt = ctx_->ir()->NewStmt();
         stmt->valnum = ctx_->Valnum();
         stmt->type = IRStmtExpr;
         stmt->op = op;
@@ -424,21 +431,28 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
         for (auto& op : node->ops) {
             IRStmt* op_stmt = ctx_->GetIRStmt(op.get());
             stmt->args.push_back(op_stmt);
-            stmt->arg_nums.push_back(op_stmt->valnum);
         }
-        ctx_->AddIRStmt(ctx_->CurBB(), move(stmt), node.get());
+        ctx_->AddIRStmt(ctx_->CurBB(), stmt, node.get());
     } else {
         // Handle a few other special cases.
         switch (node->op) {
             case ASTExpr::CONST: {
-                unique_ptr<IRStmt> stmt(new IRStmt());
+                IRStmt* stmt = ctx_->ir()->NewStmt();
                 stmt->type = IRStmtExpr;
                 stmt->op = IRStmtOpConst;
                 stmt->valnum = ctx_->Valnum();
                 stmt->constant = node->constant;
                 stmt->has_constant = true;
                 stmt->width = node->inferred_type.width;
-                ctx_->AddIRStmt(ctx_->CurBB(), move(stmt), node.get());
+                ctx_->AddIRStmt(ctx_->CurBB(), stmt, node.get());
+                break;
+            }
+            case ASTExpr::LANE: {
+                IRStmt* stmt = ctx_->ir()->NewStmt();
+                stmt->type = IRStmtLane;
+                stmt->valnum = ctx_->Valnum();
+                stmt->width = node->inferred_type.width;
+                ctx_->AddIRStmt(ctx_->CurBB(), stmt, node.get());
                 break;
             }
             case ASTExpr::VAR: {
@@ -452,7 +466,11 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
             }
             case ASTExpr::PORTDEF: {
                 // If the portdef has a user-specified name, it's exported.
-                // Else we come up with a name at this point.
+                // Else we come up with a name at this point. Internal ports
+                // are named by the frontend and are not exported.
+                if (node->ident->type == ASTIdent::INTERNAL_PORT) {
+                    break;
+                }
                 if (!node->ident->name.empty()) {
                     if (node->inferred_type.is_chan) {
                         Error(node.get(),
@@ -460,17 +478,28 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
                                 "chans must be anonymous.");
                         return VISIT_END;
                     }
-                    unique_ptr<IRStmt> export_stmt(new IRStmt());
+                    IRStmt* export_stmt = ctx_->ir()->NewStmt();
                     export_stmt->valnum = ctx_->Valnum();
                     export_stmt->type = IRStmtPortExport;
                     export_stmt->port_name = node->ident->name;
                     export_stmt->width = node->inferred_type.width;
-                    ctx_->AddIRStmt(ctx_->CurBB(), move(export_stmt));
+                    ctx_->AddIRStmt(ctx_->CurBB(), export_stmt);
                 } else {
                     // Anonymous port: give it a name, but don't mark it as
                     // exported.
                     node->ident->name = ctx_->GenSym();
                 }
+                // 'port latency N' registers it between writer and readers.
+                if (node->read_latency > 0) {
+                    IRStmt* latency_def = ctx_->ir()->NewStmt();
+                    latency_def->valnum = ctx_->Valnum();
+                    latency_def->type = IRStmtPortLatency;
+                    latency_def->port_name = node->ident->name;
+                    latency_def->constant = node->read_latency;
+                    latency_def->has_constant = true;
+                    latency_def->location = node->loc;
+                    ctx_->AddIRStmt(ctx_->CurBB(), latency_def);
+                }
                 break;
             }
             case ASTExpr::PORTREAD: {
@@ -481,7 +510,7 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
                 if (!portdef) {
                     return VISIT_END;
                 }
-                unique_ptr<IRStmt> read_stmt(new IRStmt());
+                IRStmt* read_stmt = ctx_->ir()->NewStmt();
                 read_stmt->valnum = ctx_->Valnum();
                 if (portdef->inferred_type.is_port) {
                     read_stmt->type = IRStmtPortRead;
@@ -495,7 +524,7 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
                 }
                 read_stmt->port_name = portdef->ident->name;
                 read_stmt->width = portdef->inferred_type.width;
-                ctx_->AddIRStmt(ctx_->CurBB(), move(read_stmt), node.get());
+                ctx_->AddIRStmt(ctx_->CurBB(), read_stmt, node.get());
                 break;
             }
             case ASTExpr::ARRAY_INIT: {
@@ -504,12 +533,36 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
                 node->ident.reset(new ASTIdent());
                 node->ident->name = ctx_->GenSym("array");
 
-                unique_ptr<IRStmt> array_def(new IRStmt());
+                IRStmt* array_def = ctx_->ir()->NewStmt();
                 array_def->valnum = ctx_->Valnum();
                 array_def->type = IRStmtArraySize;
                 array_def->port_name = node->ident->name;
                 array_def->constant = node->inferred_type.array_size;
-                ctx_->AddIRStmt(ctx_->CurBB(), move(array_def));
+                array_def->has_constant = true;
+                ctx_->AddIRStmt(ctx_->CurBB(), array_def);
+
+                // 'array banks N' also declares its bank count.
+                if (node->has_constant) {
+                    IRStmt* banks_def = ctx_->ir()->NewStmt();
+                    banks_def->valnum = ctx_->Valnum();
+                    banks_def->type = IRStmtArrayBanks;
+                    banks_def->port_name = node->ident->name;
+                    banks_def->constant = node->constant;
+                    banks_def->has_constant = true;
+                    banks_def->location = node->loc;
+                    ctx_->AddIRStmt(ctx_->CurBB(), banks_def);
+                }
+                // ... and 'array latency N' its read latency.
+                if (node->read_latency > 0) {
+                    IRStmt* latency_def = ctx_->ir()->NewStmt();
+                    latency_def->valnum = ctx_->Valnum();
+                    latency_def->type = IRStmtArrayLatency;
+                    latency_def->port_name = node->ident->name;
+                    latency_def->constant = node->read_latency;
+                    latency_def->has_constant = true;
+                    latency_def->location = node->loc;
+                    ctx_->AddIRStmt(ctx_->CurBB(), latency_def);
+                }
                 break;
             }
             case ASTExpr::ARRAY_REF: {
@@ -519,17 +572,16 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
                     return VISIT_END;
                 }
 
-                unique_ptr<IRStmt> array_read(new IRStmt());
+                IRStmt* array_read = ctx_->ir()->NewStmt();
                 array_read->valnum = ctx_->Valnum();
                 array_read->type = IRStmtArrayRead;
                 array_read->width = node->inferred_type.width;
 
                 IRStmt* index_arg = ctx_->GetIRStmt(node->ops[1].get());
                 array_read->args.push_back(index_arg);
-                array_read->arg_nums.push_back(index_arg->valnum);
                 array_read->port_name = arraydef->ident->name;
 
-                ctx_->AddIRStmt(ctx_->CurBB(), move(array_read), node.get());
+                ctx_->AddIRStmt(ctx_->CurBB(), array_read, node.get());
                 break;
             }
             case ASTExpr::REG_INIT: {
@@ -545,13 +597,13 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
                     return VISIT_END;
                 }
 
-                unique_ptr<IRStmt> reg_read(new IRStmt());
+                IRStmt* reg_read = ctx_->ir()->NewStmt();
                 reg_read->valnum = ctx_->Valnum();
                 reg_read->type = IRStmtRegRead;
                 reg_read->width = node->inferred_type.width;
                 reg_read->port_name = regdef->ident->name;
 
-                ctx_->AddIRStmt(ctx_->CurBB(), move(reg_read), node.get());
+                ctx_->AddIRStmt(ctx_->CurBB(), reg_read, node.get());
                 break;
             }
             case ASTExpr::BYPASSDEF:
@@ -569,7 +621,7 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
                     return VISIT_END;
                 }
 
-                unique_ptr<IRStmt> bypassop(new IRStmt());
+                IRStmt* bypassop = ctx_->ir()->NewStmt();
                 switch (node->op) {
                     case ASTExpr::BYPASSPRESENT:
                         bypassop->type = IRStmtBypassPresent;
@@ -590,9 +642,8 @@ CodeGenPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
 
                 IRStmt* index_arg = ctx_->GetIRStmt(node->ops[1].get());
                 bypassop->args.push_back(index_arg);
-                bypassop->arg_nums.push_back(index_arg->valnum);
 
-                ctx_->AddIRStmt(ctx_->CurBB(), move(bypassop), node.get());
+                ctx_->AddIRStmt(ctx_->CurBB(), bypassop, node.get());
                 break;
             }
 
@@ -663,10 +714,11 @@ CodeGenPass::ModifyASTStmtNestedFuncPre(ASTRef<ASTStmtNestedFunc>& node) {
     }
 
     // End with a 'done'.
-    unique_ptr<IRStmt> done_stmt(new IRStmt());
+    IRStmt* done_stmt = ctx_->ir()->NewStmt();
     done_stmt->valnum = ctx_->Valnum();
     done_stmt->type = IRStmtDone;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(done_stmt));
+    done_stmt->location = node->loc;
+    ctx_->AddIRStmt(ctx_->CurBB(), done_stmt);
 
     // restore the old context.
     ctx_->SetCurBB(c_.back().last_curbb);
@@ -687,7 +739,7 @@ CodeGenPass::ModifyASTStmtOnKillYoungerPre(ASTRef<ASTStmtOnKillYounger>& node) {
 
 CodeGenPass::Result
 CodeGenPass::ModifyASTStmtBypassStartPost(ASTRef<ASTStmtBypassStart>& node) {
-    unique_ptr<IRStmt> bypass_stmt(new IRStmt());
+    IRStmt* bypass_stmt = ctx_->ir()->NewStmt();
     bypass_stmt->valnum = ctx_->Valnum();
     const ASTExpr* bypassdef = FindEntityDef(
             node->bypass.get(), ASTExpr::BYPASSDEF, node->bypass.get());
@@ -698,14 +750,13 @@ CodeGenPass::ModifyASTStmtBypassStartPost(ASTRef<ASTStmtBypassStart>& node) {
     bypass_stmt->port_name = bypassdef->ident->name;
     IRStmt* index_arg = ctx_->GetIRStmt(node->index.get());
     bypass_stmt->args.push_back(index_arg);
-    bypass_stmt->arg_nums.push_back(index_arg->valnum);
-    ctx_->AddIRStmt(ctx_->CurBB(), move(bypass_stmt));
+    ctx_->AddIRStmt(ctx_->CurBB(), bypass_stmt);
     return VISIT_CONTINUE;
 }
 
 CodeGenPass::Result
 CodeGenPass::ModifyASTStmtBypassEndPost(ASTRef<ASTStmtBypassEnd>& node) {
-    unique_ptr<IRStmt> bypass_stmt(new IRStmt());
+    IRStmt* bypass_stmt = ctx_->ir()->NewStmt();
     bypass_stmt->valnum = ctx_->Valnum();
     const ASTExpr* bypassdef = FindEntityDef(
             node->bypass.get(), ASTExpr::BYPASSDEF, node->bypass.get());
@@ -714,13 +765,13 @@ CodeGenPass::ModifyASTStmtBypassEndPost(ASTRef<ASTStmtBypassEnd>& node) {
     }
     bypass_stmt->type = IRStmtBypassEnd;
     bypass_stmt->port_name = bypassdef->ident->name;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(bypass_stmt));
+    ctx_->AddIRStmt(ctx_->CurBB(), bypass_stmt);
     return VISIT_CONTINUE;
 }
 
 CodeGenPass::Result
 CodeGenPass::ModifyASTStmtBypassWritePost(ASTRef<ASTStmtBypassWrite>& node) {
-    unique_ptr<IRStmt> bypass_stmt(new IRStmt());
+    IRStmt* bypass_stmt = ctx_->ir()->NewStmt();
     bypass_stmt->valnum = ctx_->Valnum();
     const ASTExpr* bypassdef = FindEntityDef(
             node->bypass.get(), ASTExpr::BYPASSDEF, node->bypass.get());
@@ -731,9 +782,8 @@ CodeGenPass::ModifyASTStmtBypassWritePost(ASTRef<ASTStmtBypassWrite>& node) {
     bypass_stmt->port_name = bypassdef->ident->name;
     IRStmt* value_arg = ctx_->GetIRStmt(node->value.get());
     bypass_stmt->args.push_back(value_arg);
-    bypass_stmt->arg_nums.push_back(value_arg->valnum);
     bypass_stmt->width = value_arg->width;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(bypass_stmt));
+    ctx_->AddIRStmt(ctx_->CurBB(), bypass_stmt);
     return VISIT_CONTINUE;
 }
 
@@ -756,16 +806,13 @@ CodeGenPass::ModifyASTStmtIfPre(ASTRef<ASTStmtIf>& node) {
     IRStmt* conditional = ctx_->GetIRStmt(node->condition.get());
 
     // Terminate CurBB() with the conditional branch to the if- or else-path.
-    unique_ptr<IRStmt> cond_br(new IRStmt());
+    IRStmt* cond_br = ctx_->ir()->NewStmt();
     cond_br->valnum = ctx_->Valnum();
     cond_br->type = IRStmtIf;
     cond_br->args.push_back(conditional);
-    cond_br->arg_nums.push_back(conditional->valnum);
     cond_br->targets.push_back(if_body);
-    cond_br->target_names.push_back(if_body->label);
     cond_br->targets.push_back(else_body);
-    cond_br->target_names.push_back(else_body->label);
-    ctx_->AddIRStmt(ctx_->CurBB(), move(cond_br));
+    ctx_->AddIRStmt(ctx_->CurBB(), cond_br);
 
     // Generate each of the if- and else-bodies, pushing a control-flow-path
     // binding context and saving the overwritten bindings so that we can merge
@@ -800,19 +847,17 @@ CodeGenPass::ModifyASTStmtIfPre(ASTRef<ASTStmtIf>& node) {
     IRBB* merge_bb = ctx_->AddBB("if_else_merge");
     ctx_->SetCurBB(merge_bb);
 
-    unique_ptr<IRStmt> if_end_jmp(new IRStmt());
+    IRStmt* if_end_jmp = ctx_->ir()->NewStmt();
     if_end_jmp->valnum = ctx_->Valnum();
     if_end_jmp->type = IRStmtJmp;
     if_end_jmp->targets.push_back(merge_bb);
-    if_end_jmp->target_names.push_back(merge_bb->label);
-    ctx_->AddIRStmt(if_end, move(if_end_jmp));
+    ctx_->AddIRStmt(if_end, if_end_jmp);
 
-    unique_ptr<IRStmt> else_end_jmp(new IRStmt());
+    IRStmt* else_end_jmp = ctx_->ir()->NewStmt();
     else_end_jmp->valnum = ctx_->Valnum();
     else_end_jmp->type = IRStmtJmp;
     else_end_jmp->targets.push_back(merge_bb);
-    else_end_jmp->target_names.push_back(merge_bb->label);
-    ctx_->AddIRStmt(else_end, move(else_end_jmp));
+    ctx_->AddIRStmt(else_end, else_end_jmp);
 
     auto phi_map = ctx_->Bindings().JoinOverlays(
             vector<map<ASTStmtLet*, const ASTExpr*>> {
@@ -832,20 +877,16 @@ CodeGenPass::ModifyASTStmtIfPre(ASTRef<ASTStmtIf>& node) {
             return VISIT_END;
         }
 
-        unique_ptr<IRStmt> phi_node(new IRStmt());
+        IRStmt* phi_node = ctx_->ir()->NewStmt();
         phi_node->type = IRStmtPhi;
         phi_node->valnum = ctx_->Valnum();
         phi_node->width = if_val->width;
         phi_node->args.push_back(if_val);
-        phi_node->arg_nums.push_back(if_val->valnum);
         phi_node->args.push_back(else_val);
-        phi_node->arg_nums.push_back(else_val->valnum);
         phi_node->targets.push_back(if_end);
-        phi_node->target_names.push_back(if_end->label);
         phi_node->targets.push_back(else_end);
-        phi_node->target_names.push_back(else_end->label);
 
-        IRStmt* new_node = ctx_->AddIRStmt(merge_bb, move(phi_node));
+        IRStmt* new_node = ctx_->AddIRStmt(merge_bb, phi_node);
 
         // Create a new dummy ASTExpr to refer to the phi node.
         unique_ptr<ASTExpr> phi_expr(new ASTExpr());
@@ -873,11 +914,13 @@ CodeGenPass::ModifyASTStmtIfPre(ASTRef<ASTStmtIf>& node) {
 // 'while' scope to its data. Its data includes the current set of "up-exits"
 // (continues) and "down-exits" (breaks). These lists may be amended while
 // within nested whiles, for example, so it's important that all be available
-// for update up the lexical stack. Each exit edge carries a copy of the
-// binding map from the top of the associated loop to that point. Such a map
-// may be constructed by merging maps down the lexical scope stack: each
-// 'while'-loop record should also record a copy of the binding map at its own
-// start point relative to the next enclosing loop.
+// for update up the lexical stack. Each exit edge carries the bindings set
+// between the top of the associated loop's body and that point, i.e., only
+// what changed along that path; a variable absent from an edge's bindings
+// takes the header phi's value along it. The phis at each join are thus
+// driven by these change sets: the footer gets phis only for variables some
+// break edge changed, and after the loop, the other variables are bound to
+// their header phis.
 //
 // The code layout is:
 //
@@ -912,7 +955,10 @@ bool CodeGenPass::AddWhileLoopPhiNodeInputs(
         // phis (e.g. for footer).
         map<ASTStmtLet*, IRStmt*>* binding_phis,
         IRBB* binding_phi_bb,
-        map<IRBB*, SubBindingMap>& in_edges) {
+        map<IRBB*, SubBindingMap>& in_edges,
+        // Receives the binding after the loop of each variable given a phi
+        // here.
+        SubBindingMap* exit_bindings) {
     vector<IRBB*> in_bbs;
     vector<SubBindingMap> in_maps;
     for (auto& p : in_edges) {
@@ -930,15 +976,15 @@ bool CodeGenPass::AddWhileLoopPhiNodeInputs(
         if (binding_phis) {
             phi_node = (*binding_phis)[let];
         } else {
-            unique_ptr<IRStmt> new_phi_node(new IRStmt());
-            phi_node = new_phi_node.get();
+            IRStmt* new_phi_node = ctx->ir()->NewStmt();
+            phi_node = new_phi_node;
             new_phi_node->valnum = ctx->Valnum();
             new_phi_node->type = IRStmtPhi;
             unique_ptr<ASTExpr> phi_node_expr(new ASTExpr());
             phi_node_expr->inferred_type = let->inferred_type;
             phi_node_expr->op = ASTExpr::NOP;
-            ctx->Bindings().Set(let, phi_node_expr.get());
-            ctx->AddIRStmt(binding_phi_bb, move(new_phi_node), phi_node_expr.get());
+            (*exit_bindings)[let] = phi_node_expr.get();
+            ctx->AddIRStmt(binding_phi_bb, new_phi_node, phi_node_expr.get());
             ctx->ast()->ir_exprs.push_back(move(phi_node_expr));
         }
         if (!phi_node) {
@@ -952,14 +998,29 @@ bool CodeGenPass::AddWhileLoopPhiNodeInputs(
             IRStmt* in_val = ctx->GetIRStmt(exprs[i]);
             IRBB* in_bb = in_bbs[i];
             phi_node->args.push_back(in_val);
-            phi_node->arg_nums.push_back(in_val->valnum);
             phi_node->targets.push_back(in_bb);
-            phi_node->target_names.push_back(in_bb->label);
             // Propagate this as we see values so that new phi nodes are
             // properly set up.
             phi_node->width = in_val->width;
         }
     }
+
+    // Header phis of variables that no edge changed take their own value
+    // along every edge. Every variable live into the loop leaves it through
+    // its header phi (or a footer phi over it), as a transaction carries only
+    // these values around the loop.
+    if (binding_phis) {
+        for (auto& p : *binding_phis) {
+            (*exit_bindings)[p.first] = ctx->Bindings()[p.first];
+            if (join.find(p.first) != join.end()) {
+                continue;
+            }
+            for (auto* in_bb : in_bbs) {
+                p.second->args.push_back(p.second);
+                p.second->targets.push_back(in_bb);
+            }
+        }
+    }
     return true;
 }
 
@@ -979,15 +1040,15 @@ CodeGenPass::ModifyASTStmtWhilePre(ASTRef<ASTStmtWhile>& node) {
     }
     frame->header = ctx_->AddBB((bb_name_prefix + "header").c_str());
     frame->footer = ctx_->AddBB((bb_name_prefix + "footer").c_str());
+    frame->header->pipelined = node->pipelined;
 
     // Add a jump from current block to header.
     frame->in_bb = ctx_->CurBB();
-    unique_ptr<IRStmt> in_jmp(new IRStmt());
+    IRStmt* in_jmp = ctx_->ir()->NewStmt();
     in_jmp->valnum = ctx_->Valnum();
     in_jmp->type = IRStmtJmp;
     in_jmp->targets.push_back(frame->header);
-    in_jmp->target_names.push_back(frame->header->label);
-    ctx_->AddIRStmt(ctx_->CurBB(), move(in_jmp));
+    ctx_->AddIRStmt(ctx_->CurBB(), in_jmp);
 
     ctx_->SetCurBB(frame->header);
 
@@ -1018,23 +1079,22 @@ CodeGenPass::ModifyASTStmtWhilePre(ASTRef<ASTStmtWhile>& node) {
             continue;
         }
 
-        unique_ptr<IRStmt> phi_node(new IRStmt());
-        binding_phis[let] = phi_node.get();
+        IRStmt* phi_node = ctx_->ir()->NewStmt();
+        binding_phis[let] = phi_node;
         phi_node->type = IRStmtPhi;
         phi_node->valnum = ctx_->Valnum();
         phi_node->width = binding_ir->width;
         phi_node->targets.push_back(frame->in_bb);
-        phi_node->target_names.push_back(frame->in_bb->label);
         phi_node->args.push_back(binding_ir);
-        phi_node->arg_nums.push_back(binding_ir->valnum);
 
         // Create a new ASTExpr to refer to phi.
         ASTRef<ASTExpr> ast_expr(new ASTExpr());
         ast_expr->op = ASTExpr::NOP;
-        ctx_->AddIRStmt(frame->header, move(phi_node), ast_expr.get());
+        ctx_->AddIRStmt(frame->header, phi_node, ast_expr.get());
         ctx_->Bindings().Set(let, ast_expr.get());
         ctx_->ast()->ir_exprs.push_back(move(ast_expr));
     }
+    frame->body_depth = ctx_->Bindings().Push();
 
     // Generate the loop condition in the current BB (which is the header
     // block).
@@ -1051,22 +1111,19 @@ CodeGenPass::ModifyASTStmtWhilePre(ASTRef<ASTStmtWhile>& node) {
     IRBB* body_bb = ctx_->AddBB((bb_name_prefix + "body").c_str());
 
     // Generate the loop conditional jmp.
-    unique_ptr<IRStmt> loop_cond_br(new IRStmt());
+    IRStmt* loop_cond_br = ctx_->ir()->NewStmt();
     loop_cond_br->valnum = ctx_->Valnum();
     loop_cond_br->type = IRStmtIf;
     loop_cond_br->args.push_back(loop_cond_br_arg);
-    loop_cond_br->arg_nums.push_back(loop_cond_br_arg->valnum);
     loop_cond_br->targets.push_back(body_bb);
-    loop_cond_br->target_names.push_back(body_bb->label);
     loop_cond_br->targets.push_back(frame->footer);
-    loop_cond_br->target_names.push_back(frame->footer->label);
-    ctx_->AddIRStmt(frame->header, move(loop_cond_br));
+    ctx_->AddIRStmt(frame->header, loop_cond_br);
 
     // Add the implicit 'break' edge from the header to the footer due to the
     // exit condition.
     frame->break_edges.insert(make_pair(
                 frame->header,
-                ctx_->Bindings().Overlay(frame->overlay_depth)));
+                ctx_->Bindings().Overlay(frame->body_depth)));
 
     // Generate loop body starting at the body BB.
     ctx_->SetCurBB(body_bb);
@@ -1080,40 +1137,47 @@ CodeGenPass::ModifyASTStmtWhilePre(ASTRef<ASTStmtWhile>& node) {
 
     // Add the implicit 'continue' jmp at the end of the body.
     IRBB* body_end_bb = ctx_->CurBB();
-    unique_ptr<IRStmt> final_continue_jmp(new IRStmt());
+    IRStmt* final_continue_jmp = ctx_->ir()->NewStmt();
     final_continue_jmp->valnum = ctx_->Valnum();
     final_continue_jmp->type = IRStmtJmp;
     final_continue_jmp->targets.push_back(frame->header);
-    final_continue_jmp->target_names.push_back(frame->header->label);
-    ctx_->AddIRStmt(body_end_bb, move(final_continue_jmp));
+    ctx_->AddIRStmt(body_end_bb, final_continue_jmp);
 
     // Add the implicit 'continue' edge with bindings so that the phis will be
     // updated.
     frame->continue_edges.insert(make_pair(
                 body_end_bb,
-                ctx_->Bindings().Overlay(frame->overlay_depth)));
+                ctx_->Bindings().Overlay(frame->body_depth)));
 
-    // Restore the binding stack to its earlier level.
-    ctx_->Bindings().PopTo(frame->overlay_depth);
+    // Restore the binding stack to the header phis, which are the bindings
+    // that edges not changing a variable carry.
+    ctx_->Bindings().PopTo(frame->body_depth);
 
     // Add in-edges to each phi in the loop header for each continue edge (edge
     // into the header), including the implicit 'end-of-body continue' we added
     // above, and for each break edge (edge into the footer), including the
     // implicit 'break on loop condition false' edge we added above.
-
+    SubBindingMap exit_bindings;
     if (!AddWhileLoopPhiNodeInputs(
                 node.get(), ctx_,
                 &binding_phis, nullptr,
-                frame->continue_edges)) {
+                frame->continue_edges, &exit_bindings)) {
         return VISIT_END;
     }
     if (!AddWhileLoopPhiNodeInputs(
                 node.get(), ctx_,
                 nullptr, frame->footer,
-                frame->break_edges)) {
+                frame->break_edges, &exit_bindings)) {
         return VISIT_END;
     }
 
+    // Restore the binding stack to its earlier level, and bind the variables
+    // live through the loop to their values at the footer.
+    ctx_->Bindings().PopTo(frame->overlay_depth);
+    for (auto& p : exit_bindings) {
+        ctx_->Bindings().Set(p.first, p.second);
+    }
+
     // Set the footer as current -- this is our single exit point.
     ctx_->SetCurBB(frame->footer);
 
@@ -1151,7 +1215,7 @@ CodeGenPass::LoopFrame* CodeGenPass::FindLoopFrame(
 void CodeGenPass::HandleBreakContinue(LoopFrame* frame,
         map<IRBB*, SubBindingMap>& edge_map, IRBB* target) {
     // Capture the bindings up to this point.
-    SubBindingMap bindings = ctx_->Bindings().Overlay(frame->overlay_depth);
+    SubBindingMap bindings = ctx_->Bindings().Overlay(frame->body_depth);
     // Create a new binding scope for all bindings created after this 'break'.
     ctx_->Bindings().Push();
 
@@ -1162,12 +1226,11 @@ void CodeGenPass::HandleBreakContinue(LoopFrame* frame,
 
     // Generate the jump to the loop's header (continue) or footer (break)
     // block.
-    unique_ptr<IRStmt> jmp(new IRStmt());
+    IRStmt* jmp = ctx_->ir()->NewStmt();
     jmp->valnum = ctx_->Valnum();
     jmp->type = IRStmtJmp;
     jmp->targets.push_back(target);
-    jmp->target_names.push_back(target->label);
-    ctx_->AddIRStmt(ctx_->CurBB(), move(jmp));
+    ctx_->AddIRStmt(ctx_->CurBB(), jmp);
     // Start a new CurBB. This is unreachable but it must be non-null to
     // maintain our invariant.
     ctx_->SetCurBB(ctx_->AddBB("unreachable"));
@@ -1209,13 +1272,13 @@ CodeGenPass::ModifyASTStmtSpawnPre(ASTRef<ASTStmtSpawn>& node) {
     IRBB* spawn_bb = ctx_->AddBB("spawn");
 
     // Produce the spawn statement itself.
-    unique_ptr<IRStmt> spawn_stmt(new IRStmt());
+    IRStmt* spawn_stmt = ctx_->ir()->NewStmt();
     spawn_stmt->valnum = ctx_->Valnum();
     spawn_stmt->type = IRStmtSpawn;
     spawn_stmt->width = kIRStmtWidthTxnID;
     spawn_stmt->targets.push_back(spawn_bb);
-    spawn_stmt->target_names.push_back(spawn_bb->label);
-    ctx_->AddIRStmt(ctx_->CurBB(), move(spawn_stmt));
+    spawn_stmt->location = node->loc;
+    ctx_->AddIRStmt(ctx_->CurBB(), spawn_stmt);
 
     // Generate the spawn-path's code.
     ctx_->SetCurBB(spawn_bb);
@@ -1226,10 +1289,11 @@ CodeGenPass::ModifyASTStmtSpawnPre(ASTRef<ASTStmtSpawn>& node) {
     }
     ctx_->Bindings().PopTo(level);
     // Ensure that the spawn-path ends with a 'kill'.
-    unique_ptr<IRStmt> kill_stmt(new IRStmt());
+    IRStmt* kill_stmt = ctx_->ir()->NewStmt();
     kill_stmt->valnum = ctx_->Valnum();
     kill_stmt->type = IRStmtKill;
-    ctx_->AddIRStmt(ctx_->CurBB(), move(kill_stmt));
+    kill_stmt->location = node->loc;
+    ctx_->AddIRStmt(ctx_->CurBB(), kill_stmt);
 
     // Re-set the output path (current BB) to the BB to which we added the
     // 'spawn' -- codegen continues on the fallthrough path.
@@ -1241,8 +1305,10 @@ CodeGenPass::ModifyASTStmtSpawnPre(ASTRef<ASTStmtSpawn>& node) {
 
 CodeGenPass::Result
 CodeGenPass::ModifyASTPragmaPost(ASTRef<ASTPragma>& node) {
-    if (node->key == "timing_model") {
-        ctx_->ir()->timing_model = node->value;
+    string error;
+    if (!ctx_->ir()->SetPragma(node->key, node->value, &error)) {
+        Error(node.get(), error);
+        return VISIT_END;
     }
     return VISIT_CONTINUE;
 }
@@ -1259,21 +1325,15 @@ static void MarkSuccs(set<IRBB*>& bb_set, IRBB* root) {
 
 static void FilterPhiInputs(IRStmt* phi, set<IRBB*>& reachable) {
     vector<IRBB*> new_targets;
-    vector<string> new_target_names;
     vector<IRStmt*> new_args;
-    vector<int> new_arg_nums;
     for (unsigned i = 0; i < phi->args.size(); i++) {
         if (reachable.find(phi->targets[i]) != reachable.end()) {
             new_targets.push_back(phi->targets[i]);
-            new_target_names.push_back(phi->target_names[i]);
             new_args.push_back(phi->args[i]);
-            new_arg_nums.push_back(phi->arg_nums[i]);
         }
     }
     phi->targets.swap(new_targets);
-    phi->target_names.swap(new_target_names);
     phi->args.swap(new_args);
-    phi->arg_nums.swap(new_arg_nums);
 }
 
 void CodeGenPass::RemoveUnreachableBBsAndPhis() {
@@ -1297,7 +1357,7 @@ void CodeGenPass::RemoveUnreachableBBsAndPhis() {
             if (stmt->type != IRStmtPhi) {
                 continue;
             }
-            FilterPhiInputs(stmt.get(), reachable);
+            FilterPhiInputs(stmt, reachable);
         }
     }
 
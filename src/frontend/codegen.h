@@ -34,57 +34,73 @@ namespace frontend {
 // let-value slots (where scopes correspond to control-flow paths) and
 // primitive generator functions (where overrides can occur due to higher-level
 // structures).
+//
+// The bindings visible at the innermost scope are kept in one map, and each
+// Set() logs the binding it replaced in a journal that PopTo() unwinds. Lookups
+// thus do not walk the scope stack, and the cost of pushing, popping or taking
+// an overlay of a scope is proportional to the bindings set within it rather
+// than to all bindings live at that point.
 template<typename K, typename V>
 class CodeGenScope {
     public:
         CodeGenScope() {
-            scopes_.push_back({});
+            scopes_.push_back(0);
         }
 
         V& operator[](const K& k) {
-            for (int i = scopes_.size() - 1; i >= 0; --i) {
-                auto& m = scopes_[i].bindings;
-                auto it = m.find(k);
-                if (it != m.end()) {
-                    return it->second;
-                }
-            }
+            auto it = bindings_.find(k);
             // If not found, error -- new bindings must be created with Set().
-            assert(false);
+            assert(it != bindings_.end());
+            return it->second;
         }
 
         void Set(const K& k, V v) {
-            scopes_.back().bindings[k] = v;
+            auto it = bindings_.find(k);
+            if (it != bindings_.end()) {
+                journal_.push_back({k, true, it->second});
+                it->second = v;
+            } else {
+                journal_.push_back({k, false, V()});
+                bindings_.insert(std::make_pair(k, v));
+            }
         }
 
         bool Has(const K& k) const {
-            for (int i = scopes_.size() - 1; i >= 0; --i) {
-                auto m = scopes_[i].bindings;
-                auto it = m.find(k);
-                if (it != m.end()) {
-                    return true;
-                }
-            }
-            return false;
+            return bindings_.find(k) != bindings_.end();
         }
 
         int Push() {
             int level = scopes_.size();
-            scopes_.push_back({});
+            scopes_.push_back(journal_.size());
             return level;
         }
 
         void PopTo(int level) {
-            while (scopes_.size() > level) {
-                scopes_.pop_back();
+            if (static_cast<size_t>(level) >= scopes_.size()) {
+                return;
+            }
+            size_t start = scopes_[level];
+            while (journal_.size() > start) {
+                auto& e = journal_.back();
+                if (e.replaced) {
+                    bindings_[e.key] = e.old_value;
+                } else {
+                    bindings_.erase(e.key);
+                }
+                journal_.pop_back();
             }
+            scopes_.resize(level);
         }
 
+        // The bindings set in scope |from_level| or any scope nested within
+        // it: the change set of the current control-flow path since that
+        // scope was pushed.
         std::map<K, V> Overlay(int from_level) const {
             std::map<K, V> ret;
-            for (int i = from_level; i < scopes_.size(); i++) {
-                for (auto& p : scopes_[i].bindings) {
-                    ret[p.first] = p.second;
+            for (size_t i = scopes_[from_level]; i < journal_.size(); i++) {
+                const K& k = journal_[i].key;
+                if (ret.find(k) == ret.end()) {
+                    ret[k] = bindings_.find(k)->second;
                 }
             }
             return ret;
@@ -92,10 +108,8 @@ class CodeGenScope {
 
         std::set<K> Keys() const {
             std::set<K> ret;
-            for (auto& scope : scopes_) {
-                for (auto& p : scope.bindings) {
-                    ret.insert(p.first);
-                }
+            for (auto& p : bindings_) {
+                ret.insert(p.first);
             }
             return ret;
         }
@@ -144,10 +158,16 @@ class CodeGenScope {
         }
 
     private:
-        struct Scope {
-            std::map<K, V> bindings;
+        // One overwritten (|replaced|) or newly created binding.
+        struct JournalEntry {
+            K key;
+            bool replaced;
+            V old_value;
         };
-        std::vector<Scope> scopes_;
+        std::map<K, V> bindings_;
+        std::vector<JournalEntry> journal_;
+        // Journal position at which each scope starts.
+        std::vector<size_t> scopes_;
 };
 
 class CodeGenLoopHandler;
@@ -189,8 +209,8 @@ class CodeGenContext {
 
         // Add an IRStmt to the given BB, also recording that it computes the
         // value of |expr| (may be null if this stmt doesn't compute any expr's
-        // value).
-        IRStmt* AddIRStmt(IRBB* bb, std::unique_ptr<IRStmt> stmt,
+        // value) and taking its source location from |expr|.
+        IRStmt* AddIRStmt(IRBB* bb, IRStmt* stmt,
                           const ASTExpr* expr = nullptr);
 
         // Associate an IRStmt created in some other way (e.g., already added)
@@ -304,6 +324,9 @@ class CodeGenPass : public ASTVisitorContext {
         struct LoopFrame {
             ASTStmtWhile* while_block;
             int overlay_depth;
+            // Binding-scope level of the loop body, above the header phis:
+            // each break and continue edge carries the bindings set since.
+            int body_depth;
             std::map<IRBB*, SubBindingMap> break_edges;
             std::map<IRBB*, SubBindingMap> continue_edges;
             IRBB* header;
@@ -317,7 +340,8 @@ class CodeGenPass : public ASTVisitorContext {
                 const ASTBase* node, CodeGenContext* ctx,
                 std::map<ASTStmtLet*, IRStmt*>* binding_phis,
                 IRBB* binding_phi_bb,
-                std::map<IRBB*, SubBindingMap>& in_edges);
+                std::map<IRBB*, SubBindingMap>& in_edges,
+                SubBindingMap* exit_bindings);
         void HandleBreakContinue(LoopFrame* frame,
                 std::map<IRBB*, SubBindingMap>& edge_map,
                 IRBB* target);
@@ -340,6 +364,10 @@ class CodeGenPass : public ASTVisitorContext {
             // is in ctx_.
             IRBB* last_curbb;
 
+            // Binding-scope level at the start of a top-level entry function,
+            // restored at its end.
+            int binding_level;
+
             // Current set of OnKillYounger blocks, to be codegen'd at every
             // killyounger up to the end of this entry function (process).
             ASTVector<ASTStmtOnKillYounger> onkillyoungers;
@@ -15,6 +15,7 @@
  */
 
 #include "frontend/compiler.h"
+#include "frontend/library.h"
 #include "frontend/macro.h"
 #include "frontend/parser.h"
 #include "frontend/func-inline.h"
@@ -23,15 +24,103 @@
 #include "frontend/type-lower.h"
 #include "frontend/codegen.h"
 #include "backend/compiler.h"
+#include "common/build-cache.h"
 
 #include <fstream>
+#include <iostream>
 #include <memory>
+#include <vector>
 
 using namespace autopiper::frontend;
 using namespace autopiper;
 using namespace std;
 
+namespace {
+
+// Counts AST statements and expressions, as a measure of AST size for pass
+// statistics.
+class ASTSizeCounter : public ASTVisitorContext {
+    public:
+        ASTSizeCounter() : stmts(0), exprs(0) {}
+
+        int stmts;
+        int exprs;
+
+    protected:
+        virtual Result VisitASTStmtPre(const ASTStmt* node) {
+            stmts++;
+            return VISIT_CONTINUE;
+        }
+        virtual Result VisitASTExprPre(const ASTExpr* node) {
+            exprs++;
+            return VISIT_CONTINUE;
+        }
+};
+
+void RecordASTSize(PassStats::Scope* scope, const AST* ast) {
+    if (!scope->enabled()) return;
+    ASTSizeCounter counter;
+    ASTVisitor visitor;
+    visitor.VisitAST(ast, &counter);
+    scope->SetSize("ast_stmts", counter.stmts);
+    scope->SetSize("ast_exprs", counter.exprs);
+}
+
+// Replays an already-expanded token stream to the parser.
+class TokenListLexer : public Lexer {
+    public:
+        TokenListLexer(const vector<Token>* tokens)
+            : tokens_(tokens), pos_(0) {}
+
+        virtual const Token& Peek() const { return (*tokens_)[pos_]; }
+        virtual bool Have() const { return pos_ < tokens_->size(); }
+        virtual bool ReadNext() {
+            if (Have()) pos_++;
+            return Have();
+        }
+        // Newlines were already dropped by the macro expander.
+        virtual void SetIgnoreNewline(bool ignore_newline) {}
+
+    private:
+        const vector<Token>* tokens_;
+        size_t pos_;
+};
+
+// Hashes the macro-expanded token stream. Token locations are left out, so
+// that edits which only move code (or change comments and whitespace) still
+// hit the cache.
+void HashTokens(const vector<Token>& tokens, ContentHash* hash) {
+    static const string kLibraryPrefix = "library:";
+    for (auto& token : tokens) {
+        hash->Add(static_cast<int>(token.type));
+        switch (token.type) {
+            case Token::INT_LITERAL:
+                hash->Add(token.int_literal.str());
+                break;
+            case Token::QUOTED_STRING:
+                hash->Add(token.s.str());
+                // A timing library named by a pragma is an input too.
+                if (token.s.str().compare(0, kLibraryPrefix.size(),
+                                          kLibraryPrefix) == 0) {
+                    hash->AddFile(token.s.substr(kLibraryPrefix.size()));
+                }
+                break;
+            case Token::IDENT:
+                hash->Add(token.s.str());
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+}  // anonymous namespace
+
 bool Compiler::CompileFile(const Options& options, ErrorCollector* collector) {
+    if (!options.precompile_library.empty()) {
+        return PrecompileLibrary(options, collector);
+    }
+
     // Parse input.
     ifstream in(options.filename);
     if (!in.good()) {
@@ -45,72 +134,256 @@ bool Compiler::CompileFile(const Options& options, ErrorCollector* collector) {
         return false;
     }
 
+    // Libraries come first: their macros are visible throughout the input.
+    LibraryCache local_libraries;
+    LibraryCache* library_cache = options.library_cache ?
+                                  options.library_cache : &local_libraries;
+    vector<shared_ptr<const Library>> libraries;
+    vector<const Macro*> library_macros;
+    for (auto& filename : options.libraries) {
+        shared_ptr<const Library> library =
+            library_cache->Get(filename, collector);
+        if (!library) {
+            return false;
+        }
+        library->GetMacros(&library_macros);
+        libraries.push_back(library);
+    }
+
     LexerImpl lexer(&in);
-    MacroExpander macro(&lexer, collector);
-    Parser parser(options.filename, &macro, collector);
+    MacroExpander macro(&lexer, collector, library_macros);
+    if (collector->HasErrors()) {
+        return false;
+    }
 
     if (options.expand_macros) {
         TokenPrinter tokprinter(&cout);
         return tokprinter.PrintFromLexer(&macro);
     }
 
-    unique_ptr<AST> ast(new AST());
-    if (!parser.Parse(ast.get())) {
-        return false;
-    }
+    BackendCompiler backend_;
+    BackendCompiler::Options backend_options_;
+    backend_options_.filename = "(ir)";
+    backend_options_.ir_binary_output = options.ir_binary_output;
+    backend_options_.output = options.output;
+    backend_options_.cmodel_output = options.cmodel_output;
+    backend_options_.bitsliced_cmodel_output =
+        options.bitsliced_cmodel_output;
+    backend_options_.bundle_piperegs = options.bundle_piperegs;
+    backend_options_.specialize_piperegs = options.specialize_piperegs;
+    backend_options_.retime_piperegs = options.retime_piperegs;
+    backend_options_.verilator = options.verilator;
+    backend_options_.hierarchical = options.hierarchical;
+    backend_options_.timing_model = options.timing_model;
+    backend_options_.minimize_registers = options.minimize_registers;
+    backend_options_.balance_stages = options.balance_stages;
+    backend_options_.max_stages = options.max_stages;
+    backend_options_.minimize_predicates = options.minimize_predicates;
+    backend_options_.share_kill_if_slices = options.share_kill_if_slices;
+    backend_options_.propagate_predicates = options.propagate_predicates;
+    backend_options_.register_inputs = options.register_inputs;
+    backend_options_.register_outputs = options.register_outputs;
+    backend_options_.bank_arrays = options.bank_arrays;
+    backend_options_.skid_depth = options.skid_depth;
+    backend_options_.elastic_stages = options.elastic_stages;
+    backend_options_.perf_counters = options.perf_counters;
+    backend_options_.profile = options.profile;
+    backend_options_.fold_constants = options.fold_constants;
+    backend_options_.cse = options.cse;
+    backend_options_.narrow_widths = options.narrow_widths;
+    backend_options_.narrow_report = options.narrow_report;
+    backend_options_.timing_report = options.timing_report;
+    backend_options_.timing_report_paths = options.timing_report_paths;
+    backend_options_.throughput_report = options.throughput_report;
+    backend_options_.print_ir = options.print_backend_ir;
+    backend_options_.print_lowered = options.print_lowered;
+    backend_options_.lowered_output = options.lowered_output;
+    backend_options_.print_pipes = options.print_pipes;
+    backend_options_.print_first_stage = options.print_first_stage;
+    backend_options_.print_last_stage = options.print_last_stage;
+    backend_options_.jobs = options.jobs;
+    backend_options_.pass_stats = options.pass_stats;
+    backend_options_.cache_dir = options.cache_dir;
 
-    if (options.print_ast_orig) {
-        PrintAST(ast.get(), cout);
+    // With a cache, the token stream is expanded up front so that it can be
+    // hashed: if it and the options are unchanged since an earlier compile,
+    // that compile's outputs are reused. Otherwise, the backend may still
+    // find the generated IR in the cache.
+    bool use_cache = BackendCompiler::CanUseCache(backend_options_) &&
+                     !options.print_ast_orig && !options.print_ast &&
+                     !options.print_ir && options.ir_output.empty() &&
+                     options.ir_binary_output.empty();
+    BuildCache cache(options.cache_dir);
+    string cache_key;
+    vector<Token> tokens;
+    TokenListLexer token_list(&tokens);
+    Lexer* parser_input = &macro;
+    if (use_cache) {
+        PassStats::Scope scope(options.pass_stats, "TokenCacheLookup");
+        while (macro.Have()) {
+            tokens.push_back(macro.Peek());
+            macro.ReadNext();
+        }
+        if (collector->HasErrors()) {
+            return false;
+        }
+        ContentHash hash;
+        hash.Add("tokens");
+        hash.AddCompilerIdentity();
+        BackendCompiler::HashOptions(backend_options_, &hash);
+        // The libraries' macros are reflected in the expanded tokens, but
+        // their functions and types are not.
+        for (auto& filename : options.libraries) {
+            hash.AddFile(filename);
+        }
+        HashTokens(tokens, &hash);
+        cache_key = hash.Hex();
+        if (cache.Fetch(cache_key,
+                        BackendCompiler::CacheArtifacts(backend_options_))) {
+            scope.AddCount("hits", 1);
+            return true;
+        }
+        parser_input = &token_list;
     }
 
-    // AST desugaring/transforms.
-#define TRANSFORM(tform)                                                       \
-    if (!ASTVisitor::Transform< tform >(ast, collector)) {                     \
-        throw autopiper::Exception(                                            \
-                "Compilation failed in pass '" #tform "'.");                   \
-    }                                                                          \
+    // The AST, kept in an arena, and the code generator's state are only
+    // needed until the IR is generated, so they are freed before the backend
+    // runs rather than held through it.
+    unique_ptr<IRProgram> ir;
+    {
+        ASTArena arena;
+        ASTArenaScope arena_scope(&arena);
+        Parser parser(options.filename, parser_input, collector);
+        unique_ptr<AST> ast(new AST());
+        {
+            PassStats::Scope scope(options.pass_stats, "Parse");
+            if (!parser.Parse(ast.get())) {
+                return false;
+            }
+            // Added in reverse, as each is prepended, so that the first
+            // library named comes first.
+            for (auto it = libraries.rbegin(); it != libraries.rend(); ++it) {
+                (*it)->AddTo(ast.get());
+            }
+            RecordASTSize(&scope, ast.get());
+        }
+        // The cache's copy of the token stream has been parsed.
+        vector<Token>().swap(tokens);
 
-    TRANSFORM(FuncInlinePass);
-    TRANSFORM(ArgLetPass);
-    TRANSFORM(VarScopePass);
-    TRANSFORM(TypeInferPass);
-    TRANSFORM(TypeLowerPass);
+        if (options.print_ast_orig) {
+            PrintAST(ast.get(), cout);
+        }
+
+        // AST desugaring/transforms.
+#define TRANSFORM(tform)                                                   \
+        {                                                                      \
+            PassStats::Scope scope(options.pass_stats, #tform);                \
+            if (!ASTVisitor::Transform< tform >(ast, collector)) {             \
+                throw autopiper::Exception(                                    \
+                        "Compilation failed in pass '" #tform "'.");           \
+            }                                                                  \
+            RecordASTSize(&scope, ast.get());                                  \
+        }                                                                      \
+
+        TRANSFORM(FuncInlinePass);
+        TRANSFORM(ArgLetPass);
+        TRANSFORM(VarScopePass);
+        {
+            // Type inference also reports its solver's work.
+            PassStats::Scope scope(options.pass_stats, "TypeInferPass");
+            if (!ASTVisitor::Transform<TypeInferPass>(ast, collector,
+                                                      &scope)) {
+                throw autopiper::Exception(
+                        "Compilation failed in pass 'TypeInferPass'.");
+            }
+            RecordASTSize(&scope, ast.get());
+        }
+        TRANSFORM(TypeLowerPass);
 
 #undef TRANSFORM
 
-    if (options.print_ast) {
-        PrintAST(ast.get(), cout);
-    }
+        if (options.print_ast) {
+            PrintAST(ast.get(), cout);
+        }
 
-    CodeGenContext codegen_ctx(ast.get());
-    CodeGenPass codegen_pass(collector, &codegen_ctx);
-    ASTVisitor codegen_visitor;
-    if (!codegen_visitor.ModifyAST(ast, &codegen_pass)) {
-        throw autopiper::Exception(
-                "Compilation failed in IR code generation.");
-    }
-    codegen_pass.RemoveUnreachableBBsAndPhis();
+        CodeGenContext codegen_ctx(ast.get());
+        {
+            PassStats::Scope scope(options.pass_stats, "CodeGenPass");
+            CodeGenPass codegen_pass(collector, &codegen_ctx);
+            ASTVisitor codegen_visitor;
+            if (!codegen_visitor.ModifyAST(ast, &codegen_pass)) {
+                throw autopiper::Exception(
+                        "Compilation failed in IR code generation.");
+            }
+            codegen_pass.RemoveUnreachableBBsAndPhis();
 
-    unique_ptr<IRProgram> ir = codegen_ctx.Release();
+            ir = codegen_ctx.Release();
+            scope.SetSize("stmts", ir->stmts.size());
+            scope.SetSize("bbs", ir->bbs.size());
+            scope.SetSize("ast_arena_bytes", arena.bytes());
+        }
+    }
 
     if (options.print_ir) {
-        printf("IR:\n%s\n", ir->ToString().c_str());
+        cout << "# IR:" << endl;
+        ir->Print(&cout);
+        cout << endl;
     }
 
-    // TODO: print IR to IR output file if requested (ensure IR printer
-    // produces parsable output).
+    // Binary IR output is written by the backend once the program is
+    // checked.
+    if (!options.ir_output.empty()) {
+        ofstream ir_out(options.ir_output);
+        if (!ir_out.good()) {
+            Location loc;
+            loc.filename = options.ir_output;
+            loc.line = loc.column = 0;
+            collector->ReportError(loc, ErrorCollector::ERROR,
+                                   string("Could not open file '") +
+                                   options.ir_output +
+                                   string("'"));
+            return false;
+        }
+        ir->Print(&ir_out);
+    }
 
-    BackendCompiler backend_;
-    BackendCompiler::Options backend_options_;
     backend_options_.input_ir = ir.get();
-    backend_options_.filename = "(ir)";
-    backend_options_.output = options.output;
-    backend_options_.print_ir = options.print_backend_ir;
-    backend_options_.print_lowered = options.print_lowered;
     if (!backend_.CompileFile(backend_options_, collector)) {
         throw autopiper::Exception(
                 "Compilation failed in backend.");
     }
 
+    if (use_cache && !collector->HasErrors()) {
+        cache.Store(cache_key,
+                    BackendCompiler::CacheArtifacts(backend_options_));
+    }
+
+    return true;
+}
+
+bool Compiler::PrecompileLibrary(const Options& options,
+                                 ErrorCollector* collector) {
+    shared_ptr<const Library> library;
+    {
+        PassStats::Scope scope(options.pass_stats, "Parse");
+        library = Library::Load(options.filename, collector);
+        if (!library) {
+            return false;
+        }
+        RecordASTSize(&scope, library->ast.get());
+    }
+    ofstream out(options.precompile_library, ios::binary);
+    if (!out.good()) {
+        Location loc;
+        loc.filename = options.precompile_library;
+        loc.line = loc.column = 0;
+        collector->ReportError(loc, ErrorCollector::ERROR,
+                               string("Could not open file '") +
+                               options.precompile_library +
+                               string("'"));
+        return false;
+    }
+    PassStats::Scope scope(options.pass_stats, "LibraryWriteBinary");
+    library->WriteBinary(&out);
     return true;
 }
@@ -18,13 +18,17 @@
 #define _AUTOPIPER_FRONTEND_COMPILER_H_
 
 #include "common/error-collector.h"
+#include "common/pass-stats.h"
 
 #include <string>
+#include <vector>
 #include <boost/noncopyable.hpp>
 
 namespace autopiper {
 namespace frontend {
 
+class LibraryCache;
+
 class Compiler : public boost::noncopyable {
     public:
         Compiler() { }
@@ -47,18 +51,158 @@ class Compiler : public boost::noncopyable {
             // lowering/pipelining.
             bool print_backend_ir;
 
-            // Print lowered form after lowering/pipelining.
+            // Print lowered form after lowering/pipelining, and write it to
+            // |lowered_output| if non-empty: only the pipes entered at the BBs
+            // in |print_pipes| (all, if empty), and only stages
+            // |print_first_stage| through |print_last_stage| (-1 for no
+            // bound).
             bool print_lowered;
+            std::string lowered_output;
+            std::vector<std::string> print_pipes;
+            int print_first_stage;
+            int print_last_stage;
 
             // Autopiper input.
             std::string filename;
 
-            // IR output.
+            // Libraries of macros, functions and types to compile with the
+            // input; see Library. They are taken from |library_cache| if
+            // set, and parsed for this compile alone otherwise.
+            std::vector<std::string> libraries;
+            LibraryCache* library_cache;
+
+            // If non-empty, parse the input as a library and write it here
+            // in precompiled form (see Library), instead of compiling it.
+            std::string precompile_library;
+
+            // Text IR output, if non-empty: the IR after frontend codegen,
+            // in the form that the backend reads.
             std::string ir_output;
 
+            // Binary IR output, if non-empty.
+            std::string ir_binary_output;
+
             // Verilog output.
             std::string output;
 
+            // C++ model output, if non-empty.
+            std::string cmodel_output;
+            // Bit-sliced C++ model output, if non-empty.
+            std::string bitsliced_cmodel_output;
+
+            // Pack the piperegs at each stage boundary into shared wide
+            // instances in the Verilog output.
+            bool bundle_piperegs;
+
+            // Reset only the piperegs of control values, and carry data in
+            // enable-gated piperegs without reset; with retime_piperegs,
+            // in ones that synthesis may retime. See VerilogGenerator.
+            bool specialize_piperegs;
+            bool retime_piperegs;
+
+            // Write Verilog that lints clean under Verilator, for two-state
+            // cycle-based simulation: see VerilogGenerator.
+            bool verilator;
+
+            // Write each pipe as its own Verilog module, under a top module
+            // that connects them: see VerilogGenerator.
+            bool hierarchical;
+
+            // Timing model to use in place of the program's own, if
+            // non-empty; see TimingModel::New().
+            std::string timing_model;
+
+            // Place computations to minimize pipeline register bits (also
+            // enabled by pragma minimize_registers = "true").
+            bool minimize_registers;
+
+            // Spread computations over the stages to shorten the fullest
+            // stage, at the same stage count (also enabled by pragma
+            // balance_stages = "true").
+            bool balance_stages;
+
+            // If nonzero, time each pipe with the smallest delay per stage
+            // that fits it in this many stages (also set by pragma
+            // max_stages).
+            int max_stages;
+
+            // Minimize valid-signal predicates with their truth tables, and
+            // share one signal between equivalent ones (also enabled by
+            // pragma minimize_predicates = "true").
+            bool minimize_predicates;
+
+            // Evaluate each kill_if condition once per cycle and share it
+            // between the downstream stages, rather than cloning it into each
+            // (also enabled by pragma share_kill_if_slices = "true").
+            bool share_kill_if_slices;
+
+            // Simplify logic using the facts that each statement's valid
+            // predicate implies, and remove statements that can never be
+            // valid (also enabled by pragma propagate_predicates = "true").
+            bool propagate_predicates;
+
+            // Register each exported input and output that declares no
+            // latency of its own at the module boundary (also enabled by
+            // pragmas register_inputs and register_outputs = "true").
+            bool register_inputs;
+            bool register_outputs;
+
+            // Split arrays into banks where that gives each bank fewer ports
+            // (also enabled by pragma bank_arrays = "true").
+            bool bank_arrays;
+
+            // Elastic stalls: skid-buffer entries at the input of each
+            // elastic stage, if nonzero, and the elastic stages, if not all
+            // that can be (also set by pragmas elastic and elastic_stages).
+            int skid_depth;
+            std::vector<int> elastic_stages;
+
+            // Performance-counter layout output, if non-empty: instantiate
+            // a counter for each stage's performance events (also enabled
+            // by pragma perf_counters = "true") and describe the counter
+            // bank here as JSON.
+            std::string perf_counters;
+
+            // Profile layout output, if non-empty: have the Verilog and the
+            // C++ models write a trace of each cycle's performance events
+            // and of the statements that spawn, end, kill and stall
+            // transactions, once a trace file is given to them, and
+            // describe the trace here as JSON (see tools/txn_profile.py).
+            std::string profile;
+
+            // Fold constants and remove dead code before lowering.
+            bool fold_constants;
+
+            // Eliminate common subexpressions before lowering.
+            bool cse;
+
+            // Narrow arithmetic to its operands' significant bits before
+            // lowering, writing what was narrowed to |narrow_report| if
+            // non-empty.
+            bool narrow_widths;
+            std::string narrow_report;
+
+            // Per-stage critical path report output, if non-empty, listing
+            // |timing_report_paths| worst paths overall.
+            std::string timing_report;
+            int timing_report_paths;
+
+            // Throughput report output, if non-empty: each pipe's depth and
+            // each backedge's loop-carried latency, the stalls it causes and
+            // the resulting bound on transactions per cycle.
+            std::string throughput_report;
+
+            // Number of threads to use for lowering, and with |hierarchical|,
+            // for generating the modules.
+            int jobs;
+
+            // If set, per-pass statistics are recorded here.
+            PassStats* pass_stats;
+
+            // Directory of cached outputs, if non-empty; see
+            // BackendCompiler::Options.
+            std::string cache_dir;
+
             Options()
                 : expand_macros(false)
                 , print_ast_orig(false)
@@ -66,11 +210,39 @@ class Compiler : public boost::noncopyable {
                 , print_ir(false)
                 , print_backend_ir(false)
                 , print_lowered(false)
+                , print_first_stage(-1)
+                , print_last_stage(-1)
+                , library_cache(nullptr)
+                , bundle_piperegs(false)
+                , specialize_piperegs(false)
+                , retime_piperegs(false)
+                , verilator(false)
+                , hierarchical(false)
+                , minimize_registers(false)
+                , balance_stages(false)
+                , max_stages(0)
+                , minimize_predicates(false)
+                , share_kill_if_slices(false)
+                , propagate_predicates(false)
+                , register_inputs(false)
+                , register_outputs(false)
+                , bank_arrays(false)
+                , skid_depth(0)
+                , fold_constants(true)
+                , cse(true)
+                , narrow_widths(true)
+                , timing_report_paths(10)
+                , jobs(1)
+                , pass_stats(nullptr)
             { }
         };
 
         bool CompileFile(const Options& options,
                          ErrorCollector* collector);
+
+    private:
+        bool PrecompileLibrary(const Options& options,
+                               ErrorCollector* collector);
 };
 
 }  // namespace frontend
@@ -18,6 +18,11 @@
 #include "common/util.h"
 #include "common/exception.h"
 
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 using namespace std;
 
 namespace autopiper {
@@ -33,6 +38,14 @@ FuncInlinePass::VisitASTFunctionDefPre(const ASTFunctionDef* node) {
     return VISIT_CONTINUE;
 }
 
+FuncInlinePass::Result
+FuncInlinePass::VisitASTPragmaPre(const ASTPragma* node) {
+    if (node->key == "shared_func") {
+        shared_funcs_.insert(make_pair(node->value, node));
+    }
+    return VISIT_CONTINUE;
+}
+
 namespace {
 class ArgsReturnReplacer : public ASTVisitorContext {
     public:
@@ -154,6 +167,479 @@ bool InlineFunctionBody(
 
     return true;
 }
+
+// ---- Shared function units. ----
+
+ASTRef<ASTStmt> Box(ASTRef<ASTStmtBlock> block) {
+    ASTRef<ASTStmt> box(new ASTStmt());
+    box->block = move(block);
+    return box;
+}
+
+ASTRef<ASTType> NamedType(const char* name) {
+    ASTRef<ASTType> type(new ASTType());
+    type->ident.reset(new ASTIdent());
+    type->ident->name = name;
+    type->ident->type = ASTIdent::TYPE;
+    return type;
+}
+
+ASTRef<ASTExpr> ConstExpr(int value) {
+    ASTRef<ASTExpr> expr(new ASTExpr(value));
+    expr->op = ASTExpr::CONST;
+    expr->has_constant = true;
+    return expr;
+}
+
+ASTRef<ASTExpr> VarExpr(const ASTIdent* ident) {
+    ASTRef<ASTExpr> expr(new ASTExpr());
+    expr->op = ASTExpr::VAR;
+    expr->ident = CloneAST(ident);
+    return expr;
+}
+
+ASTRef<ASTExpr> ReadExpr(const ASTIdent* port) {
+    ASTRef<ASTExpr> expr(new ASTExpr());
+    expr->op = ASTExpr::PORTREAD;
+    expr->ops.push_back(VarExpr(port));
+    return expr;
+}
+
+// Defines a let-bound temp of the given type in |block|.
+const ASTIdent* AddLet(AST* ast, ASTStmtBlock* block, const char* prefix,
+                       ASTRef<ASTType> type, ASTRef<ASTExpr> rhs) {
+    return ASTDefineTemp(ast, prefix, block, move(rhs), move(type)).first;
+}
+
+// Defines a let-bound internal (non-exported) port named |name| carrying
+// values of |type|. If |has_default|, the port reads as zero in cycles in
+// which it is not written.
+const ASTIdent* AddPortLet(AST* ast, ASTStmtBlock* block,
+                           const string& name, const ASTType* type,
+                           bool has_default) {
+    ASTRef<ASTExpr> portdef(new ASTExpr());
+    portdef->op = ASTExpr::PORTDEF;
+    portdef->ident.reset(new ASTIdent());
+    portdef->ident->name = name;
+    portdef->ident->type = ASTIdent::INTERNAL_PORT;
+    if (has_default) {
+        portdef->constant = 0;
+        portdef->has_constant = true;
+    }
+    ASTRef<ASTType> port_type = CloneAST(type);
+    port_type->is_port = true;
+    return AddLet(ast, block, "port_", move(port_type), move(portdef));
+}
+
+void AddAssign(ASTStmtBlock* block, const ASTIdent* var,
+               ASTRef<ASTExpr> rhs) {
+    ASTRef<ASTStmt> stmt(new ASTStmt());
+    stmt->assign.reset(new ASTStmtAssign());
+    stmt->assign->lhs = VarExpr(var);
+    stmt->assign->rhs = move(rhs);
+    block->stmts.push_back(move(stmt));
+}
+
+void AddWrite(ASTStmtBlock* block, const ASTIdent* port,
+              ASTRef<ASTExpr> rhs) {
+    ASTRef<ASTStmt> stmt(new ASTStmt());
+    stmt->write.reset(new ASTStmtWrite());
+    stmt->write->port = VarExpr(port);
+    stmt->write->rhs = move(rhs);
+    block->stmts.push_back(move(stmt));
+}
+
+// Adds 'timing { stage 0; ... }' to |block| and returns the body, so that
+// everything in it is pinned to one stage.
+ASTStmtBlock* AddSingleStage(ASTStmtBlock* block) {
+    ASTRef<ASTStmtBlock> body(new ASTStmtBlock());
+    ASTStmtBlock* ret = body.get();
+    ASTRef<ASTStmt> stage(new ASTStmt());
+    stage->stage.reset(new ASTStmtStage());
+    stage->stage->offset = 0;
+    body->stmts.push_back(move(stage));
+
+    ASTRef<ASTStmt> stmt(new ASTStmt());
+    stmt->timing.reset(new ASTStmtTiming());
+    stmt->timing->body = Box(move(body));
+    block->stmts.push_back(move(stmt));
+    return ret;
+}
+
+bool IsVoid(const ASTType* type) {
+    return !type->is_array && type->ident->name == "void";
+}
+
+// A function compiled as a shared unit. The unit is a separate entry
+// function (process), |prefix|, that serves at most one call per cycle; each
+// call site (numbered in program order) gets its own request ports:
+//
+//     <prefix>_req_valid_<site>         (bool, zero when not requesting)
+//     <prefix>_req_<param>_<site>       (one per parameter)
+//     <prefix>_grant_<site>             (bool, set when the unit serves it)
+//
+// and all sites share the unit's <prefix>_resp port. The unit looks like:
+//
+//     func entry <prefix>() : void {
+//         timing {
+//             stage 0;
+//             if (read req_valid_N) {
+//                 params = read req_<param>_N; write grant_N, 1;
+//             } else if (read req_valid_N-1) {
+//                 ...
+//             }
+//             if (any request) { write resp, <inlined body>(params); }
+//         }
+//     }
+//
+// and a call becomes a stall loop that holds its request until granted,
+// taking the response in the same cycle:
+//
+//     {
+//         let args = ...; let result = 0; let granted = 0;
+//         while (~granted) {
+//             timing {
+//                 stage 0;
+//                 write req_valid_k, 1; write req_<param>_k, args;
+//                 granted = read grant_k; result = read resp;
+//             }
+//         }
+//         result
+//     }
+//
+// Higher-numbered sites have priority: sites are numbered in program order,
+// so within a process a later site belongs to an older transaction, which
+// must drain for younger ones to make progress. The unit answers
+// combinationally, so the function body must fit in, and not loop within, one
+// pipeline stage. A caller held in place by a stall downstream repeats its
+// request, so a shared function should not have side effects.
+struct SharedFunc {
+    const ASTFunctionDef* def;
+    string prefix;
+    int sites;
+    // The unit's parameter and result temps, and the inlined body that
+    // computes the result from the parameters.
+    ASTRef<ASTStmtBlock> decls;
+    vector<const ASTIdent*> params;
+    const ASTIdent* result;
+    ASTRef<ASTStmtBlock> body;
+
+    SharedFunc() : def(nullptr), sites(0), result(nullptr) {}
+
+    string PortName(const char* what, int site) const {
+        return strprintf("%s_%s_%d", prefix.c_str(), what, site);
+    }
+    string ArgPortName(int param, int site) const {
+        return strprintf("%s_req_%s_%d", prefix.c_str(),
+                         def->params[param]->ident->name.c_str(), site);
+    }
+    string RespPortName() const {
+        return prefix + "_resp";
+    }
+};
+
+typedef map<string, SharedFunc> SharedFuncMap;
+
+// Rewrites each call to a shared function into a request to its unit.
+class SharedCallRewriter : public ASTVisitorContext {
+    public:
+        SharedCallRewriter(AST* ast, SharedFuncMap* funcs,
+                           const SharedFunc* self, ErrorCollector* coll)
+            : ASTVisitorContext(coll), ast_(ast), funcs_(funcs), self_(self)
+        {}
+
+        virtual Result ModifyASTExprPost(ASTRef<ASTExpr>& node) {
+            if (node->op != ASTExpr::FUNCCALL) {
+                return VISIT_CONTINUE;
+            }
+            auto it = funcs_->find(node->ident->name);
+            if (it == funcs_->end()) {
+                return VISIT_CONTINUE;
+            }
+            SharedFunc& func = it->second;
+            if (&func == self_) {
+                Error(node.get(),
+                      strprintf("Shared function '%s' cannot call itself",
+                                node->ident->name.c_str()));
+                return VISIT_END;
+            }
+            if (node->ops.size() != func.def->params.size()) {
+                Error(node.get(), "Function call arity mismatch");
+                return VISIT_END;
+            }
+            int site = func.sites++;
+            const ASTType* return_type = func.def->return_type.get();
+            ASTRef<ASTType> bool_type = NamedType("bool");
+
+            ASTRef<ASTStmtBlock> block(new ASTStmtBlock());
+            const ASTIdent* valid_port = AddPortLet(
+                    ast_, block.get(), func.PortName("req_valid", site),
+                    bool_type.get(), true);
+            const ASTIdent* grant_port = AddPortLet(
+                    ast_, block.get(), func.PortName("grant", site),
+                    bool_type.get(), true);
+            const ASTIdent* resp_port = nullptr;
+            if (!IsVoid(return_type)) {
+                resp_port = AddPortLet(
+                        ast_, block.get(), func.RespPortName(),
+                        return_type, false);
+            }
+            // Evaluate the arguments once, ahead of the loop.
+            vector<const ASTIdent*> arg_ports, args;
+            for (unsigned i = 0; i < node->ops.size(); i++) {
+                const ASTType* type = func.def->params[i]->type.get();
+                arg_ports.push_back(AddPortLet(
+                            ast_, block.get(), func.ArgPortName(i, site),
+                            type, false));
+                args.push_back(AddLet(ast_, block.get(), "shared_arg_",
+                                      CloneAST(type), move(node->ops[i])));
+            }
+            auto result_ident_and_expr =
+                ASTDefineTemp(ast_, "return_value_", block.get(),
+                              ConstExpr(0), CloneAST(return_type));
+            const ASTIdent* granted = AddLet(ast_, block.get(), "granted_",
+                                             CloneAST(bool_type.get()),
+                                             ConstExpr(0));
+
+            ASTRef<ASTStmtWhile> while_stmt(new ASTStmtWhile());
+            while_stmt->condition.reset(new ASTExpr());
+            while_stmt->condition->op = ASTExpr::NOT;
+            while_stmt->condition->ops.push_back(VarExpr(granted));
+            ASTRef<ASTStmtBlock> loop_body(new ASTStmtBlock());
+            ASTStmtBlock* stage = AddSingleStage(loop_body.get());
+            AddWrite(stage, valid_port, ConstExpr(1));
+            for (unsigned i = 0; i < args.size(); i++) {
+                AddWrite(stage, arg_ports[i], VarExpr(args[i]));
+            }
+            AddAssign(stage, granted, ReadExpr(grant_port));
+            if (resp_port) {
+                AddAssign(stage, result_ident_and_expr.first,
+                          ReadExpr(resp_port));
+            }
+            while_stmt->body = Box(move(loop_body));
+            ASTRef<ASTStmt> while_box(new ASTStmt());
+            while_box->while_ = move(while_stmt);
+            block->stmts.push_back(move(while_box));
+
+            ASTRef<ASTStmt> result_stmt(new ASTStmt());
+            result_stmt->expr.reset(new ASTStmtExpr());
+            result_stmt->expr->expr = move(result_ident_and_expr.second);
+            block->stmts.push_back(move(result_stmt));
+
+            Location loc = node->loc;
+            loop_blocks_.insert(block.get());
+            node.reset(new ASTExpr());
+            node->op = ASTExpr::STMTBLOCK;
+            node->stmt = move(block);
+            node->loc = loc;
+            return VISIT_CONTINUE;
+        }
+
+        // Codegen carries only let-bound values around a loop, so a call's
+        // stall loop must not run while another operand's value is pending.
+        // Each block (innermost first) therefore hoists every expression
+        // whose evaluation may loop, i.e. a call or an expression block that
+        // contains one, into a let of its own ahead of the statement using
+        // it.
+        virtual Result ModifyASTStmtBlockPost(ASTRef<ASTStmtBlock>& node) {
+            ASTVector<ASTStmt> stmts;
+            bool loops = false;
+            for (auto& stmt : node->stmts) {
+                bool stmt_loops = false;
+                if (!HoistStmt(stmt.get(), &stmts, &stmt_loops)) {
+                    return VISIT_END;
+                }
+                if (stmt_loops || Loops(stmt.get())) {
+                    loops = true;
+                }
+                stmts.push_back(move(stmt));
+            }
+            node->stmts.swap(stmts);
+            if (loops) {
+                loop_blocks_.insert(node.get());
+            }
+            return VISIT_CONTINUE;
+        }
+
+    private:
+        AST* ast_;
+        SharedFuncMap* funcs_;
+        const SharedFunc* self_;
+        // Blocks that contain a call's stall loop.
+        set<const ASTStmtBlock*> loop_blocks_;
+
+        // Returns true if |stmt|'s nested bodies contain a call's stall loop.
+        bool Loops(const ASTStmt* stmt) const {
+            if (!stmt) {
+                return false;
+            }
+            if (stmt->block && loop_blocks_.count(stmt->block.get())) {
+                return true;
+            }
+            if (stmt->if_ &&
+                (Loops(stmt->if_->if_body.get()) ||
+                 Loops(stmt->if_->else_body.get()))) {
+                return true;
+            }
+            return (stmt->while_ && Loops(stmt->while_->body.get())) ||
+                   (stmt->spawn && Loops(stmt->spawn->body.get())) ||
+                   (stmt->timing && Loops(stmt->timing->body.get()));
+        }
+
+        // Hoists the looping subexpressions of |expr| into lets appended to
+        // |out|, unless |expr| itself loops and is a whole right-hand side
+        // (|whole|).
+        void HoistExpr(ASTRef<ASTExpr>& expr, bool whole,
+                       ASTVector<ASTStmt>* out, bool* loops) {
+            if (!expr) {
+                return;
+            }
+            if (expr->op == ASTExpr::STMTBLOCK &&
+                loop_blocks_.count(expr->stmt.get())) {
+                *loops = true;
+                if (!whole) {
+                    ASTRef<ASTStmt> let_box(new ASTStmt());
+                    let_box->let.reset(new ASTStmtLet());
+                    let_box->let->lhs = ASTGenSym(ast_, "shared_call_");
+                    let_box->let->rhs = move(expr);
+                    expr = VarExpr(let_box->let->lhs.get());
+                    out->push_back(move(let_box));
+                }
+                return;
+            }
+            for (auto& op : expr->ops) {
+                HoistExpr(op, false, out, loops);
+            }
+        }
+
+        bool HoistStmt(ASTStmt* stmt, ASTVector<ASTStmt>* out, bool* loops) {
+            if (stmt->let) {
+                HoistExpr(stmt->let->rhs, true, out, loops);
+            }
+            if (stmt->assign) {
+                bool var = stmt->assign->lhs->op == ASTExpr::VAR;
+                HoistExpr(stmt->assign->lhs, false, out, loops);
+                HoistExpr(stmt->assign->rhs, var, out, loops);
+            }
+            if (stmt->expr) {
+                HoistExpr(stmt->expr->expr, true, out, loops);
+            }
+            if (stmt->if_) {
+                HoistExpr(stmt->if_->condition, false, out, loops);
+            }
+            if (stmt->write) {
+                HoistExpr(stmt->write->port, false, out, loops);
+                HoistExpr(stmt->write->rhs, false, out, loops);
+            }
+            if (stmt->killif) {
+                HoistExpr(stmt->killif->condition, false, out, loops);
+            }
+            if (stmt->bypassstart) {
+                HoistExpr(stmt->bypassstart->bypass, false, out, loops);
+                HoistExpr(stmt->bypassstart->index, false, out, loops);
+            }
+            if (stmt->bypassend) {
+                HoistExpr(stmt->bypassend->bypass, false, out, loops);
+            }
+            if (stmt->bypasswrite) {
+                HoistExpr(stmt->bypasswrite->bypass, false, out, loops);
+                HoistExpr(stmt->bypasswrite->value, false, out, loops);
+            }
+            if (stmt->while_) {
+                bool cond_loops = false;
+                HoistExpr(stmt->while_->condition, true, out, &cond_loops);
+                if (cond_loops) {
+                    Error(stmt->while_.get(),
+                          "Calls to shared functions are not supported in "
+                          "loop conditions");
+                    return false;
+                }
+            }
+            return true;
+        }
+};
+
+// Builds the shared unit for |func|, once all of its call sites are known.
+ASTRef<ASTFunctionDef> BuildSharedUnit(AST* ast, SharedFunc* func) {
+    const ASTType* return_type = func->def->return_type.get();
+    ASTRef<ASTType> bool_type = NamedType("bool");
+
+    ASTRef<ASTFunctionDef> unit(new ASTFunctionDef());
+    unit->loc = func->def->loc;
+    unit->name.reset(new ASTIdent());
+    unit->name->name = func->prefix;
+    unit->name->type = ASTIdent::FUNC;
+    unit->return_type = NamedType("void");
+    unit->is_entry = true;
+    unit->block.reset(new ASTStmtBlock());
+    ASTStmtBlock* block = unit->block.get();
+
+    vector<const ASTIdent*> valid_ports, grant_ports;
+    vector<vector<const ASTIdent*>> arg_ports;
+    for (int site = 0; site < func->sites; site++) {
+        valid_ports.push_back(AddPortLet(
+                    ast, block, func->PortName("req_valid", site),
+                    bool_type.get(), true));
+        grant_ports.push_back(AddPortLet(
+                    ast, block, func->PortName("grant", site),
+                    bool_type.get(), true));
+        arg_ports.push_back({});
+        for (unsigned i = 0; i < func->params.size(); i++) {
+            arg_ports.back().push_back(AddPortLet(
+                        ast, block, func->ArgPortName(i, site),
+                        func->def->params[i]->type.get(), false));
+        }
+    }
+    const ASTIdent* resp_port = nullptr;
+    if (!IsVoid(return_type)) {
+        resp_port = AddPortLet(ast, block, func->RespPortName(),
+                               return_type, false);
+    }
+
+    ASTStmtBlock* stage = AddSingleStage(block);
+    for (auto& stmt : func->decls->stmts) {
+        stage->stmts.push_back(move(stmt));
+    }
+    const ASTIdent* any = AddLet(ast, stage, "shared_request_",
+                                 CloneAST(bool_type.get()), ConstExpr(0));
+
+    // Fixed-priority arbiter: an if/else-if chain over the requests, built
+    // innermost (lowest-priority) first.
+    ASTRef<ASTStmt> chain;
+    for (int site = 0; site < func->sites; site++) {
+        ASTRef<ASTStmtBlock> served(new ASTStmtBlock());
+        for (unsigned i = 0; i < func->params.size(); i++) {
+            AddAssign(served.get(), func->params[i],
+                      ReadExpr(arg_ports[site][i]));
+        }
+        AddWrite(served.get(), grant_ports[site], ConstExpr(1));
+        AddAssign(served.get(), any, ConstExpr(1));
+
+        ASTRef<ASTStmt> if_box(new ASTStmt());
+        if_box->if_.reset(new ASTStmtIf());
+        if_box->if_->condition = ReadExpr(valid_ports[site]);
+        if_box->if_->if_body = Box(move(served));
+        if_box->if_->else_body = move(chain);
+        chain = move(if_box);
+    }
+    stage->stmts.push_back(move(chain));
+
+    // Only evaluate the body when serving a request.
+    ASTRef<ASTStmtBlock> serve(new ASTStmtBlock());
+    for (auto& stmt : func->body->stmts) {
+        serve->stmts.push_back(move(stmt));
+    }
+    if (resp_port) {
+        AddWrite(serve.get(), resp_port, VarExpr(func->result));
+    }
+    ASTRef<ASTStmt> serve_box(new ASTStmt());
+    serve_box->if_.reset(new ASTStmtIf());
+    serve_box->if_->condition = VarExpr(any);
+    serve_box->if_->if_body = Box(move(serve));
+    stage->stmts.push_back(move(serve_box));
+
+    return unit;
+}
 }  // anonymous namespace
 
 FuncInlinePass::Result
@@ -166,6 +652,11 @@ FuncInlinePass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
             Error(node.get(), strprintf("Unknown function '%s'", name.c_str()));
             return VISIT_END;
         }
+        // Calls to shared functions are rewritten once all inlining is done
+        // (including inlining of the functions that contain them).
+        if (shared_funcs_.count(name)) {
+            return VISIT_CONTINUE;
+        }
 
         // Create a block that will become part of an expression block.
         ASTRef<ASTStmtBlock> block(new ASTStmtBlock());
@@ -200,5 +691,90 @@ FuncInlinePass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
     return VISIT_CONTINUE;
 }
 
+FuncInlinePass::Result
+FuncInlinePass::ModifyASTPost(ASTRef<AST>& node) {
+    if (shared_funcs_.empty()) {
+        return VISIT_CONTINUE;
+    }
+
+    SharedFuncMap funcs;
+    for (auto& p : shared_funcs_) {
+        auto it = function_defs_.find(p.first);
+        if (it == function_defs_.end()) {
+            Error(p.second, strprintf("Unknown shared function '%s'",
+                                      p.first.c_str()));
+            return VISIT_END;
+        }
+        const ASTFunctionDef* def = it->second;
+        if (def->is_entry) {
+            Error(p.second, strprintf("Entry function '%s' cannot be shared",
+                                      p.first.c_str()));
+            return VISIT_END;
+        }
+        for (auto& param : def->params) {
+            const ASTType* type = param->type.get();
+            if (type->is_port || type->is_chan || type->is_reg ||
+                type->is_array || type->is_bypass) {
+                Error(param.get(),
+                      strprintf("Parameter '%s' of shared function '%s' must "
+                                "be a value, not a port, chan, reg, array or "
+                                "bypass", param->ident->name.c_str(),
+                                p.first.c_str()));
+                return VISIT_END;
+            }
+        }
+
+        // Inline the body once, from (clones of) the parameters, which the
+        // unit assigns from whichever request it serves.
+        SharedFunc& func = funcs[p.first];
+        func.def = def;
+        func.prefix = ASTGenSym(ast_, ("shared_" + p.first).c_str())->name;
+        func.decls.reset(new ASTStmtBlock());
+        func.body.reset(new ASTStmtBlock());
+        ASTVector<ASTExpr> args;
+        for (auto& param : def->params) {
+            const ASTIdent* temp = AddLet(
+                    ast_, func.decls.get(), "shared_param_",
+                    CloneAST(param->type.get()), ConstExpr(0));
+            func.params.push_back(temp);
+            args.push_back(VarExpr(temp));
+        }
+        func.result = AddLet(ast_, func.decls.get(), "return_value_",
+                             CloneAST(def->return_type.get()), ConstExpr(0));
+        ASTExpr call;
+        call.loc = def->loc;
+        if (!InlineFunctionBody(ast_, def, &call, func.body.get(),
+                                func.result, move(args), Errors())) {
+            return VISIT_END;
+        }
+    }
+
+    // Rewrite calls in the entry functions, then in the units' bodies, in
+    // program order so that site numbering (and priority) is stable.
+    ASTVisitor visitor;
+    for (auto& func : node->functions) {
+        if (!func->is_entry) {
+            continue;
+        }
+        SharedCallRewriter rewriter(ast_, &funcs, nullptr, Errors());
+        if (!visitor.ModifyASTFunctionDef(func, &rewriter)) {
+            return VISIT_END;
+        }
+    }
+    for (auto& p : funcs) {
+        SharedCallRewriter rewriter(ast_, &funcs, &p.second, Errors());
+        if (!visitor.ModifyASTStmtBlock(p.second.body, &rewriter)) {
+            return VISIT_END;
+        }
+    }
+
+    for (auto& p : funcs) {
+        if (p.second.sites > 0) {
+            node->functions.push_back(BuildSharedUnit(ast_, &p.second));
+        }
+    }
+    return VISIT_CONTINUE;
+}
+
 }  // namesapce frontend
 }  // namespace autopiper
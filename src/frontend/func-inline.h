@@ -37,6 +37,11 @@ namespace frontend {
 //   }
 // }
 // rewrite use of f(x) with $temp$
+//
+// A function named by a 'pragma shared_func = "f";' is instead compiled once,
+// as its own entry function (a shared unit), and each call becomes a request
+// to that unit over a set of ports: see the comment on SharedFuncBuilder in
+// func-inline.cc.
 class FuncInlinePass : public ASTVisitorContext {
     public:
         FuncInlinePass(autopiper::ErrorCollector* coll);
@@ -48,6 +53,8 @@ class FuncInlinePass : public ASTVisitorContext {
         // Visit pass -- make note of all function defs.
         virtual Result VisitASTFunctionDefPre(
                 const ASTFunctionDef* node);
+        // Visit pass -- make note of shared functions.
+        virtual Result VisitASTPragmaPre(const ASTPragma* node);
 
         // To do the modification, we have a post-pass on ASTExpr
         // that replaces a function call expr with a statement-block expr whose
@@ -61,9 +68,16 @@ class FuncInlinePass : public ASTVisitorContext {
             ast_ = node.get();
             return VISIT_CONTINUE;
         }
+
+        // Once all inlining is done, build the shared units and rewrite the
+        // calls to them.
+        virtual Result ModifyASTPost(ASTRef<AST>& node);
     private:
         // map from function names to ASTFunctionDefs.
         std::map<const std::string, const ASTFunctionDef*> function_defs_;
+        // names of functions to compile as shared units, and the pragmas
+        // that named them.
+        std::map<std::string, const ASTPragma*> shared_funcs_;
 
         AST* ast_;
 };
@@ -0,0 +1,502 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frontend/library.h"
+#include "common/binary-format.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <string.h>
+
+using namespace std;
+
+namespace autopiper {
+namespace frontend {
+
+// Precompiled library format.
+//
+// A precompiled library holds a Library's macros and its AST as parsed, so
+// that loading it skips the lexer, the macro expander and the parser.
+// Integers, strings and bignums are encoded as in common/binary-format.h.
+// The file is:
+//
+//     magic "APLIBBIN", version
+//     string table: count, then (length, bytes) per string
+//     macros: count, then per macro, in name order:
+//         name (string), arms: count, then per arm,
+//             pattern: count, then (type, name (string)) per token,
+//             body: count, then (type, arg (string), literal) per token,
+//         where a literal is a token: type, int_literal (bignum),
+//         s (string), line, column
+//     functions, types and pragmas: count, then node per node
+//
+// A node is its location and then its fields, in the order Fields() below
+// lists them. A location's line is stored as the difference (signed) from
+// the previous node's. An optional child is preceded by 1 if present and 0
+// if not, except for a statement's alternatives, which are preceded by a
+// bitmask of those present (nearly always just one).
+//
+// Fields derived by later passes (inferred types, widths, definitions
+// linked by scope resolution) are not stored, since the AST is only ever
+// cloned before they are computed.
+
+namespace {
+
+const char kLibraryMagic[8] = { 'A', 'P', 'L', 'I', 'B', 'B', 'I', 'N' };
+const int kLibraryVersion = 1;
+
+// Each type's fields, for both the writer and the reader (the Codec). The
+// writer only reads them, but they take the nodes as non-const to be shared.
+#define FIELDS(type) \
+    template<typename Codec> void Fields(Codec* c, type* node)
+#define SUB(name) c->Sub(node->name)
+#define VEC(name) c->Vec(node->name)
+#define LIST(name) c->List(node->name)
+#define PRIM(name) c->Prim(node->name)
+#define ENUM(name, last) c->Enum(node->name, last)
+
+FIELDS(Token) {
+    ENUM(type, Token::LEXERERROR);
+    PRIM(int_literal);
+    PRIM(s);
+    PRIM(line);
+    PRIM(col);
+}
+
+FIELDS(Macro::PatternToken) {
+    ENUM(type, Macro::PatternToken::ARGREST);
+    PRIM(name);
+}
+
+FIELDS(Macro::BodyToken) {
+    ENUM(type, Macro::BodyToken::LITERAL);
+    PRIM(arg);
+    c->Struct(node->literal);
+}
+
+FIELDS(Macro::Arm) {
+    LIST(pattern);
+    LIST(body);
+}
+
+FIELDS(Macro) {
+    PRIM(name);
+    LIST(arms);
+}
+
+FIELDS(AST) {
+    VEC(functions);
+    VEC(types);
+    VEC(pragmas);
+}
+
+FIELDS(ASTFunctionDef) {
+    SUB(name);
+    SUB(return_type);
+    VEC(params);
+    SUB(block);
+    PRIM(is_entry);
+    PRIM(lanes);
+}
+
+FIELDS(ASTParam) {
+    SUB(ident);
+    SUB(type);
+}
+
+FIELDS(ASTTypeDef) {
+    SUB(ident);
+    SUB(alias);
+    VEC(fields);
+}
+
+FIELDS(ASTTypeField) {
+    SUB(ident);
+    SUB(type);
+}
+
+FIELDS(ASTIdent) {
+    PRIM(name);
+    ENUM(type, ASTIdent::INTERNAL_PORT);
+}
+
+FIELDS(ASTType) {
+    SUB(ident);
+    PRIM(is_port);
+    PRIM(is_chan);
+    PRIM(is_reg);
+    PRIM(is_array);
+    PRIM(array_length);
+    PRIM(is_bypass);
+}
+
+FIELDS(ASTStmt) {
+    c->Subs(node->block, node->let, node->assign, node->if_, node->while_,
+            node->break_, node->continue_, node->write, node->spawn,
+            node->return_, node->kill, node->killyounger, node->killif,
+            node->timing, node->stage, node->expr, node->nested,
+            node->onkillyounger, node->bypassstart, node->bypassend,
+            node->bypasswrite);
+}
+
+FIELDS(ASTStmtBlock) {
+    VEC(stmts);
+}
+
+FIELDS(ASTStmtLet) {
+    SUB(lhs);
+    SUB(type);
+    SUB(rhs);
+}
+
+FIELDS(ASTStmtAssign) {
+    SUB(lhs);
+    SUB(rhs);
+}
+
+FIELDS(ASTStmtIf) {
+    SUB(condition);
+    SUB(if_body);
+    SUB(else_body);
+}
+
+FIELDS(ASTStmtWhile) {
+    SUB(condition);
+    SUB(body);
+    SUB(label);
+    PRIM(pipelined);
+}
+
+FIELDS(ASTStmtBreak) {
+    SUB(label);
+}
+
+FIELDS(ASTStmtContinue) {
+    SUB(label);
+}
+
+FIELDS(ASTStmtWrite) {
+    SUB(port);
+    SUB(rhs);
+}
+
+FIELDS(ASTStmtSpawn) {
+    SUB(body);
+}
+
+FIELDS(ASTStmtReturn) {
+    SUB(value);
+}
+
+FIELDS(ASTStmtKill) {
+}
+
+FIELDS(ASTStmtKillYounger) {
+}
+
+FIELDS(ASTStmtKillIf) {
+    SUB(condition);
+}
+
+FIELDS(ASTStmtTiming) {
+    SUB(body);
+}
+
+FIELDS(ASTStmtStage) {
+    PRIM(offset);
+}
+
+FIELDS(ASTStmtExpr) {
+    SUB(expr);
+}
+
+FIELDS(ASTStmtNestedFunc) {
+    SUB(body);
+}
+
+FIELDS(ASTStmtOnKillYounger) {
+    SUB(body);
+}
+
+FIELDS(ASTStmtBypassStart) {
+    SUB(bypass);
+    SUB(index);
+}
+
+FIELDS(ASTStmtBypassEnd) {
+    SUB(bypass);
+}
+
+FIELDS(ASTStmtBypassWrite) {
+    SUB(bypass);
+    SUB(value);
+}
+
+FIELDS(ASTExpr) {
+    ENUM(op, ASTExpr::NOP);
+    VEC(ops);
+    SUB(ident);
+    PRIM(constant);
+    PRIM(has_constant);
+    PRIM(read_latency);
+    SUB(stmt);
+    SUB(cast_type);
+}
+
+FIELDS(ASTPragma) {
+    PRIM(key);
+    PRIM(value);
+}
+
+#undef FIELDS
+#undef SUB
+#undef VEC
+#undef LIST
+#undef PRIM
+#undef ENUM
+
+class LibraryWriter : public BinaryEncoder {
+    public:
+        LibraryWriter() : last_line_(0) {}
+
+        void Write(const Library* library, ostream* out) {
+            // Macros are written in name order, so that the same library
+            // always produces the same file.
+            vector<const Macro*> macros;
+            for (auto& p : library->macros) {
+                macros.push_back(&p.second);
+            }
+            sort(macros.begin(), macros.end(),
+                 [](const Macro* a, const Macro* b) {
+                     return a->name < b->name;
+                 });
+            PutVarint(&body_, macros.size());
+            for (auto* macro : macros) {
+                Fields(this, const_cast<Macro*>(macro));
+            }
+            Fields(this, library->ast.get());
+
+            string header(kLibraryMagic, sizeof(kLibraryMagic));
+            PutVarint(&header, kLibraryVersion);
+            PutStringTable(&header);
+            out->write(header.data(), header.size());
+            out->write(body_.data(), body_.size());
+        }
+
+        template<typename T>
+        void Sub(const ASTRef<T>& node) {
+            PutVarint(&body_, node ? 1 : 0);
+            WriteIfPresent(node);
+        }
+
+        template<typename T>
+        void Vec(const ASTVector<T>& nodes) {
+            PutVarint(&body_, nodes.size());
+            for (auto& node : nodes) {
+                Node(node.get());
+            }
+        }
+
+        template<typename... Ts>
+        void Subs(const ASTRef<Ts>&... nodes) {
+            unsigned long long mask = 0, bit = 1;
+            int expand[] = { (mask |= nodes ? bit : 0, bit <<= 1, 0)... };
+            PutVarint(&body_, mask);
+            int expand_nodes[] = { (WriteIfPresent(nodes), 0)... };
+            (void)expand;
+            (void)expand_nodes;
+        }
+
+        template<typename T>
+        void List(vector<T>& items) {
+            PutVarint(&body_, items.size());
+            for (auto& item : items) {
+                Fields(this, &item);
+            }
+        }
+
+        template<typename T>
+        void Struct(T& item) {
+            Fields(this, &item);
+        }
+
+        template<typename E>
+        void Enum(E value, E last) {
+            PutVarint(&body_, value);
+        }
+
+        void Prim(bool value) { PutVarint(&body_, value ? 1 : 0); }
+        void Prim(int value) { PutSigned(&body_, value); }
+        void Prim(const string& value) { PutString(&body_, value); }
+        void Prim(const ASTBignum& value) { PutBignum(&body_, value); }
+
+    private:
+        string body_;
+        int last_line_;
+
+        template<typename T>
+        void Node(T* node) {
+            PutString(&body_, node->loc.filename);
+            PutSigned(&body_, node->loc.line - last_line_);
+            PutVarint(&body_, node->loc.column);
+            last_line_ = node->loc.line;
+            Fields(this, node);
+        }
+
+        template<typename T>
+        void WriteIfPresent(const ASTRef<T>& node) {
+            if (node) {
+                Node(node.get());
+            }
+        }
+};
+
+class LibraryReader : public BinaryDecoder {
+    public:
+        LibraryReader(const string& filename, const char* data, size_t size,
+                      ErrorCollector* coll)
+            : BinaryDecoder(filename, data, size, coll,
+                            "precompiled library"),
+              last_line_(0) {}
+
+        shared_ptr<Library> Read(const string& filename) {
+            if (!GetHeader(kLibraryMagic, sizeof(kLibraryMagic),
+                           kLibraryVersion, "precompiled library")) {
+                return nullptr;
+            }
+            GetStringTable();
+
+            shared_ptr<Library> library(new Library());
+            library->filename = filename;
+            unsigned long long macro_count = GetCount();
+            for (unsigned long long i = 0; ok() && i < macro_count; i++) {
+                Macro macro;
+                Fields(this, &macro);
+                if (ok()) {
+                    Symbol name = macro.name;
+                    library->macros[name] = move(macro);
+                }
+            }
+            library->ast.reset(new AST());
+            if (ok()) Fields(this, library->ast.get());
+            if (ok() && !AtEnd()) {
+                Error("Trailing data after precompiled library");
+            }
+            if (!ok()) return nullptr;
+            return library;
+        }
+
+        template<typename T>
+        void Sub(ASTRef<T>& node) {
+            ReadIf(GetVarint() != 0, node);
+        }
+
+        template<typename T>
+        void Vec(ASTVector<T>& nodes) {
+            unsigned long long count = GetCount();
+            for (unsigned long long i = 0; ok() && i < count; i++) {
+                ASTRef<T> node(new T());
+                Node(node.get());
+                nodes.push_back(move(node));
+            }
+        }
+
+        template<typename... Ts>
+        void Subs(ASTRef<Ts>&... nodes) {
+            unsigned long long mask = GetVarint(), bit = 1;
+            if (mask >> sizeof...(Ts)) {
+                Error("Malformed statement in precompiled library");
+                return;
+            }
+            int expand[] = { (ReadIf((mask & bit) != 0, nodes),
+                              bit <<= 1, 0)... };
+            (void)expand;
+        }
+
+        template<typename T>
+        void List(vector<T>& items) {
+            unsigned long long count = GetCount();
+            for (unsigned long long i = 0; ok() && i < count; i++) {
+                items.push_back(T());
+                Fields(this, &items.back());
+            }
+        }
+
+        template<typename T>
+        void Struct(T& item) {
+            Fields(this, &item);
+        }
+
+        template<typename E>
+        void Enum(E& value, E last) {
+            value = static_cast<E>(GetIndex(last + 1));
+        }
+
+        void Prim(bool& value) { value = GetVarint() != 0; }
+        void Prim(int& value) { value = static_cast<int>(GetSigned()); }
+        void Prim(Symbol& value) { value = Symbol(GetString()); }
+        void Prim(string& value) { value = GetString(); }
+        void Prim(ASTBignum& value) { value = GetBignum<ASTBignum>(); }
+
+    private:
+        int last_line_;
+
+        template<typename T>
+        void Node(T* node) {
+            node->loc.filename = GetString();
+            node->loc.line = last_line_ + static_cast<int>(GetSigned());
+            node->loc.column = GetInt();
+            last_line_ = node->loc.line;
+            Fields(this, node);
+        }
+
+        template<typename T>
+        void ReadIf(bool present, ASTRef<T>& node) {
+            if (present && ok()) {
+                node.reset(new T());
+                Node(node.get());
+            }
+        }
+};
+
+}  // anonymous namespace
+
+void Library::WriteBinary(ostream* out) const {
+    LibraryWriter writer;
+    writer.Write(this, out);
+}
+
+bool Library::IsBinary(const char* data, size_t size) {
+    return size >= sizeof(kLibraryMagic) &&
+           memcmp(data, kLibraryMagic, sizeof(kLibraryMagic)) == 0;
+}
+
+shared_ptr<Library> Library::ParseBinary(const string& filename,
+                                         const char* data, size_t size,
+                                         ErrorCollector* coll) {
+    // As for a library parsed from source, the nodes come from the heap.
+    ASTArenaScope heap(nullptr);
+    LibraryReader reader(filename, data, size, coll);
+    shared_ptr<Library> library = reader.Read(filename);
+    if (library) {
+        library->FindCallees();
+    }
+    return library;
+}
+
+}  // namespace frontend
+}  // namespace autopiper
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frontend/library.h"
+#include "frontend/parser.h"
+#include "frontend/visitor.h"
+#include "common/build-cache.h"
+
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace autopiper {
+namespace frontend {
+
+namespace {
+
+bool ReadFile(const string& filename, string* contents,
+              ErrorCollector* coll) {
+    ifstream in(filename, ios::binary);
+    if (!in.good()) {
+        Location loc;
+        loc.filename = filename;
+        loc.line = loc.column = 0;
+        coll->ReportError(loc, ErrorCollector::ERROR,
+                          string("Could not open library '") + filename +
+                          string("'"));
+        return false;
+    }
+    ostringstream os;
+    os << in.rdbuf();
+    *contents = os.str();
+    return true;
+}
+
+shared_ptr<const Library> ParseLibrary(const string& filename,
+                                       const string& source,
+                                       ErrorCollector* coll) {
+    // The library outlives whichever compile loads it, so its nodes come
+    // from the heap even if that compile has an arena open.
+    ASTArenaScope heap(nullptr);
+
+    // Temporaries from the library's macro expansions are named after the
+    // library, so that they cannot collide with the design's or another
+    // library's.
+    ContentHash name_hash;
+    name_hash.Add(filename);
+
+    istringstream in(source);
+    LexerImpl lexer(&in);
+    MacroExpander macro(&lexer, coll, vector<const Macro*>(),
+                        "__macro__temp__" + name_hash.Hex() + "_");
+    shared_ptr<Library> library(new Library());
+    library->filename = filename;
+    library->ast.reset(new AST());
+    Parser parser(filename, &macro, coll);
+    if (!parser.Parse(library->ast.get()) || coll->HasErrors()) {
+        return nullptr;
+    }
+    library->macros = macro.macros();
+    library->FindCallees();
+    return library;
+}
+
+shared_ptr<const Library> ParseContents(const string& filename,
+                                        const string& contents,
+                                        ErrorCollector* coll) {
+    if (Library::IsBinary(contents.data(), contents.size())) {
+        return Library::ParseBinary(filename, contents.data(),
+                                    contents.size(), coll);
+    }
+    return ParseLibrary(filename, contents, coll);
+}
+
+// Collects the names of the functions that a subtree calls.
+class CallCollector : public ASTVisitorContext {
+    public:
+        explicit CallCollector(vector<Symbol>* calls) : calls_(calls) {}
+
+    protected:
+        virtual Result VisitASTExprPre(const ASTExpr* node) {
+            if (node->op == ASTExpr::FUNCCALL) {
+                calls_->push_back(node->ident->name);
+            }
+            return VISIT_CONTINUE;
+        }
+
+    private:
+        vector<Symbol>* calls_;
+};
+
+}  // anonymous namespace
+
+shared_ptr<const Library> Library::Load(const string& filename,
+                                        ErrorCollector* coll) {
+    string source;
+    if (!ReadFile(filename, &source, coll)) {
+        return nullptr;
+    }
+    return ParseContents(filename, source, coll);
+}
+
+void Library::FindCallees() {
+    callees.clear();
+    function_index.clear();
+    ASTVisitor visitor;
+    for (unsigned i = 0; i < ast->functions.size(); i++) {
+        const ASTFunctionDef* func = ast->functions[i].get();
+        function_index.insert(make_pair(func->name->name, i));
+        callees.push_back(vector<Symbol>());
+        CallCollector collector(&callees.back());
+        visitor.VisitASTFunctionDef(func, &collector);
+    }
+}
+
+void Library::GetMacros(vector<const Macro*>* out) const {
+    for (auto& macro : macros) {
+        out->push_back(&macro.second);
+    }
+}
+
+void Library::AddTo(AST* target) const {
+    // A function that nothing reaches would only be type-checked and then
+    // dropped, which for a large library is most of the frontend's work.
+    vector<Symbol> worklist;
+    CallCollector collector(&worklist);
+    ASTVisitor visitor;
+    visitor.VisitAST(target, &collector);
+    auto add_shared_funcs = [&worklist](const AST* source) {
+        for (auto& pragma : source->pragmas) {
+            if (pragma->key == "shared_func") {
+                worklist.push_back(pragma->value);
+            }
+        }
+    };
+    add_shared_funcs(target);
+    add_shared_funcs(ast.get());
+    for (auto& func : ast->functions) {
+        if (func->is_entry) {
+            worklist.push_back(func->name->name);
+        }
+    }
+    vector<bool> reached(ast->functions.size(), false);
+    while (!worklist.empty()) {
+        Symbol name = worklist.back();
+        worklist.pop_back();
+        auto range = function_index.equal_range(name);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (reached[it->second]) continue;
+            reached[it->second] = true;
+            worklist.insert(worklist.end(), callees[it->second].begin(),
+                            callees[it->second].end());
+        }
+    }
+
+    ASTVector<ASTFunctionDef> functions;
+    for (unsigned i = 0; i < ast->functions.size(); i++) {
+        if (reached[i]) {
+            functions.push_back(CloneAST(ast->functions[i].get()));
+        }
+    }
+    target->functions.insert(target->functions.begin(),
+                             make_move_iterator(functions.begin()),
+                             make_move_iterator(functions.end()));
+
+    ASTVector<ASTTypeDef> types;
+    for (auto& type : ast->types) {
+        types.push_back(CloneAST(type.get()));
+    }
+    target->types.insert(target->types.begin(),
+                         make_move_iterator(types.begin()),
+                         make_move_iterator(types.end()));
+
+    ASTVector<ASTPragma> pragmas;
+    for (auto& pragma : ast->pragmas) {
+        pragmas.push_back(CloneAST(pragma.get()));
+    }
+    target->pragmas.insert(target->pragmas.begin(),
+                           make_move_iterator(pragmas.begin()),
+                           make_move_iterator(pragmas.end()));
+}
+
+shared_ptr<const Library> LibraryCache::Get(const string& filename,
+                                            ErrorCollector* coll) {
+    string source;
+    if (!ReadFile(filename, &source, coll)) {
+        return nullptr;
+    }
+    ContentHash hash;
+    hash.Add(source);
+    string key = hash.Hex();
+    {
+        lock_guard<mutex> l(mutex_);
+        auto it = entries_.find(filename);
+        if (it != entries_.end() && it->second.hash == key) {
+            return it->second.library;
+        }
+    }
+
+    // Parse outside the lock, so that compiles which need other (or cached)
+    // libraries are not held up. Two compiles that miss on the same library
+    // at once both parse it; either result may then be kept.
+    shared_ptr<const Library> library = ParseContents(filename, source, coll);
+    if (library) {
+        lock_guard<mutex> l(mutex_);
+        Entry& entry = entries_[filename];
+        entry.hash = key;
+        entry.library = library;
+    }
+    return library;
+}
+
+}  // namespace frontend
+}  // namespace autopiper
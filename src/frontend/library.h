@@ -0,0 +1,110 @@
+/*
+ * Copyright 2014 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUTOPIPER_FRONTEND_LIBRARY_H_
+#define _AUTOPIPER_FRONTEND_LIBRARY_H_
+
+#include "frontend/ast.h"
+#include "frontend/macro.h"
+#include "common/error-collector.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace autopiper {
+namespace frontend {
+
+// A library: a source file of macros, functions and types that many designs
+// share, named with --library rather than pasted into each design. Its macros
+// are visible throughout the design's source, and its functions, types and
+// pragmas become part of the design's AST, ahead of the design's own -- but
+// only the functions that the design can reach: those it calls, directly or
+// through other library functions, entry functions and shared functions.
+//
+// A library is parsed on its own, so it cannot use the design's macros. Its
+// AST lives on the heap, not in any compilation's arena, and is only ever
+// cloned from, so one parsed library may be shared by concurrent compiles.
+//
+// A library may also be precompiled (autopiper --precompile-library): its
+// macros and parsed AST are then stored in a binary file, which loads
+// without lexing, expanding or parsing anything. Load() takes either form.
+struct Library {
+    std::string filename;
+    std::unordered_map<Symbol, Macro> macros;
+    std::unique_ptr<AST> ast;
+
+    // The names each of |ast|'s functions calls, and each function's index
+    // by name; derived by FindCallees().
+    std::vector<std::vector<Symbol>> callees;
+    std::multimap<Symbol, int> function_index;
+
+    // Parses the library in |filename|, in source or precompiled form.
+    // Returns null, having reported why to |coll|, if it cannot be read or
+    // parsed.
+    static std::shared_ptr<const Library> Load(const std::string& filename,
+                                               ErrorCollector* coll);
+
+    // Writes the library in precompiled form.
+    void WriteBinary(std::ostream* out) const;
+    // Whether |data| is a precompiled library.
+    static bool IsBinary(const char* data, size_t size);
+    // Parses a precompiled library. Returns null, having reported why to
+    // |coll|, if it is malformed.
+    static std::shared_ptr<Library> ParseBinary(const std::string& filename,
+                                                const char* data, size_t size,
+                                                ErrorCollector* coll);
+
+    void FindCallees();
+
+    // The library's macros, to predefine in a design's MacroExpander.
+    void GetMacros(std::vector<const Macro*>* out) const;
+
+    // Prepends copies of the library's types and pragmas, and of the
+    // functions that |ast| can reach, to |ast|'s.
+    void AddTo(AST* ast) const;
+};
+
+// Parsed libraries, kept between the compiles of a compile server so that
+// each library is parsed once rather than once per design. An entry is
+// reused until its file's contents change. Safe to use from several threads.
+class LibraryCache {
+    public:
+        LibraryCache() {}
+
+        // Returns the parsed library in |filename|, parsing it unless an
+        // unchanged copy is cached. Returns null, having reported why to
+        // |coll|, if it cannot be read or parsed.
+        std::shared_ptr<const Library> Get(const std::string& filename,
+                                           ErrorCollector* coll);
+
+    private:
+        struct Entry {
+            std::string hash;
+            std::shared_ptr<const Library> library;
+        };
+        std::mutex mutex_;
+        std::map<std::string, Entry> entries_;
+};
+
+}  // namespace frontend
+}  // namespace autopiper
+
+#endif  // _AUTOPIPER_FRONTEND_LIBRARY_H_
@@ -79,25 +79,35 @@ static bool SplitListArg(vector<Token>& list, vector<vector<Token>>& out) {
     return true;
 }
 
-static bool IsMacroIdent(Token tok) {
+static bool IsMacroIdent(const Token& tok) {
     return tok.type == Token::IDENT &&
            !tok.s.empty() &&
            tok.s[tok.s.size() - 1] == '!';
 }
 
 
-MacroExpander::MacroExpander(Lexer* input, ErrorCollector* coll) {
+MacroExpander::MacroExpander(Lexer* input, ErrorCollector* coll,
+                             const vector<const Macro*>& predefined,
+                             const string& temp_prefix) {
     input_ = input;
     input_->SetIgnoreNewline(true);
     coll_ = coll;
+    temp_prefix_ = temp_prefix;
     temp_num_ = 0;
     InputFill();
+    for (auto* macro : predefined) {
+        if (!macros_.insert(make_pair(macro->name, *macro)).second) {
+            Error(strprintf("Macro redefinition: name '%s' already defined",
+                        macro->name.c_str()));
+            return;
+        }
+    }
     Fill();
 }
 
 // -------- Peek/Have/ReadNext on output. Pulls from output queue. -------------
 
-Token MacroExpander::Peek() const {
+const Token& MacroExpander::Peek() const {
     return output_queue_.front();
 }
 
@@ -506,7 +516,7 @@ static bool MatchArgs(
         vector<Macro::PatternToken>::iterator pat_begin,
         vector<Macro::PatternToken>::iterator pat_end,
         vector<vector<Token>>& args,
-        map<string, vector<Token>>& argmap) {
+        unordered_map<Symbol, vector<Token>>& argmap) {
     auto arg_it = args.begin();
 
     for (; pat_begin != pat_end; /* advanced manually */) {
@@ -593,7 +603,7 @@ bool MacroExpander::ArmPatternMatch(
         vector<vector<Token>>& args,
         MacroExpansion* exp) {
 
-    map<string, vector<Token>> argmap;
+    unordered_map<Symbol, vector<Token>> argmap;
     if (!MatchArgs(arm->pattern.begin(), arm->pattern.end(), args, argmap)) {
         return false;
     }
@@ -626,10 +636,10 @@ bool MacroExpander::ExpandIntoQueue(Macro* macro, MacroExpansion* exp) {
 
             case Macro::BodyToken::TEMP: {
                 auto it = exp->temps.find(tok.arg);
-                string temptok;
+                Symbol temptok;
                 if (it == exp->temps.end()) {
                     ostringstream os;
-                    os << "__macro__temp__" << (temp_num_++);
+                    os << temp_prefix_ << (temp_num_++);
                     temptok = os.str();
                     exp->temps[tok.arg] = temptok;
                 } else {
@@ -674,7 +684,7 @@ bool MacroExpander::ExpandIntoQueue(Macro* macro, MacroExpansion* exp) {
                 return false;
             }
             Token ident = expansion[i];
-            ident.s += expansion[i + 1].s;
+            ident.s = ident.s + expansion[i + 1].s;
             concatseq.push_back(ident);
             ++i;
             ++concat_it;
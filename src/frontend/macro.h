@@ -20,9 +20,9 @@
 #include "common/parser-utils.h"
 
 #include <vector>
-#include <map>
 #include <string>
 #include <deque>
+#include <unordered_map>
 
 namespace autopiper {
 namespace frontend {
@@ -74,7 +74,7 @@ namespace frontend {
 //   current macro expansion, consistent for all uses with the same <tempname>.
 
 struct Macro {
-    std::string name;
+    Symbol name;
     struct PatternToken {
         enum Type {
             STARTLIST,
@@ -82,7 +82,7 @@ struct Macro {
             ARG,
             ARGREST,
         } type;
-        std::string name;
+        Symbol name;
     };
     struct BodyToken {
         enum Type {
@@ -92,7 +92,7 @@ struct Macro {
             LITERAL,
         } type;
 
-        std::string arg;
+        Symbol arg;
         Token literal;
     };
 
@@ -106,27 +106,42 @@ struct Macro {
 struct MacroExpansion {
     Macro* macro;
     int arm;
-    std::map<std::string, std::vector<Token>> arg_bindings;
-    std::map<std::string, std::string> temps;
+    std::unordered_map<Symbol, std::vector<Token>> arg_bindings;
+    std::unordered_map<Symbol, Symbol> temps;
 };
 
 class MacroExpander : public Lexer {
     public:
-        MacroExpander(Lexer* input, ErrorCollector* coll);
-
-        virtual Token Peek() const;
+        // |predefined| macros (e.g. a library's) are visible from the start
+        // of the input, as if defined there. Temporaries that expansions
+        // create are named with |temp_prefix|, so that the output of two
+        // expanders can be combined (a library's with a design's) without
+        // their temporaries colliding.
+        MacroExpander(Lexer* input, ErrorCollector* coll,
+                      const std::vector<const Macro*>& predefined =
+                          std::vector<const Macro*>(),
+                      const std::string& temp_prefix = "__macro__temp__");
+
+        virtual const Token& Peek() const;
         virtual bool Have() const;
         virtual bool ReadNext();
 
         // always true -- just ignore this call.
         virtual void SetIgnoreNewline(bool ignore_newline) {}
 
+        // The macros defined so far (all of them, once the input is
+        // exhausted).
+        const std::unordered_map<Symbol, Macro>& macros() const {
+            return macros_;
+        }
+
     private:
         Lexer* input_;
-        std::map<std::string, Macro> macros_;
+        std::unordered_map<Symbol, Macro> macros_;
         std::deque<Token> input_queue_;
         std::deque<Token> output_queue_;
         Location input_loc_;
+        std::string temp_prefix_;
         int temp_num_;
 
         ErrorCollector* coll_;
@@ -25,8 +25,7 @@ int main(int argc, const char* const* argv) {
     autopiper::frontend::FrontendCmdlineDriver driver;
     try {
         driver.ParseArgs(argc - 1, argv + 1);
-        driver.Execute();
-        return 0;
+        return driver.Execute();
     } catch (autopiper::Exception& e) {
         cerr << "Error: " << e.what() << endl;
         return 1;
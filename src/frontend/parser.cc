@@ -119,9 +119,20 @@ bool Parser::ParseFuncDef(ASTFunctionDef* def) {
         if (!Expect(Token::IDENT)) {
             return false;
         }
+        // 'func entry lanes N name(...)', unless the function is itself
+        // named 'lanes'.
+        if (CurToken().s == "lanes") {
+            Consume();
+            if (TryExpect(Token::INT_LITERAL)) {
+                def->lanes = CurToken().int_literal;
+                Consume();
+            } else {
+                def->name->name = "lanes";
+            }
+        }
     }
 
-    if (!ParseIdent(def->name.get())) {
+    if (def->name->name.empty() && !ParseIdent(def->name.get())) {
         return false;
     }
     def->name->type = ASTIdent::FUNC;
@@ -316,6 +327,40 @@ bool Parser::ParseStmt(ASTStmt* st) {
         return ParseBlock(st->block.get());
     }
 
+    // A statement-level pragma qualifies the statement that follows it.
+    // The only one so far is 'pragma pipeline = "true";' before a while loop.
+    if (TryExpect(Token::IDENT) && CurToken().s == "pragma") {
+        Consume();
+        if (!Expect(Token::IDENT)) {
+            return false;
+        }
+        if (CurToken().s != "pipeline") {
+            Error("Only 'pipeline' pragma is allowed before a statement.");
+            return false;
+        }
+        Consume();
+        if (!Consume(Token::EQUALS)) {
+            return false;
+        }
+        if (!Expect(Token::QUOTED_STRING)) {
+            return false;
+        }
+        bool pipelined = CurToken().s == "true";
+        Consume();
+        if (!Consume(Token::SEMICOLON)) {
+            return false;
+        }
+        if (!ParseStmt(st)) {
+            return false;
+        }
+        if (!st->while_) {
+            Error("Pipeline pragma must be followed by a while loop.");
+            return false;
+        }
+        st->while_->pipelined = pipelined;
+        return true;
+    }
+
 #define HANDLE_STMT_TYPE(str, field, name)                   \
     if (TryExpect(Token::IDENT) && CurToken().s == str) {    \
         Consume();                                           \
@@ -848,7 +893,7 @@ ASTRef<ASTExpr> Parser::ParseExprGroup11() {
 // concatenation
 ASTRef<ASTExpr> Parser::ParseExprAtom() {
     if (TryExpect(Token::IDENT)) {
-        const string& ident = CurToken().s;
+        Symbol ident = CurToken().s;
         ASTRef<ASTExpr> ret = New<ASTExpr>();
         ret->ident = New<ASTIdent>();
 
@@ -874,13 +919,20 @@ ASTRef<ASTExpr> Parser::ParseExprAtom() {
                 ret->ident->type = ASTIdent::PORT;
                 Consume();
             }
-            if (TryExpect(Token::IDENT) && CurToken().s == "default") {
+            // Options, in any order: 'default N', 'latency N'.
+            while (TryExpect(Token::IDENT) &&
+                   (CurToken().s == "default" || CurToken().s == "latency")) {
+                bool dflt = CurToken().s == "default";
                 Consume();
                 if (!Expect(Token::INT_LITERAL)) {
                     return astnull<ASTExpr>();
                 }
-                ret->constant = CurToken().int_literal;
-                ret->has_constant = true;
+                if (dflt) {
+                    ret->constant = CurToken().int_literal;
+                    ret->has_constant = true;
+                } else {
+                    ret->read_latency = CurToken().int_literal;
+                }
                 Consume();
             }
             return ret;
@@ -889,6 +941,22 @@ ASTRef<ASTExpr> Parser::ParseExprAtom() {
         if (ident == "array") {
             Consume();
             ret->op = ASTExpr::ARRAY_INIT;
+            // Options, in any order: 'banks N', 'latency N'.
+            while (TryExpect(Token::IDENT) &&
+                   (CurToken().s == "banks" || CurToken().s == "latency")) {
+                bool banks = CurToken().s == "banks";
+                Consume();
+                if (!Expect(Token::INT_LITERAL)) {
+                    return astnull<ASTExpr>();
+                }
+                if (banks) {
+                    ret->constant = CurToken().int_literal;
+                    ret->has_constant = true;
+                } else {
+                    ret->read_latency = CurToken().int_literal;
+                }
+                Consume();
+            }
             return ret;
         }
 
@@ -966,6 +1034,12 @@ ASTRef<ASTExpr> Parser::ParseExprAtom() {
             return ret;
         }
 
+        if (ident == "lane") {
+            Consume();
+            ret->op = ASTExpr::LANE;
+            return ret;
+        }
+
         if (ident == "expr") {
             Consume();
             ret->op = ASTExpr::STMTBLOCK;
@@ -20,7 +20,7 @@
 #include <vector>
 #include <memory>
 #include <string>
-#include <map>
+#include <unordered_map>
 
 #include "frontend/ast.h"
 #include "common/parser-utils.h"
@@ -109,7 +109,7 @@ class Parser : public ParserBase {
             ExprGroupParser next_level>
         bool ParseLeftAssocBinopsRHS(ASTExpr* expr);
 
-        std::map<std::string, ASTBignum> consts_;
+        std::unordered_map<Symbol, ASTBignum> consts_;
 };
 
 }  // namespace frontend
@@ -80,13 +80,14 @@ bool InferenceNode::Validate(ErrorCollector* coll) const {
 
 // ------ type-inference graph building: modify pass so we can take refs -------
 
-TypeInferPass::TypeInferPass(ErrorCollector* coll)
-    : ASTVisitorContext(coll) {}
+TypeInferPass::TypeInferPass(ErrorCollector* coll, PassStats::Scope* stats)
+    : ASTVisitorContext(coll), stats_(stats) {}
 
 TypeInferPass::~TypeInferPass() {}
 
 InferenceNode* TypeInferPass::AddNode() {
     nodes_.emplace_back(new InferenceNode());
+    nodes_.back()->index_ = nodes_.size() - 1;
     return nodes_.back().get();
 }
 
@@ -293,9 +294,10 @@ void TypeInferPass::ConveyFieldRef(
         std::string field_name) {
     Location loc = n->loc;
     AggTypeResolver* resolver = aggs_.get();
+    Symbol field_sym(field_name);
     n->inputs_.push_back(
             make_pair(
-                [loc, field_name, resolver]
+                [loc, field_sym, resolver]
                 (const vector<InferredType>& args) {
                     if (!args[0].agg) {
                         InferredType conflict;
@@ -303,10 +305,10 @@ void TypeInferPass::ConveyFieldRef(
                         conflict.conflict_msg = "Field ref on non-aggregate value";
                         return conflict;
                     } else {
-                        for (auto& field : args[0].agg->fields) {
-                            if (field->ident->name == field_name) {
-                                return resolver->ResolveType(field->type.get());
-                            }
+                        const AggFieldLayout* field =
+                            resolver->FieldLayout(args[0].agg, field_sym);
+                        if (field) {
+                            return field->type;
                         }
                         InferredType conflict;
                         conflict.type = InferredType::CONFLICT;
@@ -507,6 +509,17 @@ TypeInferPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
             break;
         }
 
+        case ASTExpr::LANE: {
+            // Like a constant: an entry has at most 64 lanes (checked when
+            // the backend crosslinks the IR), so the index needs 6 bits.
+            InferredType lane_type;
+            lane_type.type = InferredType::EXPANDING_CONST;
+            lane_type.width = 6;
+            ConveyConstType(n, lane_type);
+            EnsureSimple(n);
+            break;
+        }
+
         case ASTExpr::PORTREAD:
             ConveyPort(arg_types[0], n);
             break;
@@ -678,28 +691,67 @@ bool TypeInferPass::Infer(ErrorCollector* coll) {
     // Maximum iterations to converge, per graph node.
     static const int kMaxTypeItersPerNode = 10;
 
-    // For each node, perform an update. Keep going as long as any change is
-    // observed. (Node values take from a lattice with finite height, so this
-    // process cannot continue forever.)
+    // Record reverse edges, so that a change is propagated only to the nodes
+    // that consume it.
+    long edges = 0;
+    for (auto& node : nodes_) {
+        for (auto& input_edge : node->inputs_) {
+            for (auto* input_node : input_edge.second) {
+                auto& consumers = input_node->consumers_;
+                if (consumers.empty() || consumers.back() != node.get()) {
+                    consumers.push_back(node.get());
+                    edges++;
+                }
+            }
+        }
+    }
+
+    // Solve by sweeping over the nodes in index order, as long as any change
+    // is observed. (Node values take from a lattice with finite height, so
+    // this process cannot continue forever.) A node's value depends only on
+    // its own type slots and its inputs, so a sweep updates only the nodes
+    // marked dirty by an input change since their last update: consumers
+    // later in index order are reached in the same sweep, and earlier ones
+    // in the next. This performs exactly the updates of a sweep over every
+    // node that could change anything, in the same order.
+    vector<char> dirty(nodes_.size(), 1);
     bool changed = true;
-    unsigned iters = 0;
+    long sweeps = 0;
+    long updates = 0;
     bool failed = false;
     while (changed) {
         changed = false;
-        for (auto& node : nodes_) {
-            if (node->Update()) {
-                changed = true;
-                if (node->type_.type == InferredType::CONFLICT) {
-                    failed = true;
-                    break;
+        for (unsigned i = 0; i < nodes_.size(); i++) {
+            if (!dirty[i]) continue;
+            dirty[i] = 0;
+            InferenceNode* node = nodes_[i].get();
+            updates++;
+            if (!node->Update()) continue;
+            for (auto* consumer : node->consumers_) {
+                dirty[consumer->index_] = 1;
+                if (consumer->index_ <= static_cast<int>(i)) {
+                    changed = true;
                 }
             }
+            if (node->type_.type == InferredType::CONFLICT) {
+                // Defer the rest of this sweep to the next one.
+                failed = true;
+                changed = true;
+                break;
+            }
         }
-        if (iters > kMaxTypeItersPerNode * nodes_.size()) {
+        if (sweeps > kMaxTypeItersPerNode * static_cast<long>(nodes_.size())) {
             failed = true;
             break;
         }
-        iters++;
+        sweeps++;
+    }
+
+    if (stats_) {
+        stats_->SetSize("type_nodes", nodes_.size());
+        stats_->SetSize("type_edges", edges);
+        stats_->AddCount("type_sweeps", sweeps);
+        stats_->AddCount("type_node_updates", updates);
     }
 
     // Now, for any expanding constants remaining, fix at the current width.
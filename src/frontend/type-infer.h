@@ -20,6 +20,7 @@
 #include "frontend/ast.h"
 #include "frontend/visitor.h"
 #include "frontend/agg-types.h"
+#include "common/pass-stats.h"
 
 #include <vector>
 #include <map>
@@ -37,6 +38,10 @@ namespace frontend {
 struct InferenceNode {
     Location loc;
 
+    // Position of this node in creation order. Graph building visits operands
+    // before their users, so this approximates a topological order.
+    int index_;
+
     // List of InferredType values in the AST that are unified by this node.
     std::vector<InferredType*> nodes_;
     // Current value of this node.
@@ -54,6 +59,10 @@ struct InferenceNode {
     // being called.)
     std::vector<std::pair<TransferFunc, std::vector<InferenceNode*>>> inputs_;
 
+    // Reverse edges: the nodes with this node among their inputs. Filled in
+    // by the solver.
+    std::vector<InferenceNode*> consumers_;
+
     // Validator. This is run after the type is deduced and may signal an error
     // if the type does not meet some constraint.
     typedef std::function<bool(InferredType, ErrorCollector*)> ValidatorFunc;
@@ -67,6 +76,8 @@ struct InferenceNode {
     bool Update();
 
     bool Validate(ErrorCollector* coll) const;
+
+    InferenceNode() : index_(0) {}
 };
 
 // This pass traverses the AST, building a "type inference graph". Each node in
@@ -80,7 +91,8 @@ struct InferenceNode {
 // aggregate types and type fields).
 class TypeInferPass : public ASTVisitorContext {
     public:
-        TypeInferPass(ErrorCollector* coll);
+        // If |stats| is non-null, solver work counters are recorded to it.
+        TypeInferPass(ErrorCollector* coll, PassStats::Scope* stats = nullptr);
         ~TypeInferPass();
 
     protected:
@@ -112,6 +124,7 @@ class TypeInferPass : public ASTVisitorContext {
 
     private:
         std::unique_ptr<AggTypeResolver> aggs_;
+        PassStats::Scope* stats_;
 
         // TODO: use the type inference graph to resolve aggregate types by
         // linking field refs to the field defs inside the typedefs, and adding
@@ -24,64 +24,89 @@ using namespace std;
 namespace autopiper {
 namespace frontend {
 
-struct FieldLValue {
-    ASTExpr* parent_aggregate;
-    int offset;
-
-    FieldLValue()
-        : parent_aggregate(nullptr), offset(0) {}
-    FieldLValue(ASTExpr* p, int offset_)
-        : parent_aggregate(p), offset(offset_) {}
-};
-
-static bool ComputeLValue(ErrorCollector* coll,
-        FieldLValue* ret, ASTExpr* expr, int off = 0) {
-    if (expr->op != ASTExpr::FIELD_REF) {
-        *ret = FieldLValue(expr, off);
-        return true;
-    } else {
-        // find the field in the type corresponding to the provided identifier.
-        if (!expr->ops[0]->inferred_type.agg) {
-            coll->ReportError(expr->loc, ErrorCollector::ERROR,
-                    "Field ref on non-aggregate type");
-            return false;
-        }
+namespace {
+
+ASTRef<ASTExpr> Const32(int value) {
+    ASTRef<ASTExpr> c(new ASTExpr());
+    c->op = ASTExpr::CONST;
+    c->inferred_type = InferredType(32);
+    c->constant = value;
+    return c;
+}
 
-        ASTTypeDef* t = expr->ops[0]->inferred_type.agg;
-        ASTTypeField* field = nullptr;
-        for (auto& f : t->fields) {
-            if (f->ident->name == expr->ident->name) {
-                field = f.get();
-                break;
-            }
-        }
+// Returns |value|[hi:lo].
+ASTRef<ASTExpr> Bitslice(ASTRef<ASTExpr> value, int hi, int lo) {
+    ASTRef<ASTExpr> slice(new ASTExpr());
+    slice->op = ASTExpr::BITSLICE;
+    slice->ops.push_back(move(value));
+    slice->ops.push_back(Const32(hi));
+    slice->ops.push_back(Const32(lo));
+    slice->inferred_type = InferredType(hi - lo + 1);
+    return slice;
+}
 
-        if (!field) {
-            coll->ReportError(expr->loc, ErrorCollector::ERROR,
-                    strprintf("Unknown aggregate field: %s",
-                        expr->ident->name.c_str()));
-            return false;
-        }
+// Appends |value| to the operands of |concat|, splicing in the operands of a
+// nested concatenation (e.g., a lowered aggregate literal) rather than
+// concatenating twice.
+void AppendConcatOperand(ASTExpr* concat, ASTRef<ASTExpr> value) {
+    if (value->op != ASTExpr::CONCAT) {
+        concat->ops.push_back(move(value));
+        return;
+    }
+    for (auto& op : value->ops) {
+        concat->ops.push_back(move(op));
+    }
+}
+
+}  // anonymous namespace
 
-        // Recurse with the additional bit-offset.
-        return ComputeLValue(coll, ret, expr->ops[0].get(),
-                off + field->offset);
+bool TypeLowerPass::ComputeLValue(FieldLValue* ret, ASTExpr* expr,
+                                  bool through_slices, int off) {
+    if (through_slices && expr->op == ASTExpr::BITSLICE &&
+        expr->ops[1]->op == ASTExpr::CONST &&
+        expr->ops[2]->op == ASTExpr::CONST) {
+        // x[hi:lo][h:l] is x[lo+h:lo+l].
+        return ComputeLValue(ret, expr->ops[0].get(), through_slices,
+                             off + expr->ops[2]->constant.convert_to<int>());
     }
+    if (expr->op != ASTExpr::FIELD_REF) {
+        *ret = FieldLValue(expr, off);
+        return true;
+    }
+    // find the field in the type corresponding to the provided identifier.
+    if (!expr->ops[0]->inferred_type.agg) {
+        Errors()->ReportError(expr->loc, ErrorCollector::ERROR,
+                "Field ref on non-aggregate type");
+        return false;
+    }
+    const AggFieldLayout* field =
+        aggs_->FieldLayout(expr->ops[0]->inferred_type.agg, expr->ident->name);
+    if (!field) {
+        Errors()->ReportError(expr->loc, ErrorCollector::ERROR,
+                strprintf("Unknown aggregate field: %s",
+                    expr->ident->name.c_str()));
+        return false;
+    }
+
+    // Recurse with the additional bit-offset.
+    return ComputeLValue(ret, expr->ops[0].get(), through_slices,
+                         off + field->offset);
 }
 
 // This desugars an assignment with an LHS that contains a FIELD_REF (or a
 // chain of FIELD_REFs), possibly embedded in an ARRAY_REF, into a write of the
 // full-width value, constructed as a stmtblock expression that (i) reads the
-// entire value, and (ii) uses bitslice and concatenation operators to build
-// the new value.
+// entire value, and (ii) inserts the new field value with one concatenation
+// of the bits above the field, the value, and the bits below it.
 TypeLowerPass::Result
 TypeLowerPass::ModifyASTStmtAssignPre(ASTRef<ASTStmtAssign>& node) {
     if (node->lhs->op == ASTExpr::FIELD_REF) {
-        // Follow the chain of FIELD_REFs, finding the final offset and width
+        // Follow the chain of FIELD_REFs, finding the final offset
         // corresponding to the lvalue to which we're assigning and the
         // underlying aggregate expr.
         FieldLValue lvalue;
-        if (!ComputeLValue(Errors(), &lvalue, node->lhs->ops[0].get())) {
+        if (!ComputeLValue(&lvalue, node->lhs.get(),
+                           /* through_slices = */ false)) {
             return VISIT_END;
         }
 
@@ -115,6 +140,13 @@ TypeLowerPass::ModifyASTStmtAssignPre(ASTRef<ASTStmtAssign>& node) {
         let_stmt->let->lhs = ASTGenSym(ast_, "field_rmw_temp");
         let_stmt->let->inferred_type = lvalue.parent_aggregate->inferred_type;
         let_stmt->let->rhs = CloneAST(lvalue.parent_aggregate);
+        auto temp = [&let_stmt]() {
+            ASTRef<ASTExpr> var(new ASTExpr());
+            var->op = ASTExpr::VAR;
+            var->ident = CloneAST(let_stmt->let->lhs.get());
+            var->def = let_stmt->let.get();
+            return var;
+        };
 
         unique_ptr<ASTStmt> expr_stmt(new ASTStmt());
         expr_stmt->expr.reset(new ASTStmtExpr());
@@ -128,43 +160,11 @@ TypeLowerPass::ModifyASTStmtAssignPre(ASTRef<ASTStmtAssign>& node) {
         int c = lvalue.offset - 1;
 
         if (a >= b) {
-            unique_ptr<ASTExpr> upper_bits(new ASTExpr());
-            upper_bits->op = ASTExpr::BITSLICE;
-            upper_bits->ops.emplace_back(new ASTExpr());
-            upper_bits->ops.emplace_back(new ASTExpr());
-            upper_bits->ops.emplace_back(new ASTExpr());
-            upper_bits->ops[0]->op = ASTExpr::VAR;
-            upper_bits->ops[0]->ident = CloneAST(let_stmt->let->lhs.get());
-            upper_bits->ops[0]->def = let_stmt->let.get();
-            upper_bits->ops[1]->op = ASTExpr::CONST;
-            upper_bits->ops[1]->inferred_type = InferredType(32);
-            upper_bits->ops[1]->constant = a;
-            upper_bits->ops[2]->op = ASTExpr::CONST;
-            upper_bits->ops[2]->inferred_type = InferredType(32);
-            upper_bits->ops[2]->constant = b;
-            upper_bits->inferred_type = InferredType(a - b + 1);
-            expr_stmt->expr->expr->ops.push_back(move(upper_bits));
+            expr_stmt->expr->expr->ops.push_back(Bitslice(temp(), a, b));
         }
-
         expr_stmt->expr->expr->ops.push_back(move(node->rhs));
-
         if (c >= 0) {
-            unique_ptr<ASTExpr> lower_bits(new ASTExpr());
-            lower_bits->op = ASTExpr::BITSLICE;
-            lower_bits->ops.emplace_back(new ASTExpr());
-            lower_bits->ops.emplace_back(new ASTExpr());
-            lower_bits->ops.emplace_back(new ASTExpr());
-            lower_bits->ops[0]->op = ASTExpr::VAR;
-            lower_bits->ops[0]->ident = CloneAST(let_stmt->let->lhs.get());
-            lower_bits->ops[0]->def = let_stmt->let.get();
-            lower_bits->ops[1]->op = ASTExpr::CONST;
-            lower_bits->ops[1]->inferred_type = InferredType(32);
-            lower_bits->ops[1]->constant = c;
-            lower_bits->ops[2]->op = ASTExpr::CONST;
-            lower_bits->ops[2]->inferred_type = InferredType(32);
-            lower_bits->ops[2]->constant = 0;
-            lower_bits->inferred_type = InferredType(c + 1);
-            expr_stmt->expr->expr->ops.push_back(move(lower_bits));
+            expr_stmt->expr->expr->ops.push_back(Bitslice(temp(), c, 0));
         }
 
         rhs->stmt->stmts.push_back(move(let_stmt));
@@ -181,23 +181,16 @@ TypeLowerPass::Result
 TypeLowerPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
     if (node->op == ASTExpr::FIELD_REF) {
         // Generate a bitslice operation to extract the requested field.
+        // An inner field read of a chain (a.b of a.b.c) is lowered first, so
+        // fold through its bitslice to slice the aggregate only once.
         FieldLValue lvalue;
-        if (!ComputeLValue(Errors(), &lvalue, node.get())) {
+        if (!ComputeLValue(&lvalue, node.get(), /* through_slices = */ true)) {
             return VISIT_END;
         }
 
-        unique_ptr<ASTExpr> bitslice(new ASTExpr());
-        bitslice->op = ASTExpr::BITSLICE;
-        bitslice->ops.push_back(CloneAST(lvalue.parent_aggregate));
-        bitslice->ops.emplace_back(new ASTExpr());
-        bitslice->ops.emplace_back(new ASTExpr());
-        bitslice->ops[1]->op = ASTExpr::CONST;
-        bitslice->ops[1]->inferred_type = InferredType(32);
-        bitslice->ops[1]->constant = lvalue.offset +
-            node->inferred_type.width - 1;
-        bitslice->ops[2]->op = ASTExpr::CONST;
-        bitslice->ops[2]->inferred_type = InferredType(32);
-        bitslice->ops[2]->constant = lvalue.offset;
+        ASTRef<ASTExpr> bitslice = Bitslice(
+                CloneAST(lvalue.parent_aggregate),
+                lvalue.offset + node->inferred_type.width - 1, lvalue.offset);
         bitslice->inferred_type = node->inferred_type;
 
         node = move(bitslice);
@@ -207,13 +200,8 @@ TypeLowerPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
         ASTTypeDef* t = node->inferred_type.agg;
         for (auto& field : node->ops) {
             assert(field->op == ASTExpr::AGGLITERALFIELD);
-            ASTTypeField* typefield = nullptr;
-            for (auto& f : t->fields) {
-                if (f->ident->name == field->ident->name) {
-                    typefield = f.get();
-                    break;
-                }
-            }
+            const AggFieldLayout* typefield =
+                aggs_->FieldLayout(t, field->ident->name);
             if (!typefield) {
                 Error(node.get(),
                         strprintf("Unknown aggregate field: %s",
@@ -248,7 +236,7 @@ TypeLowerPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
             }
 
             last_highest_offset = off;
-            concat->ops.push_back(move(value));
+            AppendConcatOperand(concat.get(), move(value));
         }
 
         if (last_highest_offset > 0) {
@@ -263,6 +251,20 @@ TypeLowerPass::ModifyASTExprPost(ASTRef<ASTExpr>& node) {
         concat->inferred_type = node->inferred_type;
 
         node = move(concat);
+    } else if (node->op == ASTExpr::CONCAT) {
+        // Operands are lowered first, so an aggregate literal inserted into
+        // a field is a concatenation by now.
+        bool nested = false;
+        for (auto& op : node->ops) {
+            if (op->op == ASTExpr::CONCAT) nested = true;
+        }
+        if (nested) {
+            ASTVector<ASTExpr> ops;
+            ops.swap(node->ops);
+            for (auto& op : ops) {
+                AppendConcatOperand(node.get(), move(op));
+            }
+        }
     }
 
     return VISIT_CONTINUE;
@@ -17,10 +17,12 @@
 #ifndef _AUTOPIPER_FRONTEND_TYPE_LOWER_H_
 #define _AUTOPIPER_FRONTEND_TYPE_LOWER_H_
 
+#include "frontend/agg-types.h"
 #include "frontend/ast.h"
 #include "frontend/visitor.h"
 
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 
@@ -29,7 +31,10 @@ namespace frontend {
 
 // This pass converts all aggregate-type field accesses to bitslices (for
 // reads) and bitslice/concatenation read-modify-writes (for updates). After it
-// runs, all dataflow is desuguared to flat signal values only.
+// runs, all dataflow is desuguared to flat signal values only. A chain of
+// field accesses (a.b.c) becomes one bitslice or one insert, at the offsets
+// summed along the chain, and fields are found through each type's cached
+// layout (see AggTypeResolver::FieldLayout()).
 class TypeLowerPass : public ASTVisitorContext {
     public:
         TypeLowerPass(ErrorCollector* coll)
@@ -46,11 +51,29 @@ class TypeLowerPass : public ASTVisitorContext {
 
         virtual Result ModifyASTPre(ASTRef<AST>& node) {
             ast_ = node.get();
+            aggs_.reset(new AggTypeResolver(ast_));
             return VISIT_CONTINUE;
         }
 
     private:
         AST* ast_;
+        std::unique_ptr<AggTypeResolver> aggs_;
+
+        struct FieldLValue {
+            ASTExpr* parent_aggregate;
+            int offset;
+
+            FieldLValue()
+                : parent_aggregate(nullptr), offset(0) {}
+            FieldLValue(ASTExpr* p, int offset_)
+                : parent_aggregate(p), offset(offset_) {}
+        };
+        // Follows the chain of FIELD_REFs from |expr| to the aggregate value
+        // it starts from, summing the fields' offsets. With |through_slices|,
+        // constant bitslices (inner field reads that are already lowered) are
+        // followed as well.
+        bool ComputeLValue(FieldLValue* ret, ASTExpr* expr,
+                           bool through_slices, int off = 0);
 };
 
 }  // namesapce frontend
@@ -63,7 +63,7 @@ VarScopePass::ModifyASTStmtBlockPost(ASTRef<ASTStmtBlock>& node) {
 
 VarScopePass::Result
 VarScopePass::ModifyASTStmtLetPost(ASTRef<ASTStmtLet>& node) {
-    const std::string& name = node->lhs->name;
+    Symbol name = node->lhs->name;
     if (!AddDef(name, node.get())) {
         Error(node.get(), strprintf(
                     "Multiple definition for binding '%s'",
@@ -76,7 +76,7 @@ VarScopePass::ModifyASTStmtLetPost(ASTRef<ASTStmtLet>& node) {
 VarScopePass::Result
 VarScopePass::ModifyASTExprPre(ASTRef<ASTExpr>& node) {
     if (node->op == ASTExpr::VAR) {
-        const std::string& name = node->ident->name;
+        Symbol name = node->ident->name;
         node->def = GetDef(name);
         if (!node->def) {
             Error(node.get(), strprintf(
@@ -87,7 +87,7 @@ VarScopePass::ModifyASTExprPre(ASTRef<ASTExpr>& node) {
     return VISIT_CONTINUE;
 }
 
-bool VarScopePass::AddDef(const std::string& name, ASTStmtLet* def) {
+bool VarScopePass::AddDef(Symbol name, ASTStmtLet* def) {
     assert(!scopes_.empty());
     auto& defs = scopes_.back().defs;
     if (defs.find(name) != defs.end()) {
@@ -97,7 +97,7 @@ bool VarScopePass::AddDef(const std::string& name, ASTStmtLet* def) {
     return true;
 }
 
-ASTStmtLet* VarScopePass::GetDef(const std::string& name) {
+ASTStmtLet* VarScopePass::GetDef(Symbol name) {
     for (int i = scopes_.size() - 1; i >= 0; --i) {
         auto& defs = scopes_[i].defs;
         auto it = defs.find(name);
@@ -20,9 +20,9 @@
 #include "frontend/ast.h"
 #include "frontend/visitor.h"
 
-#include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 
 namespace autopiper {
 namespace frontend {
@@ -64,7 +64,7 @@ class VarScopePass : public ASTVisitorContext {
 
     private:
         struct Scope {
-            std::map<std::string, ASTStmtLet*> defs;
+            std::unordered_map<Symbol, ASTStmtLet*> defs;
         };
 
         std::vector<Scope> scopes_;
@@ -78,9 +78,9 @@ class VarScopePass : public ASTVisitorContext {
         }
 
         // Returns null if not found.
-        ASTStmtLet* GetDef(const std::string& name);
+        ASTStmtLet* GetDef(Symbol name);
         // Returns true for success or false for failure (already defined).
-        bool AddDef(const std::string& name, ASTStmtLet* def);
+        bool AddDef(Symbol name, ASTStmtLet* def);
 };
 
 }  // namesapce frontend
@@ -0,0 +1,457 @@
+#!/usr/bin/env python3
+
+# Parallel behavior-test runner. Runs the same steps as test.py for many tests
+# at once, one test per job: compile the test with autopiper, build the
+# simulator (iverilog; with --cmodel, the C++ compiler over the generated
+# model; with --bitsliced, over the bit-sliced model, checking every lane; or
+# with --verilator, Verilator over Verilog written for it), and run it against
+# the test's '#test:' directives. A test with '#test: variant <flags>'
+# directives also runs once more per directive, compiled with those extra
+# flags, and is reported as 'test.ap [flags]'.
+#
+# Compiled outputs and simulator binaries are cached by content hash in
+# --cache-dir: a test is recompiled only if it or the autopiper binary
+# changed, and a simulator is rebuilt only if the compiled design or the
+# testbench changed. Simulation itself always runs.
+#
+# Prints a per-test summary, slowest first, of compile, simulator-build and
+# simulation time and the cycles each test drives. With --baseline, a test
+# whose compile or simulation time grew by more than --max-slowdown times the
+# time recorded by --record is reported as a regression; times under --min-ms
+# are not judged, as they are mostly noise. Cached steps are not timed.
+#
+# Tests in test.py's KNOWN_FAILURES whose outputs do not match their expected
+# values are reported as XFAIL and do not fail the run. If one passes, it is
+# reported as XPASS and does fail, so that the list is kept current.
+#
+# With --check-jobs N, each test is also compiled with -j 1 and with -j N, and
+# fails unless the two outputs are byte-identical: lowering and hierarchical
+# generation run on up to N threads, and must not let them show in the output.
+# A synthetic design of many pipes from bench/gen.py, large enough for their
+# concurrent lowering to interleave, is checked the same way.
+#
+# With --check-binary-ir, each test is also compiled through its binary IR:
+# written with --ir-binary-output and compiled by autopiper-backend, which must
+# produce the same output as the direct compile. The synthetic design is
+# checked this way too.
+#
+# With --profile DIR, each test is compiled with --profile, its simulation
+# writes a profile trace, and tools/txn_profile.py's profile of it is written
+# to DIR/<test>.profile.json. Nothing is cached then.
+#
+# Usage:
+#     run_tests.py [--cmodel | --bitsliced | --verilator] [--hierarchical] [-j N]
+#                  <autopiper binary> [test.ap ...]
+#     run_tests.py --no-cache <autopiper binary> --record times.json
+#     run_tests.py <autopiper binary> --baseline times.json
+#     run_tests.py --cmodel --profile profiles/ <autopiper binary>
+#     run_tests.py [--hierarchical] --check-jobs 4 <autopiper binary>
+#     run_tests.py [--hierarchical] --check-binary-ir <autopiper binary>
+
+import argparse
+import concurrent.futures
+import glob
+import hashlib
+import importlib.util
+import json
+import os
+import shutil
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# test.py's name clashes with Python's own 'test' package, so load it by path.
+_spec = importlib.util.spec_from_file_location(
+        'behavior_test', os.path.join(HERE, 'test.py'))
+behavior_test = importlib.util.module_from_spec(_spec)
+_spec.loader.exec_module(behavior_test)
+
+_spec = importlib.util.spec_from_file_location(
+        'gen', os.path.join(HERE, '..', '..', 'bench', 'gen.py'))
+gen = importlib.util.module_from_spec(_spec)
+_spec.loader.exec_module(gen)
+
+_spec = importlib.util.spec_from_file_location(
+        'txn_profile', os.path.join(HERE, '..', '..', 'tools', 'txn_profile.py'))
+txn_profile = importlib.util.module_from_spec(_spec)
+_spec.loader.exec_module(txn_profile)
+
+def file_hash(*paths):
+    h = hashlib.sha256()
+    for path in paths:
+        with open(path, 'rb') as f:
+            h.update(hashlib.sha256(f.read()).digest())
+    return h
+
+class Cache(object):
+    def __init__(self, path):
+        self.path = path
+        if path:
+            os.makedirs(path, exist_ok=True)
+
+    def get(self, key, name, dest):
+        if not self.path:
+            return False
+        src = os.path.join(self.path, key, name)
+        if not os.path.exists(src):
+            return False
+        shutil.copy2(src, dest)
+        return True
+
+    def put(self, key, name, src):
+        if not self.path:
+            return
+        d = os.path.join(self.path, key)
+        os.makedirs(d, exist_ok=True)
+        # Copy then rename, so that a concurrent job never sees a partial
+        # entry.
+        tmp = os.path.join(d, '.%s.%d.%d' % (name, os.getpid(),
+                                             threading.get_ident()))
+        shutil.copy2(src, tmp)
+        os.replace(tmp, os.path.join(d, name))
+
+class Result(object):
+    def __init__(self, name):
+        self.name = name
+        self.passed = False
+        self.xfail = False  # an expected failure; see KNOWN_FAILURES
+        self.message = ''
+        self.compile_s = None  # None if cached
+        self.build_s = None
+        self.sim_s = 0.0
+        self.cycles = 0
+        self.workdir = None
+
+def timed(exe, args):
+    start = time.time()
+    ret = behavior_test.run(exe, args)
+    return ret, time.time() - start
+
+# The flags that write |mode|'s output to |out|.v (and |out|.h).
+def output_args(mode, out):
+    args = ['-o', out + '.v']
+    if mode == 'cmodel':
+        args += ['--cmodel', out + '.h']
+    elif mode == 'bitsliced':
+        args += ['--bitsliced-cmodel', out + '.h']
+    elif mode == 'verilator':
+        args += ['--verilator']
+    return args
+
+# Returns an error message naming the first of |mode|'s outputs that differs
+# between |a| and |b|, else None.
+def compare_outputs(mode, a, b, what):
+    for ext in ('.v', '.h') if mode in ('cmodel', 'bitsliced') else ('.v',):
+        if file_hash(a + ext).digest() != file_hash(b + ext).digest():
+            return 'Output differs %s: %s, %s\n' % (what, a + ext, b + ext)
+    return None
+
+# Compiles |filename| with -j 1 and with -j |jobs| and returns an error
+# message if the outputs differ, else None.
+def check_jobs(filename, autopiper, mode, flags, jobs, workdir):
+    outputs = []
+    for j in (1, jobs):
+        out = os.path.join(workdir, 'jobs%d' % j)
+        args = [autopiper, '-j', str(j)] + output_args(mode, out) + flags
+        stdout, stderr, ret = behavior_test.run(autopiper, args + [filename])
+        if ret != 0:
+            return 'Error compiling DUT:\n' + stderr.decode('utf-8')
+        outputs.append(out)
+    return compare_outputs(mode, outputs[0], outputs[1],
+                           'between -j 1 and -j %d' % jobs)
+
+# Compiles |filename| directly, writing its binary IR as well, then compiles
+# that IR with |backend|, and returns an error message if the outputs differ,
+# else None.
+def check_binary_ir(filename, autopiper, backend, mode, flags, workdir):
+    direct = os.path.join(workdir, 'direct')
+    via_ir = os.path.join(workdir, 'binary-ir')
+    ir = os.path.join(workdir, 'ir.bin')
+    args = ([autopiper, '--ir-binary-output', ir] +
+            output_args(mode, direct) + flags + [filename])
+    stdout, stderr, ret = behavior_test.run(autopiper, args)
+    if ret != 0:
+        return 'Error compiling DUT:\n' + stderr.decode('utf-8')
+    args = [backend] + output_args(mode, via_ir) + flags + [ir]
+    stdout, stderr, ret = behavior_test.run(backend, args)
+    if ret != 0:
+        return 'Error compiling binary IR:\n' + stderr.decode('utf-8')
+    return compare_outputs(mode, direct, via_ir,
+                           'between direct and binary-IR compiles')
+
+# Checks the synthetic design for --check-jobs and --check-binary-ir.
+def check_design(autopiper, backend, mode, flags, jobs):
+    result = Result('gen.py design')
+    workdir = tempfile.mkdtemp(prefix='autopiper-test-')
+    result.workdir = workdir
+    design = os.path.join(workdir, 'design.ap')
+    with open(design, 'w') as f:
+        f.write(gen.gen_design(pipes=40, stages=6, if_depth=3, arrays=1,
+                               bypass_writers=2))
+    if jobs:
+        result.message = check_jobs(design, autopiper, mode, flags, jobs,
+                                    workdir)
+    if not result.message and backend:
+        result.message = check_binary_ir(design, autopiper, backend, mode,
+                                         flags, workdir)
+    if result.message:
+        return result
+    result.passed = True
+    shutil.rmtree(workdir)
+    return result
+
+def run_test(filename, variant, autopiper, autopiper_hash, mode, flags,
+             cache, profile_dir=None, jobs=None, backend=None):
+    cmodel = mode in ('cmodel', 'bitsliced')
+    result = Result(os.path.basename(filename))
+    if variant:
+        result.name += ' [%s]' % ' '.join(variant)
+    flags = flags + variant
+    t = behavior_test.TestCase(filename)
+    t.load()
+    cycles = [c.cycle for c in t.testcmds
+              if c.cmdtype == behavior_test.TestCmd.CYCLE]
+    result.cycles = max(cycles) if cycles else 0
+
+    workdir = tempfile.mkdtemp(prefix='autopiper-test-')
+    result.workdir = workdir
+    dut = os.path.join(workdir, 'dut.h' if cmodel else 'dut.v')
+    exe = os.path.join(workdir, 'test')
+    layout = os.path.join(workdir, 'profile.json') if profile_dir else None
+    trace = os.path.join(workdir, 'profile.trace') if profile_dir else None
+
+    if jobs:
+        result.message = check_jobs(filename, autopiper, mode, flags, jobs,
+                                    workdir)
+        if result.message:
+            return result
+        result.message = ''
+    if backend:
+        result.message = check_binary_ir(filename, autopiper, backend, mode,
+                                         flags, workdir)
+        if result.message:
+            return result
+        result.message = ''
+
+    # Compile, unless this binary already compiled this test.
+    h = autopiper_hash.copy()
+    h.update(mode.encode('utf-8'))
+    h.update(' '.join(flags).encode('utf-8'))
+    h.update(file_hash(filename).digest())
+    compile_key = 'dut-' + h.hexdigest()
+    dut_name = os.path.basename(dut)
+    if not cache.get(compile_key, dut_name, dut):
+        args = [autopiper, '-o', os.path.join(workdir, 'dut.v')] + flags
+        if mode == 'cmodel':
+            args += ['--cmodel', dut]
+        elif mode == 'bitsliced':
+            args += ['--bitsliced-cmodel', dut]
+        elif mode == 'verilator':
+            args += ['--verilator']
+        if layout:
+            args += ['--profile', layout]
+        (stdout, stderr, ret), result.compile_s = timed(
+                autopiper, args + [filename])
+        if ret != 0:
+            result.message = 'Error compiling DUT:\n' + stderr.decode('utf-8')
+            return result
+        cache.put(compile_key, dut_name, dut)
+
+    # Build the simulator, unless this design and testbench were built
+    # before. The testbench includes the model by a path relative to itself,
+    # so that its contents, and so its hash, do not depend on the work
+    # directory.
+    if cmodel:
+        tb = os.path.join(workdir, 'tb.cc')
+        if mode == 'bitsliced':
+            t.write_bitsliced_tb(tb, 'dut.h', trace)
+        else:
+            t.write_cmodel_tb(tb, 'dut.h', trace)
+        sim_cmd = ['c++', '-std=c++11', '-O1', '-o', exe, tb]
+    elif mode == 'verilator':
+        tb = os.path.join(workdir, 'tb.cc')
+        t.write_verilator_tb(tb)
+        objdir = os.path.join(workdir, 'obj')
+        sim_cmd = behavior_test.verilator_cmd(objdir, dut, tb)
+    else:
+        tb = os.path.join(workdir, 'tb.v')
+        t.write_tb(tb)
+        sim_cmd = ['iverilog', '-o', exe, dut, tb]
+    h = file_hash(dut, tb)
+    h.update(sim_cmd[0].encode('utf-8'))
+    sim_key = 'sim-' + h.hexdigest()
+    if not cache.get(sim_key, 'test', exe):
+        (stdout, stderr, ret), result.build_s = timed(sim_cmd[0], sim_cmd)
+        if ret != 0:
+            result.message = ('Error building test executable:\n' +
+                              stdout.decode('utf-8') + stderr.decode('utf-8'))
+            return result
+        if mode == 'verilator':
+            shutil.copy2(os.path.join(objdir, 'test'), exe)
+        cache.put(sim_key, 'test', exe)
+
+    # The Verilog takes the trace file as a plusarg.
+    sim_args = [exe]
+    if trace and not cmodel:
+        sim_args.append('+profile_trace=' + trace)
+    (stdout, stderr, ret), result.sim_s = timed(exe, sim_args)
+    if ret != 0:
+        result.message = 'Error running test.\n' + stderr.decode('utf-8')
+        return result
+    if not stdout.endswith(b'PASSED.\n'):
+        result.message = 'Test failed:\n' + stdout.decode('utf-8')
+        result.xfail = behavior_test.known_failure(filename)
+        return result
+    if behavior_test.known_failure(filename):
+        result.message = ('Unexpected pass (XPASS): remove it from '
+                          'KNOWN_FAILURES in test.py.\n')
+        return result
+
+    if profile_dir:
+        with open(os.path.join(profile_dir,
+                               result.name + '.profile.json'), 'w') as f:
+            json.dump(txn_profile.profile(layout, trace), f, indent=2)
+            f.write('\n')
+
+    result.passed = True
+    shutil.rmtree(workdir)
+    return result
+
+def seconds(s):
+    return '  cached' if s is None else '%8.3f' % s
+
+def status(r):
+    if r.passed:
+        return 'pass'
+    if r.xfail:
+        return 'XFAIL'
+    return 'XPASS' if r.message.startswith('Unexpected pass') else 'FAIL'
+
+def print_summary(results):
+    def total(r):
+        return (r.compile_s or 0.0) + (r.build_s or 0.0) + r.sim_s
+    print('%-36s %-6s %8s %8s %8s %8s' %
+          ('test', 'result', 'compile', 'build', 'sim', 'cycles'))
+    for r in sorted(results, key=total, reverse=True):
+        print('%-36s %-6s %s %s %s %8d' %
+              (r.name, status(r), seconds(r.compile_s),
+               seconds(r.build_s), '%8.3f' % r.sim_s, r.cycles))
+
+def check(results, baseline, args):
+    failures = []
+    for r in results:
+        base = baseline.get(r.name)
+        if not base:
+            continue
+        for key, s in (('compile_s', r.compile_s), ('sim_s', r.sim_s)):
+            base_s = base.get(key)
+            if s is None or not base_s or s * 1000.0 < args.min_ms:
+                continue
+            if s > base_s * args.max_slowdown:
+                failures.append('%s: %s took %.3f s, baseline %.3f s' %
+                                (r.name, key[:-2], s, base_s))
+    return failures
+
+def main():
+    parser = argparse.ArgumentParser(description='Behavior tests.')
+    parser.add_argument('autopiper', help='the autopiper binary to test')
+    parser.add_argument('tests', nargs='*',
+                        help='tests to run (default: all in this directory)')
+    parser.add_argument('--cmodel', action='store_const', dest='mode',
+                        const='cmodel', default='verilog',
+                        help='simulate with the C++ model, not iverilog')
+    parser.add_argument('--bitsliced', action='store_const', dest='mode',
+                        const='bitsliced',
+                        help='simulate with the bit-sliced C++ model')
+    parser.add_argument('--verilator', action='store_const', dest='mode',
+                        const='verilator',
+                        help='simulate Verilog written for Verilator with it')
+    parser.add_argument('--hierarchical', action='store_true',
+                        help='compile each pipe to its own Verilog module')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+                        help='tests to run at once')
+    parser.add_argument('--cache-dir',
+                        default=os.path.join(tempfile.gettempdir(),
+                                             'autopiper-test-cache'),
+                        help='where to cache compiled designs and simulators')
+    parser.add_argument('--no-cache', action='store_true')
+    parser.add_argument('--baseline',
+                        help='per-test times to compare against')
+    parser.add_argument('--record',
+                        help='write per-test times to this file')
+    parser.add_argument('--profile', metavar='DIR',
+                        help='write a transaction profile of each test here')
+    parser.add_argument('--check-jobs', type=int, metavar='N',
+                        help='check that -j N compiles each test as -j 1 does')
+    parser.add_argument('--check-binary-ir', action='store_true',
+                        help='check that autopiper-backend compiles each '
+                        'test\'s binary IR as autopiper compiles the test')
+    parser.add_argument('--max-slowdown', type=float, default=2.0)
+    parser.add_argument('--min-ms', type=float, default=100.0)
+    args = parser.parse_args()
+
+    tests = args.tests or sorted(glob.glob(os.path.join(HERE, '*.ap')))
+    runs = []
+    for filename in tests:
+        t = behavior_test.TestCase(filename)
+        t.load()
+        runs += [(filename, variant) for variant in t.variants()]
+    autopiper = os.path.abspath(args.autopiper)
+    autopiper_hash = file_hash(autopiper)
+    backend = None
+    if args.check_binary_ir:
+        backend = os.path.join(os.path.dirname(autopiper), 'autopiper-backend')
+    cache = Cache(None if args.no_cache or args.profile else args.cache_dir)
+    flags = ['--hierarchical'] if args.hierarchical else []
+    if args.profile:
+        os.makedirs(args.profile, exist_ok=True)
+
+    with concurrent.futures.ThreadPoolExecutor(
+            max_workers=max(args.jobs, 1)) as pool:
+        futures = [pool.submit(run_test, filename, variant, autopiper,
+                               autopiper_hash, args.mode, flags, cache,
+                               args.profile, args.check_jobs, backend)
+                   for filename, variant in runs]
+        if args.check_jobs or backend:
+            futures.append(pool.submit(check_design, autopiper, backend,
+                                       args.mode, flags, args.check_jobs))
+        results = [f.result() for f in futures]
+
+    for r in results:
+        if not r.passed and not r.xfail:
+            print('%s (files in %s):\n%s' % (r.name, r.workdir, r.message))
+    print_summary(results)
+    failed = [r.name for r in results if not r.passed and not r.xfail]
+    xfailed = [r.name for r in results if r.xfail]
+    print('')
+    print('%d passed, %d failed, %d expected failures' %
+          (len(results) - len(failed) - len(xfailed), len(failed),
+           len(xfailed)))
+
+    if args.record:
+        with open(args.record, 'w') as f:
+            json.dump(dict((r.name, { 'compile_s': r.compile_s,
+                                      'build_s': r.build_s,
+                                      'sim_s': r.sim_s,
+                                      'cycles': r.cycles })
+                           for r in results),
+                      f, indent=2, sort_keys=True)
+            f.write('\n')
+
+    regressions = []
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = check(results, json.load(f), args)
+        if regressions:
+            print('')
+            print('Regressions:')
+            for line in regressions:
+                print('    ' + line)
+
+    return 1 if failed or regressions else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
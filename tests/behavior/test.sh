@@ -1,5 +1,12 @@
 #!/bin/bash
 
+# Usage: test.sh [--cmodel] [autopiper binary]
+flags=
+if [ "$1" == "--cmodel" ]; then
+    flags=--cmodel
+    shift
+fi
+
 ap=../../build/src/autopiper
 if [ $# -gt 0 ]; then
     ap=$1
@@ -7,9 +14,12 @@ fi
 
 for t in *.ap; do
     echo $t
-    python3 ./test.py $ap $t
+    out=$(python3 ./test.py $flags $ap $t)
     if [ $? -ne 0 ]; then
+        echo "$out"
         exit 1
+    elif echo "$out" | grep -q XFAIL; then
+        echo "    Expected failure (XFAIL)."
     else
         echo "    Passed."
     fi
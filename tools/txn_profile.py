@@ -0,0 +1,400 @@
+#!/usr/bin/env python3
+
+# Transaction profiler. Reads the layout that autopiper writes with
+# --profile <layout.json> and the trace that the Verilog (given
+# +profile_trace=<file>) or the C++ model (given a FILE* in its
+# profile_trace field) writes while simulating it, and follows each
+# transaction through its pipe from the cycle it is spawned, or first seen,
+# to the cycle it is done, kills itself or is killed.
+#
+# The trace has a line per cycle listing the indices of the events, in the
+# layout, that occurred in the cycle. A transaction is in a stage in each
+# cycle in which the stage's 'valid' event occurs. It stays there while the
+# stage's 'stall' event occurs, moves to the next stage with logic otherwise,
+# and continues in a restart's stage when its loop's backedge restarts it.
+#
+# Writes, as JSON (-o), for each pipe: the number of transactions by how
+# they ended, a histogram of the latencies of those that finished (were done
+# or killed themselves), and per-stage valid, stall, kill and bypass-wait
+# cycles; and for each statement in the layout (a 'site': a spawn, done,
+# kill, killyounger, kill_if, bypass-ready query or loop backedge, with its
+# source location), how often it occurred, the transactions it ended or
+# killed and the cycles it cost. Prints a summary and the hottest sites.
+#
+# Usage:
+#     txn_profile.py <layout.json> <trace> [-o profile.json] [--top N]
+
+import argparse
+import collections
+import json
+import sys
+
+# How a transaction ended.
+DONE = 'done'          # a done statement
+KILL = 'kill'          # a kill statement (the end of a spawned path)
+KILLED = 'killed'      # a killyounger or kill_if
+OTHER = 'other'        # left the traced stages otherwise
+IN_FLIGHT = 'in_flight'
+
+# Sites whose event ends the transaction in their own stage, and how.
+END_SITES = { 'done': DONE, 'kill': KILL, 'kill_if': KILLED }
+
+
+class Site(object):
+    def __init__(self, event):
+        self.index = event['index']
+        self.event = event['event']
+        self.stage = event['stage']
+        self.location = event['location']
+        self.from_stage = event.get('from_stage')
+        self.target_pipe = event.get('target_pipe')
+        self.fired = 0
+        self.transactions = 0   # ended, killed or spawned
+        self.cycles = 0         # cycles waited, or lost to kills
+        self.latencies = collections.Counter()  # of spawned transactions
+
+    def json(self, pipe):
+        j = collections.OrderedDict()
+        j['location'] = self.location
+        j['event'] = self.event
+        j['process'] = pipe.process
+        j['entry'] = pipe.entry
+        j['lane'] = pipe.lane
+        j['stage'] = self.stage
+        j['fired'] = self.fired
+        j['transactions'] = self.transactions
+        j['cycles'] = self.cycles
+        if self.event == 'spawn':
+            j['latency'] = latency_summary(self.latencies)
+        return j
+
+
+class Stage(object):
+    def __init__(self, stage):
+        self.stage = stage
+        self.events = {}        # event name -> index
+        self.sites = []
+        self.counts = collections.Counter()
+
+    def fired(self, name, cycle):
+        return name in self.events and self.events[name] in cycle
+
+
+class Transaction(object):
+    def __init__(self, start, spawned_by=None):
+        self.start = start
+        self.spawned_by = spawned_by
+
+
+class Pipe(object):
+    def __init__(self, event):
+        self.process = event['process']
+        self.index = event['pipe']
+        self.entry = event['entry']
+        self.lane = event['lane']
+        self.stages = {}
+        self.ends = collections.Counter()
+        self.latencies = collections.Counter()
+        # Spawns of transactions into this pipe not yet seen in it, oldest
+        # first, as (cycle of the spawn, site).
+        self.pending_spawns = collections.deque()
+
+    def stage(self, number):
+        if number not in self.stages:
+            self.stages[number] = Stage(number)
+        return self.stages[number]
+
+    def depth(self):
+        return max(self.stages) - min(self.stages) + 1
+
+
+def latency_summary(latencies):
+    total = sum(latencies.values())
+    j = collections.OrderedDict()
+    j['count'] = total
+    if total == 0:
+        return j
+    ordered = sorted(latencies.elements())
+    j['mean'] = round(sum(ordered) / float(total), 3)
+    for name, q in (('p50', 0.5), ('p90', 0.9), ('p99', 0.99)):
+        j[name] = ordered[min(int(q * total), total - 1)]
+    j['max'] = ordered[-1]
+    j['histogram'] = collections.OrderedDict(
+            (str(k), latencies[k]) for k in sorted(latencies))
+    return j
+
+
+class Profiler(object):
+    def __init__(self, layout):
+        self.module = layout.get('module', 'main')
+        self.pipes = collections.OrderedDict()
+        for event in layout['events']:
+            key = (event['process'], event['pipe'])
+            if key not in self.pipes:
+                self.pipes[key] = Pipe(event)
+            stage = self.pipes[key].stage(event['stage'])
+            if 'location' in event:
+                stage.sites.append(Site(event))
+            else:
+                stage.events[event['event']] = event['index']
+        for pipe in self.pipes.values():
+            pipe.order = sorted(pipe.stages)
+            # The transaction in each stage as of the last cycle, and those
+            # that moved into a stage while it held another (in a skid
+            # buffer).
+            pipe.occupants = {}
+            pipe.buffered = collections.defaultdict(collections.deque)
+        self.cycles = 0
+
+    def sites(self, pipe=None):
+        for p in ([pipe] if pipe else self.pipes.values()):
+            for number in p.order:
+                for site in p.stages[number].sites:
+                    yield p, site
+
+    def killers(self, pipe, stage, cycle):
+        # The kill_ifs that kill |stage| itself, else the killyoungers in
+        # later stages of the same process (or older lanes of this stage).
+        found = [site for site in pipe.stages[stage].sites
+                 if site.event == 'kill_if' and site.index in cycle]
+        if found:
+            return found
+        for other, site in self.sites():
+            if (other.process == pipe.process and
+                site.event == 'killyounger' and site.index in cycle and
+                (site.stage > stage or
+                 (site.stage == stage and other.lane < pipe.lane))):
+                found.append(site)
+        return found
+
+    def end(self, pipe, txn, stage, cycle, last):
+        st = pipe.stages[stage]
+        how = OTHER
+        by = []
+        for site in st.sites:
+            if site.event in END_SITES and site.index in cycle:
+                how = END_SITES[site.event]
+                by = [site]
+                break
+        if how == OTHER and st.fired('kill', cycle):
+            how = KILLED
+            by = self.killers(pipe, stage, cycle)
+        latency = last - txn.start + 1
+        pipe.ends[how] += 1
+        for site in by:
+            site.transactions += 1
+            if how == KILLED:
+                site.cycles += latency
+        if how in (DONE, KILL):
+            pipe.latencies[latency] += 1
+            if txn.spawned_by:
+                txn.spawned_by.latencies[latency] += 1
+
+    def step(self, cycle, last):
+        self.cycles += 1
+        t = self.cycles
+        for pipe in self.pipes.values():
+            self.step_pipe(pipe, cycle, last, t)
+        # Spawns are linked to the transactions they start once this cycle's
+        # are known.
+        for pipe, site in self.sites():
+            if site.event == 'spawn' and site.index in cycle:
+                target = self.pipes.get((pipe.process, site.target_pipe))
+                if target is not None:
+                    target.pending_spawns.append((t, site))
+
+    def step_pipe(self, pipe, cycle, last, t):
+        old = pipe.occupants
+        new = {}
+
+        def held(stage):
+            st = pipe.stages[stage]
+            return (stage in old and st.fired('stall', last) and
+                    not st.fired('kill', last))
+
+        def leaves(stage):
+            st = pipe.stages[stage]
+            if (stage not in old or st.fired('stall', last) or
+                st.fired('kill', last)):
+                return False
+            return not any(site.event in END_SITES and site.index in last
+                           for site in st.sites)
+
+        for _, site in self.sites(pipe):
+            if (site.event == 'restart' and site.index in cycle and
+                site.from_stage in old):
+                new[site.stage] = old[site.from_stage]
+        for i, stage in enumerate(pipe.order):
+            st = pipe.stages[stage]
+            if stage in new or not st.fired('valid', cycle):
+                continue
+            prev = pipe.order[i - 1] if i > 0 else None
+            arriving = old[prev] if prev is not None and leaves(prev) else None
+            if any(arriving is txn for txn in new.values()):
+                arriving = None  # restarted instead
+            if held(stage):
+                new[stage] = old[stage]
+                if arriving is not None:
+                    pipe.buffered[stage].append(arriving)
+            elif pipe.buffered[stage]:
+                new[stage] = pipe.buffered[stage].popleft()
+                if arriving is not None:
+                    pipe.buffered[stage].append(arriving)
+            elif arriving is not None:
+                new[stage] = arriving
+            else:
+                new[stage] = self.start(pipe, t)
+
+        placed = set(id(txn) for txn in new.values())
+        for q in pipe.buffered.values():
+            placed.update(id(txn) for txn in q)
+        for stage, txn in old.items():
+            if id(txn) not in placed:
+                placed.add(id(txn))
+                self.end(pipe, txn, stage, last, t - 1)
+        pipe.occupants = new
+
+        for stage in pipe.order:
+            st = pipe.stages[stage]
+            if not st.fired('valid', cycle):
+                continue
+            for name, index in st.events.items():
+                if index in cycle:
+                    st.counts[name] += 1
+        for _, site in self.sites(pipe):
+            if site.index in cycle:
+                site.fired += 1
+                if site.event == 'bypass_wait':
+                    site.cycles += 1
+
+    def start(self, pipe, t):
+        # A transaction spawned into this pipe counts from its spawn; spawns
+        # whose transactions never reached a traced stage are dropped.
+        while pipe.pending_spawns:
+            spawned, site = pipe.pending_spawns.popleft()
+            if t - spawned <= pipe.depth():
+                site.transactions += 1
+                return Transaction(spawned, site)
+        return Transaction(t)
+
+    def finish(self, last):
+        # Transactions that ended in the last cycle are told apart from
+        # those still in flight by the events alone.
+        for pipe in self.pipes.values():
+            for stage, txn in pipe.occupants.items():
+                st = pipe.stages[stage]
+                if st.fired('kill', last) or any(
+                        site.event in END_SITES and site.index in last
+                        for site in st.sites):
+                    self.end(pipe, txn, stage, last, self.cycles)
+                else:
+                    pipe.ends[IN_FLIGHT] += 1
+            for q in pipe.buffered.values():
+                pipe.ends[IN_FLIGHT] += len(q)
+
+    def json(self, top):
+        j = collections.OrderedDict()
+        j['module'] = self.module
+        j['cycles'] = self.cycles
+        pipes = []
+        for pipe in self.pipes.values():
+            p = collections.OrderedDict()
+            p['process'] = pipe.process
+            p['pipe'] = pipe.index
+            p['entry'] = pipe.entry
+            p['lane'] = pipe.lane
+            p['transactions'] = sum(pipe.ends.values())
+            for how in (DONE, KILL, KILLED, OTHER, IN_FLIGHT):
+                p[how] = pipe.ends[how]
+            p['latency'] = latency_summary(pipe.latencies)
+            stages = []
+            for number in pipe.order:
+                s = collections.OrderedDict()
+                s['stage'] = number
+                for name in ('valid', 'stall', 'kill', 'bypass_wait',
+                             'spawn_stall'):
+                    if name in pipe.stages[number].events:
+                        s[name] = pipe.stages[number].counts[name]
+                stages.append(s)
+            p['stages'] = stages
+            pipes.append(p)
+        j['pipes'] = pipes
+        sites = [site.json(pipe) for pipe, site in self.sites()]
+        j['sites'] = sites
+        j['hot_spots'] = hot_spots(sites, top)
+        return j
+
+
+# Sites by the cycles they cost (bypass waits, or the work of the
+# transactions they killed), then by transactions killed.
+def hot_spots(sites, top):
+    costly = [s for s in sites
+              if s['cycles'] > 0 or
+              (s['event'] in ('killyounger', 'kill_if') and
+               s['transactions'] > 0)]
+    costly.sort(key=lambda s: (-s['cycles'], -s['transactions'],
+                               s['location']))
+    return costly[:top]
+
+
+def read_trace(path):
+    with open(path) as f:
+        for line in f:
+            yield set(int(i) for i in line.split())
+
+
+def profile(layout_path, trace_path, top=10):
+    with open(layout_path) as f:
+        profiler = Profiler(json.load(f))
+    last = set()
+    for cycle in read_trace(trace_path):
+        profiler.step(cycle, last)
+        last = cycle
+    profiler.finish(last)
+    return profiler.json(top)
+
+
+def print_summary(p, out=sys.stdout):
+    out.write('%d cycles\n' % p['cycles'])
+    for pipe in p['pipes']:
+        lat = pipe['latency']
+        out.write('pipe %s (lane %d): %d transactions, %d done, %d killed'
+                  % (pipe['entry'], pipe['lane'], pipe['transactions'],
+                     pipe['done'] + pipe['kill'], pipe['killed']))
+        if lat['count']:
+            out.write('; latency mean %.2f, p90 %d, max %d'
+                      % (lat['mean'], lat['p90'], lat['max']))
+        out.write('\n')
+        for s in pipe['stages']:
+            if s.get('stall') or s.get('kill') or s.get('bypass_wait'):
+                out.write('    stage %d: %d valid, %d stalled, %d killed, '
+                          '%d waiting on bypass\n'
+                          % (s['stage'], s.get('valid', 0), s.get('stall', 0),
+                             s.get('kill', 0), s.get('bypass_wait', 0)))
+    if p['hot_spots']:
+        out.write('hot spots:\n')
+        for s in p['hot_spots']:
+            out.write('    %s: %s, %d cycles, %d transactions\n'
+                      % (s['location'], s['event'], s['cycles'],
+                         s['transactions']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Transaction profiler.')
+    parser.add_argument('layout', help='layout written by --profile')
+    parser.add_argument('trace', help='trace written by the simulation')
+    parser.add_argument('-o', '--output', help='write the profile as JSON')
+    parser.add_argument('--top', type=int, default=10,
+                        help='hot spots to list')
+    args = parser.parse_args()
+
+    p = profile(args.layout, args.trace, args.top)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(p, f, indent=2)
+            f.write('\n')
+    print_summary(p)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())